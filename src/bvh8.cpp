@@ -0,0 +1,77 @@
+#include "bvh8.h"
+
+#include <cmath>
+
+namespace {
+
+float nodeArea(const LBVHNode& n) {
+    glm::vec3 d = glm::max(n.rightTop - n.leftBottom, glm::vec3(0.0f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+}  // namespace
+
+int buildBVH8(const std::vector<LBVHNode>& nodes, int root,
+    std::vector<BVH8Node>& out) {
+    // gather up to 8 binary descendants, always splitting the internal
+    // node with the largest surface so the big boxes break up first
+    int slots[8];
+    int count = 0;
+    slots[count++] = root;
+    while (count < 8) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (int i = 0; i < count; i++) {
+            const LBVHNode& n = nodes[slots[i]];
+            if (n.left < 0) {
+                continue;
+            }
+            float a = nodeArea(n);
+            if (a > bestArea) {
+                bestArea = a;
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        int split = slots[best];
+        slots[best] = nodes[split].left;
+        slots[count++] = nodes[split].right;
+    }
+
+    // reserve this node's slot before recursing so the parent lands at a
+    // stable index while the subtrees append behind it
+    int self = (int)out.size();
+    out.push_back(BVH8Node());
+
+    BVH8Node node;
+    const LBVHNode& rootNode = nodes[root];
+    glm::vec3 extent = glm::max(rootNode.rightTop - rootNode.leftBottom,
+        glm::vec3(1e-6f));
+    node.origin = rootNode.leftBottom;
+    node.scale = extent / 255.0f;
+    for (int c = 0; c < 8; c++) {
+        if (c >= count) {
+            // empty slot: inverted box, and the sentinel skips it anyway
+            node.child[c] = -1;
+            for (int a = 0; a < 3; a++) {
+                node.qlo[c][a] = 255;
+                node.qhi[c][a] = 0;
+            }
+            continue;
+        }
+        const LBVHNode& child = nodes[slots[c]];
+        for (int a = 0; a < 3; a++) {
+            // round outward so the decoded box contains the true box
+            float lo = (child.leftBottom[a] - node.origin[a]) / node.scale[a];
+            float hi = (child.rightTop[a] - node.origin[a]) / node.scale[a];
+            node.qlo[c][a] = (unsigned char)glm::clamp((int)std::floor(lo), 0, 255);
+            node.qhi[c][a] = (unsigned char)glm::clamp((int)std::ceil(hi), 0, 255);
+        }
+        node.child[c] = child.left < 0 ? -(child.triangleIndex + 2)
+            : buildBVH8(nodes, slots[c], out);
+    }
+    out[self] = node;
+    return self;
+}
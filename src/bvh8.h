@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+#include "sceneStructs.h"
+
+/**
+ * Host-side collapse of one mesh's binary BVH (GPU LBVH or offline SAH
+ * tree, same LBVHNode layout) into the 8-wide quantized BVH8Node layout.
+ * Internal binary nodes are gathered greedily - the widest surviving box
+ * splits first - until a node holds up to eight children, and each child
+ * box is quantized to 8 bits per axis against the node's own box, rounded
+ * outward so the decoded box always contains the true one. Leaves embed
+ * the triangle index directly, so the binary nodes can be dropped after
+ * conversion.
+ *
+ * @param nodes  Binary node pool, downloaded from the device builder.
+ * @param root   Absolute index of this mesh's binary root.
+ * @param out    Shared wide-node pool, appended to.
+ * @return       Absolute index of the mesh's wide root in `out`.
+ */
+int buildBVH8(const std::vector<LBVHNode>& nodes, int root,
+    std::vector<BVH8Node>& out);
@@ -0,0 +1,334 @@
+// CPU path-tracing backend driver (see cputrace.h). A .cu file like
+// microbench.cu even though every line here is host code: the shared
+// headers declare constant-bank symbols and draw from the thrust engines,
+// so routing the translation unit through nvcc's host pass compiles them
+// exactly as the device build does.
+//
+// The tracer itself is a plain megakernel loop per pixel sample: camera
+// ray, closest hit over the geom list, scatterRay, repeat to the scene's
+// trace depth. Sampling matches the GPU path (the same scrambled Sobol
+// dimension pairs per pixel), but the device-only estimator layers - next
+// event estimation, Russian roulette, adaptive sampling, textured albedo -
+// are not replicated, so CPU frames converge to the same image more slowly
+// and are compared by eye, not byte.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <thrust/random.h>
+
+#include "sceneStructs.h"
+#include "intersections.h"
+#include "interactions.h"
+#include "image.h"
+#include "pathtrace.h"
+#include "sahbvh.h"
+#include "scene.h"
+#include "cputrace.h"
+
+namespace {
+
+// tile edge in pixels; small enough that the last row of tiles does not
+// leave cores idle at the end of the frame
+const int kTileSize = 32;
+
+// everything a worker needs to trace rays, gathered once up front
+struct CpuSceneView {
+	const GeomHot* geomsHot;
+	const GeomCold* geomsCold;
+	int numGeoms;
+	const Material* materials;
+	const TriangleIdx* triangles;
+	const glm::vec4* vertices;
+	const PackedNormal* normals;
+	const LBVHNode* bvhNodes;
+	const glm::vec4* envMap;
+	int envMapWidth;
+	int envMapHeight;
+	bool motionBlur;
+};
+
+// host mirror of environmentRadiance in pathtrace.cu: the equirect texel
+// the direction maps to, or black for scenes without a map (the device
+// gradient lives behind AMBIENT_LIGHT_ENABLE in the .cu and is skipped
+// here for the same reason the other estimator layers are)
+glm::vec3 environmentRadianceHost(const CpuSceneView& sv, glm::vec3 dir) {
+	if (sv.envMapWidth == 0) {
+		return glm::vec3(0.0f);
+	}
+	dir = glm::normalize(dir);
+	float u = atan2f(dir.z, dir.x) * (0.5f / PI) + 0.5f;
+	float v = acosf(glm::clamp(dir.y, -1.0f, 1.0f)) / PI;
+	int x = glm::min((int)(u * sv.envMapWidth), sv.envMapWidth - 1);
+	int y = glm::min((int)(v * sv.envMapHeight), sv.envMapHeight - 1);
+	return glm::vec3(sv.envMap[y * sv.envMapWidth + x]);
+}
+
+// closest hit over the whole geom list; the running minimum feeds each
+// test's tMax cull. Moving geoms take the MOVING instantiation through a
+// per-geom branch: the static/moving stream split the device maintains
+// buys nothing without warps to keep coherent.
+float intersectScene(const CpuSceneView& sv, const Ray& ray, int rayMask,
+	int& hitGeom, glm::vec3& objNormal) {
+	float tMin = FLT_MAX;
+	hitGeom = -1;
+	glm::vec3 n;
+	glm::vec2 uv;
+	for (int i = 0; i < sv.numGeoms; i++) {
+		const GeomHot& g = sv.geomsHot[i];
+		if ((g.visibility & rayMask) == 0) {
+			continue;
+		}
+		bool moving = glm::dot(g.motionOffset, g.motionOffset) > 0.0f;
+		float t = -1.0f;
+		if (g.type == SPHERE) {
+			t = moving ? sphereIntersectionTest<true>(g, ray, tMin, n)
+				: sphereIntersectionTest<false>(g, ray, tMin, n);
+		}
+		else if (g.type == CUBE) {
+			t = moving ? boxIntersectionTest<true>(g, ray, tMin, n)
+				: boxIntersectionTest<false>(g, ray, tMin, n);
+		}
+		else if (g.type == MESH) {
+			t = moving ? meshIntersectionTest<true>(g, ray, tMin, n, uv,
+					sv.triangles, sv.vertices, sv.normals, sv.bvhNodes)
+				: meshIntersectionTest<false>(g, ray, tMin, n, uv,
+					sv.triangles, sv.vertices, sv.normals, sv.bvhNodes);
+		}
+		else if (g.type == PLANE) {
+			t = moving ? planeIntersectionTest<true>(g, ray, tMin, n)
+				: planeIntersectionTest<false>(g, ray, tMin, n);
+		}
+		if (t > 0.0f && t < tMin) {
+			tMin = t;
+			hitGeom = i;
+			objNormal = n;
+		}
+	}
+	return hitGeom >= 0 ? tMin : -1.0f;
+}
+
+// one full sample of one pixel: the Sobol dimension-pair layout (0 jitter,
+// 2 time, 3 + depth hemisphere) and the RNG seeding match the GPU path,
+// so a given pixel sample draws the same points either way
+glm::vec3 tracePixelSample(const CpuSceneView& sv, const Camera& cam,
+	int x, int y, int iter, int traceDepth) {
+	int pixel = x + y * cam.resolution.x;
+
+	PathSegment segment;
+	segment.ray.origin = cam.position;
+	segment.ray.time = 0.0f;
+	segment.color = glm::vec3(1.0f);
+	segment.pixelIndex = pixel;
+	segment.remainingBounces = traceDepth;
+
+	glm::vec2 xi = sobolSample2D(iter, sobolSeed(pixel, 0));
+	float fx = (float)x + xi.x - 0.5f;
+	float fy = (float)y + xi.y - 0.5f;
+	segment.ray.direction = glm::normalize(cam.view
+		- cam.right * cam.pixelLength.x * ((float)cam.cropOffset.x + fx - (float)cam.fullResolution.x * 0.5f)
+		- cam.up * cam.pixelLength.y * ((float)cam.cropOffset.y + fy - (float)cam.fullResolution.y * 0.5f)
+		);
+	if (sv.motionBlur) {
+		segment.ray.time = sobolSample2D(iter, sobolSeed(pixel, 2)).x;
+	}
+
+	for (int depth = 0; depth < traceDepth; depth++) {
+		int hitGeom;
+		glm::vec3 objNormal;
+		float t = intersectScene(sv, segment.ray,
+			depth == 0 ? VIS_CAMERA : VIS_INDIRECT, hitGeom, objNormal);
+		if (t < 0.0f) {
+			return segment.color * environmentRadianceHost(sv, segment.ray.direction);
+		}
+
+		const GeomCold& cold = sv.geomsCold[hitGeom];
+		const Material& m = sv.materials[cold.materialid];
+		if (m.emittance > 0.0f) {
+			return segment.color * m.color * m.emittance;
+		}
+
+		glm::vec3 normal = glm::normalize(cold.invTranspose * objNormal);
+		glm::vec3 point = getPointOnRay(segment.ray, t);
+		SobolState sobol = { (unsigned int)iter, sobolSeed(pixel, 3 + depth) };
+		// same seeding as makeSeededRandomEngine in pathtrace.cu
+		thrust::default_random_engine rng(
+			utilhash((1 << 31) | (depth << 22) | iter) ^ utilhash(pixel));
+		scatterRay(segment, point, normal, m, sobol, rng);
+	}
+	// depth exhausted without reaching a light
+	return glm::vec3(0.0f);
+}
+
+}  // namespace
+
+// persistent state behind the opaque cputrace.h handle: the vectors own
+// the host mirrors the scene view points into. The camera is copied at
+// create time so the hybrid scheduler's GPU loop can crop the live one
+// per tile without racing the CPU workers' ray generation.
+struct CpuTracer {
+	Camera cam;
+	int traceDepth;
+	std::vector<LBVHNode> builtNodes;
+	std::vector<GeomHot> geomsHot;
+	std::vector<GeomCold> geomsCold;
+	std::vector<PackedNormal> packedNormals;
+	CpuSceneView sv;
+};
+
+CpuTracer* cpuTracerCreate(Scene* scene) {
+	CpuTracer* tracer = new CpuTracer;
+	tracer->cam = scene->state.camera;
+	tracer->traceDepth = scene->state.traceDepth;
+
+	// meshes need a BVH the device normally builds at init; reuse the
+	// offline SAH builder (the scene compiler's) for any mesh that did not
+	// arrive with compiled nodes. Instanced geoms share a triangle range,
+	// so the range is built once and the root shared (the build permutes
+	// the triangles in place; a second pass over them would scramble the
+	// first tree's leaves).
+	if (scene->bvhNodes.empty()) {
+		std::map<int, int> rootByRange;
+		for (Geom& geom : scene->geoms) {
+			if (geom.type != MESH) {
+				continue;
+			}
+			std::map<int, int>::iterator it = rootByRange.find(geom.startIndex);
+			if (it != rootByRange.end()) {
+				geom.bvhRoot = it->second;
+				continue;
+			}
+			buildMeshSAHBVH(scene->triangles, scene->vertices, geom, tracer->builtNodes);
+			rootByRange[geom.startIndex] = geom.bvhRoot;
+		}
+	}
+
+	// the same hot/cold split pathtraceInit uploads, kept host-side
+	buildGeomSplit(scene, tracer->geomsHot, tracer->geomsCold);
+
+	// object-space vertex normals in the traversal's pool format
+	tracer->packedNormals.resize(scene->normals.size());
+	for (size_t i = 0; i < scene->normals.size(); i++) {
+		tracer->packedNormals[i] = packNormal(glm::vec3(scene->normals[i]));
+	}
+
+	CpuSceneView& sv = tracer->sv;
+	sv.geomsHot = tracer->geomsHot.data();
+	sv.geomsCold = tracer->geomsCold.data();
+	sv.numGeoms = (int)tracer->geomsHot.size();
+	sv.materials = scene->materials.data();
+	sv.triangles = scene->triangles.data();
+	sv.vertices = scene->vertices.data();
+	sv.normals = tracer->packedNormals.data();
+	sv.bvhNodes = scene->bvhNodes.empty() ? tracer->builtNodes.data() : scene->bvhNodes.data();
+	sv.envMap = scene->envMap.data();
+	sv.envMapWidth = scene->envMapWidth;
+	sv.envMapHeight = scene->envMapHeight;
+	sv.motionBlur = false;
+	for (const Geom& geom : scene->geoms) {
+		sv.motionBlur = sv.motionBlur || geom.moving;
+	}
+	return tracer;
+}
+
+void cpuTracerRenderTile(const CpuTracer* tracer, int x0, int y0, int w, int h,
+	int iterations, glm::vec3* out) {
+	for (int iter = 1; iter <= iterations; iter++) {
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				out[x + (size_t)y * w] += tracePixelSample(tracer->sv,
+					tracer->cam, x0 + x, y0 + y, iter, tracer->traceDepth);
+			}
+		}
+	}
+	float invIterations = 1.0f / (float)iterations;
+	for (int i = 0; i < w * h; i++) {
+		out[i] *= invIterations;
+	}
+}
+
+void cpuTracerDestroy(CpuTracer* tracer) {
+	delete tracer;
+}
+
+int runCpuTrace(Scene* scene) {
+	const Camera& cam = scene->state.camera;
+	const int w = cam.resolution.x;
+	const int h = cam.resolution.y;
+	const int iterations = (int)scene->state.iterations;
+
+	CpuTracer* tracer = cpuTracerCreate(scene);
+
+	int threads = (int)std::thread::hardware_concurrency();
+	if (threads < 1) {
+		threads = 1;
+	}
+	const int tilesX = (w + kTileSize - 1) / kTileSize;
+	const int tilesY = (h + kTileSize - 1) / kTileSize;
+	const int tileCount = tilesX * tilesY;
+	printf("cputrace: %dx%d, %d iterations, %d tiles on %d threads\n",
+		w, h, iterations, tileCount, threads);
+
+	std::vector<glm::vec3> accum((size_t)w * h, glm::vec3(0.0f));
+	std::atomic<int> nextTile(0);
+	std::atomic<int> tilesDone(0);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// each worker owns whole tiles for the frame's full iteration count:
+	// tiles never overlap, so the accumulation needs no locking, and a
+	// tile's geometry stays hot in cache across its iterations
+	std::vector<std::thread> workers;
+	for (int tid = 0; tid < threads; tid++) {
+		workers.push_back(std::thread([&]() {
+			for (;;) {
+				int tile = nextTile++;
+				if (tile >= tileCount) {
+					return;
+				}
+				int x0 = (tile % tilesX) * kTileSize;
+				int y0 = (tile / tilesX) * kTileSize;
+				int tw = glm::min(kTileSize, w - x0);
+				int th = glm::min(kTileSize, h - y0);
+				std::vector<glm::vec3> pixels((size_t)tw * th, glm::vec3(0.0f));
+				cpuTracerRenderTile(tracer, x0, y0, tw, th, iterations, pixels.data());
+				for (int y = 0; y < th; y++) {
+					memcpy(&accum[x0 + (size_t)(y0 + y) * w],
+						&pixels[(size_t)y * tw], tw * sizeof(glm::vec3));
+				}
+				int done = ++tilesDone;
+				if (done % glm::max(tileCount / 10, 1) == 0) {
+					printf("cputrace: %d/%d tiles\n", done, tileCount);
+				}
+			}
+		}));
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	cpuTracerDestroy(tracer);
+
+	double seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	printf("cputrace: %.1fs, %.2f Msamples/s\n", seconds,
+		(double)w * h * iterations / seconds / 1e6);
+
+	// tiles land as per-pixel means already; mirror saveImage's flip
+	image img(w, h);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			img.setPixel(w - 1 - x, y, accum[x + (size_t)y * w]);
+		}
+	}
+	std::ostringstream ss;
+	ss << scene->state.imageName << "." << iterations << "samp";
+	img.savePNG(ss.str());
+	printf("cputrace: saved %s.png\n", ss.str().c_str());
+	return 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+class Scene;
+
+// CPU path-tracing backend (--cputrace): the intersection and shading
+// primitives in intersections.h / interactions.h are __host__ __device__
+// and already run on the host (the micro-benchmarks time them there) -
+// this is the missing host driver. The frame is cut into tiles pulled
+// from a shared counter by one worker per hardware thread; each worker
+// traces its tile for the full iteration count. Orders of magnitude
+// slower than a GPU, but it turns GPU-less farm nodes into overflow
+// render capacity instead of idle ones.
+
+/**
+ * Render the scene's frame for its full iteration count on the CPU and
+ * save the image under the usual name. Touches no CUDA state at all, so
+ * it runs on machines without a GPU or driver. Returns 0 on success.
+ */
+int runCpuTrace(Scene* scene);
+
+// Persistent host tracing state (geom split, packed normals, a CPU BVH
+// per mesh, a full-frame camera copy), so callers that trace many tiles -
+// runCpuTrace's worker pool and the hybrid scheduler in distributed.cpp -
+// pay the setup once instead of per tile. Opaque: the members name types
+// private to cputrace.cu.
+struct CpuTracer;
+
+/**
+ * Build the tracing state for `scene`. Meshes without compiled BVH nodes
+ * get one built here (this permutes the scene's triangles in place, like
+ * runCpuTrace always has), so create the tracer before any concurrent
+ * reader of the triangle pool starts.
+ */
+CpuTracer* cpuTracerCreate(Scene* scene);
+
+/**
+ * Trace the w x h tile at (x0, y0) of the full frame for `iterations`
+ * samples per pixel, writing per-pixel means into `out` (w * h, row
+ * major). Pure function of the tracer: safe to call from many threads on
+ * disjoint tiles.
+ */
+void cpuTracerRenderTile(const CpuTracer* tracer, int x0, int y0, int w, int h,
+    int iterations, glm::vec3* out);
+
+void cpuTracerDestroy(CpuTracer* tracer);
@@ -0,0 +1,850 @@
+#include "distributed.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+#define CLOSE_SOCKET closesocket
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define CLOSE_SOCKET close
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cputrace.h"
+#include "image.h"
+#include "pathtrace.h"
+#include "scene.h"
+
+namespace {
+
+// tile edge in pixels; the last row/column of tiles may be narrower
+const int kTileSize = 256;
+
+// coordinator -> worker; kind 0 means the frame is done, disconnect
+struct TileMsg {
+    int kind;
+    int x0, y0, w, h;
+};
+
+// worker -> coordinator, followed by w * h packed RGB floats holding the
+// tile's per-pixel mean over state.iterations samples
+struct TileResult {
+    int x0, y0, w, h;
+};
+
+// tooling -> render service; kind 0 shuts the service down
+struct JobMsg {
+    int kind;
+    int iterations;  // 0 = the scene file's ITERATIONS
+    char scenePath[512];
+};
+
+// render service -> tooling; ok == 0 means the scene could not be read
+// and nothing follows, otherwise w * h packed RGB floats of per-pixel
+// means over `iterations` samples
+struct FrameMsg {
+    int ok;
+    int w, h;
+    int iterations;
+};
+
+bool sendAll(socket_t s, const void* data, size_t n) {
+    const char* p = (const char*)data;
+    while (n > 0) {
+        int sent = (int)send(s, p, (int)n, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+bool recvAll(socket_t s, void* data, size_t n) {
+    char* p = (char*)data;
+    while (n > 0) {
+        int got = (int)recv(s, p, (int)n, 0);
+        if (got <= 0) {
+            return false;
+        }
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+void initSockets() {
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+}
+
+// Shared coordinator state. Tiles move pending -> outstanding -> image;
+// a tile whose worker drops mid-render goes back on the pending list, so
+// worker failures cost only the lost samples.
+struct Coordinator {
+    std::mutex mtx;
+    std::condition_variable done;
+    std::vector<TileMsg> pending;
+    int outstanding = 0;
+    int fullW = 0;
+    int fullH = 0;
+    std::vector<glm::vec3> image;
+};
+
+// One thread per connected worker: hand out tiles until none are left,
+// splice finished tiles into the full image.
+void serveWorker(Coordinator* co, socket_t sock) {
+    for (;;) {
+        TileMsg tile = {};
+        {
+            std::lock_guard<std::mutex> lock(co->mtx);
+            if (!co->pending.empty()) {
+                tile = co->pending.back();
+                co->pending.pop_back();
+                co->outstanding++;
+            }
+        }
+        if (tile.kind == 0) {
+            // nothing left to hand out (tiles may still be in flight on
+            // other workers); release this worker
+            sendAll(sock, &tile, sizeof(tile));
+            break;
+        }
+
+        TileResult res;
+        std::vector<glm::vec3> pixels((size_t)tile.w * tile.h);
+        bool ok = sendAll(sock, &tile, sizeof(tile))
+            && recvAll(sock, &res, sizeof(res))
+            && recvAll(sock, pixels.data(), pixels.size() * sizeof(glm::vec3));
+
+        std::lock_guard<std::mutex> lock(co->mtx);
+        if (!ok) {
+            co->pending.push_back(tile);
+            co->outstanding--;
+            break;
+        }
+        for (int y = 0; y < tile.h; y++) {
+            memcpy(&co->image[tile.x0 + (size_t)(tile.y0 + y) * co->fullW],
+                &pixels[(size_t)y * tile.w], tile.w * sizeof(glm::vec3));
+        }
+        co->outstanding--;
+        printf("tile %d,%d %dx%d done (%d pending, %d in flight)\n",
+            tile.x0, tile.y0, tile.w, tile.h,
+            (int)co->pending.size(), co->outstanding);
+        if (co->pending.empty() && co->outstanding == 0) {
+            co->done.notify_all();
+        }
+    }
+    CLOSE_SOCKET(sock);
+}
+
+}  // namespace
+
+int runCoordinator(Scene* scene, int port) {
+    initSockets();
+
+    // static: worker threads are detached and may still poke the state
+    // while main tears down after the frame completes
+    static Coordinator co;
+    const Camera& cam = scene->state.camera;
+    co.fullW = cam.resolution.x;
+    co.fullH = cam.resolution.y;
+    co.image.assign((size_t)co.fullW * co.fullH, glm::vec3());
+    for (int y0 = 0; y0 < co.fullH; y0 += kTileSize) {
+        for (int x0 = 0; x0 < co.fullW; x0 += kTileSize) {
+            TileMsg tile;
+            tile.kind = 1;
+            tile.x0 = x0;
+            tile.y0 = y0;
+            tile.w = std::min(kTileSize, co.fullW - x0);
+            tile.h = std::min(kTileSize, co.fullH - y0);
+            co.pending.push_back(tile);
+        }
+    }
+
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET) {
+        fprintf(stderr, "coordinator: socket() failed\n");
+        return 1;
+    }
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(listener, 16) != 0) {
+        fprintf(stderr, "coordinator: cannot listen on port %d\n", port);
+        CLOSE_SOCKET(listener);
+        return 1;
+    }
+    printf("coordinator: %d tiles of %dx%d frame, port %d\n",
+        (int)co.pending.size(), co.fullW, co.fullH, port);
+
+    std::thread([listener]() {
+        for (;;) {
+            socket_t sock = accept(listener, NULL, NULL);
+            if (sock == INVALID_SOCKET) {
+                break;
+            }
+            std::thread(serveWorker, &co, sock).detach();
+        }
+    }).detach();
+
+    {
+        std::unique_lock<std::mutex> lock(co.mtx);
+        co.done.wait(lock, [] {
+            return co.pending.empty() && co.outstanding == 0;
+        });
+    }
+
+    // workers already send per-pixel means, so no samples division here;
+    // mirror saveImage's horizontal flip
+    image img(co.fullW, co.fullH);
+    for (int y = 0; y < co.fullH; y++) {
+        for (int x = 0; x < co.fullW; x++) {
+            img.setPixel(co.fullW - 1 - x, y, co.image[x + (size_t)y * co.fullW]);
+        }
+    }
+    std::ostringstream ss;
+    ss << scene->state.imageName << "." << scene->state.iterations << "samp";
+    img.savePNG(ss.str());
+    printf("coordinator: frame complete, saved %s.png\n", ss.str().c_str());
+    return 0;
+}
+
+int runTiled(Scene* scene, int tileSize) {
+    const glm::ivec2 fullResolution = scene->state.camera.resolution;
+    const int fullW = fullResolution.x;
+    const int fullH = fullResolution.y;
+    std::vector<glm::vec3> merged((size_t)fullW * fullH);
+    const int tileCount = ((fullW + tileSize - 1) / tileSize)
+        * ((fullH + tileSize - 1) / tileSize);
+    printf("tiled: %d tiles of %dx%d frame\n", tileCount, fullW, fullH);
+
+    int tilesDone = 0;
+    for (int y0 = 0; y0 < fullH; y0 += tileSize) {
+        for (int x0 = 0; x0 < fullW; x0 += tileSize) {
+            int w = std::min(tileSize, fullW - x0);
+            int h = std::min(tileSize, fullH - y0);
+
+            // same crop-window trick as the worker loop below, minus the
+            // wire: pathtraceInit re-carves the arena at tile granularity,
+            // so the path and intersection pools never exceed one tile no
+            // matter the frame size
+            Camera& cam = scene->state.camera;
+            cam.resolution = glm::ivec2(w, h);
+            cam.cropOffset = glm::ivec2(x0, y0);
+            cam.fullResolution = fullResolution;
+            scene->state.image.assign((size_t)w * h, glm::vec3());
+
+            pathtraceInit(scene);
+            for (int iter = 1; iter <= (int)scene->state.iterations; iter++) {
+                pathtrace(NULL, 0, iter);
+            }
+            downloadImage();
+
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    merged[x0 + x + (size_t)(y0 + y) * fullW] =
+                        scene->state.image[x + (size_t)y * w]
+                        / (float)scene->state.iterations;
+                }
+            }
+            tilesDone++;
+            printf("tiled: tile %d,%d %dx%d done (%d/%d)\n",
+                x0, y0, w, h, tilesDone, tileCount);
+        }
+    }
+    pathtraceFree();
+
+    // mirror saveImage's horizontal flip
+    image img(fullW, fullH);
+    for (int y = 0; y < fullH; y++) {
+        for (int x = 0; x < fullW; x++) {
+            img.setPixel(fullW - 1 - x, y, merged[x + (size_t)y * fullW]);
+        }
+    }
+    std::ostringstream ss;
+    ss << scene->state.imageName << "." << scene->state.iterations << "samp";
+    img.savePNG(ss.str());
+    printf("tiled: frame complete, saved %s.png\n", ss.str().c_str());
+    return 0;
+}
+
+int runHybrid(Scene* scene, int tileSize) {
+    const glm::ivec2 fullResolution = scene->state.camera.resolution;
+    const int fullW = fullResolution.x;
+    const int fullH = fullResolution.y;
+    const int iterations = (int)scene->state.iterations;
+    std::vector<glm::vec3> merged((size_t)fullW * fullH);
+
+    std::vector<TileMsg> pending;
+    for (int y0 = 0; y0 < fullH; y0 += tileSize) {
+        for (int x0 = 0; x0 < fullW; x0 += tileSize) {
+            TileMsg tile;
+            tile.kind = 1;
+            tile.x0 = x0;
+            tile.y0 = y0;
+            tile.w = std::min(tileSize, fullW - x0);
+            tile.h = std::min(tileSize, fullH - y0);
+            pending.push_back(tile);
+        }
+    }
+    const int tileCount = (int)pending.size();
+
+    // one core stays on the GPU driver loop; the rest trace tiles
+    int cpuThreads = (int)std::thread::hardware_concurrency() - 1;
+    if (cpuThreads < 1) {
+        cpuThreads = 1;
+    }
+    printf("hybrid: %d tiles of %dx%d frame, GPU + %d CPU workers\n",
+        tileCount, fullW, fullH, cpuThreads);
+
+    // built before the GPU loop's first pathtraceInit: creation may build
+    // host BVHs, which permutes the triangle pool the upload then reads
+    CpuTracer* tracer = cpuTracerCreate(scene);
+
+    // shared queue plus per-backend tile timings. The split ratio is not
+    // chosen up front: both sides pull from the same queue, so each
+    // backend's share converges to its observed throughput on this scene.
+    std::mutex mtx;
+    double gpuSec = 0.0, cpuSec = 0.0;
+    int gpuTiles = 0, cpuTiles = 0;
+    int tilesDone = 0;
+
+    std::vector<std::thread> workers;
+    for (int tid = 0; tid < cpuThreads; tid++) {
+        workers.push_back(std::thread([&]() {
+            for (;;) {
+                TileMsg tile;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if (pending.empty()) {
+                        return;
+                    }
+                    // tail guard: once both backends have a sample, a CPU
+                    // tile is only worth taking if it beats waiting for the
+                    // GPU to drain the whole remaining queue; otherwise this
+                    // worker retires and the GPU finishes the frame. The
+                    // worst case left is one CPU tile's latency of tail.
+                    if (cpuTiles > 0 && gpuTiles > 0
+                        && cpuSec / cpuTiles
+                            > gpuSec / gpuTiles * (double)(pending.size() + 1)) {
+                        return;
+                    }
+                    tile = pending.back();
+                    pending.pop_back();
+                }
+
+                std::chrono::steady_clock::time_point t0 =
+                    std::chrono::steady_clock::now();
+                std::vector<glm::vec3> pixels((size_t)tile.w * tile.h, glm::vec3());
+                cpuTracerRenderTile(tracer, tile.x0, tile.y0, tile.w, tile.h,
+                    iterations, pixels.data());
+                // tiles are disjoint, so the merge itself needs no lock
+                for (int y = 0; y < tile.h; y++) {
+                    memcpy(&merged[tile.x0 + (size_t)(tile.y0 + y) * fullW],
+                        &pixels[(size_t)y * tile.w], tile.w * sizeof(glm::vec3));
+                }
+
+                std::lock_guard<std::mutex> lock(mtx);
+                cpuSec += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - t0).count();
+                cpuTiles++;
+                printf("hybrid: tile %d,%d %dx%d done on CPU (%d/%d)\n",
+                    tile.x0, tile.y0, tile.w, tile.h, ++tilesDone, tileCount);
+            }
+        }));
+    }
+
+    // GPU loop on this thread: the same crop-window carving as runTiled,
+    // competing with the CPU workers for tiles off the shared queue
+    for (;;) {
+        TileMsg tile;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (pending.empty()) {
+                break;
+            }
+            tile = pending.back();
+            pending.pop_back();
+        }
+
+        std::chrono::steady_clock::time_point t0 =
+            std::chrono::steady_clock::now();
+        Camera& cam = scene->state.camera;
+        cam.resolution = glm::ivec2(tile.w, tile.h);
+        cam.cropOffset = glm::ivec2(tile.x0, tile.y0);
+        cam.fullResolution = fullResolution;
+        scene->state.image.assign((size_t)tile.w * tile.h, glm::vec3());
+
+        pathtraceInit(scene);
+        for (int iter = 1; iter <= iterations; iter++) {
+            pathtrace(NULL, 0, iter);
+        }
+        downloadImage();
+        for (int y = 0; y < tile.h; y++) {
+            for (int x = 0; x < tile.w; x++) {
+                merged[tile.x0 + x + (size_t)(tile.y0 + y) * fullW] =
+                    scene->state.image[x + (size_t)y * tile.w]
+                    / (float)iterations;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        gpuSec += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count();
+        gpuTiles++;
+        printf("hybrid: tile %d,%d %dx%d done on GPU (%d/%d)\n",
+            tile.x0, tile.y0, tile.w, tile.h, ++tilesDone, tileCount);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    pathtraceFree();
+    cpuTracerDestroy(tracer);
+    printf("hybrid: %d GPU / %d CPU tiles (%.0f%% of the frame on CPU)\n",
+        gpuTiles, cpuTiles, 100.0 * cpuTiles / tileCount);
+
+    // mirror saveImage's horizontal flip
+    image img(fullW, fullH);
+    for (int y = 0; y < fullH; y++) {
+        for (int x = 0; x < fullW; x++) {
+            img.setPixel(fullW - 1 - x, y, merged[x + (size_t)y * fullW]);
+        }
+    }
+    std::ostringstream ss;
+    ss << scene->state.imageName << "." << scene->state.iterations << "samp";
+    img.savePNG(ss.str());
+    printf("hybrid: frame complete, saved %s.png\n", ss.str().c_str());
+    return 0;
+}
+
+int runWorker(Scene* scene, const std::string& host, int port) {
+    initSockets();
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* info = NULL;
+    char portStr[16];
+    snprintf(portStr, sizeof(portStr), "%d", port);
+    if (getaddrinfo(host.c_str(), portStr, &hints, &info) != 0 || info == NULL) {
+        fprintf(stderr, "worker: cannot resolve %s\n", host.c_str());
+        return 1;
+    }
+    socket_t sock = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (sock == INVALID_SOCKET
+        || connect(sock, info->ai_addr, (int)info->ai_addrlen) != 0) {
+        fprintf(stderr, "worker: cannot connect to %s:%d\n", host.c_str(), port);
+        freeaddrinfo(info);
+        return 1;
+    }
+    freeaddrinfo(info);
+
+    const glm::ivec2 fullResolution = scene->state.camera.resolution;
+    int tilesDone = 0;
+    for (;;) {
+        TileMsg tile;
+        if (!recvAll(sock, &tile, sizeof(tile)) || tile.kind == 0) {
+            break;
+        }
+
+        // narrow the camera to the tile's crop window; pixelLength and the
+        // ray-gen centering keep using the full frame, so the tile's rays
+        // are exactly the ones the full render would have traced
+        Camera& cam = scene->state.camera;
+        cam.resolution = glm::ivec2(tile.w, tile.h);
+        cam.cropOffset = glm::ivec2(tile.x0, tile.y0);
+        cam.fullResolution = fullResolution;
+        scene->state.image.assign((size_t)tile.w * tile.h, glm::vec3());
+
+        pathtraceInit(scene);
+        for (int iter = 1; iter <= scene->state.iterations; iter++) {
+            pathtrace(NULL, 0, iter);
+        }
+        downloadImage();
+
+        TileResult res;
+        res.x0 = tile.x0;
+        res.y0 = tile.y0;
+        res.w = tile.w;
+        res.h = tile.h;
+        std::vector<glm::vec3> pixels(scene->state.image);
+        for (glm::vec3& p : pixels) {
+            p /= (float)scene->state.iterations;
+        }
+        if (!sendAll(sock, &res, sizeof(res))
+            || !sendAll(sock, pixels.data(), pixels.size() * sizeof(glm::vec3))) {
+            break;
+        }
+        tilesDone++;
+        printf("worker: tile %d,%d %dx%d rendered (%d total)\n",
+            tile.x0, tile.y0, tile.w, tile.h, tilesDone);
+    }
+
+    pathtraceFree();
+    CLOSE_SOCKET(sock);
+    return 0;
+}
+
+int runRenderService(int port, const std::vector<std::string>& warmScenes) {
+    initSockets();
+
+    // Host cache: parsed scenes (text parse, OBJ decode, weld, BVH) keyed
+    // by path, back of the vector most recently used. Device memory is the
+    // scarce side, but the arena is carved for one scene at a time, so
+    // eviction there is just pathtraceFree; host entries past the cap drop
+    // in least-recently-used order.
+    const size_t kSceneCap = 8;
+    std::vector<std::pair<std::string, Scene*>> cache;
+    Scene* deviceScene = NULL;
+
+    for (const std::string& path : warmScenes) {
+        cache.push_back(std::make_pair(path, new Scene(path)));
+        printf("service: warmed %s\n", path.c_str());
+    }
+
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET) {
+        fprintf(stderr, "service: socket() failed\n");
+        return 1;
+    }
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    // local tooling only; the coordinator is the mode that goes on the LAN
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(listener, 16) != 0) {
+        fprintf(stderr, "service: cannot listen on port %d\n", port);
+        CLOSE_SOCKET(listener);
+        return 1;
+    }
+    printf("service: listening on localhost:%d (%d scenes warm)\n",
+        port, (int)cache.size());
+
+    // one job at a time: there is one GPU and one arena, and the tooling's
+    // jobs are seconds apart, not concurrent
+    for (;;) {
+        socket_t sock = accept(listener, NULL, NULL);
+        if (sock == INVALID_SOCKET) {
+            break;
+        }
+        JobMsg job;
+        if (!recvAll(sock, &job, sizeof(job))) {
+            CLOSE_SOCKET(sock);
+            continue;
+        }
+        if (job.kind == 0) {
+            CLOSE_SOCKET(sock);
+            break;
+        }
+        job.scenePath[sizeof(job.scenePath) - 1] = '\0';
+        std::string path(job.scenePath);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+        // cache lookup; a hit moves the entry to the back (most recent)
+        Scene* jobScene = NULL;
+        for (size_t i = 0; i < cache.size(); i++) {
+            if (cache[i].first == path) {
+                jobScene = cache[i].second;
+                cache.erase(cache.begin() + i);
+                break;
+            }
+        }
+        if (jobScene == NULL) {
+            // probe before constructing: the Scene constructor treats an
+            // unreadable file as fatal, and a bad path from the tooling
+            // must not take the resident service down with it
+            std::ifstream probe(path.c_str());
+            if (!probe.good()) {
+                fprintf(stderr, "service: cannot read %s\n", path.c_str());
+                FrameMsg fail = {};
+                sendAll(sock, &fail, sizeof(fail));
+                CLOSE_SOCKET(sock);
+                continue;
+            }
+            jobScene = new Scene(path);
+        }
+        cache.push_back(std::make_pair(path, jobScene));
+        while (cache.size() > kSceneCap) {
+            printf("service: evicting %s\n", cache.front().first.c_str());
+            if (cache.front().second == deviceScene) {
+                pathtraceFree();
+                deviceScene = NULL;
+            }
+            delete cache.front().second;
+            cache.erase(cache.begin());
+        }
+
+        const bool warm = jobScene == deviceScene;
+        int iterations = job.iterations > 0 ? job.iterations
+            : (int)jobScene->state.iterations;
+        Camera& cam = jobScene->state.camera;
+        jobScene->state.image.assign(
+            (size_t)cam.resolution.x * cam.resolution.y, glm::vec3());
+
+        if (!warm) {
+            if (deviceScene != NULL) {
+                pathtraceFree();
+            }
+            pathtraceInit(jobScene);
+            deviceScene = jobScene;
+        }
+        else {
+            // device buffers still hold this scene; only the accumulator
+            // restarts, which is where the tens-of-milliseconds
+            // time-to-first-pixel for a cached scene comes from
+            pathtraceCameraReset();
+        }
+
+        for (int iter = 1; iter <= iterations; iter++) {
+            pathtrace(NULL, 0, iter);
+        }
+        downloadImage();
+
+        FrameMsg frame;
+        frame.ok = 1;
+        frame.w = cam.resolution.x;
+        frame.h = cam.resolution.y;
+        frame.iterations = iterations;
+        std::vector<glm::vec3> pixels(jobScene->state.image);
+        for (glm::vec3& p : pixels) {
+            p /= (float)iterations;
+        }
+        sendAll(sock, &frame, sizeof(frame));
+        sendAll(sock, pixels.data(), pixels.size() * sizeof(glm::vec3));
+        CLOSE_SOCKET(sock);
+
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        printf("service: %s %d iterations in %.0f ms (%s)\n",
+            path.c_str(), iterations, ms, warm ? "warm" : "cold");
+    }
+
+    if (deviceScene != NULL) {
+        pathtraceFree();
+    }
+    for (size_t i = 0; i < cache.size(); i++) {
+        delete cache[i].second;
+    }
+    CLOSE_SOCKET(listener);
+    printf("service: shut down\n");
+    return 0;
+}
+
+// ---- MJPEG preview stream ----------------------------------------------
+
+// A long headless render is otherwise a black box until its first snapshot
+// lands on disk; the stream serves the same snapshot-cadence frames over
+// HTTP so a browser tab can watch the accumulation converge. One frame is
+// encoded per publish on the snapshot thread (which already owns a host
+// copy of the accumulation and is off the render's critical path), and
+// every connected client receives that same buffer - encoding cost is per
+// frame, not per client, and zero while nobody is connected. Frames go
+// out as PNGs: multipart/x-mixed-replace replaces images regardless of
+// their type, and our stb_image_write has no JPEG encoder.
+
+// in stb.cpp's stb_image_write but not its public header; the encoder
+// behind stbi_write_png, minus the fopen
+extern "C" unsigned char* stbi_write_png_to_mem(unsigned char* pixels,
+    int stride_bytes, int x, int y, int n, int* out_len);
+
+namespace {
+
+socket_t streamListener = INVALID_SOCKET;
+std::thread streamAcceptThread;
+std::mutex streamMutex;
+std::condition_variable streamCv;
+bool streamQuit = false;
+// bumped per published frame; clients block on the CV until it moves
+long long streamFrameId = 0;
+int streamClients = 0;
+std::vector<unsigned char> streamPng;
+
+void streamServeClient(socket_t sock) {
+    // read (and ignore) whatever request line the browser sent; the
+    // endpoint serves one thing regardless of path
+    char req[1024];
+    recv(sock, req, sizeof(req), 0);
+
+    const char* header =
+        "HTTP/1.0 200 OK\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+        "\r\n";
+    if (!sendAll(sock, header, strlen(header))) {
+        CLOSE_SOCKET(sock);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        streamClients++;
+    }
+
+    long long sentFrame = 0;
+    std::vector<unsigned char> png;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(streamMutex);
+            streamCv.wait(lock, [&] {
+                return streamQuit || streamFrameId > sentFrame;
+            });
+            if (streamQuit) {
+                break;
+            }
+            sentFrame = streamFrameId;
+            png = streamPng;
+        }
+
+        char part[128];
+        int partLen = snprintf(part, sizeof(part),
+            "--frame\r\n"
+            "Content-Type: image/png\r\n"
+            "Content-Length: %d\r\n"
+            "\r\n", (int)png.size());
+        if (!sendAll(sock, part, partLen)
+            || !sendAll(sock, png.data(), png.size())
+            || !sendAll(sock, "\r\n", 2)) {
+            // tab closed; the send failure is the disconnect signal
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        streamClients--;
+    }
+    CLOSE_SOCKET(sock);
+}
+
+}  // namespace
+
+int previewStreamStart(int port) {
+    initSockets();
+
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET) {
+        fprintf(stderr, "stream: socket() failed\n");
+        return 1;
+    }
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    // monitoring endpoint for the machine running the render; tunnel it
+    // (ssh -L) rather than exposing an unauthenticated image stream
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(listener, 4) != 0) {
+        fprintf(stderr, "stream: cannot listen on port %d\n", port);
+        CLOSE_SOCKET(listener);
+        return 1;
+    }
+    printf("stream: preview on http://localhost:%d\n", port);
+
+    streamListener = listener;
+    streamAcceptThread = std::thread([listener] {
+        for (;;) {
+            socket_t sock = accept(listener, NULL, NULL);
+            if (sock == INVALID_SOCKET) {
+                // listener closed by previewStreamStop
+                return;
+            }
+            // detached: the quit flag (or the client hanging up) unwinds it
+            std::thread(streamServeClient, sock).detach();
+        }
+    });
+    return 0;
+}
+
+void previewStreamPublish(const std::vector<glm::vec3>& accum, int width,
+        int height, float samples) {
+    if (streamListener == INVALID_SOCKET) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        if (streamClients == 0) {
+            // nobody watching: skip the encode entirely
+            return;
+        }
+    }
+
+    // same normalize + horizontal mirror as convertSnapshot, so the stream
+    // matches the saved PNGs pixel for pixel
+    std::vector<unsigned char> rgb((size_t)width * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            glm::vec3 p = glm::clamp(
+                accum[x + y * width] / samples, 0.0f, 1.0f) * 255.0f;
+            size_t o = ((size_t)y * width + (width - 1 - x)) * 3;
+            rgb[o + 0] = (unsigned char)p.x;
+            rgb[o + 1] = (unsigned char)p.y;
+            rgb[o + 2] = (unsigned char)p.z;
+        }
+    }
+
+    int pngLen = 0;
+    unsigned char* png = stbi_write_png_to_mem(rgb.data(), width * 3,
+        width, height, 3, &pngLen);
+    if (png == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        streamPng.assign(png, png + pngLen);
+        streamFrameId++;
+        streamCv.notify_all();
+    }
+    free(png);
+}
+
+void previewStreamStop() {
+    if (streamListener == INVALID_SOCKET) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        streamQuit = true;
+        streamCv.notify_all();
+    }
+    // closing the listener breaks the accept loop; client threads see the
+    // quit flag (or a failed send) and close their own sockets
+    CLOSE_SOCKET(streamListener);
+    streamListener = INVALID_SOCKET;
+    streamAcceptThread.join();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class Scene;
+
+// Distributed tile rendering: a coordinator splits the frame from
+// RenderState into tiles and hands them to workers over TCP; each worker
+// runs the normal pathtrace pipeline on a crop-window camera (see
+// Camera::cropOffset) and streams the averaged tile pixels back, where
+// they are merged into one image. The wire format is raw host-order
+// structs: a same-architecture farm is assumed.
+
+/**
+ * Serve tiles of the scene's frame on `port`, merge the results and save
+ * the finished image. Runs no CUDA work itself, so a lightweight head
+ * node can coordinate. Returns when the frame is complete.
+ */
+int runCoordinator(Scene* scene, int port);
+
+/**
+ * Connect to a coordinator and render tiles until it reports the frame
+ * done. The scene file must match the coordinator's: only tile bounds
+ * travel over the wire.
+ */
+int runWorker(Scene* scene, const std::string& host, int port);
+
+/**
+ * Render the frame in tileSize^2 crop-window tiles on this process's own
+ * GPU, merging into one host image. Device state is carved per tile, so
+ * resolutions whose full-frame path buffers would not fit (8K stills)
+ * render in a fixed footprint; coordinator and workers are not involved.
+ */
+int runTiled(Scene* scene, int tileSize);
+
+/**
+ * Render the frame in tileSize^2 crop-window tiles split between this
+ * process's GPU and a pool of CPU tracing threads (cputrace.cu), merging
+ * into one host image. Both backends pull from one shared tile queue, so
+ * the GPU/CPU split converges to their observed relative throughput
+ * without a configured ratio; a tail guard retires the CPU workers once
+ * handing the remainder to the GPU is faster. The CPU tracer omits the
+ * device-only estimator layers (see cputrace.cu), so on configs where
+ * those matter the tile provenance is visible - use it where the backends
+ * agree, or for throughput over exactness.
+ */
+int runHybrid(Scene* scene, int tileSize);
+
+/**
+ * Persistent render service: stay resident on localhost:`port`, accept
+ * render jobs naming scene files, and stream the averaged frame back.
+ * Scenes stay cached after their first job - the parsed host side (text,
+ * OBJ decode, BVH) up to a small cap, and the latest scene's device state
+ * too - so a repeat render skips straight to tracing instead of paying
+ * process startup and scene load. `warmScenes` (the command line's scene
+ * files) preloads the cache before the socket opens. Runs until a
+ * shutdown job arrives.
+ */
+int runRenderService(int port, const std::vector<std::string>& warmScenes);
+
+/**
+ * Serve a motion-PNG preview of the running render on localhost:`port`
+ * (--stream in main.cpp): any browser pointed at http://localhost:PORT
+ * shows the accumulation converging at the snapshot cadence. Returns
+ * nonzero if the port cannot be bound. Loopback only - tunnel the port
+ * for remote monitoring rather than exposing the raw stream.
+ */
+int previewStreamStart(int port);
+
+/**
+ * Encode `accum` / samples as one stream frame and hand it to every
+ * connected client. Called from the snapshot worker, which already holds
+ * a host copy of the accumulation off the render's critical path; the
+ * encode is skipped entirely while no client is connected. No-op before
+ * previewStreamStart.
+ */
+void previewStreamPublish(const std::vector<glm::vec3>& accum, int width,
+    int height, float samples);
+
+/** Close the stream listener and release waiting clients. */
+void previewStreamStop();
@@ -0,0 +1,354 @@
+#include "gbuffer.h"
+
+#if GBUFFER_ENABLE
+
+#include <GL/glew.h>
+#include <cuda_runtime.h>
+#include <cuda_gl_interop.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "scene.h"
+
+static Scene* hst_scene = NULL;
+static int bufWidth = 0;
+static int bufHeight = 0;
+
+static GLuint fbo = 0;
+static GLuint positionTex = 0;
+static GLuint normalTex = 0;
+static GLuint depthRbo = 0;
+static GLuint positionPbo = 0;
+static GLuint normalPbo = 0;
+// persistent CUDA registrations of the readback buffers
+static cudaGraphicsResource_t positionRes = NULL;
+static cudaGraphicsResource_t normalRes = NULL;
+
+static GLuint program = 0;
+static GLint uViewProj = -1;
+static GLint uModel = -1;
+static GLint uNormalMat = -1;
+static GLint uMatId = -1;
+
+static GLuint vao = 0;
+static GLuint vbo[2] = { 0, 0 };
+static GLuint ibo = 0;
+// proxy geometry lives after the mesh pool in the shared index buffer
+static int cubeIndexOffset = 0;
+static int cubeIndexCount = 0;
+static int sphereIndexOffset = 0;
+static int sphereIndexCount = 0;
+static int planeIndexOffset = 0;
+static int planeIndexCount = 0;
+
+static const char* vertexSrc =
+    "#version 330 core\n"
+    "layout(location = 0) in vec4 Position;\n"
+    "layout(location = 1) in vec4 Normal;\n"
+    "uniform mat4 u_viewProj;\n"
+    "uniform mat4 u_model;\n"
+    "uniform mat3 u_normalMat;\n"
+    "out vec3 v_worldPos;\n"
+    "out vec3 v_worldNormal;\n"
+    "void main() {\n"
+    "    vec4 world = u_model * vec4(Position.xyz, 1.0);\n"
+    "    v_worldPos = world.xyz;\n"
+    "    v_worldNormal = u_normalMat * Normal.xyz;\n"
+    "    gl_Position = u_viewProj * world;\n"
+    "}\n";
+
+static const char* fragmentSrc =
+    "#version 330 core\n"
+    "in vec3 v_worldPos;\n"
+    "in vec3 v_worldNormal;\n"
+    "uniform float u_matId;\n"
+    "layout(location = 0) out vec4 out_position;\n"
+    "layout(location = 1) out vec4 out_normal;\n"
+    "void main() {\n"
+    "    out_position = vec4(v_worldPos, u_matId);\n"
+    "    out_normal = vec4(normalize(v_worldNormal), 0.0);\n"
+    "}\n";
+
+static GLuint compileShader(GLenum type, const char* src) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+    GLint status = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "G-buffer shader compile error: %s\n", log);
+        exit(EXIT_FAILURE);
+    }
+    return shader;
+}
+
+// Unit cube proxy matching the canonical [-0.5, 0.5] box, four vertices per
+// face so the normals stay flat.
+static void appendCube(std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals,
+        std::vector<GLuint>& indices) {
+    const glm::vec3 faceNormals[6] = {
+        glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0),
+        glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1),
+    };
+    cubeIndexOffset = indices.size();
+    for (int f = 0; f < 6; f++) {
+        glm::vec3 n = faceNormals[f];
+        glm::vec3 u = glm::abs(n.y) > 0.5f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+        glm::vec3 v = glm::cross(n, u);
+        u = glm::cross(v, n);
+        GLuint base = positions.size();
+        for (int c = 0; c < 4; c++) {
+            glm::vec3 corner = 0.5f * n
+                + 0.5f * (c & 1 ? u : -u)
+                + 0.5f * (c & 2 ? v : -v);
+            positions.push_back(glm::vec4(corner, 0.0f));
+            normals.push_back(glm::vec4(n, 0.0f));
+        }
+        indices.push_back(base + 0);
+        indices.push_back(base + 1);
+        indices.push_back(base + 2);
+        indices.push_back(base + 2);
+        indices.push_back(base + 1);
+        indices.push_back(base + 3);
+    }
+    cubeIndexCount = indices.size() - cubeIndexOffset;
+}
+
+// Lat-long unit sphere proxy of radius 0.5; smooth normals are just the
+// positions rescaled.
+static void appendSphere(std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals,
+        std::vector<GLuint>& indices) {
+    const int stacks = 16;
+    const int slices = 24;
+    GLuint base = positions.size();
+    for (int i = 0; i <= stacks; i++) {
+        float theta = PI * i / stacks;
+        for (int j = 0; j <= slices; j++) {
+            float phi = TWO_PI * j / slices;
+            glm::vec3 n(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            positions.push_back(glm::vec4(0.5f * n, 0.0f));
+            normals.push_back(glm::vec4(n, 0.0f));
+        }
+    }
+    sphereIndexOffset = indices.size();
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            GLuint a = base + i * (slices + 1) + j;
+            GLuint b = a + slices + 1;
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(a + 1);
+            indices.push_back(a + 1);
+            indices.push_back(b);
+            indices.push_back(b + 1);
+        }
+    }
+    sphereIndexCount = indices.size() - sphereIndexOffset;
+}
+
+// Finite quad proxy for the infinite plane, y = 0 facing +y; its extent
+// matches the raster far plane, beyond which the quad is clipped anyway.
+static void appendPlane(std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals,
+        std::vector<GLuint>& indices) {
+    const float extent = 10000.0f;
+    GLuint base = positions.size();
+    for (int c = 0; c < 4; c++) {
+        glm::vec3 corner((c & 1 ? extent : -extent), 0.0f,
+            (c & 2 ? extent : -extent));
+        positions.push_back(glm::vec4(corner, 0.0f));
+        normals.push_back(glm::vec4(0, 1, 0, 0));
+    }
+    planeIndexOffset = indices.size();
+    indices.push_back(base + 0);
+    indices.push_back(base + 1);
+    indices.push_back(base + 2);
+    indices.push_back(base + 2);
+    indices.push_back(base + 1);
+    indices.push_back(base + 3);
+    planeIndexCount = indices.size() - planeIndexOffset;
+}
+
+void gbufferInit(Scene* scene, int width, int height) {
+    hst_scene = scene;
+    bufWidth = width;
+    bufHeight = height;
+
+    // FBO with float position and normal attachments plus a depth buffer
+    glGenTextures(1, &positionTex);
+    glBindTexture(GL_TEXTURE_2D, positionTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+
+    glGenTextures(1, &normalTex);
+    glBindTexture(GL_TEXTURE_2D, normalTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+
+    glGenRenderbuffers(1, &depthRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, positionTex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRbo);
+    const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "G-buffer FBO incomplete\n");
+        exit(EXIT_FAILURE);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // CUDA-shared readback buffers, one vec4 per texel each
+    int size = width * height * sizeof(glm::vec4);
+    glGenBuffers(1, &positionPbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, positionPbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+    // registered once here; per-frame traffic is map/unmap only. CUDA
+    // only reads the raster output
+    cudaGraphicsGLRegisterBuffer(&positionRes, positionPbo,
+        cudaGraphicsRegisterFlagsReadOnly);
+    glGenBuffers(1, &normalPbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, normalPbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+    cudaGraphicsGLRegisterBuffer(&normalRes, normalPbo,
+        cudaGraphicsRegisterFlagsReadOnly);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSrc);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSrc);
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    uViewProj = glGetUniformLocation(program, "u_viewProj");
+    uModel = glGetUniformLocation(program, "u_model");
+    uNormalMat = glGetUniformLocation(program, "u_normalMat");
+    uMatId = glGetUniformLocation(program, "u_matId");
+
+    // one shared vertex/index buffer: the mesh pools verbatim, then the cube
+    // and sphere proxies appended behind them
+    std::vector<glm::vec4> positions = scene->vertices;
+    std::vector<glm::vec4> normals = scene->normals;
+    std::vector<GLuint> indices;
+    indices.reserve(3 * scene->triangles.size());
+    for (size_t i = 0; i < scene->triangles.size(); i++) {
+        indices.push_back(scene->triangles[i].x);
+        indices.push_back(scene->triangles[i].y);
+        indices.push_back(scene->triangles[i].z);
+    }
+    appendCube(positions, normals, indices);
+    appendSphere(positions, normals, indices);
+    appendPlane(positions, normals, indices);
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(2, vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec4), positions.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo[1]);
+    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec4), normals.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(1);
+    glGenBuffers(1, &ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+void gbufferRender(const Camera& cam) {
+    // the display pass assumes its program and VAO stay bound across frames
+    GLint prevProgram = 0;
+    GLint prevVao = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prevProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prevVao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, bufWidth, bufHeight);
+    glEnable(GL_DEPTH_TEST);
+    // material id -1 in the cleared position marks background texels
+    const float clearPosition[4] = { 0.0f, 0.0f, 0.0f, -1.0f };
+    const float clearNormal[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, clearPosition);
+    glClearBufferfv(GL_COLOR, 1, clearNormal);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    // same pinhole as generateRayFromCamera: pixelLength encodes the fov
+    float tanHalfFovX = 0.5f * cam.pixelLength.x * cam.resolution.x;
+    float tanHalfFovY = 0.5f * cam.pixelLength.y * cam.resolution.y;
+    glm::mat4 proj = glm::perspective(2.0f * atanf(tanHalfFovY),
+        tanHalfFovX / tanHalfFovY, 0.01f, 10000.0f);
+    glm::mat4 view = glm::lookAt(cam.position, cam.position + cam.view, cam.up);
+    glm::mat4 viewProj = proj * view;
+
+    glUseProgram(program);
+    glUniformMatrix4fv(uViewProj, 1, GL_FALSE, &viewProj[0][0]);
+    glBindVertexArray(vao);
+    for (size_t i = 0; i < hst_scene->geoms.size(); i++) {
+        const Geom& geom = hst_scene->geoms[i];
+        glm::mat3 normalMat = glm::mat3(geom.invTranspose);
+        glUniformMatrix4fv(uModel, 1, GL_FALSE, &geom.transform[0][0]);
+        glUniformMatrix3fv(uNormalMat, 1, GL_FALSE, &normalMat[0][0]);
+        glUniform1f(uMatId, (float)geom.materialid);
+        int first;
+        int count;
+        if (geom.type == CUBE) {
+            first = cubeIndexOffset;
+            count = cubeIndexCount;
+        }
+        else if (geom.type == SPHERE) {
+            first = sphereIndexOffset;
+            count = sphereIndexCount;
+        }
+        else if (geom.type == PLANE) {
+            first = planeIndexOffset;
+            count = planeIndexCount;
+        }
+        else {
+            first = 3 * geom.startIndex;
+            count = 3 * (geom.endIndex - geom.startIndex + 1);
+        }
+        glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT,
+            (const void*)(first * sizeof(GLuint)));
+    }
+    glDisable(GL_DEPTH_TEST);
+
+    // pack both attachments into the CUDA-shared buffers
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, positionPbo);
+    glReadPixels(0, 0, bufWidth, bufHeight, GL_RGBA, GL_FLOAT, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, normalPbo);
+    glReadPixels(0, 0, bufWidth, bufHeight, GL_RGBA, GL_FLOAT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glBindVertexArray(prevVao);
+    glUseProgram(prevProgram);
+}
+
+void gbufferMap(glm::vec4** positions, glm::vec4** normals) {
+    cudaGraphicsResource_t res[2] = { positionRes, normalRes };
+    size_t size = 0;
+    cudaGraphicsMapResources(2, res);
+    cudaGraphicsResourceGetMappedPointer((void**)positions, &size, positionRes);
+    cudaGraphicsResourceGetMappedPointer((void**)normals, &size, normalRes);
+}
+
+void gbufferUnmap() {
+    cudaGraphicsResource_t res[2] = { positionRes, normalRes };
+    cudaGraphicsUnmapResources(2, res);
+}
+
+#endif // GBUFFER_ENABLE
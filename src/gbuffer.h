@@ -0,0 +1,44 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "sceneStructs.h"
+
+class Scene;
+
+// Rasterize primary visibility into a world-position/normal/material G-buffer
+// (meshes directly, spheres and cubes as proxy geometry) and start the bounce
+// loop from it instead of ray tracing depth 0. Primary rays are the most
+// coherent part of the trace and the raster pass re-runs only when the camera
+// moves. Incompatible with ANTIALIASING, DEPTH_OF_FIELD_ENABLE and
+// MOTION_BLUR_ENABLE, which all perturb primary rays per iteration.
+#define GBUFFER_ENABLE 0
+
+/**
+ * Build the G-buffer FBO, shaders and scene geometry buffers, and register
+ * the readback buffers with CUDA. Requires a current GL context; call after
+ * init() in main.
+ */
+void gbufferInit(Scene* scene, int width, int height);
+
+/**
+ * Rasterize the scene for the given camera and pack the position and normal
+ * attachments into the CUDA-registered readback buffers. Call whenever the
+ * camera changes, while the buffers are not mapped by CUDA.
+ */
+void gbufferRender(const Camera& cam);
+
+/**
+ * Map the packed attachments for CUDA and return their device pointers.
+ * Each texel is a glm::vec4: position xyz + material id in w (-1 for
+ * background), and normal xyz. Registration is persistent (done in
+ * gbufferInit); this only maps. Pair with gbufferUnmap before the next
+ * gbufferRender touches the buffers.
+ */
+void gbufferMap(glm::vec4** positions, glm::vec4** normals);
+void gbufferUnmap();
+
+/**
+ * Hand the mapped G-buffer device pointers to the path tracer for the next
+ * pathtrace() call. Implemented in pathtrace.cu.
+ */
+void pathtraceSetGBuffer(glm::vec4* positions, glm::vec4* normals);
@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <stb_image_write.h>
 
 #include "image.h"
@@ -21,14 +26,31 @@ void image::setPixel(int x, int y, const glm::vec3 &pixel) {
 
 void image::savePNG(const std::string &baseFilename) {
     unsigned char *bytes = new unsigned char[3 * xSize * ySize];
-    for (int y = 0; y < ySize; y++) {
-        for (int x = 0; x < xSize; x++) { 
-            int i = y * xSize + x;
-            glm::vec3 pix = glm::clamp(pixels[i], glm::vec3(), glm::vec3(1)) * 255.f;
-            bytes[3 * i + 0] = (unsigned char) pix.x;
-            bytes[3 * i + 1] = (unsigned char) pix.y;
-            bytes[3 * i + 2] = (unsigned char) pix.z;
+    // the byte conversion is row-independent and memory-bound, so split it
+    // across hardware threads; the encode itself stays serial inside stb
+    int nThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    int rowsPerThread = (ySize + nThreads - 1) / nThreads;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < nThreads; t++) {
+        int y0 = t * rowsPerThread;
+        int y1 = std::min(ySize, y0 + rowsPerThread);
+        if (y0 >= y1) {
+            break;
         }
+        workers.emplace_back([this, bytes, y0, y1]() {
+            for (int y = y0; y < y1; y++) {
+                for (int x = 0; x < xSize; x++) {
+                    int i = y * xSize + x;
+                    glm::vec3 pix = glm::clamp(pixels[i], glm::vec3(), glm::vec3(1)) * 255.f;
+                    bytes[3 * i + 0] = (unsigned char) pix.x;
+                    bytes[3 * i + 1] = (unsigned char) pix.y;
+                    bytes[3 * i + 2] = (unsigned char) pix.z;
+                }
+            }
+        });
+    }
+    for (std::thread &w : workers) {
+        w.join();
     }
 
     std::string filename = baseFilename + ".png";
@@ -43,3 +65,266 @@ void image::saveHDR(const std::string &baseFilename) {
     stbi_write_hdr(filename.c_str(), xSize, ySize, 3, (const float *) pixels);
     std::cout << "Saved " + filename + "." << std::endl;
 }
+
+// ---- minimal scanline OpenEXR writer ------------------------------------
+// Self-contained: there is no OpenEXR or zlib in the tree, so the chunks
+// use the format's RLE codec - the same byte-reorder + delta-predictor
+// preprocessing as ZIP, then run lengths - which every EXR reader
+// decodes. One scanline per chunk (what the RLE flavor specifies), so
+// the compression fans out across hardware threads the same way the
+// savePNG conversion does; only the final file write is serial.
+
+namespace {
+
+// IEEE half, round to nearest even; out-of-range values clamp to +/-inf
+// and NaN stays NaN, so a stray firefly cannot corrupt the file
+unsigned short floatToHalf(float f) {
+    unsigned int x;
+    std::memcpy(&x, &f, sizeof(x));
+    unsigned int sign = (x >> 16) & 0x8000u;
+    x &= 0x7fffffffu;
+    if (x >= 0x47800000u) {
+        return (unsigned short)(x > 0x7f800000u ? sign | 0x7e00u : sign | 0x7c00u);
+    }
+    if (x < 0x38800000u) {
+        // half subnormal (or zero); shift the implicit-one mantissa down
+        unsigned int shift = 126u - (x >> 23);
+        if (shift > 24u) {
+            return (unsigned short)sign;
+        }
+        unsigned int m = (x & 0x7fffffu) | 0x800000u;
+        unsigned int h = m >> shift;
+        h += (m >> (shift - 1u)) & 1u;
+        return (unsigned short)(sign | h);
+    }
+    unsigned int h = sign | (((x >> 23) - 112u) << 10) | ((x >> 13) & 0x3ffu);
+    // round to nearest even on the 13 dropped bits; a mantissa carry
+    // rolls into the exponent, which is exactly what rounding up wants
+    unsigned int r = x & 0x1fffu;
+    if (r > 0x1000u || (r == 0x1000u && (h & 1u))) {
+        h++;
+    }
+    return (unsigned short)h;
+}
+
+// ZIP/RLE shared preprocessing: interleave the bytes into two planes and
+// delta-encode, which turns slowly varying halves into long byte runs
+void reorderAndPredict(const unsigned char* src, int n, unsigned char* dst) {
+    unsigned char* t1 = dst;
+    unsigned char* t2 = dst + (n + 1) / 2;
+    for (int i = 0; i < n; i += 2) {
+        *t1++ = src[i];
+    }
+    for (int i = 1; i < n; i += 2) {
+        *t2++ = src[i];
+    }
+    int prev = dst[0];
+    for (int i = 1; i < n; i++) {
+        int d = (int)dst[i] - prev + (128 + 256);
+        prev = dst[i];
+        dst[i] = (unsigned char)d;
+    }
+}
+
+// EXR run-length coding: a non-negative count c means c+1 copies of the
+// next byte, a negative count -n means n literal bytes follow. Worst
+// case grows by one control byte per 127 literals; callers size for 2n.
+int rleCompress(const unsigned char* in, int n, signed char* out) {
+    int o = 0;
+    int i = 0;
+    while (i < n) {
+        int run = 1;
+        while (i + run < n && in[i + run] == in[i] && run < 128) {
+            run++;
+        }
+        if (run >= 3) {
+            out[o++] = (signed char)(run - 1);
+            out[o++] = (signed char)in[i];
+            i += run;
+        }
+        else {
+            int start = i;
+            int lit = 0;
+            while (i < n && lit < 127) {
+                if (i + 2 < n && in[i] == in[i + 1] && in[i] == in[i + 2]) {
+                    break;
+                }
+                i++;
+                lit++;
+            }
+            out[o++] = (signed char)(-lit);
+            std::memcpy(out + o, in + start, lit);
+            o += lit;
+        }
+    }
+    return o;
+}
+
+// little-endian byte appenders for the header (every CUDA host this
+// builds on is little-endian, same assumption stb makes)
+void putBytes(std::vector<unsigned char>& out, const void* p, size_t n) {
+    const unsigned char* b = (const unsigned char*)p;
+    out.insert(out.end(), b, b + n);
+}
+
+void putInt(std::vector<unsigned char>& out, int v) {
+    putBytes(out, &v, sizeof(v));
+}
+
+void putFloat(std::vector<unsigned char>& out, float v) {
+    putBytes(out, &v, sizeof(v));
+}
+
+void putString(std::vector<unsigned char>& out, const char* s) {
+    putBytes(out, s, std::strlen(s) + 1);
+}
+
+void putAttribute(std::vector<unsigned char>& out, const char* name,
+        const char* type, int size) {
+    putString(out, name);
+    putString(out, type);
+    putInt(out, size);
+}
+
+// one half-float channel of the file: the source image and which of its
+// three components this channel reads
+struct ExrChannel {
+    std::string name;
+    const glm::vec3* pixels;
+    int component;
+};
+
+bool channelNameLess(const ExrChannel& a, const ExrChannel& b) {
+    return a.name < b.name;
+}
+
+}  // namespace
+
+void image::saveEXR(const std::string &baseFilename,
+        const std::vector<Layer> &aovs) {
+    // base image as R/G/B, each AOV as "<name>.R" etc.; the format
+    // requires the channel list sorted by name
+    const char* rgb[3] = { "R", "G", "B" };
+    std::vector<ExrChannel> channels;
+    for (int c = 0; c < 3; c++) {
+        ExrChannel ch = { rgb[c], pixels, c };
+        channels.push_back(ch);
+    }
+    for (size_t i = 0; i < aovs.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            ExrChannel ch = { aovs[i].name + "." + rgb[c],
+                aovs[i].img->pixels, c };
+            channels.push_back(ch);
+        }
+    }
+    std::sort(channels.begin(), channels.end(), channelNameLess);
+    int nChannels = (int)channels.size();
+
+    // per channel: name + type/pLinear/sampling ints, plus the list's
+    // terminating null byte
+    int chlistSize = 1;
+    for (int c = 0; c < nChannels; c++) {
+        chlistSize += (int)channels[c].name.size() + 1 + 16;
+    }
+
+    std::vector<unsigned char> header;
+    putAttribute(header, "channels", "chlist", chlistSize);
+    for (int c = 0; c < nChannels; c++) {
+        putString(header, channels[c].name.c_str());
+        putInt(header, 1);  // HALF
+        putInt(header, 0);  // pLinear + reserved
+        putInt(header, 1);  // xSampling
+        putInt(header, 1);  // ySampling
+    }
+    header.push_back(0);
+    putAttribute(header, "compression", "compression", 1);
+    header.push_back(1);  // RLE
+    putAttribute(header, "dataWindow", "box2i", 16);
+    putInt(header, 0);
+    putInt(header, 0);
+    putInt(header, xSize - 1);
+    putInt(header, ySize - 1);
+    putAttribute(header, "displayWindow", "box2i", 16);
+    putInt(header, 0);
+    putInt(header, 0);
+    putInt(header, xSize - 1);
+    putInt(header, ySize - 1);
+    putAttribute(header, "lineOrder", "lineOrder", 1);
+    header.push_back(0);  // increasing Y
+    putAttribute(header, "pixelAspectRatio", "float", 4);
+    putFloat(header, 1.0f);
+    putAttribute(header, "screenWindowCenter", "v2f", 8);
+    putFloat(header, 0.0f);
+    putFloat(header, 0.0f);
+    putAttribute(header, "screenWindowWidth", "float", 4);
+    putFloat(header, 1.0f);
+    header.push_back(0);  // end of header
+
+    // compress every scanline chunk in parallel; a chunk that does not
+    // shrink is stored raw, which readers detect by its size
+    const int rawBytes = nChannels * xSize * 2;
+    std::vector<std::vector<unsigned char> > chunks(ySize);
+    int nThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    int rowsPerThread = (ySize + nThreads - 1) / nThreads;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < nThreads; t++) {
+        int y0 = t * rowsPerThread;
+        int y1 = std::min(ySize, y0 + rowsPerThread);
+        if (y0 >= y1) {
+            break;
+        }
+        workers.emplace_back([this, &channels, &chunks, rawBytes, y0, y1]() {
+            std::vector<unsigned char> raw(rawBytes);
+            std::vector<unsigned char> predicted(rawBytes);
+            std::vector<signed char> packed(2 * rawBytes);
+            for (int y = y0; y < y1; y++) {
+                unsigned char* out = raw.data();
+                for (size_t c = 0; c < channels.size(); c++) {
+                    const glm::vec3* row = channels[c].pixels + (size_t)y * xSize;
+                    int component = channels[c].component;
+                    for (int x = 0; x < xSize; x++) {
+                        unsigned short h = floatToHalf(row[x][component]);
+                        std::memcpy(out, &h, 2);
+                        out += 2;
+                    }
+                }
+                reorderAndPredict(raw.data(), rawBytes, predicted.data());
+                int packedBytes = rleCompress(predicted.data(), rawBytes,
+                    packed.data());
+                if (packedBytes < rawBytes) {
+                    chunks[y].assign(packed.data(), packed.data() + packedBytes);
+                }
+                else {
+                    chunks[y].assign(raw.data(), raw.data() + rawBytes);
+                }
+            }
+        });
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+
+    std::string filename = baseFilename + ".exr";
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    if (!file) {
+        std::cout << "Could not open " << filename << " for writing." << std::endl;
+        return;
+    }
+    const unsigned char magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+    file.write((const char*)magic, sizeof(magic));
+    file.write((const char*)header.data(), header.size());
+    // scanline offset table, then the chunks it points at
+    unsigned long long offset =
+        sizeof(magic) + header.size() + (unsigned long long)8 * ySize;
+    for (int y = 0; y < ySize; y++) {
+        file.write((const char*)&offset, 8);
+        offset += 8 + chunks[y].size();
+    }
+    for (int y = 0; y < ySize; y++) {
+        int dataSize = (int)chunks[y].size();
+        file.write((const char*)&y, 4);
+        file.write((const char*)&dataSize, 4);
+        file.write((const char*)chunks[y].data(), dataSize);
+    }
+    std::cout << "Saved " << filename << "." << std::endl;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <string>
+#include <vector>
 
 using namespace std;
 
@@ -11,9 +13,21 @@ private:
     glm::vec3 *pixels;
 
 public:
+    /**
+     * Named AOV layer for saveEXR: the layer's channels are written as
+     * "<name>.R/G/B" next to the base image's R/G/B. The source must match
+     * the base image's resolution and outlive the call.
+     */
+    struct Layer {
+        std::string name;
+        const image* img;
+    };
+
     image(int x, int y);
     ~image();
     void setPixel(int x, int y, const glm::vec3 &pixel);
     void savePNG(const std::string &baseFilename);
     void saveHDR(const std::string &baseFilename);
+    void saveEXR(const std::string &baseFilename,
+        const std::vector<Layer> &aovs = std::vector<Layer>());
 };
@@ -2,35 +2,124 @@
 
 #include "intersections.h"
 
-#define STRATIFIED_SAMPLING 0
-#define SAMPLE_SIZE 10
+// draw the camera jitter and the per-bounce hemisphere samples from a
+// hash-scrambled Sobol (0,2)-sequence indexed by the iteration instead of
+// the hashed pseudo-random engine; the stratification typically reaches a
+// given noise level in a fraction of the iterations
+#define SOBOL_SAMPLING 1
+
+// overlay the first iterations' Sobol points with a per-pixel toroidal
+// shift drawn from a tiled blue-noise mask (built once at startup by
+// pathtraceInit). The shift re-phases each pixel's sequence so the
+// residual error between neighbours is high-frequency instead of blotchy,
+// which reads as far less noise in the interactive window; past
+// BLUE_NOISE_ITERS the accumulated average dominates and the shift stops
+// mattering. A uniform toroidal shift keeps every sequence individually
+// stratified, so nothing is biased.
+#define BLUE_NOISE_ENABLE 1
+// iterations that get the shift, and the mask tile's edge length
+#define BLUE_NOISE_ITERS 64
+#define BLUE_NOISE_TILE 64
+
+// run the Fresnel / Schlick shading math entirely in single precision with
+// the pow() folded into fused multiplies; consumer GPUs retire doubles at
+// 1/32 the float rate, so the double path exists only to A/B image output
+#define FAST_SHADING_MATH 1
+
+// degraded shading tier for dim paths: once a path's accumulated
+// throughput has decayed below LOW_THROUGHPUT_LUMINANCE, each further
+// bounce moves the image by at most that much of one sample, so
+// scatterRay drops to cheaper math there - Schlick in place of the exact
+// Fresnel split, a perfect mirror in place of the GGX visible-normal
+// lobe, and a plain hashed-RNG hemisphere draw in place of the Sobol /
+// blue-noise bookkeeping (stratification earns nothing on a contribution
+// this small). The shortcuts are biased, but the bias is bounded by the
+// threshold and lands below the accumulation's own noise floor; set the
+// threshold to 0 to make every bounce take the full-quality path
+#define LOW_THROUGHPUT_SHADING 1
+#define LOW_THROUGHPUT_LUMINANCE 0.05f
+
+__host__ __device__ inline unsigned int reverseBits32(unsigned int n) {
+#ifdef __CUDA_ARCH__
+    return __brev(n);
+#else
+    n = (n << 16) | (n >> 16);
+    n = ((n & 0x00ff00ffu) << 8) | ((n & 0xff00ff00u) >> 8);
+    n = ((n & 0x0f0f0f0fu) << 4) | ((n & 0xf0f0f0f0u) >> 4);
+    n = ((n & 0x33333333u) << 2) | ((n & 0xccccccccu) >> 2);
+    n = ((n & 0x55555555u) << 1) | ((n & 0xaaaaaaaau) >> 1);
+    return n;
+#endif
+}
 
-// CHECKITOUT
 /**
- * Computes a cosine-weighted random direction in a hemisphere.
- * Used for diffuse lighting.
+ * Owen-style scrambling of one 32-bit sample value (Laine-Karras hash on the
+ * bit-reversed value). Each bit is permuted based only on the bits above it,
+ * so the sequence's stratification survives while the structured aliasing of
+ * the raw Sobol points does not.
  */
-__host__ __device__
-glm::vec3 calculateRandomDirectionInHemisphere(
-        glm::vec3 normal, thrust::default_random_engine &rng) {
-    thrust::uniform_real_distribution<float> u01(0, 1);
+__host__ __device__ inline unsigned int nestedUniformScramble(unsigned int x, unsigned int seed) {
+    x = reverseBits32(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits32(x);
+}
 
+/**
+ * Point `index` of the scrambled Sobol (0,2)-sequence. The first dimension
+ * is the base-2 radical inverse, the second uses the standard Sobol'
+ * direction numbers; `seed` picks the scrambling, so distinct seeds give
+ * decorrelated but individually well-stratified sequences.
+ */
+__host__ __device__ inline glm::vec2 sobolSample2D(unsigned int index, unsigned int seed) {
+    unsigned int a = reverseBits32(index);
+    unsigned int b = 0;
+    unsigned int v = 1u << 31;
+    for (unsigned int i = index; i; i >>= 1, v ^= v >> 1) {
+        if (i & 1) {
+            b ^= v;
+        }
+    }
+    a = nestedUniformScramble(a, seed);
+    b = nestedUniformScramble(b, utilhash(seed));
+    return glm::vec2(a, b) * 2.3283064365386963e-10f;  // 2^-32
+}
 
-#if STRATIFIED_SAMPLING
-    int x = u01(rng) * SAMPLE_SIZE;
-    int y = u01(rng) * SAMPLE_SIZE;
+/**
+ * Scramble seed for one (pixel, dimension pair) combination. Pairs 0-2 are
+ * the camera jitter, lens and time samples; pair 3 + depth is the hemisphere
+ * sample of that bounce.
+ */
+__host__ __device__ inline unsigned int sobolSeed(int pixel, int pair) {
+    return utilhash((unsigned int)pixel * 0x51633e2du + (unsigned int)pair);
+}
 
-    float u = (x + u01(rng)) / SAMPLE_SIZE;
-    float v = (y + u01(rng)) / SAMPLE_SIZE;
+// Sobol state for one path at one bounce: the sample index within the pixel
+// (the iteration) and the scramble seed of this bounce's dimension pair.
+struct SobolState {
+    unsigned int index;
+    unsigned int seed;
+#if BLUE_NOISE_ENABLE
+    // Cranley-Patterson rotation applied to this bounce's 2D point; stays
+    // zero (aggregate init) outside the blue-noise window
+    glm::vec2 shift;
+#endif // BLUE_NOISE_ENABLE
+};
 
-    float up = sqrt(u); // cos(theta)
-    float over = sqrt(1 - up * up); // sin(theta)
-    float around = v * TWO_PI;
-#else
-    float up = sqrt(u01(rng)); // cos(theta)
+// CHECKITOUT
+/**
+ * Computes a cosine-weighted direction in a hemisphere from one 2D sample.
+ * Used for diffuse lighting.
+ */
+__host__ __device__
+glm::vec3 calculateRandomDirectionInHemisphere(
+        glm::vec3 normal, glm::vec2 xi) {
+    float up = sqrt(xi.x); // cos(theta)
     float over = sqrt(1 - up * up); // sin(theta)
-    float around = u01(rng) * TWO_PI;
-#endif // STRATIFIED_SAMPLING
+    float around = xi.y * TWO_PI;
 
     // Find a direction that is not the normal based off of whether or not the
     // normal's components are all equal to sqrt(1/3) or whether or not at
@@ -57,6 +146,61 @@ glm::vec3 calculateRandomDirectionInHemisphere(
         + sin(around) * over * perpendicularDirection2;
 }
 
+/**
+ * The 2D sample for one bounce: the scrambled Sobol point when enabled, a
+ * pseudo-random pair otherwise.
+ */
+__host__ __device__ glm::vec2 bounceSample2D(
+        const SobolState &sobol, thrust::default_random_engine &rng) {
+#if SOBOL_SAMPLING && BLUE_NOISE_ENABLE
+    return glm::fract(sobolSample2D(sobol.index, sobol.seed) + sobol.shift);
+#elif SOBOL_SAMPLING
+    return sobolSample2D(sobol.index, sobol.seed);
+#else
+    thrust::uniform_real_distribution<float> u01(0, 1);
+    return glm::vec2(u01(rng), u01(rng));
+#endif // SOBOL_SAMPLING
+}
+
+#if FAST_SHADING_MATH
+__host__ __device__ float fresnel(
+    float cosThetaI, float ref_idx
+    )
+{
+    float etaI_ = 1.0f;
+    float etaT_ = ref_idx;
+    // Potentially swap indices of refraction
+    bool entering = cosThetaI > 0.f;
+    if (!entering) {
+        float temp = etaI_;
+        etaI_ = etaT_;
+        etaT_ = temp;
+        cosThetaI = fabsf(cosThetaI);
+    }
+    // Compute cosThetaT using Snell's law
+    float sinThetaI = sqrtf(fmaxf(0.f, 1.0f - cosThetaI * cosThetaI));
+    float sinThetaT = etaI_ / etaT_ * sinThetaI;
+    // Handle total internal reflection
+    if (sinThetaT >= 1.0f) {
+        return 1.0f;
+    }
+    float cosThetaT = sqrtf(fmaxf(0.f, 1.0f - sinThetaT * sinThetaT));
+
+    float Rparl = ((etaT_ * cosThetaI) - (etaI_ * cosThetaT)) /
+        ((etaT_ * cosThetaI) + (etaI_ * cosThetaT));
+    float Rperp = ((etaI_ * cosThetaI) - (etaT_ * cosThetaT)) /
+        ((etaI_ * cosThetaI) + (etaT_ * cosThetaT));
+    return (Rparl * Rparl + Rperp * Rperp) * 0.5f;
+}
+
+__host__ __device__ float schlick(float cosine, float ref_idx) {
+    float r0 = (1.0f - ref_idx) / (1.0f + ref_idx);
+    r0 = r0 * r0;
+    float x = 1.0f - cosine;
+    float x2 = x * x;
+    return r0 + (1.0f - r0) * x2 * x2 * x;  // (1-cos)^5 without pow()
+}
+#else // FAST_SHADING_MATH
 __host__ __device__ float fresnel(
     double cosThetaI, double ref_idx
     )
@@ -71,7 +215,7 @@ __host__ __device__ float fresnel(
         etaT_ = temp;
         cosThetaI = abs(cosThetaI);
     }
-    // Compute cosThetaT using Snell�s law
+    // Compute cosThetaT using Snell�s law
     float sinThetaI =sqrt(max(0.f, 1 - cosThetaI * cosThetaI));
     float sinThetaT = etaI_ / etaT_ * sinThetaI;
     // Handle total internal reflection
@@ -92,8 +236,164 @@ __host__ __device__ double schlick(double cosine, double ref_idx) {
     r0 = r0 * r0;
     return r0 + (1 - r0) * pow((1 - cosine), 5);
 }
+#endif // FAST_SHADING_MATH
 
 
+/**
+ * Straight-line scatter for one diffuse bounce. `scale` compensates for the
+ * probability of this lobe being chosen (1 for pure-diffuse materials).
+ *
+ * @return  the solid-angle pdf of the sampled direction (cos(theta) / pi for
+ *          the cosine-weighted hemisphere), for multiple importance sampling
+ *          against the light sample.
+ */
+__host__ __device__
+float scatterDiffuse(
+        PathSegment & pathSegment,
+        glm::vec3 intersect,
+        glm::vec3 normal,
+        const Material &m,
+        float scale,
+        const SobolState &sobol,
+        thrust::default_random_engine &rng) {
+    pathSegment.ray.direction = glm::normalize(calculateRandomDirectionInHemisphere(normal, bounceSample2D(sobol, rng)));
+    pathSegment.color *= m.color * scale;
+    pathSegment.ray.origin = intersect + 0.001f * normal;
+    return glm::max(glm::dot(normal, pathSegment.ray.direction), 0.0f) / PI;
+}
+
+/**
+ * Sample a GGX microfacet normal from the distribution of normals visible
+ * from `wo` (Heitz 2018). All vectors are in tangent space with the surface
+ * normal along +z; `alpha` is the GGX roughness.
+ */
+__host__ __device__
+glm::vec3 sampleGGXVNDF(glm::vec3 wo, float alpha, glm::vec2 xi) {
+    // stretch the view direction to the alpha = 1 hemisphere
+    glm::vec3 vh = glm::normalize(glm::vec3(alpha * wo.x, alpha * wo.y, wo.z));
+    // orthonormal basis around vh
+    float lensq = vh.x * vh.x + vh.y * vh.y;
+    glm::vec3 T1 = lensq > 0.0f ? glm::vec3(-vh.y, vh.x, 0.0f) / sqrt(lensq) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 T2 = glm::cross(vh, T1);
+    // uniform disk sample, warped toward the visible half
+    float r = sqrt(xi.x);
+    float phi = TWO_PI * xi.y;
+    float t1 = r * cos(phi);
+    float t2 = r * sin(phi);
+    float sf = 0.5f * (1.0f + vh.z);
+    t2 = (1.0f - sf) * sqrt(glm::max(0.0f, 1.0f - t1 * t1)) + sf * t2;
+    glm::vec3 nh = t1 * T1 + t2 * T2 + sqrt(glm::max(0.0f, 1.0f - t1 * t1 - t2 * t2)) * vh;
+    // unstretch back
+    return glm::normalize(glm::vec3(alpha * nh.x, alpha * nh.y, glm::max(0.0f, nh.z)));
+}
+
+// Smith masking term Lambda for GGX, from the tangent-space z component.
+__host__ __device__
+float smithLambdaGGX(float cosTheta, float alpha) {
+    float cos2 = cosTheta * cosTheta;
+    float tan2 = glm::max(0.0f, 1.0f - cos2) / glm::max(cos2, 1e-6f);
+    return 0.5f * (sqrt(1.0f + alpha * alpha * tan2) - 1.0f);
+}
+
+/**
+ * Straight-line scatter for one specular bounce: a perfect mirror when the
+ * material's roughness is 0, otherwise a GGX lobe importance-sampled by the
+ * visible normal distribution, whose throughput weight reduces to the Smith
+ * G2 / G1 ratio (times the material color).
+ */
+__host__ __device__
+void scatterSpecular(
+        PathSegment & pathSegment,
+        glm::vec3 intersect,
+        glm::vec3 normal,
+        const Material &m,
+        float scale,
+        thrust::default_random_engine &rng) {
+    if (m.roughness > 0.0f) {
+        thrust::uniform_real_distribution<float> u01(0, 1);
+        // tangent basis (same construction as the hemisphere sampler)
+        glm::vec3 directionNotNormal;
+        if (abs(normal.x) < SQRT_OF_ONE_THIRD) {
+            directionNotNormal = glm::vec3(1, 0, 0);
+        } else if (abs(normal.y) < SQRT_OF_ONE_THIRD) {
+            directionNotNormal = glm::vec3(0, 1, 0);
+        } else {
+            directionNotNormal = glm::vec3(0, 0, 1);
+        }
+        glm::vec3 t1 = glm::normalize(glm::cross(normal, directionNotNormal));
+        glm::vec3 t2 = glm::normalize(glm::cross(normal, t1));
+
+        glm::vec3 wo = -pathSegment.ray.direction;
+        glm::vec3 woT = glm::vec3(glm::dot(wo, t1), glm::dot(wo, t2), glm::dot(wo, normal));
+        glm::vec3 wmT = sampleGGXVNDF(woT, m.roughness, glm::vec2(u01(rng), u01(rng)));
+        glm::vec3 wm = wmT.x * t1 + wmT.y * t2 + wmT.z * normal;
+
+        glm::vec3 wi = glm::reflect(pathSegment.ray.direction, wm);
+        float cosI = glm::dot(wi, normal);
+        if (cosI <= 0.0f) {
+            // sampled direction dips below the surface: absorb
+            pathSegment.color = glm::vec3(0.0f);
+            pathSegment.ray.direction = glm::reflect(pathSegment.ray.direction, normal);
+        }
+        else {
+            // VNDF sampling cancels D and G1(wo) out of f * cos / pdf
+            float lambdaO = smithLambdaGGX(woT.z, m.roughness);
+            float lambdaI = smithLambdaGGX(cosI, m.roughness);
+            float g2OverG1 = (1.0f + lambdaO) / (1.0f + lambdaO + lambdaI);
+            pathSegment.color *= m.color * g2OverG1;
+            pathSegment.ray.direction = glm::normalize(wi);
+        }
+    }
+    else {
+        pathSegment.ray.direction = glm::normalize(glm::reflect(pathSegment.ray.direction, normal));
+        pathSegment.color *= m.color;
+    }
+    pathSegment.color *= scale;
+    pathSegment.ray.origin = intersect + 0.001f * normal;
+}
+
+/**
+ * Straight-line scatter for one refractive bounce; chooses between the
+ * reflected and refracted ray by the Fresnel term.
+ */
+__host__ __device__
+void scatterRefractive(
+        PathSegment & pathSegment,
+        glm::vec3 intersect,
+        glm::vec3 normal,
+        const Material &m,
+        float scale,
+        thrust::default_random_engine &rng) {
+    thrust::uniform_real_distribution<float> u01(0, 1);
+    float costheta = glm::dot(-pathSegment.ray.direction, normal);
+    costheta = costheta > 1.0 ? 1.0 : costheta;
+    costheta = costheta < -1.0 ? -1.0 : costheta;
+    // if the ray is entering the surface
+    float eta = costheta > 0 ? (1.0 / m.indexOfRefraction) : m.indexOfRefraction;
+    glm::vec3 _normal = costheta > 0 ? normal : -normal;
+
+    glm::vec3 refract = glm::refract(glm::normalize(pathSegment.ray.direction), glm::normalize(_normal), eta);
+    glm::vec3 reflect = glm::reflect(pathSegment.ray.direction, _normal);
+    if (glm::length(refract) < EPSILON) {
+        pathSegment.ray.direction = glm::normalize(reflect);
+        pathSegment.color *= m.specular.color * scale;
+        pathSegment.ray.origin = intersect + (pathSegment.ray.direction * 0.001f);
+        return;
+    }
+    float f = fresnel(costheta, m.indexOfRefraction) / abs(costheta);
+    // reflect or refract?
+    if (u01(rng) < f) {
+        pathSegment.ray.direction = glm::normalize(reflect);
+        pathSegment.color *= m.specular.color * scale;
+    }
+    else {
+        pathSegment.ray.direction = glm::normalize(refract);
+        pathSegment.color *= m.color * scale;
+    }
+
+    pathSegment.ray.origin = intersect + (pathSegment.ray.direction * 0.001f);
+}
+
 /**
  * Scatter a ray with some probabilities according to the material properties.
  * For example, a diffuse surface scatters in a cosine-weighted hemisphere.
@@ -118,13 +418,20 @@ __host__ __device__ double schlick(double cosine, double ref_idx) {
  * It also modifies the color `color` of the ray in place.
  *
  * You may need to change the parameter list for your purposes!
+ *
+ * @return  the solid-angle pdf of the sampled direction, or a negative value
+ *          for the specular and refractive lobes, which are (treated as)
+ *          delta distributions a light sample can never match. The caller
+ *          uses this to weight a later emissive hit against the light
+ *          sampling technique.
  */
 __host__ __device__
-void scatterRay(
+float scatterRay(
 		PathSegment & pathSegment,
         glm::vec3 intersect,
         glm::vec3 normal,
         const Material &m,
+        const SobolState &sobol,
         thrust::default_random_engine &rng) {
     // A basic implementation of pure-diffuse shading will just call the
     // calculateRandomDirectionInHemisphere defined above.
@@ -132,56 +439,64 @@ void scatterRay(
     thrust::uniform_real_distribution<float> u01(0, 1);
     float p0 = u01(rng);
 
-    // specular
-    if (p0 <= m.hasReflective) {
-        if (m.specular.exponent > 0.0f) {
-            float p1 = u01(rng);
-            float p2 = u01(rng);
-            pathSegment.ray.direction = glm::normalize(glm::reflect(pathSegment.ray.direction, normal) + m.specular.exponent * glm::normalize(glm::vec3(p0, p1, p2)));
-        }
-        else {
+#if LOW_THROUGHPUT_SHADING
+    // dim-path tier (see the define block above): same lobe selection,
+    // cheaper math inside each lobe
+    glm::vec3 lum(0.2126f, 0.7152f, 0.0722f);
+    if (glm::dot(pathSegment.color, lum) < LOW_THROUGHPUT_LUMINANCE) {
+        // specular: mirror bounce regardless of roughness
+        if (p0 <= m.hasReflective) {
+            float scale = m.hasReflective <= 0.0 ? 0.0 : 1.0 / m.hasReflective;
             pathSegment.ray.direction = glm::normalize(glm::reflect(pathSegment.ray.direction, normal));
+            pathSegment.color *= m.color * scale;
+            pathSegment.ray.origin = intersect + 0.001f * normal;
+            return -1.0f;
         }
-        float scale = m.hasReflective <= 0.0 ? 0.0 : 1.0 / m.hasReflective;
-        pathSegment.color *= m.color * scale;
-        pathSegment.ray.origin = intersect + 0.001f * normal;
-    }
-    // refract
-    else if (p0 <= m.hasReflective + m.hasRefractive) {
-        float costheta = glm::dot(-pathSegment.ray.direction, normal);
-        costheta = costheta > 1.0 ? 1.0 : costheta;
-        costheta = costheta < -1.0 ? -1.0 : costheta;
-        // if the ray is entering the surface
-        float eta = costheta > 0 ? (1.0 / m.indexOfRefraction) : m.indexOfRefraction;
-        glm::vec3 _normal = costheta > 0 ? normal : -normal;
-        float scale = m.hasRefractive <= 0.0 ? 0.0 : 1.0 / m.hasRefractive;
-
-        glm::vec3 refract = glm::refract(glm::normalize(pathSegment.ray.direction), glm::normalize(_normal), eta);
-        glm::vec3 reflect = glm::reflect(pathSegment.ray.direction, _normal);
-        if (glm::length(refract) < EPSILON) {
-            pathSegment.ray.direction = glm::normalize(reflect);
-            pathSegment.color *= m.specular.color * scale;
+        // refract: Schlick in place of the exact Fresnel split
+        else if (p0 <= m.hasReflective + m.hasRefractive) {
+            float scale = m.hasRefractive <= 0.0 ? 0.0 : 1.0 / m.hasRefractive;
+            float costheta = glm::clamp(glm::dot(-pathSegment.ray.direction, normal), -1.0f, 1.0f);
+            float eta = costheta > 0 ? (1.0f / m.indexOfRefraction) : m.indexOfRefraction;
+            glm::vec3 _normal = costheta > 0 ? normal : -normal;
+            glm::vec3 refract = glm::refract(glm::normalize(pathSegment.ray.direction), glm::normalize(_normal), eta);
+            if (glm::length(refract) < EPSILON
+                || u01(rng) < schlick(fabsf(costheta), m.indexOfRefraction)) {
+                pathSegment.ray.direction = glm::normalize(glm::reflect(pathSegment.ray.direction, _normal));
+                pathSegment.color *= m.specular.color * scale;
+            }
+            else {
+                pathSegment.ray.direction = glm::normalize(refract);
+                pathSegment.color *= m.color * scale;
+            }
             pathSegment.ray.origin = intersect + (pathSegment.ray.direction * 0.001f);
-            return;
-        }
-        float f = fresnel(costheta, m.indexOfRefraction) / abs(costheta);
-        // reflect or refract?
-        if (u01(rng) < f) {
-            pathSegment.ray.direction = glm::normalize(reflect);
-            pathSegment.color *= m.specular.color * scale;
+            return -1.0f;
         }
+        // diffuse: plain RNG hemisphere draw, no Sobol scrambling
         else {
-            pathSegment.ray.direction = glm::normalize(refract);
+            float scale = m.hasReflective >= 1.0 ? 0.0 : 1.0 / (1.0 - m.hasReflective);
+            pathSegment.ray.direction = glm::normalize(calculateRandomDirectionInHemisphere(normal, glm::vec2(u01(rng), u01(rng))));
             pathSegment.color *= m.color * scale;
+            pathSegment.ray.origin = intersect + 0.001f * normal;
+            return glm::max(glm::dot(normal, pathSegment.ray.direction), 0.0f) / PI;
         }
+    }
+#endif // LOW_THROUGHPUT_SHADING
 
-        pathSegment.ray.origin = intersect + (pathSegment.ray.direction * 0.001f);
+    // specular
+    if (p0 <= m.hasReflective) {
+        float scale = m.hasReflective <= 0.0 ? 0.0 : 1.0 / m.hasReflective;
+        scatterSpecular(pathSegment, intersect, normal, m, scale, rng);
+        return -1.0f;
+    }
+    // refract
+    else if (p0 <= m.hasReflective + m.hasRefractive) {
+        float scale = m.hasRefractive <= 0.0 ? 0.0 : 1.0 / m.hasRefractive;
+        scatterRefractive(pathSegment, intersect, normal, m, scale, rng);
+        return -1.0f;
     }
     // diffuse
     else {
-        pathSegment.ray.direction = glm::normalize(calculateRandomDirectionInHemisphere(normal, rng));
         float scale = m.hasReflective >= 1.0 ? 0.0 : 1.0 / (1.0 - m.hasReflective);
-        pathSegment.color *= m.color * scale;
-        pathSegment.ray.origin = intersect + 0.001f * normal;
+        return scatterDiffuse(pathSegment, intersect, normal, m, scale, sobol, rng);
     }
 }
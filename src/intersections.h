@@ -6,6 +6,38 @@
 #include "utilities.h"
 
 #define BOUNDING_BOX_ENABLE 1
+#define LBVH_ENABLE 1
+// traverse meshes through the 8-wide quantized BVH instead of the binary
+// LBVH: child bounds are 8-bit against the parent box, so a full node is
+// two cache lines where eight binary nodes were ten, and a traversal step
+// tests eight children with an unrolled loop. Built once per init by
+// collapsing the binary tree (bvh8.h); worth it when the node pool itself
+// is a real slice of VRAM, i.e. multi-million-triangle scenes
+#define BVH8_ENABLE 0
+// with the per-mesh LBVH off, run the linear triangle loop warp-
+// cooperatively: the active lanes stride each lane's triangle range in
+// turn with that lane's ray, so one lane hitting a heavy mesh borrows the
+// idle lanes instead of looping alone. No effect on the LBVH build, whose
+// leaves hold a single triangle and leave no range to split.
+#define WARP_MESH_ENABLE 1
+// route vertex/normal pool reads through texture objects instead of plain
+// global loads; divergent per-lane triangle fetches during BVH traversal
+// behave better in the texture cache than in L1, where they compete with
+// path-state traffic. The pool stays float4-aligned either way, so the
+// fallback is the __ldg path in loadPooled.
+#define POOL_TEX_ENABLE 1
+#if MULTI_GPU_ENABLE && MULTI_GPU_PEER_GEOM_ENABLE && POOL_TEX_ENABLE
+// texture objects cannot be created over another device's memory, so the
+// peer-resident pools (pathtraceConfig.h) must read through the __ldg path
+#undef POOL_TEX_ENABLE
+#define POOL_TEX_ENABLE 0
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+// texture-mapped albedo: meshes carry a texcoord pool next to the vertex
+// and normal pools, the winning hit interpolates a UV, and shading
+// multiplies a bindless mipmapped albedo fetch into the material color.
+// Off compiles the UV pool, the fetches and the per-material handles away
+// for scenes that never use TEXTURE directives.
+#define ALBEDO_TEX_ENABLE 1
 
 /**
  * Handy-dandy hash function that provides seeds for random number generation.
@@ -22,11 +54,13 @@ __host__ __device__ inline unsigned int utilhash(unsigned int a) {
 
 // CHECKITOUT
 /**
- * Compute a point at parameter value `t` on ray `r`.
+ * Compute a point at parameter value `t` on ray `r`. The ray direction is
+ * required to be normalized (generateRayFromCamera and scatterRay maintain
+ * that invariant), so no per-call normalize is needed.
  * Falls slightly short so that it doesn't intersect the object it's hitting.
  */
 __host__ __device__ glm::vec3 getPointOnRay(Ray r, float t) {
-    return r.origin + (t - .0001f) * glm::normalize(r.direction);
+    return r.origin + (t - .0001f) * r.direction;
 }
 
 /**
@@ -36,51 +70,151 @@ __host__ __device__ glm::vec3 multiplyMV(glm::mat4 m, glm::vec4 v) {
     return glm::vec3(m * v);
 }
 
+/**
+ * Affine (3x4) overload: the dropped projective row is always (0, 0, 0, 1).
+ */
+__host__ __device__ glm::vec3 multiplyMV(glm::mat4x3 m, glm::vec4 v) {
+    return m * v;
+}
+
+/**
+ * Read-only load of one float4-aligned pool entry; on device, __ldg routes
+ * the fetch through the read-only cache.
+ */
+__host__ __device__ inline glm::vec4 loadPooled(const glm::vec4* pool, int i) {
+#ifdef __CUDA_ARCH__
+    float4 v = __ldg(reinterpret_cast<const float4*>(pool) + i);
+    return glm::vec4(v.x, v.y, v.z, v.w);
+#else
+    return pool[i];
+#endif
+}
+
+#if BVH8_ENABLE
+// wide node pool, uploaded by pathtraceInit once the collapse has run;
+// a constant-bank pointer so no kernel signature carries it
+__constant__ const BVH8Node* c_bvh8Nodes;
+#endif // BVH8_ENABLE
+
+// texture objects over the linear vertex/normal pools, one float4 texel per
+// entry; pathtraceInit (re)creates them alongside the pools and uploads the
+// handles here, once per device. Declared unconditionally so fetchPooled
+// call sites survive POOL_TEX_ENABLE 0.
+__constant__ cudaTextureObject_t c_texVertices;
+__constant__ cudaTextureObject_t c_texNormals;
+
+/**
+ * Pool read through the matching texture object when POOL_TEX_ENABLE is on;
+ * the pool pointer covers host callers and the non-texture build.
+ */
+__host__ __device__ inline glm::vec4 fetchPooled(cudaTextureObject_t tex,
+    const glm::vec4* pool, int i) {
+#if defined(__CUDA_ARCH__) && POOL_TEX_ENABLE
+    float4 v = tex1Dfetch<float4>(tex, i);
+    return glm::vec4(v.x, v.y, v.z, v.w);
+#else
+    return loadPooled(pool, i);
+#endif
+}
+
+// texcoord pool alongside the vertex/normal pools, constant-bank only (the
+// BVH8 pattern) so no kernel signature carries it; both NULL / 0 for scenes
+// without textured materials, which fetchUv answers with (0, 0)
+__constant__ const glm::vec2* c_uvs;
+__constant__ cudaTextureObject_t c_texUvs;
+
+/**
+ * Texcoord-pool read for one pooled vertex. Device only in practice: the
+ * host instantiation of meshIntersectionTest never traces textured meshes
+ * and gets (0, 0).
+ */
+__host__ __device__ inline glm::vec2 fetchUv(int i) {
+#if defined(__CUDA_ARCH__) && POOL_TEX_ENABLE
+    if (c_texUvs != 0) {
+        float2 v = tex1Dfetch<float2>(c_texUvs, i);
+        return glm::vec2(v.x, v.y);
+    }
+    return glm::vec2(0.0f);
+#elif defined(__CUDA_ARCH__)
+    if (c_uvs != NULL) {
+        float2 v = __ldg(reinterpret_cast<const float2*>(c_uvs) + i);
+        return glm::vec2(v.x, v.y);
+    }
+    return glm::vec2(0.0f);
+#else
+    return glm::vec2(0.0f);
+#endif
+}
+
+/**
+ * Normal-pool read: decodes the octahedral packing (sceneStructs.h) when it
+ * is on, with the texture path fetching one 32-bit texel instead of a
+ * float4. Returns the unit object-space vertex normal.
+ */
+__host__ __device__ inline glm::vec3 fetchNormal(cudaTextureObject_t tex,
+    const PackedNormal* pool, int i) {
+#if OCT_NORMALS_ENABLE
+#if defined(__CUDA_ARCH__) && POOL_TEX_ENABLE
+    return unpackNormal(tex1Dfetch<unsigned int>(tex, i));
+#elif defined(__CUDA_ARCH__)
+    return unpackNormal(__ldg(pool + i));
+#else
+    return unpackNormal(pool[i]);
+#endif
+#else
+    return glm::vec3(fetchPooled(tex, pool, i));
+#endif
+}
+
 // CHECKITOUT
 /**
  * Test intersection between a ray and a transformed cube. Untransformed,
  * the cube ranges from -0.5 to 0.5 in each axis and is centered at the origin.
+ * `MOVING` selects the motion-blur offset at compile time, so the static
+ * instantiation carries no per-ray motion branch.
  *
- * @param intersectionPoint  Output parameter for point of intersection.
- * @param normal             Output parameter for surface normal.
- * @param outside            Output param for whether the ray came from outside.
- * @return                   Ray parameter `t` value. -1 if no intersection.
+ * @param objNormal  Output object-space normal; the caller transforms it by
+ *                   the hit geom's normal matrix (cold data) exactly once.
+ * @return           Ray parameter `t` value. -1 if no intersection.
  */
-__host__ __device__ float boxIntersectionTest(Geom box, Ray r,
-        glm::vec3 &intersectionPoint, glm::vec3 &normal, bool &outside) {
+template <bool MOVING>
+__host__ __device__ float boxIntersectionTest(const GeomHot& box, Ray r, float tMax,
+        glm::vec3 &objNormal) {
     Ray q;
     glm::vec3 ro;
-    if (box.moving) {
-        ro = r.origin - r.time * (box.target - box.translation);
+    if (MOVING) {
+        ro = r.origin - r.time * box.motionOffset;
     }
     else {
         ro = r.origin;
     }
     q.origin = multiplyMV(box.inverseTransform, glm::vec4(ro, 1.0f));
-    q.direction = glm::normalize(multiplyMV(box.inverseTransform, glm::vec4(r.direction, 0.0f)));
+    q.direction = multiplyMV(box.inverseTransform, glm::vec4(r.direction, 0.0f));
+    // an object-space distance of t is t / |M^-1 d| along the world ray
+    float dirScale = glm::length(q.direction);
+    q.direction /= dirScale;
+    glm::vec3 qInvDir = 1.0f / q.direction;
 
     float tmin = -1e38f;
     float tmax = 1e38f;
     glm::vec3 tmin_n;
     glm::vec3 tmax_n;
     for (int xyz = 0; xyz < 3; ++xyz) {
-        float qdxyz = q.direction[xyz];
-        /*if (glm::abs(qdxyz) > 0.00001f)*/ {
-            float t1 = (-0.5f - q.origin[xyz]) / qdxyz;
-            float t2 = (+0.5f - q.origin[xyz]) / qdxyz;
-            float ta = glm::min(t1, t2);
-            float tb = glm::max(t1, t2);
-            glm::vec3 n;
-            n[xyz] = t2 < t1 ? +1 : -1;
-            if (ta > 0 && ta > tmin) {
-                tmin = ta;
-                tmin_n = n;
-            }
-            if (tb < tmax) {
-                tmax = tb;
-                n[xyz] = -n[xyz];
-                tmax_n = n;
-            }
+        // same multiply-by-inverse slab scheme as boundingIntersectionTest
+        float t1 = (-0.5f - q.origin[xyz]) * qInvDir[xyz];
+        float t2 = (+0.5f - q.origin[xyz]) * qInvDir[xyz];
+        float ta = glm::min(t1, t2);
+        float tb = glm::max(t1, t2);
+        glm::vec3 n;
+        n[xyz] = t2 < t1 ? +1 : -1;
+        if (ta > 0 && ta > tmin) {
+            tmin = ta;
+            tmin_n = n;
+        }
+        if (tb < tmax) {
+            tmax = tb;
+            n[xyz] = -n[xyz];
+            tmax_n = n;
         }
     }
 
@@ -89,12 +223,13 @@ __host__ __device__ float boxIntersectionTest(Geom box, Ray r,
             tmin = tmax;
             tmin_n = tmax_n;
         }
-        intersectionPoint = multiplyMV(box.transform, glm::vec4(getPointOnRay(q, tmin), 1.0f));
-        if (box.moving) {
-            intersectionPoint += r.time * (box.target - box.translation);
+        float t = tmin / dirScale;
+        if (t >= tMax) {
+            // a closer hit is already known
+            return -1;
         }
-        normal = glm::normalize(multiplyMV(box.invTranspose, glm::vec4(tmin_n, 0.0f)));
-        return glm::length(r.origin - intersectionPoint);
+        objNormal = tmin_n;
+        return t;
     }
     return -1;
 }
@@ -104,24 +239,65 @@ __host__ __device__ float boxIntersectionTest(Geom box, Ray r,
  * Test intersection between a ray and a transformed sphere. Untransformed,
  * the sphere always has radius 0.5 and is centered at the origin.
  *
- * @param intersectionPoint  Output parameter for point of intersection.
- * @param normal             Output parameter for surface normal.
- * @param outside            Output param for whether the ray came from outside.
- * @return                   Ray parameter `t` value. -1 if no intersection.
+ * @param objNormal  Output object-space normal; the caller transforms it by
+ *                   the hit geom's normal matrix (cold data) exactly once.
+ * @return           Ray parameter `t` value. -1 if no intersection.
  */
-__host__ __device__ float sphereIntersectionTest(Geom sphere, Ray r,
-        glm::vec3 &intersectionPoint, glm::vec3 &normal, bool &outside) {
+template <bool MOVING>
+__host__ __device__ float sphereIntersectionTest(const GeomHot& sphere, Ray r, float tMax,
+        glm::vec3 &objNormal) {
     float radius = .5;
 
+    if (sphere.rightTop.x > 0.0f) {
+        // Uniform-scale fast path: buildGeomSplit packed the world-space
+        // center/radius into the (otherwise unused) AABB fields, so the
+        // quadratic runs directly in world space — no matrix transforms,
+        // no renormalization (world ray directions are unit length). One
+        // inverse transform on the hit point recovers the object-space
+        // normal the caller's invTranspose multiply expects; it is off by
+        // a positive scale, which the caller's normalize absorbs.
+        float worldRadius = sphere.rightTop.x;
+        glm::vec3 wo = r.origin;
+        if (MOVING) {
+            wo -= r.time * sphere.motionOffset;
+        }
+        glm::vec3 oc = wo - sphere.leftBottom;
+        float vDotDirection = glm::dot(oc, r.direction);
+        float radicand = vDotDirection * vDotDirection - (glm::dot(oc, oc) - worldRadius * worldRadius);
+        if (radicand < 0) {
+            return -1;
+        }
+        float squareRoot = sqrt(radicand);
+        float t1 = -vDotDirection + squareRoot;
+        float t2 = -vDotDirection - squareRoot;
+        float t = 0;
+        if (t1 < 0 && t2 < 0) {
+            return -1;
+        } else if (t1 > 0 && t2 > 0) {
+            t = min(t1, t2);
+        } else {
+            t = max(t1, t2);
+        }
+        if (t >= tMax) {
+            // a closer hit is already known
+            return -1;
+        }
+        objNormal = multiplyMV(sphere.inverseTransform, glm::vec4(wo + t * r.direction, 1.0f));
+        return t;
+    }
+
     glm::vec3 ro;
-    if (sphere.moving) {
-        ro = r.origin - r.time * (sphere.target - sphere.translation);
+    if (MOVING) {
+        ro = r.origin - r.time * sphere.motionOffset;
         ro = multiplyMV(sphere.inverseTransform, glm::vec4(ro, 1.0f));
     }
     else {
         ro = multiplyMV(sphere.inverseTransform, glm::vec4(r.origin, 1.0f));
     }
-    glm::vec3 rd = glm::normalize(multiplyMV(sphere.inverseTransform, glm::vec4(r.direction, 0.0f)));
+    glm::vec3 rd = multiplyMV(sphere.inverseTransform, glm::vec4(r.direction, 0.0f));
+    // an object-space distance of t is t / |M^-1 d| along the world ray
+    float dirScale = glm::length(rd);
+    rd /= dirScale;
 
     Ray rt;
     rt.origin = ro;
@@ -147,129 +323,569 @@ __host__ __device__ float sphereIntersectionTest(Geom sphere, Ray r,
         t = max(t1, t2);
     }
 
-    glm::vec3 objspaceIntersection = getPointOnRay(rt, t);
-    intersectionPoint = multiplyMV(sphere.transform, glm::vec4(objspaceIntersection, 1.f));
-    if (sphere.moving) {
-        intersectionPoint += r.time * (sphere.target - sphere.translation);
+    float worldT = t / dirScale;
+    if (worldT >= tMax) {
+        // a closer hit is already known
+        return -1;
     }
-    normal = glm::normalize(multiplyMV(sphere.invTranspose, glm::vec4(objspaceIntersection, 0.f)));
+    // for the unit sphere, the object-space hit point is the normal
+    objNormal = getPointOnRay(rt, t);
 
-    return glm::length(r.origin - intersectionPoint);
+    return worldT;
+}
+
+/**
+ * Test intersection between a ray and an infinite plane. buildGeomSplit
+ * packs the world-space unit normal and plane offset into the (otherwise
+ * unused) AABB fields, so this is a direct point-normal test: one dot per
+ * term, no matrix transforms, and none of the float-precision acne a
+ * huge-radius ground sphere shows at contact points. Two-sided; the
+ * object-space normal flips to face the ray.
+ *
+ * @param objNormal  Output object-space normal; the caller transforms it by
+ *                   the hit geom's normal matrix (cold data) exactly once.
+ * @return           Ray parameter `t` value. -1 if no intersection.
+ */
+template <bool MOVING>
+__host__ __device__ float planeIntersectionTest(const GeomHot& plane, Ray r, float tMax,
+        glm::vec3 &objNormal) {
+    glm::vec3 n = plane.leftBottom;
+    glm::vec3 wo = r.origin;
+    if (MOVING) {
+        wo -= r.time * plane.motionOffset;
+    }
+    float denom = glm::dot(n, r.direction);
+    if (denom == 0.0f) {
+        // parallel ray; a grazing hit carries no usable normal anyway
+        return -1;
+    }
+    float t = (plane.rightTop.x - glm::dot(n, wo)) / denom;
+    if (t <= 0 || t >= tMax) {
+        return -1;
+    }
+    objNormal = glm::vec3(0, denom < 0.0f ? 1 : -1, 0);
+    return t;
 }
 
-__host__ __device__ bool boundingIntersectionTest(Ray r, glm::vec3 leftBottom, glm::vec3 rightTop) {
+/**
+ * Slab test against an AABB, culled against the known-best hit distance: a
+ * box whose entry point already lies beyond `tMax` cannot contain a closer
+ * hit and is rejected outright. `invDir` is the componentwise reciprocal of
+ * r.direction, computed once per ray so every slab is a multiply.
+ */
+__host__ __device__ bool boundingIntersectionTest(Ray r, glm::vec3 invDir, glm::vec3 leftBottom, glm::vec3 rightTop, float tMax) {
 
     float tmin = -1e38f;
     float tmax = 1e38f;
     for (int xyz = 0; xyz < 3; ++xyz) {
-        float qdxyz = r.direction[xyz];
-        /*if (glm::abs(qdxyz) > 0.00001f)*/ {
-            float t1 = (leftBottom[xyz] - r.origin[xyz]) / qdxyz;
-            float t2 = (rightTop[xyz] - r.origin[xyz]) / qdxyz;
-            float ta = glm::min(t1, t2);
-            float tb = glm::max(t1, t2);
-
-            if (ta > 0 && ta > tmin) {
-                tmin = ta;
-            }
-            if (tb < tmax) {
-                tmax = tb;
-            }
+        // multiply by the precomputed inverse instead of dividing; for an
+        // axis-parallel ray invDir is +/-inf and IEEE rules reject the box
+        // exactly when the origin lies outside that slab
+        float t1 = (leftBottom[xyz] - r.origin[xyz]) * invDir[xyz];
+        float t2 = (rightTop[xyz] - r.origin[xyz]) * invDir[xyz];
+        float ta = glm::min(t1, t2);
+        float tb = glm::max(t1, t2);
+
+        if (ta > 0 && ta > tmin) {
+            tmin = ta;
+        }
+        if (tb < tmax) {
+            tmax = tb;
         }
     }
 
-    if (tmax >= tmin && tmax > 0) {
+    if (tmax >= tmin && tmax > 0 && tmin < tMax) {
         return true;
     }
     return false;
 }
 
-__host__ __device__ float triangleIntersect(const Ray& r, Triangle &tri, glm::vec3 &normal, bool &outside)
+/**
+ * Watertight Möller-Trumbore ray-triangle intersection. No square roots, and
+ * the edge functions are evaluated consistently so rays cannot slip through
+ * shared edges.
+ *
+ * @param bary  Output barycentric weights for (p1, p2, p3).
+ * @return      Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ float triangleIntersect(const Ray& r,
+    glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, glm::vec3& bary)
 {
-    //1. Ray-plane intersection
-    float t = glm::dot(tri.n1, (tri.p1 - r.origin)) / glm::dot(tri.n1, r.direction);
-    if (t < 0) {
+    glm::vec3 e1 = p2 - p1;
+    glm::vec3 e2 = p3 - p1;
+    glm::vec3 pvec = glm::cross(r.direction, e2);
+    float det = glm::dot(e1, pvec);
+    if (det == 0.0f) {
+        // ray parallel to the triangle plane
         return -1;
     }
+    float invDet = 1.0f / det;
 
-    glm::vec3 P = r.origin + t * r.direction;
-    //2. Barycentric test
-    float S = 0.5f * glm::length(glm::cross(tri.p1 - tri.p2, tri.p1 - tri.p3));
-    float s1 = 0.5f * glm::length(glm::cross(P - tri.p2, P - tri.p3)) / S;
-    float s2 = 0.5f * glm::length(glm::cross(P - tri.p3, P - tri.p1)) / S;
-    float s3 = 0.5f * glm::length(glm::cross(P - tri.p1, P - tri.p2)) / S;
-    float sum = s1 + s2 + s3;
+    glm::vec3 tvec = r.origin - p1;
+    float u = glm::dot(tvec, pvec) * invDet;
+    glm::vec3 qvec = glm::cross(tvec, e1);
+    float v = glm::dot(r.direction, qvec) * invDet;
+    if (u < 0.0f || v < 0.0f || u + v > 1.0f) {
+        return -1;
+    }
 
-    if (s1 >= 0 && s1 <= 1 && s2 >= 0 && s2 <= 1 && s3 >= 0 && s3 <= 1 && abs(sum - 1.0f) < 0.001f) {
-        normal = s1 / S * tri.n1 + s2 / S * tri.n2 + s3 / S * tri.n3;
-        return t;
+    float t = glm::dot(e2, qvec) * invDet;
+    if (t <= 0.0f) {
+        return -1;
     }
-    return -1;
+    bary = glm::vec3(1.0f - u - v, u, v);
+    return t;
 }
 
 /**
- * Test intersection between a ray and a transformed mesh. 
+ * Test intersection between a ray and a transformed mesh.
  *
- * @param intersectionPoint  Output parameter for point of intersection.
- * @param normal             Output parameter for surface normal.
- * @param outside            Output param for whether the ray came from outside.
- * @return                   Ray parameter `t` value. -1 if no intersection.
+ * @param objNormal  Output object-space normal; the caller transforms it by
+ *                   the hit geom's normal matrix (cold data) exactly once.
+ * @param objUV      Output interpolated texcoords from the pool in the
+ *                   constant bank; (0, 0) when the scene carries none.
+ * @return           Ray parameter `t` value. -1 if no intersection.
  */
-__host__ __device__ float meshIntersectionTest(Geom mesh, Ray r,
-    glm::vec3& intersectionPoint, glm::vec3& normal, bool& outside, Triangle* triangles) {
+template <bool MOVING>
+__host__ __device__ float meshIntersectionTest(const GeomHot& mesh, Ray r, float tMax,
+    glm::vec3& objNormal, glm::vec2& objUV, const TriangleIdx* __restrict__ triangles,
+    const glm::vec4* __restrict__ vertices,
+    const PackedNormal* __restrict__ normals, const LBVHNode* __restrict__ bvhNodes) {
 
     Ray rt;
-    
-    if (mesh.moving) {
-        rt.origin = r.origin - r.time * (mesh.target - mesh.translation);
-        rt.origin = multiplyMV(mesh.inverseTransform, glm::vec4(rt.origin, 1.0f));
+    float dirScale;
+    float tMaxObj;
+
+    if (!MOVING && mesh.worldSpace) {
+        // triangles baked into world space at load: the ray passes through
+        // untouched, and t below is already a world-space parameter
+        rt = r;
+        dirScale = 1.0f;
+        tMaxObj = tMax;
     }
     else {
-        rt.origin = multiplyMV(mesh.inverseTransform, glm::vec4(r.origin, 1.0f));
+        if (MOVING) {
+            rt.origin = r.origin - r.time * mesh.motionOffset;
+            rt.origin = multiplyMV(mesh.inverseTransform, glm::vec4(rt.origin, 1.0f));
+        }
+        else {
+            rt.origin = multiplyMV(mesh.inverseTransform, glm::vec4(r.origin, 1.0f));
+        }
+        rt.direction = multiplyMV(mesh.inverseTransform, glm::vec4(r.direction, 0.0f));
+        // a world-space distance of tMax along r maps to an object-space distance
+        // of tMax * |M^-1 d|, so the cull interval survives the transform
+        dirScale = glm::length(rt.direction);
+        rt.direction /= dirScale;
+        tMaxObj = tMax >= FLT_MAX ? FLT_MAX : tMax * dirScale;
     }
-    rt.direction = glm::normalize(multiplyMV(mesh.inverseTransform, glm::vec4(r.direction, 0.0f)));
+    glm::vec3 rtInvDir = 1.0f / rt.direction;
 
 #if BOUNDING_BOX_ENABLE
-    if (!boundingIntersectionTest(rt, mesh.leftBottom, mesh.rightTop)) {
+    if (!boundingIntersectionTest(rt, rtInvDir, mesh.leftBottom, mesh.rightTop, tMaxObj)) {
         return -1;
     }
 #endif
-    float t_min = FLT_MAX;
-    bool isFound = false;
-    glm::vec3 objspaceIntersection;
-    glm::vec3 nnormal;
+    float t_min = tMaxObj;
     int minId = -1;
     glm::vec3 minBary;
-    for (int i = mesh.startIndex; i <= mesh.endIndex; i++) {
-        glm::vec3 tvec;
-        if (glm::intersectRayTriangle(rt.origin, rt.direction, triangles[i].p1, triangles[i].p2, triangles[i].p3, tvec)) {
-            float t = tvec.z;
+#if BVH8_ENABLE
+    // wide traversal: decode and test all eight quantized child boxes per
+    // step; internal survivors go on the stack, leaves test their triangle
+    {
+        int stack[64];
+        int stackTop = 0;
+        stack[stackTop++] = mesh.bvhRoot;
+        while (stackTop > 0) {
+            const BVH8Node& node = c_bvh8Nodes[stack[--stackTop]];
+#pragma unroll
+            for (int c = 0; c < 8; c++) {
+                int child = node.child[c];
+                if (child == -1) {
+                    continue;
+                }
+                glm::vec3 lo = node.origin + node.scale
+                    * glm::vec3(node.qlo[c][0], node.qlo[c][1], node.qlo[c][2]);
+                glm::vec3 hi = node.origin + node.scale
+                    * glm::vec3(node.qhi[c][0], node.qhi[c][1], node.qhi[c][2]);
+                if (!boundingIntersectionTest(rt, rtInvDir, lo, hi, t_min)) {
+                    continue;
+                }
+                if (child < -1) {
+                    int i = -(child + 2);
+                    TriangleIdx tri = triangles[i];
+                    glm::vec3 bary;
+                    float t = triangleIntersect(rt,
+                        glm::vec3(fetchPooled(c_texVertices, vertices, tri.x)),
+                        glm::vec3(fetchPooled(c_texVertices, vertices, tri.y)),
+                        glm::vec3(fetchPooled(c_texVertices, vertices, tri.z)), bary);
+                    if (t > 0 && t_min > t) {
+                        t_min = t;
+                        minId = i;
+                        minBary = bary;
+                    }
+                }
+                else {
+                    stack[stackTop++] = child;
+                }
+            }
+        }
+    }
+#elif LBVH_ENABLE
+    // stack-based LBVH traversal; per-ray cost is logarithmic in triangle count
+    int stack[64];
+    int stackTop = 0;
+    stack[stackTop++] = mesh.bvhRoot;
+    while (stackTop > 0) {
+        const LBVHNode& node = bvhNodes[stack[--stackTop]];
+        if (!boundingIntersectionTest(rt, rtInvDir, node.leftBottom, node.rightTop, t_min)) {
+            continue;
+        }
+        if (node.left < 0) {
+            int i = node.triangleIndex;
+            TriangleIdx tri = triangles[i];
+            glm::vec3 bary;
+            float t = triangleIntersect(rt,
+                glm::vec3(fetchPooled(c_texVertices, vertices, tri.x)),
+                glm::vec3(fetchPooled(c_texVertices, vertices, tri.y)),
+                glm::vec3(fetchPooled(c_texVertices, vertices, tri.z)), bary);
             if (t > 0 && t_min > t) {
                 t_min = t;
                 minId = i;
-                minBary = tvec;
+                minBary = bary;
+            }
+        }
+        else {
+            stack[stackTop++] = node.left;
+            stack[stackTop++] = node.right;
+        }
+    }
+#elif WARP_MESH_ENABLE && defined(__CUDA_ARCH__)
+    // serve each active lane's mesh in turn: the group strides the leader's
+    // range with the leader's object-space ray, then the leader gathers the
+    // per-lane minima. Lanes outside the mask diverged away earlier (AABB
+    // miss or non-mesh geom) and take no part.
+    {
+        unsigned warpMask = __activemask();
+        int lane = threadIdx.x & 31;
+        int rank = __popc(warpMask & ((1u << lane) - 1));
+        int groupSize = __popc(warpMask);
+        for (unsigned pending = warpMask; pending; pending &= pending - 1) {
+            int leader = __ffs(pending) - 1;
+            Ray lr;
+            lr.origin.x = __shfl_sync(warpMask, rt.origin.x, leader);
+            lr.origin.y = __shfl_sync(warpMask, rt.origin.y, leader);
+            lr.origin.z = __shfl_sync(warpMask, rt.origin.z, leader);
+            lr.direction.x = __shfl_sync(warpMask, rt.direction.x, leader);
+            lr.direction.y = __shfl_sync(warpMask, rt.direction.y, leader);
+            lr.direction.z = __shfl_sync(warpMask, rt.direction.z, leader);
+            int lStart = __shfl_sync(warpMask, mesh.startIndex, leader);
+            int lEnd = __shfl_sync(warpMask, mesh.endIndex, leader);
+            float bestT = __shfl_sync(warpMask, tMaxObj, leader);
+            int bestId = -1;
+            glm::vec3 bestBary(0.0f);
+            for (int i = lStart + rank; i <= lEnd; i += groupSize) {
+                TriangleIdx tri = triangles[i];
+                glm::vec3 bary;
+                float t = triangleIntersect(lr,
+                    glm::vec3(fetchPooled(c_texVertices, vertices, tri.x)),
+                    glm::vec3(fetchPooled(c_texVertices, vertices, tri.y)),
+                    glm::vec3(fetchPooled(c_texVertices, vertices, tri.z)), bary);
+                if (t > 0 && bestT > t) {
+                    bestT = t;
+                    bestId = i;
+                    bestBary = bary;
+                }
+            }
+            // uniform source lane per step, so partial masks stay legal
+            for (unsigned m = warpMask; m; m &= m - 1) {
+                int src = __ffs(m) - 1;
+                float t = __shfl_sync(warpMask, bestT, src);
+                int id = __shfl_sync(warpMask, bestId, src);
+                float bx = __shfl_sync(warpMask, bestBary.x, src);
+                float by = __shfl_sync(warpMask, bestBary.y, src);
+                float bz = __shfl_sync(warpMask, bestBary.z, src);
+                if (lane == leader && id >= 0 && t_min > t) {
+                    t_min = t;
+                    minId = id;
+                    minBary = glm::vec3(bx, by, bz);
+                }
             }
         }
     }
+#else
+    for (int i = mesh.startIndex; i <= mesh.endIndex; i++) {
+        TriangleIdx tri = triangles[i];
+        glm::vec3 bary;
+        float t = triangleIntersect(rt,
+            glm::vec3(fetchPooled(c_texVertices, vertices, tri.x)),
+            glm::vec3(fetchPooled(c_texVertices, vertices, tri.y)),
+            glm::vec3(fetchPooled(c_texVertices, vertices, tri.z)), bary);
+        if (t > 0 && t_min > t) {
+            t_min = t;
+            minId = i;
+            minBary = bary;
+        }
+    }
+#endif // LBVH_ENABLE
 
     if (minId < 0) {
         return -1;
     }
     
-    normal = triangles[minId].n1 * minBary.x + triangles[minId].n2 * minBary.y + triangles[minId].n3 * minBary.z;
+    TriangleIdx minTri = triangles[minId];
+    objNormal = fetchNormal(c_texNormals, normals, minTri.x) * minBary.x
+        + fetchNormal(c_texNormals, normals, minTri.y) * minBary.y
+        + fetchNormal(c_texNormals, normals, minTri.z) * minBary.z;
+#if ALBEDO_TEX_ENABLE
+    objUV = fetchUv(minTri.x) * minBary.x
+        + fetchUv(minTri.y) * minBary.y
+        + fetchUv(minTri.z) * minBary.z;
+#else
+    objUV = glm::vec2(0.0f);
+#endif
+
+    if (glm::dot(objNormal, rt.direction) > 0) {
+        objNormal = -objNormal;
+    }
+
+    return t_min / dirScale;
+}
+
+// Occlusion-only (any-hit) variants of the tests above, for shadow rays.
+// They answer "is anything closer than tMax" and nothing else: no normal,
+// no hit-point transform, and the mesh traversal returns on the first
+// triangle inside the interval instead of finishing the closest-hit search.
+
+/**
+ * Any-hit counterpart of boxIntersectionTest.
+ *
+ * @return  true if the ray hits the cube at a parameter in (0, tMax).
+ */
+template <bool MOVING>
+__host__ __device__ bool boxAnyHitTest(const GeomHot& box, Ray r, float tMax) {
+    glm::vec3 ro;
+    if (MOVING) {
+        ro = r.origin - r.time * box.motionOffset;
+    }
+    else {
+        ro = r.origin;
+    }
+    glm::vec3 qo = multiplyMV(box.inverseTransform, glm::vec4(ro, 1.0f));
+    glm::vec3 qd = multiplyMV(box.inverseTransform, glm::vec4(r.direction, 0.0f));
+    float dirScale = glm::length(qd);
+    qd /= dirScale;
+    glm::vec3 qInvDir = 1.0f / qd;
+
+    float tmin = -1e38f;
+    float tmax = 1e38f;
+    for (int xyz = 0; xyz < 3; ++xyz) {
+        float t1 = (-0.5f - qo[xyz]) * qInvDir[xyz];
+        float t2 = (+0.5f - qo[xyz]) * qInvDir[xyz];
+        tmin = glm::max(tmin, glm::min(t1, t2));
+        tmax = glm::min(tmax, glm::max(t1, t2));
+    }
+    if (tmax < tmin || tmax <= 0) {
+        return false;
+    }
+    // entry point if outside, exit point if the origin is inside the cube
+    float t = tmin > 0 ? tmin : tmax;
+    return t < tMax * dirScale;
+}
+
+/**
+ * Any-hit counterpart of sphereIntersectionTest.
+ *
+ * @return  true if the ray hits the sphere at a parameter in (0, tMax).
+ */
+template <bool MOVING>
+__host__ __device__ bool sphereAnyHitTest(const GeomHot& sphere, Ray r, float tMax) {
+    float radius = .5;
+
+    if (sphere.rightTop.x > 0.0f) {
+        // same world-space fast path as sphereIntersectionTest, minus the
+        // normal reconstruction
+        float worldRadius = sphere.rightTop.x;
+        glm::vec3 wo = r.origin;
+        if (MOVING) {
+            wo -= r.time * sphere.motionOffset;
+        }
+        glm::vec3 oc = wo - sphere.leftBottom;
+        float vDotDirection = glm::dot(oc, r.direction);
+        float radicand = vDotDirection * vDotDirection - (glm::dot(oc, oc) - worldRadius * worldRadius);
+        if (radicand < 0) {
+            return false;
+        }
+        float squareRoot = sqrt(radicand);
+        float t1 = -vDotDirection + squareRoot;
+        float t2 = -vDotDirection - squareRoot;
+        if (t1 < 0 && t2 < 0) {
+            return false;
+        }
+        float t = t2 > 0 ? t2 : t1;
+        return t < tMax;
+    }
+
+    glm::vec3 ro;
+    if (MOVING) {
+        ro = r.origin - r.time * sphere.motionOffset;
+        ro = multiplyMV(sphere.inverseTransform, glm::vec4(ro, 1.0f));
+    }
+    else {
+        ro = multiplyMV(sphere.inverseTransform, glm::vec4(r.origin, 1.0f));
+    }
+    glm::vec3 rd = multiplyMV(sphere.inverseTransform, glm::vec4(r.direction, 0.0f));
+    float dirScale = glm::length(rd);
+    rd /= dirScale;
 
-    if (glm::dot(normal, rt.direction) > 0) {
-        normal = -normal;
+    float vDotDirection = glm::dot(ro, rd);
+    float radicand = vDotDirection * vDotDirection - (glm::dot(ro, ro) - powf(radius, 2));
+    if (radicand < 0) {
+        return false;
     }
 
-    objspaceIntersection = getPointOnRay(rt, t_min);
-    intersectionPoint = multiplyMV(mesh.transform, glm::vec4(objspaceIntersection, 1.f));
-    if (mesh.moving) {
-        intersectionPoint += r.time * (mesh.target - mesh.translation);
+    float squareRoot = sqrt(radicand);
+    float t1 = -vDotDirection + squareRoot;
+    float t2 = -vDotDirection - squareRoot;
+    if (t1 < 0 && t2 < 0) {
+        return false;
     }
-    normal = glm::normalize(multiplyMV(mesh.invTranspose, glm::vec4(normal, 0.f)));
+    float t = t2 > 0 ? t2 : t1;
+    return t < tMax * dirScale;
+}
 
-    return glm::length(r.origin - intersectionPoint);
+/**
+ * Any-hit counterpart of planeIntersectionTest.
+ *
+ * @return  true if the ray hits the plane at a parameter in (0, tMax).
+ */
+template <bool MOVING>
+__host__ __device__ bool planeAnyHitTest(const GeomHot& plane, Ray r, float tMax) {
+    glm::vec3 n = plane.leftBottom;
+    glm::vec3 wo = r.origin;
+    if (MOVING) {
+        wo -= r.time * plane.motionOffset;
+    }
+    float denom = glm::dot(n, r.direction);
+    if (denom == 0.0f) {
+        return false;
+    }
+    float t = (plane.rightTop.x - glm::dot(n, wo)) / denom;
+    return t > 0 && t < tMax;
 }
 
+/**
+ * Any-hit counterpart of meshIntersectionTest: the traversal stops at the
+ * first triangle inside the interval, in whatever order the LBVH visits
+ * them, and never touches the normal pool.
+ *
+ * @return  true if the ray hits any triangle at a parameter in (0, tMax).
+ */
+template <bool MOVING>
+__host__ __device__ bool meshAnyHitTest(const GeomHot& mesh, Ray r, float tMax,
+    const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices, const LBVHNode* __restrict__ bvhNodes) {
+
+    Ray rt;
+    float tMaxObj;
 
+    if (!MOVING && mesh.worldSpace) {
+        // same baked world-space pass-through as meshIntersectionTest
+        rt = r;
+        tMaxObj = tMax;
+    }
+    else {
+        if (MOVING) {
+            rt.origin = r.origin - r.time * mesh.motionOffset;
+            rt.origin = multiplyMV(mesh.inverseTransform, glm::vec4(rt.origin, 1.0f));
+        }
+        else {
+            rt.origin = multiplyMV(mesh.inverseTransform, glm::vec4(r.origin, 1.0f));
+        }
+        rt.direction = multiplyMV(mesh.inverseTransform, glm::vec4(r.direction, 0.0f));
+        float dirScale = glm::length(rt.direction);
+        rt.direction /= dirScale;
+        tMaxObj = tMax >= FLT_MAX ? FLT_MAX : tMax * dirScale;
+    }
+    glm::vec3 rtInvDir = 1.0f / rt.direction;
+
+#if BOUNDING_BOX_ENABLE
+    if (!boundingIntersectionTest(rt, rtInvDir, mesh.leftBottom, mesh.rightTop, tMaxObj)) {
+        return false;
+    }
+#endif
+#if BVH8_ENABLE
+    {
+        int stack[64];
+        int stackTop = 0;
+        stack[stackTop++] = mesh.bvhRoot;
+        while (stackTop > 0) {
+            const BVH8Node& node = c_bvh8Nodes[stack[--stackTop]];
+#pragma unroll
+            for (int c = 0; c < 8; c++) {
+                int child = node.child[c];
+                if (child == -1) {
+                    continue;
+                }
+                glm::vec3 lo = node.origin + node.scale
+                    * glm::vec3(node.qlo[c][0], node.qlo[c][1], node.qlo[c][2]);
+                glm::vec3 hi = node.origin + node.scale
+                    * glm::vec3(node.qhi[c][0], node.qhi[c][1], node.qhi[c][2]);
+                if (!boundingIntersectionTest(rt, rtInvDir, lo, hi, tMaxObj)) {
+                    continue;
+                }
+                if (child < -1) {
+                    TriangleIdx tri = triangles[-(child + 2)];
+                    glm::vec3 bary;
+                    float t = triangleIntersect(rt,
+                        glm::vec3(fetchPooled(c_texVertices, vertices, tri.x)),
+                        glm::vec3(fetchPooled(c_texVertices, vertices, tri.y)),
+                        glm::vec3(fetchPooled(c_texVertices, vertices, tri.z)), bary);
+                    if (t > 0 && t < tMaxObj) {
+                        return true;
+                    }
+                }
+                else {
+                    stack[stackTop++] = child;
+                }
+            }
+        }
+    }
+#elif LBVH_ENABLE
+    int stack[64];
+    int stackTop = 0;
+    stack[stackTop++] = mesh.bvhRoot;
+    while (stackTop > 0) {
+        const LBVHNode& node = bvhNodes[stack[--stackTop]];
+        if (!boundingIntersectionTest(rt, rtInvDir, node.leftBottom, node.rightTop, tMaxObj)) {
+            continue;
+        }
+        if (node.left < 0) {
+            TriangleIdx tri = triangles[node.triangleIndex];
+            glm::vec3 bary;
+            float t = triangleIntersect(rt,
+                glm::vec3(fetchPooled(c_texVertices, vertices, tri.x)),
+                glm::vec3(fetchPooled(c_texVertices, vertices, tri.y)),
+                glm::vec3(fetchPooled(c_texVertices, vertices, tri.z)), bary);
+            if (t > 0 && t < tMaxObj) {
+                return true;
+            }
+        }
+        else {
+            stack[stackTop++] = node.left;
+            stack[stackTop++] = node.right;
+        }
+    }
+#else
+    for (int i = mesh.startIndex; i <= mesh.endIndex; i++) {
+        TriangleIdx tri = triangles[i];
+        glm::vec3 bary;
+        float t = triangleIntersect(rt,
+            glm::vec3(fetchPooled(c_texVertices, vertices, tri.x)),
+            glm::vec3(fetchPooled(c_texVertices, vertices, tri.y)),
+            glm::vec3(fetchPooled(c_texVertices, vertices, tri.z)), bary);
+        if (t > 0 && t < tMaxObj) {
+            return true;
+        }
+    }
+#endif // LBVH_ENABLE
+    return false;
+}
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <set>
+#include <cuda.h>
+#include <thrust/execution_policy.h>
+#include <thrust/sort.h>
+#include <thrust/device_vector.h>
+
+#include "lbvh.h"
+
+// Expand a 10-bit integer into 30 bits by inserting 2 zeros after each bit.
+__device__ unsigned int expandBits(unsigned int v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// 30-bit Morton code for a point in [0,1]^3.
+__device__ unsigned int morton3D(glm::vec3 p) {
+	float x = glm::min(glm::max(p.x * 1024.0f, 0.0f), 1023.0f);
+	float y = glm::min(glm::max(p.y * 1024.0f, 0.0f), 1023.0f);
+	float z = glm::min(glm::max(p.z * 1024.0f, 0.0f), 1023.0f);
+	unsigned int xx = expandBits((unsigned int)x);
+	unsigned int yy = expandBits((unsigned int)y);
+	unsigned int zz = expandBits((unsigned int)z);
+	return xx * 4 + yy * 2 + zz;
+}
+
+__global__ void kernComputeMortonCodes(int n, TriangleIdx* triangles,
+	const glm::vec4* vertices, unsigned int* codes,
+	glm::vec3 leftBottom, glm::vec3 rightTop) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	TriangleIdx tri = triangles[i];
+	glm::vec3 centroid = glm::vec3(vertices[tri.x] + vertices[tri.y] + vertices[tri.z]) / 3.0f;
+	glm::vec3 extent = glm::max(rightTop - leftBottom, glm::vec3(1e-6f));
+	codes[i] = morton3D((centroid - leftBottom) / extent);
+}
+
+// Leaves live at nodeOffset + (n - 1) + i, mirroring the Karras layout where
+// internal nodes occupy [0, n-2].
+__global__ void kernInitLeaves(int n, int nodeOffset, int triOffset,
+	TriangleIdx* triangles, const glm::vec4* vertices, LBVHNode* nodes) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	TriangleIdx tri = triangles[i];
+	glm::vec3 p1 = glm::vec3(vertices[tri.x]);
+	glm::vec3 p2 = glm::vec3(vertices[tri.y]);
+	glm::vec3 p3 = glm::vec3(vertices[tri.z]);
+	LBVHNode& leaf = nodes[nodeOffset + (n - 1) + i];
+	leaf.leftBottom = glm::min(glm::min(p1, p2), p3);
+	leaf.rightTop = glm::max(glm::max(p1, p2), p3);
+	leaf.left = -1;
+	leaf.right = -1;
+	leaf.triangleIndex = triOffset + i;
+	if (n == 1) {
+		leaf.parent = -1;
+	}
+}
+
+// Length of the common Morton code prefix of keys i and j; falls back to
+// index bits so duplicate codes still split deterministically.
+__device__ int commonPrefix(unsigned int* codes, int n, int i, int j) {
+	if (j < 0 || j >= n) {
+		return -1;
+	}
+	if (codes[i] == codes[j]) {
+		return 32 + __clz(i ^ j);
+	}
+	return __clz(codes[i] ^ codes[j]);
+}
+
+// Karras 2012: each internal node i covers a range of sorted keys determined
+// purely from prefix lengths, so all n-1 internal nodes build in parallel.
+__global__ void kernBuildInternal(int n, int nodeOffset,
+	unsigned int* codes, LBVHNode* nodes) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n - 1) {
+		return;
+	}
+
+	// determine range direction
+	int d = commonPrefix(codes, n, i, i + 1) - commonPrefix(codes, n, i, i - 1) >= 0 ? 1 : -1;
+	int deltaMin = commonPrefix(codes, n, i, i - d);
+
+	// find the far end of the range
+	int lmax = 2;
+	while (commonPrefix(codes, n, i, i + lmax * d) > deltaMin) {
+		lmax *= 2;
+	}
+	int l = 0;
+	for (int t = lmax / 2; t >= 1; t /= 2) {
+		if (commonPrefix(codes, n, i, i + (l + t) * d) > deltaMin) {
+			l += t;
+		}
+	}
+	int j = i + l * d;
+
+	// find the split position
+	int deltaNode = commonPrefix(codes, n, i, j);
+	int s = 0;
+	for (int t = (l + 1) / 2; ; t = (t + 1) / 2) {
+		if (commonPrefix(codes, n, i, i + (s + t) * d) > deltaNode) {
+			s += t;
+		}
+		if (t <= 1) {
+			break;
+		}
+	}
+	int split = i + s * d + glm::min(d, 0);
+
+	int first = glm::min(i, j);
+	int last = glm::max(i, j);
+	int left = (first == split) ? nodeOffset + (n - 1) + split : nodeOffset + split;
+	int right = (last == split + 1) ? nodeOffset + (n - 1) + split + 1 : nodeOffset + split + 1;
+
+	LBVHNode& node = nodes[nodeOffset + i];
+	node.left = left;
+	node.right = right;
+	node.triangleIndex = -1;
+	nodes[left].parent = nodeOffset + i;
+	nodes[right].parent = nodeOffset + i;
+	if (i == 0) {
+		node.parent = -1;
+	}
+}
+
+// Bottom-up AABB fit: each leaf climbs toward the root; the second thread to
+// arrive at an internal node merges its children's boxes.
+__global__ void kernFitBounds(int n, int nodeOffset, LBVHNode* nodes, int* flags) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	int node = nodes[nodeOffset + (n - 1) + i].parent;
+	while (node != -1) {
+		if (atomicAdd(&flags[node - nodeOffset], 1) == 0) {
+			// first arrival: the sibling subtree is not done yet
+			return;
+		}
+		__threadfence();
+		LBVHNode& parent = nodes[node];
+		parent.leftBottom = glm::min(nodes[parent.left].leftBottom, nodes[parent.right].leftBottom);
+		parent.rightTop = glm::max(nodes[parent.left].rightTop, nodes[parent.right].rightTop);
+		node = parent.parent;
+	}
+}
+
+int countLBVHNodes(const std::vector<Geom>& geoms) {
+	int total = 0;
+	// instanced meshes share one triangle range and get one tree
+	std::set<int> counted;
+	for (const Geom& geom : geoms) {
+		if (geom.type == MESH && counted.insert(geom.startIndex).second) {
+			total += 2 * (geom.endIndex - geom.startIndex + 1) - 1;
+		}
+	}
+	return total;
+}
+
+// World-space AABB of one geom. Spheres and cubes both fit the canonical
+// [-0.5, 0.5] cube, so transforming its corners bounds either; meshes use
+// their object-space AABB corners instead. Infinite planes get a huge but
+// finite slab (large enough to pass every bounds test, small enough that
+// the transformed corners stay finite in float), so the TLAS always
+// descends to their leaf - which is correct, since most rays hit them.
+static void geomWorldBoundsAtRest(const Geom& geom, glm::vec3& leftBottom, glm::vec3& rightTop) {
+	glm::vec3 lo = geom.type == MESH ? geom.leftBottom : glm::vec3(-0.5f);
+	glm::vec3 hi = geom.type == MESH ? geom.rightTop : glm::vec3(0.5f);
+	if (geom.type == PLANE) {
+		lo = glm::vec3(-1e30f, 0.0f, -1e30f);
+		hi = glm::vec3(1e30f, 0.0f, 1e30f);
+	}
+	leftBottom = glm::vec3(1e38f);
+	rightTop = glm::vec3(-1e38f);
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z);
+		glm::vec3 p = glm::vec3(geom.transform * glm::vec4(corner, 1.0f));
+		leftBottom = glm::min(leftBottom, p);
+		rightTop = glm::max(rightTop, p);
+	}
+}
+
+void geomWorldBounds(const Geom& geom, glm::vec3& leftBottom, glm::vec3& rightTop) {
+	geomWorldBoundsAtRest(geom, leftBottom, rightTop);
+	if (geom.moving) {
+		// cover the whole motion sweep
+		glm::vec3 offset = geom.target - geom.translation;
+		leftBottom = glm::min(leftBottom, leftBottom + offset);
+		rightTop = glm::max(rightTop, rightTop + offset);
+	}
+}
+
+static int buildTLASRecursive(const std::vector<Geom>& geoms, std::vector<LBVHNode>& nodes,
+	std::vector<int>& order, int first, int last) {
+	LBVHNode node;
+	node.leftBottom = glm::vec3(1e38f);
+	node.rightTop = glm::vec3(-1e38f);
+	node.parent = -1;
+	for (int i = first; i <= last; i++) {
+		glm::vec3 lo, hi;
+		geomWorldBounds(geoms[order[i]], lo, hi);
+		node.leftBottom = glm::min(node.leftBottom, lo);
+		node.rightTop = glm::max(node.rightTop, hi);
+	}
+
+	int nodeIndex = nodes.size();
+	nodes.push_back(node);
+	if (first == last) {
+		nodes[nodeIndex].left = -1;
+		nodes[nodeIndex].right = -1;
+		nodes[nodeIndex].triangleIndex = order[first];
+		// leaves keep the rest-pose box; the traversal shifts it by the
+		// ray's sampled time, so the per-instant test stays exact while
+		// the internal nodes above still cover the whole sweep
+		geomWorldBoundsAtRest(geoms[order[first]],
+			nodes[nodeIndex].leftBottom, nodes[nodeIndex].rightTop);
+		return nodeIndex;
+	}
+
+	// median split along the longest axis of the centroid bounds
+	glm::vec3 extent = node.rightTop - node.leftBottom;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	std::sort(order.begin() + first, order.begin() + last + 1, [&](int a, int b) {
+		glm::vec3 loA, hiA, loB, hiB;
+		geomWorldBounds(geoms[a], loA, hiA);
+		geomWorldBounds(geoms[b], loB, hiB);
+		return loA[axis] + hiA[axis] < loB[axis] + hiB[axis];
+	});
+	int mid = (first + last) / 2;
+
+	int left = buildTLASRecursive(geoms, nodes, order, first, mid);
+	int right = buildTLASRecursive(geoms, nodes, order, mid + 1, last);
+	nodes[nodeIndex].left = left;
+	nodes[nodeIndex].right = right;
+	nodes[nodeIndex].triangleIndex = -1;
+	return nodeIndex;
+}
+
+int buildGeomTLAS(const std::vector<Geom>& geoms, std::vector<LBVHNode>& nodes) {
+	nodes.clear();
+	if (geoms.empty()) {
+		return -1;
+	}
+	std::vector<int> order(geoms.size());
+	for (int i = 0; i < (int)geoms.size(); i++) {
+		order[i] = i;
+	}
+	nodes.reserve(2 * geoms.size() - 1);
+	return buildTLASRecursive(geoms, nodes, order, 0, geoms.size() - 1);
+}
+
+int buildMeshLBVH(TriangleIdx* dev_triangles, const glm::vec4* dev_vertices,
+	Geom& geom, LBVHNode* dev_nodes, int nodeOffset) {
+	const int n = geom.endIndex - geom.startIndex + 1;
+	const int blockSize = 128;
+	const int numBlocks = (n + blockSize - 1) / blockSize;
+	TriangleIdx* meshTris = dev_triangles + geom.startIndex;
+
+	thrust::device_vector<unsigned int> codes(n);
+	kernComputeMortonCodes << <numBlocks, blockSize >> > (n, meshTris, dev_vertices,
+		thrust::raw_pointer_cast(codes.data()), geom.leftBottom, geom.rightTop);
+
+	// radix sort the triangle indices by Morton code so leaf order follows
+	// the curve; only the 16-byte index records move, not the vertex data
+	thrust::sort_by_key(codes.begin(), codes.end(),
+		thrust::device_pointer_cast(meshTris));
+
+	kernInitLeaves << <numBlocks, blockSize >> > (n, nodeOffset, geom.startIndex,
+		meshTris, dev_vertices, dev_nodes);
+
+	if (n > 1) {
+		kernBuildInternal << <numBlocks, blockSize >> > (n, nodeOffset,
+			thrust::raw_pointer_cast(codes.data()), dev_nodes);
+
+		thrust::device_vector<int> flags(n - 1, 0);
+		kernFitBounds << <numBlocks, blockSize >> > (n, nodeOffset, dev_nodes,
+			thrust::raw_pointer_cast(flags.data()));
+		geom.bvhRoot = nodeOffset;
+	}
+	else {
+		geom.bvhRoot = nodeOffset;  // the single leaf is the root
+	}
+
+	return 2 * n - 1;
+}
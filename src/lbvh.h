@@ -0,0 +1,45 @@
+#pragma once
+
+#include "sceneStructs.h"
+
+/**
+ * GPU LBVH builder (Morton codes + radix sort + Karras hierarchy) over the
+ * triangles of one mesh Geom. Called from pathtraceInit for every MESH geom.
+ *
+ * Nodes are written into a shared node buffer; indices stored in the nodes
+ * (children, parent, triangleIndex) are absolute indices into that buffer /
+ * into dev_triangles, so traversal needs no per-mesh offsets.
+ *
+ * @param dev_triangles  Device triangle index buffer; the range belonging to
+ *                       this mesh is sorted in place by Morton code.
+ * @param dev_vertices   Device vertex position pool the indices refer to.
+ * @param geom           Host-side geom; bvhRoot is filled in.
+ * @param dev_nodes      Device node buffer.
+ * @param nodeOffset     First free slot in dev_nodes; builds 2n-1 nodes.
+ * @return               Number of nodes written.
+ */
+int buildMeshLBVH(TriangleIdx* dev_triangles, const glm::vec4* dev_vertices,
+    Geom& geom, LBVHNode* dev_nodes, int nodeOffset);
+
+/**
+ * Total node count needed for all MESH geoms in a scene (2n-1 per mesh).
+ */
+int countLBVHNodes(const std::vector<Geom>& geoms);
+
+/**
+ * Host-side top-level BVH (TLAS) over the per-Geom world-space AABBs, built
+ * by recursive median split at pathtraceInit time. Reuses LBVHNode; leaves
+ * store the geom index in triangleIndex. AABBs of moving geoms cover the
+ * whole translation->target sweep.
+ *
+ * @param geoms  Scene geom list.
+ * @param nodes  Output node array (cleared first).
+ * @return       Index of the root node.
+ */
+int buildGeomTLAS(const std::vector<Geom>& geoms, std::vector<LBVHNode>& nodes);
+
+/**
+ * World-space AABB of one geom, as used for the TLAS leaves; moving geoms
+ * cover their whole translation->target sweep.
+ */
+void geomWorldBounds(const Geom& geom, glm::vec3& leftBottom, glm::vec3& rightTop);
@@ -1,6 +1,25 @@
 #include "main.h"
+#include "cputrace.h"
+#include "distributed.h"
 #include "preview.h"
+#include "gbuffer.h"
+#include <stb_image.h>
+#include <stb_image_write.h>
+#include <atomic>
 #include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 static std::string startTimeString;
 
@@ -10,8 +29,64 @@ static bool rightMousePressed = false;
 static bool middleMousePressed = false;
 static double lastX;
 static double lastY;
+// Ctrl+drag region-of-interest selection (see pathtraceSetROI); the
+// anchor is the press position, the release corner closes the rectangle
+static bool roiDragging = false;
+static double roiAnchorX;
+static double roiAnchorY;
 
 static bool camchanged = true;
+// device buffers become resident on the first pathtraceInit and stay that
+// way; camera changes only reset accumulation state
+static bool pathtraceReady = false;
+// set by --resume; consumed once the device buffers exist
+static std::string resumePath;
+// distributed tile rendering (see distributed.cpp): --serve makes this
+// process the coordinator on the given port, --worker connects to one
+static int servePort = 0;
+static const char* workerHost = NULL;
+static int workerPort = 0;
+// --service: persistent render service with a warm scene cache (see
+// runRenderService); scene files on the command line pre-warm it
+static int servicePort = 0;
+// --jobs N: fan the render queue out over N concurrent renderer
+// processes, for batches of small scenes (asset thumbnails) that cannot
+// fill the device one at a time
+static int concurrentJobs = 1;
+// golden-image + timing regression suite (see runRegression): --regress
+// names the reference directory, --regress-update rebaselines it
+static std::string regressDir;
+static bool regressUpdate = false;
+// --headless: no window, no GL interop, no per-iteration PBO traffic;
+// render nodes drive pathtrace() in a plain loop and exit after saving
+static bool headless = false;
+// --tiled N: render the frame locally in NxN crop-window tiles (see
+// distributed.cpp), so path-buffer memory scales with the tile instead of
+// an 8K frame
+static int tileSize = 0;
+// --hybrid N: like --tiled, but the tile queue is shared between the GPU
+// and a pool of CPU tracing threads (see runHybrid); smaller tiles than
+// --tiled keep the CPU side's per-tile latency from stalling the tail
+static int hybridTileSize = 0;
+// --benchmark N: render N iterations headlessly with the timing layer on,
+// then emit one JSON record plus a per-stage CSV for regression tracking
+static int benchmarkIters = 0;
+// --tune: sweep block-size candidates per kernel class and cache the
+// winners in launchconfig.txt, keyed by GPU model
+static bool tuneLaunch = false;
+// --cputrace: render on the host CPU instead of the GPU (cputrace.cu);
+// overflow capacity for farm nodes whose GPUs are busy or absent
+static bool cpuTrace = false;
+// --trace FILE: record a chrome://tracing timeline of the render (GPU
+// stage spans plus host brackets) and write it when the render finishes
+static std::string traceOutPath;
+// --stream PORT: serve a browser-viewable preview stream of the
+// accumulation on localhost:PORT, fed one frame per snapshot
+static int streamPort = 0;
+// render queue: every non-flag argument is a scene file, rendered in order
+// within this one process (one CUDA context, one arena)
+static std::vector<std::string> sceneFiles;
+static size_t currentJob = 0;
 static float dtheta = 0, dphi = 0;
 static glm::vec3 cammove;
 
@@ -26,24 +101,448 @@ int iteration;
 int width;
 int height;
 
-//-------------------------------
-//-------------MAIN--------------
-//-------------------------------
+// Snapshot writer thread: saveImage hands a copy of the accumulation to
+// this worker and returns, so the flip/normalize and the PNG encode never
+// stall the GLFW loop. One job slot, double-buffered against
+// renderState->image: the render thread refills state.image while the
+// worker encodes its own copy.
+struct SnapshotJob {
+    std::vector<glm::vec3> pixels;
+    // AOV accumulations riding along when the tracer was built with
+    // AOV_ENABLE; empty otherwise (pathtraceGetAOVs)
+    std::vector<glm::vec3> aovNormal;
+    std::vector<float> aovDepth;
+    std::vector<glm::vec3> aovAlbedo;
+    std::vector<glm::vec3> aovDirect;
+    float samples;
+    std::string filename;
+};
+static SnapshotJob snapshotJob;
+static bool snapshotPending = false;
+static bool snapshotBusy = false;
+static bool snapshotQuit = false;
+static std::thread snapshotThread;
+static std::mutex snapshotMutex;
+static std::condition_variable snapshotCv;
 
-int main(int argc, char** argv) {
-    startTimeString = currentTimeString();
+// Flip and normalize the snapshot into img. The loop is row-independent
+// and memory-bound, so rows are just split evenly across hardware threads.
+static void convertSnapshot(const SnapshotJob& job, image& img) {
+    int nThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    int rowsPerThread = (height + nThreads - 1) / nThreads;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < nThreads; t++) {
+        int y0 = t * rowsPerThread;
+        int y1 = std::min(height, y0 + rowsPerThread);
+        if (y0 >= y1) {
+            break;
+        }
+        workers.emplace_back([&job, &img, y0, y1]() {
+            for (int y = y0; y < y1; y++) {
+                for (int x = 0; x < width; x++) {
+                    int index = x + (y * width);
+                    img.setPixel(width - 1 - x, y, job.pixels[index] / job.samples);
+                }
+            }
+        });
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+}
 
-    if (argc < 2) {
-        printf("Usage: %s SCENEFILE.txt\n", argv[0]);
-        return 1;
+// Final-frame denoise through Intel Open Image Denoise: every snapshot
+// additionally runs the trained RT filter over the beauty mean (guided by
+// the albedo and normal AOVs when the tracer was built with AOV_ENABLE)
+// and writes the result next to the raw accumulation as
+// <name>.denoised.png/.exr. The A-Trous pass stays the interactive
+// preview path; this one is for delivery, where it buys roughly the same
+// perceived quality at a fraction of the iterations. Requires an OIDN
+// install (OIDN_INSTALL_DIR in CMakeLists.txt); the library picks its
+// CPU or GPU backend at runtime.
+#define OIDN_ENABLE 0
+
+#if OIDN_ENABLE
+#include <OpenImageDenoise/oidn.h>
+
+// Runs on the snapshot worker thread, so the filter (seconds on big
+// frames with the CPU backend) never stalls the render loop. The device
+// is created once and reused across snapshots.
+static void denoiseSnapshot(const SnapshotJob& job) {
+    static OIDNDevice oidnDevice = NULL;
+    if (oidnDevice == NULL) {
+        oidnDevice = oidnNewDevice(OIDN_DEVICE_TYPE_DEFAULT);
+        oidnCommitDevice(oidnDevice);
+    }
+    int n = width * height;
+    std::vector<glm::vec3> color(n);
+    std::vector<glm::vec3> output(n);
+    for (int i = 0; i < n; i++) {
+        color[i] = job.pixels[i] / job.samples;
+    }
+    OIDNFilter filter = oidnNewFilter(oidnDevice, "RT");
+    oidnSetSharedFilterImage(filter, "color", color.data(),
+        OIDN_FORMAT_FLOAT3, width, height, 0, 0, 0);
+    std::vector<glm::vec3> albedo;
+    std::vector<glm::vec3> normal;
+    if (!job.aovAlbedo.empty()) {
+        albedo.resize(n);
+        normal.resize(n);
+        for (int i = 0; i < n; i++) {
+            albedo[i] = job.aovAlbedo[i] / job.samples;
+            normal[i] = job.aovNormal[i] / job.samples;
+        }
+        oidnSetSharedFilterImage(filter, "albedo", albedo.data(),
+            OIDN_FORMAT_FLOAT3, width, height, 0, 0, 0);
+        oidnSetSharedFilterImage(filter, "normal", normal.data(),
+            OIDN_FORMAT_FLOAT3, width, height, 0, 0, 0);
+    }
+    oidnSetSharedFilterImage(filter, "output", output.data(),
+        OIDN_FORMAT_FLOAT3, width, height, 0, 0, 0);
+    oidnSetFilterBool(filter, "hdr", true);
+    oidnCommitFilter(filter);
+    oidnExecuteFilter(filter);
+    const char* message;
+    if (oidnGetDeviceError(oidnDevice, &message) != OIDN_ERROR_NONE) {
+        std::cout << "OIDN: " << message << std::endl;
+        oidnReleaseFilter(filter);
+        return;
     }
+    oidnReleaseFilter(filter);
 
-    const char *sceneFile = argv[1];
+    image denoised(width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            // mirror convertSnapshot's flip
+            denoised.setPixel(width - 1 - x, y, output[x + y * width]);
+        }
+    }
+    denoised.savePNG(job.filename + ".denoised");
+    denoised.saveEXR(job.filename + ".denoised");
+}
+#endif // OIDN_ENABLE
 
-    // Load scene file
-    scene = new Scene(sceneFile);
+// Shared-memory output surface (--surface): external viewers and
+// compositing pre-checks want the live image without our GLFW window or
+// polling snapshot files, so the latest frame is mapped into a POSIX
+// shared-memory segment other processes open read-only - zero copies, no
+// sockets. The layout is a SurfaceHeader followed by a width*height RGBA8
+// plane in saved-PNG orientation (blit it as-is) and the width*height
+// float RGB accumulation in render order (divide by `samples`). `frame`
+// is a seqlock: odd while the writer is mid-update, so a reader copies,
+// rereads, and retries until it saw the same even value on both sides.
+// Updated from the snapshot worker, where a host copy of the accumulation
+// already exists, so publishing costs no extra device traffic. A crash
+// leaves the segment behind (/dev/shm/ptsurface); normal exits unlink it.
+struct SurfaceHeader {
+    char magic[4];       // "PTSF"
+    int version;
+    int width, height;
+    int samples;         // divisor for the float accumulation plane
+    long long frame;     // seqlock, odd while mid-update
+};
 
-    // Set up camera stuff from loaded path tracer settings
+// --surface: publish frames to the shared-memory surface
+static bool shmSurface = false;
+
+#ifndef _WIN32
+static const char* kSurfaceName = "/ptsurface";
+static char* surfaceBase = NULL;
+
+static void surfacePublish(const SnapshotJob& job) {
+    if (!shmSurface) {
+        return;
+    }
+    size_t rgbaBytes = (size_t)width * height * 4;
+    size_t bytes = sizeof(SurfaceHeader) + rgbaBytes
+        + (size_t)width * height * sizeof(glm::vec3);
+    if (surfaceBase == NULL) {
+        int fd = shm_open(kSurfaceName, O_CREAT | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)bytes) != 0) {
+            fprintf(stderr, "surface: cannot create %s, disabling\n",
+                kSurfaceName);
+            if (fd >= 0) {
+                close(fd);
+            }
+            shmSurface = false;
+            return;
+        }
+        surfaceBase = (char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+        close(fd);
+        if (surfaceBase == MAP_FAILED) {
+            surfaceBase = NULL;
+            shmSurface = false;
+            return;
+        }
+        SurfaceHeader* h = (SurfaceHeader*)surfaceBase;
+        memcpy(h->magic, "PTSF", 4);
+        h->version = 1;
+        h->width = width;
+        h->height = height;
+        h->samples = 0;
+        h->frame = 0;
+        printf("surface: publishing to /dev/shm%s\n", kSurfaceName);
+    }
+    SurfaceHeader* h = (SurfaceHeader*)surfaceBase;
+    unsigned char* rgba = (unsigned char*)(surfaceBase + sizeof(SurfaceHeader));
+    glm::vec3* accum = (glm::vec3*)(rgba + rgbaBytes);
+
+    h->frame++;  // odd: readers back off
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            // savePNG's normalize + horizontal mirror, alpha opaque
+            glm::vec3 p = glm::clamp(
+                job.pixels[x + y * width] / job.samples, 0.0f, 1.0f) * 255.0f;
+            size_t o = ((size_t)y * width + (width - 1 - x)) * 4;
+            rgba[o + 0] = (unsigned char)p.x;
+            rgba[o + 1] = (unsigned char)p.y;
+            rgba[o + 2] = (unsigned char)p.z;
+            rgba[o + 3] = 255;
+        }
+    }
+    memcpy(accum, job.pixels.data(),
+        (size_t)width * height * sizeof(glm::vec3));
+    h->samples = (int)job.samples;
+    std::atomic_thread_fence(std::memory_order_release);
+    h->frame++;  // even again: this frame is consistent
+}
+
+static void surfaceStop() {
+    if (surfaceBase != NULL) {
+        munmap(surfaceBase, sizeof(SurfaceHeader)
+            + (size_t)width * height * 4
+            + (size_t)width * height * sizeof(glm::vec3));
+        surfaceBase = NULL;
+        shm_unlink(kSurfaceName);
+    }
+}
+#else
+// POSIX shared memory only; the flag warns and stays off on Windows
+static void surfacePublish(const SnapshotJob& job) {}
+static void surfaceStop() {}
+#endif
+
+// Review-video capture (--video FILE): animation frames - and the
+// snapshot-cadence frames of a still render, which make a convergence
+// progression - are piped as raw RGB into an ffmpeg child process that
+// hands them to NVENC (h264_nvenc), so the turntable exists as H.264 the
+// moment the render does instead of after an hour of PNG post-handling.
+// The encoder silicon idles on every render GPU and ffmpeg ships on the
+// farm nodes; feeding the device buffer to the encoder directly would
+// mean vendoring the Video Codec SDK for a copy the host pixel path has
+// already paid for, so the frames ride that path instead.
+static std::string videoOutPath;
+static FILE* videoPipe = NULL;
+static bool videoFailed = false;
+
+#ifdef _WIN32
+#define PT_POPEN(cmd) _popen(cmd, "wb")
+#define PT_PCLOSE _pclose
+#else
+#define PT_POPEN(cmd) popen(cmd, "w")
+#define PT_PCLOSE pclose
+#endif
+
+static void videoWriteFrame(const std::vector<glm::vec3>& accum, int w, int h,
+        float samples) {
+    if (videoOutPath.empty() || videoFailed) {
+        return;
+    }
+    if (videoPipe == NULL) {
+        char cmd[1024];
+        // yuv420p for player compatibility; swap h264_nvenc for libx264
+        // on the odd node without encoder silicon
+        snprintf(cmd, sizeof(cmd),
+            "ffmpeg -v error -y -f rawvideo -pix_fmt rgb24 -s %dx%d -r 30 "
+            "-i - -c:v h264_nvenc -pix_fmt yuv420p \"%s\"",
+            w, h, videoOutPath.c_str());
+        videoPipe = PT_POPEN(cmd);
+        if (videoPipe == NULL) {
+            fprintf(stderr, "video: cannot start ffmpeg, disabling capture\n");
+            videoFailed = true;
+            return;
+        }
+        printf("video: encoding %s\n", videoOutPath.c_str());
+    }
+    // savePNG's normalize + horizontal mirror, packed RGB24
+    std::vector<unsigned char> rgb((size_t)w * h * 3);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            glm::vec3 p = glm::clamp(
+                accum[x + (size_t)y * w] / samples, 0.0f, 1.0f) * 255.0f;
+            size_t o = ((size_t)y * w + (w - 1 - x)) * 3;
+            rgb[o + 0] = (unsigned char)p.x;
+            rgb[o + 1] = (unsigned char)p.y;
+            rgb[o + 2] = (unsigned char)p.z;
+        }
+    }
+    if (fwrite(rgb.data(), 1, rgb.size(), videoPipe) != rgb.size()) {
+        fprintf(stderr, "video: encoder pipe closed, disabling capture\n");
+        PT_PCLOSE(videoPipe);
+        videoPipe = NULL;
+        videoFailed = true;
+    }
+}
+
+static void videoStop() {
+    if (videoPipe != NULL) {
+        PT_PCLOSE(videoPipe);
+        videoPipe = NULL;
+        printf("video: finished %s\n", videoOutPath.c_str());
+    }
+}
+
+static void snapshotWorker() {
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    for (;;) {
+        snapshotCv.wait(lock, [] { return snapshotPending || snapshotQuit; });
+        if (!snapshotPending) {
+            // quit requested and nothing left to drain
+            return;
+        }
+        SnapshotJob job = std::move(snapshotJob);
+        snapshotPending = false;
+        snapshotBusy = true;
+        snapshotCv.notify_all();
+        lock.unlock();
+
+        image img(width, height);
+        convertSnapshot(job, img);
+        img.savePNG(job.filename);
+        // the same frame feeds the preview stream, the shared-memory
+        // surface and the progression video, if anyone asked for them
+        previewStreamPublish(job.pixels, width, height, job.samples);
+        surfacePublish(job);
+        videoWriteFrame(job.pixels, width, height, job.samples);
+        // float master for compositing next to the 8-bit preview; when the
+        // tracer captured AOVs they become layers of the same EXR, with
+        // indirect derived as beauty minus direct so the split always sums
+        // back to the beauty pass
+        if (!job.aovDirect.empty()) {
+            image normalImg(width, height);
+            image depthImg(width, height);
+            image albedoImg(width, height);
+            image directImg(width, height);
+            image indirectImg(width, height);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    int index = x + (y * width);
+                    int ox = width - 1 - x;  // mirror convertSnapshot's flip
+                    glm::vec3 direct = job.aovDirect[index] / job.samples;
+                    normalImg.setPixel(ox, y, job.aovNormal[index] / job.samples);
+                    depthImg.setPixel(ox, y, glm::vec3(job.aovDepth[index] / job.samples));
+                    albedoImg.setPixel(ox, y, job.aovAlbedo[index] / job.samples);
+                    directImg.setPixel(ox, y, direct);
+                    indirectImg.setPixel(ox, y, job.pixels[index] / job.samples - direct);
+                }
+            }
+            std::vector<image::Layer> layers;
+            image::Layer layer;
+            layer.name = "normal";
+            layer.img = &normalImg;
+            layers.push_back(layer);
+            layer.name = "depth";
+            layer.img = &depthImg;
+            layers.push_back(layer);
+            layer.name = "albedo";
+            layer.img = &albedoImg;
+            layers.push_back(layer);
+            layer.name = "direct";
+            layer.img = &directImg;
+            layers.push_back(layer);
+            layer.name = "indirect";
+            layer.img = &indirectImg;
+            layers.push_back(layer);
+            img.saveEXR(job.filename, layers);
+        }
+        else {
+            img.saveEXR(job.filename);
+        }
+#if OIDN_ENABLE
+        denoiseSnapshot(job);
+#endif // OIDN_ENABLE
+
+        lock.lock();
+        snapshotBusy = false;
+        snapshotCv.notify_all();
+    }
+}
+
+
+// Snapshot schedule: progressive outputs every so many iterations or
+// seconds (whichever fires first), for farm monitoring and dailies. The
+// device copy is staged right after an iteration is queued and consumed a
+// frame later, so accumulation never pauses for a snapshot.
+#define SNAPSHOT_ITERATION_INTERVAL 100
+#define SNAPSHOT_SECONDS 60.0
+static bool snapshotReadbackPending = false;
+static int snapshotReadbackIteration = 0;
+static double lastSnapshotTime = std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+
+// Frame-budget scheduler for the interactive preview: while the camera is
+// moving, accumulation restarts every frame anyway, so per-frame latency is
+// all that matters. An exponential average of the iteration's wall time
+// drives the trace depth down toward the budget one bounce at a time (depth
+// is re-read from RenderState every iteration, so no re-init is involved)
+// and back up when frames come in cheap. Once the camera has been still
+// long enough the full depth returns and accumulation restarts, so the
+// converged image never mixes shallow and deep iterations.
+#define PREVIEW_BUDGET_MS 33.0
+#define PREVIEW_IDLE_SECONDS 0.25
+// Iteration batching for the display loop: vsync hands runCuda one call
+// per displayed frame, so a cheap iteration would leave the GPU idle for
+// the rest of the interval. Each call keeps issuing PBO-less iterations
+// while one more is predicted to fit the budget (a little under a 60Hz
+// interval, leaving room for the GL blit) and lets only the last of the
+// burst feed the PBO. Headless runs have no display interval and keep the
+// one-iteration shape.
+#define DISPLAY_BUDGET_MS 14.0
+static int fullTraceDepth = 0;       // scene file's depth, captured lazily
+static double frameMsAvg = 0.0;
+static double lastCamMoveTime = 0.0;
+
+// Publish the staged pixels (a frame old by now, so the wait is near zero)
+// and hand them to the encode worker under a numbered name.
+static void queueSnapshot(int snapIteration) {
+    downloadImageWait();
+
+    std::string filename = renderState->imageName;
+    std::ostringstream ss;
+    ss << filename << "." << startTimeString << ".snap" << snapIteration;
+    filename = ss.str();
+
+    if (!snapshotThread.joinable()) {
+        snapshotThread = std::thread(snapshotWorker);
+    }
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    snapshotCv.wait(lock, [] { return !snapshotPending; });
+    snapshotJob.pixels.assign(renderState->image.begin(), renderState->image.end());
+    snapshotJob.samples = (float)snapIteration;
+    snapshotJob.filename = filename;
+    snapshotPending = true;
+    snapshotCv.notify_all();
+}
+
+// Drain whatever is queued and retire the worker. Called on the exit paths
+// so the final save is never cut off mid-encode.
+static void snapshotShutdown() {
+    if (!snapshotThread.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(snapshotMutex);
+        snapshotQuit = true;
+    }
+    snapshotCv.notify_all();
+    snapshotThread.join();
+}
+
+// Set up the orbit-control state from the active scene's camera. Shared by
+// startup and the render queue's job advance.
+static void setupCameraControls() {
     iteration = 0;
     renderState = &scene->state;
     Camera &cam = renderState->camera;
@@ -65,42 +564,1203 @@ int main(int argc, char** argv) {
     theta = glm::acos(glm::dot(glm::normalize(viewZY), glm::vec3(0, 1, 0)));
     ogLookAt = cam.lookAt;
     zoom = glm::length(cam.position - ogLookAt);
+    camchanged = true;
+}
+
+// Swap in the next queued scene, if any. The CUDA context, streams and
+// arena are reused inside pathtraceInit; only the scene buffers turn over.
+static bool advanceToNextJob() {
+    while (currentJob + 1 < sceneFiles.size()) {
+        currentJob++;
+        Scene* next = new Scene(sceneFiles[currentJob]);
+        Camera& cam = next->state.camera;
+        if (!headless && (cam.resolution.x != width || cam.resolution.y != height)) {
+            // the GL window and PBO are sized once at startup; mismatched
+            // resolutions need a headless run
+            printf("Skipping %s: resolution differs from the window\n",
+                sceneFiles[currentJob].c_str());
+            delete next;
+            continue;
+        }
+        delete scene;
+        scene = next;
+        setupCameraControls();
+        pathtraceReady = false;
+        // the budget scheduler re-captures the new scene's depth
+        fullTraceDepth = 0;
+        frameMsAvg = 0.0;
+        return true;
+    }
+    return false;
+}
+
+// Hot reload: poll the active scene's source files (scene text or packed
+// blob, meshes, textures, environment map) once a second during
+// interactive runs. An edit that only moves material values is patched
+// onto the device in place; anything else swaps the freshly parsed scene
+// into the live context the same way the render queue advances jobs, so
+// the cost is a parse plus a scene-buffer re-upload instead of a process
+// restart with its CUDA and GL init. A change is acted on only once two
+// consecutive polls agree on the new timestamps, so a file an editor is
+// still writing gets left alone.
+#define HOT_RELOAD_POLL_SECONDS 1.0
+static double lastWatchPollTime = 0.0;
+static std::vector<long long> pendingWatchMtimes;
+static bool reloadPending = false;
+
+// true when the edit touched nothing the device-resident pools, textures
+// or acceleration structures were built from, so swapping the material
+// palette is the whole job
+static bool materialOnlyEdit(const Scene* a, const Scene* b) {
+    if (a->geoms.size() != b->geoms.size()
+        || a->materials.size() != b->materials.size()
+        || a->vertices.size() != b->vertices.size()
+        || a->triangles.size() != b->triangles.size()
+        || a->textures.size() != b->textures.size()
+        || a->bvhNodes.size() != b->bvhNodes.size()
+        || a->state.traceDepth != b->state.traceDepth
+        || a->state.iterations != b->state.iterations
+        || a->state.frames != b->state.frames
+        || memcmp(&a->medium, &b->medium, sizeof(Medium)) != 0
+        || memcmp(&a->state.camera, &b->state.camera, sizeof(Camera)) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < a->geoms.size(); i++) {
+        const Geom& ga = a->geoms[i];
+        const Geom& gb = b->geoms[i];
+        if (ga.type != gb.type || ga.materialid != gb.materialid
+            || ga.startIndex != gb.startIndex || ga.endIndex != gb.endIndex
+            || ga.transform != gb.transform || ga.moving != gb.moving) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a->textures.size(); i++) {
+        if (a->textures[i].pixels != b->textures[i].pixels) {
+            return false;
+        }
+    }
+    // content checks catch a mesh edit that kept every count the same
+    return a->vertices == b->vertices && a->normals == b->normals
+        && a->uvs == b->uvs && a->triangles == b->triangles
+        && a->envMap == b->envMap;
+}
+
+static void checkSceneHotReload() {
+    double now = std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (now - lastWatchPollTime < HOT_RELOAD_POLL_SECONDS) {
+        return;
+    }
+    lastWatchPollTime = now;
+
+    std::vector<long long> mtimes(scene->watchedFiles.size());
+    bool changed = false;
+    for (size_t i = 0; i < scene->watchedFiles.size(); i++) {
+        mtimes[i] = utilityCore::fileModTime(scene->watchedFiles[i].path);
+        changed = changed || mtimes[i] != scene->watchedFiles[i].mtime;
+    }
+    if (!changed) {
+        reloadPending = false;
+        return;
+    }
+    if (!reloadPending || mtimes != pendingWatchMtimes) {
+        // first sight of the edit, or the timestamps are still moving:
+        // give the writer one more poll interval to finish
+        pendingWatchMtimes = mtimes;
+        reloadPending = true;
+        return;
+    }
+    reloadPending = false;
+
+    printf("Hot reload: re-reading %s\n", sceneFiles[currentJob].c_str());
+    Scene* next = new Scene(sceneFiles[currentJob]);
+    if (pathtraceReady && materialOnlyEdit(scene, next)) {
+        // patch the changed materials onto the device in place; geometry,
+        // pools and acceleration structures all stay resident
+        for (int i = 0; i < (int)next->materials.size(); i++) {
+            if (memcmp(&scene->materials[i], &next->materials[i], sizeof(Material)) != 0) {
+                scene->materials[i] = next->materials[i];
+                pathtraceUpdateMaterial(i);
+            }
+        }
+        scene->watchedFiles = next->watchedFiles;
+        delete next;
+        // the device accumulation restarted with the first patch; restart
+        // the display divisor (and drop any staged readback) with it
+        iteration = 0;
+        snapshotReadbackPending = false;
+        return;
+    }
+    Camera& cam = next->state.camera;
+    if (!headless && (cam.resolution.x != width || cam.resolution.y != height)) {
+        // the GL window and PBO are sized once at startup; adopt the new
+        // timestamps so the message prints once, not every poll
+        printf("Hot reload: resolution changed, restart to apply\n");
+        scene->watchedFiles = next->watchedFiles;
+        delete next;
+        return;
+    }
+    delete scene;
+    scene = next;
+    setupCameraControls();
+    pathtraceReady = false;
+    fullTraceDepth = 0;
+    frameMsAvg = 0.0;
+    snapshotReadbackPending = false;
+}
+
+//-------------------------------
+//-------------MAIN--------------
+//-------------------------------
+
+// NVML telemetry for benchmark runs. Perf-per-watt is what the farm
+// actually buys, and a thermally throttled node reports kernel
+// "regressions" that are really clocks: --benchmark therefore samples the
+// SM clock, power draw, temperature and throttle-reason bitmask at 10 Hz
+// on a thread for the duration of the run, summarizes them into the
+// .bench.json record next to the per-stage timings, and integrates power
+// into joules for the rendered frame. NVML ships with the driver rather
+// than the toolkit, so the library is loaded at runtime with the handful
+// of entry points declared here; a machine without it (or a non-NVIDIA
+// display node) just omits the fields.
+typedef struct nvmlDevice_st* nvmlDevice_t;
+typedef int (*NvmlInitFn)(void);
+typedef int (*NvmlShutdownFn)(void);
+typedef int (*NvmlGetHandleFn)(unsigned int, nvmlDevice_t*);
+typedef int (*NvmlGetClockFn)(nvmlDevice_t, int, unsigned int*);
+typedef int (*NvmlGetPowerFn)(nvmlDevice_t, unsigned int*);
+typedef int (*NvmlGetTempFn)(nvmlDevice_t, int, unsigned int*);
+typedef int (*NvmlGetThrottleFn)(nvmlDevice_t, unsigned long long*);
+
+// run summary; valid stays false when the library or device is absent
+struct NvmlStats {
+    bool valid = false;
+    int samples = 0;
+    unsigned int smClockFirst = 0;   // the run's starting (baseline) clock
+    unsigned int smClockMin = 0;
+    unsigned int smClockMax = 0;
+    double smClockMean = 0.0;
+    double powerWattsMean = 0.0;
+    unsigned int tempMax = 0;
+    unsigned long long throttleReasons = 0;  // OR over the whole run
+    double energyJoules = 0.0;  // mean power x wall seconds
+};
+
+static NvmlShutdownFn nvmlShutdownFn = NULL;
+static NvmlGetClockFn nvmlGetClockFn = NULL;
+static NvmlGetPowerFn nvmlGetPowerFn = NULL;
+static NvmlGetTempFn nvmlGetTempFn = NULL;
+static NvmlGetThrottleFn nvmlGetThrottleFn = NULL;
+static nvmlDevice_t nvmlDevice = NULL;
+static std::thread nvmlThread;
+static std::atomic<bool> nvmlStop(false);
+static NvmlStats nvmlStats;
+
+static bool nvmlLoad() {
+#ifdef _WIN32
+    HMODULE lib = LoadLibraryA("nvml.dll");
+    if (lib == NULL) {
+        return false;
+    }
+#define NVML_SYM(fn, name) fn = (decltype(fn))GetProcAddress(lib, name)
+#else
+    void* lib = dlopen("libnvidia-ml.so.1", RTLD_NOW);
+    if (lib == NULL) {
+        lib = dlopen("libnvidia-ml.so", RTLD_NOW);
+    }
+    if (lib == NULL) {
+        return false;
+    }
+#define NVML_SYM(fn, name) fn = (decltype(fn))dlsym(lib, name)
+#endif
+    NvmlInitFn init;
+    NvmlGetHandleFn getHandle;
+    NVML_SYM(init, "nvmlInit_v2");
+    NVML_SYM(getHandle, "nvmlDeviceGetHandleByIndex_v2");
+    NVML_SYM(nvmlShutdownFn, "nvmlShutdown");
+    NVML_SYM(nvmlGetClockFn, "nvmlDeviceGetClockInfo");
+    NVML_SYM(nvmlGetPowerFn, "nvmlDeviceGetPowerUsage");
+    NVML_SYM(nvmlGetTempFn, "nvmlDeviceGetTemperature");
+    NVML_SYM(nvmlGetThrottleFn, "nvmlDeviceGetCurrentClocksThrottleReasons");
+#undef NVML_SYM
+    if (init == NULL || getHandle == NULL || nvmlShutdownFn == NULL
+        || nvmlGetClockFn == NULL || nvmlGetPowerFn == NULL
+        || nvmlGetTempFn == NULL || nvmlGetThrottleFn == NULL) {
+        return false;
+    }
+    // device 0 matches initCuda's cudaSetDevice(0); NVML enumerates by
+    // PCI order, which can differ from CUDA's on multi-GPU nodes, but the
+    // farm's benchmark nodes have one GPU each
+    return init() == 0 && getHandle(0, &nvmlDevice) == 0;
+}
+
+static void nvmlSamplerStart() {
+    nvmlStats = NvmlStats();
+    if (!nvmlLoad()) {
+        return;
+    }
+    nvmlStop = false;
+    nvmlThread = std::thread([] {
+        double clockSum = 0.0, powerSum = 0.0;
+        while (!nvmlStop) {
+            unsigned int clockMhz = 0, powerMw = 0, temp = 0;
+            unsigned long long throttle = 0;
+            // clock type 1 = SM, temperature sensor 0 = the GPU die
+            if (nvmlGetClockFn(nvmlDevice, 1, &clockMhz) != 0
+                || nvmlGetPowerFn(nvmlDevice, &powerMw) != 0) {
+                break;
+            }
+            nvmlGetTempFn(nvmlDevice, 0, &temp);
+            nvmlGetThrottleFn(nvmlDevice, &throttle);
+
+            if (nvmlStats.samples == 0) {
+                nvmlStats.smClockFirst = clockMhz;
+                nvmlStats.smClockMin = clockMhz;
+                nvmlStats.smClockMax = clockMhz;
+            }
+            nvmlStats.smClockMin = std::min(nvmlStats.smClockMin, clockMhz);
+            nvmlStats.smClockMax = std::max(nvmlStats.smClockMax, clockMhz);
+            nvmlStats.tempMax = std::max(nvmlStats.tempMax, temp);
+            nvmlStats.throttleReasons |= throttle;
+            clockSum += clockMhz;
+            powerSum += powerMw * 1e-3;
+            nvmlStats.samples++;
+            nvmlStats.smClockMean = clockSum / nvmlStats.samples;
+            nvmlStats.powerWattsMean = powerSum / nvmlStats.samples;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    });
+}
+
+static void nvmlSamplerStop(double wallSec) {
+    if (!nvmlThread.joinable()) {
+        return;
+    }
+    nvmlStop = true;
+    nvmlThread.join();
+    nvmlShutdownFn();
+    if (nvmlStats.samples == 0) {
+        return;
+    }
+    nvmlStats.valid = true;
+    nvmlStats.energyJoules = nvmlStats.powerWattsMean * wallSec;
+
+    // a clock sag past measurement noise means the per-stage timings mix
+    // throttled and unthrottled iterations; flag the record as suspect
+    if (nvmlStats.smClockMin < nvmlStats.smClockFirst * 95 / 100) {
+        printf("WARNING: SM clock fell from %u to %u MHz during the run "
+            "(throttle reasons 0x%llx); timings include throttling\n",
+            nvmlStats.smClockFirst, nvmlStats.smClockMin,
+            nvmlStats.throttleReasons);
+    }
+}
+
+// Render a fixed number of iterations with no window and no PBO traffic,
+// per-stage timing forced on, then write <imageName>.bench.json (scene,
+// GPU model, build config, wall time, rays/sec, device memory, per-bounce
+// live-path means) and <imageName>.bench.csv (one row per populated
+// (stage, bounce) timing slot). The JSON is one self-contained record per
+// run so nightly sweeps can append and diff them; the CSV feeds the same
+// plots profile.xlsx used to be filled with by hand.
+static int runBenchmark(const std::string& sceneFile, int iterations) {
+    renderState = &scene->state;
+    Camera& cam = renderState->camera;
+    width = cam.resolution.x;
+    height = cam.resolution.y;
+
+    pathtraceProfileSetActive(true);
+    pathtraceInit(scene);
+    nvmlSamplerStart();
+
+    auto wallStart = std::chrono::steady_clock::now();
+    for (int iter = 1; iter <= iterations; iter++) {
+        pathtrace(NULL, 0, iter);
+    }
+    double wallSec = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - wallStart).count();
+    nvmlSamplerStop(wallSec);
+
+    // rays per iteration as the launch grids saw them: with compaction the
+    // per-bounce counts shrink, without it every bounce runs full
+    double raysPerIter = 0.0;
+    int numBounces = 0;
+    for (int b = 0; b < renderState->traceDepth; b++) {
+        double alive = pathtracePathsAlivePerBounce(b);
+        if (alive <= 0.0) {
+            break;
+        }
+        raysPerIter += alive;
+        numBounces = b + 1;
+    }
+    double raysPerSec = raysPerIter * iterations / wallSec;
+
+    char gpuName[256];
+    size_t memUsed = 0, memTotal = 0;
+    pathtraceDeviceInfo(gpuName, sizeof(gpuName), &memUsed, &memTotal);
+
+    ProfileStageStats stageStats[512];
+    int numStages = pathtraceProfileSnapshot(stageStats, 512);
+    KernelRegionStats regionStats[16];
+    int numRegions = pathtraceKernelProfileSnapshot(regionStats, 16);
+
+    std::string base = renderState->imageName + ".bench";
+
+    FILE* json = fopen((base + ".json").c_str(), "w");
+    if (json != NULL) {
+        fprintf(json, "{\n");
+        fprintf(json, "  \"scene\": \"%s\",\n", renderState->imageName.c_str());
+        fprintf(json, "  \"scene_file\": \"%s\",\n", sceneFile.c_str());
+        fprintf(json, "  \"gpu\": \"%s\",\n", gpuName);
+        fprintf(json, "  \"build\": \"%s\",\n", pathtraceBuildConfig());
+        fprintf(json, "  \"resolution\": [%d, %d],\n", width, height);
+        fprintf(json, "  \"trace_depth\": %d,\n", renderState->traceDepth);
+        fprintf(json, "  \"iterations\": %d,\n", iterations);
+        fprintf(json, "  \"wall_seconds\": %.4f,\n", wallSec);
+        fprintf(json, "  \"rays_per_second\": %.0f,\n", raysPerSec);
+        fprintf(json, "  \"device_mem_used_bytes\": %llu,\n",
+            (unsigned long long)memUsed);
+        fprintf(json, "  \"device_mem_total_bytes\": %llu,\n",
+            (unsigned long long)memTotal);
+        // present only when NVML loaded; the benchmark renders one frame,
+        // so the run's energy IS the frame's joules
+        if (nvmlStats.valid) {
+            fprintf(json, "  \"sm_clock_mhz\": {\"mean\": %.0f, \"min\": %u, "
+                "\"max\": %u, \"baseline\": %u},\n",
+                nvmlStats.smClockMean, nvmlStats.smClockMin,
+                nvmlStats.smClockMax, nvmlStats.smClockFirst);
+            fprintf(json, "  \"power_watts_mean\": %.1f,\n",
+                nvmlStats.powerWattsMean);
+            fprintf(json, "  \"temperature_c_max\": %u,\n", nvmlStats.tempMax);
+            fprintf(json, "  \"throttle_reasons\": \"0x%llx\",\n",
+                nvmlStats.throttleReasons);
+            fprintf(json, "  \"joules_per_frame\": %.1f,\n",
+                nvmlStats.energyJoules);
+        }
+        fprintf(json, "  \"paths_alive_per_bounce\": [");
+        for (int b = 0; b < numBounces; b++) {
+            fprintf(json, "%s%.1f", b > 0 ? ", " : "",
+                pathtracePathsAlivePerBounce(b));
+        }
+        fprintf(json, "],\n");
+        // intra-kernel attribution, present only in KERNEL_PROFILE_ENABLE
+        // builds (pathtraceConfig.h)
+        if (numRegions > 0) {
+            fprintf(json, "  \"kernel_regions\": [\n");
+            for (int i = 0; i < numRegions; i++) {
+                const KernelRegionStats& kr = regionStats[i];
+                fprintf(json, "    {\"region\": \"%s\", \"visits\": %.0f, "
+                    "\"cycles\": %.0f, \"share\": %.4f}%s\n",
+                    kr.region, kr.visits, kr.cycles, kr.share,
+                    i + 1 < numRegions ? "," : "");
+            }
+            fprintf(json, "  ],\n");
+        }
+        fprintf(json, "  \"stages\": [\n");
+        for (int i = 0; i < numStages; i++) {
+            const ProfileStageStats& st = stageStats[i];
+            fprintf(json, "    {\"stage\": \"%s\", \"bounce\": %d, "
+                "\"samples\": %d, \"mean_ms\": %.4f, \"p95_ms\": %.4f}%s\n",
+                st.stage, st.bounce, st.samples, st.meanMs, st.p95Ms,
+                i + 1 < numStages ? "," : "");
+        }
+        fprintf(json, "  ]\n}\n");
+        fclose(json);
+    }
+
+    FILE* csv = fopen((base + ".csv").c_str(), "w");
+    if (csv != NULL) {
+        fprintf(csv, "scene,gpu,stage,bounce,samples,mean_ms,p95_ms\n");
+        for (int i = 0; i < numStages; i++) {
+            const ProfileStageStats& st = stageStats[i];
+            fprintf(csv, "%s,%s,%s,%d,%d,%.4f,%.4f\n",
+                renderState->imageName.c_str(), gpuName,
+                st.stage, st.bounce, st.samples, st.meanMs, st.p95Ms);
+        }
+        fclose(csv);
+    }
+
+    // heatmap builds also dump the per-pixel bounce-cost map; the false
+    // color is for the live view, grayscale suits offline diffing better
+    std::vector<float> heat;
+    if (pathtraceDownloadHeatmap(heat, iterations)) {
+        image heatImg(width, height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                float v = heat[x + y * width] / (float)renderState->traceDepth;
+                heatImg.setPixel(width - 1 - x, y, glm::vec3(v));
+            }
+        }
+        heatImg.savePNG(base + ".heatmap");
+    }
+
+    printf("benchmark: %s on %s, %d iterations in %.2fs (%.0f Mrays/s)\n",
+        renderState->imageName.c_str(), gpuName, iterations, wallSec,
+        raysPerSec / 1e6);
+    if (nvmlStats.valid) {
+        printf("  %.1f J for the frame at %.0f W mean, SM %u-%u MHz, "
+            "%u C peak\n", nvmlStats.energyJoules, nvmlStats.powerWattsMean,
+            nvmlStats.smClockMin, nvmlStats.smClockMax, nvmlStats.tempMax);
+    }
+    for (int i = 0; i < numRegions; i++) {
+        printf("  kernel region %-14s %5.1f%% of sampled cycles (%.0f visits)\n",
+            regionStats[i].region, 100.0 * regionStats[i].share,
+            regionStats[i].visits);
+    }
+    printf("wrote %s.json and %s.csv\n", base.c_str(), base.c_str());
+
+    pathtraceFree();
+    return 0;
+}
+
+// ---- golden-image + timing regression suite (--regress) -----------------
+// Renders fixed-seed configurations of every scene on the command line -
+// each scene as written, plus a generated shallow-depth variant that
+// leans on the direct-lighting and termination paths deep renders mostly
+// amortize away - then compares pixels against checked-in reference PNGs
+// (per-pixel and SSIM tolerances) and per-iteration wall time against a
+// stored baseline. References live in the --regress directory, are
+// rewritten by --regress-update, and record the GPU and build config they
+// were made with; a mismatch skips the timing check rather than failing
+// it, since another machine's milliseconds prove nothing here.
+#define REGRESS_ITERATIONS 16
+#define REGRESS_MAX_PIXEL_DIFF 2     // 8-bit steps, per channel
+#define REGRESS_MIN_SSIM 0.995
+#define REGRESS_TIME_THRESHOLD 1.20  // fail past +20% of baseline ms/iter
+
+// savePNG's exact quantization (including the horizontal flip), so the
+// comparison sees what a shipped PNG would hold
+static void regressQuantize(float samples, std::vector<unsigned char>& bytes) {
+    bytes.resize(3 * (size_t)width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            glm::vec3 pix = glm::clamp(
+                renderState->image[x + (size_t)y * width] / samples,
+                glm::vec3(), glm::vec3(1)) * 255.f;
+            size_t o = 3 * ((size_t)y * width + (width - 1 - x));
+            bytes[o + 0] = (unsigned char)pix.x;
+            bytes[o + 1] = (unsigned char)pix.y;
+            bytes[o + 2] = (unsigned char)pix.z;
+        }
+    }
+}
+
+// mean SSIM over 8x8 luminance windows stepped by 4, standard constants;
+// catches structured drift that a per-pixel bound lets through once it is
+// spread thinly across the frame
+static double regressSSIM(const unsigned char* a, const unsigned char* b) {
+    std::vector<float> la((size_t)width * height);
+    std::vector<float> lb((size_t)width * height);
+    for (size_t i = 0; i < la.size(); i++) {
+        la[i] = 0.299f * a[3 * i] + 0.587f * a[3 * i + 1] + 0.114f * a[3 * i + 2];
+        lb[i] = 0.299f * b[3 * i] + 0.587f * b[3 * i + 1] + 0.114f * b[3 * i + 2];
+    }
+    const double C1 = 6.5025;    // (0.01 * 255)^2
+    const double C2 = 58.5225;   // (0.03 * 255)^2
+    double sum = 0.0;
+    int windows = 0;
+    for (int y = 0; y + 8 <= height; y += 4) {
+        for (int x = 0; x + 8 <= width; x += 4) {
+            double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            for (int wy = 0; wy < 8; wy++) {
+                for (int wx = 0; wx < 8; wx++) {
+                    double va = la[(size_t)(y + wy) * width + x + wx];
+                    double vb = lb[(size_t)(y + wy) * width + x + wx];
+                    sa += va;
+                    sb += vb;
+                    saa += va * va;
+                    sbb += vb * vb;
+                    sab += va * vb;
+                }
+            }
+            double ma = sa / 64.0;
+            double mb = sb / 64.0;
+            double varA = saa / 64.0 - ma * ma;
+            double varB = sbb / 64.0 - mb * mb;
+            double cov = sab / 64.0 - ma * mb;
+            sum += ((2.0 * ma * mb + C1) * (2.0 * cov + C2))
+                / ((ma * ma + mb * mb + C1) * (varA + varB + C2));
+            windows++;
+        }
+    }
+    return windows > 0 ? sum / windows : 1.0;
+}
+
+// Render one configuration of the current scene and check (or rebaseline)
+// it. Returns false on a failed comparison.
+static bool regressConfig(const std::string& variant) {
+    renderState = &scene->state;
+    width = renderState->camera.resolution.x;
+    height = renderState->camera.resolution.y;
+
+    pathtraceProfileSetActive(true);
+    pathtraceInit(scene);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int iter = 1; iter <= REGRESS_ITERATIONS; iter++) {
+        pathtrace(NULL, 0, iter);
+    }
+    double msPerIter = 1000.0 * std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count() / REGRESS_ITERATIONS;
+    downloadImage();
+
+    std::vector<unsigned char> bytes;
+    regressQuantize((float)REGRESS_ITERATIONS, bytes);
 
-    // Initialize CUDA and GL components
-    init();
+    char gpuName[256];
+    size_t memUsed = 0, memTotal = 0;
+    pathtraceDeviceInfo(gpuName, sizeof(gpuName), &memUsed, &memTotal);
+    ProfileStageStats stageStats[512];
+    int numStages = pathtraceProfileSnapshot(stageStats, 512);
+    pathtraceFree();
+
+    std::string name = renderState->imageName + "." + variant;
+    std::string imagePath = regressDir + "/" + name + ".png";
+    std::string timingPath = regressDir + "/" + name + ".timing.txt";
+
+    if (regressUpdate) {
+        if (stbi_write_png(imagePath.c_str(), width, height, 3,
+                bytes.data(), width * 3) == 0) {
+            printf("regress: %s FAIL: cannot write %s\n", name.c_str(),
+                imagePath.c_str());
+            return false;
+        }
+        FILE* f = fopen(timingPath.c_str(), "w");
+        if (f == NULL) {
+            printf("regress: %s FAIL: cannot write %s\n", name.c_str(),
+                timingPath.c_str());
+            return false;
+        }
+        fprintf(f, "gpu %s\n", gpuName);
+        fprintf(f, "build %s\n", pathtraceBuildConfig());
+        fprintf(f, "ms_per_iter %.4f\n", msPerIter);
+        // per-stage means ride along for diagnosing a tripped threshold
+        for (int i = 0; i < numStages; i++) {
+            fprintf(f, "stage %s:%d %.4f\n", stageStats[i].stage,
+                stageStats[i].bounce, stageStats[i].meanMs);
+        }
+        fclose(f);
+        printf("regress: %s rebaselined (%.2f ms/iter)\n", name.c_str(),
+            msPerIter);
+        return true;
+    }
+
+    bool ok = true;
+
+    int rw = 0, rh = 0, rc = 0;
+    unsigned char* ref = stbi_load(imagePath.c_str(), &rw, &rh, &rc, 3);
+    if (ref == NULL) {
+        printf("regress: %s FAIL: no reference %s (run --regress-update)\n",
+            name.c_str(), imagePath.c_str());
+        ok = false;
+    }
+    else if (rw != width || rh != height) {
+        printf("regress: %s FAIL: reference is %dx%d, render is %dx%d\n",
+            name.c_str(), rw, rh, width, height);
+        stbi_image_free(ref);
+        ok = false;
+    }
+    else {
+        int maxDiff = 0;
+        for (size_t i = 0; i < bytes.size(); i++) {
+            int d = (int)bytes[i] - (int)ref[i];
+            maxDiff = std::max(maxDiff, d < 0 ? -d : d);
+        }
+        double ssim = regressSSIM(bytes.data(), ref);
+        stbi_image_free(ref);
+        if (maxDiff > REGRESS_MAX_PIXEL_DIFF || ssim < REGRESS_MIN_SSIM) {
+            printf("regress: %s FAIL: image diverges (max diff %d, SSIM %.4f)\n",
+                name.c_str(), maxDiff, ssim);
+            ok = false;
+        }
+        else {
+            printf("regress: %s image OK (max diff %d, SSIM %.4f)\n",
+                name.c_str(), maxDiff, ssim);
+        }
+    }
+
+    FILE* f = fopen(timingPath.c_str(), "r");
+    if (f == NULL) {
+        printf("regress: %s FAIL: no timing baseline %s (run --regress-update)\n",
+            name.c_str(), timingPath.c_str());
+        return false;
+    }
+    char line[1024];
+    std::string baseGpu;
+    std::string baseBuild;
+    double baseMs = -1.0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (strncmp(line, "gpu ", 4) == 0) {
+            baseGpu = line + 4;
+        }
+        else if (strncmp(line, "build ", 6) == 0) {
+            baseBuild = line + 6;
+        }
+        else {
+            sscanf(line, "ms_per_iter %lf", &baseMs);
+        }
+    }
+    fclose(f);
+    if (baseGpu != gpuName || baseBuild != pathtraceBuildConfig()) {
+        printf("regress: %s timing skipped (baseline is for another gpu/build)\n",
+            name.c_str());
+    }
+    else if (baseMs <= 0.0) {
+        printf("regress: %s FAIL: malformed timing baseline %s\n",
+            name.c_str(), timingPath.c_str());
+        ok = false;
+    }
+    else if (msPerIter > baseMs * REGRESS_TIME_THRESHOLD) {
+        printf("regress: %s FAIL: %.2f ms/iter vs baseline %.2f (+%.0f%%)\n",
+            name.c_str(), msPerIter, baseMs,
+            100.0 * (msPerIter / baseMs - 1.0));
+        ok = false;
+    }
+    else {
+        printf("regress: %s timing OK (%.2f ms/iter, baseline %.2f)\n",
+            name.c_str(), msPerIter, baseMs);
+    }
+    return ok;
+}
+
+static int runRegression() {
+    int failures = 0;
+    for (size_t i = 0; i < sceneFiles.size(); i++) {
+        if (i > 0) {
+            delete scene;
+            scene = new Scene(sceneFiles[i]);
+        }
+        int fullDepth = scene->state.traceDepth;
+        if (!regressConfig("full")) {
+            failures++;
+        }
+        if (fullDepth > 2) {
+            // generated case: two bounces routes nearly every path through
+            // emission, direct lighting and early termination
+            scene->state.traceDepth = 2;
+            if (!regressConfig("depth2")) {
+                failures++;
+            }
+            scene->state.traceDepth = fullDepth;
+        }
+    }
+    if (failures > 0) {
+        printf("regress: %d configuration(s) FAILED\n", failures);
+    }
+    else {
+        printf("regress: all configurations passed\n");
+    }
+    return failures > 0 ? 1 : 0;
+}
+
+// Time a few headless iterations with the current launch sizes. The
+// first call also pays first-touch costs, so runTune warms up before
+// measuring anything.
+static double timeIterations(int firstIter, int count) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        pathtrace(NULL, 0, firstIter + i);
+    }
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
+}
+
+// Greedy per-kernel-class block-size sweep: hold the other classes at
+// their current sizes, time each candidate over a handful of iterations,
+// keep the fastest, then move to the next class. Winners land in
+// launchconfig.txt keyed by GPU model, which pathtraceInit overlays on
+// its occupancy-based defaults from then on.
+static int runTune() {
+    static const int kCandidates[] = { 64, 96, 128, 192, 256, 384, 512 };
+    static const int kNumCandidates = sizeof(kCandidates) / sizeof(kCandidates[0]);
+    static const int kItersPerCandidate = 20;
+
+    renderState = &scene->state;
+    width = renderState->camera.resolution.x;
+    height = renderState->camera.resolution.y;
+    pathtraceInit(scene);
+
+    int iter = 1;
+    timeIterations(iter, 10);  // warm up: first-touch, caches, clocks
+    iter += 10;
+
+    int sizes[3];
+    pathtraceGetLaunchSizes(&sizes[0], &sizes[1], &sizes[2]);
+    const char* classNames[3] = { "intersect", "shade", "gather" };
+    for (int c = 0; c < 3; c++) {
+        double bestTime = 1e30;
+        int bestSize = sizes[c];
+        for (int i = 0; i < kNumCandidates; i++) {
+            sizes[c] = kCandidates[i];
+            pathtraceSetLaunchSizes(sizes[0], sizes[1], sizes[2]);
+            double t = timeIterations(iter, kItersPerCandidate);
+            iter += kItersPerCandidate;
+            printf("%s %3d: %.1f ms/iter\n", classNames[c], kCandidates[i],
+                1000.0 * t / kItersPerCandidate);
+            if (t < bestTime) {
+                bestTime = t;
+                bestSize = kCandidates[i];
+            }
+        }
+        sizes[c] = bestSize;
+        pathtraceSetLaunchSizes(sizes[0], sizes[1], sizes[2]);
+    }
+
+    char gpuName[256];
+    size_t memUsed, memTotal;
+    pathtraceDeviceInfo(gpuName, sizeof(gpuName), &memUsed, &memTotal);
+    FILE* f = fopen("launchconfig.txt", "w");
+    if (f != NULL) {
+        fprintf(f, "gpu %s\n", gpuName);
+        for (int c = 0; c < 3; c++) {
+            fprintf(f, "%s %d\n", classNames[c], sizes[c]);
+        }
+        fclose(f);
+    }
+    printf("tuned for %s: intersect %d, shade %d, gather %d "
+        "(saved to launchconfig.txt)\n", gpuName, sizes[0], sizes[1], sizes[2]);
+
+    pathtraceFree();
+    return 0;
+}
+
+// Animation driver (ANIMATION scene block, frames > 1): render each frame
+// headlessly for the scene's iteration count, reusing every device buffer
+// and acceleration structure across frames - per frame the scene is
+// re-posed and only the transform tables travel to the device
+// (pathtraceUpdateGeoms). Frames save as imageName.f0000.png etc.
+static int runAnimation(Scene* scene) {
+    RenderState& state = scene->state;
+    const int fullW = state.camera.resolution.x;
+    const int fullH = state.camera.resolution.y;
+    printf("animation: %d frames x %d iterations\n",
+        state.frames, (int)state.iterations);
+
+    pathtraceInit(scene);
+    for (int frame = 0; frame < state.frames; frame++) {
+        scene->setAnimationFrame(frame);
+        pathtraceUpdateGeoms();
+        pathtraceCameraReset();
+        for (int iter = 1; iter <= (int)state.iterations; iter++) {
+            pathtrace(NULL, frame, iter);
+        }
+        downloadImage();
+
+        // mirror saveImage's horizontal flip and per-sample scaling
+        image img(fullW, fullH);
+        for (int y = 0; y < fullH; y++) {
+            for (int x = 0; x < fullW; x++) {
+                img.setPixel(fullW - 1 - x, y,
+                    state.image[x + (size_t)y * fullW] / (float)state.iterations);
+            }
+        }
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".f%04d", frame);
+        img.savePNG(state.imageName + suffix);
+        img.saveEXR(state.imageName + suffix);
+        videoWriteFrame(state.image, fullW, fullH, (float)state.iterations);
+        printf("animation: frame %d/%d saved\n", frame + 1, state.frames);
+    }
+    videoStop();
+    pathtraceFree();
+    return 0;
+}
+
+// Multi-view driver (VIEW scene blocks): render the CAMERA pose and then
+// each extra view headlessly for the scene's iteration count, all in one
+// process. The scene stays resident throughout - between views only a
+// camera swap and pathtraceCameraReset run, so parse, upload and BVH
+// builds are paid once for the whole set instead of once per angle.
+// Views render sequentially rather than interleaved: the device holds one
+// accumulation, and the setup amortization is identical either way.
+// Images save as imageName.v00.png etc., v00 being the CAMERA pose.
+static int runViews(Scene* scene) {
+    RenderState& state = scene->state;
+    const int fullW = state.camera.resolution.x;
+    const int fullH = state.camera.resolution.y;
+    const int count = 1 + (int)state.views.size();
+    printf("views: %d cameras x %d iterations\n",
+        count, (int)state.iterations);
+
+    pathtraceInit(scene);
+    for (int v = 0; v < count; v++) {
+        if (v > 0) {
+            state.camera = state.views[v - 1];
+            pathtraceCameraReset();
+        }
+        for (int iter = 1; iter <= (int)state.iterations; iter++) {
+            pathtrace(NULL, 0, iter);
+        }
+        downloadImage();
+
+        // mirror saveImage's horizontal flip and per-sample scaling
+        image img(fullW, fullH);
+        for (int y = 0; y < fullH; y++) {
+            for (int x = 0; x < fullW; x++) {
+                img.setPixel(fullW - 1 - x, y,
+                    state.image[x + (size_t)y * fullW] / (float)state.iterations);
+            }
+        }
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".v%02d", v);
+        img.savePNG(state.imageName + suffix);
+        img.saveEXR(state.imageName + suffix);
+        printf("views: view %d/%d saved\n", v + 1, count);
+    }
+    pathtraceFree();
+    return 0;
+}
+
+// Cheap pre-scan of a scene text for the camera "RES w h" directive, so
+// the GL window can come up while the full parse runs on a worker thread.
+// Returns false for packed or GENERATOR scenes (no such line), which keeps
+// those on the serial startup path.
+static bool prescanResolution(const std::string& path, int* w, int* h) {
+    ifstream file(path.c_str());
+    if (!file.is_open()) {
+        return false;
+    }
+    std::string line;
+    std::vector<utilityCore::Token> tokens;
+    while (file.good()) {
+        utilityCore::safeGetline(file, line);
+        if (line.empty()) {
+            continue;
+        }
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("GENERATOR")) {
+            return false;
+        }
+        if (tokens[0].equals("RES") && tokens.size() >= 3) {
+            *w = tokens[1].toInt();
+            *h = tokens[2].toInt();
+            return *w > 0 && *h > 0;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    startTimeString = currentTimeString();
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resumePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+            benchmarkIters = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tiled") == 0 && i + 1 < argc) {
+            tileSize = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--hybrid") == 0 && i + 1 < argc) {
+            hybridTileSize = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tune") == 0) {
+            tuneLaunch = true;
+        }
+        else if (strcmp(argv[i], "--cputrace") == 0) {
+            cpuTrace = true;
+        }
+        else if (strcmp(argv[i], "--hwtrace") == 0) {
+            // OptiX RT-core traversal; falls back to the software kernels
+            // when the build or the scene does not support it
+            pathtraceSetHardwareTrace(true);
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceOutPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+            streamPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--video") == 0 && i + 1 < argc) {
+            videoOutPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--surface") == 0) {
+#ifdef _WIN32
+            fprintf(stderr, "--surface needs POSIX shared memory; ignored\n");
+#else
+            shmSurface = true;
+#endif
+        }
+        else if (strcmp(argv[i], "--regress") == 0 && i + 1 < argc) {
+            regressDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--regress-update") == 0) {
+            regressUpdate = true;
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--worker") == 0 && i + 2 < argc) {
+            workerHost = argv[++i];
+            workerPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--service") == 0 && i + 1 < argc) {
+            servicePort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            concurrentJobs = atoi(argv[++i]);
+        }
+        else {
+            sceneFiles.push_back(argv[i]);
+        }
+    }
+    if (sceneFiles.empty() && servicePort == 0) {
+        printf("Usage: %s SCENEFILE.txt [SCENEFILE2.txt ...] [--headless] [--resume CHECKPOINT]\n"
+            "       [--benchmark ITERATIONS] [--tiled TILESIZE] [--hybrid TILESIZE] [--tune]\n"
+            "       [--hwtrace] [--cputrace] [--trace FILE] [--stream PORT] [--surface]\n"
+            "       [--video FILE]\n"
+            "       [--regress REFDIR [--regress-update]]\n"
+            "       [--serve PORT | --worker HOST PORT | --service PORT] [--jobs N]\n", argv[0]);
+        return 1;
+    }
+
+#ifndef _WIN32
+    // Concurrent small-scene batch: fork one renderer per job before any
+    // CUDA state exists (a context does not survive a fork). In-process
+    // multiplexing is off the table here - per-scene state (the
+    // accumulation handles, light alias tables, environment map and
+    // texture pools) lives in the constant bank that in-flight kernels
+    // read - so each job is a whole process with its own context, arena
+    // and streams, rendering every N-th scene of the queue headless. The
+    // driver keeps the children's kernels resident together (best under
+    // MPS), which is what lets 65k-path thumbnail scenes overlap instead
+    // of leaving the device mostly idle between them.
+    if (concurrentJobs > 1 && sceneFiles.size() > 1 && servicePort == 0) {
+        int jobs = (int)std::min((size_t)concurrentJobs, sceneFiles.size());
+        std::vector<pid_t> children;
+        bool isChild = false;
+        int started = 0;
+        for (int j = 0; j < jobs; j++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                // child j keeps scenes j, j + jobs, ...; the round-robin
+                // stripes stay balanced when the queue is sorted by cost
+                std::vector<std::string> stripe;
+                for (size_t i = j; i < sceneFiles.size(); i += (size_t)jobs) {
+                    stripe.push_back(sceneFiles[i]);
+                }
+                sceneFiles.swap(stripe);
+                headless = true;
+                isChild = true;
+                break;
+            }
+            if (pid < 0) {
+                fprintf(stderr, "--jobs: fork failed after %d of %d jobs\n", started, jobs);
+                break;
+            }
+            children.push_back(pid);
+            started++;
+        }
+        if (!isChild) {
+            int rc = 0;
+            for (size_t c = 0; c < children.size(); c++) {
+                int status = 0;
+                waitpid(children[c], &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    rc = 1;
+                }
+            }
+            if (started == jobs) {
+                return rc;
+            }
+            // stripes that never got a child stay with this process: keep
+            // their scenes and fall through to the ordinary render queue
+            if (rc != 0) {
+                fprintf(stderr, "--jobs: a child renderer failed\n");
+            }
+            std::vector<std::string> rest;
+            for (size_t i = 0; i < sceneFiles.size(); i++) {
+                if ((int)(i % (size_t)jobs) >= started) {
+                    rest.push_back(sceneFiles[i]);
+                }
+            }
+            sceneFiles.swap(rest);
+            headless = true;
+        }
+    }
+#else
+    if (concurrentJobs > 1) {
+        fprintf(stderr, "--jobs needs fork(); rendering the queue sequentially\n");
+    }
+#endif // _WIN32
+
+    // the render service loads scenes per job and manages device state
+    // itself; any scene files on the command line just pre-warm its cache
+    if (servicePort > 0) {
+        cudaFree(0);
+        return runRenderService(servicePort, sceneFiles);
+    }
+
+    // Startup overlap: the scene parse (text, OBJ/GLTF decode, weld,
+    // Morton reorder) and context creation are independent serial phases,
+    // so the first scene loads on a worker while this thread warms
+    // contexts. The CUDA primary context is process-wide driver state
+    // every mode pays for eventually; interactive runs additionally bring
+    // up the GL window and PBO, sized from a cheap pre-scan of the scene
+    // text for the camera RES line. Queued scenes follow as jobs complete.
+    std::thread sceneLoader([]() { scene = new Scene(sceneFiles[0]); });
+    cudaFree(0);
+
+    bool interactive = servePort == 0 && workerHost == NULL && tileSize == 0
+        && hybridTileSize == 0 && !tuneLaunch && !cpuTrace && benchmarkIters == 0
+        && regressDir.empty() && !headless;
+    bool glReady = false;
+    int scanW;
+    int scanH;
+    if (interactive && prescanResolution(sceneFiles[0], &scanW, &scanH)) {
+        width = scanW;
+        height = scanH;
+        glReady = init();
+    }
+    sceneLoader.join();
+    if (glReady && (scene->state.camera.resolution.x != width
+        || scene->state.camera.resolution.y != height)) {
+        // the pre-scan reads the same RES directive the parser does, so a
+        // mismatch means the file changed underneath us mid-load
+        fprintf(stderr, "Scene resolution changed during load - aborting\n");
+        return 1;
+    }
+
+    // distributed tile rendering bypasses the interactive loop entirely
+    if (servePort > 0) {
+        return runCoordinator(scene, servePort);
+    }
+    if (workerHost != NULL) {
+        return runWorker(scene, workerHost, workerPort);
+    }
+    if (tileSize > 0) {
+        return runTiled(scene, tileSize);
+    }
+    if (hybridTileSize > 0) {
+        return runHybrid(scene, hybridTileSize);
+    }
+    if (tuneLaunch) {
+        return runTune();
+    }
+    if (cpuTrace) {
+        // host-only rendering; the render queue works here too
+        int rc = 0;
+        for (size_t i = 0; i < sceneFiles.size(); i++) {
+            if (i > 0) {
+                delete scene;
+                scene = new Scene(sceneFiles[i]);
+            }
+            rc |= runCpuTrace(scene);
+        }
+        return rc;
+    }
+    if (benchmarkIters > 0) {
+        // every scene on the command line gets its own record, so the
+        // whole corpus sweeps in one invocation (mirrors runRegression)
+        int rc = 0;
+        for (size_t i = 0; i < sceneFiles.size(); i++) {
+            if (i > 0) {
+                delete scene;
+                scene = new Scene(sceneFiles[i]);
+            }
+            rc |= runBenchmark(sceneFiles[i], benchmarkIters);
+        }
+        return rc;
+    }
+    if (!regressDir.empty()) {
+        return runRegression();
+    }
+    // scene-driven: an ANIMATION block with more than one frame renders
+    // the sequence and exits instead of entering the interactive loop
+    if (scene->state.frames > 1) {
+        return runAnimation(scene);
+    }
+    // likewise VIEW blocks: render every camera of the batch and exit
+    if (!scene->state.views.empty()) {
+        return runViews(scene);
+    }
+
+    // Set up camera stuff from loaded path tracer settings
+    setupCameraControls();
+
+    if (!traceOutPath.empty()) {
+        pathtraceTraceBegin(traceOutPath.c_str());
+    }
+    if (streamPort > 0) {
+        previewStreamStart(streamPort);
+    }
+
+    if (headless) {
+        // no display, no GL: the CUDA context comes up implicitly with the
+        // first allocation and runCuda exits the process when done
+        for (;;) {
+            pathtraceTraceHostBegin("runCuda");
+            runCuda();
+            pathtraceTraceHostEnd();
+        }
+    }
+
+    // Initialize CUDA and GL components, unless the startup overlap
+    // already brought them up alongside the scene parse
+    if (!glReady) {
+        init();
+    }
+#if GBUFFER_ENABLE
+    // needs the GL context created by init()
+    gbufferInit(scene, width, height);
+#endif
 
     // GLFW main loop
     mainLoop();
 
+    pathtraceTraceEnd();
+    // flush any snapshot still encoding (the Esc path queues one)
+    snapshotShutdown();
+    previewStreamStop();
+    surfaceStop();
+    videoStop();
+
     return 0;
 }
 
 void saveImage() {
     float samples = iteration;
-    // output image file
-    image img(width, height);
 
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            int index = x + (y * width);
-            glm::vec3 pix = renderState->image[index];
-            img.setPixel(width - 1 - x, y, glm::vec3(pix) / samples);
-        }
-    }
+    // accumulation lives on the device; fetch it only now that we save
+    downloadImage();
 
     std::string filename = renderState->imageName;
     std::ostringstream ss;
     ss << filename << "." << startTimeString << "." << samples << "samp";
     filename = ss.str();
 
-    // CHECKITOUT
-    img.savePNG(filename);
-    //img.saveHDR(filename);  // Save a Radiance HDR file
+    if (!snapshotThread.joinable()) {
+        snapshotThread = std::thread(snapshotWorker);
+    }
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    // wait only for the handover of the previous snapshot, not its encode
+    snapshotCv.wait(lock, [] { return !snapshotPending; });
+    snapshotJob.pixels.assign(renderState->image.begin(), renderState->image.end());
+    pathtraceGetAOVs(snapshotJob.aovNormal, snapshotJob.aovDepth,
+        snapshotJob.aovAlbedo, snapshotJob.aovDirect);
+    snapshotJob.samples = samples;
+    snapshotJob.filename = filename;
+    snapshotPending = true;
+    snapshotCv.notify_all();
 }
 
 void runCuda() {
+    if (!headless) {
+        // look-dev edits to the scene's source files land without a restart
+        checkSceneHotReload();
+    }
     if (camchanged) {
         iteration = 0;
+        lastCamMoveTime = std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
         Camera &cam = renderState->camera;
         cameraPosition.x = zoom * sin(phi) * sin(theta);
         cameraPosition.y = zoom * cos(theta);
@@ -123,23 +1783,140 @@ void runCuda() {
     // No data is moved (Win & Linux). When mapped to CUDA, OpenGL should not use this buffer
 
     if (iteration == 0) {
-        pathtraceFree();
-        pathtraceInit(scene);
+        if (pathtraceReady) {
+            // only the viewpoint changed: clear the accumulation in place
+            // instead of tearing down and re-uploading the whole scene
+            pathtraceCameraReset();
+            // a staged readback from the old viewpoint is worthless now
+            snapshotReadbackPending = false;
+        }
+        else {
+            pathtraceInit(scene);
+            pathtraceReady = true;
+            if (!resumePath.empty()) {
+                int resumed = pathtraceLoadCheckpoint(resumePath);
+                if (resumed > 0) {
+                    iteration = resumed;
+                }
+                resumePath.clear();
+            }
+        }
+#if GBUFFER_ENABLE
+        // primary visibility only changes with the camera (needs GL, so
+        // headless runs fall back to traced primary hits)
+        if (!headless) {
+            gbufferRender(renderState->camera);
+        }
+#endif
+    }
+
+    bool converged = false;
+    if (iteration > 0 && iteration % CONVERGENCE_CHECK_INTERVAL == 0) {
+        // the scene file's iteration count is sized for the worst case;
+        // stop as soon as nearly every pixel has converged
+        converged = pathtraceConvergedFraction() >= CONVERGENCE_PIXEL_FRACTION;
     }
 
-    if (iteration < renderState->iterations) {
+    if (iteration < renderState->iterations && !converged) {
         uchar4 *pbo_dptr = NULL;
         iteration++;
-        cudaGLMapBufferObject((void**)&pbo_dptr, pbo);
+        if (!headless) {
+            pbo_dptr = pboMapForWrite();
+#if GBUFFER_ENABLE
+            glm::vec4* gbufferPositions = NULL;
+            glm::vec4* gbufferNormals = NULL;
+            gbufferMap(&gbufferPositions, &gbufferNormals);
+            pathtraceSetGBuffer(gbufferPositions, gbufferNormals);
+#endif
+        }
 
-        // execute the kernel
+        // execute the kernel; a null PBO skips the display copy entirely.
+        // Burst as many iterations as the display budget fits; "one more
+        // fits" is judged against the exponential average the preview
+        // scheduler below also uses, so both react to the same cost signal
         int frame = 0;
-        pathtrace(pbo_dptr, frame, iteration);
+        auto frameStart = std::chrono::steady_clock::now();
+        for (;;) {
+            double burstMs = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - frameStart).count();
+            bool lastThisFrame = headless
+                || iteration >= renderState->iterations
+                || burstMs + 2.0 * frameMsAvg > DISPLAY_BUDGET_MS;
+            auto iterStart = std::chrono::steady_clock::now();
+            pathtrace(lastThisFrame ? pbo_dptr : NULL, frame, iteration);
+            double frameMs = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - iterStart).count();
+            frameMsAvg = frameMsAvg <= 0.0 ? frameMs : 0.8 * frameMsAvg + 0.2 * frameMs;
+            if (lastThisFrame) {
+                break;
+            }
+            iteration++;
+        }
+        if (!headless) {
+            if (fullTraceDepth == 0) {
+                fullTraceDepth = renderState->traceDepth;
+            }
+            double sinceMove = std::chrono::duration<double>(
+                std::chrono::steady_clock::now().time_since_epoch()).count()
+                - lastCamMoveTime;
+            if (sinceMove < PREVIEW_IDLE_SECONDS) {
+                // look-dev mode: trade depth for latency against the budget
+                if (frameMsAvg > PREVIEW_BUDGET_MS && renderState->traceDepth > 1) {
+                    renderState->traceDepth--;
+                }
+                else if (frameMsAvg < 0.6 * PREVIEW_BUDGET_MS
+                    && renderState->traceDepth < fullTraceDepth) {
+                    renderState->traceDepth++;
+                }
+            }
+            else if (renderState->traceDepth < fullTraceDepth) {
+                // camera settled: restore the scene's depth and drop the
+                // shallow frames from the accumulation
+                renderState->traceDepth = fullTraceDepth;
+                iteration = 0;
+            }
+        }
+
+        // release the write buffer; mainLoop textures from its partner
+        if (!headless) {
+#if GBUFFER_ENABLE
+            gbufferUnmap();
+#endif
+            pboUnmapForWrite();
+        }
 
-        // unmap buffer object
-        cudaGLUnmapBufferObject(pbo);
+        // snapshot scheduler: consume last frame's staged readback first,
+        // then maybe stage a new one (ordered behind the iteration queued
+        // above), so the staging buffer is never overwritten while in use
+        if (snapshotReadbackPending) {
+            queueSnapshot(snapshotReadbackIteration);
+            snapshotReadbackPending = false;
+        }
+        // steady_clock rather than glfwGetTime: headless runs never
+        // initialize GLFW
+        double now = std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (iteration % SNAPSHOT_ITERATION_INTERVAL == 0
+            || now - lastSnapshotTime >= SNAPSHOT_SECONDS) {
+            downloadImageAsync();
+            snapshotReadbackPending = true;
+            snapshotReadbackIteration = iteration;
+            lastSnapshotTime = now;
+            // checkpoint on the same schedule, so a killed render resumes
+            // from the last snapshot instead of iteration zero
+            pathtraceSaveCheckpoint(renderState->imageName + ".ckpt", iteration);
+        }
     } else {
         saveImage();
+        if (advanceToNextJob()) {
+            // next scene takes over this context; nothing torn down
+            return;
+        }
+        pathtraceTraceEnd();
+        snapshotShutdown();
+        previewStreamStop();
+        surfaceStop();
+        videoStop();
         pathtraceFree();
         cudaDeviceReset();
         exit(EXIT_SUCCESS);
@@ -156,6 +1933,18 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
       case GLFW_KEY_S:
         saveImage();
         break;
+      case GLFW_KEY_P:
+        pathtraceProfileReport();
+        break;
+      case GLFW_KEY_H:
+        pathtraceToggleHeatmap();
+        break;
+      case GLFW_KEY_L:
+        // layout preview and the full integrator must not mix in one
+        // accumulation, so restart it like a camera move
+        pathtraceToggleLayoutPreview();
+        camchanged = true;
+        break;
       case GLFW_KEY_SPACE:
         camchanged = true;
         renderState = &scene->state;
@@ -167,9 +1956,54 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 }
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+  // Shift+click arms the pixel probe: the next iteration prints that
+  // pixel's per-bounce path telemetry (PIXEL_PROBE_ENABLE builds)
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && (mods & GLFW_MOD_SHIFT)) {
+    double xpos, ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    // window -> image pixel, mirrored in x like the ROI mapping below
+    pathtraceProbePixel(width - 1 - (int)xpos, (int)ypos);
+    return;
+  }
+  // Ctrl+left-drag marks the look-dev region of interest instead of
+  // orbiting; a plain Ctrl+click (no real drag) clears it
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && (mods & GLFW_MOD_CONTROL)) {
+    roiDragging = true;
+    glfwGetCursorPos(window, &roiAnchorX, &roiAnchorY);
+    return;
+  }
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE && roiDragging) {
+    roiDragging = false;
+    double xpos, ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    int w = (int)std::fabs(xpos - roiAnchorX);
+    int h = (int)std::fabs(ypos - roiAnchorY);
+    if (w < 8 || h < 8) {
+      pathtraceSetROI(0, 0, 0, 0, 0);
+    }
+    else {
+      // window -> image pixel: the display quad's texcoords mirror u (see
+      // initVAO), so window x counts from the image's right edge; rows match
+      int x0 = width - 1 - (int)std::fmax(roiAnchorX, xpos);
+      int y0 = (int)std::fmin(roiAnchorY, ypos);
+      pathtraceSetROI(x0, y0, w, h, iteration);
+    }
+    return;
+  }
   leftMousePressed = (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS);
   rightMousePressed = (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS);
   middleMousePressed = (button == GLFW_MOUSE_BUTTON_MIDDLE && action == GLFW_PRESS);
+
+  // drags render at quarter resolution (half per dimension) for latency;
+  // any scale change restarts accumulation since the image layout follows
+  // the traced size
+  static bool wasDragging = false;
+  bool dragging = leftMousePressed || rightMousePressed || middleMousePressed;
+  if (dragging != wasDragging) {
+    pathtraceSetPreviewScale(dragging ? 2 : 1);
+    camchanged = true;
+    wasDragging = dragging;
+  }
 }
 
 void mousePositionCallback(GLFWwindow* window, double xpos, double ypos) {
@@ -0,0 +1,244 @@
+// Device-side mesh assembly for Scene::loadObj (see meshassembly.h). The
+// host still tokenizes - tinyobj owns that - but everything after the
+// parse is data-parallel: dedup of (position, normal) corner pairs via a
+// sort + head-flag scan, pooled attribute gather, triangle index rebase,
+// a min/max bounds reduction and, for files without normals, per-face
+// normal generation. Output matches the host shard path bit for bit
+// except for pool order, which finalizeMesh re-sorts anyway.
+
+#include <cstdio>
+
+#include <cuda_runtime.h>
+#include <thrust/device_vector.h>
+#include <thrust/execution_policy.h>
+#include <thrust/scan.h>
+#include <thrust/sort.h>
+#include <thrust/transform_reduce.h>
+
+#include "meshassembly.h"
+
+namespace {
+
+// one corner's dedup key: vertex index in the high half so equal pairs
+// are adjacent after the sort
+__global__ void kernMakeKeys(int n, const glm::ivec2* corners,
+	unsigned long long* keys, int* order) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	keys[i] = ((unsigned long long)(unsigned int)corners[i].x << 32)
+		| (unsigned int)corners[i].y;
+	order[i] = i;
+}
+
+// head flags over the sorted keys: 1 where a new distinct pair starts
+__global__ void kernHeadFlags(int n, const unsigned long long* keys,
+	int* flags) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	flags[i] = i == 0 || keys[i] != keys[i - 1] ? 1 : 0;
+}
+
+// scatter each corner's pooled slot (inclusive scan of the head flags,
+// minus one) back to its original position
+__global__ void kernScatterRemap(int n, const int* order,
+	const int* pooledOfSorted, int* remap) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	remap[order[i]] = pooledOfSorted[i] - 1;
+}
+
+// every head writes its pair's pooled vertex and normal once
+__global__ void kernGatherPooled(int n, const unsigned long long* keys,
+	const int* flags, const int* pooledOfSorted,
+	const float* positions, const float* normals,
+	glm::vec4* outVertices, glm::vec4* outNormals) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n || flags[i] == 0) {
+		return;
+	}
+	int slot = pooledOfSorted[i] - 1;
+	int vidx = (int)(keys[i] >> 32);
+	int nidx = (int)(unsigned int)(keys[i] & 0xffffffffu);
+	outVertices[slot] = glm::vec4(positions[3 * vidx + 0],
+		positions[3 * vidx + 1], positions[3 * vidx + 2], 0.0f);
+	outNormals[slot] = glm::vec4(normals[3 * nidx + 0],
+		normals[3 * nidx + 1], normals[3 * nidx + 2], 0.0f);
+}
+
+// triangles from the per-corner remap, already 0-based in the new pool
+__global__ void kernBuildTriangles(int nFaces, const int* remap,
+	TriangleIdx* triangles) {
+	int f = blockIdx.x * blockDim.x + threadIdx.x;
+	if (f >= nFaces) {
+		return;
+	}
+	triangles[f] = TriangleIdx(remap[3 * f], remap[3 * f + 1],
+		remap[3 * f + 2], 0);
+}
+
+// normal-less files: no sharing is possible (the generated normal is per
+// face), so each corner owns a pool slot and the face normal lands on all
+// three - the same layout the host path produces
+__global__ void kernAssembleFaceless(int nFaces, const glm::ivec2* corners,
+	const float* positions, glm::vec4* outVertices, glm::vec4* outNormals,
+	TriangleIdx* triangles) {
+	int f = blockIdx.x * blockDim.x + threadIdx.x;
+	if (f >= nFaces) {
+		return;
+	}
+	glm::vec3 p[3];
+	for (int v = 0; v < 3; v++) {
+		int vidx = corners[3 * f + v].x;
+		p[v] = glm::vec3(positions[3 * vidx + 0], positions[3 * vidx + 1],
+			positions[3 * vidx + 2]);
+		outVertices[3 * f + v] = glm::vec4(p[v], 0.0f);
+	}
+	glm::vec4 n(glm::normalize(glm::cross(p[1] - p[0], p[2] - p[1])), 0.0f);
+	outNormals[3 * f + 0] = n;
+	outNormals[3 * f + 1] = n;
+	outNormals[3 * f + 2] = n;
+	triangles[f] = TriangleIdx(3 * f, 3 * f + 1, 3 * f + 2, 0);
+}
+
+struct VertexToVec3 {
+	__host__ __device__ glm::vec3 operator()(const glm::vec4& v) const {
+		return glm::vec3(v);
+	}
+};
+
+struct Vec3Min {
+	__host__ __device__ glm::vec3 operator()(const glm::vec3& a,
+			const glm::vec3& b) const {
+		return glm::min(a, b);
+	}
+};
+
+struct Vec3Max {
+	__host__ __device__ glm::vec3 operator()(const glm::vec3& a,
+			const glm::vec3& b) const {
+		return glm::max(a, b);
+	}
+};
+
+}  // namespace
+
+bool meshAssembleOnDevice(const float* positions, size_t positionCount,
+	const float* normals, size_t normalCount,
+	const glm::ivec2* corners, size_t faceCount,
+	std::vector<glm::vec4>& outVertices,
+	std::vector<glm::vec4>& outNormals,
+	std::vector<TriangleIdx>& outTriangles,
+	glm::vec3& leftBottom, glm::vec3& rightTop) {
+	int deviceCount = 0;
+	if (cudaGetDeviceCount(&deviceCount) != cudaSuccess || deviceCount == 0) {
+		return false;
+	}
+
+	const int n = (int)(3 * faceCount);
+	const int blockSize = 128;
+	const int cornerBlocks = (n + blockSize - 1) / blockSize;
+	const int faceBlocks = ((int)faceCount + blockSize - 1) / blockSize;
+
+	try {
+		thrust::device_vector<glm::ivec2> d_corners(corners, corners + n);
+		thrust::device_vector<float> d_positions(positions,
+			positions + 3 * positionCount);
+		thrust::device_vector<glm::vec4> d_vertices;
+		thrust::device_vector<glm::vec4> d_normals;
+		thrust::device_vector<TriangleIdx> d_triangles(faceCount);
+
+		if (normalCount > 0) {
+			thrust::device_vector<float> d_srcNormals(normals,
+				normals + 3 * normalCount);
+			thrust::device_vector<unsigned long long> d_keys(n);
+			thrust::device_vector<int> d_order(n);
+			thrust::device_vector<int> d_flags(n);
+			thrust::device_vector<int> d_remap(n);
+			kernMakeKeys << <cornerBlocks, blockSize >> > (n,
+				thrust::raw_pointer_cast(d_corners.data()),
+				thrust::raw_pointer_cast(d_keys.data()),
+				thrust::raw_pointer_cast(d_order.data()));
+			thrust::sort_by_key(d_keys.begin(), d_keys.end(), d_order.begin());
+			kernHeadFlags << <cornerBlocks, blockSize >> > (n,
+				thrust::raw_pointer_cast(d_keys.data()),
+				thrust::raw_pointer_cast(d_flags.data()));
+			// the scan doubles as the pooled-slot numbering (1-based) and
+			// its last element as the pool size
+			thrust::device_vector<int> d_pooledOfSorted(n);
+			thrust::inclusive_scan(d_flags.begin(), d_flags.end(),
+				d_pooledOfSorted.begin());
+			int pooledCount = d_pooledOfSorted.back();
+			kernScatterRemap << <cornerBlocks, blockSize >> > (n,
+				thrust::raw_pointer_cast(d_order.data()),
+				thrust::raw_pointer_cast(d_pooledOfSorted.data()),
+				thrust::raw_pointer_cast(d_remap.data()));
+			d_vertices.resize(pooledCount);
+			d_normals.resize(pooledCount);
+			kernGatherPooled << <cornerBlocks, blockSize >> > (n,
+				thrust::raw_pointer_cast(d_keys.data()),
+				thrust::raw_pointer_cast(d_flags.data()),
+				thrust::raw_pointer_cast(d_pooledOfSorted.data()),
+				thrust::raw_pointer_cast(d_positions.data()),
+				thrust::raw_pointer_cast(d_srcNormals.data()),
+				thrust::raw_pointer_cast(d_vertices.data()),
+				thrust::raw_pointer_cast(d_normals.data()));
+			kernBuildTriangles << <faceBlocks, blockSize >> > ((int)faceCount,
+				thrust::raw_pointer_cast(d_remap.data()),
+				thrust::raw_pointer_cast(d_triangles.data()));
+		}
+		else {
+			d_vertices.resize(n);
+			d_normals.resize(n);
+			kernAssembleFaceless << <faceBlocks, blockSize >> > ((int)faceCount,
+				thrust::raw_pointer_cast(d_corners.data()),
+				thrust::raw_pointer_cast(d_positions.data()),
+				thrust::raw_pointer_cast(d_vertices.data()),
+				thrust::raw_pointer_cast(d_normals.data()),
+				thrust::raw_pointer_cast(d_triangles.data()));
+		}
+
+		glm::vec3 lo = thrust::transform_reduce(d_vertices.begin(),
+			d_vertices.end(), VertexToVec3(), glm::vec3(1000000), Vec3Min());
+		glm::vec3 hi = thrust::transform_reduce(d_vertices.begin(),
+			d_vertices.end(), VertexToVec3(), glm::vec3(-1000000), Vec3Max());
+
+		if (cudaDeviceSynchronize() != cudaSuccess) {
+			return false;
+		}
+
+		// append with the same rebase the shard path applies
+		const int base = (int)outVertices.size();
+		size_t pooled = d_vertices.size();
+		outVertices.resize(base + pooled);
+		outNormals.resize(base + pooled);
+		thrust::copy(d_vertices.begin(), d_vertices.end(),
+			outVertices.begin() + base);
+		thrust::copy(d_normals.begin(), d_normals.end(),
+			outNormals.begin() + base);
+		size_t triBase = outTriangles.size();
+		outTriangles.resize(triBase + faceCount);
+		thrust::copy(d_triangles.begin(), d_triangles.end(),
+			outTriangles.begin() + triBase);
+		for (size_t f = triBase; f < outTriangles.size(); f++) {
+			outTriangles[f].x += base;
+			outTriangles[f].y += base;
+			outTriangles[f].z += base;
+		}
+		leftBottom = glm::min(leftBottom, lo);
+		rightTop = glm::max(rightTop, hi);
+	}
+	catch (...) {
+		// out of device memory or a thrust failure: the host path still
+		// loads the mesh, just slower
+		fprintf(stderr, "GPU mesh assembly failed, using host threads\n");
+		cudaGetLastError();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "sceneStructs.h"
+
+// GPU mesh assembly for the OBJ importer (meshassembly.cu): the per-face
+// work after tinyobj parses - corner dedup, triangle gather, bounds
+// reduction, face-normal generation - is embarrassingly parallel, and for
+// multi-million-face meshes the device outruns the loader's host shards
+// by the width of the GPU. Below this face count the upload and kernel
+// launches cost more than the host threads take, so the importer does not
+// bother trying.
+#define GPU_MESH_ASSEMBLY_MIN_FACES (1 << 16)
+
+/**
+ * Assemble one parsed OBJ mesh on the device and append the pooled
+ * vertices, normals and rebased triangles to the scene's arrays, merging
+ * the mesh bounds into leftBottom/rightTop. corners holds one
+ * (vertex_index, normal_index) pair per face corner, 3 per face, with
+ * normal_index -1 when the file carries no normals (face normals are then
+ * generated, unshared, like the host path). Returns false - leaving every
+ * output untouched - when no CUDA device is usable or any step fails, and
+ * the caller's host path stays in charge.
+ */
+bool meshAssembleOnDevice(const float* positions, size_t positionCount,
+    const float* normals, size_t normalCount,
+    const glm::ivec2* corners, size_t faceCount,
+    std::vector<glm::vec4>& outVertices,
+    std::vector<glm::vec4>& outNormals,
+    std::vector<TriangleIdx>& outTriangles,
+    glm::vec3& leftBottom, glm::vec3& rightTop);
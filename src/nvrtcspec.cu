@@ -0,0 +1,409 @@
+#include "nvrtcspec.h"
+
+#if NVRTC_SPEC_ENABLE
+
+#include <cuda.h>
+#include <nvrtc.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+
+// full unrolling of the baked geom loop past this point costs more in
+// JIT time and instruction cache than the known bound buys
+static const int kSpecMaxGeoms = 128;
+
+static CUmodule specModule = NULL;
+static CUfunction specKernel = NULL;
+static bool specReady = false;
+
+#define NVRTC_CHECK(call) \
+	do { \
+		nvrtcResult res = call; \
+		if (res != NVRTC_SUCCESS) { \
+			fprintf(stderr, "nvrtcspec: %s failed: %s\n", #call, nvrtcGetErrorString(res)); \
+			return false; \
+		} \
+	} while (0)
+
+#define CU_CHECK(call) \
+	do { \
+		CUresult res = call; \
+		if (res != CUDA_SUCCESS) { \
+			const char* str = NULL; \
+			cuGetErrorString(res, &str); \
+			fprintf(stderr, "nvrtcspec: %s failed: %s\n", #call, str ? str : "?"); \
+			return false; \
+		} \
+	} while (0)
+
+// The JIT source. Self-contained on purpose: NVRTC has no STL and cannot
+// consume the glm/thrust headers behind intersections.h, so the analytic
+// tests are restated in plain structs. The struct mirrors must match the
+// sceneStructs.h layouts byte for byte - the static_asserts after the
+// string are the tripwire for anyone editing GeomHot or GeomCold.
+// Bump kSpecSourceVersion with any edit here, so stale disk caches miss.
+static const int kSpecSourceVersion = 2;
+static const char* kSpecSource = R"nvrtc(
+// Baked in via -D at JIT time:
+//   SPEC_GEOMS   geom count, the loop bound
+//   SPEC_MOVING  1 if any geom moves; 0 compiles the time reads out
+
+struct V3 { float x, y, z; };
+struct V2 { float x, y; };
+
+__device__ V3 v3(float x, float y, float z) {
+	V3 v; v.x = x; v.y = y; v.z = z; return v;
+}
+__device__ V3 add3(V3 a, V3 b) { return v3(a.x + b.x, a.y + b.y, a.z + b.z); }
+__device__ V3 sub3(V3 a, V3 b) { return v3(a.x - b.x, a.y - b.y, a.z - b.z); }
+__device__ V3 scale3(V3 a, float s) { return v3(a.x * s, a.y * s, a.z * s); }
+__device__ float dot3(V3 a, V3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+// mirrors of GeomHot / GeomCold (sceneStructs.h); glm matrices are
+// column-major float arrays
+struct GeomHot {
+	int type;  // 0 sphere, 1 cube; meshes never pass eligibility
+	int startIndex;
+	int endIndex;
+	int bvhRoot;
+	int visibility;
+	float inv[12];  // glm::mat4x3 inverseTransform
+	V3 motionOffset;
+	V3 leftBottom;  // sphere: world center (uniform-scale fast path)
+	V3 rightTop;    // sphere: world radius in .x, < 0 for deformed
+	int worldSpace; // baked world-space mesh flag; meshes never JIT
+};
+struct GeomCold {
+	float invT[9];  // glm::mat3 invTranspose
+	int materialid;
+	float lightArea;
+};
+
+__device__ V3 xfPoint(const float* m, V3 p) {
+	return v3(m[0] * p.x + m[3] * p.y + m[6] * p.z + m[9],
+		m[1] * p.x + m[4] * p.y + m[7] * p.z + m[10],
+		m[2] * p.x + m[5] * p.y + m[8] * p.z + m[11]);
+}
+__device__ V3 xfDir(const float* m, V3 d) {
+	return v3(m[0] * d.x + m[3] * d.y + m[6] * d.z,
+		m[1] * d.x + m[4] * d.y + m[7] * d.z,
+		m[2] * d.x + m[5] * d.y + m[8] * d.z);
+}
+__device__ V3 xfMat3(const float* m, V3 d) {
+	return v3(m[0] * d.x + m[3] * d.y + m[6] * d.z,
+		m[1] * d.x + m[4] * d.y + m[7] * d.z,
+		m[2] * d.x + m[5] * d.y + m[8] * d.z);
+}
+
+// sphereIntersectionTest, restated: world-space quadratic when the
+// center/radius overlay is valid, matrix path for deformed spheres
+__device__ float sphereTest(const GeomHot& g, V3 wo, V3 wd, float time,
+	float tMax, V3& objNormal) {
+#if SPEC_MOVING
+	wo = sub3(wo, scale3(g.motionOffset, time));
+#endif
+	if (g.rightTop.x > 0.0f) {
+		V3 oc = sub3(wo, g.leftBottom);
+		float vDotDirection = dot3(oc, wd);
+		float radicand = vDotDirection * vDotDirection
+			- (dot3(oc, oc) - g.rightTop.x * g.rightTop.x);
+		if (radicand < 0.0f) {
+			return -1.0f;
+		}
+		float squareRoot = sqrtf(radicand);
+		float t1 = -vDotDirection + squareRoot;
+		float t2 = -vDotDirection - squareRoot;
+		if (t1 < 0.0f && t2 < 0.0f) {
+			return -1.0f;
+		}
+		float t = (t1 > 0.0f && t2 > 0.0f) ? fminf(t1, t2) : fmaxf(t1, t2);
+		if (t >= tMax) {
+			return -1.0f;
+		}
+		objNormal = xfPoint(g.inv, add3(wo, scale3(wd, t)));
+		return t;
+	}
+	V3 ro = xfPoint(g.inv, wo);
+	V3 rd = xfDir(g.inv, wd);
+	float dirScale = sqrtf(dot3(rd, rd));
+	rd = scale3(rd, 1.0f / dirScale);
+	float vDotDirection = dot3(ro, rd);
+	float radicand = vDotDirection * vDotDirection - (dot3(ro, ro) - 0.25f);
+	if (radicand < 0.0f) {
+		return -1.0f;
+	}
+	float squareRoot = sqrtf(radicand);
+	float t1 = -vDotDirection + squareRoot;
+	float t2 = -vDotDirection - squareRoot;
+	if (t1 < 0.0f && t2 < 0.0f) {
+		return -1.0f;
+	}
+	float t = (t1 > 0.0f && t2 > 0.0f) ? fminf(t1, t2) : fmaxf(t1, t2);
+	float worldT = t / dirScale;
+	if (worldT >= tMax) {
+		return -1.0f;
+	}
+	objNormal = add3(ro, scale3(rd, t - 0.0001f));
+	return worldT;
+}
+
+// boxIntersectionTest, restated: slab test on the unit cube in object space
+__device__ float boxTest(const GeomHot& g, V3 wo, V3 wd, float time,
+	float tMax, V3& objNormal) {
+#if SPEC_MOVING
+	wo = sub3(wo, scale3(g.motionOffset, time));
+#endif
+	V3 ro = xfPoint(g.inv, wo);
+	V3 rd = xfDir(g.inv, wd);
+	float dirScale = sqrtf(dot3(rd, rd));
+	rd = scale3(rd, 1.0f / dirScale);
+	float o[3] = { ro.x, ro.y, ro.z };
+	float d[3] = { rd.x, rd.y, rd.z };
+	float tmin = -1e38f;
+	float tmax = 1e38f;
+	int tminAxis = 0;
+	float tminSign = 1.0f;
+	int tmaxAxis = 0;
+	float tmaxSign = 1.0f;
+	for (int xyz = 0; xyz < 3; ++xyz) {
+		float invD = 1.0f / d[xyz];
+		float t1 = (-0.5f - o[xyz]) * invD;
+		float t2 = (+0.5f - o[xyz]) * invD;
+		float ta = fminf(t1, t2);
+		float tb = fmaxf(t1, t2);
+		float sign = t2 < t1 ? +1.0f : -1.0f;
+		if (ta > 0.0f && ta > tmin) {
+			tmin = ta;
+			tminAxis = xyz;
+			tminSign = sign;
+		}
+		if (tb < tmax) {
+			tmax = tb;
+			tmaxAxis = xyz;
+			tmaxSign = -sign;
+		}
+	}
+	if (tmax < tmin || tmax <= 0.0f) {
+		return -1.0f;
+	}
+	if (tmin <= 0.0f) {
+		tmin = tmax;
+		tminAxis = tmaxAxis;
+		tminSign = tmaxSign;
+	}
+	float t = tmin / dirScale;
+	if (t >= tMax) {
+		return -1.0f;
+	}
+	V3 n = v3(0.0f, 0.0f, 0.0f);
+	if (tminAxis == 0) { n.x = tminSign; }
+	else if (tminAxis == 1) { n.y = tminSign; }
+	else { n.z = tminSign; }
+	objNormal = n;
+	return t;
+}
+
+extern "C" __global__ void intersectSpec(int num_paths, int rayMask,
+	const V3* origins, const V3* directions, const float* times,
+	const int* remap, const GeomHot* geoms, const GeomCold* geomsCold,
+	float* outT, V3* outNormals, int* outMatIds, V3* outPoints,
+	float* outLightAreas, V2* outUvs)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths) {
+		return;
+	}
+	if (remap) {
+		idx = remap[idx];
+	}
+	V3 ro = origins[idx];
+	V3 rd = directions[idx];
+#if SPEC_MOVING
+	float time = times[idx];
+#else
+	float time = 0.0f;
+#endif
+	float t_min = 3.402823466e38f;
+	int hit = -1;
+	V3 normal = v3(0.0f, 0.0f, 0.0f);
+#pragma unroll
+	for (int i = 0; i < SPEC_GEOMS; i++) {
+		if ((geoms[i].visibility & rayMask) == 0) {
+			continue;
+		}
+		V3 n;
+		float t = geoms[i].type == 0
+			? sphereTest(geoms[i], ro, rd, time, t_min, n)
+			: boxTest(geoms[i], ro, rd, time, t_min, n);
+		if (t > 0.0f && t < t_min) {
+			t_min = t;
+			hit = i;
+			normal = n;
+		}
+	}
+	if (hit < 0) {
+		outT[idx] = -1.0f;
+		return;
+	}
+	GeomCold cold = geomsCold[hit];
+	V3 wn = xfMat3(cold.invT, normal);
+	wn = scale3(wn, 1.0f / sqrtf(dot3(wn, wn)));
+	outT[idx] = t_min;
+	outMatIds[idx] = cold.materialid;
+	outNormals[idx] = wn;
+	// getPointOnRay's epsilon pullback
+	outPoints[idx] = add3(ro, scale3(rd, t_min - 0.0001f));
+	outLightAreas[idx] = cold.lightArea;
+	V2 uv;
+	uv.x = 0.0f;
+	uv.y = 0.0f;
+	outUvs[idx] = uv;
+}
+)nvrtc";
+
+// tripwires for the mirror structs in kSpecSource
+static_assert(sizeof(GeomHot) == 108, "GeomHot layout changed - update kSpecSource");
+static_assert(offsetof(GeomHot, visibility) == 16, "GeomHot layout changed - update kSpecSource");
+static_assert(offsetof(GeomHot, inverseTransform) == 20, "GeomHot layout changed - update kSpecSource");
+static_assert(offsetof(GeomHot, motionOffset) == 68, "GeomHot layout changed - update kSpecSource");
+static_assert(sizeof(GeomCold) == 44, "GeomCold layout changed - update kSpecSource");
+static_assert(offsetof(GeomCold, materialid) == 36, "GeomCold layout changed - update kSpecSource");
+static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::vec2) == 8,
+	"pool element layout changed - update kSpecSource");
+
+// FNV-1a over everything that affects the generated PTX
+static unsigned long long specHash(const std::string& s) {
+	unsigned long long h = 1469598103934665603ULL;
+	for (size_t i = 0; i < s.size(); i++) {
+		h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+bool nvrtcSpecInit(Scene* scene) {
+	nvrtcSpecFree();
+
+	int numGeoms = (int)scene->geoms.size();
+	if (numGeoms < 1 || numGeoms > kSpecMaxGeoms) {
+		return false;
+	}
+	bool moving = false;
+	for (const Geom& geom : scene->geoms) {
+		if (geom.type == MESH || geom.type == PLANE) {
+			// no BVH traversal or plane test in the JIT source;
+			// precompiled kernels stay
+			return false;
+		}
+		moving = moving || geom.moving;
+	}
+
+	cudaDeviceProp prop;
+	int device;
+	cudaGetDevice(&device);
+	cudaGetDeviceProperties(&prop, device);
+	char archOpt[64];
+	snprintf(archOpt, sizeof(archOpt), "--gpu-architecture=compute_%d%d",
+		prop.major, prop.minor);
+	char geomsOpt[32];
+	snprintf(geomsOpt, sizeof(geomsOpt), "-DSPEC_GEOMS=%d", numGeoms);
+	const char* movingOpt = moving ? "-DSPEC_MOVING=1" : "-DSPEC_MOVING=0";
+	const char* opts[] = { archOpt, geomsOpt, movingOpt };
+
+	// disk cache: everything that shapes the PTX goes into the key, so a
+	// different scene shape, GPU or source revision misses cleanly
+	std::ostringstream key;
+	key << kSpecSource << kSpecSourceVersion << archOpt << geomsOpt
+		<< movingOpt << prop.name;
+	char cachePath[64];
+	snprintf(cachePath, sizeof(cachePath), "nvrtcspec_%016llx.ptx",
+		specHash(key.str()));
+
+	std::string ptx;
+	std::ifstream cached(cachePath, std::ios::binary);
+	if (cached.good()) {
+		std::ostringstream buf;
+		buf << cached.rdbuf();
+		ptx = buf.str();
+	}
+	else {
+		nvrtcProgram prog;
+		NVRTC_CHECK(nvrtcCreateProgram(&prog, kSpecSource, "nvrtcspec", 0, NULL, NULL));
+		nvrtcResult res = nvrtcCompileProgram(prog, 3, opts);
+		if (res != NVRTC_SUCCESS) {
+			size_t logSize = 0;
+			nvrtcGetProgramLogSize(prog, &logSize);
+			std::vector<char> log(logSize + 1, 0);
+			nvrtcGetProgramLog(prog, log.data());
+			fprintf(stderr, "nvrtcspec: compile failed:\n%s\n", log.data());
+			nvrtcDestroyProgram(&prog);
+			return false;
+		}
+		size_t ptxSize = 0;
+		NVRTC_CHECK(nvrtcGetPTXSize(prog, &ptxSize));
+		ptx.resize(ptxSize);
+		NVRTC_CHECK(nvrtcGetPTX(prog, &ptx[0]));
+		nvrtcDestroyProgram(&prog);
+		std::ofstream out(cachePath, std::ios::binary);
+		out.write(ptx.data(), ptx.size());
+	}
+
+	// the runtime API already established the context; the driver calls
+	// pick it up from this thread
+	CU_CHECK(cuModuleLoadData(&specModule, ptx.c_str()));
+	CU_CHECK(cuModuleGetFunction(&specKernel, specModule, "intersectSpec"));
+	specReady = true;
+	printf("nvrtcspec: specialized for %d geoms%s\n", numGeoms,
+		moving ? " (moving)" : "");
+	return true;
+}
+
+bool nvrtcSpecAvailable() {
+	return specReady;
+}
+
+void nvrtcSpecTrace(int numPaths, const PathSegmentSoA& paths, const int* remap,
+	const ShadeableIntersectionSoA& intersections, const GeomHot* geomsHot,
+	const GeomCold* geomsCold, int rayMask, cudaStream_t stream) {
+	void* args[] = {
+		&numPaths, &rayMask,
+		(void*)&paths.origins, (void*)&paths.directions, (void*)&paths.times,
+		&remap, &geomsHot, &geomsCold,
+		(void*)&intersections.t, (void*)&intersections.surfaceNormals,
+		(void*)&intersections.materialIds, (void*)&intersections.points,
+		(void*)&intersections.lightAreas, (void*)&intersections.uvs,
+	};
+	const int blockSize = 128;
+	int numBlocks = (numPaths + blockSize - 1) / blockSize;
+	CUresult res = cuLaunchKernel(specKernel, numBlocks, 1, 1,
+		blockSize, 1, 1, 0, (CUstream)stream, args, NULL);
+	if (res != CUDA_SUCCESS) {
+		fprintf(stderr, "nvrtcspec: launch failed (%d)\n", (int)res);
+	}
+}
+
+void nvrtcSpecFree() {
+	if (specModule != NULL) {
+		cuModuleUnload(specModule);
+	}
+	specModule = NULL;
+	specKernel = NULL;
+	specReady = false;
+}
+
+#else  // NVRTC_SPEC_ENABLE
+
+bool nvrtcSpecInit(Scene*) { return false; }
+bool nvrtcSpecAvailable() { return false; }
+void nvrtcSpecTrace(int, const PathSegmentSoA&, const int*,
+	const ShadeableIntersectionSoA&, const GeomHot*, const GeomCold*, int,
+	cudaStream_t) {}
+void nvrtcSpecFree() {}
+
+#endif // NVRTC_SPEC_ENABLE
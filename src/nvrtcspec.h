@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cuda_runtime.h>
+#include "sceneStructs.h"
+
+class Scene;
+
+// NVRTC runtime kernel specialization: after the scene loads, the hot
+// intersection loop is JIT-compiled with the scene's constants baked in -
+// geom count as a compile-time loop bound, the motion-blur reads compiled
+// out of all-static scenes - and launched through the driver API in place
+// of the precompiled computeIntersections. PTX is cached on disk keyed by
+// scene shape, GPU and source version, so only the first render of a
+// scene pays the JIT. Analytic (sphere/cube) scenes only: the JIT source
+// must be self-contained because NVRTC cannot consume the glm/thrust
+// headers the precompiled kernels use, and duplicating the BVH traversal
+// in a second dialect is not worth carrying - mesh scenes, and any init
+// or compile failure, keep the precompiled kernels. Requires libnvrtc and
+// the driver API (CMakeLists links both when present).
+#define NVRTC_SPEC_ENABLE 0
+
+/**
+ * Decide eligibility, then compile (or load from the PTX cache) the
+ * kernel specialized for this scene. Returns false - leaving the
+ * precompiled kernels in charge - for mesh scenes, on any NVRTC or driver
+ * error, and when the build lacks NVRTC_SPEC_ENABLE.
+ */
+bool nvrtcSpecInit(Scene* scene);
+
+/** True once nvrtcSpecInit has succeeded and until nvrtcSpecFree. */
+bool nvrtcSpecAvailable();
+
+/**
+ * Trace one bounce's closest-hit queries with the specialized kernel:
+ * same contract as the computeIntersections launch it replaces (numPaths
+ * rays through the optional remap, intersection SoA filled), with the
+ * ray's visibility class passed in place of a geom count - the count is
+ * baked into the kernel.
+ */
+void nvrtcSpecTrace(int numPaths, const PathSegmentSoA& paths, const int* remap,
+    const ShadeableIntersectionSoA& intersections, const GeomHot* geomsHot,
+    const GeomCold* geomsCold, int rayMask, cudaStream_t stream);
+
+/** Unload the module; the next init recompiles or re-reads the cache. */
+void nvrtcSpecFree();
@@ -0,0 +1,26 @@
+#pragma once
+
+// Thin NVTX wrapper so Nsight Systems timelines show named pipeline stages
+// (with bounce index and live path count) instead of an undifferentiated
+// wall of kernels. Ranges are host-side markers and cost a formatted string
+// plus one library call each, so the toggle compiles them to nothing for
+// release-minimal builds. Enabling also needs nvToolsExt linked; the
+// CMakeLists picks it up from the CUDA toolkit when available.
+#define NVTX_ENABLE 0
+
+#if NVTX_ENABLE
+#include <cstdio>
+#include <nvToolsExt.h>
+// printf-style range open, e.g. NVTX_PUSH("bounce %d: %d paths", d, n);
+// every push must be matched by an NVTX_POP on the same thread
+#define NVTX_PUSH(...) \
+    do { \
+        char nvtxNameBuf_[128]; \
+        snprintf(nvtxNameBuf_, sizeof(nvtxNameBuf_), __VA_ARGS__); \
+        nvtxRangePushA(nvtxNameBuf_); \
+    } while (0)
+#define NVTX_POP() nvtxRangePop()
+#else
+#define NVTX_PUSH(...)
+#define NVTX_POP()
+#endif // NVTX_ENABLE
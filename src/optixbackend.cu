@@ -0,0 +1,425 @@
+#include "optixbackend.h"
+
+#if OPTIX_BACKEND_ENABLE
+
+#include <optix.h>
+#include <optix_function_table_definition.h>
+#include <optix_stubs.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "scene.h"
+
+// Module statics, following pathtrace.cu's pattern of per-file device
+// state. The backend owns its own copies of the geometry pools: they cost
+// one extra upload at init but keep it decoupled from pathtrace.cu's
+// internals, so either side can reinitialize without the other noticing.
+static OptixDeviceContext context = NULL;
+static OptixModule module = NULL;
+static OptixPipeline pipeline = NULL;
+static OptixProgramGroup raygenPG = NULL;
+static OptixProgramGroup missPG = NULL;
+static OptixProgramGroup triPG = NULL;
+static OptixProgramGroup primPG = NULL;
+static OptixShaderBindingTable sbt = {};
+static OptixTraversableHandle tlasHandle = 0;
+static std::vector<CUdeviceptr> ownedBuffers;
+static CUdeviceptr d_params = 0;
+static glm::ivec4* d_triangles = NULL;
+static glm::vec4* d_vertices = NULL;
+static PackedNormal* d_normals = NULL;
+static glm::vec2* d_uvs = NULL;
+static bool backendReady = false;
+
+#define OPTIX_CHECK(call) \
+	do { \
+		OptixResult res_ = call; \
+		if (res_ != OPTIX_SUCCESS) { \
+			fprintf(stderr, "optix: %s failed (%d)\n", #call, (int)res_); \
+			return false; \
+		} \
+	} while (0)
+
+// one device allocation the teardown path will reclaim
+static CUdeviceptr ownedAlloc(size_t bytes) {
+	void* p = NULL;
+	cudaMalloc(&p, bytes);
+	ownedBuffers.push_back((CUdeviceptr)p);
+	return (CUdeviceptr)p;
+}
+
+template <typename T>
+struct SbtRecord {
+	__align__(OPTIX_SBT_RECORD_ALIGNMENT) char header[OPTIX_SBT_RECORD_HEADER_SIZE];
+	T data;
+};
+struct EmptyData {};
+typedef SbtRecord<EmptyData> RaygenRecord;
+typedef SbtRecord<EmptyData> MissRecord;
+typedef SbtRecord<OptixHitgroupData> HitgroupRecord;
+
+static void contextLog(unsigned int level, const char* tag, const char* msg, void*) {
+	if (level <= 3) {
+		fprintf(stderr, "optix[%s]: %s\n", tag, msg);
+	}
+}
+
+// Build one GAS from prepared build inputs and wrap the compaction dance;
+// returns 0 on failure.
+static OptixTraversableHandle buildGAS(const std::vector<OptixBuildInput>& inputs) {
+	OptixAccelBuildOptions options = {};
+	options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_TRACE;
+	options.operation = OPTIX_BUILD_OPERATION_BUILD;
+
+	OptixAccelBufferSizes sizes;
+	if (optixAccelComputeMemoryUsage(context, &options, inputs.data(),
+		(unsigned int)inputs.size(), &sizes) != OPTIX_SUCCESS) {
+		return 0;
+	}
+	CUdeviceptr d_temp = ownedAlloc(sizes.tempSizeInBytes);
+	CUdeviceptr d_output = ownedAlloc(sizes.outputSizeInBytes);
+	OptixTraversableHandle handle = 0;
+	if (optixAccelBuild(context, 0, &options, inputs.data(),
+		(unsigned int)inputs.size(), d_temp, sizes.tempSizeInBytes,
+		d_output, sizes.outputSizeInBytes, &handle, NULL, 0) != OPTIX_SUCCESS) {
+		return 0;
+	}
+	return handle;
+}
+
+// world-space surface area of a sphere/cube light, matching pathtrace.cu's
+// geomSurfaceArea so MIS weights agree across backends
+static float primSurfaceArea(const Geom& geom) {
+	glm::vec3 sc = geom.scale;
+	if (geom.type == SPHERE) {
+		float r = 0.5f * (sc.x + sc.y + sc.z) / 3.0f;
+		return 4.0f * 3.14159265358979f * r * r;
+	}
+	return 2.0f * (sc.x * sc.y + sc.y * sc.z + sc.z * sc.x);
+}
+
+static bool loadPtx(std::string& ptx) {
+	// the CMake rule copies the compiled device programs next to the binary
+	std::ifstream file("optixdevice.ptx");
+	if (!file.good()) {
+		fprintf(stderr, "optix: cannot open optixdevice.ptx\n");
+		return false;
+	}
+	std::stringstream ss;
+	ss << file.rdbuf();
+	ptx = ss.str();
+	return true;
+}
+
+bool optixBackendInit(Scene* scene) {
+	if (backendReady) {
+		optixBackendFree();
+	}
+	for (const Geom& geom : scene->geoms) {
+		if (geom.moving) {
+			// motion blur needs OptiX motion keys; not worth the pipeline
+			// permutation for the few scenes that animate
+			fprintf(stderr, "optix: scene has moving geoms, using software traversal\n");
+			return false;
+		}
+		if (geom.type == PLANE) {
+			// an infinite plane has no AABB for the custom-primitive GAS
+			fprintf(stderr, "optix: scene has plane geoms, using software traversal\n");
+			return false;
+		}
+	}
+
+	OPTIX_CHECK(optixInit());
+	OptixDeviceContextOptions ctxOptions = {};
+	ctxOptions.logCallbackFunction = contextLog;
+	ctxOptions.logCallbackLevel = 3;
+	OPTIX_CHECK(optixDeviceContextCreate(0 /* current CUDA context */, &ctxOptions, &context));
+
+	// geometry pools, backend-owned copies (vec4-aligned like the originals)
+	d_triangles = (glm::ivec4*)ownedAlloc(scene->triangles.size() * sizeof(glm::ivec4));
+	cudaMemcpy(d_triangles, scene->triangles.data(), scene->triangles.size() * sizeof(glm::ivec4), cudaMemcpyHostToDevice);
+	d_vertices = (glm::vec4*)ownedAlloc(scene->vertices.size() * sizeof(glm::vec4));
+	cudaMemcpy(d_vertices, scene->vertices.data(), scene->vertices.size() * sizeof(glm::vec4), cudaMemcpyHostToDevice);
+	std::vector<PackedNormal> packedNormals(scene->normals.size());
+	for (size_t i = 0; i < scene->normals.size(); i++) {
+		packedNormals[i] = packNormal(glm::vec3(scene->normals[i]));
+	}
+	d_normals = (PackedNormal*)ownedAlloc(scene->normals.size() * sizeof(PackedNormal));
+	cudaMemcpy(d_normals, packedNormals.data(), scene->normals.size() * sizeof(PackedNormal), cudaMemcpyHostToDevice);
+	if (!scene->textures.empty() && !scene->uvs.empty()) {
+		d_uvs = (glm::vec2*)ownedAlloc(scene->uvs.size() * sizeof(glm::vec2));
+		cudaMemcpy(d_uvs, scene->uvs.data(), scene->uvs.size() * sizeof(glm::vec2), cudaMemcpyHostToDevice);
+	}
+
+	// one triangle GAS per unique mesh range (instances share it, like the
+	// BLAS sharing at init), plus one custom-primitive GAS holding an AABB
+	// per sphere/cube; everything instanced under a single IAS
+	std::vector<OptixInstance> instances;
+	std::vector<HitgroupRecord> hitRecords;
+	const unsigned int triFlags[1] = { OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT };
+	std::map<int, OptixTraversableHandle> meshGas;
+	int numMeshGeoms = 0;
+	for (const Geom& geom : scene->geoms) {
+		if (geom.type != MESH) {
+			continue;
+		}
+		std::map<int, OptixTraversableHandle>::iterator built = meshGas.find(geom.startIndex);
+		if (built == meshGas.end()) {
+			OptixBuildInput input = {};
+			input.type = OPTIX_BUILD_INPUT_TYPE_TRIANGLES;
+			input.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_FLOAT3;
+			input.triangleArray.vertexStrideInBytes = sizeof(glm::vec4);
+			input.triangleArray.numVertices = (unsigned int)scene->vertices.size();
+			CUdeviceptr vertexBuffer = (CUdeviceptr)d_vertices;
+			input.triangleArray.vertexBuffers = &vertexBuffer;
+			input.triangleArray.indexFormat = OPTIX_INDICES_FORMAT_UNSIGNED_INT3;
+			input.triangleArray.indexStrideInBytes = sizeof(glm::ivec4);
+			input.triangleArray.numIndexTriplets = (unsigned int)(geom.endIndex - geom.startIndex);
+			input.triangleArray.indexBuffer = (CUdeviceptr)(d_triangles + geom.startIndex);
+			input.triangleArray.flags = triFlags;
+			input.triangleArray.numSbtRecords = 1;
+			std::vector<OptixBuildInput> inputs(1, input);
+			OptixTraversableHandle gas = buildGAS(inputs);
+			if (gas == 0) {
+				fprintf(stderr, "optix: mesh GAS build failed\n");
+				return false;
+			}
+			built = meshGas.insert(std::make_pair(geom.startIndex, gas)).first;
+		}
+
+		OptixInstance inst = {};
+		// glm is column-major; OptiX wants the 3x4 rows
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 4; c++) {
+				inst.transform[r * 4 + c] = geom.transform[c][r];
+			}
+		}
+		inst.instanceId = (unsigned int)instances.size();
+		inst.sbtOffset = (unsigned int)hitRecords.size();
+		inst.visibilityMask = 0xFF;
+		inst.flags = OPTIX_INSTANCE_FLAG_NONE;
+		inst.traversableHandle = built->second;
+		instances.push_back(inst);
+
+		HitgroupRecord rec = {};
+		rec.data.geomType = MESH;
+		rec.data.materialid = geom.materialid;
+		rec.data.lightArea = 0.0f;  // mesh lights are not NEE-listed
+		rec.data.triangleBase = geom.startIndex;
+		rec.data.inverseTransform = geom.inverseTransform;
+		rec.data.invTranspose = geom.invTranspose;
+		hitRecords.push_back(rec);
+		numMeshGeoms++;
+	}
+
+	// spheres and cubes: one AABB build input each, so every primitive gets
+	// its own SBT record carrying its transform and material
+	std::vector<OptixAabb> aabbs;
+	std::vector<const Geom*> primGeoms;
+	for (const Geom& geom : scene->geoms) {
+		if (geom.type == MESH) {
+			continue;
+		}
+		// world bounds of the unit primitive: transform the 8 corners
+		glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 p(corner & 1 ? 0.5f : -0.5f,
+				corner & 2 ? 0.5f : -0.5f,
+				corner & 4 ? 0.5f : -0.5f);
+			glm::vec3 w = glm::vec3(geom.transform * glm::vec4(p, 1.0f));
+			lo = glm::min(lo, w);
+			hi = glm::max(hi, w);
+		}
+		OptixAabb aabb = { lo.x, lo.y, lo.z, hi.x, hi.y, hi.z };
+		aabbs.push_back(aabb);
+		primGeoms.push_back(&geom);
+	}
+	if (!aabbs.empty()) {
+		CUdeviceptr d_aabbs = ownedAlloc(aabbs.size() * sizeof(OptixAabb));
+		cudaMemcpy((void*)d_aabbs, aabbs.data(), aabbs.size() * sizeof(OptixAabb), cudaMemcpyHostToDevice);
+		std::vector<OptixBuildInput> inputs(aabbs.size());
+		std::vector<CUdeviceptr> aabbPtrs(aabbs.size());
+		std::vector<unsigned int> primFlags(aabbs.size(), OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT);
+		for (size_t i = 0; i < aabbs.size(); i++) {
+			aabbPtrs[i] = d_aabbs + i * sizeof(OptixAabb);
+			OptixBuildInput input = {};
+			input.type = OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES;
+			input.customPrimitiveArray.aabbBuffers = &aabbPtrs[i];
+			input.customPrimitiveArray.numPrimitives = 1;
+			input.customPrimitiveArray.flags = &primFlags[i];
+			input.customPrimitiveArray.numSbtRecords = 1;
+			inputs[i] = input;
+		}
+		OptixTraversableHandle primGas = buildGAS(inputs);
+		if (primGas == 0) {
+			fprintf(stderr, "optix: primitive GAS build failed\n");
+			return false;
+		}
+		OptixInstance inst = {};
+		inst.transform[0] = inst.transform[5] = inst.transform[10] = 1.0f;
+		inst.instanceId = (unsigned int)instances.size();
+		inst.sbtOffset = (unsigned int)hitRecords.size();
+		inst.visibilityMask = 0xFF;
+		inst.flags = OPTIX_INSTANCE_FLAG_NONE;
+		inst.traversableHandle = primGas;
+		instances.push_back(inst);
+		for (const Geom* geom : primGeoms) {
+			HitgroupRecord rec = {};
+			rec.data.geomType = geom->type;
+			rec.data.materialid = geom->materialid;
+			rec.data.lightArea = scene->materials[geom->materialid].emittance > 0.0f
+				? primSurfaceArea(*geom) : 0.0f;
+			rec.data.triangleBase = 0;
+			rec.data.inverseTransform = geom->inverseTransform;
+			rec.data.invTranspose = geom->invTranspose;
+			hitRecords.push_back(rec);
+		}
+	}
+
+	CUdeviceptr d_instances = ownedAlloc(instances.size() * sizeof(OptixInstance));
+	cudaMemcpy((void*)d_instances, instances.data(), instances.size() * sizeof(OptixInstance), cudaMemcpyHostToDevice);
+	OptixBuildInput iasInput = {};
+	iasInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+	iasInput.instanceArray.instances = d_instances;
+	iasInput.instanceArray.numInstances = (unsigned int)instances.size();
+	std::vector<OptixBuildInput> iasInputs(1, iasInput);
+	tlasHandle = buildGAS(iasInputs);
+	if (tlasHandle == 0) {
+		fprintf(stderr, "optix: IAS build failed\n");
+		return false;
+	}
+
+	// module, pipeline, program groups
+	std::string ptx;
+	if (!loadPtx(ptx)) {
+		return false;
+	}
+	OptixModuleCompileOptions moduleOptions = {};
+	OptixPipelineCompileOptions pipelineOptions = {};
+	pipelineOptions.traversableGraphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING;
+	pipelineOptions.numPayloadValues = 8;
+	pipelineOptions.numAttributeValues = 3;
+	pipelineOptions.pipelineLaunchParamsVariableName = "params";
+	OPTIX_CHECK(optixModuleCreateFromPTX(context, &moduleOptions, &pipelineOptions,
+		ptx.c_str(), ptx.size(), NULL, NULL, &module));
+
+	OptixProgramGroupOptions pgOptions = {};
+	OptixProgramGroupDesc descs[4] = {};
+	descs[0].kind = OPTIX_PROGRAM_GROUP_KIND_RAYGEN;
+	descs[0].raygen.module = module;
+	descs[0].raygen.entryFunctionName = "__raygen__trace";
+	descs[1].kind = OPTIX_PROGRAM_GROUP_KIND_MISS;
+	descs[1].miss.module = module;
+	descs[1].miss.entryFunctionName = "__miss__miss";
+	descs[2].kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+	descs[2].hitgroup.moduleCH = module;
+	descs[2].hitgroup.entryFunctionNameCH = "__closesthit__triangle";
+	descs[3].kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+	descs[3].hitgroup.moduleCH = module;
+	descs[3].hitgroup.entryFunctionNameCH = "__closesthit__primitive";
+	descs[3].hitgroup.moduleIS = module;
+	descs[3].hitgroup.entryFunctionNameIS = "__intersection__primitive";
+	OptixProgramGroup groups[4];
+	OPTIX_CHECK(optixProgramGroupCreate(context, descs, 4, &pgOptions, NULL, NULL, groups));
+	raygenPG = groups[0];
+	missPG = groups[1];
+	triPG = groups[2];
+	primPG = groups[3];
+
+	OptixPipelineLinkOptions linkOptions = {};
+	linkOptions.maxTraceDepth = 1;  // closest-hit queries only
+	OPTIX_CHECK(optixPipelineCreate(context, &pipelineOptions, &linkOptions,
+		groups, 4, NULL, NULL, &pipeline));
+
+	// SBT: one raygen, one miss, the per-geom hitgroup records built above
+	// (mesh records first, then the custom primitives, matching sbtOffset)
+	RaygenRecord rgRecord = {};
+	optixSbtRecordPackHeader(raygenPG, &rgRecord);
+	sbt.raygenRecord = ownedAlloc(sizeof(RaygenRecord));
+	cudaMemcpy((void*)sbt.raygenRecord, &rgRecord, sizeof(rgRecord), cudaMemcpyHostToDevice);
+	MissRecord msRecord = {};
+	optixSbtRecordPackHeader(missPG, &msRecord);
+	sbt.missRecordBase = ownedAlloc(sizeof(MissRecord));
+	sbt.missRecordStrideInBytes = sizeof(MissRecord);
+	sbt.missRecordCount = 1;
+	cudaMemcpy((void*)sbt.missRecordBase, &msRecord, sizeof(msRecord), cudaMemcpyHostToDevice);
+	for (size_t i = 0; i < hitRecords.size(); i++) {
+		optixSbtRecordPackHeader((int)i < numMeshGeoms ? triPG : primPG, &hitRecords[i]);
+	}
+	sbt.hitgroupRecordBase = ownedAlloc(hitRecords.size() * sizeof(HitgroupRecord));
+	sbt.hitgroupRecordStrideInBytes = sizeof(HitgroupRecord);
+	sbt.hitgroupRecordCount = (unsigned int)hitRecords.size();
+	cudaMemcpy((void*)sbt.hitgroupRecordBase, hitRecords.data(),
+		hitRecords.size() * sizeof(HitgroupRecord), cudaMemcpyHostToDevice);
+
+	d_params = ownedAlloc(sizeof(OptixBackendParams));
+	backendReady = true;
+	printf("optix: hardware traversal ready (%d instances, %d hitgroups)\n",
+		(int)instances.size(), (int)hitRecords.size());
+	return true;
+}
+
+bool optixBackendAvailable() {
+	return backendReady;
+}
+
+void optixBackendTrace(int numPaths, const PathSegmentSoA& paths,
+	const int* remap, const ShadeableIntersectionSoA& intersections,
+	cudaStream_t stream) {
+	OptixBackendParams params;
+	params.paths = paths;
+	params.intersections = intersections;
+	params.remap = remap;
+	params.tlas = tlasHandle;
+	params.triangles = d_triangles;
+	params.normals = d_normals;
+	params.uvs = d_uvs;
+	cudaMemcpyAsync((void*)d_params, &params, sizeof(params),
+		cudaMemcpyHostToDevice, stream);
+	optixLaunch(pipeline, stream, d_params, sizeof(OptixBackendParams),
+		&sbt, (unsigned int)numPaths, 1, 1);
+}
+
+void optixBackendFree() {
+	if (pipeline) {
+		optixPipelineDestroy(pipeline);
+		pipeline = NULL;
+	}
+	if (module) {
+		optixModuleDestroy(module);
+		module = NULL;
+	}
+	if (context) {
+		optixDeviceContextDestroy(context);
+		context = NULL;
+	}
+	for (CUdeviceptr p : ownedBuffers) {
+		cudaFree((void*)p);
+	}
+	ownedBuffers.clear();
+	d_triangles = NULL;
+	d_vertices = NULL;
+	d_normals = NULL;
+	d_uvs = NULL;
+	d_params = 0;
+	tlasHandle = 0;
+	sbt = OptixShaderBindingTable();
+	backendReady = false;
+}
+
+#else  // OPTIX_BACKEND_ENABLE
+
+// stubs so callers need no guards of their own; the software path stays in
+// charge
+bool optixBackendInit(Scene*) { return false; }
+bool optixBackendAvailable() { return false; }
+void optixBackendTrace(int, const PathSegmentSoA&, const int*,
+	const ShadeableIntersectionSoA&, cudaStream_t) {}
+void optixBackendFree() {}
+
+#endif // OPTIX_BACKEND_ENABLE
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cuda_runtime.h>
+#include <glm/glm.hpp>
+#include "sceneStructs.h"
+
+class Scene;
+
+// RT-core hardware intersection backend. The software traversal in
+// computeIntersections never touches the RT cores; this backend routes one
+// bounce's closest-hit queries through OptiX instead - the ray and
+// intersection SoA streams stay exactly as they are, the shading kernels
+// never know which backend filled them. Requires the OptiX 7 SDK headers
+// (point OPTIX_INSTALL_DIR at the SDK when configuring) and the device
+// program PTX (optixdevice.ptx) next to the binary; selected at runtime
+// with --hwtrace, and any init failure falls back to the software path.
+// Out of scope, falling back automatically: moving geoms (motion blur),
+// mesh LODs and multi-GPU sharding.
+#define OPTIX_BACKEND_ENABLE 0
+
+// Everything the device programs need for one launch: the path stream to
+// read rays from, the optional live-slot indirection, and the intersection
+// stream to fill. Shared between optixbackend.cu (upload) and
+// optixdevice.cu (use).
+struct OptixBackendParams {
+    PathSegmentSoA paths;
+    ShadeableIntersectionSoA intersections;
+    const int* remap;  // NULL for identity slot order
+    unsigned long long tlas;  // OptixTraversableHandle
+    const glm::ivec4* triangles;
+    const PackedNormal* normals;
+    const glm::vec2* uvs;  // NULL for scenes without textured materials
+};
+
+// Per-hitgroup shading-binding-table payload: what the closest-hit
+// programs need to emit a ShadeableIntersection for their geom.
+struct OptixHitgroupData {
+    int geomType;
+    int materialid;
+    float lightArea;
+    int triangleBase;  // mesh geoms: startIndex of the GAS's index slice
+    glm::mat4 inverseTransform;  // custom prims test in object space
+    glm::mat4 invTranspose;
+};
+
+/**
+ * Build the traversable (per-mesh triangle GAS + one custom-primitive GAS
+ * for spheres/cubes, instanced under an IAS), load the device-program
+ * module and set up the pipeline and SBT. Returns false - leaving the
+ * software path in charge - on any failure or when the build lacks
+ * OPTIX_BACKEND_ENABLE.
+ */
+bool optixBackendInit(Scene* scene);
+
+/** True once optixBackendInit has succeeded and until optixBackendFree. */
+bool optixBackendAvailable();
+
+/**
+ * Trace one bounce's closest-hit queries on the stream: reads numPaths
+ * rays from the path SoA (through remap when non-NULL, matching the
+ * software kernels' live-slot indirection) and writes the intersection
+ * SoA. Asynchronous like the kernel launch it replaces.
+ */
+void optixBackendTrace(int numPaths, const PathSegmentSoA& paths,
+    const int* remap, const ShadeableIntersectionSoA& intersections,
+    cudaStream_t stream);
+
+/** Tear down the pipeline and every buffer the backend owns. */
+void optixBackendFree();
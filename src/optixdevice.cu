@@ -0,0 +1,167 @@
+// OptiX device programs for the hardware intersection backend
+// (optixbackend.cu): raygen reads one ray per launch index from the path
+// SoA, traces the IAS and writes a ShadeableIntersection-equivalent back
+// into the intersection SoA. Compiled to PTX by the CMake rule and loaded
+// at runtime; never part of the main binary.
+
+#include <optix.h>
+#include <glm/glm.hpp>
+
+#include "optixbackend.h"
+#include "sceneStructs.h"
+
+extern "C" __constant__ OptixBackendParams params;
+
+// payload registers: hit t, world normal, material id, light area, uv
+static __forceinline__ __device__ unsigned int bits(float f) {
+	return __float_as_uint(f);
+}
+static __forceinline__ __device__ float flt(unsigned int u) {
+	return __uint_as_float(u);
+}
+
+static __forceinline__ __device__ const OptixHitgroupData* hitData() {
+	return (const OptixHitgroupData*)optixGetSbtDataPointer();
+}
+
+extern "C" __global__ void __raygen__trace() {
+	const unsigned int idx = optixGetLaunchIndex().x;
+	const int slot = params.remap != NULL ? params.remap[idx] : (int)idx;
+	if (params.paths.remainingBounces[slot] <= 0) {
+		params.intersections.t[slot] = -1.0f;
+		return;
+	}
+
+	const glm::vec3 origin = params.paths.origins[slot];
+	const glm::vec3 direction = params.paths.directions[slot];
+
+	// match the software kernels: no hit encodes as t < 0
+	unsigned int p0 = bits(-1.0f);
+	unsigned int p1 = 0, p2 = 0, p3 = 0;
+	unsigned int p4 = (unsigned int)-1;
+	unsigned int p5 = 0;
+	unsigned int p6 = 0, p7 = 0;
+	optixTrace(params.tlas,
+		make_float3(origin.x, origin.y, origin.z),
+		make_float3(direction.x, direction.y, direction.z),
+		0.0001f, 1e16f, 0.0f, OptixVisibilityMask(0xFF),
+		OPTIX_RAY_FLAG_DISABLE_ANYHIT,
+		0, 1, 0,
+		p0, p1, p2, p3, p4, p5, p6, p7);
+
+	const float t = flt(p0);
+	params.intersections.t[slot] = t;
+	if (t > 0.0f) {
+		params.intersections.surfaceNormals[slot] = glm::vec3(flt(p1), flt(p2), flt(p3));
+		params.intersections.materialIds[slot] = (int)p4;
+		params.intersections.points[slot] = origin + t * direction;
+		params.intersections.lightAreas[slot] = flt(p5);
+		params.intersections.uvs[slot] = glm::vec2(flt(p6), flt(p7));
+	}
+}
+
+extern "C" __global__ void __miss__miss() {
+	optixSetPayload_0(bits(-1.0f));
+}
+
+extern "C" __global__ void __closesthit__triangle() {
+	const OptixHitgroupData* data = hitData();
+	const float2 bary = optixGetTriangleBarycentrics();
+	const unsigned int prim = optixGetPrimitiveIndex();
+
+	// smooth normal from the shared pool, like meshIntersectionTest. The
+	// GAS was built over the mesh's slice of the index buffer, so the
+	// primitive index is range-local; the record carries the slice's start.
+	const glm::ivec4 tri = params.triangles[data->triangleBase + (int)prim];
+	glm::vec2 uv(0.0f);
+	if (params.uvs != NULL) {
+		uv = params.uvs[tri.x] * (1.0f - bary.x - bary.y)
+			+ params.uvs[tri.y] * bary.x + params.uvs[tri.z] * bary.y;
+	}
+	glm::vec3 n0 = unpackNormal(params.normals[tri.x]);
+	glm::vec3 n1 = unpackNormal(params.normals[tri.y]);
+	glm::vec3 n2 = unpackNormal(params.normals[tri.z]);
+	glm::vec3 n = glm::normalize(n0 * (1.0f - bary.x - bary.y) + n1 * bary.x + n2 * bary.y);
+
+	// object -> world for the instanced mesh
+	float3 wn = optixTransformNormalFromObjectToWorldSpace(make_float3(n.x, n.y, n.z));
+	glm::vec3 worldN = glm::normalize(glm::vec3(wn.x, wn.y, wn.z));
+
+	optixSetPayload_0(bits(optixGetRayTmax()));
+	optixSetPayload_1(bits(worldN.x));
+	optixSetPayload_2(bits(worldN.y));
+	optixSetPayload_3(bits(worldN.z));
+	optixSetPayload_4((unsigned int)data->materialid);
+	optixSetPayload_5(bits(0.0f));
+	optixSetPayload_6(bits(uv.x));
+	optixSetPayload_7(bits(uv.y));
+}
+
+// unit sphere (radius 0.5) and unit cube (side 1) intersection in object
+// space, mirroring the tests in intersections.h; the AABB got us here, the
+// exact test decides
+extern "C" __global__ void __intersection__primitive() {
+	const OptixHitgroupData* data = hitData();
+	const float3 o = optixGetWorldRayOrigin();
+	const float3 d = optixGetWorldRayDirection();
+	glm::vec3 ro = glm::vec3(data->inverseTransform * glm::vec4(o.x, o.y, o.z, 1.0f));
+	glm::vec3 rd = glm::vec3(data->inverseTransform * glm::vec4(d.x, d.y, d.z, 0.0f));
+
+	float tObj = -1.0f;
+	glm::vec3 nObj(0.0f);
+	if (data->geomType == SPHERE) {
+		const float radius = 0.5f;
+		float a = glm::dot(rd, rd);
+		float b = 2.0f * glm::dot(ro, rd);
+		float c = glm::dot(ro, ro) - radius * radius;
+		float radicand = b * b - 4.0f * a * c;
+		if (radicand < 0.0f) {
+			return;
+		}
+		float sq = sqrtf(radicand);
+		float t0 = (-b - sq) / (2.0f * a);
+		float t1 = (-b + sq) / (2.0f * a);
+		tObj = t0 > 0.0f ? t0 : t1;
+		if (tObj <= 0.0f) {
+			return;
+		}
+		nObj = ro + tObj * rd;
+	}
+	else {
+		glm::vec3 inv = 1.0f / rd;
+		float tmin = -1e38f, tmax = 1e38f;
+		int minAxis = 0;
+		for (int xyz = 0; xyz < 3; xyz++) {
+			float t1 = (-0.5f - ro[xyz]) * inv[xyz];
+			float t2 = (+0.5f - ro[xyz]) * inv[xyz];
+			float lo = fminf(t1, t2);
+			float hi = fmaxf(t1, t2);
+			if (lo > tmin) {
+				tmin = lo;
+				minAxis = xyz;
+			}
+			tmax = fminf(tmax, hi);
+		}
+		if (tmax < tmin || tmax < 0.0f) {
+			return;
+		}
+		tObj = tmin > 0.0f ? tmin : tmax;
+		nObj[minAxis] = rd[minAxis] > 0.0f ? -1.0f : 1.0f;
+	}
+
+	// report in world-space t: object and world rays share the parameter
+	// because the direction was transformed unnormalized
+	glm::vec3 n = glm::normalize(glm::mat3(data->invTranspose) * glm::normalize(nObj));
+	optixReportIntersection(tObj, 0,
+		bits(n.x), bits(n.y), bits(n.z));
+}
+
+extern "C" __global__ void __closesthit__primitive() {
+	const OptixHitgroupData* data = hitData();
+	optixSetPayload_0(bits(optixGetRayTmax()));
+	optixSetPayload_1(optixGetAttribute_0());
+	optixSetPayload_2(optixGetAttribute_1());
+	optixSetPayload_3(optixGetAttribute_2());
+	optixSetPayload_4((unsigned int)data->materialid);
+	optixSetPayload_5(bits(data->lightArea));
+}
@@ -1,38 +1,49 @@
+#include <algorithm>
 #include <cstdio>
+#include <map>
+#include <cstring>
 #include <cuda.h>
+#include <cooperative_groups.h>
 #include <cmath>
+#include <chrono>
 #include <thrust/execution_policy.h>
 #include <thrust/random.h>
+#include <thrust/reduce.h>
 #include <thrust/remove.h>
+#include <thrust/scan.h>
 #include <thrust/partition.h>
 #include <thrust/sort.h>
 #include <thrust/device_vector.h>
+#include <thrust/iterator/zip_iterator.h>
+#include <thrust/tuple.h>
 
 #include "sceneStructs.h"
 #include "scene.h"
 #include "glm/glm.hpp"
 #include "glm/gtx/norm.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
 #include "utilities.h"
 #include "pathtrace.h"
 #include "intersections.h"
 #include "interactions.h"
+#include "lbvh.h"
+#include "bvh8.h"
+#include "image.h"
+#include "gbuffer.h"
+#include "pathtraceDisplay.h"
+#include "optixbackend.h"
+#include "nvrtcspec.h"
+#include "nvtx.h"
+#include "../stream_compaction/efficient.h"
+#include "../stream_compaction/emit.h"
 
-#define ERRORCHECK 1
-#define STREAM_COMPACTION 0
-#define SORT_BY_MATERIAL 0
-#define CACHE_ENABLE 0
-#define PROFILE_ENABLE 0
-#define DEPTH_OF_FIELD_ENABLE 0
-#define ANTIALIASING 0
-#define MOTION_BLUR_ENABLE 0
-#define AMBIENT_LIGHT_ENABLE 1
-
-#define FILENAME (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-#define checkCUDAError(msg) checkCUDAErrorFn(msg, FILENAME, __LINE__)
-void checkCUDAErrorFn(const char* msg, const char* file, int line) {
-#if ERRORCHECK
-	cudaDeviceSynchronize();
-	cudaError_t err = cudaGetLastError();
+#include "pathtraceConfig.h"
+
+// best-effort accumulation salvage before a fatal exit; lives with the
+// checkpoint machinery at the end of the file
+static void emergencySave();
+
+static void reportCUDAError(cudaError_t err, const char* msg, const char* file, int line) {
 	if (cudaSuccess == err) {
 		return;
 	}
@@ -42,396 +53,8345 @@ void checkCUDAErrorFn(const char* msg, const char* file, int line) {
 		fprintf(stderr, " (%s:%d)", file, line);
 	}
 	fprintf(stderr, ": %s: %s\n", msg, cudaGetErrorString(err));
+	emergencySave();
 #  ifdef _WIN32
 	getchar();
 #  endif
 	exit(EXIT_FAILURE);
+}
+
+void checkCUDAErrorFn(const char* msg, const char* file, int line) {
+#if ERRORCHECK >= 2
+	cudaDeviceSynchronize();
+#endif
+#if ERRORCHECK
+	reportCUDAError(cudaGetLastError(), msg, file, line);
 #endif
 }
 
-__host__ __device__
-thrust::default_random_engine makeSeededRandomEngine(int iter, int index, int depth) {
-	int h = utilhash((1 << 31) | (depth << 22) | iter) ^ utilhash(index);
-	return thrust::default_random_engine(h);
+// Synchronizing check; called once per iteration so launch errors surface
+// with at most one iteration of latency while the pipeline stays async.
+void checkCUDAErrorSyncFn(const char* msg, const char* file, int line) {
+#if ERRORCHECK
+	reportCUDAError(cudaDeviceSynchronize(), msg, file, line);
+	reportCUDAError(cudaGetLastError(), msg, file, line);
+#endif
 }
 
-//Kernel that writes the image to the OpenGL PBO directly.
-__global__ void sendImageToPBO(uchar4* pbo, glm::ivec2 resolution,
-	int iter, glm::vec3* image) {
-	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
-	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+// Named device-allocation registry. Every cudaMalloc in this file goes
+// through deviceMalloc so that (a) an OOM prints which buffer failed and
+// the full breakdown of what was already resident instead of a bare
+// cudaMalloc error, and (b) pathtraceInit can print where the memory
+// went. Records are keyed by name and updated in place on re-init, which
+// matches how every buffer here is freed and immediately re-allocated.
+struct DeviceAllocRecord {
+	const char* name;
+	size_t bytes;
+};
+static DeviceAllocRecord deviceAllocs[32];
+static int numDeviceAllocs = 0;
 
-	if (x < resolution.x && y < resolution.y) {
-		int index = x + (y * resolution.x);
-		glm::vec3 pix = image[index];
+static void reportDeviceAllocs(FILE* out) {
+	size_t total = 0;
+	for (int i = 0; i < numDeviceAllocs; i++) {
+		fprintf(out, "  %-16s %12.2f MB\n", deviceAllocs[i].name,
+			deviceAllocs[i].bytes / (1024.0 * 1024.0));
+		total += deviceAllocs[i].bytes;
+	}
+	size_t freeBytes = 0, totalBytes = 0;
+	cudaMemGetInfo(&freeBytes, &totalBytes);
+	fprintf(out, "  %-16s %12.2f MB (device: %.0f of %.0f MB free)\n",
+		"total", total / (1024.0 * 1024.0),
+		freeBytes / (1024.0 * 1024.0), totalBytes / (1024.0 * 1024.0));
+}
+
+static void recordDeviceAlloc(const char* name, size_t bytes) {
+	for (int i = 0; i < numDeviceAllocs; i++) {
+		if (strcmp(deviceAllocs[i].name, name) == 0) {
+			deviceAllocs[i].bytes = bytes;
+			return;
+		}
+	}
+	if (numDeviceAllocs < (int)(sizeof(deviceAllocs) / sizeof(deviceAllocs[0]))) {
+		deviceAllocs[numDeviceAllocs].name = name;
+		deviceAllocs[numDeviceAllocs].bytes = bytes;
+		numDeviceAllocs++;
+	}
+}
 
-		glm::ivec3 color;
-		color.x = glm::clamp((int)(pix.x / iter * 255.0), 0, 255);
-		color.y = glm::clamp((int)(pix.y / iter * 255.0), 0, 255);
-		color.z = glm::clamp((int)(pix.z / iter * 255.0), 0, 255);
+static void deviceMallocFailed(const char* name, size_t bytes, cudaError_t err) {
+	fprintf(stderr, "cudaMalloc of %.2f MB for %s failed: %s\n"
+		"resident device buffers at the time:\n",
+		bytes / (1024.0 * 1024.0), name, cudaGetErrorString(err));
+	reportDeviceAllocs(stderr);
+	exit(EXIT_FAILURE);
+}
 
-		// Each thread writes one pixel location in the texture (textel)
-		pbo[index].w = 0;
-		pbo[index].x = color.x;
-		pbo[index].y = color.y;
-		pbo[index].z = color.z;
+static void deviceMalloc(void** ptr, size_t bytes, const char* name) {
+	cudaError_t err = cudaMalloc(ptr, bytes);
+	if (err != cudaSuccess) {
+		deviceMallocFailed(name, bytes, err);
 	}
+	recordDeviceAlloc(name, bytes);
 }
 
-static Scene* hst_scene = NULL;
-static glm::vec3* dev_image = NULL;
-static Geom* dev_geoms = NULL;
-static Material* dev_materials = NULL;
-static PathSegment* dev_paths = NULL;
-static ShadeableIntersection* dev_intersections = NULL;
-static ShadeableIntersection* dev_intersections_cache = NULL;
-static Triangle* dev_triangles = NULL;
-// TODO: static variables for device memory, any extra info you need, etc
-// ...
+// Variant for the geometry pools, which are the buffers that can outgrow
+// VRAM on the largest scenes. When the plain allocation fails, fall back
+// to managed memory marked read-mostly: the driver then keeps a resident
+// working set on the device and streams cold pages from host RAM on
+// demand, so the job renders (slower) instead of dying. cudaFree releases
+// either kind, so the teardown paths stay unchanged.
+static void deviceMallocStreamable(void** ptr, size_t bytes, const char* name) {
+	cudaError_t err = cudaMalloc(ptr, bytes);
+	if (err == cudaSuccess) {
+		recordDeviceAlloc(name, bytes);
+		return;
+	}
+	cudaGetLastError();
+	err = cudaMallocManaged(ptr, bytes);
+	if (err != cudaSuccess) {
+		deviceMallocFailed(name, bytes, err);
+	}
+	int device = 0;
+	cudaGetDevice(&device);
+	cudaMemAdvise(*ptr, bytes, cudaMemAdviseSetReadMostly, device);
+	fprintf(stderr, "%s (%.2f MB) does not fit in device memory; "
+		"falling back to managed pages streamed from host RAM\n",
+		name, bytes / (1024.0 * 1024.0));
+	recordDeviceAlloc(name, bytes);
+}
 
-// variables for profiling
-cudaEvent_t start, stop;
-float totalTime = 0.0;
-bool countStart = true;
+// Chunked, double-buffered upload for the big geometry pools. A plain
+// cudaMemcpy from a pageable std::vector stages through a driver bounce
+// buffer and blocks the host for the whole transfer; instead, memcpy one
+// bounded page-locked chunk while the DMA engine drains the other on a
+// dedicated copy stream. The call returns as soon as the source is staged,
+// so the host-side init work that follows (normal packing, the bounds
+// scan, the geom partition) overlaps the transfers; uploadWait() fences
+// before the first device-side consumer. Pinning is bounded at two chunks
+// regardless of scene size, so multi-hundred-MB pools never get pinned
+// wholesale.
+#define UPLOAD_CHUNK_BYTES (32 << 20)
+static cudaStream_t uploadStream = NULL;
+static char* host_uploadStage[2] = { NULL, NULL };
+static cudaEvent_t uploadStageFree[2] = { NULL, NULL };
+static int uploadStageBuf = 0;
 
-void pathtraceInit(Scene* scene) {
-	hst_scene = scene;
-	const Camera& cam = hst_scene->state.camera;
-	const int pixelcount = cam.resolution.x * cam.resolution.y;
+static void uploadChunked(void* dst, const void* src, size_t bytes)
+{
+	if (bytes == 0) {
+		return;
+	}
+	if (uploadStream == NULL) {
+		cudaStreamCreate(&uploadStream);
+		for (int b = 0; b < 2; b++) {
+			cudaHostAlloc((void**)&host_uploadStage[b], UPLOAD_CHUNK_BYTES, cudaHostAllocDefault);
+			cudaEventCreateWithFlags(&uploadStageFree[b], cudaEventDisableTiming);
+			cudaEventRecord(uploadStageFree[b], uploadStream);
+		}
+	}
+	size_t done = 0;
+	while (done < bytes) {
+		size_t chunk = bytes - done < UPLOAD_CHUNK_BYTES ? bytes - done : UPLOAD_CHUNK_BYTES;
+		cudaEventSynchronize(uploadStageFree[uploadStageBuf]);
+		memcpy(host_uploadStage[uploadStageBuf], (const char*)src + done, chunk);
+		cudaMemcpyAsync((char*)dst + done, host_uploadStage[uploadStageBuf], chunk,
+			cudaMemcpyHostToDevice, uploadStream);
+		cudaEventRecord(uploadStageFree[uploadStageBuf], uploadStream);
+		uploadStageBuf ^= 1;
+		done += chunk;
+	}
+}
 
-	cudaMalloc(&dev_image, pixelcount * sizeof(glm::vec3));
-	cudaMemset(dev_image, 0, pixelcount * sizeof(glm::vec3));
+static void uploadWait()
+{
+	if (uploadStream) {
+		cudaStreamSynchronize(uploadStream);
+	}
+}
 
-	cudaMalloc(&dev_paths, pixelcount * sizeof(PathSegment));
+// build a 1D float4-texel texture object over a linear device buffer;
+// returns 0 for an empty buffer (a scene with no mesh has empty pools)
+static cudaTextureObject_t makeLinearFloat4Tex(const void* devPtr, size_t bytes) {
+	if (devPtr == NULL || bytes == 0) {
+		return 0;
+	}
+	cudaResourceDesc resDesc;
+	memset(&resDesc, 0, sizeof(resDesc));
+	resDesc.resType = cudaResourceTypeLinear;
+	resDesc.res.linear.devPtr = const_cast<void*>(devPtr);
+	resDesc.res.linear.desc = cudaCreateChannelDesc<float4>();
+	resDesc.res.linear.sizeInBytes = bytes;
+	cudaTextureDesc texDesc;
+	memset(&texDesc, 0, sizeof(texDesc));
+	texDesc.readMode = cudaReadModeElementType;
+	cudaTextureObject_t tex = 0;
+	cudaCreateTextureObject(&tex, &resDesc, &texDesc, NULL);
+	return tex;
+}
 
-	cudaMalloc(&dev_geoms, scene->geoms.size() * sizeof(Geom));
-	cudaMemcpy(dev_geoms, scene->geoms.data(), scene->geoms.size() * sizeof(Geom), cudaMemcpyHostToDevice);
+// normal-pool variant: one uint texel per packed entry when the octahedral
+// encoding is on, float4 otherwise
+static cudaTextureObject_t makeLinearNormalTex(const void* devPtr, size_t bytes) {
+#if OCT_NORMALS_ENABLE
+	if (devPtr == NULL || bytes == 0) {
+		return 0;
+	}
+	cudaResourceDesc resDesc;
+	memset(&resDesc, 0, sizeof(resDesc));
+	resDesc.resType = cudaResourceTypeLinear;
+	resDesc.res.linear.devPtr = const_cast<void*>(devPtr);
+	resDesc.res.linear.desc = cudaCreateChannelDesc<unsigned int>();
+	resDesc.res.linear.sizeInBytes = bytes;
+	cudaTextureDesc texDesc;
+	memset(&texDesc, 0, sizeof(texDesc));
+	texDesc.readMode = cudaReadModeElementType;
+	cudaTextureObject_t tex = 0;
+	cudaCreateTextureObject(&tex, &resDesc, &texDesc, NULL);
+	return tex;
+#else
+	return makeLinearFloat4Tex(devPtr, bytes);
+#endif
+}
 
-	cudaMalloc(&dev_triangles, scene->triangles.size() * sizeof(Triangle));
-	cudaMemcpy(dev_triangles, scene->triangles.data(), scene->triangles.size() * sizeof(Triangle), cudaMemcpyHostToDevice);
+#if ALBEDO_TEX_ENABLE
+// 1D float2-texel texture over the linear texcoord pool
+static cudaTextureObject_t makeLinearFloat2Tex(const void* devPtr, size_t bytes) {
+	if (devPtr == NULL || bytes == 0) {
+		return 0;
+	}
+	cudaResourceDesc resDesc;
+	memset(&resDesc, 0, sizeof(resDesc));
+	resDesc.resType = cudaResourceTypeLinear;
+	resDesc.res.linear.devPtr = const_cast<void*>(devPtr);
+	resDesc.res.linear.desc = cudaCreateChannelDesc<float2>();
+	resDesc.res.linear.sizeInBytes = bytes;
+	cudaTextureDesc texDesc;
+	memset(&texDesc, 0, sizeof(texDesc));
+	texDesc.readMode = cudaReadModeElementType;
+	cudaTextureObject_t tex = 0;
+	cudaCreateTextureObject(&tex, &resDesc, &texDesc, NULL);
+	return tex;
+}
 
-	cudaMalloc(&dev_materials, scene->materials.size() * sizeof(Material));
-	cudaMemcpy(dev_materials, scene->materials.data(), scene->materials.size() * sizeof(Material), cudaMemcpyHostToDevice);
+// Upload one RGBA8 image as a mipmapped array plus a bindless texture
+// object: wrap addressing, trilinear filtering across a host-built box
+// chain, and hardware sRGB decode, so applyAlbedo is one tex2DLod. Returns
+// 0 on any allocation failure, which just leaves the material untextured.
+static cudaTextureObject_t makeAlbedoTex(const unsigned char* rgba, int w, int h,
+	cudaMipmappedArray_t& outArray) {
+	int levels = 1;
+	while ((w >> levels) > 0 || (h >> levels) > 0) {
+		levels++;
+	}
+	cudaChannelFormatDesc desc = cudaCreateChannelDesc<uchar4>();
+	outArray = NULL;
+	if (cudaMallocMipmappedArray(&outArray, &desc,
+			make_cudaExtent(w, h, 0), levels) != cudaSuccess) {
+		cudaGetLastError();
+		return 0;
+	}
+	std::vector<unsigned char> level(rgba, rgba + (size_t)4 * w * h);
+	int lw = w;
+	int lh = h;
+	for (int l = 0; l < levels; l++) {
+		cudaArray_t levelArray;
+		cudaGetMipmappedArrayLevel(&levelArray, outArray, l);
+		cudaMemcpy2DToArray(levelArray, 0, 0, level.data(), (size_t)4 * lw,
+			(size_t)4 * lw, lh, cudaMemcpyHostToDevice);
+		if (l + 1 == levels) {
+			break;
+		}
+		// 2x2 box reduction in linear-light would be more correct than in
+		// sRGB bytes, but the difference is below the 8-bit quantization
+		// for the photographic maps this feeds
+		int nw = lw > 1 ? lw / 2 : 1;
+		int nh = lh > 1 ? lh / 2 : 1;
+		std::vector<unsigned char> next((size_t)4 * nw * nh);
+		for (int y = 0; y < nh; y++) {
+			int y0 = glm::min(2 * y, lh - 1);
+			int y1 = glm::min(2 * y + 1, lh - 1);
+			for (int x = 0; x < nw; x++) {
+				int x0 = glm::min(2 * x, lw - 1);
+				int x1 = glm::min(2 * x + 1, lw - 1);
+				for (int c = 0; c < 4; c++) {
+					int sum = level[4 * ((size_t)y0 * lw + x0) + c]
+						+ level[4 * ((size_t)y0 * lw + x1) + c]
+						+ level[4 * ((size_t)y1 * lw + x0) + c]
+						+ level[4 * ((size_t)y1 * lw + x1) + c];
+					next[4 * ((size_t)y * nw + x) + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+		level.swap(next);
+		lw = nw;
+		lh = nh;
+	}
 
-	cudaMalloc(&dev_intersections, pixelcount * sizeof(ShadeableIntersection));
-	cudaMemset(dev_intersections, 0, pixelcount * sizeof(ShadeableIntersection));
+	cudaResourceDesc resDesc;
+	memset(&resDesc, 0, sizeof(resDesc));
+	resDesc.resType = cudaResourceTypeMipmappedArray;
+	resDesc.res.mipmap.mipmap = outArray;
+	cudaTextureDesc texDesc;
+	memset(&texDesc, 0, sizeof(texDesc));
+	texDesc.addressMode[0] = cudaAddressModeWrap;
+	texDesc.addressMode[1] = cudaAddressModeWrap;
+	texDesc.filterMode = cudaFilterModeLinear;
+	texDesc.mipmapFilterMode = cudaFilterModeLinear;
+	texDesc.readMode = cudaReadModeNormalizedFloat;
+	texDesc.normalizedCoords = 1;
+	texDesc.sRGB = 1;
+	texDesc.maxMipmapLevelClamp = (float)(levels - 1);
+	cudaTextureObject_t tex = 0;
+	if (cudaCreateTextureObject(&tex, &resDesc, &texDesc, NULL) != cudaSuccess) {
+		cudaGetLastError();
+		cudaFreeMipmappedArray(outArray);
+		outArray = NULL;
+		return 0;
+	}
+	return tex;
+}
+#endif // ALBEDO_TEX_ENABLE
 
-#if CACHE_ENABLE
-	cudaMalloc(&dev_intersections_cache, pixelcount * sizeof(ShadeableIntersection));
-	cudaMemset(dev_intersections_cache, 0, pixelcount * sizeof(ShadeableIntersection));
-#endif // CACHE_ENABLE
+// Vose's alias method over arbitrary non-negative weights: O(n) build,
+// O(1) draws on the device (pick a slot uniformly, keep it with prob[slot]
+// or take its alias). Shared by the environment map and the light list.
+static void buildAliasTable(const std::vector<float>& weights, double total,
+	std::vector<float>& prob, std::vector<int>& alias) {
+	int n = (int)weights.size();
+	prob.resize(n);
+	alias.resize(n);
+	std::vector<float> scaled(n);
+	std::vector<int> underfull;
+	std::vector<int> overfull;
+	for (int i = 0; i < n; i++) {
+		scaled[i] = total > 0.0 ? (float)(weights[i] / total * n) : 1.0f;
+		(scaled[i] < 1.0f ? underfull : overfull).push_back(i);
+	}
+	while (!underfull.empty() && !overfull.empty()) {
+		int s = underfull.back();
+		underfull.pop_back();
+		int l = overfull.back();
+		overfull.pop_back();
+		prob[s] = scaled[s];
+		alias[s] = l;
+		scaled[l] -= 1.0f - scaled[s];
+		(scaled[l] < 1.0f ? underfull : overfull).push_back(l);
+	}
+	// leftovers in either list have probability 1 up to rounding
+	while (!overfull.empty()) {
+		prob[overfull.back()] = 1.0f;
+		alias[overfull.back()] = overfull.back();
+		overfull.pop_back();
+	}
+	while (!underfull.empty()) {
+		prob[underfull.back()] = 1.0f;
+		alias[underfull.back()] = underfull.back();
+		underfull.pop_back();
+	}
+}
 
-	// TODO: initialize any extra device memeory you need
+__constant__ cudaTextureObject_t c_texMaterials;
 
-	cudaEventCreate(&start);
-	cudaEventCreate(&stop);
+#if SHARED_MATERIALS_ENABLE
+// material palette size after dedup, so the shade kernel's staging loop
+// and its fits-in-shared check agree without an extra kernel argument
+__constant__ int c_numMaterials;
+#endif // SHARED_MATERIALS_ENABLE
 
-	checkCUDAError("pathtraceInit");
+// fetchMaterial unpacks four float4 texels per record, so the struct must
+// stay exactly sixteen floats wide and keep this field order
+static_assert(sizeof(Material) == 16 * sizeof(float),
+	"Material layout changed; update fetchMaterial");
+
+/**
+ * Material table read; rides the texture cache when MATERIAL_TEX_ENABLE is
+ * on, otherwise a plain read-only load through the qualified pointer.
+ */
+__device__ inline Material fetchMaterial(const Material* __restrict__ materials, int id) {
+#if MATERIAL_TEX_ENABLE
+	float4 a = tex1Dfetch<float4>(c_texMaterials, id * 4);
+	float4 b = tex1Dfetch<float4>(c_texMaterials, id * 4 + 1);
+	float4 c = tex1Dfetch<float4>(c_texMaterials, id * 4 + 2);
+	float4 d = tex1Dfetch<float4>(c_texMaterials, id * 4 + 3);
+	Material m;
+	m.color = glm::vec3(a.x, a.y, a.z);
+	m.specular.exponent = a.w;
+	m.specular.color = glm::vec3(b.x, b.y, b.z);
+	m.roughness = b.w;
+	m.hasReflective = c.x;
+	m.hasRefractive = c.y;
+	m.indexOfRefraction = c.z;
+	m.emittance = c.w;
+	// the 64-bit texture handle rides in two bit-cast texel floats
+	m.albedoTex = ((unsigned long long)__float_as_uint(d.y) << 32)
+		| __float_as_uint(d.x);
+	m.albedoMaxLod = d.z;
+	m.albedoTexId = __float_as_int(d.w);
+	return m;
+#else
+	return materials[id];
+#endif // MATERIAL_TEX_ENABLE
 }
 
-void pathtraceFree() {
-	cudaFree(dev_image);  // no-op if dev_image is null
-	cudaFree(dev_paths);
-	cudaFree(dev_geoms);
-	cudaFree(dev_triangles);
-	cudaFree(dev_materials);
-	cudaFree(dev_intersections);
-#if CACHE_ENABLE
-	cudaFree(dev_intersections_cache);
-#endif // CACHE_ENABLE
-	// TODO: clean up any extra device memory you created
+#if ALBEDO_TEX_ENABLE
+// world-to-texel scale of the lod heuristic below: the camera's angular
+// pixel size, uploaded per device at init
+__constant__ float c_albedoLodScale;
 
-	checkCUDAError("pathtraceFree");
+/**
+ * Fold the material's albedo map into its color at uv. The lod comes from
+ * the hit distance alone: footprint ~= t * pixel angle, and with maxLod =
+ * log2(width) that is maxLod + log2(t * scale) texels - assuming roughly
+ * unit UV density per world unit, which holds for our assets; proper ray
+ * differentials are not worth carrying through the SoA for this. The
+ * texture object does sRGB decode and trilinear filtering in hardware.
+ */
+__device__ inline void applyAlbedo(Material& m, glm::vec2 uv, float t) {
+	if (m.albedoTex != 0) {
+		float lod = glm::clamp(m.albedoMaxLod + log2f(fmaxf(t, 1e-6f) * c_albedoLodScale),
+			0.0f, m.albedoMaxLod);
+		float4 texel = tex2DLod<float4>(m.albedoTex, uv.x, uv.y, lod);
+		m.color *= glm::vec3(texel.x, texel.y, texel.z);
+	}
 }
+#else
+__device__ inline void applyAlbedo(Material& m, glm::vec2 uv, float t) {}
+#endif // ALBEDO_TEX_ENABLE
 
-/**
-* Generate PathSegments with rays from the camera through the screen into the
-* scene, which is the first bounce of rays.
-*
-* Antialiasing - add rays for sub-pixel sampling
-* motion blur - jitter rays "in time"
-* lens effect - jitter ray origin positions based on a lens
-*/
-__global__ void generateRayFromCamera(Camera cam, int iter, int traceDepth, PathSegment* pathSegments)
-{
-	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
-	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+// Environment map in the constant bank, like the pool textures: the init
+// block uploads the handle, the dimensions and the alias-table / pdf
+// pointers per device, so no kernel signature carries them. Dimensions of
+// (0, 0) mean the scene has no map and the helpers fall back to the
+// AMBIENT_LIGHT_ENABLE gradient.
+__constant__ cudaTextureObject_t c_texEnvMap;
+__constant__ int2 c_envMapSize;
+__constant__ const float* c_envAliasProb;
+__constant__ const int* c_envAliasIdx;
+// solid-angle pdf of drawing each texel from the alias table
+__constant__ const float* c_envPdf;
+// probability that next event estimation picks the environment technique
+// over the area lights (1 when the scene has no listed lights)
+__constant__ float c_envSelectProb;
+#if PORTAL_SAMPLING_ENABLE
+// environment portals (scene file PORTAL blocks): openings the NEE
+// environment sample targets instead of the whole map. Zero count means
+// the scene marked none and the alias-table draw runs as usual.
+__constant__ Portal c_portals[PORTAL_MAX_COUNT];
+__constant__ int c_numPortals;
+__constant__ float c_portalAreaTotal;
+#endif // PORTAL_SAMPLING_ENABLE
 
-	if (x < cam.resolution.x && y < cam.resolution.y) {
-		int index = x + (y * cam.resolution.x);
-		PathSegment& segment = pathSegments[index];
+#if BLUE_NOISE_ENABLE
+// tiled blue-noise shift mask (BLUE_NOISE_TILE^2 vec2s) and the row pitch
+// for turning a flat pixel index back into coordinates
+__constant__ const glm::vec2* c_blueNoiseMask;
+__constant__ int c_blueNoiseResX;
 
-		segment.ray.origin = cam.position;
-		segment.color = glm::vec3(1.0f, 1.0f, 1.0f);
+// mask texel for a pixel and dimension pair; each pair reads the tile at
+// its own offset so the camera, lens and bounce shifts decorrelate
+static __device__ __forceinline__ glm::vec2 blueNoiseShiftAt(int x, int y, int pair) {
+	x = (x + 17 * pair) & (BLUE_NOISE_TILE - 1);
+	y = (y + 29 * pair) & (BLUE_NOISE_TILE - 1);
+	return c_blueNoiseMask[y * BLUE_NOISE_TILE + x];
+}
 
-		// antialiasing
-#if ANTIALIASING
-		thrust::default_random_engine rng = makeSeededRandomEngine(iter, index, 0);
-		thrust::uniform_real_distribution<float> u01(-0.5, 0.5);
-		// add a small offset
-		x += u01(rng);
-		y += u01(rng);
-#endif
-		segment.ray.direction = glm::normalize(cam.view
-			- cam.right * cam.pixelLength.x * ((float)x - (float)cam.resolution.x * 0.5f)
-			- cam.up * cam.pixelLength.y * ((float)y - (float)cam.resolution.y * 0.5f)
-			);
+// arm the first bounce's 2D sample with the pixel's blue-noise shift
+// during the early window; later bounces and iterations stay untouched
+static __device__ __forceinline__ void blueNoiseShiftBounce(SobolState& sobol, int depth, int pixel) {
+	if (depth == 1 && sobol.index <= (unsigned int)BLUE_NOISE_ITERS) {
+		sobol.shift = blueNoiseShiftAt(pixel % c_blueNoiseResX, pixel / c_blueNoiseResX, 2);
+	}
+}
+#else
+static __device__ __forceinline__ void blueNoiseShiftBounce(SobolState&, int, int) {}
+#endif // BLUE_NOISE_ENABLE
 
-		segment.pixelIndex = index;
-		segment.remainingBounces = traceDepth;
+#if TERMINATE_GATHER_ENABLE
+// accumulation handles mirrored into the constant bank, so the kill sites
+// inside the shading kernels can flush without widening every signature
+__constant__ glm::vec3* c_accumImage;
+__constant__ glm::vec3* c_clampedEnergyBank;
+#if AOV_ENABLE
+// direct-only radiance layer; mirrored like c_accumImage so the deposit
+// sites inside the shading kernels need no extra parameters
+__constant__ glm::vec3* c_aovDirect;
+#endif // AOV_ENABLE
 
-#if DEPTH_OF_FIELD_ENABLE || MOTION_BLUR_ENABLE
-		thrust::default_random_engine rng = makeSeededRandomEngine(iter, index, 0);
-#endif
+// Bank one finished path into the accumulation; mirrors what finalGather
+// used to do per slot (batch averaging, firefly clamp, banked NEE
+// radiance). Each kill site fires exactly once per path per iteration:
+// the guards that flip remainingBounces non-positive are the same ones
+// that stop the path from ever being shaded again.
+static __device__ __forceinline__ void accumulateTerminatedPath(PathSegmentSoA& pathSegments, int idx)
+{
+	glm::vec3 contribution = pathSegments.colors[idx];
+#if DIRECT_LIGHTING_ENABLE
+	contribution += glm::vec3(pathSegments.radiances[idx]);
+#endif // DIRECT_LIGHTING_ENABLE
+#if SPP_BATCH > 1
+	contribution *= 1.0f / (float)SPP_BATCH;
+#endif // SPP_BATCH
+	int pixel = pathSegments.pixelIndices[idx];
+#if FIREFLY_CLAMP_ENABLE
+	float l = glm::dot(contribution, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	if (l > FIREFLY_CLAMP) {
+		glm::vec3 kept = contribution * (FIREFLY_CLAMP / l);
+#if SPP_BATCH > 1
+		glm::vec3 excess = contribution - kept;
+		atomicAdd(&c_clampedEnergyBank[pixel].x, excess.x);
+		atomicAdd(&c_clampedEnergyBank[pixel].y, excess.y);
+		atomicAdd(&c_clampedEnergyBank[pixel].z, excess.z);
+#else
+		c_clampedEnergyBank[pixel] += contribution - kept;
+#endif // SPP_BATCH
+		contribution = kept;
+	}
+#endif // FIREFLY_CLAMP_ENABLE
+#if SPP_BATCH > 1
+	atomicAdd(&c_accumImage[pixel].x, contribution.x);
+	atomicAdd(&c_accumImage[pixel].y, contribution.y);
+	atomicAdd(&c_accumImage[pixel].z, contribution.z);
+#else
+	c_accumImage[pixel] += contribution;
+#endif // SPP_BATCH
+}
+#endif // TERMINATE_GATHER_ENABLE
 
-#if DEPTH_OF_FIELD_ENABLE
-		// depth of field
-		float lensRadius = 0.05f;
-		float focalDistance = 12.0f;
-
-		float p0 = u01(rng);
-		float p1 = u01(rng);
-		// sample a point from lens
-		segment.ray.origin = cam.position + p0 * lensRadius * cam.up + p1 * lensRadius * cam.right;
-		float asp = focalDistance / glm::length(cam.view);
-		segment.ray.direction = cam.view
-			- cam.right * cam.pixelLength.x * ((float)x - (float)cam.resolution.x * 0.5f)
-			- cam.up * cam.pixelLength.y * ((float)y - (float)cam.resolution.y * 0.5f);
-		glm::vec3 target = cam.position + segment.ray.direction * asp;
-		segment.ray.direction = glm::normalize(target - segment.ray.origin);
-#endif
+/**
+ * Radiance arriving from the environment along dir: the equirect texel the
+ * direction maps to, or the procedural gradient (or black) for scenes
+ * without a map. Every escaped-ray site funnels through here.
+ */
+__device__ inline glm::vec3 environmentRadiance(glm::vec3 dir) {
+	dir = glm::normalize(dir);
+	if (c_envMapSize.x == 0) {
+#if AMBIENT_LIGHT_ENABLE
+		float t = 0.5f * (dir.y + 1.0f);
+		return (1.0f - t) * glm::vec3(1.0f, 1.0f, 1.0f) + t * glm::vec3(0.5f, 0.7f, 1.0f);
+#else
+		return glm::vec3(0.0f);
+#endif // AMBIENT_LIGHT_ENABLE
+	}
+	float u = atan2f(dir.z, dir.x) * (0.5f / PI) + 0.5f;
+	float v = acosf(glm::clamp(dir.y, -1.0f, 1.0f)) / PI;
+	int x = glm::min((int)(u * c_envMapSize.x), c_envMapSize.x - 1);
+	int y = glm::min((int)(v * c_envMapSize.y), c_envMapSize.y - 1);
+	float4 texel = tex1Dfetch<float4>(c_texEnvMap, y * c_envMapSize.x + x);
+	return glm::vec3(texel.x, texel.y, texel.z);
+}
 
-#if MOTION_BLUR_ENABLE
-		thrust::uniform_real_distribution<float> u02(0.0f, 1.0f);
-		segment.ray.time = u02(rng);
-#endif
+// Solid-angle pdf of next event estimation drawing dir from the
+// environment, selection probability included; pairs with the draw in
+// sampleEnvironment below.
+__device__ inline float environmentPdf(glm::vec3 dir) {
+	dir = glm::normalize(dir);
+	float u = atan2f(dir.z, dir.x) * (0.5f / PI) + 0.5f;
+	float v = acosf(glm::clamp(dir.y, -1.0f, 1.0f)) / PI;
+	int x = glm::min((int)(u * c_envMapSize.x), c_envMapSize.x - 1);
+	int y = glm::min((int)(v * c_envMapSize.y), c_envMapSize.y - 1);
+	return c_envPdf[y * c_envMapSize.x + x] * c_envSelectProb;
+}
+
+#if PORTAL_SAMPLING_ENABLE
+// Solid-angle pdf of the portal technique drawing dir from origin,
+// selection probability included; pairs with the draw in samplePortal
+// below the way environmentPdf pairs with sampleEnvironment. Zero when
+// the ray passes through no portal - those directions the technique can
+// never draw, so the BSDF sample keeps full weight for them.
+__device__ inline float portalPdf(glm::vec3 origin, glm::vec3 dir) {
+	for (int i = 0; i < c_numPortals; i++) {
+		const Portal& p = c_portals[i];
+		float denom = glm::dot(p.normal, dir);
+		if (fabsf(denom) < 1e-6f) {
+			continue;
+		}
+		float t = glm::dot(p.corner - origin, p.normal) / denom;
+		if (t <= 0.0f) {
+			continue;
+		}
+		glm::vec3 onPlane = origin + t * dir - p.corner;
+		float u = glm::dot(onPlane, p.edgeU) / glm::dot(p.edgeU, p.edgeU);
+		float v = glm::dot(onPlane, p.edgeV) / glm::dot(p.edgeV, p.edgeV);
+		if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f) {
+			continue;
+		}
+		// area-proportional portal selection cancels the per-portal area:
+		// the area-measure pdf is 1 / total area over every opening
+		return t * t / (fabsf(denom) * c_portalAreaTotal) * c_envSelectProb;
 	}
+	return 0.0f;
 }
+#endif // PORTAL_SAMPLING_ENABLE
 
-// TODO:
-// computeIntersections handles generating ray intersections ONLY.
-// Generating new rays is handled in your shader(s).
-// Feel free to modify the code below.
-__global__ void computeIntersections(
-	int depth
-	, int num_paths
-	, PathSegment* pathSegments
-	, Geom* geoms
-	, int geoms_size
-	, ShadeableIntersection* intersections
-	, Triangle* triangles
-	)
-{
-	int path_index = blockIdx.x * blockDim.x + threadIdx.x;
+// Power-heuristic weight for environment radiance found by the BSDF
+// sample, the escaped-ray mirror of emissiveMisWeight: the light sample at
+// the previous hit could have drawn the same direction, so both techniques
+// split the contribution. Full weight for delta bounces and primary rays
+// (prevPdf < 0), for scenes without a map, and with NEE compiled out.
+// The origin only matters with portals in the scene, whose pdf depends on
+// where the escaped ray started.
+__device__ inline float environmentMisWeight(float prevPdf, glm::vec3 origin, glm::vec3 dir) {
+#if DIRECT_LIGHTING_ENABLE
+	if (c_envMapSize.x == 0 || prevPdf < 0.0f) {
+		return 1.0f;
+	}
+#if PORTAL_SAMPLING_ENABLE
+	float pdfEnv = c_numPortals > 0 ? portalPdf(origin, dir) : environmentPdf(dir);
+#else
+	float pdfEnv = environmentPdf(dir);
+#endif // PORTAL_SAMPLING_ENABLE
+	return (prevPdf * prevPdf) / (prevPdf * prevPdf + pdfEnv * pdfEnv);
+#else
+	return 1.0f;
+#endif // DIRECT_LIGHTING_ENABLE
+}
 
-	if (path_index < num_paths)
-	{
-		PathSegment pathSegment = pathSegments[path_index];
+__host__ __device__
+thrust::default_random_engine makeSeededRandomEngine(int iter, int index, int depth) {
+	int h = utilhash((1 << 31) | (depth << 22) | iter) ^ utilhash(index);
+	return thrust::default_random_engine(h);
+}
 
-		float t;
-		glm::vec3 intersect_point;
-		glm::vec3 normal;
-		float t_min = FLT_MAX;
-		int hit_geom_index = -1;
-		bool outside = true;
+// Seed one persistent RNG lane per pixel, once at init. Kernels load their
+// pixel's lane, draw from it and store it back, so the stream advances
+// across bounces and iterations instead of being re-hashed at every use
+// site; indexing by pixel keeps a lane with its path through compaction.
+__global__ void kernInitRNG(int n, int seed, thrust::default_random_engine* states) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < n) {
+		states[i] = makeSeededRandomEngine(seed, i, 0);
+	}
+}
 
-		glm::vec3 tmp_intersect;
-		glm::vec3 tmp_normal;
+// RNG lane for a path slot. One lane per pixel normally; with an SPP
+// batch in flight every slot owns a lane instead, so the samples sharing
+// a pixel never race one engine. Slots never move (compaction is
+// index-based), so either choice keeps a lane with its path.
+static __device__ __forceinline__ int rngLane(int slot, int pixel) {
+#if SPP_BATCH > 1
+	return slot;
+#else
+	return pixel;
+#endif // SPP_BATCH
+}
 
-		// naive parse through global geoms
+#if PATH_REGEN_ENABLE
+// per-pixel sample counter (dev_pixelNextSample) mirrored into the
+// constant bank so bounceSobolState can read it without widening every
+// shading kernel's signature
+__constant__ const int* c_pixelNextSample;
+#endif // PATH_REGEN_ENABLE
+#if SPP_BATCH > 1
+// frame pixel count, for recovering a slot's sample plane (slots are
+// sample-major: sample s of pixel p sits in slot s * pixelcount + p)
+__constant__ int c_pixelcount;
+#endif // SPP_BATCH
 
-		for (int i = 0; i < geoms_size; i++)
-		{
-			Geom& geom = geoms[i];
+// Sobol state for a path slot's bounce dimensions (pairs 3+). The point
+// index must be the pixel's own sample number for the stratification to
+// mean anything: the raygen dimensions already enumerate it (the
+// iteration normally, the per-pixel counter under path regeneration, the
+// virtual iteration number under an SPP batch), and the bounce
+// dimensions follow the same enumeration here. With path regeneration a
+// pixel can finish several samples inside one wavefront iteration, so
+// indexing with iter would hand two of its samples the same Sobol point;
+// with an SPP batch the whole batch walks one shared per-pixel sequence
+// at consecutive indices, making an iteration's samples jointly
+// stratified with every earlier one instead of merely decorrelated.
+static __device__ __forceinline__ SobolState bounceSobolState(int iter, int slot, int pixel, int depth) {
+#if PATH_REGEN_ENABLE
+	SobolState sobol = { (unsigned int)c_pixelNextSample[pixel], sobolSeed(pixel, 3 + depth) };
+#elif SPP_BATCH > 1
+	SobolState sobol = { (unsigned int)((iter - 1) * SPP_BATCH + slot / c_pixelcount + 1),
+		sobolSeed(pixel, 3 + depth) };
+#else
+	SobolState sobol = { (unsigned int)iter, sobolSeed(pixel, 3 + depth) };
+#endif // PATH_REGEN_ENABLE
+	return sobol;
+}
 
-			if (geom.type == CUBE)
-			{
-				t = boxIntersectionTest(geom, pathSegment.ray, tmp_intersect, tmp_normal, outside);
-			}
-			else if (geom.type == SPHERE)
-			{
-				t = sphereIntersectionTest(geom, pathSegment.ray, tmp_intersect, tmp_normal, outside);
-			}
-			else if (geom.type == MESH)
-			{
-				t = meshIntersectionTest(geom, pathSegment.ray, tmp_intersect, tmp_normal, outside, triangles);
-			}
-			// TODO: add more intersection tests here... triangle? metaball? CSG?
 
-			// Compute the minimum t from the intersection tests to determine what
-			// scene geometry object was hit first.
-			if (t > 0.0f && t_min > t)
-			{
-				t_min = t;
-				hit_geom_index = i;
-				intersect_point = tmp_intersect;
-				normal = tmp_normal;
-			}
-		}
+static Scene* hst_scene = NULL;
+// movement-preview downscale factor (1 = full resolution); applied to the
+// traced frame inside pathtraceIteration, see pathtraceSetPreviewScale
+static int previewScale = 1;
+#if ROI_ENABLE
+// look-dev region of interest (pathtraceSetROI): while roiSize is
+// non-zero, iterations trace only this rectangle and the display holds
+// the rest of the frame at the roiBaseIter samples it had when the
+// rectangle was set
+static glm::ivec2 roiOffset(0, 0);
+static glm::ivec2 roiSize(0, 0);
+static int roiBaseIter = 0;
+#endif // ROI_ENABLE
+// --hwtrace: route closest-hit queries through the OptiX backend when its
+// init succeeded (optixbackend.cu); the software kernels stay the fallback
+static bool hwTraceRequested = false;
+static glm::vec3* dev_image = NULL;
+#if AOV_ENABLE
+// AOV accumulations, pixelcount-sized in the arena and normalized by the
+// iteration count at save time like dev_image
+static glm::vec3* dev_aovNormal = NULL;
+static float* dev_aovDepth = NULL;
+static glm::vec3* dev_aovAlbedo = NULL;
+static glm::vec3* dev_aovDirect = NULL;
+#endif // AOV_ENABLE
+static GeomHot* dev_geomsHot = NULL;
+static GeomCold* dev_geomsCold = NULL;
+#if PROXY_BOUNCE_ENABLE
+// deep-bounce proxy table: dev_geomsHot with every compiled-LOD mesh
+// pinned to its coarsest level; NULL when the scene has no LOD chains,
+// which keeps the depth switch in traceOneBounce free
+static GeomHot* dev_geomsHotProxy = NULL;
+#endif // PROXY_BOUNCE_ENABLE
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+// per-tile primary-ray culling: candidate static-geom indices per 8x8
+// screen tile (tile-major, numStaticGeoms stride) and the per-tile
+// counts, rebuilt on the host at every camera change
+static int* dev_tileCullLists = NULL;
+static int* dev_tileCullCounts = NULL;
+// resolution the lists were built for; preview-scaled frames trace a
+// different grid and fall back to the TLAS until the next full-res build
+static int tileCullResX = 0;
+static int tileCullResY = 0;
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+static Material* dev_materials = NULL;
+static PathSegmentSoA dev_paths = {};
+static ShadeableIntersectionSoA dev_intersections = {};
+static ShadeableIntersectionSoA dev_intersections_cache = {};
+#if AA_EDGE_ADAPTIVE_ENABLE
+// per-pixel edge flags from the cached strata (kernBuildAaEdgeMask), the
+// compacted list of flagged pixels the depth-0 re-trace launches over,
+// and the device counter that sizes it
+static int* dev_aaEdgeMask = NULL;
+static int* dev_aaEdgeList = NULL;
+static int* dev_aaEdgeCount = NULL;
+static int numAaEdgePaths = 0;
+__constant__ const int* c_aaEdgeMask;
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+static TriangleIdx* dev_triangles = NULL;
+static glm::vec4* dev_vertices = NULL;
+static PackedNormal* dev_normals = NULL;
+#if ALBEDO_TEX_ENABLE
+static glm::vec2* dev_uvs = NULL;
+// one mipmapped array + bindless object per Scene::textures entry,
+// recreated with the pools at init
+static std::vector<cudaMipmappedArray_t> albedoArrays;
+static std::vector<cudaTextureObject_t> albedoTextures;
+#endif // ALBEDO_TEX_ENABLE
+// texture objects over the pools above and over dev_materials; recreated
+// with their buffers on init, handles mirrored into the __constant__ bank
+static cudaTextureObject_t texVertices = 0;
+static cudaTextureObject_t texNormals = 0;
+#if ALBEDO_TEX_ENABLE
+static cudaTextureObject_t texUvs = 0;
+#endif // ALBEDO_TEX_ENABLE
+static cudaTextureObject_t texMaterials = 0;
+// equirect HDR environment map texels plus the alias table / pdf arrays
+// built over their luminance at init; the texel count doubles as the
+// host-side "this scene has an environment map" flag
+static glm::vec4* dev_envMap = NULL;
+static float* dev_envAliasProb = NULL;
+static glm::vec2* dev_blueNoiseMask = NULL;
+static int* dev_envAliasIdx = NULL;
+static float* dev_envPdf = NULL;
+static cudaTextureObject_t texEnvMap = 0;
+static int envMapTexels = 0;
+static LBVHNode* dev_bvhNodes = NULL;
+static BVH8Node* dev_bvh8Nodes = NULL;
+static LBVHNode* dev_tlasNodes = NULL;
+static int tlasRoot = -1;
+#if GEOM_GRID_ENABLE
+// CSR uniform grid over the static partition, built when the size-spread
+// heuristic fires at init (buildGeomGrid): cellStart is a cells+1 prefix
+// into items, items holds static-geom indices per overlapped cell
+static int* dev_gridCellStart = NULL;
+static int* dev_gridItems = NULL;
+__constant__ glm::ivec3 c_gridDims;
+__constant__ glm::vec3 c_gridMin;
+__constant__ glm::vec3 c_gridCellSize;
+__constant__ glm::vec3 c_gridInvCellSize;
+__constant__ const int* c_gridCellStart;
+__constant__ const int* c_gridItems;
+// 0 keeps every traversal on the TLAS (heuristic declined, or re-init)
+__constant__ int c_gridActive;
+#endif // GEOM_GRID_ENABLE
+static LBVHNode* dev_movingTlasNodes = NULL;
+static int movingTlasRoot = -1;
+// scene->geoms is partitioned at init: [0, numStaticGeoms) is static,
+// [numStaticGeoms, numStaticGeoms + numMovingGeoms) is moving
+static int numStaticGeoms = 0;
+static int numMovingGeoms = 0;
+// per-scene camera-feature mask (CamFeature bits); picks which template
+// instantiation of generateRayFromCamera this render launches
+static unsigned int camFeatures = 0;
+static int* dev_queues = NULL;
+static int* dev_queueCounters = NULL;
+static int* dev_intersectWorkCounter = NULL;
+// two-slot live-path counter the cooperative bounce loop ping-pongs for
+// device-side termination
+static int* dev_coopLiveCounters = NULL;
+static Light* dev_lights = NULL;
+static int numLights = 0;
+// alias table over the light list's power for NEE light selection
+static float* dev_lightAliasProb = NULL;
+static int* dev_lightAliasIdx = NULL;
+#if PHOTON_MAP_ENABLE
+// one stored photon: where it landed, the flux it carried (total over the
+// emitted population; the gather divides by PHOTON_COUNT) and the surface
+// normal there, kept so the lookup can reject photons on back faces and
+// the far side of thin walls
+struct Photon {
+	glm::vec3 position;
+	glm::vec3 power;
+	glm::vec3 normal;
+};
+// photons sorted by hash cell, and per-cell [start, end) offsets into them
+// (PHOTON_HASH_SIZE + 1 entries); built lazily on the first iteration so
+// the scene's device buffers and constants are already in place
+static Photon* dev_photons = NULL;
+static int* dev_photonCellStart = NULL;
+static int numPhotonStores = -1;  // -1: map not built yet
+#endif // PHOTON_MAP_ENABLE
+#if RESTIR_ENABLE
+// Per-pixel reservoir for the first bounce's resampled light sample: the
+// kept candidate (a point on a light), the running weight sum, the target
+// function value of the kept sample at this pixel and the candidate count
+// folded in so far. [0] persists across iterations for temporal reuse;
+// [1] is the scratch frame the spatial pass reads neighbors from.
+struct Reservoir {
+	glm::vec3 lightPoint;
+	glm::vec3 lightNormal;
+	glm::vec3 emittance;
+	float wSum;
+	float targetPdf;
+	int M;
+};
+static Reservoir* dev_reservoirs[2] = { NULL, NULL };
+#endif // RESTIR_ENABLE
+static thrust::default_random_engine* dev_rngStates = NULL;
+// per-pixel energy removed by the firefly clamp
+static glm::vec3* dev_clampedEnergy = NULL;
+// first-bounce guide buffers and ping-pong color buffers for the denoiser
+static glm::vec3* dev_denoiseNormals = NULL;
+static glm::vec3* dev_denoisePositions = NULL;
+static glm::vec3* dev_denoised[2] = { NULL, NULL };
+static glm::vec3* dev_denoisedResult = NULL;
+static int lastDenoisedIter = 0;
+#if HALF_RES_INDIRECT_ENABLE
+// per-iteration quad-resolution indirect contribution, and the slot of
+// each quad's continuing representative (-1: none survived the first
+// bounce)
+static glm::vec3* dev_indirectQuads = NULL;
+static int* dev_quadRep = NULL;
+#endif // HALF_RES_INDIRECT_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+// per-pixel first-bounce hit points (w < 0: miss), the previous view's
+// accumulation, its reprojection into the new view (w: valid flag) and the
+// depth buffer that resolves scatter collisions
+static glm::vec4* dev_reprojPositions = NULL;
+static glm::vec3* dev_prevImage = NULL;
+static glm::vec4* dev_reprojImage = NULL;
+static unsigned int* dev_reprojDepth = NULL;
+// how many samples dev_image held after the last completed iteration,
+// and at what preview scale; the reset uses them to decide whether a
+// reprojection is possible and what to divide by
+static int reprojPrevIter = 0;
+static int reprojPrevScale = 1;
+static bool reprojBlendValid = false;
+#endif // TEMPORAL_REPROJECTION_ENABLE
+// per-pixel convergence tracking for adaptive sampling
+static float* dev_pixelMeans = NULL;
+static float* dev_pixelM2s = NULL;
+static int* dev_pixelSamples = NULL;
+static int* dev_pixelConverged = NULL;
+#if IMPORTANCE_MAP_ENABLE
+// grayscale importance map (scene IMPORTANCE directive) at its source
+// resolution; NULL for scenes without one, which leaves the freeze
+// tolerance uniform
+static float* dev_importance = NULL;
+__constant__ const float* c_importance;
+__constant__ glm::ivec2 c_importanceDims;
+#endif // IMPORTANCE_MAP_ENABLE
+// pixel index -> Morton-ordered path slot for primary ray generation
+static int* dev_pixelToSlot = NULL;
+// Hands thrust the same cached scratch block for every per-bounce call
+// (radix sort needs temporary storage) instead of letting it cudaMalloc /
+// cudaFree on each one, which costs allocator round-trips and potential
+// device syncs mid-iteration. Grown on demand, released in pathtraceFree.
+struct CachedThrustAllocator {
+	typedef char value_type;
+	char* scratch = NULL;
+	size_t capacity = 0;
 
-		if (hit_geom_index == -1)
-		{
-			intersections[path_index].t = -1.0f;
-		}
-		else
-		{
-			//The ray hits something
-			intersections[path_index].t = t_min;
-			intersections[path_index].materialId = geoms[hit_geom_index].materialid;
-			intersections[path_index].surfaceNormal = normal;
-			intersections[path_index].point = intersect_point;
+	char* allocate(std::ptrdiff_t n) {
+		if (capacity < (size_t)n) {
+			cudaFree(scratch);
+			deviceMalloc((void**)&scratch, n, "thrust scratch");
+			capacity = n;
 		}
+		return scratch;
 	}
-}
+	void deallocate(char*, size_t) {
+		// keep the block for the next call
+	}
+	void release() {
+		cudaFree(scratch);
+		scratch = NULL;
+		capacity = 0;
+	}
+};
+static CachedThrustAllocator thrustScratch;
 
-// LOOK: "fake" shader demonstrating what you might do with the info in
-// a ShadeableIntersection, as well as how to use thrust's random number
-// generator. Observe that since the thrust random number generator basically
-// adds "noise" to the iteration, the image should start off noisy and get
-// cleaner as more iterations are computed.
-//
-// Note that this shader does NOT do a BSDF evaluation!
-// Your shaders should handle that - this can allow techniques such as
-// bump mapping.
-__global__ void shadeFakeMaterial(
-	int iter
-	, int num_paths
-	, ShadeableIntersection* shadeableIntersections
-	, PathSegment* pathSegments
-	, Material* materials
-	)
-{
-	int idx = blockIdx.x * blockDim.x + threadIdx.x;
-	if (idx < num_paths)
-	{
-		ShadeableIntersection intersection = shadeableIntersections[idx];
-		if (intersection.t > 0.0f) { // if the intersection exists...
-		  // Set up the RNG
-		  // LOOK: this is how you use thrust's RNG! Please look at
-		  // makeSeededRandomEngine as well.
-			thrust::default_random_engine rng = makeSeededRandomEngine(iter, idx, 0);
-			thrust::uniform_real_distribution<float> u01(0, 1);
+// live-slot indirection for the bounce kernels: NULL means identity
+// (depth 0, or compaction disabled); after each compaction it points at
+// the ping-pong buffer holding the surviving slot order
+static const int* dev_activePaths = NULL;
+#if STREAM_COMPACTION
+static int* dev_pathIndices[2] = { NULL, NULL };
+static int activePathBuf = 0;
+// live-count readback lands here (page-locked so the copy is truly async);
+// the event marks when the value is safe to read
+static int* host_pathCount = NULL;
+static cudaEvent_t pathCountEvent = NULL;
+#if FUSED_COMPACT_ENABLE
+// append counter for the shading kernel's survivor emission
+static int* dev_survivorCount = NULL;
+#endif // FUSED_COMPACT_ENABLE
+#endif // STREAM_COMPACTION
+#if PATH_REGEN_ENABLE
+// per-pixel sample accounting for path regeneration: the index of the
+// sample most recently started, and how many have been flushed to dev_image
+static int* dev_pixelNextSample = NULL;
+static int* dev_pixelDoneSamples = NULL;
+#endif // PATH_REGEN_ENABLE
+#if RAY_SORT_ENABLE
+// per-bounce coherence sort scratch: 32-bit keys and the index order the
+// intersection kernels consume
+static unsigned int* dev_raySortKeys = NULL;
+static int* dev_raySortIndices = NULL;
+// ping-pong and digit-count scratch for StreamCompaction::sortPairs, carved
+// from the arena so per-bounce sorts allocate nothing
+static void* dev_raySortScratch = NULL;
+#endif // RAY_SORT_ENABLE
+// one queued NEE visibility test; appended across every bounce of an
+// iteration and traced in one sorted any-hit batch before the gather
+// (DEFERRED_SHADOW_ENABLE; declared unconditionally so sampleDirectLight
+// can carry the out-parameter either way)
+struct ShadowJob {
+	glm::vec3 origin;
+	glm::vec3 direction;
+	float maxT;              // FLT_MAX for environment samples
+	float time;
+	glm::vec3 contribution;  // throughput-weighted; deposited if unoccluded
+	int pixel;
+};
+#if DEFERRED_SHADOW_ENABLE
+static ShadowJob* dev_shadowQueue = NULL;
+static int* dev_shadowQueueCount = NULL;
+static int shadowQueueCapacity = 0;
+// coherence-sort scratch for the batch, mirroring the bounce-ray sort's
+static unsigned int* dev_shadowSortKeys = NULL;
+static int* dev_shadowSortIndices = NULL;
+static void* dev_shadowSortScratch = NULL;
+#endif // DEFERRED_SHADOW_ENABLE
+#if RAY_SORT_ENABLE || PATH_GUIDING_ENABLE || DEFERRED_SHADOW_ENABLE
+// scene AABB, quantizing ray origins into sort cells and positions into
+// guiding cells
+static glm::vec3 sceneBoundsMin;
+static glm::vec3 sceneBoundsInvExtent;
+#endif // RAY_SORT_ENABLE || PATH_GUIDING_ENABLE || DEFERRED_SHADOW_ENABLE
+#if PATH_GUIDING_ENABLE
+// learned incident-flux histograms, GUIDE_NUM_CELLS * GUIDE_DIR_BINS
+// floats each: `flux` is the frozen distribution the current iteration
+// samples from, `accum` collects this iteration's deposits, and
+// kernGuideDecay folds accum into flux between iterations. cellFlux
+// caches each cell's bin sum so sampling skips a 64-wide reduction.
+static float* dev_guideFlux = NULL;
+static float* dev_guideAccum = NULL;
+static float* dev_guideCellFlux = NULL;
+#endif // PATH_GUIDING_ENABLE
+// TODO: static variables for device memory, any extra info you need, etc
+// ...
 
-			Material material = materials[intersection.materialId];
-			glm::vec3 materialColor = material.color;
+// material classes used to bin paths for wavefront shading
+enum MaterialQueue {
+	QUEUE_DIFFUSE,
+	QUEUE_SPECULAR,
+	QUEUE_REFRACTIVE,
+	QUEUE_EMISSIVE,
+	QUEUE_MISS,
+	QUEUE_COUNT
+};
 
-			// If the material indicates that the object was a light, "light" the ray
-			if (material.emittance > 0.0f) {
-				pathSegments[idx].color *= (materialColor * material.emittance);
-			}
-			// Otherwise, do some pseudo-lighting computation. This is actually more
-			// like what you would expect from shading in a rasterizer like OpenGL.
-			// TODO: replace this! you should be able to start with basically a one-liner
-			else {
-				//float lightTerm = glm::dot(intersection.surfaceNormal, glm::vec3(0.0f, 1.0f, 0.0f));
-				//pathSegments[idx].color *= (materialColor * lightTerm) * 0.3f + ((1.0f - intersection.t * 0.02f) * materialColor) * 0.7f;
-				//pathSegments[idx].color *= u01(rng); // apply some noise because why not
+// Tuned 1D block sizes for the three kernel classes whose register
+// pressure actually differs: BVH traversal, shading and the per-pixel
+// gather/statistics passes. The 128 defaults hold until pathtraceInit
+// asks the occupancy calculator (and overlays launchconfig.txt when a
+// --tune sweep recorded winners for this GPU model); utility kernels
+// that are bandwidth-bound either way stay on blockSize1d.
+#if HEATMAP_ENABLE
+// per-pixel accumulated live-bounce counts, and whether the display shows
+// them instead of the image (toggled from the UI at runtime)
+static int* dev_pixelBounceDepth = NULL;
+static bool heatmapView = false;
+#endif // HEATMAP_ENABLE
+// layout-preview integrator (pathtraceToggleLayoutPreview, L key in the
+// viewer): cap the walk at one bounce so an iteration costs primary hit
+// plus the NEE direct sample, with a flat ambient standing in for the
+// skipped indirect transport. The host flag clamps the trace depth; the
+// constant-bank mirror tells the termination shading to add the ambient.
+static bool layoutPreview = false;
+__constant__ int c_layoutPreview;
+#if PIXEL_PROBE_ENABLE
+// one bounce of the probed pixel's path (pathtraceProbePixel): the shade
+// kernel fills slot depth-1 when the path's pixel matches c_probePixel,
+// and the host prints the trace-depth-sized array after the iteration
+struct ProbeRecord {
+	glm::vec3 throughput;    // path color after this bounce's shade
+	glm::vec3 direction;     // outgoing direction (incoming one for terminations)
+	float t;                 // hit distance; < 0 for an environment miss
+	float pdf;               // bsdf pdf of the scatter; 0 at terminations
+	int materialId;          // -1 for an environment miss
+	int event;               // ProbeEvent; PROBE_NONE marks unwritten slots
+};
+enum ProbeEvent {
+	PROBE_NONE = 0,
+	PROBE_SCATTERED,         // bounced on; throughput carries the new weight
+	PROBE_EMISSIVE_HIT,      // hit a light; throughput is the banked radiance
+	PROBE_ENV_MISS,          // escaped; throughput is the banked radiance
+	PROBE_TERMINATED,        // roulette or depth killed the path here
+};
+static ProbeRecord* dev_probeRecords = NULL;
+// armed pixel for the next full-resolution iteration; -1 between captures
+static int probePixel = -1;
+static int probeX = 0;
+static int probeY = 0;
+__constant__ ProbeRecord* c_probeRecords;
+__constant__ int c_probePixel;
+#endif // PIXEL_PROBE_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+// per-tile, per-termination-depth luminance sums, and the per-tile depth
+// budgets distilled from them at the top of each iteration
+static float* dev_tileDepthLum = NULL;
+static int* dev_tileDepthBudget = NULL;
+static int numDepthTiles = 0;
+#endif // ADAPTIVE_DEPTH_ENABLE
 
-				scatterRay(pathSegments[idx], intersection.point, intersection.surfaceNormal, material, rng);
-			}
-			// If there was no intersection, color the ray black.
-			// Lots of renderers use 4 channel color, RGBA, where A = alpha, often
-			// used for opacity, in which case they can indicate "no opacity".
-			// This can be useful for post-processing and image compositing.
-		}
-		else {
-			pathSegments[idx].color = glm::vec3(0.0f);
-		}
-	}
-}
+static int blockSizeIntersect = 128;
+static int blockSizeShade = 128;
+static int blockSizeGather = 128;
+static void tuneLaunchSizes();
 
-__global__ void shadeBSDFMaterial(
-	int iter
-	, int num_paths
-	, ShadeableIntersection* shadeableIntersections
-	, PathSegment* pathSegments
-	, Material* materials
-	)
-{
-	int idx = blockIdx.x * blockDim.x + threadIdx.x;
-	if (idx < num_paths)
-	{
-		ShadeableIntersection intersection = shadeableIntersections[idx];
-		if (pathSegments[idx].remainingBounces <= 0) {
-			return;
-		}
-		if (intersection.t > 0.0f) { // if the intersection exists...
+// named streams: path tracing kernels run on computeStream; the display kernel
+// runs on displayStream gated by an event, so it can drain while the host
+// already issues the next iteration's work
+static cudaStream_t computeStream = NULL;
+static cudaStream_t displayStream = NULL;
+static cudaEvent_t gatherDone = NULL;
+// pinned staging for image readback: the device-to-host copy runs async on
+// computeStream and the event marks when the staged pixels are valid
+static glm::vec3* host_imageStage = NULL;
+// salvage bookkeeping for emergencySave: the newest iteration whose gather
+// is known complete, the count riding the in-flight download, and the
+// count behind the host-side snapshot in RenderState::image (0 until the
+// first download lands)
+static int lastCompletedIter = 0;
+static int imageStageIter = 0;
+static int hostSnapshotIter = 0;
+static cudaEvent_t imageStageDone = NULL;
+static cudaGraphExec_t iterationGraphExec = NULL;
 
-			thrust::default_random_engine rng = makeSeededRandomEngine(iter, idx, pathSegments[idx].remainingBounces);
+#if GBUFFER_ENABLE
+// mapped G-buffer readback buffers, handed over per frame by runCuda
+static glm::vec4* dev_gbufferPositions = NULL;
+static glm::vec4* dev_gbufferNormals = NULL;
 
-			Material material = materials[intersection.materialId];
-			glm::vec3 materialColor = material.color;
+void pathtraceSetGBuffer(glm::vec4* positions, glm::vec4* normals) {
+	dev_gbufferPositions = positions;
+	dev_gbufferNormals = normals;
+}
+#endif // GBUFFER_ENABLE
+
+// Per-stage GPU timing: every pipeline stage records an event pair on its
+// stream, keyed by bounce where that applies, and the elapsed times are
+// folded into per-(stage, bounce) rolling windows once per iteration.
+// pathtraceProfileReport prints mean/p95/last over the window on demand
+// (P key in the preview). Gated at runtime by profileActive (default
+// PROFILE_ENABLE) so --benchmark can switch it on without a rebuild; the
+// per-stage records cost a few microseconds of host time each when on and
+// one branch when off. Events are created lazily and kept for the life
+// of the process, so re-entrant pathtraceInit never re-creates them.
+// Meaningless combined with CUDA_GRAPH_ENABLE (the records would be
+// captured into the graph) or MULTI_GPU_ENABLE (one slot table, many
+// devices).
+static bool profileActive = PROFILE_ENABLE != 0;
+
+enum ProfileStage {
+	PROF_RAYGEN,
+	PROF_INTERSECT,
+	PROF_SORT,
+	PROF_SHADE,
+	PROF_COMPACT,
+	PROF_GATHER,
+	PROF_PBO,
+	PROF_STAGE_COUNT
+};
+static const char* profileStageNames[PROF_STAGE_COUNT] = {
+	"raygen", "intersect", "sort", "shade", "compact", "gather", "pbo"
+};
+#define PROFILE_MAX_BOUNCES 32
+#define PROFILE_WINDOW 256
+struct ProfileSlot {
+	cudaEvent_t begin;
+	cudaEvent_t end;
+	bool open;    // begin recorded this iteration
+	bool closed;  // end recorded this iteration
+};
+static ProfileSlot profileSlots[PROF_STAGE_COUNT][PROFILE_MAX_BOUNCES];
+// ring of the most recent elapsed times per (stage, bounce); mean and p95
+// come from a sorted copy at report time, so recording stays O(1)
+struct ProfileSeries {
+	float window[PROFILE_WINDOW];
+	int count;
+};
+static ProfileSeries profileSeries[PROF_STAGE_COUNT][PROFILE_MAX_BOUNCES];
+static int profileOpenBounce[PROF_STAGE_COUNT];
+// live-path accounting per bounce, for the benchmark's paths-alive
+// histogram and rays/sec; sums what the launch grid actually saw
+static long long profilePathsAliveSum[PROFILE_MAX_BOUNCES];
+static long long profilePathsAliveIters[PROFILE_MAX_BOUNCES];
+
+static void profileStageBegin(ProfileStage stage, int bounce, cudaStream_t stream) {
+	if (bounce >= PROFILE_MAX_BOUNCES) {
+		bounce = PROFILE_MAX_BOUNCES - 1;
+	}
+	ProfileSlot& slot = profileSlots[stage][bounce];
+	if (slot.begin == NULL) {
+		cudaEventCreate(&slot.begin);
+		cudaEventCreate(&slot.end);
+	}
+	cudaEventRecord(slot.begin, stream);
+	slot.open = true;
+	profileOpenBounce[stage] = bounce;
+}
+
+static void profileStageEnd(ProfileStage stage, cudaStream_t stream) {
+	ProfileSlot& slot = profileSlots[stage][profileOpenBounce[stage]];
+	cudaEventRecord(slot.end, stream);
+	slot.closed = true;
+}
+
+// timeline capture hook, defined with the trace exporter below
+static void traceRecordGpuSpan(int stage, int bounce, cudaEvent_t begin, float ms);
+
+// Fold every pair recorded this iteration into its series. Runs once per
+// pathtrace() call; the per-slot event sync only waits on work that the
+// iteration has already enqueued.
+static void profileCollect() {
+	for (int st = 0; st < PROF_STAGE_COUNT; st++) {
+		for (int b = 0; b < PROFILE_MAX_BOUNCES; b++) {
+			ProfileSlot& slot = profileSlots[st][b];
+			bool complete = slot.open && slot.closed;
+			slot.open = slot.closed = false;
+			if (!complete) {
+				continue;
+			}
+			cudaEventSynchronize(slot.end);
+			float ms = 0.0f;
+			cudaEventElapsedTime(&ms, slot.begin, slot.end);
+			ProfileSeries& series = profileSeries[st][b];
+			series.window[series.count % PROFILE_WINDOW] = ms;
+			series.count++;
+			traceRecordGpuSpan(st, b, slot.begin, ms);
+		}
+	}
+}
+#define PROFILE_BEGIN(stage, bounce, stream) \
+	if (profileActive) profileStageBegin(stage, bounce, stream)
+#define PROFILE_END(stage, stream) \
+	if (profileActive) profileStageEnd(stage, stream)
+
+// mean/p95 over the most recent window of one series
+static void profileSeriesStats(const ProfileSeries& series,
+	float* mean, float* p95) {
+	int n = series.count < PROFILE_WINDOW ? series.count : PROFILE_WINDOW;
+	float sorted[PROFILE_WINDOW];
+	float sum = 0.0f;
+	for (int i = 0; i < n; i++) {
+		sorted[i] = series.window[i];
+		sum += sorted[i];
+	}
+	std::sort(sorted, sorted + n);
+	*mean = sum / n;
+	*p95 = sorted[(int)(0.95f * (n - 1))];
+}
+
+void pathtraceProfileSetActive(bool active) {
+	profileActive = active;
+}
+
+int pathtraceProfileSnapshot(ProfileStageStats* out, int maxEntries) {
+	int written = 0;
+	for (int st = 0; st < PROF_STAGE_COUNT; st++) {
+		for (int b = 0; b < PROFILE_MAX_BOUNCES; b++) {
+			const ProfileSeries& series = profileSeries[st][b];
+			if (series.count == 0 || written >= maxEntries) {
+				continue;
+			}
+			ProfileStageStats& e = out[written++];
+			e.stage = profileStageNames[st];
+			e.bounce = b;
+			e.samples = series.count;
+			profileSeriesStats(series, &e.meanMs, &e.p95Ms);
+		}
+	}
+	return written;
+}
+
+// ---- Chrome-tracing timeline export (pathtraceTraceBegin/End) -----------
+// The rolling aggregates above answer "which stage is slow"; the trace
+// answers "what does an iteration actually look like". While recording,
+// every stage's event pair becomes one complete span on a GPU track,
+// host brackets (pathtrace() here, runCuda in main.cpp) land on a host
+// track, and the gaps between them are visible. pathtraceTraceEnd writes
+// Trace Event Format JSON for chrome://tracing or Perfetto, so a "this
+// scene got slow" farm ticket can carry a timeline without anyone
+// running Nsight on the node. GPU timestamps are cudaEventElapsedTime
+// against an epoch event synchronized with the host clock when recording
+// starts, so the tracks line up to within event-sync jitter. Shares the
+// profiler's caveats: meaningless with CUDA_GRAPH_ENABLE or
+// MULTI_GPU_ENABLE (one slot table, many devices).
+
+struct TraceEvent {
+	char name[64];
+	int tid;     // 0 = host, 1 = GPU
+	int bounce;  // -1 for host spans
+	double tsUs;
+	double durUs;
+};
+// cap on retained spans so an overnight render cannot eat the host; the
+// writer reports how many were dropped
+#define TRACE_MAX_EVENTS (1 << 22)
+static bool traceActive = false;
+static bool traceProfileWasActive = false;
+static bool traceEpochRecorded = false;
+static std::string tracePath;
+static std::vector<TraceEvent> traceEvents;
+static long long traceDroppedEvents = 0;
+static cudaEvent_t traceEpoch = NULL;
+static std::chrono::steady_clock::time_point traceEpochHost;
+// GPU-epoch offset on the host timeline (see traceRecordEpoch)
+static double traceGpuSkewUs = 0.0;
+// host spans nest (runCuda around pathtrace); slots beyond the stack
+// only count depth so the pairs still match
+static TraceEvent traceHostStack[8];
+static int traceHostDepth = 0;
+
+static double traceNowUs() {
+	return std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - traceEpochHost).count();
+}
+
+static void tracePushEvent(const TraceEvent& e) {
+	if ((long long)traceEvents.size() >= TRACE_MAX_EVENTS) {
+		traceDroppedEvents++;
+		return;
+	}
+	traceEvents.push_back(e);
+}
+
+// the GPU epoch cannot be recorded in pathtraceTraceBegin - the streams
+// may not exist yet - so the first traced pathtrace() call plants it
+static void traceRecordEpoch() {
+	if (traceEpoch == NULL) {
+		cudaEventCreate(&traceEpoch);
+	}
+	cudaEventRecord(traceEpoch, computeStream);
+	cudaEventSynchronize(traceEpoch);
+	traceGpuSkewUs = traceNowUs();
+	traceEpochRecorded = true;
+}
+
+// one complete GPU span per (stage, bounce) pair profileCollect folded;
+// only the stage has to be bounce-keyed because bounce-less stages run
+// once per iteration, so per-occurrence timestamps stay distinct
+static void traceRecordGpuSpan(int stage, int bounce, cudaEvent_t begin, float ms) {
+	if (!traceActive || !traceEpochRecorded) {
+		return;
+	}
+	float startMs = 0.0f;
+	cudaEventElapsedTime(&startMs, traceEpoch, begin);
+	TraceEvent e;
+	snprintf(e.name, sizeof(e.name), "%s", profileStageNames[stage]);
+	e.tid = 1;
+	e.bounce = bounce;
+	e.tsUs = traceGpuSkewUs + 1000.0 * startMs;
+	e.durUs = 1000.0 * ms;
+	tracePushEvent(e);
+}
+
+void pathtraceTraceBegin(const char* path) {
+	tracePath = path;
+	traceEvents.clear();
+	traceEvents.reserve(1 << 16);
+	traceDroppedEvents = 0;
+	traceHostDepth = 0;
+	traceEpochHost = std::chrono::steady_clock::now();
+	traceEpochRecorded = false;
+	// the spans come from the profiler's event pairs, so recording forces
+	// them on; pathtraceTraceEnd restores the previous setting
+	traceProfileWasActive = profileActive;
+	profileActive = true;
+	traceActive = true;
+	printf("trace: recording timeline to %s\n", path);
+}
+
+void pathtraceTraceHostBegin(const char* name) {
+	if (!traceActive) {
+		return;
+	}
+	traceHostDepth++;
+	if (traceHostDepth > (int)(sizeof(traceHostStack) / sizeof(traceHostStack[0]))) {
+		return;
+	}
+	TraceEvent& e = traceHostStack[traceHostDepth - 1];
+	snprintf(e.name, sizeof(e.name), "%s", name);
+	e.tid = 0;
+	e.bounce = -1;
+	e.tsUs = traceNowUs();
+}
+
+void pathtraceTraceHostEnd() {
+	if (!traceActive || traceHostDepth == 0) {
+		return;
+	}
+	if (traceHostDepth <= (int)(sizeof(traceHostStack) / sizeof(traceHostStack[0]))) {
+		TraceEvent e = traceHostStack[traceHostDepth - 1];
+		e.durUs = traceNowUs() - e.tsUs;
+		tracePushEvent(e);
+	}
+	traceHostDepth--;
+}
+
+void pathtraceTraceEnd() {
+	if (!traceActive) {
+		return;
+	}
+	traceActive = false;
+	profileActive = traceProfileWasActive;
+	FILE* f = fopen(tracePath.c_str(), "w");
+	if (f == NULL) {
+		printf("trace: cannot write %s\n", tracePath.c_str());
+		return;
+	}
+	// every name written here is a fixed stage label or a host bracket
+	// name from main.cpp, so no JSON escaping is needed
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+		"\"args\":{\"name\":\"pathtracer\"}},\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+		"\"args\":{\"name\":\"host\"}},\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,"
+		"\"args\":{\"name\":\"gpu\"}}");
+	for (size_t i = 0; i < traceEvents.size(); i++) {
+		const TraceEvent& e = traceEvents[i];
+		fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+			"\"ts\":%.3f,\"dur\":%.3f", e.name, e.tid, e.tsUs, e.durUs);
+		if (e.bounce >= 0) {
+			fprintf(f, ",\"args\":{\"bounce\":%d}", e.bounce);
+		}
+		fprintf(f, "}");
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	printf("trace: wrote %d spans to %s", (int)traceEvents.size(), tracePath.c_str());
+	if (traceDroppedEvents > 0) {
+		printf(" (%lld dropped past the %d-span cap)",
+			traceDroppedEvents, TRACE_MAX_EVENTS);
+	}
+	printf("\n");
+	traceEvents.clear();
+}
+
+// ---- clock64 in-kernel sampling profiler (KERNEL_PROFILE_ENABLE) --------
+// The per-stage event timing above says which kernel is slow; these
+// counters say where the time goes inside it. Labeled regions bracket the
+// hot spots with clock64 and accumulate cycles and visit counts into
+// device totals. Only each warp's first active lane samples - the leader's
+// elapsed clocks stand in for the warp, one atomic per region visit - so
+// the instrumentation stays cheap enough to leave on for a whole
+// benchmark run. Shares of the sampled cycle total are the meaningful
+// output; absolute cycles include memory stalls the leader happened to
+// wait out.
+#if KERNEL_PROFILE_ENABLE
+enum KprofRegion {
+	KPROF_BOX,
+	KPROF_SPHERE,
+	KPROF_MESH,
+	KPROF_PLANE,
+	KPROF_SHADE_FETCH,
+	KPROF_SHADE_SCATTER,
+	KPROF_REGION_COUNT
+};
+static const char* kprofRegionNames[KPROF_REGION_COUNT] = {
+	"isect_box", "isect_sphere", "isect_mesh", "isect_plane",
+	"shade_fetch", "shade_scatter",
+};
+__device__ unsigned long long d_kprofCycles[KPROF_REGION_COUNT];
+__device__ unsigned long long d_kprofVisits[KPROF_REGION_COUNT];
+
+#define KPROF_CLOCK(var) long long var = clock64()
+#define KPROF_REGION(region, var) \
+	do { \
+		unsigned kprofMask = __activemask(); \
+		if ((threadIdx.x & 31) == __ffs(kprofMask) - 1) { \
+			atomicAdd(&d_kprofCycles[region], (unsigned long long)(clock64() - (var))); \
+			atomicAdd(&d_kprofVisits[region], 1ULL); \
+		} \
+	} while (0)
+#else
+#define KPROF_CLOCK(var) ((void)0)
+#define KPROF_REGION(region, var) ((void)0)
+#endif // KERNEL_PROFILE_ENABLE
+
+int pathtraceKernelProfileSnapshot(KernelRegionStats* out, int maxEntries) {
+#if KERNEL_PROFILE_ENABLE
+	unsigned long long cycles[KPROF_REGION_COUNT];
+	unsigned long long visits[KPROF_REGION_COUNT];
+	cudaMemcpyFromSymbol(cycles, d_kprofCycles, sizeof(cycles));
+	cudaMemcpyFromSymbol(visits, d_kprofVisits, sizeof(visits));
+	double total = 0.0;
+	for (int i = 0; i < KPROF_REGION_COUNT; i++) {
+		total += (double)cycles[i];
+	}
+	int written = 0;
+	for (int i = 0; i < KPROF_REGION_COUNT && written < maxEntries; i++) {
+		if (visits[i] == 0) {
+			continue;
+		}
+		KernelRegionStats& e = out[written++];
+		e.region = kprofRegionNames[i];
+		e.visits = (double)visits[i];
+		e.cycles = (double)cycles[i];
+		e.share = total > 0.0 ? (double)cycles[i] / total : 0.0;
+	}
+	return written;
+#else
+	(void)out;
+	(void)maxEntries;
+	return 0;
+#endif // KERNEL_PROFILE_ENABLE
+}
+
+double pathtracePathsAlivePerBounce(int bounce) {
+	if (bounce < 0 || bounce >= PROFILE_MAX_BOUNCES
+		|| profilePathsAliveIters[bounce] == 0) {
+		return 0.0;
+	}
+	return (double)profilePathsAliveSum[bounce]
+		/ (double)profilePathsAliveIters[bounce];
+}
+
+void pathtraceProfileReport() {
+	printf("%-10s %6s %8s %10s %10s %10s\n",
+		"stage", "bounce", "samples", "mean ms", "p95 ms", "last ms");
+	for (int st = 0; st < PROF_STAGE_COUNT; st++) {
+		for (int b = 0; b < PROFILE_MAX_BOUNCES; b++) {
+			const ProfileSeries& series = profileSeries[st][b];
+			if (series.count == 0) {
+				continue;
+			}
+			float mean, p95;
+			profileSeriesStats(series, &mean, &p95);
+			printf("%-10s %6d %8d %10.4f %10.4f %10.4f\n",
+				profileStageNames[st], b, series.count, mean, p95,
+				series.window[(series.count - 1) % PROFILE_WINDOW]);
+		}
+	}
+}
+
+// One line of feature toggles, so a benchmark record pins down which
+// pipeline it measured. Keep in sync with the define block above.
+const char* pathtraceBuildConfig() {
+	return "compaction=" TOSTR(STREAM_COMPACTION)
+		" fusedcompact=" TOSTR(FUSED_COMPACT_ENABLE)
+		" wavefront=" TOSTR(WAVEFRONT_ENABLE)
+		" megakernel=" TOSTR(MEGAKERNEL_ENABLE)
+		" coop=" TOSTR(COOP_LAUNCH_ENABLE)
+		" sppbatch=" TOSTR(SPP_BATCH)
+		" bluenoise=" TOSTR(BLUE_NOISE_ENABLE)
+		" lowtp=" TOSTR(LOW_THROUGHPUT_SHADING)
+		" termgather=" TOSTR(TERMINATE_GATHER_ENABLE)
+		" tonemap=" TOSTR(TONEMAP_ENABLE)
+		" pathregen=" TOSTR(PATH_REGEN_ENABLE)
+		" raysort=" TOSTR(RAY_SORT_ENABLE)
+		" sharedmat=" TOSTR(SHARED_MATERIALS_ENABLE)
+		" fusedprimary=" TOSTR(FUSED_PRIMARY_ENABLE)
+		" tilecull=" TOSTR(TILE_CULL_ENABLE)
+		" proxybounce=" TOSTR(PROXY_BOUNCE_ENABLE)
+		" geomgrid=" TOSTR(GEOM_GRID_ENABLE)
+		" lbvh=" TOSTR(LBVH_ENABLE)
+		" bvh8=" TOSTR(BVH8_ENABLE)
+		" tlas=" TOSTR(TLAS_ENABLE)
+		" nee=" TOSTR(DIRECT_LIGHTING_ENABLE)
+		" defershadow=" TOSTR(DEFERRED_SHADOW_ENABLE)
+		" probe=" TOSTR(PIXEL_PROBE_ENABLE)
+		" portal=" TOSTR(PORTAL_SAMPLING_ENABLE)
+		" restir=" TOSTR(RESTIR_ENABLE)
+		" bdpt=" TOSTR(BDPT_ENABLE)
+		" photon=" TOSTR(PHOTON_MAP_ENABLE)
+		" halfcolor=" TOSTR(HALF_COLOR_ENABLE)
+		" reproj=" TOSTR(TEMPORAL_REPROJECTION_ENABLE)
+		" optix=" TOSTR(OPTIX_BACKEND_ENABLE)
+		" nvrtcspec=" TOSTR(NVRTC_SPEC_ENABLE)
+		" kprof=" TOSTR(KERNEL_PROFILE_ENABLE)
+		" sobol=" TOSTR(SOBOL_ENABLE)
+		" adaptive=" TOSTR(ADAPTIVE_SAMPLING)
+		" impmap=" TOSTR(IMPORTANCE_MAP_ENABLE)
+		" aaedge=" TOSTR(AA_EDGE_ADAPTIVE_ENABLE)
+		" matdepth=" TOSTR(MATERIAL_DEPTH_BUDGET_ENABLE)
+		" denoise=" TOSTR(DENOISE_ENABLE)
+		" pooltex=" TOSTR(POOL_TEX_ENABLE)
+		" octnormals=" TOSTR(OCT_NORMALS_ENABLE)
+		" mattex=" TOSTR(MATERIAL_TEX_ENABLE)
+		" albedotex=" TOSTR(ALBEDO_TEX_ENABLE)
+		" volume=" TOSTR(VOLUME_ENABLE)
+		" guiding=" TOSTR(PATH_GUIDING_ENABLE)
+		" halfres=" TOSTR(HALF_RES_INDIRECT_ENABLE)
+		" adaptivedepth=" TOSTR(ADAPTIVE_DEPTH_ENABLE)
+		" roi=" TOSTR(ROI_ENABLE)
+		" graph=" TOSTR(CUDA_GRAPH_ENABLE)
+		" multigpu=" TOSTR(MULTI_GPU_ENABLE)
+		" peergeom=" TOSTR(MULTI_GPU_PEER_GEOM_ENABLE)
+		" mgpusteal=" TOSTR(MULTI_GPU_STEAL_ENABLE);
+}
+
+void pathtraceDeviceInfo(char* name, int nameLen, size_t* memUsed,
+	size_t* memTotal) {
+	cudaDeviceProp prop;
+	int device = 0;
+	cudaGetDevice(&device);
+	cudaGetDeviceProperties(&prop, device);
+	snprintf(name, nameLen, "%s", prop.name);
+	size_t freeBytes = 0, totalBytes = 0;
+	cudaMemGetInfo(&freeBytes, &totalBytes);
+	// the arena is carved once at init, so current usage is the peak
+	*memUsed = totalBytes - freeBytes;
+	*memTotal = totalBytes;
+}
+
+// World-space surface area of a sphere or cube geom (average-scale
+// approximation for the sphere); 0 for meshes and planes. Shared by the light list and
+// the per-geom light areas used for multiple importance sampling.
+static float geomSurfaceArea(const Geom& geom) {
+	glm::vec3 sc = geom.scale;
+	if (geom.type == SPHERE) {
+		float r = 0.5f * (sc.x + sc.y + sc.z) / 3.0f;
+		return 4.0f * PI * r * r;
+	}
+	if (geom.type == CUBE) {
+		return 2.0f * (sc.x * sc.y + sc.y * sc.z + sc.z * sc.x);
+	}
+	return 0.0f;
+}
+
+#if MORTON_ORDER_ENABLE
+// Interleave the low 16 bits of v with zeros (host-side half of the 2D
+// Morton code; the device LBVH builder keeps its own 3D variant).
+static unsigned int mortonPart1By1(unsigned int v) {
+	v &= 0x0000ffffu;
+	v = (v | (v << 8)) & 0x00ff00ffu;
+	v = (v | (v << 4)) & 0x0f0f0f0fu;
+	v = (v | (v << 2)) & 0x33333333u;
+	v = (v | (v << 1)) & 0x55555555u;
+	return v;
+}
+#endif // MORTON_ORDER_ENABLE
+
+// One arena for every buffer whose size is fixed by the resolution: a dry
+// carve measures, a single cudaMalloc serves them all, and a camera change
+// later resets per-pixel state without touching the allocator at all.
+static char* dev_arena = NULL;
+static size_t arenaCapacity = 0;
+static size_t arenaOffset = 0;
+
+// Carve `bytes` from the arena at 256-byte alignment (what cudaMalloc
+// guarantees). With dev_arena still NULL this only advances the cursor,
+// which is exactly the measuring pass.
+static void* arenaAlloc(size_t bytes)
+{
+	arenaOffset = (arenaOffset + 255) & ~(size_t)255;
+	void* p = dev_arena + arenaOffset;
+	arenaOffset += bytes;
+	return p;
+}
+
+// Every resolution-sized buffer, carved in one fixed order. Scene-sized
+// buffers (geometry, BVH nodes, materials, lights) keep their own
+// allocations: they are uploaded once per scene and never touched again.
+static void carvePixelBuffers(int pixelcount)
+{
+	// path-pool slots: an SPP batch carves one sample plane per sample
+	const int slotcount = SPP_BATCH * pixelcount;
+
+	dev_image = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+#if AOV_ENABLE
+	dev_aovNormal = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+	dev_aovDepth = (float*)arenaAlloc(pixelcount * sizeof(float));
+	dev_aovAlbedo = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+	dev_aovDirect = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+#endif // AOV_ENABLE
+
+	dev_paths.origins = (glm::vec3*)arenaAlloc(slotcount * sizeof(glm::vec3));
+	dev_paths.directions = (glm::vec3*)arenaAlloc(slotcount * sizeof(glm::vec3));
+	dev_paths.invDirections = (glm::vec3*)arenaAlloc(slotcount * sizeof(glm::vec3));
+	dev_paths.times = (float*)arenaAlloc(slotcount * sizeof(float));
+	dev_paths.colors = (PathColor*)arenaAlloc(slotcount * sizeof(PathColor));
+	dev_paths.radiances = (PathColor*)arenaAlloc(slotcount * sizeof(PathColor));
+	dev_paths.pixelIndices = (int*)arenaAlloc(slotcount * sizeof(int));
+	dev_paths.remainingBounces = (int*)arenaAlloc(slotcount * sizeof(int));
+	dev_paths.prevPdfs = (float*)arenaAlloc(slotcount * sizeof(float));
+#if PATH_GUIDING_ENABLE
+	dev_paths.guideBins = (int*)arenaAlloc(slotcount * sizeof(int));
+#endif // PATH_GUIDING_ENABLE
+
+	dev_rngStates = (thrust::default_random_engine*)arenaAlloc(slotcount * sizeof(thrust::default_random_engine));
+
+	dev_intersections.t = (float*)arenaAlloc(slotcount * sizeof(float));
+	dev_intersections.surfaceNormals = (glm::vec3*)arenaAlloc(slotcount * sizeof(glm::vec3));
+	dev_intersections.materialIds = (int*)arenaAlloc(slotcount * sizeof(int));
+	dev_intersections.points = (glm::vec3*)arenaAlloc(slotcount * sizeof(glm::vec3));
+	dev_intersections.lightAreas = (float*)arenaAlloc(slotcount * sizeof(float));
+	dev_intersections.uvs = (glm::vec2*)arenaAlloc(slotcount * sizeof(glm::vec2));
+
+#if MORTON_ORDER_ENABLE
+	dev_pixelToSlot = (int*)arenaAlloc(pixelcount * sizeof(int));
+#endif // MORTON_ORDER_ENABLE
+#if RAY_SORT_ENABLE
+	dev_raySortKeys = (unsigned int*)arenaAlloc(slotcount * sizeof(unsigned int));
+	dev_raySortIndices = (int*)arenaAlloc(slotcount * sizeof(int));
+	dev_raySortScratch = arenaAlloc(StreamCompaction::sortPairsScratchBytes(slotcount));
+#endif // RAY_SORT_ENABLE
+#if DEFERRED_SHADOW_ENABLE
+	// worst case one light sample per live slot per bounce, so the exact
+	// capacity is known up front and the enqueue needs no overflow check
+	shadowQueueCapacity = slotcount * scene->state.traceDepth;
+	dev_shadowQueue = (ShadowJob*)arenaAlloc(shadowQueueCapacity * sizeof(ShadowJob));
+	dev_shadowQueueCount = (int*)arenaAlloc(sizeof(int));
+	dev_shadowSortKeys = (unsigned int*)arenaAlloc(shadowQueueCapacity * sizeof(unsigned int));
+	dev_shadowSortIndices = (int*)arenaAlloc(shadowQueueCapacity * sizeof(int));
+	dev_shadowSortScratch = arenaAlloc(StreamCompaction::sortPairsScratchBytes(shadowQueueCapacity));
+	cudaMemset(dev_shadowQueueCount, 0, sizeof(int));
+#endif // DEFERRED_SHADOW_ENABLE
+#if PIXEL_PROBE_ENABLE
+	dev_probeRecords = (ProbeRecord*)arenaAlloc(scene->state.traceDepth * sizeof(ProbeRecord));
+	cudaMemcpyToSymbol(c_probeRecords, &dev_probeRecords, sizeof(dev_probeRecords));
+	{
+		// disarmed until a click; the shade kernel compares every path's
+		// pixel against this
+		int disarmed = -1;
+		cudaMemcpyToSymbol(c_probePixel, &disarmed, sizeof(int));
+	}
+#endif // PIXEL_PROBE_ENABLE
+	{
+		// carry the layout-preview state across re-inits (scene switches
+		// keep whatever mode the artist was in)
+		int layoutFlag = layoutPreview ? 1 : 0;
+		cudaMemcpyToSymbol(c_layoutPreview, &layoutFlag, sizeof(int));
+	}
+#if STREAM_COMPACTION
+	dev_pathIndices[0] = (int*)arenaAlloc(slotcount * sizeof(int));
+	dev_pathIndices[1] = (int*)arenaAlloc(slotcount * sizeof(int));
+#if FUSED_COMPACT_ENABLE
+	dev_survivorCount = (int*)arenaAlloc(sizeof(int));
+#endif // FUSED_COMPACT_ENABLE
+#endif // STREAM_COMPACTION
+#if PATH_REGEN_ENABLE
+	dev_pixelNextSample = (int*)arenaAlloc(pixelcount * sizeof(int));
+	dev_pixelDoneSamples = (int*)arenaAlloc(pixelcount * sizeof(int));
+#endif // PATH_REGEN_ENABLE
+#if FIREFLY_CLAMP_ENABLE
+	dev_clampedEnergy = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+#endif // FIREFLY_CLAMP_ENABLE
+#if DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+	dev_denoiseNormals = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+	dev_denoisePositions = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+#endif // DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+#if DENOISE_ENABLE
+	dev_denoised[0] = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+	dev_denoised[1] = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+#endif // DENOISE_ENABLE
+#if HALF_RES_INDIRECT_ENABLE
+	{
+		// quad-resolution buffers: the mode requires slot == pixel, so the
+		// quad grid derives straight from the camera resolution
+		const glm::ivec2 res = hst_scene->state.camera.resolution;
+		int quadcount = ((res.x + 1) / 2) * ((res.y + 1) / 2);
+		dev_indirectQuads = (glm::vec3*)arenaAlloc(quadcount * sizeof(glm::vec3));
+		dev_quadRep = (int*)arenaAlloc(quadcount * sizeof(int));
+	}
+#endif // HALF_RES_INDIRECT_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+	{
+		const glm::ivec2 res = hst_scene->state.camera.resolution;
+		numDepthTiles = ((res.x + ADAPTIVE_DEPTH_TILE - 1) / ADAPTIVE_DEPTH_TILE)
+			* ((res.y + ADAPTIVE_DEPTH_TILE - 1) / ADAPTIVE_DEPTH_TILE);
+		dev_tileDepthLum = (float*)arenaAlloc(numDepthTiles * ADAPTIVE_DEPTH_BINS * sizeof(float));
+		dev_tileDepthBudget = (int*)arenaAlloc(numDepthTiles * sizeof(int));
+	}
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+	dev_reprojPositions = (glm::vec4*)arenaAlloc(pixelcount * sizeof(glm::vec4));
+	dev_prevImage = (glm::vec3*)arenaAlloc(pixelcount * sizeof(glm::vec3));
+	dev_reprojImage = (glm::vec4*)arenaAlloc(pixelcount * sizeof(glm::vec4));
+	dev_reprojDepth = (unsigned int*)arenaAlloc(pixelcount * sizeof(unsigned int));
+	// a fresh carve invalidates whatever the old positions described
+	reprojPrevIter = 0;
+	reprojBlendValid = false;
+#endif // TEMPORAL_REPROJECTION_ENABLE
+#if ADAPTIVE_SAMPLING
+	dev_pixelMeans = (float*)arenaAlloc(pixelcount * sizeof(float));
+	dev_pixelM2s = (float*)arenaAlloc(pixelcount * sizeof(float));
+	dev_pixelSamples = (int*)arenaAlloc(pixelcount * sizeof(int));
+	dev_pixelConverged = (int*)arenaAlloc(pixelcount * sizeof(int));
+#endif // ADAPTIVE_SAMPLING
+#if RESTIR_ENABLE
+	dev_reservoirs[0] = (Reservoir*)arenaAlloc(pixelcount * sizeof(Reservoir));
+	dev_reservoirs[1] = (Reservoir*)arenaAlloc(pixelcount * sizeof(Reservoir));
+#endif // RESTIR_ENABLE
+#if CACHE_ENABLE
+	dev_intersections_cache.t = (float*)arenaAlloc(CACHE_STRATA * pixelcount * sizeof(float));
+	dev_intersections_cache.surfaceNormals = (glm::vec3*)arenaAlloc(CACHE_STRATA * pixelcount * sizeof(glm::vec3));
+	dev_intersections_cache.materialIds = (int*)arenaAlloc(CACHE_STRATA * pixelcount * sizeof(int));
+	dev_intersections_cache.points = (glm::vec3*)arenaAlloc(CACHE_STRATA * pixelcount * sizeof(glm::vec3));
+	dev_intersections_cache.lightAreas = (float*)arenaAlloc(CACHE_STRATA * pixelcount * sizeof(float));
+	dev_intersections_cache.uvs = (glm::vec2*)arenaAlloc(CACHE_STRATA * pixelcount * sizeof(glm::vec2));
+#if AA_EDGE_ADAPTIVE_ENABLE
+	dev_aaEdgeMask = (int*)arenaAlloc(pixelcount * sizeof(int));
+	dev_aaEdgeList = (int*)arenaAlloc(pixelcount * sizeof(int));
+	dev_aaEdgeCount = (int*)arenaAlloc(sizeof(int));
+	// everything is an edge until the warmup strata have been compared,
+	// but the mask is only consulted past iteration CACHE_STRATA anyway
+	numAaEdgePaths = 0;
+	cudaMemcpyToSymbol(c_aaEdgeMask, &dev_aaEdgeMask, sizeof(dev_aaEdgeMask));
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+#endif // CACHE_ENABLE
+#if WAVEFRONT_ENABLE
+	dev_queues = (int*)arenaAlloc(QUEUE_COUNT * slotcount * sizeof(int));
+	dev_queueCounters = (int*)arenaAlloc(QUEUE_COUNT * sizeof(int));
+#endif // WAVEFRONT_ENABLE
+#if PERSISTENT_THREADS
+	dev_intersectWorkCounter = (int*)arenaAlloc(sizeof(int));
+#endif // PERSISTENT_THREADS
+#if COOP_LAUNCH_ENABLE
+	dev_coopLiveCounters = (int*)arenaAlloc(2 * sizeof(int));
+#endif // COOP_LAUNCH_ENABLE
+#if HEATMAP_ENABLE
+	dev_pixelBounceDepth = (int*)arenaAlloc(pixelcount * sizeof(int));
+#endif // HEATMAP_ENABLE
+}
+
+#if MULTI_GPU_ENABLE
+// Snapshot of every per-device module static above. Iteration sharding
+// swaps these in and out around cudaSetDevice, so every kernel and helper
+// in this file keeps reading the same statics it always has; only the
+// public entry points at the bottom know more than one device exists.
+struct DeviceState {
+	glm::vec3* image;
+	GeomHot* geomsHot;
+	GeomCold* geomsCold;
+#if PROXY_BOUNCE_ENABLE
+	GeomHot* geomsHotProxy;
+#endif // PROXY_BOUNCE_ENABLE
+#if GEOM_GRID_ENABLE
+	int* gridCellStart;
+	int* gridItems;
+#endif // GEOM_GRID_ENABLE
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	int* tileCullLists;
+	int* tileCullCounts;
+	int tileCullResX;
+	int tileCullResY;
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	Material* materials;
+	PathSegmentSoA paths;
+	ShadeableIntersectionSoA intersections;
+	ShadeableIntersectionSoA intersectionsCache;
+#if AA_EDGE_ADAPTIVE_ENABLE
+	int* aaEdgeMask;
+	int* aaEdgeList;
+	int* aaEdgeCount;
+	int numAaEdgePaths;
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+	TriangleIdx* triangles;
+	glm::vec4* vertices;
+	PackedNormal* normals;
+	cudaTextureObject_t texVertices;
+	cudaTextureObject_t texNormals;
+	cudaTextureObject_t texMaterials;
+#if ALBEDO_TEX_ENABLE
+	glm::vec2* uvs;
+	cudaTextureObject_t texUvs;
+	std::vector<cudaMipmappedArray_t> albedoArrays;
+	std::vector<cudaTextureObject_t> albedoTextures;
+#endif // ALBEDO_TEX_ENABLE
+	glm::vec4* envMap;
+	float* envAliasProb;
+	glm::vec2* blueNoiseMask;
+	int* envAliasIdx;
+	float* envPdf;
+	cudaTextureObject_t texEnvMap;
+	int envMapTexels;
+	LBVHNode* bvhNodes;
+	BVH8Node* bvh8Nodes;
+	LBVHNode* tlasNodes;
+	int tlasRoot;
+	LBVHNode* movingTlasNodes;
+	int movingTlasRoot;
+	int* queues;
+	int* queueCounters;
+	int* intersectWorkCounter;
+	int* coopLiveCounters;
+	Light* lights;
+	int numLights;
+	float* lightAliasProb;
+	int* lightAliasIdx;
+#if PHOTON_MAP_ENABLE
+	Photon* photons;
+	int* photonCellStart;
+	int numPhotonStores;
+#endif // PHOTON_MAP_ENABLE
+#if PATH_GUIDING_ENABLE
+	float* guideFlux;
+	float* guideAccum;
+	float* guideCellFlux;
+#endif // PATH_GUIDING_ENABLE
+	thrust::default_random_engine* rngStates;
+	glm::vec3* clampedEnergy;
+	glm::vec3* denoiseNormals;
+	glm::vec3* denoisePositions;
+	glm::vec3* denoised[2];
+	glm::vec3* denoisedResult;
+	int lastDenoisedIter;
+#if HALF_RES_INDIRECT_ENABLE
+	glm::vec3* indirectQuads;
+	int* quadRep;
+#endif // HALF_RES_INDIRECT_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+	glm::vec4* reprojPositions;
+	glm::vec3* prevImage;
+	glm::vec4* reprojImage;
+	unsigned int* reprojDepth;
+#endif // TEMPORAL_REPROJECTION_ENABLE
+	float* pixelMeans;
+	float* pixelM2s;
+	int* pixelSamples;
+	int* pixelConverged;
+#if IMPORTANCE_MAP_ENABLE
+	float* importance;
+#endif // IMPORTANCE_MAP_ENABLE
+#if RESTIR_ENABLE
+	Reservoir* reservoirs[2];
+#endif // RESTIR_ENABLE
+	int* pixelToSlot;
+	CachedThrustAllocator thrustScratch;
+#if STREAM_COMPACTION
+	int* pathIndices[2];
+	int activePathBuf;
+	int* hostPathCount;
+	cudaEvent_t pathCountEvent;
+#if FUSED_COMPACT_ENABLE
+	int* survivorCount;
+#endif // FUSED_COMPACT_ENABLE
+#endif // STREAM_COMPACTION
+#if PATH_REGEN_ENABLE
+	int* pixelNextSample;
+	int* pixelDoneSamples;
+#endif // PATH_REGEN_ENABLE
+#if RAY_SORT_ENABLE
+	unsigned int* raySortKeys;
+	int* raySortIndices;
+	void* raySortScratch;
+#endif // RAY_SORT_ENABLE
+#if DEFERRED_SHADOW_ENABLE
+	ShadowJob* shadowQueue;
+	int* shadowQueueCount;
+	int shadowQueueCapacity;
+	unsigned int* shadowSortKeys;
+	int* shadowSortIndices;
+	void* shadowSortScratch;
+#endif // DEFERRED_SHADOW_ENABLE
+#if PIXEL_PROBE_ENABLE
+	ProbeRecord* probeRecords;
+#endif // PIXEL_PROBE_ENABLE
+	char* arena;
+	size_t arenaCapacity;
+	size_t arenaOffset;
+	cudaStream_t computeStream;
+	cudaStream_t uploadStream;
+	char* uploadStage[2];
+	cudaEvent_t uploadStageFree[2];
+	cudaStream_t displayStream;
+	cudaEvent_t gatherDone;
+	glm::vec3* hostImageStage;
+	cudaEvent_t imageStageDone;
+	cudaGraphExec_t iterationGraphExec;
+#if HEATMAP_ENABLE
+	int* pixelBounceDepth;
+#endif // HEATMAP_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+	float* tileDepthLum;
+	int* tileDepthBudget;
+	int numDepthTiles;
+#endif // ADAPTIVE_DEPTH_ENABLE
+};
+
+// zero-initialized, so the first load per device presents fresh NULL
+// statics to pathtraceInit exactly as a cold process start would
+static DeviceState deviceStates[MULTI_GPU_MAX_DEVICES];
+static int numDevices = 1;
+// per-device salt for kernInitRNG, set around each device's init
+static int multiGpuRngSalt = 0;
+// device 0 additionally owns the cross-device blend target and the staging
+// buffer the workers' accumulations are peer-copied through (outside the
+// arena: they have no single-device counterpart)
+static glm::vec3* dev_mergedImage = NULL;
+static glm::vec3* dev_peerStage = NULL;
+#if MULTI_GPU_STEAL_ENABLE
+// one completion marker per device, recorded after each enqueued sample;
+// a completed (or never recorded) event marks the device idle and ready
+// to take the batch's next sample
+static cudaEvent_t stealDone[MULTI_GPU_MAX_DEVICES] = {};
+#endif // MULTI_GPU_STEAL_ENABLE
+
+#if MULTI_GPU_PEER_GEOM_ENABLE
+// The peer-resident geometry pools (MULTI_GPU_PEER_GEOM_ENABLE): one copy
+// of each big read-only pool for the whole group, instead of a replica in
+// every device's statics. The flat pools are allocated round-robin by
+// setupPeerGeom before the per-device init loop; the BVH pools are built
+// by whichever device's init pass runs first and adopted by the rest
+// (the build permutes the shared triangles and remaps geom.bvhRoot, so it
+// must run exactly once). Inactive - all replicated, exactly the old
+// behavior - when any device pair lacks peer access.
+static struct PeerGeom {
+	bool active;
+	bool bvhShared;
+	TriangleIdx* triangles;
+	glm::vec4* vertices;
+	PackedNormal* normals;
+	glm::vec2* uvs;
+	LBVHNode* bvhNodes;
+	BVH8Node* bvh8Nodes;
+	int poolDevice[4];  // owners of the four flat pools, for the frees
+	int bvhDevice;      // device whose init pass built the shared trees
+} peerGeom = {};
+// the builder pass's post-remap geom.bvhRoot values, restored on every
+// adopting pass (the LOD reselect resets them to the pre-build roots)
+static std::vector<int> peerGeomBvhRoots;
+
+static void releasePeerGeom() {
+	int prev;
+	cudaGetDevice(&prev);
+	if (peerGeom.triangles) {
+		cudaSetDevice(peerGeom.poolDevice[0]);
+		cudaFree(peerGeom.triangles);
+	}
+	if (peerGeom.vertices) {
+		cudaSetDevice(peerGeom.poolDevice[1]);
+		cudaFree(peerGeom.vertices);
+	}
+	if (peerGeom.normals) {
+		cudaSetDevice(peerGeom.poolDevice[2]);
+		cudaFree(peerGeom.normals);
+	}
+	if (peerGeom.uvs) {
+		cudaSetDevice(peerGeom.poolDevice[3]);
+		cudaFree(peerGeom.uvs);
+	}
+	if (peerGeom.bvhNodes || peerGeom.bvh8Nodes) {
+		cudaSetDevice(peerGeom.bvhDevice);
+		cudaFree(peerGeom.bvhNodes);
+		cudaFree(peerGeom.bvh8Nodes);
+	}
+	memset(&peerGeom, 0, sizeof(peerGeom));
+	peerGeomBvhRoots.clear();
+	cudaSetDevice(prev);
+}
+
+// Map every device pair and place the flat pools; runs once per init,
+// before the per-device loop (the loop's pathtraceInitDevice passes adopt
+// the pointers instead of allocating replicas).
+static void setupPeerGeom(Scene* scene) {
+	releasePeerGeom();
+	if (numDevices < 2) {
+		return;
+	}
+	for (int a = 0; a < numDevices; a++) {
+		for (int b = 0; b < numDevices; b++) {
+			if (a == b) {
+				continue;
+			}
+			int can = 0;
+			cudaDeviceCanAccessPeer(&can, a, b);
+			if (!can) {
+				fprintf(stderr, "multi-GPU: devices %d and %d are not peers, replicating geometry\n", a, b);
+				return;
+			}
+		}
+	}
+	int prev;
+	cudaGetDevice(&prev);
+	for (int d = 0; d < numDevices; d++) {
+		cudaSetDevice(d);
+		for (int e = 0; e < numDevices; e++) {
+			if (e == d) {
+				continue;
+			}
+			cudaError_t err = cudaDeviceEnablePeerAccess(e, 0);
+			if (err != cudaSuccess && err != cudaErrorPeerAccessAlreadyEnabled) {
+				fprintf(stderr, "multi-GPU: peer mapping %d -> %d failed, replicating geometry\n", d, e);
+				cudaGetLastError();
+				cudaSetDevice(prev);
+				return;
+			}
+			// clear the sticky already-enabled error from re-inits
+			cudaGetLastError();
+		}
+	}
+
+	for (int p = 0; p < 4; p++) {
+		peerGeom.poolDevice[p] = p % numDevices;
+	}
+	cudaSetDevice(peerGeom.poolDevice[0]);
+	deviceMalloc((void**)&peerGeom.triangles, scene->triangles.size() * sizeof(TriangleIdx), "peer triangles");
+	cudaMemcpy(peerGeom.triangles, scene->triangles.data(),
+		scene->triangles.size() * sizeof(TriangleIdx), cudaMemcpyHostToDevice);
+	cudaSetDevice(peerGeom.poolDevice[1]);
+	deviceMalloc((void**)&peerGeom.vertices, scene->vertices.size() * sizeof(glm::vec4), "peer vertices");
+	cudaMemcpy(peerGeom.vertices, scene->vertices.data(),
+		scene->vertices.size() * sizeof(glm::vec4), cudaMemcpyHostToDevice);
+	std::vector<PackedNormal> packedNormals(scene->normals.size());
+	for (size_t i = 0; i < scene->normals.size(); i++) {
+		packedNormals[i] = packNormal(glm::vec3(scene->normals[i]));
+	}
+	cudaSetDevice(peerGeom.poolDevice[2]);
+	deviceMalloc((void**)&peerGeom.normals, scene->normals.size() * sizeof(PackedNormal), "peer normals");
+	cudaMemcpy(peerGeom.normals, packedNormals.data(),
+		scene->normals.size() * sizeof(PackedNormal), cudaMemcpyHostToDevice);
+#if ALBEDO_TEX_ENABLE
+	if (!scene->textures.empty() && !scene->uvs.empty()) {
+		cudaSetDevice(peerGeom.poolDevice[3]);
+		deviceMalloc((void**)&peerGeom.uvs, scene->uvs.size() * sizeof(glm::vec2), "peer uvs");
+		cudaMemcpy(peerGeom.uvs, scene->uvs.data(),
+			scene->uvs.size() * sizeof(glm::vec2), cudaMemcpyHostToDevice);
+	}
+#endif // ALBEDO_TEX_ENABLE
+	peerGeom.active = true;
+	printf("multi-GPU: geometry pools peer-shared across %d devices\n", numDevices);
+	cudaSetDevice(prev);
+	checkCUDAError("setupPeerGeom");
+}
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+
+static void saveDeviceState(DeviceState& st) {
+	st.image = dev_image;
+	st.geomsHot = dev_geomsHot;
+	st.geomsCold = dev_geomsCold;
+#if PROXY_BOUNCE_ENABLE
+	st.geomsHotProxy = dev_geomsHotProxy;
+#endif // PROXY_BOUNCE_ENABLE
+#if GEOM_GRID_ENABLE
+	st.gridCellStart = dev_gridCellStart;
+	st.gridItems = dev_gridItems;
+#endif // GEOM_GRID_ENABLE
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	st.tileCullLists = dev_tileCullLists;
+	st.tileCullCounts = dev_tileCullCounts;
+	st.tileCullResX = tileCullResX;
+	st.tileCullResY = tileCullResY;
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	st.materials = dev_materials;
+	st.paths = dev_paths;
+	st.intersections = dev_intersections;
+	st.intersectionsCache = dev_intersections_cache;
+#if AA_EDGE_ADAPTIVE_ENABLE
+	st.aaEdgeMask = dev_aaEdgeMask;
+	st.aaEdgeList = dev_aaEdgeList;
+	st.aaEdgeCount = dev_aaEdgeCount;
+	st.numAaEdgePaths = numAaEdgePaths;
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+	st.triangles = dev_triangles;
+	st.vertices = dev_vertices;
+	st.normals = dev_normals;
+#if ALBEDO_TEX_ENABLE
+	st.uvs = dev_uvs;
+	st.texUvs = texUvs;
+	st.albedoArrays = albedoArrays;
+	st.albedoTextures = albedoTextures;
+#endif // ALBEDO_TEX_ENABLE
+	st.texVertices = texVertices;
+	st.texNormals = texNormals;
+	st.texMaterials = texMaterials;
+	st.envMap = dev_envMap;
+	st.envAliasProb = dev_envAliasProb;
+	st.blueNoiseMask = dev_blueNoiseMask;
+	st.envAliasIdx = dev_envAliasIdx;
+	st.envPdf = dev_envPdf;
+	st.texEnvMap = texEnvMap;
+	st.envMapTexels = envMapTexels;
+	st.bvhNodes = dev_bvhNodes;
+	st.bvh8Nodes = dev_bvh8Nodes;
+	st.tlasNodes = dev_tlasNodes;
+	st.tlasRoot = tlasRoot;
+	st.movingTlasNodes = dev_movingTlasNodes;
+	st.movingTlasRoot = movingTlasRoot;
+	st.queues = dev_queues;
+	st.queueCounters = dev_queueCounters;
+	st.intersectWorkCounter = dev_intersectWorkCounter;
+	st.coopLiveCounters = dev_coopLiveCounters;
+	st.lights = dev_lights;
+	st.numLights = numLights;
+	st.lightAliasProb = dev_lightAliasProb;
+	st.lightAliasIdx = dev_lightAliasIdx;
+#if PHOTON_MAP_ENABLE
+	st.photons = dev_photons;
+	st.photonCellStart = dev_photonCellStart;
+	st.numPhotonStores = numPhotonStores;
+#endif // PHOTON_MAP_ENABLE
+#if PATH_GUIDING_ENABLE
+	st.guideFlux = dev_guideFlux;
+	st.guideAccum = dev_guideAccum;
+	st.guideCellFlux = dev_guideCellFlux;
+#endif // PATH_GUIDING_ENABLE
+	st.rngStates = dev_rngStates;
+	st.clampedEnergy = dev_clampedEnergy;
+	st.denoiseNormals = dev_denoiseNormals;
+	st.denoisePositions = dev_denoisePositions;
+	st.denoised[0] = dev_denoised[0];
+	st.denoised[1] = dev_denoised[1];
+	st.denoisedResult = dev_denoisedResult;
+	st.lastDenoisedIter = lastDenoisedIter;
+#if HALF_RES_INDIRECT_ENABLE
+	st.indirectQuads = dev_indirectQuads;
+	st.quadRep = dev_quadRep;
+#endif // HALF_RES_INDIRECT_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+	st.reprojPositions = dev_reprojPositions;
+	st.prevImage = dev_prevImage;
+	st.reprojImage = dev_reprojImage;
+	st.reprojDepth = dev_reprojDepth;
+#endif // TEMPORAL_REPROJECTION_ENABLE
+	st.pixelMeans = dev_pixelMeans;
+	st.pixelM2s = dev_pixelM2s;
+	st.pixelSamples = dev_pixelSamples;
+	st.pixelConverged = dev_pixelConverged;
+#if IMPORTANCE_MAP_ENABLE
+	st.importance = dev_importance;
+#endif // IMPORTANCE_MAP_ENABLE
+#if RESTIR_ENABLE
+	st.reservoirs[0] = dev_reservoirs[0];
+	st.reservoirs[1] = dev_reservoirs[1];
+#endif // RESTIR_ENABLE
+	st.pixelToSlot = dev_pixelToSlot;
+	st.thrustScratch = thrustScratch;
+#if STREAM_COMPACTION
+	st.pathIndices[0] = dev_pathIndices[0];
+	st.pathIndices[1] = dev_pathIndices[1];
+	st.activePathBuf = activePathBuf;
+	st.hostPathCount = host_pathCount;
+	st.pathCountEvent = pathCountEvent;
+#if FUSED_COMPACT_ENABLE
+	st.survivorCount = dev_survivorCount;
+#endif // FUSED_COMPACT_ENABLE
+#endif // STREAM_COMPACTION
+#if PATH_REGEN_ENABLE
+	st.pixelNextSample = dev_pixelNextSample;
+	st.pixelDoneSamples = dev_pixelDoneSamples;
+#endif // PATH_REGEN_ENABLE
+#if RAY_SORT_ENABLE
+	st.raySortKeys = dev_raySortKeys;
+	st.raySortIndices = dev_raySortIndices;
+	st.raySortScratch = dev_raySortScratch;
+#endif // RAY_SORT_ENABLE
+#if DEFERRED_SHADOW_ENABLE
+	st.shadowQueue = dev_shadowQueue;
+	st.shadowQueueCount = dev_shadowQueueCount;
+	st.shadowQueueCapacity = shadowQueueCapacity;
+	st.shadowSortKeys = dev_shadowSortKeys;
+	st.shadowSortIndices = dev_shadowSortIndices;
+	st.shadowSortScratch = dev_shadowSortScratch;
+#endif // DEFERRED_SHADOW_ENABLE
+#if PIXEL_PROBE_ENABLE
+	st.probeRecords = dev_probeRecords;
+#endif // PIXEL_PROBE_ENABLE
+	st.arena = dev_arena;
+	st.arenaCapacity = arenaCapacity;
+	st.arenaOffset = arenaOffset;
+	st.computeStream = computeStream;
+	st.uploadStream = uploadStream;
+	st.uploadStage[0] = host_uploadStage[0];
+	st.uploadStage[1] = host_uploadStage[1];
+	st.uploadStageFree[0] = uploadStageFree[0];
+	st.uploadStageFree[1] = uploadStageFree[1];
+	st.displayStream = displayStream;
+	st.gatherDone = gatherDone;
+	st.hostImageStage = host_imageStage;
+	st.imageStageDone = imageStageDone;
+	st.iterationGraphExec = iterationGraphExec;
+#if HEATMAP_ENABLE
+	st.pixelBounceDepth = dev_pixelBounceDepth;
+#endif // HEATMAP_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+	st.tileDepthLum = dev_tileDepthLum;
+	st.tileDepthBudget = dev_tileDepthBudget;
+	st.numDepthTiles = numDepthTiles;
+#endif // ADAPTIVE_DEPTH_ENABLE
+}
+
+static void loadDeviceState(const DeviceState& st) {
+	dev_image = st.image;
+	dev_geomsHot = st.geomsHot;
+	dev_geomsCold = st.geomsCold;
+#if PROXY_BOUNCE_ENABLE
+	dev_geomsHotProxy = st.geomsHotProxy;
+#endif // PROXY_BOUNCE_ENABLE
+#if GEOM_GRID_ENABLE
+	dev_gridCellStart = st.gridCellStart;
+	dev_gridItems = st.gridItems;
+#endif // GEOM_GRID_ENABLE
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	dev_tileCullLists = st.tileCullLists;
+	dev_tileCullCounts = st.tileCullCounts;
+	tileCullResX = st.tileCullResX;
+	tileCullResY = st.tileCullResY;
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	dev_materials = st.materials;
+	dev_paths = st.paths;
+	dev_intersections = st.intersections;
+	dev_intersections_cache = st.intersectionsCache;
+#if AA_EDGE_ADAPTIVE_ENABLE
+	dev_aaEdgeMask = st.aaEdgeMask;
+	dev_aaEdgeList = st.aaEdgeList;
+	dev_aaEdgeCount = st.aaEdgeCount;
+	numAaEdgePaths = st.numAaEdgePaths;
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+	dev_triangles = st.triangles;
+	dev_vertices = st.vertices;
+	dev_normals = st.normals;
+#if ALBEDO_TEX_ENABLE
+	dev_uvs = st.uvs;
+	texUvs = st.texUvs;
+	albedoArrays = st.albedoArrays;
+	albedoTextures = st.albedoTextures;
+#endif // ALBEDO_TEX_ENABLE
+	texVertices = st.texVertices;
+	texNormals = st.texNormals;
+	texMaterials = st.texMaterials;
+	dev_envMap = st.envMap;
+	dev_envAliasProb = st.envAliasProb;
+	dev_blueNoiseMask = st.blueNoiseMask;
+	dev_envAliasIdx = st.envAliasIdx;
+	dev_envPdf = st.envPdf;
+	texEnvMap = st.texEnvMap;
+	envMapTexels = st.envMapTexels;
+	dev_bvhNodes = st.bvhNodes;
+	dev_bvh8Nodes = st.bvh8Nodes;
+	dev_tlasNodes = st.tlasNodes;
+	tlasRoot = st.tlasRoot;
+	dev_movingTlasNodes = st.movingTlasNodes;
+	movingTlasRoot = st.movingTlasRoot;
+	dev_queues = st.queues;
+	dev_queueCounters = st.queueCounters;
+	dev_intersectWorkCounter = st.intersectWorkCounter;
+	dev_coopLiveCounters = st.coopLiveCounters;
+	dev_lights = st.lights;
+	numLights = st.numLights;
+	dev_lightAliasProb = st.lightAliasProb;
+	dev_lightAliasIdx = st.lightAliasIdx;
+#if PHOTON_MAP_ENABLE
+	dev_photons = st.photons;
+	dev_photonCellStart = st.photonCellStart;
+	numPhotonStores = st.numPhotonStores;
+#endif // PHOTON_MAP_ENABLE
+#if PATH_GUIDING_ENABLE
+	dev_guideFlux = st.guideFlux;
+	dev_guideAccum = st.guideAccum;
+	dev_guideCellFlux = st.guideCellFlux;
+#endif // PATH_GUIDING_ENABLE
+	dev_rngStates = st.rngStates;
+	dev_clampedEnergy = st.clampedEnergy;
+	dev_denoiseNormals = st.denoiseNormals;
+	dev_denoisePositions = st.denoisePositions;
+	dev_denoised[0] = st.denoised[0];
+	dev_denoised[1] = st.denoised[1];
+	dev_denoisedResult = st.denoisedResult;
+	lastDenoisedIter = st.lastDenoisedIter;
+#if HALF_RES_INDIRECT_ENABLE
+	dev_indirectQuads = st.indirectQuads;
+	dev_quadRep = st.quadRep;
+#endif // HALF_RES_INDIRECT_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+	dev_reprojPositions = st.reprojPositions;
+	dev_prevImage = st.prevImage;
+	dev_reprojImage = st.reprojImage;
+	dev_reprojDepth = st.reprojDepth;
+#endif // TEMPORAL_REPROJECTION_ENABLE
+	dev_pixelMeans = st.pixelMeans;
+	dev_pixelM2s = st.pixelM2s;
+	dev_pixelSamples = st.pixelSamples;
+	dev_pixelConverged = st.pixelConverged;
+#if IMPORTANCE_MAP_ENABLE
+	dev_importance = st.importance;
+#endif // IMPORTANCE_MAP_ENABLE
+#if RESTIR_ENABLE
+	dev_reservoirs[0] = st.reservoirs[0];
+	dev_reservoirs[1] = st.reservoirs[1];
+#endif // RESTIR_ENABLE
+	dev_pixelToSlot = st.pixelToSlot;
+	thrustScratch = st.thrustScratch;
+#if STREAM_COMPACTION
+	dev_pathIndices[0] = st.pathIndices[0];
+	dev_pathIndices[1] = st.pathIndices[1];
+	activePathBuf = st.activePathBuf;
+	host_pathCount = st.hostPathCount;
+	pathCountEvent = st.pathCountEvent;
+#if FUSED_COMPACT_ENABLE
+	dev_survivorCount = st.survivorCount;
+#endif // FUSED_COMPACT_ENABLE
+#endif // STREAM_COMPACTION
+#if PATH_REGEN_ENABLE
+	dev_pixelNextSample = st.pixelNextSample;
+	dev_pixelDoneSamples = st.pixelDoneSamples;
+#endif // PATH_REGEN_ENABLE
+#if RAY_SORT_ENABLE
+	dev_raySortKeys = st.raySortKeys;
+	dev_raySortIndices = st.raySortIndices;
+	dev_raySortScratch = st.raySortScratch;
+#endif // RAY_SORT_ENABLE
+#if DEFERRED_SHADOW_ENABLE
+	dev_shadowQueue = st.shadowQueue;
+	dev_shadowQueueCount = st.shadowQueueCount;
+	shadowQueueCapacity = st.shadowQueueCapacity;
+	dev_shadowSortKeys = st.shadowSortKeys;
+	dev_shadowSortIndices = st.shadowSortIndices;
+	dev_shadowSortScratch = st.shadowSortScratch;
+#endif // DEFERRED_SHADOW_ENABLE
+#if PIXEL_PROBE_ENABLE
+	dev_probeRecords = st.probeRecords;
+#endif // PIXEL_PROBE_ENABLE
+	dev_arena = st.arena;
+	arenaCapacity = st.arenaCapacity;
+	arenaOffset = st.arenaOffset;
+	computeStream = st.computeStream;
+	uploadStream = st.uploadStream;
+	host_uploadStage[0] = st.uploadStage[0];
+	host_uploadStage[1] = st.uploadStage[1];
+	uploadStageFree[0] = st.uploadStageFree[0];
+	uploadStageFree[1] = st.uploadStageFree[1];
+	displayStream = st.displayStream;
+	gatherDone = st.gatherDone;
+	host_imageStage = st.hostImageStage;
+	imageStageDone = st.imageStageDone;
+	iterationGraphExec = st.iterationGraphExec;
+#if HEATMAP_ENABLE
+	dev_pixelBounceDepth = st.pixelBounceDepth;
+#endif // HEATMAP_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+	dev_tileDepthLum = st.tileDepthLum;
+	dev_tileDepthBudget = st.tileDepthBudget;
+	numDepthTiles = st.numDepthTiles;
+#endif // ADAPTIVE_DEPTH_ENABLE
+}
+#endif // MULTI_GPU_ENABLE
+
+// Release only the scene-sized buffers (geometry, BVHs, materials,
+// lights). Used between queued jobs, where the CUDA context, the streams
+// and the arena all stay up and only the scene itself is swapped.
+static void freeSceneBuffers() {
+#if MULTI_GPU_ENABLE && MULTI_GPU_PEER_GEOM_ENABLE
+	if (peerGeom.active) {
+		// these statics only borrow the peer-resident pools; the single
+		// real free is releasePeerGeom's, so drop the pointers here and
+		// let cudaFree(NULL) below no-op
+		dev_triangles = NULL;
+		dev_vertices = NULL;
+		dev_normals = NULL;
+#if ALBEDO_TEX_ENABLE
+		dev_uvs = NULL;
+#endif // ALBEDO_TEX_ENABLE
+		dev_bvhNodes = NULL;
+		dev_bvh8Nodes = NULL;
+	}
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+	cudaFree(dev_geomsHot);
+	dev_geomsHot = NULL;
+	cudaFree(dev_geomsCold);
+	dev_geomsCold = NULL;
+#if PROXY_BOUNCE_ENABLE
+	cudaFree(dev_geomsHotProxy);
+	dev_geomsHotProxy = NULL;
+#endif // PROXY_BOUNCE_ENABLE
+#if GEOM_GRID_ENABLE
+	cudaFree(dev_gridCellStart);
+	dev_gridCellStart = NULL;
+	cudaFree(dev_gridItems);
+	dev_gridItems = NULL;
+#endif // GEOM_GRID_ENABLE
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	cudaFree(dev_tileCullLists);
+	dev_tileCullLists = NULL;
+	cudaFree(dev_tileCullCounts);
+	dev_tileCullCounts = NULL;
+	tileCullResX = 0;
+	tileCullResY = 0;
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	cudaFree(dev_triangles);
+	dev_triangles = NULL;
+	if (texVertices) {
+		cudaDestroyTextureObject(texVertices);
+		texVertices = 0;
+	}
+	if (texNormals) {
+		cudaDestroyTextureObject(texNormals);
+		texNormals = 0;
+	}
+	if (texMaterials) {
+		cudaDestroyTextureObject(texMaterials);
+		texMaterials = 0;
+	}
+	if (texEnvMap) {
+		cudaDestroyTextureObject(texEnvMap);
+		texEnvMap = 0;
+	}
+	cudaFree(dev_envMap);
+	dev_envMap = NULL;
+	cudaFree(dev_envAliasProb);
+	dev_envAliasProb = NULL;
+	cudaFree(dev_blueNoiseMask);
+	dev_blueNoiseMask = NULL;
+	cudaFree(dev_envAliasIdx);
+	dev_envAliasIdx = NULL;
+	cudaFree(dev_envPdf);
+	dev_envPdf = NULL;
+	envMapTexels = 0;
+	cudaFree(dev_vertices);
+	dev_vertices = NULL;
+	cudaFree(dev_normals);
+	dev_normals = NULL;
+#if ALBEDO_TEX_ENABLE
+	if (texUvs) {
+		cudaDestroyTextureObject(texUvs);
+		texUvs = 0;
+	}
+	cudaFree(dev_uvs);
+	dev_uvs = NULL;
+	for (size_t i = 0; i < albedoTextures.size(); i++) {
+		cudaDestroyTextureObject(albedoTextures[i]);
+	}
+	albedoTextures.clear();
+	for (size_t i = 0; i < albedoArrays.size(); i++) {
+		cudaFreeMipmappedArray(albedoArrays[i]);
+	}
+	albedoArrays.clear();
+#endif // ALBEDO_TEX_ENABLE
+	cudaFree(dev_bvhNodes);
+	dev_bvhNodes = NULL;
+	cudaFree(dev_bvh8Nodes);
+	dev_bvh8Nodes = NULL;
+	cudaFree(dev_tlasNodes);
+	dev_tlasNodes = NULL;
+	cudaFree(dev_movingTlasNodes);
+	dev_movingTlasNodes = NULL;
+	cudaFree(dev_materials);
+	dev_materials = NULL;
+#if IMPORTANCE_MAP_ENABLE
+	cudaFree(dev_importance);
+	dev_importance = NULL;
+#endif // IMPORTANCE_MAP_ENABLE
+	cudaFree(dev_lights);
+	dev_lights = NULL;
+	cudaFree(dev_lightAliasProb);
+	dev_lightAliasProb = NULL;
+	cudaFree(dev_lightAliasIdx);
+	dev_lightAliasIdx = NULL;
+#if PHOTON_MAP_ENABLE
+	cudaFree(dev_photons);
+	dev_photons = NULL;
+	cudaFree(dev_photonCellStart);
+	dev_photonCellStart = NULL;
+	numPhotonStores = -1;
+#endif // PHOTON_MAP_ENABLE
+#if PATH_GUIDING_ENABLE
+	cudaFree(dev_guideFlux);
+	dev_guideFlux = NULL;
+	cudaFree(dev_guideAccum);
+	dev_guideAccum = NULL;
+	cudaFree(dev_guideCellFlux);
+	dev_guideCellFlux = NULL;
+#endif // PATH_GUIDING_ENABLE
+}
+
+// Split each geom into its hot (traversal) and cold (post-hit) halves; the
+// full Geom stays host-side as the scene-loading representation. Shared by
+// init, by the per-frame animation update (which re-runs it after
+// Scene::setAnimationFrame rewrote the transforms) and by the CPU backend,
+// which traverses the same split arrays on the host (cputrace.cu).
+void buildGeomSplit(Scene* scene, std::vector<GeomHot>& geomsHot,
+	std::vector<GeomCold>& geomsCold) {
+	geomsHot.resize(scene->geoms.size());
+	geomsCold.resize(scene->geoms.size());
+	for (int i = 0; i < (int)scene->geoms.size(); i++) {
+		const Geom& geom = scene->geoms[i];
+		geomsHot[i].type = geom.type;
+		geomsHot[i].startIndex = geom.startIndex;
+		geomsHot[i].endIndex = geom.endIndex;
+		geomsHot[i].bvhRoot = geom.bvhRoot;
+		geomsHot[i].visibility = geom.visibility;
+		geomsHot[i].inverseTransform = glm::mat4x3(geom.inverseTransform);
+		geomsHot[i].motionOffset = geom.moving ? geom.target - geom.translation : glm::vec3(0.0f);
+		geomsHot[i].leftBottom = geom.leftBottom;
+		geomsHot[i].rightTop = geom.rightTop;
+		// meshes baked into world space at load keep an identity transform;
+		// flag them so the mesh tests skip the ray transform altogether
+		geomsHot[i].worldSpace = geom.type == MESH && !geom.moving
+			&& geom.transform == glm::mat4(1.0f) ? 1 : 0;
+		if (geom.type == SPHERE) {
+			// Spheres do not use the mesh AABB fields; pack a world-space
+			// center/radius pair into them when the transform is a rigid
+			// motion plus uniform scale (orthogonal upper-3x3 columns of
+			// equal length), which is every sphere the scene files and
+			// buildRandomScene actually produce. sphereIntersectionTest
+			// then runs a direct world-space quadratic with no matrix
+			// transforms; rightTop.x < 0 keeps deformed spheres on the
+			// matrix path.
+			glm::vec3 c0 = glm::vec3(geom.transform[0]);
+			glm::vec3 c1 = glm::vec3(geom.transform[1]);
+			glm::vec3 c2 = glm::vec3(geom.transform[2]);
+			float s = glm::length(c0);
+			float eps = 1e-4f * s;
+			bool uniform = fabsf(glm::length(c1) - s) < eps
+				&& fabsf(glm::length(c2) - s) < eps
+				&& fabsf(glm::dot(c0, c1)) < eps * s
+				&& fabsf(glm::dot(c0, c2)) < eps * s
+				&& fabsf(glm::dot(c1, c2)) < eps * s;
+			if (uniform) {
+				geomsHot[i].leftBottom = glm::vec3(geom.transform[3]);
+				geomsHot[i].rightTop = glm::vec3(0.5f * s, 0.0f, 0.0f);
+			}
+			else {
+				geomsHot[i].rightTop = glm::vec3(-1.0f, 0.0f, 0.0f);
+			}
+		}
+		if (geom.type == PLANE) {
+			// Planes do not use the mesh AABB fields either: pack the
+			// world-space unit normal and the plane offset (the normal
+			// transforms by the inverse transpose, a point on the plane by
+			// the transform), so planeIntersectionTest is a direct
+			// point-normal test with no matrix work at all.
+			glm::vec3 n = glm::normalize(glm::vec3(geom.invTranspose * glm::vec4(0, 1, 0, 0)));
+			geomsHot[i].leftBottom = n;
+			geomsHot[i].rightTop = glm::vec3(glm::dot(n, glm::vec3(geom.transform[3])), 0.0f, 0.0f);
+		}
+		geomsCold[i].invTranspose = glm::mat3(geom.invTranspose);
+		geomsCold[i].materialid = geom.materialid;
+		bool listedLight = scene->materials[geom.materialid].emittance > 0.0f
+			&& geom.type != MESH && geom.type != PLANE;
+		geomsCold[i].lightArea = listedLight ? geomSurfaceArea(geom) : 0.0f;
+	}
+}
+
+#if DIRECT_LIGHTING_ENABLE
+// Flatten every emissive sphere/cube into the host light list, in geom
+// order. Shared by init and the per-frame animation update (which only
+// needs the refreshed transforms; translation leaves area and power - and
+// so the alias table - unchanged).
+static void flattenLights(Scene* scene, std::vector<Light>& lights) {
+	for (const Geom& geom : scene->geoms) {
+		const Material& m = scene->materials[geom.materialid];
+		// planes have no finite area to sample, so like meshes they stay
+		// off the NEE list and BSDF samples collect them at full weight
+		if (m.emittance <= 0.0f || geom.type == MESH || geom.type == PLANE) {
+			continue;
+		}
+		Light light;
+		light.type = geom.type;
+		light.transform = glm::mat4x3(geom.transform);
+		light.emittance = m.color * m.emittance;
+		light.area = geomSurfaceArea(geom);
+		lights.push_back(light);
+	}
+}
+
+// Flatten and upload the device light list and build the
+// power-proportional alias table over each light's luminance * area.
+// c_lightPowerTotal is uploaded either way so a re-init across queued jobs
+// clears the previous scene's. Re-entrant: material edits toggling
+// emittance change the listed-light set, so any previous buffers are
+// dropped first (a no-op on init, where freeSceneBuffers already ran).
+static void uploadLights(Scene* scene) {
+	cudaFree(dev_lights);
+	dev_lights = NULL;
+	cudaFree(dev_lightAliasProb);
+	dev_lightAliasProb = NULL;
+	cudaFree(dev_lightAliasIdx);
+	dev_lightAliasIdx = NULL;
+
+	std::vector<Light> lights;
+	flattenLights(scene, lights);
+	numLights = lights.size();
+	double totalPower = 0.0;
+	if (numLights > 0) {
+		deviceMalloc((void**)&dev_lights, numLights * sizeof(Light), "lights");
+		cudaMemcpy(dev_lights, lights.data(), numLights * sizeof(Light), cudaMemcpyHostToDevice);
+
+		std::vector<float> powers(numLights);
+		for (int i = 0; i < numLights; i++) {
+			float lum = glm::dot(lights[i].emittance, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+			powers[i] = lum * lights[i].area;
+			totalPower += powers[i];
+		}
+		std::vector<float> prob;
+		std::vector<int> alias;
+		buildAliasTable(powers, totalPower, prob, alias);
+		deviceMalloc((void**)&dev_lightAliasProb, numLights * sizeof(float), "light alias prob");
+		cudaMemcpy(dev_lightAliasProb, prob.data(), numLights * sizeof(float), cudaMemcpyHostToDevice);
+		deviceMalloc((void**)&dev_lightAliasIdx, numLights * sizeof(int), "light alias idx");
+		cudaMemcpy(dev_lightAliasIdx, alias.data(), numLights * sizeof(int), cudaMemcpyHostToDevice);
+		cudaMemcpyToSymbol(c_lightAliasProb, &dev_lightAliasProb, sizeof(dev_lightAliasProb));
+		cudaMemcpyToSymbol(c_lightAliasIdx, &dev_lightAliasIdx, sizeof(dev_lightAliasIdx));
+	}
+	float lightPowerTotal = (float)totalPower;
+	cudaMemcpyToSymbol(c_lightPowerTotal, &lightPowerTotal, sizeof(lightPowerTotal));
+}
+#endif // DIRECT_LIGHTING_ENABLE
+
+#if BLUE_NOISE_ENABLE
+// Build the BLUE_NOISE_TILE^2 two-channel blue-noise mask on the host,
+// void-and-cluster style: rank the cells by repeatedly taking the
+// lowest-energy empty one and splatting a toroidal gaussian around it, so
+// every prefix of the ranking is evenly spread over the tile. A touch of
+// white noise breaks ties and decorrelates the two channels. Built once
+// per process (a few milliseconds at tile 64) and shared by every device.
+static const std::vector<glm::vec2>& blueNoiseMaskHost() {
+	static std::vector<glm::vec2> mask;
+	if (!mask.empty()) {
+		return mask;
+	}
+	const int T = BLUE_NOISE_TILE;
+	const int N = T * T;
+	mask.resize(N);
+	const float sigma2 = 2.1f * 2.1f;
+	for (int channel = 0; channel < 2; channel++) {
+		std::vector<float> energy(N);
+		std::vector<bool> placed(N, false);
+		for (int i = 0; i < N; i++) {
+			energy[i] = 1e-4f * (float)(utilhash(i * 2 + channel) & 0xffff) / 65535.0f;
+		}
+		for (int rank = 0; rank < N; rank++) {
+			int best = -1;
+			for (int i = 0; i < N; i++) {
+				if (!placed[i] && (best < 0 || energy[i] < energy[best])) {
+					best = i;
+				}
+			}
+			placed[best] = true;
+			float v = ((float)rank + 0.5f) / (float)N;
+			if (channel == 0) {
+				mask[best].x = v;
+			}
+			else {
+				mask[best].y = v;
+			}
+			int bx = best % T;
+			int by = best / T;
+			for (int y = 0; y < T; y++) {
+				int dy = y - by < 0 ? by - y : y - by;
+				dy = dy > T / 2 ? T - dy : dy;
+				for (int x = 0; x < T; x++) {
+					int dx = x - bx < 0 ? bx - x : x - bx;
+					dx = dx > T / 2 ? T - dx : dx;
+					energy[y * T + x] += expf(-(float)(dx * dx + dy * dy) / sigma2);
+				}
+			}
+		}
+	}
+	return mask;
+}
+#endif // BLUE_NOISE_ENABLE
+
+#if GEOM_GRID_ENABLE
+// Decide between the TLAS and a uniform grid for the static partition and
+// build the grid when the scene earns it: a particle field - many static
+// geoms whose world AABB diagonals cluster around one size - walks a DDA
+// grid with no hierarchy divergence, while anything else (few geoms,
+// mixed scales) keeps the TLAS. Uploads c_gridActive either way, so a
+// re-init across queued jobs clears the previous scene's verdict.
+static void buildGeomGrid(Scene* scene) {
+	int active = 0;
+	bool hasPlane = false;
+	for (int i = 0; i < numStaticGeoms; i++) {
+		// an infinite plane has no meaningful grid cell span; its huge
+		// AABB would also wreck the diagonal statistics below
+		hasPlane = hasPlane || scene->geoms[i].type == PLANE;
+	}
+	if (!hasPlane && numStaticGeoms >= GEOM_GRID_MIN_GEOMS) {
+		std::vector<glm::vec3> boundsLo(numStaticGeoms);
+		std::vector<glm::vec3> boundsHi(numStaticGeoms);
+		glm::vec3 sceneLo(FLT_MAX);
+		glm::vec3 sceneHi(-FLT_MAX);
+		double diagSum = 0.0;
+		double diagSqSum = 0.0;
+		for (int i = 0; i < numStaticGeoms; i++) {
+			geomWorldBounds(scene->geoms[i], boundsLo[i], boundsHi[i]);
+			sceneLo = glm::min(sceneLo, boundsLo[i]);
+			sceneHi = glm::max(sceneHi, boundsHi[i]);
+			double diag = glm::length(boundsHi[i] - boundsLo[i]);
+			diagSum += diag;
+			diagSqSum += diag * diag;
+		}
+		double mean = diagSum / numStaticGeoms;
+		double var = glm::max(diagSqSum / numStaticGeoms - mean * mean, 0.0);
+		if (mean > 0.0 && sqrt(var) / mean <= GEOM_GRID_MAX_SPREAD) {
+			// cells near the common geom size, capped so pathological
+			// extents cannot blow the cell table up
+			glm::vec3 extent = glm::max(sceneHi - sceneLo, glm::vec3(EPSILON));
+			glm::ivec3 dims;
+			for (int a = 0; a < 3; a++) {
+				dims[a] = glm::clamp((int)ceilf(extent[a] / (float)mean), 1, 128);
+			}
+			glm::vec3 cellSize = extent / glm::vec3(dims);
+			int cells = dims.x * dims.y * dims.z;
+
+			// counting pass, prefix, fill: each geom lands in every cell
+			// its AABB overlaps, so a hit found in an early cell is never
+			// missed by a geom extending back into it
+			std::vector<int> cellStart(cells + 1, 0);
+			for (int i = 0; i < numStaticGeoms; i++) {
+				glm::ivec3 clo = glm::clamp(glm::ivec3((boundsLo[i] - sceneLo) / cellSize), glm::ivec3(0), dims - 1);
+				glm::ivec3 chi = glm::clamp(glm::ivec3((boundsHi[i] - sceneLo) / cellSize), glm::ivec3(0), dims - 1);
+				for (int z = clo.z; z <= chi.z; z++)
+					for (int y = clo.y; y <= chi.y; y++)
+						for (int x = clo.x; x <= chi.x; x++)
+							cellStart[(z * dims.y + y) * dims.x + x + 1]++;
+			}
+			for (int c = 0; c < cells; c++) {
+				cellStart[c + 1] += cellStart[c];
+			}
+			std::vector<int> items(cellStart[cells]);
+			std::vector<int> cursor(cellStart.begin(), cellStart.end() - 1);
+			for (int i = 0; i < numStaticGeoms; i++) {
+				glm::ivec3 clo = glm::clamp(glm::ivec3((boundsLo[i] - sceneLo) / cellSize), glm::ivec3(0), dims - 1);
+				glm::ivec3 chi = glm::clamp(glm::ivec3((boundsHi[i] - sceneLo) / cellSize), glm::ivec3(0), dims - 1);
+				for (int z = clo.z; z <= chi.z; z++)
+					for (int y = clo.y; y <= chi.y; y++)
+						for (int x = clo.x; x <= chi.x; x++)
+							items[cursor[(z * dims.y + y) * dims.x + x]++] = i;
+			}
+
+			deviceMalloc((void**)&dev_gridCellStart, (cells + 1) * sizeof(int), "grid cell starts");
+			cudaMemcpy(dev_gridCellStart, cellStart.data(), (cells + 1) * sizeof(int), cudaMemcpyHostToDevice);
+			deviceMalloc((void**)&dev_gridItems, items.size() * sizeof(int), "grid items");
+			cudaMemcpy(dev_gridItems, items.data(), items.size() * sizeof(int), cudaMemcpyHostToDevice);
+			glm::vec3 invCellSize = 1.0f / cellSize;
+			cudaMemcpyToSymbol(c_gridDims, &dims, sizeof(dims));
+			cudaMemcpyToSymbol(c_gridMin, &sceneLo, sizeof(sceneLo));
+			cudaMemcpyToSymbol(c_gridCellSize, &cellSize, sizeof(cellSize));
+			cudaMemcpyToSymbol(c_gridInvCellSize, &invCellSize, sizeof(invCellSize));
+			cudaMemcpyToSymbol(c_gridCellStart, &dev_gridCellStart, sizeof(dev_gridCellStart));
+			cudaMemcpyToSymbol(c_gridItems, &dev_gridItems, sizeof(dev_gridItems));
+			active = 1;
+			printf("geom grid: %dx%dx%d cells, %d entries over %d static geoms\n",
+				dims.x, dims.y, dims.z, (int)items.size(), numStaticGeoms);
+		}
+	}
+	cudaMemcpyToSymbol(c_gridActive, &active, sizeof(active));
+	checkCUDAError("buildGeomGrid");
+}
+#endif // GEOM_GRID_ENABLE
+
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+// (Re)build the per-tile candidate lists for the fused primary launch: one
+// four-plane frustum per TILE_CULL_SIZE^2 screen tile, tested against the
+// world AABBs of the static geoms (the moving tail keeps its TLAS pass, and
+// its sweep bounds would defeat the culling anyway). Host-side and a few
+// hundred geoms times a few thousand tiles, so it only runs where the
+// camera already forces a restart: init and pathtraceCameraResetDevice.
+static void buildTileCullLists(Scene* scene) {
+	const Camera& cam = scene->state.camera;
+	int tilesX = (cam.resolution.x + TILE_CULL_SIZE - 1) / TILE_CULL_SIZE;
+	int tilesY = (cam.resolution.y + TILE_CULL_SIZE - 1) / TILE_CULL_SIZE;
+	int tiles = tilesX * tilesY;
+	tileCullResX = cam.resolution.x;
+	tileCullResY = cam.resolution.y;
+
+	// the geoms were partitioned statics-first above, so geom index i in
+	// [0, numStaticGeoms) is scene->geoms[i] on the device too
+	std::vector<glm::vec3> boundsLo(numStaticGeoms);
+	std::vector<glm::vec3> boundsHi(numStaticGeoms);
+	for (int i = 0; i < numStaticGeoms; i++) {
+		geomWorldBounds(scene->geoms[i], boundsLo[i], boundsHi[i]);
+	}
+	// defocus widens the ray bundle by the lens: pad the plane test by the
+	// kernels' hard-coded lens radius so no in-focus geom is lost to the
+	// aperture. AA jitter is covered by the half-pixel margin on the tile
+	// corners below.
+	float pad = (camFeatures & CAM_FEATURE_DOF) ? 0.05f : 0.0f;
+
+	// a tile corner's (unnormalized) camera ray direction, the same formula
+	// generateOneCameraRay uses so the frustum brackets exactly what the
+	// kernel will trace
+	auto tileDir = [&cam](float fx, float fy) {
+		return cam.view
+			- cam.right * cam.pixelLength.x * ((float)cam.cropOffset.x + fx - (float)cam.fullResolution.x * 0.5f)
+			- cam.up * cam.pixelLength.y * ((float)cam.cropOffset.y + fy - (float)cam.fullResolution.y * 0.5f);
+	};
+
+	std::vector<int> lists((size_t)tiles * numStaticGeoms);
+	std::vector<int> counts(tiles);
+	for (int ty = 0; ty < tilesY; ty++) {
+		for (int tx = 0; tx < tilesX; tx++) {
+			// half a pixel past the outer pixel centers, so antialiasing
+			// jitter stays inside the frustum
+			float x0 = (float)(tx * TILE_CULL_SIZE) - 0.5f;
+			float x1 = (float)((tx + 1) * TILE_CULL_SIZE) - 0.5f;
+			float y0 = (float)(ty * TILE_CULL_SIZE) - 0.5f;
+			float y1 = (float)((ty + 1) * TILE_CULL_SIZE) - 0.5f;
+			glm::vec3 d00 = tileDir(x0, y0);
+			glm::vec3 d10 = tileDir(x1, y0);
+			glm::vec3 d01 = tileDir(x0, y1);
+			glm::vec3 d11 = tileDir(x1, y1);
+			glm::vec3 dc = tileDir(0.5f * (x0 + x1), 0.5f * (y0 + y1));
+			// side planes through the camera position, normals pointed
+			// into the frustum (flipped against the center direction so
+			// the orientation survives any handedness of the basis)
+			glm::vec3 planes[4] = {
+				glm::cross(d00, d10),
+				glm::cross(d10, d11),
+				glm::cross(d11, d01),
+				glm::cross(d01, d00),
+			};
+			for (int p = 0; p < 4; p++) {
+				if (glm::dot(planes[p], dc) < 0.0f) {
+					planes[p] = -planes[p];
+				}
+				planes[p] = glm::normalize(planes[p]);
+			}
+
+			int tileIdx = ty * tilesX + tx;
+			int* list = lists.data() + (size_t)tileIdx * numStaticGeoms;
+			int cnt = 0;
+			for (int i = 0; i < numStaticGeoms; i++) {
+				if (!(scene->geoms[i].visibility & VIS_CAMERA)) {
+					continue;
+				}
+				bool outside = false;
+				for (int p = 0; p < 4 && !outside; p++) {
+					// p-vertex test: the AABB corner farthest along the
+					// plane normal; if even that corner is behind the
+					// plane the whole box is outside the frustum
+					glm::vec3 n = planes[p];
+					glm::vec3 v(n.x > 0.0f ? boundsHi[i].x : boundsLo[i].x,
+						n.y > 0.0f ? boundsHi[i].y : boundsLo[i].y,
+						n.z > 0.0f ? boundsHi[i].z : boundsLo[i].z);
+					outside = glm::dot(n, v - cam.position) < -pad;
+				}
+				if (!outside) {
+					list[cnt++] = i;
+				}
+			}
+			counts[tileIdx] = cnt;
+		}
+	}
+	cudaMemcpy(dev_tileCullLists, lists.data(), lists.size() * sizeof(int), cudaMemcpyHostToDevice);
+	cudaMemcpy(dev_tileCullCounts, counts.data(), counts.size() * sizeof(int), cudaMemcpyHostToDevice);
+	checkCUDAError("buildTileCullLists");
+}
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+
+static void pathtraceInitDevice(Scene* scene) {
+	// re-entrant for the render queue: drop the previous job's scene (a
+	// no-op on the first call) and let the arena / streams / events below
+	// be reused wherever they already exist and still fit
+	freeSceneBuffers();
+
+	hst_scene = scene;
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+
+	arenaOffset = 0;
+	carvePixelBuffers(pixelcount);
+
+	// projected usage from scene stats, before committing to anything: the
+	// dry carve just measured the arena exactly, and the scene-sized
+	// buffers follow directly from the counts. Capacity planning for big
+	// scenes reads this line instead of trial and error.
+	{
+		size_t projected = arenaOffset
+			+ scene->triangles.size() * (sizeof(TriangleIdx) + 2 * sizeof(LBVHNode))
+			+ scene->vertices.size() * sizeof(glm::vec4)
+			+ scene->normals.size() * sizeof(PackedNormal)
+			+ scene->uvs.size() * sizeof(glm::vec2)
+			+ scene->geoms.size() * (sizeof(GeomHot) + sizeof(GeomCold) + 2 * sizeof(LBVHNode))
+			+ scene->materials.size() * sizeof(Material);
+		size_t freeBytes = 0, totalBytes = 0;
+		cudaMemGetInfo(&freeBytes, &totalBytes);
+		printf("projected device memory: %.2f MB (%.2f MB arena + %.2f MB scene), %.0f MB free\n",
+			projected / (1024.0 * 1024.0), arenaOffset / (1024.0 * 1024.0),
+			(projected - arenaOffset) / (1024.0 * 1024.0),
+			freeBytes / (1024.0 * 1024.0));
+		if (projected > freeBytes) {
+			fprintf(stderr, "warning: projected usage exceeds free device memory\n");
+		}
+	}
+
+	if (arenaCapacity < arenaOffset) {
+		cudaFree(dev_arena);
+		deviceMalloc((void**)&dev_arena, arenaOffset, "pixel arena");
+		arenaCapacity = arenaOffset;
+	}
+	arenaOffset = 0;
+	carvePixelBuffers(pixelcount);
+
+	cudaMemset(dev_image, 0, pixelcount * sizeof(glm::vec3));
+#if AOV_ENABLE
+	cudaMemset(dev_aovNormal, 0, pixelcount * sizeof(glm::vec3));
+	cudaMemset(dev_aovDepth, 0, pixelcount * sizeof(float));
+	cudaMemset(dev_aovAlbedo, 0, pixelcount * sizeof(glm::vec3));
+	cudaMemset(dev_aovDirect, 0, pixelcount * sizeof(glm::vec3));
+#endif // AOV_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+	cudaMemset(dev_tileDepthLum, 0, numDepthTiles * ADAPTIVE_DEPTH_BINS * sizeof(float));
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if HEATMAP_ENABLE
+	cudaMemset(dev_pixelBounceDepth, 0, pixelcount * sizeof(int));
+#endif // HEATMAP_ENABLE
+	// seed 0 on a single device (and on device 0) keeps the persistent lane
+	// sequences bit-identical to the single-GPU build; worker devices get a
+	// salt so their first samples do not duplicate device 0's
+	int rngLaneSeed = 0;
+#if MULTI_GPU_ENABLE
+	rngLaneSeed = multiGpuRngSalt;
+#endif // MULTI_GPU_ENABLE
+	int rngLanes = SPP_BATCH * pixelcount;
+	kernInitRNG << <(rngLanes + 127) / 128, 128 >> > (rngLanes, rngLaneSeed, dev_rngStates);
+
+#if MORTON_ORDER_ENABLE
+	{
+		// slot order = pixels sorted by the Morton code of (x, y). Ranking
+		// the sorted codes compacts the gaps a non-power-of-two resolution
+		// leaves in code space, so slots stay dense in [0, pixelcount)
+		std::vector<unsigned int> codes(pixelcount);
+		std::vector<int> order(pixelcount);
+		for (int y = 0; y < cam.resolution.y; y++) {
+			for (int x = 0; x < cam.resolution.x; x++) {
+				int i = x + y * cam.resolution.x;
+				codes[i] = (mortonPart1By1(y) << 1) | mortonPart1By1(x);
+				order[i] = i;
+			}
+		}
+		std::sort(order.begin(), order.end(),
+			[&codes](int a, int b) { return codes[a] < codes[b]; });
+		std::vector<int> pixelToSlot(pixelcount);
+		for (int slot = 0; slot < pixelcount; slot++) {
+			pixelToSlot[order[slot]] = slot;
+		}
+		cudaMemcpy(dev_pixelToSlot, pixelToSlot.data(), pixelcount * sizeof(int), cudaMemcpyHostToDevice);
+	}
+#endif // MORTON_ORDER_ENABLE
+
+#if STREAM_COMPACTION
+	if (host_pathCount == NULL) {
+		cudaHostAlloc(&host_pathCount, sizeof(int), cudaHostAllocDefault);
+		cudaEventCreateWithFlags(&pathCountEvent, cudaEventDisableTiming);
+	}
+#endif // STREAM_COMPACTION
+
+#if PATH_REGEN_ENABLE
+	// the iter == 1 camera pass starts every pixel's first sample
+	thrust::fill(thrust::device_pointer_cast(dev_pixelNextSample),
+		thrust::device_pointer_cast(dev_pixelNextSample) + pixelcount, 1);
+	cudaMemset(dev_pixelDoneSamples, 0, pixelcount * sizeof(int));
+#endif // PATH_REGEN_ENABLE
+
+#if FIREFLY_CLAMP_ENABLE
+	cudaMemset(dev_clampedEnergy, 0, pixelcount * sizeof(glm::vec3));
+#endif // FIREFLY_CLAMP_ENABLE
+
+#if DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+	cudaMemset(dev_denoiseNormals, 0, pixelcount * sizeof(glm::vec3));
+#endif // DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+
+#if TEMPORAL_REPROJECTION_ENABLE
+	cudaMemset(dev_reprojPositions, 0, pixelcount * sizeof(glm::vec4));
+#endif // TEMPORAL_REPROJECTION_ENABLE
+
+#if ADAPTIVE_SAMPLING
+	cudaMemset(dev_pixelMeans, 0, pixelcount * sizeof(float));
+	cudaMemset(dev_pixelM2s, 0, pixelcount * sizeof(float));
+	cudaMemset(dev_pixelSamples, 0, pixelcount * sizeof(int));
+	cudaMemset(dev_pixelConverged, 0, pixelcount * sizeof(int));
+#endif // ADAPTIVE_SAMPLING
+
+#if MULTI_GPU_ENABLE && MULTI_GPU_PEER_GEOM_ENABLE
+	if (peerGeom.active) {
+		// adopt the peer-resident pools (setupPeerGeom). No texture
+		// objects over them: another device's memory cannot back one,
+		// which is why this mode forces POOL_TEX_ENABLE off; zero handles
+		// keep the constant bank well-defined anyway.
+		dev_triangles = peerGeom.triangles;
+		dev_vertices = peerGeom.vertices;
+		dev_normals = peerGeom.normals;
+		if (texVertices) {
+			cudaDestroyTextureObject(texVertices);
+			texVertices = 0;
+		}
+		if (texNormals) {
+			cudaDestroyTextureObject(texNormals);
+			texNormals = 0;
+		}
+		cudaMemcpyToSymbol(c_texVertices, &texVertices, sizeof(texVertices));
+		cudaMemcpyToSymbol(c_texNormals, &texNormals, sizeof(texNormals));
+	}
+	else
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+	{
+		deviceMallocStreamable((void**)&dev_triangles, scene->triangles.size() * sizeof(TriangleIdx), "triangles");
+		uploadChunked(dev_triangles, scene->triangles.data(), scene->triangles.size() * sizeof(TriangleIdx));
+		deviceMallocStreamable((void**)&dev_vertices, scene->vertices.size() * sizeof(glm::vec4), "vertices");
+		uploadChunked(dev_vertices, scene->vertices.data(), scene->vertices.size() * sizeof(glm::vec4));
+		// the normal pool uploads through the packed format (sceneStructs.h);
+		// the host copy stays vec4 for the G-buffer rasterizer. Packing runs
+		// while the triangle and vertex transfers drain on the copy stream.
+		std::vector<PackedNormal> packedNormals(scene->normals.size());
+		for (size_t i = 0; i < scene->normals.size(); i++) {
+			packedNormals[i] = packNormal(glm::vec3(scene->normals[i]));
+		}
+		deviceMallocStreamable((void**)&dev_normals, scene->normals.size() * sizeof(PackedNormal), "normals");
+		uploadChunked(dev_normals, packedNormals.data(), scene->normals.size() * sizeof(PackedNormal));
+		// rebind the pool textures to the freshly (re)allocated buffers and
+		// mirror the handles into this device's constant bank
+		if (texVertices) {
+			cudaDestroyTextureObject(texVertices);
+		}
+		texVertices = makeLinearFloat4Tex(dev_vertices, scene->vertices.size() * sizeof(glm::vec4));
+		if (texNormals) {
+			cudaDestroyTextureObject(texNormals);
+		}
+		texNormals = makeLinearNormalTex(dev_normals, scene->normals.size() * sizeof(PackedNormal));
+		cudaMemcpyToSymbol(c_texVertices, &texVertices, sizeof(texVertices));
+		cudaMemcpyToSymbol(c_texNormals, &texNormals, sizeof(texNormals));
+	}
+
+#if ALBEDO_TEX_ENABLE
+	// texcoord pool, uploaded only when the scene has textured materials;
+	// a null pointer / zero handle makes fetchUv answer (0, 0)
+#if MULTI_GPU_ENABLE && MULTI_GPU_PEER_GEOM_ENABLE
+	if (peerGeom.active) {
+		dev_uvs = peerGeom.uvs;
+		if (texUvs) {
+			cudaDestroyTextureObject(texUvs);
+			texUvs = 0;
+		}
+	}
+	else
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+	{
+		if (!scene->textures.empty() && !scene->uvs.empty()) {
+			deviceMallocStreamable((void**)&dev_uvs, scene->uvs.size() * sizeof(glm::vec2), "uvs");
+			uploadChunked(dev_uvs, scene->uvs.data(), scene->uvs.size() * sizeof(glm::vec2));
+		}
+		if (texUvs) {
+			cudaDestroyTextureObject(texUvs);
+			texUvs = 0;
+		}
+		texUvs = makeLinearFloat2Tex(dev_uvs, dev_uvs != NULL ? scene->uvs.size() * sizeof(glm::vec2) : 0);
+	}
+	cudaMemcpyToSymbol(c_uvs, &dev_uvs, sizeof(dev_uvs));
+	cudaMemcpyToSymbol(c_texUvs, &texUvs, sizeof(texUvs));
+#endif // ALBEDO_TEX_ENABLE
+
+	// partition the geoms so the (usually dominant) static ones are contiguous
+	// at the front; intersection then runs a branch-free static pass plus a
+	// motion-blur pass only over the moving tail
+	std::stable_partition(scene->geoms.begin(), scene->geoms.end(),
+		[](const Geom& geom) { return !geom.moving; });
+	numStaticGeoms = 0;
+	for (const Geom& geom : scene->geoms) {
+		if (!geom.moving) {
+			numStaticGeoms++;
+		}
+	}
+	numMovingGeoms = scene->geoms.size() - numStaticGeoms;
+
+	// the #defines above are the job defaults; motion blur additionally
+	// follows the scene, so a job with animated geoms gets it from the same
+	// binary and a static scene never pays for the per-ray time draw
+	camFeatures = (ANTIALIASING ? CAM_FEATURE_AA : 0)
+		| (DEPTH_OF_FIELD_ENABLE ? CAM_FEATURE_DOF : 0)
+		| (MOTION_BLUR_ENABLE ? CAM_FEATURE_MOTION_BLUR : 0);
+	if (numMovingGeoms > 0) {
+		camFeatures |= CAM_FEATURE_MOTION_BLUR;
+	}
+
+#if MESH_LOD_ENABLE
+	// level thresholds fall 4x per step to mirror the compiler's roughly
+	// quarter-resolution levels; the chain holds the full range at [0], so
+	// re-running selection on re-init stays idempotent
+	for (Geom& geom : scene->geoms) {
+		if (geom.type != MESH || geom.numLods <= 1) {
+			continue;
+		}
+		glm::vec3 lo, hi;
+		geomWorldBounds(geom, lo, hi);
+		float diag = glm::length(hi - lo);
+		float dist = glm::length(0.5f * (lo + hi) - cam.position);
+		dist = glm::max(dist - 0.5f * diag, (float)EPSILON);
+		float pixels = diag / (dist * cam.pixelLength.y);
+		int level = pixels > 256.0f ? 0 : (pixels > 64.0f ? 1 : 2);
+		if (level >= geom.numLods) {
+			level = geom.numLods - 1;
+		}
+		geom.startIndex = geom.lodStart[level];
+		geom.endIndex = geom.lodEnd[level];
+		geom.bvhRoot = geom.lodRoot[level];
+	}
+#endif // MESH_LOD_ENABLE
+
+#if RAY_SORT_ENABLE || PATH_GUIDING_ENABLE || DEFERRED_SHADOW_ENABLE
+	{
+		// world bounds of the whole scene, for quantizing ray origins into
+		// sort cells and hit points into guiding cells; moving geoms
+		// already report their full sweep
+		glm::vec3 sceneMax;
+		sceneBoundsMin = glm::vec3(FLT_MAX);
+		sceneMax = glm::vec3(-FLT_MAX);
+		for (const Geom& geom : scene->geoms) {
+			if (geom.type == PLANE) {
+				// an infinite backdrop would flatten the quantization to
+				// one cell; points beyond the finite bounds just clamp
+				continue;
+			}
+			glm::vec3 lo, hi;
+			geomWorldBounds(geom, lo, hi);
+			sceneBoundsMin = glm::min(sceneBoundsMin, lo);
+			sceneMax = glm::max(sceneMax, hi);
+		}
+		sceneBoundsInvExtent = 1.0f / glm::max(sceneMax - sceneBoundsMin, glm::vec3(EPSILON));
+	}
+#endif // RAY_SORT_ENABLE || PATH_GUIDING_ENABLE || DEFERRED_SHADOW_ENABLE
+
+	// the device-side BVH build below reads the triangle and vertex pools;
+	// everything since the uploadChunked calls ran against the in-flight
+	// transfers, which end here
+	uploadWait();
+
+#if LBVH_ENABLE
+	int numBvhNodes = 0;
+#if MULTI_GPU_ENABLE && MULTI_GPU_PEER_GEOM_ENABLE
+	if (peerGeom.active && peerGeom.bvhShared) {
+		// an earlier device's pass already built the shared trees over the
+		// peer-resident triangles (the build permutes them, so it must run
+		// exactly once); adopt its pools and restore the post-build
+		// geom.bvhRoot values, which the LOD reselect above just reset
+		dev_bvhNodes = peerGeom.bvhNodes;
+		for (size_t i = 0; i < scene->geoms.size(); i++) {
+			scene->geoms[i].bvhRoot = peerGeomBvhRoots[i];
+		}
+#if BVH8_ENABLE
+		dev_bvh8Nodes = peerGeom.bvh8Nodes;
+		cudaMemcpyToSymbol(c_bvh8Nodes, &dev_bvh8Nodes, sizeof(dev_bvh8Nodes));
+#endif // BVH8_ENABLE
+	}
+	else
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+	if (!scene->bvhNodes.empty()) {
+		// offline SAH trees from a packed scene: already in device layout
+		// with geom.bvhRoot set and the triangle order baked in, so this
+		// is upload-and-go
+		numBvhNodes = (int)scene->bvhNodes.size();
+		deviceMallocStreamable((void**)&dev_bvhNodes, numBvhNodes * sizeof(LBVHNode), "bvh nodes");
+		cudaMemcpy(dev_bvhNodes, scene->bvhNodes.data(),
+			numBvhNodes * sizeof(LBVHNode), cudaMemcpyHostToDevice);
+	}
+	else {
+		// build one LBVH per mesh geom over dev_triangles before uploading geoms,
+		// so each geom's bvhRoot makes it to the device copy
+		numBvhNodes = countLBVHNodes(scene->geoms);
+		if (numBvhNodes > 0) {
+			deviceMallocStreamable((void**)&dev_bvhNodes, numBvhNodes * sizeof(LBVHNode), "bvh nodes");
+			int nodeOffset = 0;
+			// instanced meshes share a triangle range; build its tree once
+			// and point every instance's bvhRoot at it (rebuilding would
+			// also re-sort the range out from under the first tree)
+			std::map<int, int> builtRoots;
+			for (Geom& geom : scene->geoms) {
+				if (geom.type == MESH) {
+					std::map<int, int>::iterator built = builtRoots.find(geom.startIndex);
+					if (built != builtRoots.end()) {
+						geom.bvhRoot = built->second;
+					}
+					else {
+						nodeOffset += buildMeshLBVH(dev_triangles, dev_vertices, geom, dev_bvhNodes, nodeOffset);
+						builtRoots[geom.startIndex] = geom.bvhRoot;
+					}
+				}
+			}
+		}
+	}
+#if BVH8_ENABLE
+	// collapse the binary per-mesh trees into the 8-wide quantized layout;
+	// runs on the host once per init. Each mesh's bvhRoot is repointed at
+	// the wide pool before the hot geoms are built below, and the binary
+	// nodes are dropped - traversal reads only c_bvh8Nodes
+	if (numBvhNodes > 0) {
+		std::vector<LBVHNode> binaryNodes(numBvhNodes);
+		cudaMemcpy(binaryNodes.data(), dev_bvhNodes, numBvhNodes * sizeof(LBVHNode), cudaMemcpyDeviceToHost);
+		std::vector<BVH8Node> wideNodes;
+		std::map<int, int> wideRoots;
+		for (Geom& geom : scene->geoms) {
+			if (geom.type == MESH) {
+				std::map<int, int>::iterator wide = wideRoots.find(geom.bvhRoot);
+				if (wide == wideRoots.end()) {
+					wide = wideRoots.insert(std::make_pair(geom.bvhRoot,
+						buildBVH8(binaryNodes, geom.bvhRoot, wideNodes))).first;
+				}
+				geom.bvhRoot = wide->second;
+			}
+		}
+		deviceMallocStreamable((void**)&dev_bvh8Nodes, wideNodes.size() * sizeof(BVH8Node), "bvh8 nodes");
+		cudaMemcpy(dev_bvh8Nodes, wideNodes.data(), wideNodes.size() * sizeof(BVH8Node), cudaMemcpyHostToDevice);
+		cudaMemcpyToSymbol(c_bvh8Nodes, &dev_bvh8Nodes, sizeof(dev_bvh8Nodes));
+		cudaFree(dev_bvhNodes);
+		dev_bvhNodes = NULL;
+	}
+#endif // BVH8_ENABLE
+#if MULTI_GPU_ENABLE && MULTI_GPU_PEER_GEOM_ENABLE
+	if (peerGeom.active && !peerGeom.bvhShared) {
+		// publish this pass's trees (binary or wide) and the remapped
+		// geom.bvhRoot values for the device passes that follow
+		cudaGetDevice(&peerGeom.bvhDevice);
+		peerGeom.bvhNodes = dev_bvhNodes;
+		peerGeom.bvh8Nodes = dev_bvh8Nodes;
+		peerGeomBvhRoots.resize(scene->geoms.size());
+		for (size_t i = 0; i < scene->geoms.size(); i++) {
+			peerGeomBvhRoots[i] = scene->geoms[i].bvhRoot;
+		}
+		peerGeom.bvhShared = true;
+	}
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+#endif // LBVH_ENABLE
+
+#if TLAS_ENABLE
+	// one top-level BVH per partition; leaf indices are relative to the
+	// partition, matching the geom pointer each intersection pass receives
+	std::vector<Geom> staticGeoms(scene->geoms.begin(), scene->geoms.begin() + numStaticGeoms);
+	std::vector<LBVHNode> tlasNodes;
+	tlasRoot = buildGeomTLAS(staticGeoms, tlasNodes);
+	deviceMalloc((void**)&dev_tlasNodes, tlasNodes.size() * sizeof(LBVHNode), "tlas nodes");
+	cudaMemcpy(dev_tlasNodes, tlasNodes.data(), tlasNodes.size() * sizeof(LBVHNode), cudaMemcpyHostToDevice);
+
+	if (numMovingGeoms > 0) {
+		std::vector<Geom> movingGeoms(scene->geoms.begin() + numStaticGeoms, scene->geoms.end());
+		std::vector<LBVHNode> movingTlasNodes;
+		movingTlasRoot = buildGeomTLAS(movingGeoms, movingTlasNodes);
+		deviceMalloc((void**)&dev_movingTlasNodes, movingTlasNodes.size() * sizeof(LBVHNode), "moving tlas nodes");
+		cudaMemcpy(dev_movingTlasNodes, movingTlasNodes.data(), movingTlasNodes.size() * sizeof(LBVHNode), cudaMemcpyHostToDevice);
+	}
+#endif // TLAS_ENABLE
+
+	std::vector<GeomHot> geomsHot;
+	std::vector<GeomCold> geomsCold;
+	buildGeomSplit(scene, geomsHot, geomsCold);
+	deviceMalloc((void**)&dev_geomsHot, geomsHot.size() * sizeof(GeomHot), "geoms hot");
+	cudaMemcpy(dev_geomsHot, geomsHot.data(), geomsHot.size() * sizeof(GeomHot), cudaMemcpyHostToDevice);
+	deviceMalloc((void**)&dev_geomsCold, geomsCold.size() * sizeof(GeomCold), "geoms cold");
+	cudaMemcpy(dev_geomsCold, geomsCold.data(), geomsCold.size() * sizeof(GeomCold), cudaMemcpyHostToDevice);
+
+#if PROXY_BOUNCE_ENABLE
+	{
+		// second hot table for the deep bounces: every compiled-LOD mesh
+		// pinned to its coarsest level, whatever the projected-size pick
+		// above wrote into the primary table. Skipped entirely (NULL) when
+		// no geom carries a chain, so plain scenes pay nothing.
+		std::vector<GeomHot> geomsHotProxy = geomsHot;
+		int proxied = 0;
+		for (size_t i = 0; i < scene->geoms.size(); i++) {
+			const Geom& geom = scene->geoms[i];
+			if (geom.type == MESH && geom.numLods > 1) {
+				int coarse = geom.numLods - 1;
+				geomsHotProxy[i].startIndex = geom.lodStart[coarse];
+				geomsHotProxy[i].endIndex = geom.lodEnd[coarse];
+				geomsHotProxy[i].bvhRoot = geom.lodRoot[coarse];
+				proxied++;
+			}
+		}
+		if (proxied > 0) {
+			deviceMalloc((void**)&dev_geomsHotProxy, geomsHotProxy.size() * sizeof(GeomHot), "geoms hot proxy");
+			cudaMemcpy(dev_geomsHotProxy, geomsHotProxy.data(),
+				geomsHotProxy.size() * sizeof(GeomHot), cudaMemcpyHostToDevice);
+		}
+	}
+#endif // PROXY_BOUNCE_ENABLE
+
+#if GEOM_GRID_ENABLE
+	buildGeomGrid(scene);
+#endif // GEOM_GRID_ENABLE
+
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	{
+		int tiles = ((cam.resolution.x + TILE_CULL_SIZE - 1) / TILE_CULL_SIZE)
+			* ((cam.resolution.y + TILE_CULL_SIZE - 1) / TILE_CULL_SIZE);
+		deviceMalloc((void**)&dev_tileCullLists, (size_t)tiles * numStaticGeoms * sizeof(int), "tile cull lists");
+		deviceMalloc((void**)&dev_tileCullCounts, tiles * sizeof(int), "tile cull counts");
+		buildTileCullLists(scene);
+	}
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+
+#if ALBEDO_TEX_ENABLE
+	// albedo maps first, so the upload copy of the materials can carry this
+	// device's bindless handles; the lod heuristic scale is the camera's
+	// angular pixel size
+	for (size_t i = 0; i < scene->textures.size(); i++) {
+		cudaMipmappedArray_t mipArray = NULL;
+		albedoTextures.push_back(makeAlbedoTex(scene->textures[i].pixels.data(),
+			scene->textures[i].width, scene->textures[i].height, mipArray));
+		albedoArrays.push_back(mipArray);
+	}
+	std::vector<Material> patchedMaterials = scene->materials;
+	for (size_t i = 0; i < patchedMaterials.size(); i++) {
+		int texId = patchedMaterials[i].albedoTexId;
+		if (texId > 0 && (size_t)texId <= albedoTextures.size()) {
+			patchedMaterials[i].albedoTex = albedoTextures[texId - 1];
+			patchedMaterials[i].albedoMaxLod =
+				log2f((float)glm::max(scene->textures[texId - 1].width, 1));
+		}
+	}
+	float albedoLodScale = glm::min(cam.pixelLength.x, cam.pixelLength.y);
+	cudaMemcpyToSymbol(c_albedoLodScale, &albedoLodScale, sizeof(albedoLodScale));
+	deviceMalloc((void**)&dev_materials, scene->materials.size() * sizeof(Material), "materials");
+	cudaMemcpy(dev_materials, patchedMaterials.data(), scene->materials.size() * sizeof(Material), cudaMemcpyHostToDevice);
+#else
+	deviceMalloc((void**)&dev_materials, scene->materials.size() * sizeof(Material), "materials");
+	cudaMemcpy(dev_materials, scene->materials.data(), scene->materials.size() * sizeof(Material), cudaMemcpyHostToDevice);
+#endif // ALBEDO_TEX_ENABLE
+	if (texMaterials) {
+		cudaDestroyTextureObject(texMaterials);
+	}
+	texMaterials = makeLinearFloat4Tex(dev_materials, scene->materials.size() * sizeof(Material));
+	cudaMemcpyToSymbol(c_texMaterials, &texMaterials, sizeof(texMaterials));
+#if SHARED_MATERIALS_ENABLE
+	{
+		int numMaterials = (int)scene->materials.size();
+		cudaMemcpyToSymbol(c_numMaterials, &numMaterials, sizeof(numMaterials));
+	}
+#endif // SHARED_MATERIALS_ENABLE
+
+#if IMPORTANCE_MAP_ENABLE
+	if (!scene->importanceMap.empty()) {
+		deviceMalloc((void**)&dev_importance, scene->importanceMap.size() * sizeof(float), "importance map");
+		cudaMemcpy(dev_importance, scene->importanceMap.data(),
+			scene->importanceMap.size() * sizeof(float), cudaMemcpyHostToDevice);
+		glm::ivec2 dims(scene->importanceWidth, scene->importanceHeight);
+		cudaMemcpyToSymbol(c_importanceDims, &dims, sizeof(dims));
+	}
+	// NULL for scenes without a map, which keeps the tolerance uniform
+	cudaMemcpyToSymbol(c_importance, &dev_importance, sizeof(dev_importance));
+#endif // IMPORTANCE_MAP_ENABLE
+
+#if DIRECT_LIGHTING_ENABLE
+	uploadLights(scene);
+#endif // DIRECT_LIGHTING_ENABLE
+
+#if VOLUME_ENABLE
+	{
+		// homogeneous medium coefficients, uploaded even for scenes without
+		// a MEDIUM block so a re-init across queued jobs clears the previous
+		// scene's; zero mean extinction turns every volume branch off
+		glm::vec3 mediumSigmaT = scene->medium.sigmaS + scene->medium.sigmaA;
+		float mediumSigmaTBar = (mediumSigmaT.x + mediumSigmaT.y + mediumSigmaT.z) / 3.0f;
+		cudaMemcpyToSymbol(c_mediumSigmaS, &scene->medium.sigmaS, sizeof(glm::vec3));
+		cudaMemcpyToSymbol(c_mediumSigmaT, &mediumSigmaT, sizeof(glm::vec3));
+		cudaMemcpyToSymbol(c_mediumSigmaTBar, &mediumSigmaTBar, sizeof(float));
+		cudaMemcpyToSymbol(c_mediumG, &scene->medium.g, sizeof(float));
+	}
+#endif // VOLUME_ENABLE
+
+#if PATH_GUIDING_ENABLE
+	{
+		// guiding grid, zeroed per job: the learned flux is scene (and
+		// view) state, not worth carrying across the render queue. The
+		// grid bounds reuse the scene AABB computed above.
+		size_t guideBytes = (size_t)GUIDE_NUM_CELLS * GUIDE_DIR_BINS * sizeof(float);
+		deviceMalloc((void**)&dev_guideFlux, guideBytes, "guide flux");
+		deviceMalloc((void**)&dev_guideAccum, guideBytes, "guide accum");
+		deviceMalloc((void**)&dev_guideCellFlux, GUIDE_NUM_CELLS * sizeof(float), "guide cell flux");
+		cudaMemset(dev_guideFlux, 0, guideBytes);
+		cudaMemset(dev_guideAccum, 0, guideBytes);
+		cudaMemset(dev_guideCellFlux, 0, GUIDE_NUM_CELLS * sizeof(float));
+		cudaMemcpyToSymbol(c_guideFlux, &dev_guideFlux, sizeof(dev_guideFlux));
+		cudaMemcpyToSymbol(c_guideAccum, &dev_guideAccum, sizeof(dev_guideAccum));
+		cudaMemcpyToSymbol(c_guideCellFlux, &dev_guideCellFlux, sizeof(dev_guideCellFlux));
+		cudaMemcpyToSymbol(c_guideGridMin, &sceneBoundsMin, sizeof(sceneBoundsMin));
+		cudaMemcpyToSymbol(c_guideGridInvExtent, &sceneBoundsInvExtent, sizeof(sceneBoundsInvExtent));
+	}
+#endif // PATH_GUIDING_ENABLE
+
+#if ADAPTIVE_DEPTH_ENABLE
+	{
+		int tileCols = (cam.resolution.x + ADAPTIVE_DEPTH_TILE - 1) / ADAPTIVE_DEPTH_TILE;
+		cudaMemcpyToSymbol(c_tileDepthLum, &dev_tileDepthLum, sizeof(dev_tileDepthLum));
+		cudaMemcpyToSymbol(c_tileDepthBudget, &dev_tileDepthBudget, sizeof(dev_tileDepthBudget));
+		cudaMemcpyToSymbol(c_depthTileCols, &tileCols, sizeof(tileCols));
+		cudaMemcpyToSymbol(c_depthTileResX, &cam.resolution.x, sizeof(int));
+	}
+#endif // ADAPTIVE_DEPTH_ENABLE
+
+	// environment map: upload the texels, build the luminance alias table
+	// and per-texel solid-angle pdf host-side, and mirror everything into
+	// the constant bank. c_envMapSize is uploaded even for scenes without a
+	// map so a re-init across queued jobs clears the previous scene's.
+	envMapTexels = scene->envMapWidth * scene->envMapHeight;
+	if (envMapTexels > 0) {
+		int w = scene->envMapWidth;
+		int h = scene->envMapHeight;
+		deviceMalloc((void**)&dev_envMap, envMapTexels * sizeof(glm::vec4), "env map");
+		cudaMemcpy(dev_envMap, scene->envMap.data(), envMapTexels * sizeof(glm::vec4), cudaMemcpyHostToDevice);
+		if (texEnvMap) {
+			cudaDestroyTextureObject(texEnvMap);
+		}
+		texEnvMap = makeLinearFloat4Tex(dev_envMap, envMapTexels * sizeof(glm::vec4));
+		cudaMemcpyToSymbol(c_texEnvMap, &texEnvMap, sizeof(texEnvMap));
+
+		// texel weight: luminance scaled by the row's sin(theta), since
+		// equirect texels near the poles cover less solid angle
+		std::vector<float> weights(envMapTexels);
+		double total = 0.0;
+		for (int y = 0; y < h; y++) {
+			float sinTheta = sinf(PI * (y + 0.5f) / h);
+			for (int x = 0; x < w; x++) {
+				const glm::vec4& c = scene->envMap[y * w + x];
+				float lum = 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+				weights[y * w + x] = lum * sinTheta;
+				total += weights[y * w + x];
+			}
+		}
+		// solid-angle pdf of each texel: its selection probability over the
+		// solid angle it covers
+		std::vector<float> pdf(envMapTexels);
+		for (int y = 0; y < h; y++) {
+			float dOmega = (TWO_PI / w) * (PI / h) * sinf(PI * (y + 0.5f) / h);
+			for (int x = 0; x < w; x++) {
+				int i = y * w + x;
+				pdf[i] = total > 0.0 ? (float)(weights[i] / total) / dOmega : 0.0f;
+			}
+		}
+		std::vector<float> prob;
+		std::vector<int> alias;
+		buildAliasTable(weights, total, prob, alias);
+
+		deviceMalloc((void**)&dev_envAliasProb, envMapTexels * sizeof(float), "env alias prob");
+		cudaMemcpy(dev_envAliasProb, prob.data(), envMapTexels * sizeof(float), cudaMemcpyHostToDevice);
+		deviceMalloc((void**)&dev_envAliasIdx, envMapTexels * sizeof(int), "env alias idx");
+		cudaMemcpy(dev_envAliasIdx, alias.data(), envMapTexels * sizeof(int), cudaMemcpyHostToDevice);
+		deviceMalloc((void**)&dev_envPdf, envMapTexels * sizeof(float), "env pdf");
+		cudaMemcpy(dev_envPdf, pdf.data(), envMapTexels * sizeof(float), cudaMemcpyHostToDevice);
+		cudaMemcpyToSymbol(c_envAliasProb, &dev_envAliasProb, sizeof(dev_envAliasProb));
+		cudaMemcpyToSymbol(c_envAliasIdx, &dev_envAliasIdx, sizeof(dev_envAliasIdx));
+		cudaMemcpyToSymbol(c_envPdf, &dev_envPdf, sizeof(dev_envPdf));
+	}
+	int2 envSize = make_int2(scene->envMapWidth, scene->envMapHeight);
+	cudaMemcpyToSymbol(c_envMapSize, &envSize, sizeof(envSize));
+	float envSelectProb = numLights > 0 ? 0.5f : 1.0f;
+	cudaMemcpyToSymbol(c_envSelectProb, &envSelectProb, sizeof(envSelectProb));
+#if PORTAL_SAMPLING_ENABLE
+	{
+		int numPortals = (int)scene->portals.size();
+		if (numPortals > PORTAL_MAX_COUNT) {
+			fprintf(stderr, "PORTAL: scene marks %d portals, constant bank holds %d; extras ignored\n",
+				numPortals, PORTAL_MAX_COUNT);
+			numPortals = PORTAL_MAX_COUNT;
+		}
+		float portalAreaTotal = 0.0f;
+		for (int i = 0; i < numPortals; i++) {
+			portalAreaTotal += scene->portals[i].area;
+		}
+		if (numPortals > 0) {
+			cudaMemcpyToSymbol(c_portals, scene->portals.data(), numPortals * sizeof(Portal));
+		}
+		cudaMemcpyToSymbol(c_numPortals, &numPortals, sizeof(numPortals));
+		cudaMemcpyToSymbol(c_portalAreaTotal, &portalAreaTotal, sizeof(portalAreaTotal));
+	}
+#endif // PORTAL_SAMPLING_ENABLE
+
+#if BLUE_NOISE_ENABLE
+	// blue-noise shift mask for the early-iteration sampling overlay
+	if (dev_blueNoiseMask == NULL) {
+		const std::vector<glm::vec2>& mask = blueNoiseMaskHost();
+		deviceMalloc((void**)&dev_blueNoiseMask, mask.size() * sizeof(glm::vec2), "blue noise mask");
+		cudaMemcpy(dev_blueNoiseMask, mask.data(), mask.size() * sizeof(glm::vec2), cudaMemcpyHostToDevice);
+	}
+	cudaMemcpyToSymbol(c_blueNoiseMask, &dev_blueNoiseMask, sizeof(dev_blueNoiseMask));
+	cudaMemcpyToSymbol(c_blueNoiseResX, &cam.resolution.x, sizeof(int));
+#endif // BLUE_NOISE_ENABLE
+#if TERMINATE_GATHER_ENABLE
+	// mirror this carve's accumulation handles for the inline kill-site flush
+	cudaMemcpyToSymbol(c_accumImage, &dev_image, sizeof(dev_image));
+#if AOV_ENABLE
+	cudaMemcpyToSymbol(c_aovDirect, &dev_aovDirect, sizeof(dev_aovDirect));
+#endif // AOV_ENABLE
+#if FIREFLY_CLAMP_ENABLE
+	cudaMemcpyToSymbol(c_clampedEnergyBank, &dev_clampedEnergy, sizeof(dev_clampedEnergy));
+#endif // FIREFLY_CLAMP_ENABLE
+#endif // TERMINATE_GATHER_ENABLE
+#if PATH_REGEN_ENABLE
+	// sampler-state mirror for the bounce dimensions' stratum enumeration
+	cudaMemcpyToSymbol(c_pixelNextSample, &dev_pixelNextSample, sizeof(dev_pixelNextSample));
+#endif // PATH_REGEN_ENABLE
+#if SPP_BATCH > 1
+	cudaMemcpyToSymbol(c_pixelcount, &pixelcount, sizeof(pixelcount));
+#endif // SPP_BATCH
+#if MATERIAL_DEPTH_BUDGET_ENABLE
+	const int specularDepthCap = scene->state.traceDepth + SPECULAR_EXTRA_DEPTH;
+	cudaMemcpyToSymbol(c_specularDepthCap, &specularDepthCap, sizeof(specularDepthCap));
+#endif // MATERIAL_DEPTH_BUDGET_ENABLE
+#if KERNEL_PROFILE_ENABLE
+	// the region counters accumulate from here until the next init
+	unsigned long long kprofZeros[KPROF_REGION_COUNT] = {};
+	cudaMemcpyToSymbol(d_kprofCycles, kprofZeros, sizeof(kprofZeros));
+	cudaMemcpyToSymbol(d_kprofVisits, kprofZeros, sizeof(kprofZeros));
+#endif // KERNEL_PROFILE_ENABLE
+
+	// TODO: initialize any extra device memeory you need
+
+	if (computeStream == NULL) {
+		cudaStreamCreate(&computeStream);
+		cudaStreamCreate(&displayStream);
+		cudaEventCreateWithFlags(&gatherDone, cudaEventDisableTiming);
+		cudaEventCreateWithFlags(&imageStageDone, cudaEventDisableTiming);
+		tuneLaunchSizes();
+	}
+	// re-staged per job: the resolution can differ between queued scenes
+	cudaFreeHost(host_imageStage);
+	cudaHostAlloc(&host_imageStage, pixelcount * sizeof(glm::vec3), cudaHostAllocDefault);
+
+	printf("device memory in use:\n");
+	reportDeviceAllocs(stdout);
+
+	checkCUDAError("pathtraceInit");
+}
+
+void pathtraceInit(Scene* scene) {
+#if MULTI_GPU_ENABLE
+	cudaGetDeviceCount(&numDevices);
+	if (numDevices > MULTI_GPU_MAX_DEVICES) {
+		numDevices = MULTI_GPU_MAX_DEVICES;
+	}
+	if (numDevices < 1) {
+		numDevices = 1;
+	}
+#if MULTI_GPU_PEER_GEOM_ENABLE
+	setupPeerGeom(scene);
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+	// walk the devices high to low so the loop ends with device 0 - the
+	// primary, whose state the display and readback paths read - loaded
+	for (int d = numDevices - 1; d >= 0; d--) {
+		cudaSetDevice(d);
+		loadDeviceState(deviceStates[d]);
+		multiGpuRngSalt = d * 7919;
+		pathtraceInitDevice(scene);
+		saveDeviceState(deviceStates[d]);
+	}
+	loadDeviceState(deviceStates[0]);
+
+#if MULTI_GPU_STEAL_ENABLE
+	for (int d = 0; d < numDevices; d++) {
+		if (stealDone[d] == NULL) {
+			cudaSetDevice(d);
+			cudaEventCreateWithFlags(&stealDone[d], cudaEventDisableTiming);
+		}
+	}
+	cudaSetDevice(0);
+#endif // MULTI_GPU_STEAL_ENABLE
+
+	const Camera& cam = scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+	cudaFree(dev_mergedImage);
+	deviceMalloc((void**)&dev_mergedImage, pixelcount * sizeof(glm::vec3), "merged image");
+	cudaFree(dev_peerStage);
+	deviceMalloc((void**)&dev_peerStage, pixelcount * sizeof(glm::vec3), "peer stage");
+	checkCUDAError("pathtraceInit multi-GPU");
+#else
+	pathtraceInitDevice(scene);
+#endif // MULTI_GPU_ENABLE
+
+#if OPTIX_BACKEND_ENABLE
+	// single-device only: the backend keeps one context and one set of
+	// buffers, and multi-GPU sharding already splits by iteration
+	if (hwTraceRequested) {
+#if MULTI_GPU_ENABLE
+		fprintf(stderr, "optix: multi-GPU build, using software traversal\n");
+#else
+		if (!optixBackendInit(scene)) {
+			fprintf(stderr, "optix: falling back to software traversal\n");
+		}
+#endif // MULTI_GPU_ENABLE
+	}
+#endif // OPTIX_BACKEND_ENABLE
+
+#if NVRTC_SPEC_ENABLE
+	// same single-device restriction as the OptiX backend: one module, one
+	// context, and iteration sharding already covers the multi-GPU build
+#if MULTI_GPU_ENABLE
+	fprintf(stderr, "nvrtcspec: multi-GPU build, using precompiled kernels\n");
+#else
+	if (!nvrtcSpecInit(scene)) {
+		fprintf(stderr, "nvrtcspec: using precompiled kernels\n");
+	}
+#endif // MULTI_GPU_ENABLE
+#endif // NVRTC_SPEC_ENABLE
+}
+
+void pathtraceSetHardwareTrace(bool enable) {
+	hwTraceRequested = enable;
+}
+
+// Reset for a camera change: the scene (geometry, BVHs, materials, lights)
+// and the arena stay exactly where they are; only the per-pixel
+// accumulation state is cleared, stream-ordered behind whatever the
+// previous viewpoint still has in flight. No frees, no mallocs, no
+// re-upload - this is what makes interactive orbiting smooth.
+static void pathtraceCameraResetDevice() {
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+
+#if TEMPORAL_REPROJECTION_ENABLE
+	// reproject the outgoing view's accumulation before wiping it, but only
+	// when both the old and the new view trace at full preview resolution:
+	// scaled frames use a different image layout (see
+	// pathtraceSetPreviewScale), and mixing the two would smear
+	if (reprojPrevIter > 0 && reprojPrevScale == 1 && previewScale == 1) {
+		cudaMemcpyAsync(dev_prevImage, dev_image, pixelcount * sizeof(glm::vec3),
+			cudaMemcpyDeviceToDevice, computeStream);
+		cudaMemsetAsync(dev_reprojDepth, 0xFF, pixelcount * sizeof(unsigned int), computeStream);
+		cudaMemsetAsync(dev_reprojImage, 0, pixelcount * sizeof(glm::vec4), computeStream);
+		const int blockSize1d = 128;
+		const int blocks = (pixelcount + blockSize1d - 1) / blockSize1d;
+		kernReprojectDepth << <blocks, blockSize1d, 0, computeStream >> > (
+			pixelcount, dev_reprojPositions, cam, dev_reprojDepth);
+		kernReprojectResolve << <blocks, blockSize1d, 0, computeStream >> > (
+			pixelcount, dev_reprojPositions, dev_prevImage, (float)reprojPrevIter,
+			cam, dev_reprojDepth, dev_reprojImage);
+		reprojBlendValid = true;
+	}
+	else {
+		reprojBlendValid = false;
+	}
+#endif // TEMPORAL_REPROJECTION_ENABLE
+
+	cudaMemsetAsync(dev_image, 0, pixelcount * sizeof(glm::vec3), computeStream);
+#if HEATMAP_ENABLE
+	cudaMemsetAsync(dev_pixelBounceDepth, 0, pixelcount * sizeof(int), computeStream);
+#endif // HEATMAP_ENABLE
+#if FIREFLY_CLAMP_ENABLE
+	cudaMemsetAsync(dev_clampedEnergy, 0, pixelcount * sizeof(glm::vec3), computeStream);
+#endif // FIREFLY_CLAMP_ENABLE
+#if ADAPTIVE_SAMPLING
+	cudaMemsetAsync(dev_pixelMeans, 0, pixelcount * sizeof(float), computeStream);
+	cudaMemsetAsync(dev_pixelM2s, 0, pixelcount * sizeof(float), computeStream);
+	cudaMemsetAsync(dev_pixelSamples, 0, pixelcount * sizeof(int), computeStream);
+	cudaMemsetAsync(dev_pixelConverged, 0, pixelcount * sizeof(int), computeStream);
+#endif // ADAPTIVE_SAMPLING
+#if PATH_REGEN_ENABLE
+	thrust::fill(thrust::cuda::par.on(computeStream),
+		thrust::device_pointer_cast(dev_pixelNextSample),
+		thrust::device_pointer_cast(dev_pixelNextSample) + pixelcount, 1);
+	cudaMemsetAsync(dev_pixelDoneSamples, 0, pixelcount * sizeof(int), computeStream);
+#endif // PATH_REGEN_ENABLE
+#if FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	// the tile frusta moved with the camera; refill the already-allocated
+	// lists (a host pass plus one upload, still no mallocs)
+	buildTileCullLists(hst_scene);
+#endif // FUSED_PRIMARY_ENABLE && TILE_CULL_ENABLE
+	// the first-hit cache needs no clear: the iteration counter restarts at
+	// 1, so every stratum is re-traced before it is ever served again
+	checkCUDAError("pathtraceCameraReset");
+}
+
+void pathtraceSetPreviewScale(int scale) {
+	previewScale = scale < 1 ? 1 : scale;
+}
+
+/**
+ * Set or clear the look-dev region of interest (w or h <= 0 clears). The
+ * rectangle is clamped to the frame; baseIter is the sample count every
+ * pixel holds right now, which the display keeps using for the frozen
+ * remainder. No-op unless built with ROI_ENABLE.
+ */
+void pathtraceSetROI(int x, int y, int w, int h, int baseIter) {
+#if ROI_ENABLE
+	if (hst_scene == NULL) {
+		return;
+	}
+	const glm::ivec2 res = hst_scene->state.camera.resolution;
+	if (w <= 0 || h <= 0) {
+		roiSize = glm::ivec2(0, 0);
+		roiBaseIter = 0;
+		return;
+	}
+	x = glm::clamp(x, 0, res.x - 1);
+	y = glm::clamp(y, 0, res.y - 1);
+	roiOffset = glm::ivec2(x, y);
+	roiSize = glm::ivec2(glm::min(w, res.x - x), glm::min(h, res.y - y));
+	roiBaseIter = baseIter;
+#endif // ROI_ENABLE
+}
+
+/**
+ * Arm the pixel probe: the next full-resolution iteration records pixel
+ * (x, y)'s path bounce by bounce and prints it to stdout. No-op unless
+ * built with PIXEL_PROBE_ENABLE.
+ */
+void pathtraceProbePixel(int x, int y) {
+#if PIXEL_PROBE_ENABLE
+	if (hst_scene == NULL) {
+		return;
+	}
+	const glm::ivec2 res = hst_scene->state.camera.resolution;
+	if (x < 0 || y < 0 || x >= res.x || y >= res.y) {
+		return;
+	}
+	probeX = x;
+	probeY = y;
+	probePixel = x + y * res.x;
+#endif // PIXEL_PROBE_ENABLE
+}
+
+// Per-frame animation update: push the transforms Scene::setAnimationFrame
+// rewrote on the host back to the device. Only the small per-geom tables
+// move - the object-space BLASes never change under rigid motion and the
+// static partition never animates, so the cost is two geom-table uploads
+// plus a host rebuild of the (small) moving TLAS, not a scene re-init.
+static void pathtraceUpdateGeomsDevice() {
+	Scene* scene = hst_scene;
+
+	std::vector<GeomHot> geomsHot;
+	std::vector<GeomCold> geomsCold;
+	buildGeomSplit(scene, geomsHot, geomsCold);
+	cudaMemcpy(dev_geomsHot, geomsHot.data(), geomsHot.size() * sizeof(GeomHot), cudaMemcpyHostToDevice);
+	cudaMemcpy(dev_geomsCold, geomsCold.data(), geomsCold.size() * sizeof(GeomCold), cudaMemcpyHostToDevice);
+
+#if TLAS_ENABLE
+	if (numMovingGeoms > 0) {
+		std::vector<Geom> movingGeoms(scene->geoms.begin() + numStaticGeoms, scene->geoms.end());
+		std::vector<LBVHNode> movingTlasNodes;
+		movingTlasRoot = buildGeomTLAS(movingGeoms, movingTlasNodes);
+		cudaMemcpy(dev_movingTlasNodes, movingTlasNodes.data(), movingTlasNodes.size() * sizeof(LBVHNode), cudaMemcpyHostToDevice);
+	}
+#endif // TLAS_ENABLE
+
+#if DIRECT_LIGHTING_ENABLE
+	// translation-only animation keeps each light's area and power, so the
+	// alias table stays valid and only the transforms need refreshing
+	if (numLights > 0) {
+		std::vector<Light> lights;
+		flattenLights(scene, lights);
+		cudaMemcpy(dev_lights, lights.data(), numLights * sizeof(Light), cudaMemcpyHostToDevice);
+	}
+#endif // DIRECT_LIGHTING_ENABLE
+	checkCUDAError("pathtraceUpdateGeoms");
+}
+
+void pathtraceUpdateGeoms() {
+#if MULTI_GPU_ENABLE
+	for (int d = numDevices - 1; d >= 0; d--) {
+		cudaSetDevice(d);
+		loadDeviceState(deviceStates[d]);
+		pathtraceUpdateGeomsDevice();
+		saveDeviceState(deviceStates[d]);
+	}
+	loadDeviceState(deviceStates[0]);
+#else
+	pathtraceUpdateGeomsDevice();
+#endif // MULTI_GPU_ENABLE
+}
+
+// Look-dev edit: patch one material in place. The materials texture is a
+// linear view over dev_materials, so the edit is visible to the next
+// launch without rebuilding it. Emittance or color edits move light power
+// (and toggling emittance changes which geoms are listed at all), so the
+// light list, its alias table and the cold halves' lightArea flags are
+// rebuilt - all host-side work over a handful of lights.
+static void pathtraceUpdateMaterialDevice(int id) {
+	cudaMemcpy(dev_materials + id, &hst_scene->materials[id],
+		sizeof(Material), cudaMemcpyHostToDevice);
+
+	std::vector<GeomHot> geomsHot;
+	std::vector<GeomCold> geomsCold;
+	buildGeomSplit(hst_scene, geomsHot, geomsCold);
+	cudaMemcpy(dev_geomsCold, geomsCold.data(), geomsCold.size() * sizeof(GeomCold), cudaMemcpyHostToDevice);
+
+#if DIRECT_LIGHTING_ENABLE
+	uploadLights(hst_scene);
+#endif // DIRECT_LIGHTING_ENABLE
+	checkCUDAError("pathtraceUpdateMaterial");
+}
+
+void pathtraceUpdateMaterial(int id) {
+	if (hst_scene == NULL || id < 0 || id >= (int)hst_scene->materials.size()) {
+		return;
+	}
+#if MULTI_GPU_ENABLE
+	for (int d = numDevices - 1; d >= 0; d--) {
+		cudaSetDevice(d);
+		loadDeviceState(deviceStates[d]);
+		pathtraceUpdateMaterialDevice(id);
+		saveDeviceState(deviceStates[d]);
+	}
+	loadDeviceState(deviceStates[0]);
+#else
+	pathtraceUpdateMaterialDevice(id);
+#endif // MULTI_GPU_ENABLE
+	pathtraceCameraReset();
+}
+
+// Look-dev edit: patch one geom's transform tables in place and rebuild
+// only the TLAS partition it sits in. Object-space triangles and BLASes
+// are untouched; an emissive geom additionally refreshes the light list,
+// since scaling moves its area and so its selection power.
+static void pathtraceUpdateTransformDevice(int geomId) {
+	std::vector<GeomHot> geomsHot;
+	std::vector<GeomCold> geomsCold;
+	buildGeomSplit(hst_scene, geomsHot, geomsCold);
+	cudaMemcpy(dev_geomsHot + geomId, &geomsHot[geomId], sizeof(GeomHot), cudaMemcpyHostToDevice);
+	cudaMemcpy(dev_geomsCold + geomId, &geomsCold[geomId], sizeof(GeomCold), cudaMemcpyHostToDevice);
+
+#if TLAS_ENABLE
+	// node counts depend only on partition size, so the rebuilt tree drops
+	// into the existing buffer
+	if (geomId < numStaticGeoms) {
+		std::vector<Geom> staticGeoms(hst_scene->geoms.begin(), hst_scene->geoms.begin() + numStaticGeoms);
+		std::vector<LBVHNode> tlasNodes;
+		tlasRoot = buildGeomTLAS(staticGeoms, tlasNodes);
+		cudaMemcpy(dev_tlasNodes, tlasNodes.data(), tlasNodes.size() * sizeof(LBVHNode), cudaMemcpyHostToDevice);
+	}
+	else if (numMovingGeoms > 0) {
+		std::vector<Geom> movingGeoms(hst_scene->geoms.begin() + numStaticGeoms, hst_scene->geoms.end());
+		std::vector<LBVHNode> movingTlasNodes;
+		movingTlasRoot = buildGeomTLAS(movingGeoms, movingTlasNodes);
+		cudaMemcpy(dev_movingTlasNodes, movingTlasNodes.data(), movingTlasNodes.size() * sizeof(LBVHNode), cudaMemcpyHostToDevice);
+	}
+#endif // TLAS_ENABLE
+
+#if DIRECT_LIGHTING_ENABLE
+	if (hst_scene->materials[hst_scene->geoms[geomId].materialid].emittance > 0.0f) {
+		uploadLights(hst_scene);
+	}
+#endif // DIRECT_LIGHTING_ENABLE
+	checkCUDAError("pathtraceUpdateTransform");
+}
+
+void pathtraceUpdateTransform(int geomId) {
+	if (hst_scene == NULL || geomId < 0 || geomId >= (int)hst_scene->geoms.size()) {
+		return;
+	}
+	// rebuild the matrices from the edited translation/rotation/scale here,
+	// once, rather than per device
+	Geom& geom = hst_scene->geoms[geomId];
+	geom.transform = utilityCore::buildTransformationMatrix(
+		geom.translation, geom.rotation, geom.scale);
+	geom.inverseTransform = glm::inverse(geom.transform);
+	geom.invTranspose = glm::inverseTranspose(geom.transform);
+#if MULTI_GPU_ENABLE
+	for (int d = numDevices - 1; d >= 0; d--) {
+		cudaSetDevice(d);
+		loadDeviceState(deviceStates[d]);
+		pathtraceUpdateTransformDevice(geomId);
+		saveDeviceState(deviceStates[d]);
+	}
+	loadDeviceState(deviceStates[0]);
+#else
+	pathtraceUpdateTransformDevice(geomId);
+#endif // MULTI_GPU_ENABLE
+	pathtraceCameraReset();
+}
+
+void pathtraceCameraReset() {
+	// the accumulation is about to clear; a salvage of it is meaningless
+	lastCompletedIter = 0;
+	hostSnapshotIter = 0;
+#if ROI_ENABLE
+	// the frozen remainder would show the outgoing view; drop the region
+	roiSize = glm::ivec2(0, 0);
+	roiBaseIter = 0;
+#endif // ROI_ENABLE
+#if MULTI_GPU_ENABLE
+	for (int d = numDevices - 1; d >= 0; d--) {
+		cudaSetDevice(d);
+		loadDeviceState(deviceStates[d]);
+		pathtraceCameraResetDevice();
+		saveDeviceState(deviceStates[d]);
+	}
+	loadDeviceState(deviceStates[0]);
+#else
+	pathtraceCameraResetDevice();
+#endif // MULTI_GPU_ENABLE
+}
+
+// view of one stratum's slice of the first-hit cache
+static ShadeableIntersectionSoA cacheSlice(int stratum, int pixelcount) {
+	ShadeableIntersectionSoA slice = dev_intersections_cache;
+	slice.t += stratum * pixelcount;
+	slice.surfaceNormals += stratum * pixelcount;
+	slice.materialIds += stratum * pixelcount;
+	slice.points += stratum * pixelcount;
+	slice.lightAreas += stratum * pixelcount;
+	slice.uvs += stratum * pixelcount;
+	return slice;
+}
+
+#if AA_EDGE_ADAPTIVE_ENABLE
+// two first hits count as the same surface for the edge mask when the
+// object agrees and the depths are within the relative tolerance
+__device__ inline bool aaSameSurface(int mat0, float t0, int mat1, float t1) {
+	return mat0 == mat1
+		&& fabsf(t1 - t0) <= AA_EDGE_DEPTH_TOLERANCE * fmaxf(fabsf(t0), 1.0f);
+}
+
+// Classify every pixel once the cache holds all CACHE_STRATA first hits:
+// a pixel is an edge pixel when its own strata disagree (a surface edge
+// crosses the pixel) or any 4-neighbor's stratum-0 hit landed on
+// different geometry (catches edges the strata straddle). Edge pixels
+// also land in the compacted list the depth-0 re-trace launches over;
+// the order the atomic hands out does not matter there.
+__global__ void kernBuildAaEdgeMask(glm::ivec2 res, ShadeableIntersectionSoA cache,
+	int* mask, int* edgeList, int* edgeCount) {
+	int pixel = blockIdx.x * blockDim.x + threadIdx.x;
+	int pixelcount = res.x * res.y;
+	if (pixel >= pixelcount) {
+		return;
+	}
+	int mat0 = cache.materialIds[pixel];
+	float t0 = cache.t[pixel];
+	bool edge = false;
+	for (int s = 1; s < CACHE_STRATA && !edge; s++) {
+		edge = !aaSameSurface(mat0, t0,
+			cache.materialIds[s * pixelcount + pixel], cache.t[s * pixelcount + pixel]);
+	}
+	int x = pixel % res.x;
+	int y = pixel / res.x;
+	const int nx[4] = { -1, 1, 0, 0 };
+	const int ny[4] = { 0, 0, -1, 1 };
+	for (int k = 0; k < 4 && !edge; k++) {
+		int px = x + nx[k];
+		int py = y + ny[k];
+		if (px < 0 || px >= res.x || py < 0 || py >= res.y) {
+			continue;
+		}
+		int neighbor = py * res.x + px;
+		edge = !aaSameSurface(mat0, t0, cache.materialIds[neighbor], cache.t[neighbor]);
+	}
+	mask[pixel] = edge ? 1 : 0;
+	if (edge) {
+		edgeList[atomicAdd(edgeCount, 1)] = pixel;
+	}
+}
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+
+// device-to-device copy of every intersection component stream
+static void copyIntersections(ShadeableIntersectionSoA dst, ShadeableIntersectionSoA src, int n) {
+	cudaMemcpy(dst.t, src.t, n * sizeof(float), cudaMemcpyDeviceToDevice);
+	cudaMemcpy(dst.surfaceNormals, src.surfaceNormals, n * sizeof(glm::vec3), cudaMemcpyDeviceToDevice);
+	cudaMemcpy(dst.materialIds, src.materialIds, n * sizeof(int), cudaMemcpyDeviceToDevice);
+	cudaMemcpy(dst.points, src.points, n * sizeof(glm::vec3), cudaMemcpyDeviceToDevice);
+	cudaMemcpy(dst.lightAreas, src.lightAreas, n * sizeof(float), cudaMemcpyDeviceToDevice);
+	cudaMemcpy(dst.uvs, src.uvs, n * sizeof(glm::vec2), cudaMemcpyDeviceToDevice);
+}
+
+static void pathtraceFreeDevice() {
+	// the arena owns every resolution-sized buffer; one free covers them all
+	cudaFree(dev_arena);
+	dev_arena = NULL;
+	arenaCapacity = 0;
+	arenaOffset = 0;
+	dev_image = NULL;
+	dev_paths = {};
+	dev_intersections = {};
+#if CACHE_ENABLE
+	dev_intersections_cache = {};
+#if AA_EDGE_ADAPTIVE_ENABLE
+	dev_aaEdgeMask = NULL;
+	dev_aaEdgeList = NULL;
+	dev_aaEdgeCount = NULL;
+	numAaEdgePaths = 0;
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+#endif // CACHE_ENABLE
+	dev_rngStates = NULL;
+	dev_pixelToSlot = NULL;
+#if FIREFLY_CLAMP_ENABLE
+	dev_clampedEnergy = NULL;
+#endif // FIREFLY_CLAMP_ENABLE
+#if DENOISE_ENABLE
+	dev_denoiseNormals = NULL;
+	dev_denoisePositions = NULL;
+	dev_denoised[0] = NULL;
+	dev_denoised[1] = NULL;
+#endif // DENOISE_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+	dev_reprojPositions = NULL;
+	dev_prevImage = NULL;
+	dev_reprojImage = NULL;
+	dev_reprojDepth = NULL;
+	reprojPrevIter = 0;
+	reprojBlendValid = false;
+#endif // TEMPORAL_REPROJECTION_ENABLE
+#if ADAPTIVE_SAMPLING
+	dev_pixelMeans = NULL;
+	dev_pixelM2s = NULL;
+	dev_pixelSamples = NULL;
+	dev_pixelConverged = NULL;
+#endif // ADAPTIVE_SAMPLING
+#if RAY_SORT_ENABLE
+	dev_raySortKeys = NULL;
+	dev_raySortIndices = NULL;
+	dev_raySortScratch = NULL;
+#endif // RAY_SORT_ENABLE
+#if DEFERRED_SHADOW_ENABLE
+	dev_shadowQueue = NULL;
+	dev_shadowQueueCount = NULL;
+	shadowQueueCapacity = 0;
+	dev_shadowSortKeys = NULL;
+	dev_shadowSortIndices = NULL;
+	dev_shadowSortScratch = NULL;
+#endif // DEFERRED_SHADOW_ENABLE
+#if WAVEFRONT_ENABLE
+	dev_queues = NULL;
+	dev_queueCounters = NULL;
+#endif // WAVEFRONT_ENABLE
+#if PERSISTENT_THREADS
+	dev_intersectWorkCounter = NULL;
+#endif // PERSISTENT_THREADS
+#if COOP_LAUNCH_ENABLE
+	dev_coopLiveCounters = NULL;
+#endif // COOP_LAUNCH_ENABLE
+#if STREAM_COMPACTION
+	StreamCompaction::cleanup();
+	dev_pathIndices[0] = NULL;
+	dev_pathIndices[1] = NULL;
+	dev_activePaths = NULL;
+#if FUSED_COMPACT_ENABLE
+	dev_survivorCount = NULL;
+#endif // FUSED_COMPACT_ENABLE
+	cudaFreeHost(host_pathCount);
+	host_pathCount = NULL;
+	if (pathCountEvent) {
+		cudaEventDestroy(pathCountEvent);
+		pathCountEvent = NULL;
+	}
+#endif // STREAM_COMPACTION
+#if PATH_REGEN_ENABLE
+	dev_pixelNextSample = NULL;
+	dev_pixelDoneSamples = NULL;
+#endif // PATH_REGEN_ENABLE
+	freeSceneBuffers();
+	thrustScratch.release();
+	cudaFreeHost(host_imageStage);
+	host_imageStage = NULL;
+	if (imageStageDone) {
+		cudaEventDestroy(imageStageDone);
+		imageStageDone = NULL;
+	}
+	if (computeStream) {
+		cudaStreamDestroy(computeStream);
+		computeStream = NULL;
+	}
+	if (uploadStream) {
+		cudaStreamDestroy(uploadStream);
+		uploadStream = NULL;
+		for (int b = 0; b < 2; b++) {
+			cudaFreeHost(host_uploadStage[b]);
+			host_uploadStage[b] = NULL;
+			cudaEventDestroy(uploadStageFree[b]);
+			uploadStageFree[b] = NULL;
+		}
+	}
+	if (displayStream) {
+		cudaStreamDestroy(displayStream);
+		displayStream = NULL;
+	}
+	if (gatherDone) {
+		cudaEventDestroy(gatherDone);
+		gatherDone = NULL;
+	}
+	if (iterationGraphExec) {
+		cudaGraphExecDestroy(iterationGraphExec);
+		iterationGraphExec = NULL;
+	}
+	// TODO: clean up any extra device memory you created
+
+	checkCUDAError("pathtraceFree");
+}
+
+void pathtraceFree() {
+#if OPTIX_BACKEND_ENABLE
+	optixBackendFree();
+#endif // OPTIX_BACKEND_ENABLE
+#if NVRTC_SPEC_ENABLE
+	nvrtcSpecFree();
+#endif // NVRTC_SPEC_ENABLE
+#if MULTI_GPU_ENABLE
+	for (int d = numDevices - 1; d >= 0; d--) {
+		cudaSetDevice(d);
+		loadDeviceState(deviceStates[d]);
+		pathtraceFreeDevice();
+		saveDeviceState(deviceStates[d]);
+	}
+	loadDeviceState(deviceStates[0]);
+	cudaFree(dev_mergedImage);
+	dev_mergedImage = NULL;
+	cudaFree(dev_peerStage);
+	dev_peerStage = NULL;
+#if MULTI_GPU_STEAL_ENABLE
+	for (int d = 0; d < numDevices; d++) {
+		if (stealDone[d]) {
+			cudaEventDestroy(stealDone[d]);
+			stealDone[d] = NULL;
+		}
+	}
+#endif // MULTI_GPU_STEAL_ENABLE
+#if MULTI_GPU_PEER_GEOM_ENABLE
+	releasePeerGeom();
+#endif // MULTI_GPU_PEER_GEOM_ENABLE
+#else
+	pathtraceFreeDevice();
+#endif // MULTI_GPU_ENABLE
+}
+
+#if ROI_ENABLE
+// Crop placement of the current launch inside the frame: launch pixel
+// (x, y) is frame pixel c_roiOffset + (x, y) with row pitch
+// c_roiFrameWidth. Identity (zero offset, traced width) whenever no
+// region is active, so one raygen body serves both cases.
+__constant__ glm::ivec2 c_roiOffset;
+__constant__ int c_roiFrameWidth;
+#endif // ROI_ENABLE
+
+/**
+* Generate PathSegments with rays from the camera through the screen into the
+* scene, which is the first bounce of rays.
+*
+* Antialiasing - add rays for sub-pixel sampling
+* motion blur - jitter rays "in time"
+* lens effect - jitter ray origin positions based on a lens
+*
+* FEATURES is a CamFeature bitmask; every feature test below folds at
+* compile time, so each instantiation carries only the code its mask
+* enables and the combination is picked at runtime per scene.
+*/
+enum CamFeature {
+	CAM_FEATURE_AA = 1 << 0,
+	CAM_FEATURE_DOF = 1 << 1,
+	CAM_FEATURE_MOTION_BLUR = 1 << 2,
+};
+
+// Stage one camera path in registers and scatter it into the component
+// arrays. Returns the path slot written, or -1 when adaptive sampling
+// froze the pixel (the dead replay path was written instead); `rayOut`
+// receives the generated ray, so a fused caller can keep tracing it
+// without reloading the streams it just wrote.
+template <unsigned int FEATURES>
+__device__ int generateOneCameraRay(Camera cam, int iter, int traceDepth, int x, int y,
+	PathSegmentSoA pathSegments, thrust::default_random_engine* rngStates,
+	glm::vec3* image, int* pixelConverged, const int* pixelToSlot, Ray& rayOut)
+{
+	{
+		int index = x + (y * cam.resolution.x);
+#if ROI_ENABLE
+		// `index` stays the compact in-launch slot basis; `pixel` addresses
+		// the frame-layout per-pixel state (image, RNG lane, Sobol seed),
+		// which a region-of-interest crop must keep reading in place
+		const int pixel = (c_roiOffset.x + x) + (c_roiOffset.y + y) * c_roiFrameWidth;
+#else
+		const int pixel = index;
+#endif // ROI_ENABLE
+#if MORTON_ORDER_ENABLE && !ROI_ENABLE
+		// path slot in Morton order; `pixel` stays the index for the image,
+		// the RNG lane and the Sobol seeding. A crop launch skips the
+		// table: it permutes the full frame, not the rectangle.
+		int slot = pixelToSlot[index];
+#else
+		int slot = index;
+#endif // MORTON_ORDER_ENABLE
+		PathSegment segment;
+
+#if ADAPTIVE_SAMPLING
+		if (pixelConverged[pixel]) {
+			// frozen pixel: emit a dead path that replays the running mean,
+			// so dividing the accumulation by the iteration count stays
+			// exact. Every earlier iteration contributed either a sample or
+			// that same mean, so the mean is just accumulation / (iter - 1).
+			pathSegments.colors[slot] = image[pixel] / (float)(iter - 1);
+			pathSegments.radiances[slot] = glm::vec3(0.0f);
+			pathSegments.pixelIndices[slot] = pixel;
+			pathSegments.remainingBounces[slot] = 0;
+#if TERMINATE_GATHER_ENABLE
+			// dead replay path: nothing will ever shade it, so bank the
+			// mean here instead of leaving it for the gather pass
+			image[pixel] += pathSegments.colors[slot];
+#endif // TERMINATE_GATHER_ENABLE
+			return -1;
+		}
+#endif // ADAPTIVE_SAMPLING
+
+		segment.ray.origin = cam.position;
+		segment.color = glm::vec3(1.0f, 1.0f, 1.0f);
+
+		float fx = (float)x;
+		float fy = (float)y;
+		// this pixel's persistent RNG lane; only loaded (and stored back
+		// after the last draw) by instantiations that actually draw from it
+		const bool needsRng = !SOBOL_SAMPLING
+			&& (((FEATURES & CAM_FEATURE_AA) && (!CACHE_ENABLE || AA_EDGE_ADAPTIVE_ENABLE))
+				|| (FEATURES & (CAM_FEATURE_DOF | CAM_FEATURE_MOTION_BLUR)));
+		thrust::default_random_engine rng;
+		if (needsRng) {
+			rng = rngStates[pixel];
+		}
+		// antialiasing
+		if (FEATURES & CAM_FEATURE_AA) {
+#if CACHE_ENABLE
+#if AA_EDGE_ADAPTIVE_ENABLE
+			if (iter > CACHE_STRATA && c_aaEdgeMask[pixel] != 0) {
+				// edge pixel: free per-iteration jitter, full AA quality;
+				// its primary hit is re-traced (see the depth-0 branch)
+#if SOBOL_SAMPLING
+				glm::vec2 xi = sobolSample2D(iter, sobolSeed(pixel, 0));
+				fx += xi.x - 0.5f;
+				fy += xi.y - 0.5f;
+#else
+				thrust::uniform_real_distribution<float> u01(-0.5f, 0.5f);
+				fx += u01(rng);
+				fy += u01(rng);
+#endif // SOBOL_SAMPLING
+			}
+			else
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+			{
+				// fixed rotated-grid subpixel position per stratum: a stratum's
+				// jitter never changes, so its first hit can be served from cache
+				const float strataX[CACHE_STRATA] = { -0.375f, 0.125f, 0.375f, -0.125f };
+				const float strataY[CACHE_STRATA] = { -0.125f, -0.375f, 0.125f, 0.375f };
+				int stratum = (iter - 1) % CACHE_STRATA;
+				fx += strataX[stratum];
+				fy += strataY[stratum];
+			}
+#elif SOBOL_SAMPLING
+			// dimension pair 0 of this pixel's scrambled Sobol sequence
+			glm::vec2 xi = sobolSample2D(iter, sobolSeed(pixel, 0));
+#if BLUE_NOISE_ENABLE
+			if (iter <= BLUE_NOISE_ITERS) {
+				xi = glm::fract(xi + blueNoiseShiftAt(x, y, 0));
+			}
+#endif // BLUE_NOISE_ENABLE
+			fx += xi.x - 0.5f;
+			fy += xi.y - 0.5f;
+#else
+			thrust::uniform_real_distribution<float> u01(-0.5, 0.5);
+			// add a small offset
+			fx += u01(rng);
+			fy += u01(rng);
+#endif // CACHE_ENABLE
+		}
+		segment.ray.direction = glm::normalize(cam.view
+			- cam.right * cam.pixelLength.x * ((float)cam.cropOffset.x + fx - (float)cam.fullResolution.x * 0.5f)
+			- cam.up * cam.pixelLength.y * ((float)cam.cropOffset.y + fy - (float)cam.fullResolution.y * 0.5f)
+			);
+
+		segment.pixelIndex = pixel;
+		segment.remainingBounces = traceDepth;
+
+		if (FEATURES & CAM_FEATURE_DOF) {
+			// depth of field
+			float lensRadius = 0.05f;
+			float focalDistance = 12.0f;
+
+#if SOBOL_SAMPLING
+			glm::vec2 lensXi = sobolSample2D(iter, sobolSeed(pixel, 1));
+#if BLUE_NOISE_ENABLE
+			if (iter <= BLUE_NOISE_ITERS) {
+				lensXi = glm::fract(lensXi + blueNoiseShiftAt(x, y, 1));
+			}
+#endif // BLUE_NOISE_ENABLE
+			float p0 = lensXi.x - 0.5f;
+			float p1 = lensXi.y - 0.5f;
+#else
+			thrust::uniform_real_distribution<float> uLens(-0.5, 0.5);
+			float p0 = uLens(rng);
+			float p1 = uLens(rng);
+#endif // SOBOL_SAMPLING
+			// sample a point from lens
+			segment.ray.origin = cam.position + p0 * lensRadius * cam.up + p1 * lensRadius * cam.right;
+			float asp = focalDistance / glm::length(cam.view);
+			segment.ray.direction = cam.view
+				- cam.right * cam.pixelLength.x * ((float)cam.cropOffset.x + fx - (float)cam.fullResolution.x * 0.5f)
+				- cam.up * cam.pixelLength.y * ((float)cam.cropOffset.y + fy - (float)cam.fullResolution.y * 0.5f);
+			glm::vec3 target = cam.position + segment.ray.direction * asp;
+			segment.ray.direction = glm::normalize(target - segment.ray.origin);
+		}
+
+		if (FEATURES & CAM_FEATURE_MOTION_BLUR) {
+#if SOBOL_SAMPLING
+			segment.ray.time = sobolSample2D(iter, sobolSeed(pixel, 2)).x;
+#else
+			thrust::uniform_real_distribution<float> u02(0.0f, 1.0f);
+			segment.ray.time = u02(rng);
+#endif // SOBOL_SAMPLING
+		}
+
+		if (needsRng) {
+			rngStates[pixel] = rng;
+		}
+
+		// scatter the staged segment into the component arrays
+		pathSegments.origins[slot] = segment.ray.origin;
+		pathSegments.directions[slot] = segment.ray.direction;
+		pathSegments.invDirections[slot] = 1.0f / segment.ray.direction;
+		pathSegments.times[slot] = segment.ray.time;
+		pathSegments.colors[slot] = segment.color;
+		pathSegments.radiances[slot] = glm::vec3(0.0f);
+		pathSegments.pixelIndices[slot] = segment.pixelIndex;
+		pathSegments.remainingBounces[slot] = segment.remainingBounces;
+		// primary rays are a delta technique: emissive hits count in full
+		pathSegments.prevPdfs[slot] = -1.0f;
+#if PATH_GUIDING_ENABLE
+		// no guided vertex yet on this path
+		pathSegments.guideBins[slot] = -1;
+#endif // PATH_GUIDING_ENABLE
+
+		rayOut = segment.ray;
+		return slot;
+	}
+}
+
+template <unsigned int FEATURES>
+__global__ void generateRayFromCamera(Camera cam, int iter, int traceDepth, PathSegmentSoA pathSegments,
+	thrust::default_random_engine* rngStates, glm::vec3* image, int* pixelConverged,
+	const int* pixelToSlot)
+{
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < cam.resolution.x && y < cam.resolution.y) {
+		Ray ray;
+		generateOneCameraRay<FEATURES>(cam, iter, traceDepth, x, y,
+			pathSegments, rngStates, image, pixelConverged, pixelToSlot, ray);
+	}
+}
+
+// Launch the generateRayFromCamera instantiation matching the scene's
+// runtime feature mask. Every combination is pre-instantiated, so the
+// switch is the only runtime cost and the kernels themselves stay
+// branch-free with respect to disabled features.
+static void launchGenerateRayFromCamera(dim3 blocksPerGrid2d, dim3 blockSize2d,
+	cudaStream_t stream, unsigned int features, Camera cam, int iter, int traceDepth,
+	PathSegmentSoA paths, thrust::default_random_engine* rngStates,
+	glm::vec3* image, int* pixelConverged, const int* pixelToSlot)
+{
+#define LAUNCH_CAMERA_KERNEL(MASK) \
+	case (MASK): \
+		generateRayFromCamera<(MASK)> << <blocksPerGrid2d, blockSize2d, 0, stream >> > ( \
+			cam, iter, traceDepth, paths, rngStates, image, pixelConverged, pixelToSlot); \
+		break;
+	switch (features) {
+	LAUNCH_CAMERA_KERNEL(0)
+	LAUNCH_CAMERA_KERNEL(CAM_FEATURE_AA)
+	LAUNCH_CAMERA_KERNEL(CAM_FEATURE_DOF)
+	LAUNCH_CAMERA_KERNEL(CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_CAMERA_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_DOF)
+	LAUNCH_CAMERA_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_CAMERA_KERNEL(CAM_FEATURE_DOF | CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_CAMERA_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_DOF | CAM_FEATURE_MOTION_BLUR)
+	}
+#undef LAUNCH_CAMERA_KERNEL
+}
+
+#if SPP_BATCH > 1
+// The path stream viewed from sample plane s on: the raygen slot math is
+// per-pixel, so a base shift on every component array lands it in plane s.
+static PathSegmentSoA pathStreamForSample(PathSegmentSoA paths, int base)
+{
+	paths.origins += base;
+	paths.directions += base;
+	paths.invDirections += base;
+	paths.times += base;
+	paths.colors += base;
+	paths.radiances += base;
+	paths.pixelIndices += base;
+	paths.remainingBounces += base;
+	paths.prevPdfs += base;
+#if PATH_GUIDING_ENABLE
+	paths.guideBins += base;
+#endif // PATH_GUIDING_ENABLE
+	return paths;
+}
+#endif // SPP_BATCH
+
+#if PATH_REGEN_ENABLE
+// Flush every finished path's sample into the accumulation and immediately
+// restart its slot on the same pixel's next sample. Slots never move (no
+// compaction), so a pixel always owns one slot and the per-pixel counters
+// need no atomics. Russian roulette keys off the wavefront index, so a
+// refilled path may face it from its first bounce; the survival
+// compensation keeps that unbiased.
+template <unsigned int FEATURES>
+__global__ void kernRegeneratePaths(int num_paths, Camera cam, int traceDepth,
+	PathSegmentSoA pathSegments, thrust::default_random_engine* rngStates,
+	glm::vec3* image, glm::vec3* clampedEnergy, int* pixelConverged,
+	const int* pixelToSlot, int* nextSample, int* doneSamples)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths || pathSegments.remainingBounces[idx] > 0) {
+		return;
+	}
+	int pixel = pathSegments.pixelIndices[idx];
+
+	glm::vec3 contribution = pathSegments.colors[idx];
+#if DIRECT_LIGHTING_ENABLE
+	contribution += glm::vec3(pathSegments.radiances[idx]);
+#endif // DIRECT_LIGHTING_ENABLE
+#if FIREFLY_CLAMP_ENABLE
+	float l = glm::dot(contribution, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	if (l > FIREFLY_CLAMP) {
+		// scale the sample down to the clamp and bank the excess
+		glm::vec3 kept = contribution * (FIREFLY_CLAMP / l);
+		clampedEnergy[pixel] += contribution - kept;
+		contribution = kept;
+	}
+#endif // FIREFLY_CLAMP_ENABLE
+	image[pixel] += contribution;
+	doneSamples[pixel] += 1;
+
+	// restart the slot on this pixel's next sample; the sample index plays
+	// the role iter does elsewhere (Sobol index, stratum selection)
+	int sample = nextSample[pixel] + 1;
+	nextSample[pixel] = sample;
+	Ray ray;
+	generateOneCameraRay<FEATURES>(cam, sample, traceDepth,
+		pixel % cam.resolution.x, pixel / cam.resolution.x,
+		pathSegments, rngStates, image, pixelConverged, pixelToSlot, ray);
+}
+
+// Dispatch to the instantiation matching the runtime feature mask, same
+// scheme as launchGenerateRayFromCamera.
+static void launchRegeneratePaths(dim3 numBlocks, int blockSize,
+	cudaStream_t stream, unsigned int features, Camera cam, int num_paths, int traceDepth)
+{
+#define LAUNCH_REGEN_KERNEL(MASK) \
+	case (MASK): \
+		kernRegeneratePaths<(MASK)> << <numBlocks, blockSize, 0, stream >> > ( \
+			num_paths, cam, traceDepth, dev_paths, dev_rngStates, dev_image, \
+			dev_clampedEnergy, dev_pixelConverged, dev_pixelToSlot, \
+			dev_pixelNextSample, dev_pixelDoneSamples); \
+		break;
+	switch (features) {
+	LAUNCH_REGEN_KERNEL(0)
+	LAUNCH_REGEN_KERNEL(CAM_FEATURE_AA)
+	LAUNCH_REGEN_KERNEL(CAM_FEATURE_DOF)
+	LAUNCH_REGEN_KERNEL(CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_REGEN_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_DOF)
+	LAUNCH_REGEN_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_REGEN_KERNEL(CAM_FEATURE_DOF | CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_REGEN_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_DOF | CAM_FEATURE_MOTION_BLUR)
+	}
+#undef LAUNCH_REGEN_KERNEL
+}
+#endif // PATH_REGEN_ENABLE
+
+// Intersect one geom of any type; dispatch shared by the naive loop and the
+// TLAS traversal below. MOVING picks the motion-blur instantiation of the
+// per-type tests at compile time.
+template <bool MOVING>
+__device__ float geomIntersectionTest(const GeomHot& geom, Ray r, float tMax,
+	glm::vec3& objNormal, glm::vec2& objUV, const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices,
+	const PackedNormal* __restrict__ normals, const LBVHNode* __restrict__ bvhNodes)
+{
+	// analytic primitives have no texcoords; their UV stays (0, 0)
+	objUV = glm::vec2(0.0f);
+	KPROF_CLOCK(kprofT);
+	if (geom.type == CUBE)
+	{
+		float t = boxIntersectionTest<MOVING>(geom, r, tMax, objNormal);
+		KPROF_REGION(KPROF_BOX, kprofT);
+		return t;
+	}
+	else if (geom.type == SPHERE)
+	{
+		float t = sphereIntersectionTest<MOVING>(geom, r, tMax, objNormal);
+		KPROF_REGION(KPROF_SPHERE, kprofT);
+		return t;
+	}
+	else if (geom.type == MESH)
+	{
+		float t = meshIntersectionTest<MOVING>(geom, r, tMax, objNormal, objUV, triangles, vertices, normals, bvhNodes);
+		KPROF_REGION(KPROF_MESH, kprofT);
+		return t;
+	}
+	else if (geom.type == PLANE)
+	{
+		float t = planeIntersectionTest<MOVING>(geom, r, tMax, objNormal);
+		KPROF_REGION(KPROF_PLANE, kprofT);
+		return t;
+	}
+	// TODO: add more intersection tests here... triangle? metaball? CSG?
+	return -1.0f;
+}
+
+// Any-hit dispatch for shadow rays; same shape as geomIntersectionTest but
+// routed to the occlusion-only tests, which skip normals and stop early.
+template <bool MOVING>
+__device__ bool geomAnyHitTest(const GeomHot& geom, Ray r, float tMax,
+	const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices, const LBVHNode* __restrict__ bvhNodes)
+{
+	if (geom.type == CUBE)
+	{
+		return boxAnyHitTest<MOVING>(geom, r, tMax);
+	}
+	else if (geom.type == SPHERE)
+	{
+		return sphereAnyHitTest<MOVING>(geom, r, tMax);
+	}
+	else if (geom.type == MESH)
+	{
+		return meshAnyHitTest<MOVING>(geom, r, tMax, triangles, vertices, bvhNodes);
+	}
+	else if (geom.type == PLANE)
+	{
+		return planeAnyHitTest<MOVING>(geom, r, tMax);
+	}
+	return false;
+}
+
+// TODO:
+// computeIntersections handles generating ray intersections ONLY.
+// Generating new rays is handled in your shader(s).
+// Feel free to modify the code below.
+// Per-path intersection body shared by the one-thread-per-path kernel and
+// the persistent-threads variant below. MOVING selects the motion-blur
+// instantiation of the intersection tests; MERGE makes this a second pass
+// that only beats (never clobbers) the hit distances an earlier pass wrote.
+// Closest-hit search over one geom list, entirely in registers: returns the
+// winning distance (<= the t_min passed in) and writes the object-space
+// normal and list-relative geom index of the winner. Shared between the
+// SoA-writing pass kernels below and the fused megakernel. rayMask names
+// the ray's visibility class (VIS_CAMERA for primaries, VIS_INDIRECT for
+// later bounces); geoms excluded from the class are never tested.
+template <bool MOVING>
+__device__ float intersectList(Ray ray, glm::vec3 invDir, float t_min,
+	const GeomHot* __restrict__ geoms, int geoms_size, int rayMask, glm::vec3& normal, glm::vec2& uv, int& hit_geom_index,
+	const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices, const PackedNormal* __restrict__ normals,
+	const LBVHNode* __restrict__ bvhNodes, const LBVHNode* __restrict__ tlasNodes, int tlasRoot)
+{
+	float t;
+	glm::vec3 tmp_normal;
+	glm::vec2 tmp_uv;
+
+#if GEOM_GRID_ENABLE
+	if (!MOVING && c_gridActive) {
+		// particle-field scene: DDA walk over the uniform grid instead of
+		// the TLAS. Cells come front to back, so the walk ends at the
+		// first cell whose entry distance already exceeds the best hit; a
+		// geom spanning several cells is just tested more than once.
+		glm::vec3 gridMax = c_gridMin + c_gridCellSize * glm::vec3(c_gridDims);
+		float tEnter = 0.0f;
+		float tExit = t_min;
+		for (int a = 0; a < 3; a++) {
+			float ta = (c_gridMin[a] - ray.origin[a]) * invDir[a];
+			float tb = (gridMax[a] - ray.origin[a]) * invDir[a];
+			tEnter = glm::max(tEnter, glm::min(ta, tb));
+			tExit = glm::min(tExit, glm::max(ta, tb));
+		}
+		if (tEnter <= tExit) {
+			glm::vec3 entry = ray.origin + ray.direction * tEnter;
+			glm::ivec3 cell = glm::clamp(glm::ivec3((entry - c_gridMin) * c_gridInvCellSize),
+				glm::ivec3(0), c_gridDims - 1);
+			glm::ivec3 stepDir;
+			glm::vec3 tDelta;
+			glm::vec3 tNext;
+			for (int a = 0; a < 3; a++) {
+				if (ray.direction[a] == 0.0f) {
+					// never steps on this axis
+					stepDir[a] = 0;
+					tDelta[a] = 0.0f;
+					tNext[a] = FLT_MAX;
+				}
+				else {
+					stepDir[a] = ray.direction[a] > 0.0f ? 1 : -1;
+					tDelta[a] = fabsf(c_gridCellSize[a] * invDir[a]);
+					float boundary = c_gridMin[a]
+						+ (cell[a] + (stepDir[a] > 0 ? 1 : 0)) * c_gridCellSize[a];
+					tNext[a] = (boundary - ray.origin[a]) * invDir[a];
+				}
+			}
+			while (true) {
+				int cellIdx = (cell.z * c_gridDims.y + cell.y) * c_gridDims.x + cell.x;
+				int end = c_gridCellStart[cellIdx + 1];
+				for (int s = c_gridCellStart[cellIdx]; s < end; s++) {
+					int i = c_gridItems[s];
+					if ((geoms[i].visibility & rayMask) == 0)
+					{
+						continue;
+					}
+					t = geomIntersectionTest<false>(geoms[i], ray, t_min, tmp_normal, tmp_uv, triangles, vertices, normals, bvhNodes);
+					if (t > 0.0f && t_min > t)
+					{
+						t_min = t;
+						hit_geom_index = i;
+						normal = tmp_normal;
+						uv = tmp_uv;
+					}
+				}
+				float tStep = glm::min(tNext.x, glm::min(tNext.y, tNext.z));
+				if (tStep > t_min) {
+					break;
+				}
+				int axis = tNext.x <= tNext.y
+					? (tNext.x <= tNext.z ? 0 : 2)
+					: (tNext.y <= tNext.z ? 1 : 2);
+				cell[axis] += stepDir[axis];
+				if (cell[axis] < 0 || cell[axis] >= c_gridDims[axis]) {
+					break;
+				}
+				tNext[axis] += tDelta[axis];
+			}
+		}
+		return t_min;
+	}
+#endif // GEOM_GRID_ENABLE
+#if TLAS_ENABLE
+	// traverse the top-level BVH so only geoms whose world-space bounds
+	// the ray enters are tested
+	int stack[64];
+	int stackTop = 0;
+	stack[stackTop++] = tlasRoot;
+	while (stackTop > 0)
+	{
+		const LBVHNode& node = tlasNodes[stack[--stackTop]];
+		if (node.left < 0)
+		{
+			int i = node.triangleIndex;
+			if ((geoms[i].visibility & rayMask) == 0)
+			{
+				continue;
+			}
+			// leaf boxes hold the rest pose; in the moving pass, shift by
+			// this ray's sampled time so the test is exact for the instant
+			// instead of the whole sweep the internal nodes cover
+			glm::vec3 offset = MOVING ? ray.time * geoms[i].motionOffset : glm::vec3(0.0f);
+			if (!boundingIntersectionTest(ray, invDir, node.leftBottom + offset, node.rightTop + offset, t_min))
+			{
+				continue;
+			}
+			t = geomIntersectionTest<MOVING>(geoms[i], ray, t_min, tmp_normal, tmp_uv, triangles, vertices, normals, bvhNodes);
+			if (t > 0.0f && t_min > t)
+			{
+				t_min = t;
+				hit_geom_index = i;
+				normal = tmp_normal;
+				uv = tmp_uv;
+			}
+		}
+		else
+		{
+			if (!boundingIntersectionTest(ray, invDir, node.leftBottom, node.rightTop, t_min))
+			{
+				continue;
+			}
+			stack[stackTop++] = node.left;
+			stack[stackTop++] = node.right;
+		}
+	}
+#else
+	// naive parse through global geoms
+
+	for (int i = 0; i < geoms_size; i++)
+	{
+		if ((geoms[i].visibility & rayMask) == 0)
+		{
+			continue;
+		}
+		t = geomIntersectionTest<MOVING>(geoms[i], ray, t_min, tmp_normal, tmp_uv, triangles, vertices, normals, bvhNodes);
+
+		// Compute the minimum t from the intersection tests to determine what
+		// scene geometry object was hit first.
+		if (t > 0.0f && t_min > t)
+		{
+			t_min = t;
+			hit_geom_index = i;
+			normal = tmp_normal;
+			uv = tmp_uv;
+		}
+	}
+#endif // TLAS_ENABLE
+	return t_min;
+}
+
+template <bool MOVING, bool MERGE>
+__device__ void intersectOnePath(
+	int path_index
+	, PathSegmentSoA pathSegments
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, int geoms_size
+	, int rayMask
+	, ShadeableIntersectionSoA intersections
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	)
+{
+	{
+		// the only components intersection needs are the ray streams
+		Ray ray;
+		ray.origin = pathSegments.origins[path_index];
+		ray.direction = pathSegments.directions[path_index];
+		ray.time = MOVING ? pathSegments.times[path_index] : 0.0f;
+		glm::vec3 invDir = pathSegments.invDirections[path_index];
+
+		glm::vec3 normal;
+		glm::vec2 uv(0.0f);
+		float t_min = FLT_MAX;
+		int hit_geom_index = -1;
+		if (MERGE) {
+			float prevT = intersections.t[path_index];
+			if (prevT > 0.0f) {
+				t_min = prevT;
+			}
+		}
+
+		t_min = intersectList<MOVING>(ray, invDir, t_min, geoms, geoms_size,
+			rayMask, normal, uv, hit_geom_index, triangles, vertices, normals, bvhNodes,
+			tlasNodes, tlasRoot);
+
+		if (hit_geom_index == -1)
+		{
+			if (!MERGE)
+			{
+				// a merge pass leaves the earlier pass's result in place
+				intersections.t[path_index] = -1.0f;
+			}
+		}
+		else
+		{
+			// the ray hits something; only now touch the winning geom's cold
+			// half for the normal matrix and material
+			GeomCold cold = geomsCold[hit_geom_index];
+			intersections.t[path_index] = t_min;
+			intersections.materialIds[path_index] = cold.materialid;
+			intersections.surfaceNormals[path_index] = glm::normalize(cold.invTranspose * normal);
+			// the world-space hit point falls straight out of the world ray
+			intersections.points[path_index] = getPointOnRay(ray, t_min);
+			intersections.lightAreas[path_index] = cold.lightArea;
+			intersections.uvs[path_index] = uv;
+		}
+	}
+}
+
+#if RAY_SORT_ENABLE || DEFERRED_SHADOW_ENABLE
+// Spread the low 9 bits of v two bits apart (2D/3D Morton building block;
+// the LBVH builder keeps its own float-domain variant).
+__device__ unsigned int expandBits9(unsigned int v) {
+	v &= 0x000001ffu;
+	v = (v | (v << 16)) & 0x030000ffu;
+	v = (v | (v << 8)) & 0x0300f00fu;
+	v = (v | (v << 4)) & 0x030c30c3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+#endif // RAY_SORT_ENABLE || DEFERRED_SHADOW_ENABLE
+
+#if RAY_SORT_ENABLE
+// One 32-bit coherence key per path: 3 bits of direction octant on top of
+// a 27-bit Morton code of the origin cell (512 cells per axis across the
+// scene bounds). Dead paths key to the maximum so the sort parks them at
+// the back; `indices` is reset to the identity for the sort to permute.
+__global__ void kernComputeRayKeys(int num_paths, PathSegmentSoA pathSegments,
+	const int* activePaths, glm::vec3 boundsMin, glm::vec3 invExtent,
+	unsigned int* keys, int* indices)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths) {
+		return;
+	}
+	int lane = idx;
+	if (activePaths != NULL) {
+		idx = activePaths[idx];
+	}
+	indices[lane] = idx;
+	if (pathSegments.remainingBounces[idx] <= 0) {
+		keys[lane] = 0xffffffffu;
+		return;
+	}
+	glm::vec3 dir = pathSegments.directions[idx];
+	unsigned int octant = (dir.x < 0.0f ? 4u : 0u) | (dir.y < 0.0f ? 2u : 0u) | (dir.z < 0.0f ? 1u : 0u);
+	glm::vec3 q = glm::clamp((pathSegments.origins[idx] - boundsMin) * invExtent, 0.0f, 1.0f);
+	unsigned int cell = (expandBits9((unsigned int)(q.x * 511.0f)) << 2)
+		| (expandBits9((unsigned int)(q.y * 511.0f)) << 1)
+		| expandBits9((unsigned int)(q.z * 511.0f));
+	keys[lane] = (octant << 27) | cell;
+}
+#endif // RAY_SORT_ENABLE
+
+template <bool MOVING, bool MERGE>
+__global__ void computeIntersections(
+	int depth
+	, int num_paths
+	, PathSegmentSoA pathSegments
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, int geoms_size
+	, ShadeableIntersectionSoA intersections
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const int* __restrict__ remap
+	)
+{
+	int path_index = blockIdx.x * blockDim.x + threadIdx.x;
+
+	const GeomHot* geomList = geoms;
+#if SHARED_GEOMS_ENABLE && !TLAS_ENABLE
+	// every thread walks the whole list, so load it once per block; all
+	// threads reach the barrier because nothing returns before this point
+	__shared__ GeomHot sharedGeoms[SHARED_GEOMS_MAX];
+	if (geoms_size <= SHARED_GEOMS_MAX)
+	{
+		for (int i = threadIdx.x; i < geoms_size; i += blockDim.x)
+		{
+			sharedGeoms[i] = geoms[i];
+		}
+		__syncthreads();
+		geomList = sharedGeoms;
+	}
+#endif // SHARED_GEOMS_ENABLE && !TLAS_ENABLE
+	if (path_index < num_paths)
+	{
+		// with the coherence sort on, threads walk paths in sorted order
+		if (remap != NULL) {
+			path_index = remap[path_index];
+		}
+		intersectOnePath<MOVING, MERGE>(path_index, pathSegments, geomList, geomsCold,
+			geoms_size, depth == 0 ? VIS_CAMERA : VIS_INDIRECT, intersections,
+			triangles, vertices, normals, bvhNodes, tlasNodes, tlasRoot);
+	}
+}
+
+#if PERSISTENT_THREADS
+// Persistent variant: the grid is sized to fill the device once and each
+// warp pulls 32-path chunks from the global queue until it runs dry. One
+// atomic per warp keeps the queue traffic negligible.
+template <bool MOVING, bool MERGE>
+__global__ void computeIntersectionsPersistent(
+	int num_paths
+	, int rayMask
+	, PathSegmentSoA pathSegments
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, int geoms_size
+	, ShadeableIntersectionSoA intersections
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, int* workCounter
+	, const int* __restrict__ remap
+	)
+{
+	const GeomHot* geomList = geoms;
+#if SHARED_GEOMS_ENABLE && !TLAS_ENABLE
+	__shared__ GeomHot sharedGeoms[SHARED_GEOMS_MAX];
+	if (geoms_size <= SHARED_GEOMS_MAX)
+	{
+		for (int i = threadIdx.x; i < geoms_size; i += blockDim.x)
+		{
+			sharedGeoms[i] = geoms[i];
+		}
+		__syncthreads();
+		geomList = sharedGeoms;
+	}
+#endif // SHARED_GEOMS_ENABLE && !TLAS_ENABLE
+	while (true)
+	{
+		int base = 0;
+		if ((threadIdx.x & 31) == 0)
+		{
+			base = atomicAdd(workCounter, 32);
+		}
+		base = __shfl_sync(0xffffffff, base, 0);
+		if (base >= num_paths)
+		{
+			return;
+		}
+		int path_index = base + (threadIdx.x & 31);
+		if (path_index < num_paths)
+		{
+			if (remap != NULL) {
+				path_index = remap[path_index];
+			}
+			intersectOnePath<MOVING, MERGE>(path_index, pathSegments, geomList, geomsCold,
+				geoms_size, rayMask, intersections, triangles, vertices, normals, bvhNodes,
+				tlasNodes, tlasRoot);
+		}
+	}
+}
+#endif // PERSISTENT_THREADS
+
+// Launch intersection for one bounce: a branch-free pass over the static
+// geoms, then a motion-blur pass over the moving tail that merges by hit
+// distance. Scenes with no moving geoms pay nothing for motion blur.
+#if PERSISTENT_THREADS
+static void traceOneBounce(int depth, int remaining_paths, dim3 numBlocks, int blockSize)
+{
+	// enough resident blocks to fill the device; queried once
+	static int numWorkerBlocks = 0;
+	if (numWorkerBlocks == 0) {
+		int device;
+		int numSMs;
+		cudaGetDevice(&device);
+		cudaDeviceGetAttribute(&numSMs, cudaDevAttrMultiProcessorCount, device);
+		numWorkerBlocks = 8 * numSMs;
+	}
+#if RAY_SORT_ENABLE
+	// secondary bounces consume the coherence-sorted index order (itself a
+	// permutation of the live-slot indirection when compaction is on)
+	const int* remap = depth > 0 ? dev_raySortIndices : dev_activePaths;
+#else
+	const int* remap = dev_activePaths;
+#endif // RAY_SORT_ENABLE
+#if OPTIX_BACKEND_ENABLE
+	if (hwTraceRequested && optixBackendAvailable()) {
+		optixBackendTrace(remaining_paths, dev_paths, remap, dev_intersections, computeStream);
+		return;
+	}
+#endif // OPTIX_BACKEND_ENABLE
+#if NVRTC_SPEC_ENABLE
+	if (nvrtcSpecAvailable()) {
+		nvrtcSpecTrace(remaining_paths, dev_paths, remap, dev_intersections,
+			dev_geomsHot, dev_geomsCold, depth == 0 ? VIS_CAMERA : VIS_INDIRECT,
+			computeStream);
+		return;
+	}
+#endif // NVRTC_SPEC_ENABLE
+	const int rayMask = depth == 0 ? VIS_CAMERA : VIS_INDIRECT;
+#if PROXY_BOUNCE_ENABLE
+	// deep bounces trade full-detail meshes for their coarsest LOD
+	const GeomHot* geomsHot = (depth >= PROXY_BOUNCE_DEPTH && dev_geomsHotProxy != NULL)
+		? dev_geomsHotProxy : dev_geomsHot;
+#else
+	const GeomHot* geomsHot = dev_geomsHot;
+#endif // PROXY_BOUNCE_ENABLE
+	if (numStaticGeoms > 0) {
+		cudaMemsetAsync(dev_intersectWorkCounter, 0, sizeof(int), computeStream);
+		computeIntersectionsPersistent<false, false> << <numWorkerBlocks, blockSize, 0, computeStream >> > (
+			remaining_paths, rayMask, dev_paths, geomsHot, dev_geomsCold, numStaticGeoms,
+			dev_intersections, dev_triangles, dev_vertices, dev_normals, dev_bvhNodes,
+			dev_tlasNodes, tlasRoot, dev_intersectWorkCounter, remap);
+	}
+	if (numMovingGeoms > 0) {
+		cudaMemsetAsync(dev_intersectWorkCounter, 0, sizeof(int), computeStream);
+		if (numStaticGeoms > 0) {
+			computeIntersectionsPersistent<true, true> << <numWorkerBlocks, blockSize, 0, computeStream >> > (
+				remaining_paths, rayMask, dev_paths, geomsHot + numStaticGeoms, dev_geomsCold + numStaticGeoms,
+				numMovingGeoms, dev_intersections, dev_triangles, dev_vertices, dev_normals,
+				dev_bvhNodes, dev_movingTlasNodes, movingTlasRoot, dev_intersectWorkCounter, remap);
+		}
+		else {
+			computeIntersectionsPersistent<true, false> << <numWorkerBlocks, blockSize, 0, computeStream >> > (
+				remaining_paths, rayMask, dev_paths, geomsHot + numStaticGeoms, dev_geomsCold + numStaticGeoms,
+				numMovingGeoms, dev_intersections, dev_triangles, dev_vertices, dev_normals,
+				dev_bvhNodes, dev_movingTlasNodes, movingTlasRoot, dev_intersectWorkCounter, remap);
+		}
+	}
+	checkCUDAError("trace one bounce");
+}
+#else
+static void traceOneBounce(int depth, int remaining_paths, dim3 numBlocks, int blockSize)
+{
+#if RAY_SORT_ENABLE
+	// secondary bounces consume the coherence-sorted index order (itself a
+	// permutation of the live-slot indirection when compaction is on)
+	const int* remap = depth > 0 ? dev_raySortIndices : dev_activePaths;
+#else
+	const int* remap = dev_activePaths;
+#endif // RAY_SORT_ENABLE
+#if OPTIX_BACKEND_ENABLE
+	if (hwTraceRequested && optixBackendAvailable()) {
+		optixBackendTrace(remaining_paths, dev_paths, remap, dev_intersections, computeStream);
+		return;
+	}
+#endif // OPTIX_BACKEND_ENABLE
+#if NVRTC_SPEC_ENABLE
+	if (nvrtcSpecAvailable()) {
+		nvrtcSpecTrace(remaining_paths, dev_paths, remap, dev_intersections,
+			dev_geomsHot, dev_geomsCold, depth == 0 ? VIS_CAMERA : VIS_INDIRECT,
+			computeStream);
+		return;
+	}
+#endif // NVRTC_SPEC_ENABLE
+#if PROXY_BOUNCE_ENABLE
+	// deep bounces trade full-detail meshes for their coarsest LOD
+	const GeomHot* geomsHot = (depth >= PROXY_BOUNCE_DEPTH && dev_geomsHotProxy != NULL)
+		? dev_geomsHotProxy : dev_geomsHot;
+#else
+	const GeomHot* geomsHot = dev_geomsHot;
+#endif // PROXY_BOUNCE_ENABLE
+	if (numStaticGeoms > 0) {
+		computeIntersections<false, false> << <numBlocks, blockSize, 0, computeStream >> > (
+			depth
+			, remaining_paths
+			, dev_paths
+			, geomsHot
+			, dev_geomsCold
+			, numStaticGeoms
+			, dev_intersections
+			, dev_triangles
+			, dev_vertices
+			, dev_normals
+			, dev_bvhNodes
+			, dev_tlasNodes
+			, tlasRoot
+			, remap
+			);
+	}
+	if (numMovingGeoms > 0) {
+		if (numStaticGeoms > 0) {
+			computeIntersections<true, true> << <numBlocks, blockSize, 0, computeStream >> > (
+				depth, remaining_paths, dev_paths, geomsHot + numStaticGeoms, dev_geomsCold + numStaticGeoms,
+				numMovingGeoms, dev_intersections, dev_triangles, dev_vertices, dev_normals, dev_bvhNodes, dev_movingTlasNodes, movingTlasRoot, remap);
+		}
+		else {
+			computeIntersections<true, false> << <numBlocks, blockSize, 0, computeStream >> > (
+				depth, remaining_paths, dev_paths, geomsHot + numStaticGeoms, dev_geomsCold + numStaticGeoms,
+				numMovingGeoms, dev_intersections, dev_triangles, dev_vertices, dev_normals, dev_bvhNodes, dev_movingTlasNodes, movingTlasRoot, remap);
+		}
+	}
+	checkCUDAError("trace one bounce");
+}
+#endif // PERSISTENT_THREADS
+
+#if FUSED_PRIMARY_ENABLE
+// Primary rays fused with primary visibility: the ray never leaves
+// registers between generation and its first hit, and the 2D tile launch
+// keeps each warp on a compact screen footprint, which primary traversal
+// rewards since all its rays share an origin.
+template <unsigned int FEATURES>
+__global__ void generatePrimaryAndIntersect(Camera cam, int iter, int traceDepth,
+	PathSegmentSoA pathSegments, thrust::default_random_engine* rngStates,
+	glm::vec3* image, int* pixelConverged, const int* pixelToSlot,
+	const GeomHot* __restrict__ geoms, const GeomCold* __restrict__ geomsCold, int numStatic, int numMoving,
+	ShadeableIntersectionSoA intersections,
+	const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices, const PackedNormal* __restrict__ normals,
+	const LBVHNode* __restrict__ bvhNodes, const LBVHNode* __restrict__ tlasNodes, int tlasRoot,
+	const LBVHNode* __restrict__ movingTlasNodes, int movingTlasRoot
+#if TILE_CULL_ENABLE
+	, const int* __restrict__ tileCullLists, const int* __restrict__ tileCullCounts
+#endif // TILE_CULL_ENABLE
+	)
+{
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+	if (x >= cam.resolution.x || y >= cam.resolution.y)
+	{
+		return;
+	}
+	Ray ray;
+	int slot = generateOneCameraRay<FEATURES>(cam, iter, traceDepth, x, y,
+		pathSegments, rngStates, image, pixelConverged, pixelToSlot, ray);
+	if (slot < 0)
+	{
+		// frozen pixel: dead path; downstream kernels skip it on
+		// remainingBounces without reading the intersection record
+		return;
+	}
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	glm::vec3 objNormal;
+	glm::vec2 objUV(0.0f);
+	float t_min = FLT_MAX;
+	int hit_geom_index = -1;
+	if (numStatic > 0) {
+#if TILE_CULL_ENABLE
+		if (tileCullLists != NULL) {
+			// each block is exactly one cull tile (TILE_CULL_SIZE matches
+			// the 2D block below), so the whole block walks one candidate
+			// list in lockstep; visibility was already filtered on the host
+			int tileIdx = blockIdx.y * gridDim.x + blockIdx.x;
+			int count = tileCullCounts[tileIdx];
+			const int* list = tileCullLists + (size_t)tileIdx * numStatic;
+			glm::vec3 tmp_normal;
+			glm::vec2 tmp_uv;
+			for (int c = 0; c < count; c++) {
+				int i = list[c];
+				float t = geomIntersectionTest<false>(geoms[i], ray, t_min, tmp_normal, tmp_uv,
+					triangles, vertices, normals, bvhNodes);
+				if (t > 0.0f && t_min > t) {
+					t_min = t;
+					hit_geom_index = i;
+					objNormal = tmp_normal;
+					objUV = tmp_uv;
+				}
+			}
+		}
+		else
+#endif // TILE_CULL_ENABLE
+		{
+			t_min = intersectList<false>(ray, invDir, t_min, geoms, numStatic, VIS_CAMERA,
+				objNormal, objUV, hit_geom_index, triangles, vertices, normals, bvhNodes,
+				tlasNodes, tlasRoot);
+		}
+	}
+	if (numMoving > 0) {
+		int hit_moving_index = -1;
+		t_min = intersectList<true>(ray, invDir, t_min, geoms + numStatic, numMoving, VIS_CAMERA,
+			objNormal, objUV, hit_moving_index, triangles, vertices, normals, bvhNodes,
+			movingTlasNodes, movingTlasRoot);
+		if (hit_moving_index >= 0) {
+			hit_geom_index = numStatic + hit_moving_index;
+		}
+	}
+
+	if (hit_geom_index == -1)
+	{
+		intersections.t[slot] = -1.0f;
+	}
+	else
+	{
+		GeomCold cold = geomsCold[hit_geom_index];
+		intersections.t[slot] = t_min;
+		intersections.materialIds[slot] = cold.materialid;
+		intersections.surfaceNormals[slot] = glm::normalize(cold.invTranspose * objNormal);
+		intersections.points[slot] = getPointOnRay(ray, t_min);
+		intersections.lightAreas[slot] = cold.lightArea;
+		intersections.uvs[slot] = objUV;
+	}
+}
+
+// Fused counterpart of launchGenerateRayFromCamera; same per-mask
+// instantiation scheme, with the scene buffers coming from the statics.
+static void launchGeneratePrimaryAndIntersect(dim3 blocksPerGrid2d, dim3 blockSize2d,
+	cudaStream_t stream, unsigned int features, Camera cam, int iter, int traceDepth)
+{
+#if TILE_CULL_ENABLE
+	// preview-scaled (or cropped) frames trace a different tile grid than
+	// the lists were built for; pass NULL and let the kernel fall back to
+	// the TLAS until the next full-resolution build
+	const int* tileLists = (cam.resolution.x == tileCullResX && cam.resolution.y == tileCullResY)
+		? dev_tileCullLists : NULL;
+#define LAUNCH_PRIMARY_KERNEL(MASK) \
+	case (MASK): \
+		generatePrimaryAndIntersect<(MASK)> << <blocksPerGrid2d, blockSize2d, 0, stream >> > ( \
+			cam, iter, traceDepth, dev_paths, dev_rngStates, dev_image, dev_pixelConverged, dev_pixelToSlot, \
+			dev_geomsHot, dev_geomsCold, numStaticGeoms, numMovingGeoms, dev_intersections, \
+			dev_triangles, dev_vertices, dev_normals, dev_bvhNodes, dev_tlasNodes, tlasRoot, \
+			dev_movingTlasNodes, movingTlasRoot, tileLists, dev_tileCullCounts); \
+		break;
+#else
+#define LAUNCH_PRIMARY_KERNEL(MASK) \
+	case (MASK): \
+		generatePrimaryAndIntersect<(MASK)> << <blocksPerGrid2d, blockSize2d, 0, stream >> > ( \
+			cam, iter, traceDepth, dev_paths, dev_rngStates, dev_image, dev_pixelConverged, dev_pixelToSlot, \
+			dev_geomsHot, dev_geomsCold, numStaticGeoms, numMovingGeoms, dev_intersections, \
+			dev_triangles, dev_vertices, dev_normals, dev_bvhNodes, dev_tlasNodes, tlasRoot, \
+			dev_movingTlasNodes, movingTlasRoot); \
+		break;
+#endif // TILE_CULL_ENABLE
+	switch (features) {
+	LAUNCH_PRIMARY_KERNEL(0)
+	LAUNCH_PRIMARY_KERNEL(CAM_FEATURE_AA)
+	LAUNCH_PRIMARY_KERNEL(CAM_FEATURE_DOF)
+	LAUNCH_PRIMARY_KERNEL(CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_PRIMARY_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_DOF)
+	LAUNCH_PRIMARY_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_PRIMARY_KERNEL(CAM_FEATURE_DOF | CAM_FEATURE_MOTION_BLUR)
+	LAUNCH_PRIMARY_KERNEL(CAM_FEATURE_AA | CAM_FEATURE_DOF | CAM_FEATURE_MOTION_BLUR)
+	}
+#undef LAUNCH_PRIMARY_KERNEL
+}
+#endif // FUSED_PRIMARY_ENABLE
+
+#if DIRECT_LIGHTING_ENABLE
+// Power-proportional light selection: alias table over each listed light's
+// luminance * area, built at init like the environment map's. Uniform
+// selection makes direct-lighting variance scale with the light count;
+// drawing bright fixtures proportionally more often keeps it flat as art
+// adds lights. c_lightPowerTotal is the table's normalizer (0 when the
+// scene lists no lights), and selection pdfs fall out of the Light record:
+// luminance(emittance) * area / total.
+__constant__ const float* c_lightAliasProb;
+__constant__ const int* c_lightAliasIdx;
+__constant__ float c_lightPowerTotal;
+
+// Sample a point uniformly (in area) on one light's surface. Returns the
+// world-space point and writes the surface normal there; the normal comes
+// from the forward transform, which is exact up to non-uniform scale.
+__device__ glm::vec3 sampleLightSurface(const Light& light, thrust::default_random_engine& rng, glm::vec3& lightNormal)
+{
+	thrust::uniform_real_distribution<float> u01(0, 1);
+	if (light.type == SPHERE)
+	{
+		// uniform direction, scaled to the unit sphere's 0.5 radius
+		float z = 1.0f - 2.0f * u01(rng);
+		float phi = TWO_PI * u01(rng);
+		float s = sqrt(glm::max(0.0f, 1.0f - z * z));
+		glm::vec3 dir(s * cos(phi), s * sin(phi), z);
+		lightNormal = glm::normalize(multiplyMV(light.transform, glm::vec4(dir, 0.0f)));
+		return multiplyMV(light.transform, glm::vec4(0.5f * dir, 1.0f));
+	}
+	// cube: pick a face pair axis proportionally to its world-space area,
+	// then a side and a uniform point on that face of the unit cube
+	float ax = glm::length(glm::cross(glm::vec3(light.transform[1]), glm::vec3(light.transform[2])));
+	float ay = glm::length(glm::cross(glm::vec3(light.transform[2]), glm::vec3(light.transform[0])));
+	float az = glm::length(glm::cross(glm::vec3(light.transform[0]), glm::vec3(light.transform[1])));
+	float pick = u01(rng) * (ax + ay + az);
+	float side = u01(rng) < 0.5f ? 0.5f : -0.5f;
+	float u = u01(rng) - 0.5f;
+	float v = u01(rng) - 0.5f;
+	glm::vec3 p;
+	glm::vec3 n;
+	if (pick < ax)
+	{
+		p = glm::vec3(side, u, v);
+		n = glm::vec3(side, 0.0f, 0.0f);
+	}
+	else if (pick < ax + ay)
+	{
+		p = glm::vec3(u, side, v);
+		n = glm::vec3(0.0f, side, 0.0f);
+	}
+	else
+	{
+		p = glm::vec3(u, v, side);
+		n = glm::vec3(0.0f, 0.0f, side);
+	}
+	lightNormal = glm::normalize(multiplyMV(light.transform, glm::vec4(n, 0.0f)));
+	return multiplyMV(light.transform, glm::vec4(p, 1.0f));
+}
+
+// One O(1) draw from the environment's luminance distribution: pick the
+// alias-table slot, keep it or take its alias, jitter within the texel and
+// invert the equirect mapping back to a world direction. Writes the
+// solid-angle pdf of the draw (selection probability not included; the
+// caller folds in c_envSelectProb) and returns the texel radiance.
+__device__ glm::vec3 sampleEnvironment(
+	thrust::default_random_engine& rng, glm::vec3& wi, float& pdf)
+{
+	thrust::uniform_real_distribution<float> u01(0, 1);
+	int n = c_envMapSize.x * c_envMapSize.y;
+	int slot = glm::min((int)(u01(rng) * n), n - 1);
+	int texel = u01(rng) < c_envAliasProb[slot] ? slot : c_envAliasIdx[slot];
+	pdf = c_envPdf[texel];
+	int x = texel % c_envMapSize.x;
+	int y = texel / c_envMapSize.x;
+	float u = (x + u01(rng)) / c_envMapSize.x;
+	float v = (y + u01(rng)) / c_envMapSize.y;
+	float phi = (u - 0.5f) * TWO_PI;
+	float theta = v * PI;
+	float sinTheta = sinf(theta);
+	wi = glm::vec3(sinTheta * cosf(phi), cosf(theta), sinTheta * sinf(phi));
+	float4 texelColor = tex1Dfetch<float4>(c_texEnvMap, texel);
+	return glm::vec3(texelColor.x, texelColor.y, texelColor.z);
+}
+
+#if PORTAL_SAMPLING_ENABLE
+// Portal stand-in for sampleEnvironment: pick a portal in proportion to
+// its area, a point uniformly on its rectangle, and return the map
+// radiance toward that point with the solid-angle pdf of the draw (sans
+// c_envSelectProb, same convention as sampleEnvironment). Every
+// unoccluded environment direction from an interior passes through an
+// opening, so the directions this can never draw are exactly the ones
+// the walls would have eaten anyway.
+__device__ glm::vec3 samplePortal(glm::vec3 point,
+	thrust::default_random_engine& rng, glm::vec3& wi, float& pdf)
+{
+	thrust::uniform_real_distribution<float> u01(0, 1);
+	float pick = u01(rng) * c_portalAreaTotal;
+	int i = 0;
+	for (; i < c_numPortals - 1 && pick > c_portals[i].area; i++) {
+		pick -= c_portals[i].area;
+	}
+	const Portal& p = c_portals[i];
+	glm::vec3 onPortal = p.corner + u01(rng) * p.edgeU + u01(rng) * p.edgeV;
+	glm::vec3 toPortal = onPortal - point;
+	float dist2 = glm::dot(toPortal, toPortal);
+	float dist = sqrt(dist2);
+	wi = toPortal / dist;
+	// two-sided: the opening works from either side of its plane
+	float cosPortal = fabsf(glm::dot(p.normal, wi));
+	if (cosPortal <= 1e-6f || dist2 <= EPSILON) {
+		pdf = 0.0f;
+		return glm::vec3(0.0f);
+	}
+	// area-proportional selection cancels the per-portal area (portalPdf
+	// reconstructs the same value for the BSDF side)
+	pdf = dist2 / (cosPortal * c_portalAreaTotal);
+	return environmentRadiance(wi);
+}
+#endif // PORTAL_SAMPLING_ENABLE
+
+// True if any geom in [geoms, geoms + geoms_size) blocks the shadow ray
+// before dist; first blocker wins, via the any-hit tests. Geoms outside
+// the VIS_SHADOW class (backdrop cards, light fixtures excluded from
+// their own shadow rays) are never candidates.
+template <bool MOVING>
+__device__ bool occludedByList(Ray ray, glm::vec3 invDir, float dist,
+	const GeomHot* __restrict__ geoms, int geoms_size, const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices,
+	const LBVHNode* __restrict__ bvhNodes, const LBVHNode* __restrict__ tlasNodes, int tlasRoot)
+{
+#if TLAS_ENABLE
+	int stack[64];
+	int stackTop = 0;
+	stack[stackTop++] = tlasRoot;
+	while (stackTop > 0)
+	{
+		const LBVHNode& node = tlasNodes[stack[--stackTop]];
+		if (node.left < 0)
+		{
+			int i = node.triangleIndex;
+			if ((geoms[i].visibility & VIS_SHADOW) == 0)
+			{
+				continue;
+			}
+			glm::vec3 offset = MOVING ? ray.time * geoms[i].motionOffset : glm::vec3(0.0f);
+			if (!boundingIntersectionTest(ray, invDir, node.leftBottom + offset, node.rightTop + offset, dist))
+			{
+				continue;
+			}
+			if (geomAnyHitTest<MOVING>(geoms[i], ray, dist, triangles, vertices, bvhNodes))
+			{
+				return true;
+			}
+		}
+		else
+		{
+			if (!boundingIntersectionTest(ray, invDir, node.leftBottom, node.rightTop, dist))
+			{
+				continue;
+			}
+			stack[stackTop++] = node.left;
+			stack[stackTop++] = node.right;
+		}
+	}
+#else
+	for (int i = 0; i < geoms_size; i++)
+	{
+		if ((geoms[i].visibility & VIS_SHADOW) == 0)
+		{
+			continue;
+		}
+		if (geomAnyHitTest<MOVING>(geoms[i], ray, dist, triangles, vertices, bvhNodes))
+		{
+			return true;
+		}
+	}
+#endif // TLAS_ENABLE
+	return false;
+}
+
+// One area-measure light sample per live diffuse hit: pick a light uniformly,
+// sample its surface, and bank the unoccluded contribution into the path's
+// radiance stream, weighted by the power heuristic against the BSDF sample
+// that may find the same light one bounce later.
+// Core of next event estimation for one shaded point, shared between the
+// standalone kernel below and the fused megakernel. Draws from the caller's
+// rng lane (all draws happen up front, so the lane can be stored back
+// whether or not the sample survives) and returns the weighted light
+// contribution sans path throughput; zero if occluded or below a horizon.
+// With DEFERRED the visibility test is not traced here: the shadow ray is
+// written into *job instead and the returned contribution is the
+// unoccluded value, for the caller to queue (DEFERRED_SHADOW_ENABLE).
+template <bool DEFERRED>
+__device__ glm::vec3 sampleDirectLight(
+	glm::vec3 point, glm::vec3 surfNormal, const Material& material, float time,
+	thrust::default_random_engine& rng,
+	const Light* __restrict__ lights, int numLights,
+	const GeomHot* __restrict__ geoms, int numStatic, int numMoving,
+	const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices, const LBVHNode* __restrict__ bvhNodes,
+	const LBVHNode* __restrict__ tlasNodes, int tlasRoot, const LBVHNode* __restrict__ movingTlasNodes, int movingTlasRoot,
+	ShadowJob* job = NULL)
+{
+	thrust::uniform_real_distribution<float> u01(0, 1);
+
+	// with an environment map loaded, split the light sample between the
+	// map and the area lights; each technique's estimator divides by its
+	// selection probability, and the MIS weights on both sides pair the
+	// same selection-scaled pdfs, so the combination stays unbiased
+	float areaSelect = 1.0f;
+	if (c_envMapSize.x > 0)
+	{
+		if (numLights <= 0 || u01(rng) < c_envSelectProb)
+		{
+			glm::vec3 wi;
+			float pdf;
+			glm::vec3 radiance;
+#if PORTAL_SAMPLING_ENABLE
+			// with portals marked, aim the sample through an opening
+			// instead of at an arbitrary bright texel the walls likely hide
+			if (c_numPortals > 0)
+			{
+				radiance = samplePortal(point, rng, wi, pdf);
+			}
+			else
+#endif // PORTAL_SAMPLING_ENABLE
+			{
+				radiance = sampleEnvironment(rng, wi, pdf);
+			}
+			float cosSurf = glm::dot(surfNormal, wi);
+			if (cosSurf <= 0.0f || pdf <= 0.0f)
+			{
+				return glm::vec3(0.0f);
+			}
+			Ray shadowRay;
+			shadowRay.origin = point + 0.001f * surfNormal;
+			shadowRay.direction = wi;
+			shadowRay.time = time;
+			// anything along the ray occludes; the map itself is at infinity
+			if (DEFERRED)
+			{
+				job->origin = shadowRay.origin;
+				job->direction = wi;
+				job->maxT = FLT_MAX;
+				job->time = time;
+			}
+			else
+			{
+				glm::vec3 invDir = 1.0f / wi;
+				if (numStatic > 0 && occludedByList<false>(shadowRay, invDir, FLT_MAX,
+					geoms, numStatic, triangles, vertices, bvhNodes, tlasNodes, tlasRoot))
+				{
+					return glm::vec3(0.0f);
+				}
+				if (numMoving > 0 && occludedByList<true>(shadowRay, invDir, FLT_MAX,
+					geoms + numStatic, numMoving, triangles, vertices, bvhNodes,
+					movingTlasNodes, movingTlasRoot))
+				{
+					return glm::vec3(0.0f);
+				}
+			}
+			float pdfEnv = pdf * c_envSelectProb;
+			float pdfBsdf = cosSurf / PI;
+			float weight = (pdfEnv * pdfEnv) / (pdfEnv * pdfEnv + pdfBsdf * pdfBsdf);
+			return weight * (material.color / PI) * cosSurf * radiance / pdfEnv;
+		}
+		areaSelect = 1.0f - c_envSelectProb;
+	}
+
+	// alias-table draw, power-proportional; zero-power lights are never picked
+	int slot = glm::min((int)(u01(rng) * numLights), numLights - 1);
+	int pick = u01(rng) < c_lightAliasProb[slot] ? slot : c_lightAliasIdx[slot];
+	Light light = lights[pick];
+	float selectPdf = glm::dot(light.emittance, glm::vec3(0.2126f, 0.7152f, 0.0722f))
+		* light.area / c_lightPowerTotal;
+	if (selectPdf <= 0.0f)
+	{
+		return glm::vec3(0.0f);
+	}
+
+	glm::vec3 lightNormal;
+	glm::vec3 lightPoint = sampleLightSurface(light, rng, lightNormal);
+
+	glm::vec3 toLight = lightPoint - point;
+	float dist2 = glm::dot(toLight, toLight);
+	float dist = sqrt(dist2);
+	glm::vec3 wi = toLight / dist;
+	float cosSurf = glm::dot(surfNormal, wi);
+	float cosLight = glm::dot(lightNormal, -wi);
+	if (cosSurf <= 0.0f || cosLight <= 0.0f)
+	{
+		return glm::vec3(0.0f);
+	}
+
+	Ray shadowRay;
+	shadowRay.origin = point + 0.001f * surfNormal;
+	shadowRay.direction = wi;
+	shadowRay.time = time;
+	// stop just short of the light so its own surface does not occlude
+	float maxT = dist - 0.01f;
+	if (DEFERRED)
+	{
+		job->origin = shadowRay.origin;
+		job->direction = wi;
+		job->maxT = maxT;
+		job->time = time;
+	}
+	else
+	{
+		glm::vec3 invDir = 1.0f / wi;
+		if (numStatic > 0 && occludedByList<false>(shadowRay, invDir, maxT,
+			geoms, numStatic, triangles, vertices, bvhNodes, tlasNodes, tlasRoot))
+		{
+			return glm::vec3(0.0f);
+		}
+		if (numMoving > 0 && occludedByList<true>(shadowRay, invDir, maxT,
+			geoms + numStatic, numMoving, triangles, vertices, bvhNodes,
+			movingTlasNodes, movingTlasRoot))
+		{
+			return glm::vec3(0.0f);
+		}
+	}
+
+	// f * G * Le over the area-measure pdf selectPdf / area; the
+	// cosine-weighted diffuse convention elsewhere makes f = albedo / pi
+	float G = cosSurf * cosLight / dist2;
+	// power heuristic against the BSDF technique, both pdfs in solid angle
+	float pdfLight = dist2 * selectPdf / (cosLight * light.area);
+	float pdfBsdf = cosSurf / PI;
+	float weight = (pdfLight * pdfLight) / (pdfLight * pdfLight + pdfBsdf * pdfBsdf);
+	// the weight pairs the same pdfs emissiveMisWeight reconstructs (no
+	// env-split factor), so only the estimator divides by the probability
+	// of having taken this branch
+	return weight * (material.color / PI) * G * light.emittance * (light.area / selectPdf) / areaSelect;
+}
+
+__global__ void kernSampleDirectLight(
+	int num_paths
+	, int depth
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const Light* __restrict__ lights
+	, int numLights
+	, const GeomHot* __restrict__ geoms
+	, int numStatic
+	, int numMoving
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	, const int* activePaths
+#if DEFERRED_SHADOW_ENABLE
+	, ShadowJob* shadowQueue
+	, int* shadowQueueCount
+#endif // DEFERRED_SHADOW_ENABLE
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths)
+	{
+		return;
+	}
+	if (activePaths != NULL)
+	{
+		idx = activePaths[idx];
+	}
+	if (pathSegments.remainingBounces[idx] <= 0)
+	{
+		return;
+	}
+	if (shadeableIntersections.t[idx] <= 0.0f)
+	{
+		return;
+	}
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+	// only the diffuse lobe gets a light sample; emissive hits shade
+	// themselves and the specular/refractive deltas cannot hit an area sample
+	if (material.emittance > 0.0f || material.hasRefractive > 0.0f || material.hasReflective >= 1.0f)
+	{
+		return;
+	}
+
+	int lane = rngLane(idx, pathSegments.pixelIndices[idx]);
+	thrust::default_random_engine rng = rngStates[lane];
+#if DEFERRED_SHADOW_ENABLE
+	ShadowJob job;
+	glm::vec3 contribution = sampleDirectLight<true>(
+		shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx],
+		material, pathSegments.times[idx], rng, lights, numLights,
+		geoms, numStatic, numMoving, triangles, vertices, bvhNodes,
+		tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot, &job);
+	rngStates[lane] = rng;
+	contribution *= pathSegments.colors[idx];
+	// samples rejected before the visibility test (horizon, zero pdf) have
+	// nothing to trace; only survivors pay for a queue slot
+	if (contribution.x + contribution.y + contribution.z <= 0.0f)
+	{
+		return;
+	}
+	job.contribution = contribution;
+	job.pixel = pathSegments.pixelIndices[idx];
+	// the queue holds one slot per live path per bounce, so the
+	// warp-aggregated append can never overflow
+	int store = StreamCompaction::warpEmit(shadowQueueCount);
+	shadowQueue[store] = job;
+#else // DEFERRED_SHADOW_ENABLE
+	glm::vec3 contribution = sampleDirectLight<false>(
+		shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx],
+		material, pathSegments.times[idx], rng, lights, numLights,
+		geoms, numStatic, numMoving, triangles, vertices, bvhNodes,
+		tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot);
+	rngStates[lane] = rng;
+	pathSegments.radiances[idx] += pathSegments.colors[idx] * contribution;
+#if AOV_ENABLE
+	// the first vertex's light sample is the direct component
+	if (depth == 0) {
+		c_aovDirect[pathSegments.pixelIndices[idx]] += pathSegments.colors[idx] * contribution;
+	}
+#endif // AOV_ENABLE
+#endif // DEFERRED_SHADOW_ENABLE
+}
+
+#if DEFERRED_SHADOW_ENABLE
+// Coherence keys for the queued shadow rays, the same direction-octant /
+// origin-Morton layout kernComputeRayKeys gives the bounce rays; every
+// queue entry is live, so there is no dead-path escape.
+__global__ void kernComputeShadowKeys(int numJobs, const ShadowJob* __restrict__ jobs,
+	glm::vec3 boundsMin, glm::vec3 invExtent, unsigned int* keys, int* indices)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= numJobs) {
+		return;
+	}
+	indices[idx] = idx;
+	glm::vec3 dir = jobs[idx].direction;
+	unsigned int octant = (dir.x < 0.0f ? 4u : 0u) | (dir.y < 0.0f ? 2u : 0u) | (dir.z < 0.0f ? 1u : 0u);
+	glm::vec3 q = glm::clamp((jobs[idx].origin - boundsMin) * invExtent, 0.0f, 1.0f);
+	unsigned int cell = (expandBits9((unsigned int)(q.x * 511.0f)) << 2)
+		| (expandBits9((unsigned int)(q.y * 511.0f)) << 1)
+		| expandBits9((unsigned int)(q.z * 511.0f));
+	keys[idx] = (octant << 27) | cell;
+}
+
+// Trace the whole iteration's shadow queue in sorted order and deposit the
+// unoccluded contributions. The owning paths may already have banked their
+// colors at a kill site by now, so the deposits go straight into the
+// accumulation image - always atomically, since several bounces of one
+// pixel land in the same launch - and the firefly clamp sees each light
+// sample on its own instead of folded into the path's banked sum.
+__global__ void kernResolveShadowQueue(
+	int numJobs
+	, const ShadowJob* __restrict__ jobs
+	, const int* __restrict__ indices
+	, glm::vec3* image
+	, glm::vec3* clampedEnergy
+	, const GeomHot* __restrict__ geoms
+	, int numStatic
+	, int numMoving
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	)
+{
+	int lane = blockIdx.x * blockDim.x + threadIdx.x;
+	if (lane >= numJobs)
+	{
+		return;
+	}
+	ShadowJob job = jobs[indices[lane]];
+	Ray shadowRay;
+	shadowRay.origin = job.origin;
+	shadowRay.direction = job.direction;
+	shadowRay.time = job.time;
+	glm::vec3 invDir = 1.0f / job.direction;
+	if (numStatic > 0 && occludedByList<false>(shadowRay, invDir, job.maxT,
+		geoms, numStatic, triangles, vertices, bvhNodes, tlasNodes, tlasRoot))
+	{
+		return;
+	}
+	if (numMoving > 0 && occludedByList<true>(shadowRay, invDir, job.maxT,
+		geoms + numStatic, numMoving, triangles, vertices, bvhNodes,
+		movingTlasNodes, movingTlasRoot))
+	{
+		return;
+	}
+	glm::vec3 contribution = job.contribution;
+#if SPP_BATCH > 1
+	contribution *= 1.0f / (float)SPP_BATCH;
+#endif // SPP_BATCH
+#if FIREFLY_CLAMP_ENABLE
+	float l = glm::dot(contribution, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	if (l > FIREFLY_CLAMP) {
+		glm::vec3 kept = contribution * (FIREFLY_CLAMP / l);
+		glm::vec3 excess = contribution - kept;
+		atomicAdd(&clampedEnergy[job.pixel].x, excess.x);
+		atomicAdd(&clampedEnergy[job.pixel].y, excess.y);
+		atomicAdd(&clampedEnergy[job.pixel].z, excess.z);
+		contribution = kept;
+	}
+#endif // FIREFLY_CLAMP_ENABLE
+	atomicAdd(&image[job.pixel].x, contribution.x);
+	atomicAdd(&image[job.pixel].y, contribution.y);
+	atomicAdd(&image[job.pixel].z, contribution.z);
+}
+#endif // DEFERRED_SHADOW_ENABLE
+
+#if VOLUME_ENABLE
+// Homogeneous medium in the constant bank, mirrored from Scene::medium at
+// init. The mean extinction drives distance sampling and doubles as the
+// device-side "medium present" gate: zero short-circuits every volume
+// branch, so builds with the toggle on cost scenes without a MEDIUM block
+// nothing but the compare.
+__constant__ glm::vec3 c_mediumSigmaS;
+__constant__ glm::vec3 c_mediumSigmaT;
+__constant__ float c_mediumSigmaTBar;
+__constant__ float c_mediumG;
+
+// written into the intersection t stream when the bounce happened in the
+// medium: every surface-stage kernel skips the slot outright
+#define VOLUME_SCATTERED_T -2.0f
+// prevPdfs marker for a phase-sampled continuation: listed-light hits are
+// already covered by the banked equiangular sample and must count zero,
+// while unlisted emitters and the environment still count in full
+#define VOLUME_PHASE_PDF -2.0f
+
+__device__ inline glm::vec3 mediumTransmittance(float d) {
+	return glm::vec3(expf(-c_mediumSigmaT.x * d),
+		expf(-c_mediumSigmaT.y * d), expf(-c_mediumSigmaT.z * d));
+}
+
+// Henyey-Greenstein phase function over the cosine between the incoming
+// propagation direction and the scattered direction; the function is its
+// own solid-angle pdf, so sampled continuations carry unit phase weight
+__device__ inline float hgPhase(float cosTheta) {
+	float g = c_mediumG;
+	float denom = 1.0f + g * g - 2.0f * g * cosTheta;
+	return (1.0f - g * g) / (4.0f * PI * denom * sqrtf(fmaxf(denom, 1e-6f)));
+}
+
+__device__ glm::vec3 sampleHenyeyGreenstein(glm::vec3 dir, float u1, float u2) {
+	float g = c_mediumG;
+	float cosTheta;
+	if (fabsf(g) < 1e-3f) {
+		cosTheta = 1.0f - 2.0f * u1;
+	} else {
+		float sq = (1.0f - g * g) / (1.0f - g + 2.0f * g * u1);
+		cosTheta = (1.0f + g * g - sq * sq) / (2.0f * g);
+	}
+	float sinTheta = sqrtf(fmaxf(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = TWO_PI * u2;
+	// same not-parallel-axis basis trick as the hemisphere sampler
+	glm::vec3 other = fabsf(dir.x) < SQRT_OF_ONE_THIRD ? glm::vec3(1, 0, 0)
+		: fabsf(dir.y) < SQRT_OF_ONE_THIRD ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1);
+	glm::vec3 tangent = glm::normalize(glm::cross(dir, other));
+	glm::vec3 bitangent = glm::cross(dir, tangent);
+	return cosTheta * dir
+		+ sinTheta * (cosf(phi) * tangent + sinf(phi) * bitangent);
+}
+
+/**
+ * One segment's worth of medium work, shared by the standalone kernel and
+ * the fused bounce: bank the equiangular single-scatter sample toward the
+ * listed lights, then let transmittance-based distance sampling decide
+ * whether the path scatters before its surface hit (tHit < 0 for a miss:
+ * an infinite homogeneous segment always scatters). Returns true when it
+ * scattered - the path streams are already rewritten and the surface
+ * stages must leave the slot alone this bounce.
+ */
+__device__ bool volumeInteract(
+	PathSegmentSoA& pathSegments, int idx, Ray ray, float tHit,
+	thrust::default_random_engine& rng,
+	const Light* __restrict__ lights, int numLights,
+	const GeomHot* __restrict__ geoms, int numStatic, int numMoving,
+	const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices, const LBVHNode* __restrict__ bvhNodes,
+	const LBVHNode* __restrict__ tlasNodes, int tlasRoot, const LBVHNode* __restrict__ movingTlasNodes, int movingTlasRoot)
+{
+	thrust::uniform_real_distribution<float> u01(0, 1);
+	float tMax = tHit > 0.0f ? tHit : 1e16f;
+
+	// Single scattering toward the NEE light list, one sample per segment:
+	// draw a light from the alias table, then place the scatter vertex
+	// along the segment with the equiangular distribution around it, which
+	// puts samples where the 1/r^2 kernel peaks instead of where the
+	// transmittance does. Banked like the surface NEE, weighted by the
+	// throughput carried into this segment.
+	if (numLights > 0) {
+		int slot = glm::min((int)(u01(rng) * numLights), numLights - 1);
+		int pick = u01(rng) < c_lightAliasProb[slot] ? slot : c_lightAliasIdx[slot];
+		Light light = lights[pick];
+		float selectPdf = glm::dot(light.emittance, glm::vec3(0.2126f, 0.7152f, 0.0722f))
+			* light.area / c_lightPowerTotal;
+		if (selectPdf > 0.0f) {
+			glm::vec3 lightNormal;
+			glm::vec3 lightPoint = sampleLightSurface(light, rng, lightNormal);
+			// distance along the ray of the point nearest the light, and
+			// the perpendicular miss distance the angles pivot around
+			float delta = glm::dot(lightPoint - ray.origin, ray.direction);
+			float D = fmaxf(glm::length(ray.origin + delta * ray.direction - lightPoint), 1e-4f);
+			float thetaA = atanf(-delta / D);
+			float thetaB = atanf((tMax - delta) / D);
+			if (thetaB - thetaA > 1e-6f) {
+				float theta = glm::mix(thetaA, thetaB, u01(rng));
+				float x = glm::clamp(delta + D * tanf(theta), 0.0f, tMax);
+				float pdfX = D / ((thetaB - thetaA) * (D * D + (x - delta) * (x - delta)));
+				glm::vec3 p = getPointOnRay(ray, x);
+				glm::vec3 toLight = lightPoint - p;
+				float dist2 = glm::dot(toLight, toLight);
+				float dist = sqrt(dist2);
+				glm::vec3 wi = toLight / dist;
+				float cosLight = glm::dot(lightNormal, -wi);
+				if (cosLight > 0.0f && pdfX > 0.0f) {
+					Ray shadowRay;
+					shadowRay.origin = p;
+					shadowRay.direction = wi;
+					shadowRay.time = ray.time;
+					glm::vec3 invDir = 1.0f / wi;
+					// stop just short of the light so its own surface does not occlude
+					float maxT = dist - 0.01f;
+					bool occluded = numStatic > 0 && occludedByList<false>(shadowRay, invDir, maxT,
+						geoms, numStatic, triangles, vertices, bvhNodes, tlasNodes, tlasRoot);
+					if (!occluded && numMoving > 0) {
+						occluded = occludedByList<true>(shadowRay, invDir, maxT,
+							geoms + numStatic, numMoving, triangles, vertices, bvhNodes,
+							movingTlasNodes, movingTlasRoot);
+					}
+					if (!occluded) {
+						// Tr to the vertex, scatter there, phase toward the
+						// light, Tr and geometry of the connection; over the
+						// equiangular, area and selection pdfs
+						glm::vec3 contribution = mediumTransmittance(x) * c_mediumSigmaS
+							* hgPhase(glm::dot(ray.direction, wi))
+							* mediumTransmittance(dist) * light.emittance
+							* (cosLight * light.area / (dist2 * pdfX * selectPdf));
+						pathSegments.radiances[idx] += pathSegments.colors[idx] * contribution;
+					}
+				}
+			}
+		}
+	}
+
+	// transmittance-based distance sampling drives the path itself
+	float d = -logf(fmaxf(1.0f - u01(rng), 1e-7f)) / c_mediumSigmaTBar;
+	if (tHit > 0.0f && d >= tHit) {
+		// reached the surface: the per-channel transmittance over the
+		// survival probability exp(-sigmaTBar * tHit); exactly 1 for a
+		// gray medium, a spectral correction otherwise
+		pathSegments.colors[idx] *= mediumTransmittance(tHit) * expf(c_mediumSigmaTBar * tHit);
+		return false;
+	}
+
+	// scatter: weight by Tr * sigmaS over the sampling density
+	// sigmaTBar * exp(-sigmaTBar * d), then continue with a phase draw.
+	// The phase function is its own pdf, so nothing else rides along.
+	pathSegments.colors[idx] *= mediumTransmittance(d) * c_mediumSigmaS
+		* (expf(c_mediumSigmaTBar * d) / c_mediumSigmaTBar);
+	glm::vec3 newDir = sampleHenyeyGreenstein(ray.direction, u01(rng), u01(rng));
+	int remainingBounces = pathSegments.remainingBounces[idx] - 1;
+	if (remainingBounces <= 0) {
+		// out of bounces while still inside the infinite medium: whatever
+		// lies beyond sits behind unbounded optical depth
+		pathSegments.colors[idx] = glm::vec3(0.0f);
+		remainingBounces = 0;
+	}
+	pathSegments.origins[idx] = ray.origin + d * ray.direction;
+	pathSegments.directions[idx] = newDir;
+	pathSegments.invDirections[idx] = 1.0f / newDir;
+	pathSegments.remainingBounces[idx] = remainingBounces;
+	pathSegments.prevPdfs[idx] = VOLUME_PHASE_PDF;
+#if TERMINATE_GATHER_ENABLE
+	if (remainingBounces <= 0) {
+		accumulateTerminatedPath(pathSegments, idx);
+	}
+#endif // TERMINATE_GATHER_ENABLE
+	return true;
+}
+
+// Medium stage of the split pipeline, launched between the intersection
+// and surface stages: same live-slot plumbing as kernSampleDirectLight,
+// with the sentinel left in t for the slots that scattered.
+__global__ void kernVolumeScatter(
+	int num_paths
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, thrust::default_random_engine* rngStates
+	, const Light* __restrict__ lights
+	, int numLights
+	, const GeomHot* __restrict__ geoms
+	, int numStatic
+	, int numMoving
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	, const int* activePaths
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths)
+	{
+		return;
+	}
+	if (activePaths != NULL)
+	{
+		idx = activePaths[idx];
+	}
+	if (pathSegments.remainingBounces[idx] <= 0)
+	{
+		return;
+	}
+	Ray ray;
+	ray.origin = pathSegments.origins[idx];
+	ray.direction = pathSegments.directions[idx];
+	ray.time = numMoving > 0 ? pathSegments.times[idx] : 0.0f;
+	int lane = rngLane(idx, pathSegments.pixelIndices[idx]);
+	thrust::default_random_engine rng = rngStates[lane];
+	if (volumeInteract(pathSegments, idx, ray, shadeableIntersections.t[idx], rng,
+		lights, numLights, geoms, numStatic, numMoving, triangles, vertices, bvhNodes,
+		tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot)) {
+		shadeableIntersections.t[idx] = VOLUME_SCATTERED_T;
+	}
+	rngStates[lane] = rng;
+}
+#endif // VOLUME_ENABLE
+
+#if RESTIR_ENABLE
+// Target function the reservoirs resample toward: luminance of the
+// unshadowed contribution f * G * Le of a light sample at this shading
+// point. Visibility deliberately stays out - it is paid once, for the
+// final winner only.
+__device__ float restirTargetPdf(
+	glm::vec3 point, glm::vec3 surfNormal, glm::vec3 albedo,
+	glm::vec3 lightPoint, glm::vec3 lightNormal, glm::vec3 emittance)
+{
+	glm::vec3 toLight = lightPoint - point;
+	float dist2 = glm::dot(toLight, toLight);
+	if (dist2 <= 0.0f) {
+		return 0.0f;
+	}
+	glm::vec3 wi = toLight / sqrt(dist2);
+	float cosSurf = glm::dot(surfNormal, wi);
+	float cosLight = glm::dot(lightNormal, -wi);
+	if (cosSurf <= 0.0f || cosLight <= 0.0f) {
+		return 0.0f;
+	}
+	glm::vec3 c = (albedo / PI) * (cosSurf * cosLight / dist2) * emittance;
+	return glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Weighted streaming update: fold a sample carrying resampling weight w
+// and candidate count m into the reservoir; it replaces the kept sample
+// with probability w / wSum.
+__device__ void reservoirAdd(Reservoir& r,
+	glm::vec3 lightPoint, glm::vec3 lightNormal, glm::vec3 emittance,
+	float targetPdf, float w, int m, float u)
+{
+	r.wSum += w;
+	r.M += m;
+	if (r.wSum > 0.0f && u < w / r.wSum) {
+		r.lightPoint = lightPoint;
+		r.lightNormal = lightNormal;
+		r.emittance = emittance;
+		r.targetPdf = targetPdf;
+	}
+}
+
+// Fold another pixel's reservoir in: its kept sample is re-scored against
+// this pixel's target function, carrying the candidate history it stands
+// for. Used for both the temporal and the spatial reuse.
+__device__ void reservoirMerge(Reservoir& r, const Reservoir& q,
+	glm::vec3 point, glm::vec3 surfNormal, glm::vec3 albedo, float u)
+{
+	float target = restirTargetPdf(point, surfNormal, albedo,
+		q.lightPoint, q.lightNormal, q.emittance);
+	float W = q.targetPdf > 0.0f ? q.wSum / (q.M * q.targetPdf) : 0.0f;
+	reservoirAdd(r, q.lightPoint, q.lightNormal, q.emittance,
+		target, target * W * q.M, q.M, u);
+}
+
+// Pass 1: per-pixel candidate generation plus temporal reuse. Streams
+// RESTIR_CANDIDATES alias-table draws through a fresh reservoir, folds in
+// this pixel's reservoir from the previous iteration (history capped), and
+// parks the result in the scratch frame for the spatial pass.
+__global__ void kernReSTIRTemporal(
+	int num_paths
+	, int iter
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const Light* __restrict__ lights
+	, int numLights
+	, const Reservoir* __restrict__ prevReservoirs
+	, Reservoir* reservoirs
+	, const int* activePaths
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths)
+	{
+		return;
+	}
+	if (activePaths != NULL)
+	{
+		idx = activePaths[idx];
+	}
+	int pixel = pathSegments.pixelIndices[idx];
+	// dead paths, misses and non-diffuse hits (the lobe gate from
+	// kernSampleDirectLight) park an empty reservoir so neighbors skip them
+	Reservoir r = {};
+	if (pathSegments.remainingBounces[idx] <= 0 || shadeableIntersections.t[idx] <= 0.0f)
+	{
+		reservoirs[pixel] = r;
+		return;
+	}
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+	if (material.emittance > 0.0f || material.hasRefractive > 0.0f || material.hasReflective >= 1.0f)
+	{
+		reservoirs[pixel] = r;
+		return;
+	}
+	glm::vec3 point = shadeableIntersections.points[idx];
+	glm::vec3 surfNormal = shadeableIntersections.surfaceNormals[idx];
+
+	thrust::default_random_engine rng = rngStates[pixel];
+	thrust::uniform_real_distribution<float> u01(0, 1);
+	for (int c = 0; c < RESTIR_CANDIDATES; c++)
+	{
+		int slot = glm::min((int)(u01(rng) * numLights), numLights - 1);
+		int pick = u01(rng) < c_lightAliasProb[slot] ? slot : c_lightAliasIdx[slot];
+		Light light = lights[pick];
+		glm::vec3 lightNormal;
+		glm::vec3 lightPoint = sampleLightSurface(light, rng, lightNormal);
+		float selectPdf = glm::dot(light.emittance, glm::vec3(0.2126f, 0.7152f, 0.0722f))
+			* light.area / c_lightPowerTotal;
+		// area-measure source pdf; the geometry term lives in the target
+		float sourcePdf = selectPdf / light.area;
+		float target = sourcePdf > 0.0f ? restirTargetPdf(point, surfNormal,
+			material.color, lightPoint, lightNormal, light.emittance) : 0.0f;
+		float w = sourcePdf > 0.0f ? target / sourcePdf : 0.0f;
+		reservoirAdd(r, lightPoint, lightNormal, light.emittance, target, w, 1, u01(rng));
+	}
+	// temporal reuse: last iteration's winner competes with this frame's
+	// candidates, capped so a stale sample cannot dominate forever
+	if (iter > 1)
+	{
+		Reservoir prev = prevReservoirs[pixel];
+		if (prev.M > 0)
+		{
+			prev.M = glm::min(prev.M, RESTIR_M_CAP * RESTIR_CANDIDATES);
+			reservoirMerge(r, prev, point, surfNormal, material.color, u01(rng));
+		}
+	}
+	rngStates[pixel] = rng;
+	reservoirs[pixel] = r;
+}
+
+// Pass 2: spatial reuse and the actual shade. Folds a few random
+// neighbors' reservoirs in, stores the merged reservoir as next
+// iteration's history, then spends the one shadow ray on the surviving
+// sample and banks the contribution scaled by the reservoir's unbiased
+// weight estimate.
+__global__ void kernReSTIRSpatial(
+	int num_paths
+	, glm::ivec2 resolution
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const Reservoir* __restrict__ reservoirs
+	, Reservoir* outReservoirs
+	, const GeomHot* __restrict__ geoms
+	, int numStatic
+	, int numMoving
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	, const int* activePaths
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths)
+	{
+		return;
+	}
+	if (activePaths != NULL)
+	{
+		idx = activePaths[idx];
+	}
+	int pixel = pathSegments.pixelIndices[idx];
+	if (pathSegments.remainingBounces[idx] <= 0 || shadeableIntersections.t[idx] <= 0.0f)
+	{
+		Reservoir empty = {};
+		outReservoirs[pixel] = empty;
+		return;
+	}
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+	if (material.emittance > 0.0f || material.hasRefractive > 0.0f || material.hasReflective >= 1.0f)
+	{
+		Reservoir empty = {};
+		outReservoirs[pixel] = empty;
+		return;
+	}
+	glm::vec3 point = shadeableIntersections.points[idx];
+	glm::vec3 surfNormal = shadeableIntersections.surfaceNormals[idx];
+
+	Reservoir r = reservoirs[pixel];
+	thrust::default_random_engine rng = rngStates[pixel];
+	thrust::uniform_real_distribution<float> u01(0, 1);
+	int px = pixel % resolution.x;
+	int py = pixel / resolution.x;
+	for (int k = 0; k < RESTIR_SPATIAL_NEIGHBORS; k++)
+	{
+		int nx = px + (int)((u01(rng) * 2.0f - 1.0f) * RESTIR_SPATIAL_RADIUS);
+		int ny = py + (int)((u01(rng) * 2.0f - 1.0f) * RESTIR_SPATIAL_RADIUS);
+		if (nx < 0 || nx >= resolution.x || ny < 0 || ny >= resolution.y
+			|| (nx == px && ny == py))
+		{
+			continue;
+		}
+		Reservoir q = reservoirs[ny * resolution.x + nx];
+		if (q.M <= 0)
+		{
+			continue;
+		}
+		reservoirMerge(r, q, point, surfNormal, material.color, u01(rng));
+	}
+	// the merged reservoir (visibility untested) is next iteration's history
+	outReservoirs[pixel] = r;
+
+	if (r.M > 0 && r.targetPdf > 0.0f && r.wSum > 0.0f)
+	{
+		glm::vec3 toLight = r.lightPoint - point;
+		float dist2 = glm::dot(toLight, toLight);
+		float dist = sqrt(dist2);
+		glm::vec3 wi = toLight / dist;
+		float cosSurf = glm::dot(surfNormal, wi);
+		float cosLight = glm::dot(r.lightNormal, -wi);
+		if (cosSurf > 0.0f && cosLight > 0.0f)
+		{
+			Ray shadowRay;
+			shadowRay.origin = point + 0.001f * surfNormal;
+			shadowRay.direction = wi;
+			shadowRay.time = pathSegments.times[idx];
+			glm::vec3 invDir = 1.0f / wi;
+			float maxT = dist - 0.01f;
+			bool occluded = numStatic > 0 && occludedByList<false>(shadowRay, invDir, maxT,
+				geoms, numStatic, triangles, vertices, bvhNodes, tlasNodes, tlasRoot);
+			if (!occluded && numMoving > 0)
+			{
+				occluded = occludedByList<true>(shadowRay, invDir, maxT,
+					geoms + numStatic, numMoving, triangles, vertices, bvhNodes,
+					movingTlasNodes, movingTlasRoot);
+			}
+			if (!occluded)
+			{
+				float W = r.wSum / (r.M * r.targetPdf);
+				glm::vec3 G = (material.color / PI) * (cosSurf * cosLight / dist2) * r.emittance;
+				pathSegments.radiances[idx] += pathSegments.colors[idx] * (G * W);
+#if AOV_ENABLE
+				c_aovDirect[pathSegments.pixelIndices[idx]] += pathSegments.colors[idx] * (G * W);
+#endif // AOV_ENABLE
+			}
+		}
+	}
+	rngStates[pixel] = rng;
+}
+#endif // RESTIR_ENABLE
+#endif // DIRECT_LIGHTING_ENABLE
+
+#if PHOTON_MAP_ENABLE
+// photon map lookup state, uploaded by buildPhotonMap on each device; the
+// constant bank keeps the shading kernel signatures unchanged
+__constant__ const Photon* c_photons;
+__constant__ const int* c_photonCellStart;
+__constant__ int c_numPhotonStores;
+
+// infinite uniform grid: cell coordinates hash straight into the bucket
+// array, so no scene bounds are needed and empty space costs nothing
+__device__ inline unsigned int photonHash(glm::ivec3 cell) {
+	return ((unsigned int)cell.x * 73856093u
+		^ (unsigned int)cell.y * 19349663u
+		^ (unsigned int)cell.z * 83492791u) & (PHOTON_HASH_SIZE - 1);
+}
+
+__device__ inline glm::ivec3 photonCell(glm::vec3 point) {
+	return glm::ivec3(glm::floor(point * (1.0f / PHOTON_RADIUS)));
+}
+
+// density estimate over the 27 cells the gather sphere can reach: sum the
+// flux of every photon within the radius on a compatible surface, over the
+// disc area and the emitted population. Photons from colliding far-away
+// cells fail the distance test, so collisions only waste the loads.
+__device__ glm::vec3 photonIrradiance(glm::vec3 point, glm::vec3 normal)
+{
+	glm::vec3 flux = glm::vec3(0.0f);
+	glm::ivec3 base = photonCell(point);
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				unsigned int h = photonHash(base + glm::ivec3(dx, dy, dz));
+				int end = c_photonCellStart[h + 1];
+				for (int i = c_photonCellStart[h]; i < end; i++) {
+					Photon photon = c_photons[i];
+					glm::vec3 d = photon.position - point;
+					if (glm::dot(d, d) < PHOTON_RADIUS * PHOTON_RADIUS
+						&& glm::dot(photon.normal, normal) > 0.5f) {
+						flux += photon.power;
+					}
+				}
+			}
+		}
+	}
+	return flux / (PI * PHOTON_RADIUS * PHOTON_RADIUS * (float)PHOTON_COUNT);
+}
+#endif // PHOTON_MAP_ENABLE
+
+#if GBUFFER_ENABLE
+// Turn one rasterized G-buffer texel into the depth-0 intersection record.
+// The raster image is stored bottom-up and the display quad flips both axes,
+// so the texel lookup mirrors x and y relative to the path's pixel index.
+__global__ void kernGBufferToIntersections(
+	int num_paths
+	, glm::ivec2 resolution
+	, const glm::vec4* __restrict__ positions
+	, const glm::vec4* __restrict__ normals
+	, PathSegmentSoA pathSegments
+	, ShadeableIntersectionSoA intersections
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths) {
+		return;
+	}
+	int pixel = pathSegments.pixelIndices[idx];
+	int x = pixel % resolution.x;
+	int y = pixel / resolution.x;
+	int texel = (resolution.x - 1 - x) + (resolution.y - 1 - y) * resolution.x;
+
+	glm::vec4 position = positions[texel];
+	if (position.w < 0.0f) {
+		intersections.t[idx] = -1.0f;
+		return;
+	}
+	glm::vec3 origin = pathSegments.origins[idx];
+	glm::vec3 direction = pathSegments.directions[idx];
+	intersections.t[idx] = glm::dot(glm::vec3(position) - origin, direction);
+	intersections.materialIds[idx] = (int)(position.w + 0.5f);
+	intersections.surfaceNormals[idx] = glm::normalize(glm::vec3(normals[texel]));
+	intersections.points[idx] = glm::vec3(position);
+	// never read at depth 0 (primary rays are a delta technique)
+	intersections.lightAreas[idx] = 0.0f;
+	// the raster G-buffer carries no texcoord channel; textured albedo is
+	// flat at depth 0 through this path
+	intersections.uvs[idx] = glm::vec2(0.0f);
+}
+#endif // GBUFFER_ENABLE
+
+// LOOK: "fake" shader demonstrating what you might do with the info in
+// a ShadeableIntersection, as well as how to use thrust's random number
+// generator. Observe that since the thrust random number generator basically
+// adds "noise" to the iteration, the image should start off noisy and get
+// cleaner as more iterations are computed.
+//
+// Note that this shader does NOT do a BSDF evaluation!
+// Your shaders should handle that - this can allow techniques such as
+// bump mapping.
+__global__ void shadeFakeMaterial(
+	int iter
+	, int num_paths
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx < num_paths)
+	{
+#if VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+		if (shadeableIntersections.t[idx] == VOLUME_SCATTERED_T) {
+			return;
+		}
+#endif // VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+		if (shadeableIntersections.t[idx] > 0.0f) { // if the intersection exists...
+		  // Set up the RNG
+		  // LOOK: this is how you use thrust's RNG! Please look at
+		  // kernInitRNG as well.
+			thrust::default_random_engine rng = rngStates[pathSegments.pixelIndices[idx]];
+			thrust::uniform_real_distribution<float> u01(0, 1);
+
+			Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+			applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+			glm::vec3 materialColor = material.color;
+
+			// If the material indicates that the object was a light, "light" the ray
+			if (material.emittance > 0.0f) {
+				pathSegments.colors[idx] *= (materialColor * material.emittance);
+			}
+			// Otherwise, do some pseudo-lighting computation. This is actually more
+			// like what you would expect from shading in a rasterizer like OpenGL.
+			// TODO: replace this! you should be able to start with basically a one-liner
+			else {
+				// stage the segment in registers so scatterRay stays unchanged
+				PathSegment segment;
+				segment.ray.origin = pathSegments.origins[idx];
+				segment.ray.direction = pathSegments.directions[idx];
+				segment.ray.time = pathSegments.times[idx];
+				segment.color = pathSegments.colors[idx];
+				SobolState sobol = { (unsigned int)iter, sobolSeed(pathSegments.pixelIndices[idx], 3) };
+				scatterRay(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, sobol, rng);
+				pathSegments.origins[idx] = segment.ray.origin;
+				pathSegments.directions[idx] = segment.ray.direction;
+				pathSegments.invDirections[idx] = 1.0f / segment.ray.direction;
+				pathSegments.colors[idx] = segment.color;
+			}
+			rngStates[pathSegments.pixelIndices[idx]] = rng;
+			// If there was no intersection, color the ray black.
+			// Lots of renderers use 4 channel color, RGBA, where A = alpha, often
+			// used for opacity, in which case they can indicate "no opacity".
+			// This can be useful for post-processing and image compositing.
+		}
+		else {
+			pathSegments.colors[idx] = glm::vec3(0.0f);
+		}
+	}
+}
+
+#if PATH_GUIDING_ENABLE
+// the frozen sampling distribution, this iteration's deposit sink and the
+// per-cell bin sums (see the dev_guide* statics), plus the grid bounds
+// mirroring the scene AABB; all uploaded by pathtraceInitDevice
+__constant__ const float* c_guideFlux;
+__constant__ float* c_guideAccum;
+__constant__ const float* c_guideCellFlux;
+__constant__ glm::vec3 c_guideGridMin;
+__constant__ glm::vec3 c_guideGridInvExtent;
+
+__device__ int guideCellIndex(glm::vec3 p)
+{
+	glm::vec3 q = (p - c_guideGridMin) * c_guideGridInvExtent;
+	int x = glm::clamp((int)(q.x * GUIDE_GRID_RES), 0, GUIDE_GRID_RES - 1);
+	int y = glm::clamp((int)(q.y * GUIDE_GRID_RES), 0, GUIDE_GRID_RES - 1);
+	int z = glm::clamp((int)(q.z * GUIDE_GRID_RES), 0, GUIDE_GRID_RES - 1);
+	return (z * GUIDE_GRID_RES + y) * GUIDE_GRID_RES + x;
+}
+
+// Direction bin of a unit vector: the same octahedral fold the normal
+// packing uses (sceneStructs.h), quantized to GUIDE_DIR_RES per axis.
+__device__ int guideDirBin(glm::vec3 n)
+{
+	n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+	float u = n.x;
+	float v = n.y;
+	if (n.z < 0.0f) {
+		u = (1.0f - glm::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		v = (1.0f - glm::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	int bu = glm::min((int)((u * 0.5f + 0.5f) * GUIDE_DIR_RES), GUIDE_DIR_RES - 1);
+	int bv = glm::min((int)((v * 0.5f + 0.5f) * GUIDE_DIR_RES), GUIDE_DIR_RES - 1);
+	return bv * GUIDE_DIR_RES + bu;
+}
+
+// Decode a jittered position inside a bin's octahedral square back to a
+// unit direction (inverse of the fold above).
+__device__ glm::vec3 guideBinDir(int bin, glm::vec2 xi)
+{
+	float u = ((bin % GUIDE_DIR_RES) + xi.x) * (2.0f / GUIDE_DIR_RES) - 1.0f;
+	float v = ((bin / GUIDE_DIR_RES) + xi.y) * (2.0f / GUIDE_DIR_RES) - 1.0f;
+	glm::vec3 n(u, v, 1.0f - glm::abs(u) - glm::abs(v));
+	if (n.z < 0.0f) {
+		n.x = (1.0f - glm::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - glm::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+	}
+	return glm::normalize(n);
+}
+
+// Solid-angle pdf of the histogram sampler for any direction. Sampling is
+// uniform over the chosen bin's octahedral square, and the decode maps
+// square area du dv to solid angle du dv / |p|^3 with p the point on the
+// octahedron |x|+|y|+|z| = 1; for a unit direction that |p| is the
+// reciprocal of its L1 norm, so the exact Jacobian is three adds and a
+// cube - no equal-area approximation, which would bias the MIS weights.
+__device__ float guidePdf(int cell, glm::vec3 dir, float total)
+{
+	float w = c_guideFlux[cell * GUIDE_DIR_BINS + guideDirBin(dir)];
+	// bin squares tile [-1, 1]^2, so the per-bin uv density is bins / 4
+	float density = (w / total) * (GUIDE_DIR_BINS * 0.25f);
+	float l1 = glm::abs(dir.x) + glm::abs(dir.y) + glm::abs(dir.z);
+	return density / (l1 * l1 * l1);
+}
+
+// Draw a direction from the cell's histogram: invert the bin CDF by a
+// linear scan (64 floats, one cache line apart and warp-coherent within a
+// cell), then jitter uniformly inside the bin's square.
+__device__ glm::vec3 guideSampleDir(int cell, float total, float u0, glm::vec2 xi)
+{
+	const float* flux = c_guideFlux + cell * GUIDE_DIR_BINS;
+	float pick = u0 * total;
+	int bin = 0;
+	for (; bin < GUIDE_DIR_BINS - 1; bin++) {
+		pick -= flux[bin];
+		if (pick <= 0.0f) {
+			break;
+		}
+	}
+	return guideBinDir(bin, xi);
+}
+
+// Diffuse scatter through the learned distribution: a one-sample MIS
+// mixture of the cell's histogram and the usual cosine hemisphere, with
+// f * cos / (mixture pdf) folded into the throughput, so the estimator
+// stays unbiased however wrong the histogram still is. A guided draw
+// under the horizon just zeroes the throughput (its pdf is still valid).
+// Only called for pure-diffuse materials, where scatterRay's lobe
+// selection reduces to scatterDiffuse; guideSlot reports the histogram
+// slot the continuation should credit, -1 when there is none.
+__device__ float guidedScatterRay(
+	PathSegment& pathSegment, glm::vec3 intersect, glm::vec3 normal,
+	const Material& m, const SobolState& sobol,
+	thrust::default_random_engine& rng, int& guideSlot)
+{
+	int cell = guideCellIndex(intersect);
+	float total = c_guideCellFlux[cell];
+	thrust::uniform_real_distribution<float> u01(0, 1);
+	glm::vec3 dir;
+	if (total > 0.0f && u01(rng) < GUIDE_MIX) {
+		dir = guideSampleDir(cell, total, u01(rng), glm::vec2(u01(rng), u01(rng)));
+	}
+	else {
+		dir = glm::normalize(calculateRandomDirectionInHemisphere(normal, bounceSample2D(sobol, rng)));
+	}
+	float cosTheta = glm::dot(normal, dir);
+	float pdf = glm::max(cosTheta, 0.0f) / PI;
+	if (total > 0.0f) {
+		pdf = (1.0f - GUIDE_MIX) * pdf + GUIDE_MIX * guidePdf(cell, dir, total);
+	}
+	pathSegment.ray.direction = dir;
+	pathSegment.ray.origin = intersect + 0.001f * normal;
+	if (cosTheta <= 0.0f || pdf <= 0.0f) {
+		pathSegment.color = glm::vec3(0.0f);
+		guideSlot = -1;
+		return pdf > 0.0f ? pdf : 1.0f;
+	}
+	pathSegment.color *= m.color * (cosTheta / PI) / pdf;
+	guideSlot = cell * GUIDE_DIR_BINS + guideDirBin(dir);
+	return pdf;
+}
+
+// Bank a finished path's contribution into the histogram slot its last
+// guided bounce sampled. The full path contribution (camera-side
+// throughput included) stands in for the incident radiance at that
+// vertex - crude, but monotone in the right quantity and free, since the
+// color is already in hand at termination. Clamped so one firefly cannot
+// own a cell's distribution for the next few iterations.
+__device__ void guideDeposit(const PathSegmentSoA& pathSegments, int idx)
+{
+	int slot = pathSegments.guideBins[idx];
+	if (slot < 0) {
+		return;
+	}
+	glm::vec3 c = pathSegments.colors[idx];
+	float lum = glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	if (lum > 0.0f && isfinite(lum)) {
+		atomicAdd(&c_guideAccum[slot], glm::min(lum, 16.0f));
+	}
+}
+
+// Fold the iteration's deposits into the sampling distribution: one
+// thread per cell decays the frozen flux, adds the fresh accumulation and
+// rebuilds the cell sum. Keeping the sampled distribution frozen within
+// an iteration (deposits land in accum, never flux) is what lets guidePdf
+// normalize by a sum that stays consistent with the weights it scans.
+__global__ void kernGuideDecay(float* flux, float* accum, float* cellFlux)
+{
+	int cell = blockIdx.x * blockDim.x + threadIdx.x;
+	if (cell >= GUIDE_NUM_CELLS) {
+		return;
+	}
+	float total = 0.0f;
+	for (int b = 0; b < GUIDE_DIR_BINS; b++) {
+		int i = cell * GUIDE_DIR_BINS + b;
+		float f = flux[i] * GUIDE_DECAY + accum[i];
+		flux[i] = f;
+		accum[i] = 0.0f;
+		total += f;
+	}
+	cellFlux[cell] = total;
+}
+#endif // PATH_GUIDING_ENABLE
+
+#if ADAPTIVE_DEPTH_ENABLE
+// the statistics sink, the distilled budgets and the tile geometry (see
+// the dev_tileDepth* statics); uploaded by pathtraceInitDevice
+__constant__ float* c_tileDepthLum;
+__constant__ const int* c_tileDepthBudget;
+__constant__ int c_depthTileCols;
+__constant__ int c_depthTileResX;
+
+__device__ int adaptiveDepthTile(int pixel)
+{
+	int x = pixel % c_depthTileResX;
+	int y = pixel / c_depthTileResX;
+	return (y / ADAPTIVE_DEPTH_TILE) * c_depthTileCols + (x / ADAPTIVE_DEPTH_TILE);
+}
+
+// Record a terminated path: its contribution's luminance lands in the
+// tile's bin for the depth it died at, clamped into the last bin past
+// ADAPTIVE_DEPTH_BINS.
+__device__ void adaptiveDepthDeposit(const PathSegmentSoA& pathSegments, int idx, int depth)
+{
+	glm::vec3 c = pathSegments.colors[idx];
+	float lum = glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	if (lum > 0.0f && isfinite(lum)) {
+		int bin = glm::min(depth, ADAPTIVE_DEPTH_BINS - 1);
+		int tile = adaptiveDepthTile(pathSegments.pixelIndices[idx]);
+		atomicAdd(&c_tileDepthLum[tile * ADAPTIVE_DEPTH_BINS + bin], lum);
+	}
+}
+
+// One thread per tile at the top of each iteration: walk the bins from
+// the deep end and keep the deepest depth whose contribution tail still
+// clears the per-sample threshold. invSamples is 1 over the samples a
+// tile pixel has deposited so far; zero (the warmup) parks every tile at
+// the scene's full depth.
+__global__ void kernAdaptiveDepthBudget(
+	int numTiles, const float* tileLum, int* budgets, int maxDepth, float invSamples)
+{
+	int tile = blockIdx.x * blockDim.x + threadIdx.x;
+	if (tile >= numTiles) {
+		return;
+	}
+	if (invSamples <= 0.0f) {
+		budgets[tile] = maxDepth;
+		return;
+	}
+	float tail = 0.0f;
+	int budget = ADAPTIVE_DEPTH_MIN;
+	for (int d = ADAPTIVE_DEPTH_BINS - 1; d > ADAPTIVE_DEPTH_MIN; d--) {
+		tail += tileLum[tile * ADAPTIVE_DEPTH_BINS + d];
+		if (tail * invSamples >= ADAPTIVE_DEPTH_THRESHOLD) {
+			budget = d;
+			break;
+		}
+	}
+	budgets[tile] = glm::min(budget, maxDepth);
+}
+#endif // ADAPTIVE_DEPTH_ENABLE
+
+__device__ PathSegment loadPathSegment(PathSegmentSoA& pathSegments, int idx)
+{
+	PathSegment segment;
+	segment.ray.origin = pathSegments.origins[idx];
+	segment.ray.direction = pathSegments.directions[idx];
+	segment.ray.time = pathSegments.times[idx];
+	segment.color = pathSegments.colors[idx];
+	return segment;
+}
+
+#if MATERIAL_DEPTH_BUDGET_ENABLE
+// traceDepth + SPECULAR_EXTRA_DEPTH, mirrored at init so the refund test
+// below needs no extra kernel parameter
+__constant__ int c_specularDepthCap;
+#endif // MATERIAL_DEPTH_BUDGET_ENABLE
+
+// Shared scatter epilogue: apply Russian roulette, shade paths whose bounce
+// budget just ran out with the environment, then write the segment back.
+__device__ void finishScatteredPath(
+	PathSegmentSoA& pathSegments, PathSegment& segment, int idx, int remainingBounces,
+	int depth, float bsdfPdf, thrust::default_random_engine& rng)
+{
+	remainingBounces--;
+#if MATERIAL_DEPTH_BUDGET_ENABLE
+	// a delta bounce is free while the extension window can still absorb
+	// the continuation, so glass interiors resolve at a traceDepth sized
+	// for the diffuse transport
+	if (bsdfPdf < 0.0f && depth + remainingBounces < c_specularDepthCap) {
+		remainingBounces++;
+	}
+#endif // MATERIAL_DEPTH_BUDGET_ENABLE
+#if RUSSIAN_ROULETTE_ENABLE
+#if MATERIAL_DEPTH_BUDGET_ENABLE
+	// diffuse-to-diffuse chains lose energy fastest; roulette them earlier
+	// than the scene-wide floor. Primaries, delta history and phase
+	// continuations all read as negative pdfs, so mixed chains keep it.
+	const int rrMinDepth = (bsdfPdf >= 0.0f && pathSegments.prevPdfs[idx] >= 0.0f)
+		? DIFFUSE_RR_MIN_DEPTH : RUSSIAN_ROULETTE_MIN_DEPTH;
+#else
+	const int rrMinDepth = RUSSIAN_ROULETTE_MIN_DEPTH;
+#endif // MATERIAL_DEPTH_BUDGET_ENABLE
+	if (remainingBounces > 0 && depth >= rrMinDepth) {
+		thrust::uniform_real_distribution<float> u01(0, 1);
+		float q = glm::min(glm::max(segment.color.x, glm::max(segment.color.y, segment.color.z)), 1.0f);
+		if (u01(rng) > q) {
+			// terminated paths contribute nothing
+			segment.color = glm::vec3(0.0f);
+			remainingBounces = 0;
+		}
+		else {
+			segment.color /= q;
+		}
+	}
+#endif // RUSSIAN_ROULETTE_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+	// the tile's learned depth budget: continuations past it face a fixed
+	// Russian roulette, so the truncation is compensated and unbiased
+	if (remainingBounces > 0
+		&& depth >= c_tileDepthBudget[adaptiveDepthTile(pathSegments.pixelIndices[idx])]) {
+		thrust::uniform_real_distribution<float> u01(0, 1);
+		if (u01(rng) > ADAPTIVE_DEPTH_SURVIVAL) {
+			segment.color = glm::vec3(0.0f);
+			remainingBounces = 0;
+		}
+		else {
+			segment.color /= ADAPTIVE_DEPTH_SURVIVAL;
+		}
+	}
+#endif // ADAPTIVE_DEPTH_ENABLE
+	// if the last bounce is not the light source, it should not be shaded
+	if (remainingBounces <= 0) {
+		glm::vec3 tail = environmentMisWeight(bsdfPdf, segment.ray.origin, segment.ray.direction)
+			* environmentRadiance(segment.ray.direction);
+		if (c_layoutPreview) {
+			// flat ambient in place of the indirect transport the
+			// one-bounce preview never traces
+			tail += glm::vec3(LAYOUT_PREVIEW_AMBIENT);
+		}
+		segment.color *= tail;
+	}
+	pathSegments.origins[idx] = segment.ray.origin;
+	pathSegments.directions[idx] = segment.ray.direction;
+	pathSegments.invDirections[idx] = 1.0f / segment.ray.direction;
+	pathSegments.colors[idx] = segment.color;
+	pathSegments.remainingBounces[idx] = remainingBounces;
+	pathSegments.prevPdfs[idx] = bsdfPdf;
+#if PATH_GUIDING_ENABLE
+	if (remainingBounces <= 0) {
+		guideDeposit(pathSegments, idx);
+	}
+#endif // PATH_GUIDING_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+	if (remainingBounces <= 0) {
+		adaptiveDepthDeposit(pathSegments, idx, depth);
+	}
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TERMINATE_GATHER_ENABLE
+	if (remainingBounces <= 0) {
+		accumulateTerminatedPath(pathSegments, idx);
+	}
+#endif // TERMINATE_GATHER_ENABLE
+}
+
+#if DIRECT_LIGHTING_ENABLE
+// Power-heuristic weight for an emissive hit found by the BSDF sample. The
+// competing light-sample pdf is reconstructed from the hit: distance, cosine
+// at the light and the light's emitted radiance - under power-proportional
+// selection the listed area cancels out of the pdf, leaving only the
+// luminance over the scene's total light power. Delta bounces (prevPdf < 0)
+// and unlisted emitters (area 0, e.g. meshes) count in full.
+__device__ float emissiveMisWeight(
+	float prevPdf, float t, float cosLight, float lightArea, glm::vec3 emittance)
+{
+#if VOLUME_ENABLE
+	// a phase-sampled continuation finding a listed light counts zero: the
+	// equiangular sample banked that segment's single scattering already
+	if (prevPdf == VOLUME_PHASE_PDF && lightArea > 0.0f) {
+		return 0.0f;
+	}
+#endif // VOLUME_ENABLE
+	if (prevPdf < 0.0f || lightArea <= 0.0f || c_lightPowerTotal <= 0.0f || cosLight <= 0.0f) {
+		return 1.0f;
+	}
+	float lum = glm::dot(emittance, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	float pdfLight = t * t * lum / (cosLight * c_lightPowerTotal);
+	return (prevPdf * prevPdf) / (prevPdf * prevPdf + pdfLight * pdfLight);
+}
+#endif // DIRECT_LIGHTING_ENABLE
+
+#if PIXEL_PROBE_ENABLE
+// Write one bounce of the probed pixel's path; a no-op for every other
+// path, and for every path while disarmed (c_probePixel is -1). depth is
+// 1-based like the bounce loop's, so slot depth-1 is this vertex.
+__device__ void probeRecordBounce(const PathSegmentSoA& pathSegments, int idx, int depth,
+	float t, int materialId, float pdf, int event)
+{
+	if (pathSegments.pixelIndices[idx] != c_probePixel) {
+		return;
+	}
+	ProbeRecord rec;
+	rec.throughput = glm::vec3(pathSegments.colors[idx]);
+	rec.direction = pathSegments.directions[idx];
+	rec.t = t;
+	rec.pdf = pdf;
+	rec.materialId = materialId;
+	rec.event = event;
+	c_probeRecords[depth - 1] = rec;
+}
+#endif // PIXEL_PROBE_ENABLE
+
+#if FUSED_COMPACT_ENABLE
+// Claim a live-list slot for a path that survived this bounce's shading;
+// a no-op for paths the shading just retired. Every shadeBSDFMaterial
+// exit that can leave a path alive runs through here exactly once, so
+// the emitted list IS the next bounce's compaction and the separate
+// full-buffer pass disappears (FUSED_COMPACT_ENABLE in pathtraceConfig.h).
+static __device__ __forceinline__ void emitSurvivor(const PathSegmentSoA& pathSegments, int idx,
+	int* survivors, int* survivorCount)
+{
+	if (pathSegments.remainingBounces[idx] > 0) {
+		survivors[StreamCompaction::warpEmit(survivorCount)] = idx;
+	}
+}
+#endif // FUSED_COMPACT_ENABLE
+
+__global__ void shadeBSDFMaterial(
+	int iter
+	, int depth
+	, int num_paths
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const int* activePaths
+#if FUSED_COMPACT_ENABLE
+	, int* survivors
+	, int* survivorCount
+#endif // FUSED_COMPACT_ENABLE
+	)
+{
+#if SHARED_MATERIALS_ENABLE
+	// cooperative palette staging; must run before any thread can return,
+	// since __syncthreads() below needs the whole block. The fits check is
+	// block-uniform (constant memory), so divergence cannot strand it.
+	__shared__ Material s_materials[SHARED_MATERIALS_MAX];
+	bool materialsStaged = c_numMaterials <= SHARED_MATERIALS_MAX;
+	if (materialsStaged) {
+		for (int m = threadIdx.x; m < c_numMaterials; m += blockDim.x) {
+			s_materials[m] = fetchMaterial(materials, m);
+		}
+		__syncthreads();
+	}
+#endif // SHARED_MATERIALS_ENABLE
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx < num_paths)
+	{
+		if (activePaths != NULL)
+		{
+			idx = activePaths[idx];
+		}
+		int remainingBounces = pathSegments.remainingBounces[idx];
+		if (remainingBounces <= 0) {
+			return;
+		}
+#if VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+		if (shadeableIntersections.t[idx] == VOLUME_SCATTERED_T) {
+			// this bounce already happened in the medium; the path is
+			// still in flight, so it must claim its live-list slot here
+#if FUSED_COMPACT_ENABLE
+			emitSurvivor(pathSegments, idx, survivors, survivorCount);
+#endif // FUSED_COMPACT_ENABLE
+			return;
+		}
+#endif // VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+		if (shadeableIntersections.t[idx] > 0.0f) { // if the intersection exists...
+
+			KPROF_CLOCK(kprofFetch);
+#if SHARED_MATERIALS_ENABLE
+			Material material = materialsStaged
+				? s_materials[shadeableIntersections.materialIds[idx]]
+				: fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+#else
+			Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+#endif // SHARED_MATERIALS_ENABLE
+			applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+			KPROF_REGION(KPROF_SHADE_FETCH, kprofFetch);
+			glm::vec3 materialColor = material.color;
+
+			// If the material indicates that the object was a light, "light" the ray
+			if (material.emittance > 0.0f) {
+				if (remainingBounces >= 0) {
+#if DIRECT_LIGHTING_ENABLE
+					float cosLight = glm::dot(shadeableIntersections.surfaceNormals[idx], -pathSegments.directions[idx]);
+					float weight = emissiveMisWeight(pathSegments.prevPdfs[idx],
+						shadeableIntersections.t[idx], cosLight,
+						shadeableIntersections.lightAreas[idx],
+						materialColor * material.emittance);
+					pathSegments.colors[idx] *= weight * (materialColor * material.emittance);
+#else
+					pathSegments.colors[idx] *= (materialColor * material.emittance);
+#endif // DIRECT_LIGHTING_ENABLE
+					pathSegments.remainingBounces[idx] = -1;
+#if AOV_ENABLE
+					// emissive first hit terminates with one transport vertex
+					if (depth == 1) {
+						c_aovDirect[pathSegments.pixelIndices[idx]] += glm::vec3(pathSegments.colors[idx]);
+					}
+#endif // AOV_ENABLE
+#if PATH_GUIDING_ENABLE
+					guideDeposit(pathSegments, idx);
+#endif // PATH_GUIDING_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+					adaptiveDepthDeposit(pathSegments, idx, depth);
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TERMINATE_GATHER_ENABLE
+					accumulateTerminatedPath(pathSegments, idx);
+#endif // TERMINATE_GATHER_ENABLE
+#if PIXEL_PROBE_ENABLE
+					probeRecordBounce(pathSegments, idx, depth, shadeableIntersections.t[idx],
+						shadeableIntersections.materialIds[idx], 0.0f, PROBE_EMISSIVE_HIT);
+#endif // PIXEL_PROBE_ENABLE
+				}
+			}
+			else {
+#if PHOTON_MAP_ENABLE
+				// deep diffuse bounce: answer it from the photon map instead
+				// of extending the path. The map holds indirect flux only, so
+				// this stacks with the NEE sample already banked here; the
+				// specular and refractive materials keep bouncing since a
+				// blurred cache cannot stand in for their delta lobes.
+				if (depth >= PHOTON_GATHER_DEPTH && c_numPhotonStores > 0
+					&& material.hasReflective <= 0.0f && material.hasRefractive <= 0.0f) {
+					glm::vec3 irradiance = photonIrradiance(shadeableIntersections.points[idx],
+						shadeableIntersections.surfaceNormals[idx]);
+					pathSegments.colors[idx] *= (materialColor / PI) * irradiance;
+					pathSegments.remainingBounces[idx] = 0;
+#if TERMINATE_GATHER_ENABLE
+					accumulateTerminatedPath(pathSegments, idx);
+#endif // TERMINATE_GATHER_ENABLE
+					return;
+				}
+#endif // PHOTON_MAP_ENABLE
+				// stage the segment in registers so scatterRay stays unchanged
+				KPROF_CLOCK(kprofScatter);
+				int lane = rngLane(idx, pathSegments.pixelIndices[idx]);
+				thrust::default_random_engine rng = rngStates[lane];
+				PathSegment segment = loadPathSegment(pathSegments, idx);
+				SobolState sobol = bounceSobolState(iter, idx, pathSegments.pixelIndices[idx], depth);
+				blueNoiseShiftBounce(sobol, depth, pathSegments.pixelIndices[idx]);
+#if PATH_GUIDING_ENABLE
+				// guide only the pure-diffuse lobe; mixed materials keep
+				// scatterRay's own selection, and any earlier guided
+				// vertex on the path still collects the credit
+				float bsdfPdf;
+				if (material.hasReflective <= 0.0f && material.hasRefractive <= 0.0f) {
+					int guideSlot;
+					bsdfPdf = guidedScatterRay(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, sobol, rng, guideSlot);
+					pathSegments.guideBins[idx] = guideSlot;
+				}
+				else {
+					bsdfPdf = scatterRay(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, sobol, rng);
+				}
+#else
+				float bsdfPdf = scatterRay(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, sobol, rng);
+#endif // PATH_GUIDING_ENABLE
+				finishScatteredPath(pathSegments, segment, idx, remainingBounces, depth, bsdfPdf, rng);
+				rngStates[lane] = rng;
+				KPROF_REGION(KPROF_SHADE_SCATTER, kprofScatter);
+#if PIXEL_PROBE_ENABLE
+				// remainingBounces was rewritten by the epilogue, so it
+				// already tells scattered-on from roulette/depth deaths
+				probeRecordBounce(pathSegments, idx, depth, shadeableIntersections.t[idx],
+					shadeableIntersections.materialIds[idx], bsdfPdf,
+					pathSegments.remainingBounces[idx] > 0 ? PROBE_SCATTERED : PROBE_TERMINATED);
+#endif // PIXEL_PROBE_ENABLE
+			}
+		}
+		else {
+			glm::vec3 dir = pathSegments.directions[idx];
+			pathSegments.colors[idx] *= environmentMisWeight(pathSegments.prevPdfs[idx], pathSegments.origins[idx], dir)
+				* environmentRadiance(dir);
+			pathSegments.remainingBounces[idx] = 0;
+#if AOV_ENABLE
+			// a primary ray escaping to the environment is direct light too
+			if (depth == 1) {
+				c_aovDirect[pathSegments.pixelIndices[idx]] += glm::vec3(pathSegments.colors[idx]);
+			}
+#endif // AOV_ENABLE
+#if PATH_GUIDING_ENABLE
+			guideDeposit(pathSegments, idx);
+#endif // PATH_GUIDING_ENABLE
+#if ADAPTIVE_DEPTH_ENABLE
+			adaptiveDepthDeposit(pathSegments, idx, depth);
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TERMINATE_GATHER_ENABLE
+			accumulateTerminatedPath(pathSegments, idx);
+#endif // TERMINATE_GATHER_ENABLE
+#if PIXEL_PROBE_ENABLE
+			probeRecordBounce(pathSegments, idx, depth, -1.0f, -1, 0.0f, PROBE_ENV_MISS);
+#endif // PIXEL_PROBE_ENABLE
+		}
+#if FUSED_COMPACT_ENABLE
+		// scattered-on paths claim their slot; the branches above that
+		// retired the path left remainingBounces non-positive, so this
+		// no-ops for them
+		emitSurvivor(pathSegments, idx, survivors, survivorCount);
+#endif // FUSED_COMPACT_ENABLE
+	}
+}
+
+#if MEGAKERNEL_ENABLE || COOP_LAUNCH_ENABLE
+// One bounce for one path: closest hit, next event estimation and the BSDF
+// scatter all happen on register state, so the per-path hit record never
+// touches global memory. Shading mirrors shadeBSDFMaterial exactly; the
+// geom lists and TLAS roots come in split static/moving just like the
+// two-pass pipeline, but both passes run back to back in the same thread.
+// Shared between the megakernel (one launch per bounce) and the
+// cooperative loop (one launch per iteration).
+static __device__ void fusedBounceOnePath(
+	int iter
+	, int depth
+	, int idx
+	, PathSegmentSoA pathSegments
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, int numStatic
+	, int numMoving
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const Light* __restrict__ lights
+	, int numLights
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	)
+{
+	int remainingBounces = pathSegments.remainingBounces[idx];
+	if (remainingBounces <= 0)
+	{
+		return;
+	}
+
+	Ray ray;
+	ray.origin = pathSegments.origins[idx];
+	ray.direction = pathSegments.directions[idx];
+	ray.time = numMoving > 0 ? pathSegments.times[idx] : 0.0f;
+	glm::vec3 invDir = pathSegments.invDirections[idx];
+	// primaries are the camera class, every later bounce the indirect one
+	const int rayMask = depth == 0 ? VIS_CAMERA : VIS_INDIRECT;
+
+	glm::vec3 objNormal;
+	glm::vec2 objUV(0.0f);
+	float t_min = FLT_MAX;
+	int hit_geom_index = -1;
+	if (numStatic > 0) {
+		t_min = intersectList<false>(ray, invDir, t_min, geoms, numStatic, rayMask,
+			objNormal, objUV, hit_geom_index, triangles, vertices, normals, bvhNodes,
+			tlasNodes, tlasRoot);
+	}
+	if (numMoving > 0) {
+		int hit_moving_index = -1;
+		t_min = intersectList<true>(ray, invDir, t_min, geoms + numStatic, numMoving, rayMask,
+			objNormal, objUV, hit_moving_index, triangles, vertices, normals, bvhNodes,
+			movingTlasNodes, movingTlasRoot);
+		if (hit_moving_index >= 0) {
+			hit_geom_index = numStatic + hit_moving_index;
+		}
+	}
+
+#if VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+	if (c_mediumSigmaTBar > 0.0f) {
+		int volLane = rngLane(idx, pathSegments.pixelIndices[idx]);
+		thrust::default_random_engine volRng = rngStates[volLane];
+		bool scattered = volumeInteract(pathSegments, idx, ray,
+			hit_geom_index >= 0 ? t_min : -1.0f, volRng,
+			lights, numLights, geoms, numStatic, numMoving, triangles, vertices,
+			bvhNodes, tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot);
+		rngStates[volLane] = volRng;
+		if (scattered) {
+			return;
+		}
+	}
+#endif // VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+
+	if (hit_geom_index == -1) {
+		pathSegments.colors[idx] *= environmentMisWeight(pathSegments.prevPdfs[idx], ray.origin, ray.direction)
+			* environmentRadiance(ray.direction);
+		pathSegments.remainingBounces[idx] = 0;
+#if ADAPTIVE_DEPTH_ENABLE
+		adaptiveDepthDeposit(pathSegments, idx, depth);
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TERMINATE_GATHER_ENABLE
+		accumulateTerminatedPath(pathSegments, idx);
+#endif // TERMINATE_GATHER_ENABLE
+		return;
+	}
+
+	GeomCold cold = geomsCold[hit_geom_index];
+	glm::vec3 surfNormal = glm::normalize(cold.invTranspose * objNormal);
+	glm::vec3 point = getPointOnRay(ray, t_min);
+	Material material = fetchMaterial(materials, cold.materialid);
+	applyAlbedo(material, objUV, t_min);
+
+	if (material.emittance > 0.0f) {
+#if DIRECT_LIGHTING_ENABLE
+		float cosLight = glm::dot(surfNormal, -ray.direction);
+		float weight = emissiveMisWeight(pathSegments.prevPdfs[idx],
+			t_min, cosLight, cold.lightArea, material.color * material.emittance);
+		pathSegments.colors[idx] *= weight * (material.color * material.emittance);
+#else
+		pathSegments.colors[idx] *= (material.color * material.emittance);
+#endif // DIRECT_LIGHTING_ENABLE
+		pathSegments.remainingBounces[idx] = -1;
+#if ADAPTIVE_DEPTH_ENABLE
+		adaptiveDepthDeposit(pathSegments, idx, depth);
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TERMINATE_GATHER_ENABLE
+		accumulateTerminatedPath(pathSegments, idx);
+#endif // TERMINATE_GATHER_ENABLE
+		return;
+	}
+
+	int pixel = pathSegments.pixelIndices[idx];
+	int lane = rngLane(idx, pixel);
+	thrust::default_random_engine rng = rngStates[lane];
+
+#if DIRECT_LIGHTING_ENABLE
+	// same lobe gate as the standalone kernel: only diffuse-capable
+	// surfaces get a light sample
+	if ((numLights > 0 || c_envMapSize.x > 0) && material.hasRefractive <= 0.0f && material.hasReflective < 1.0f) {
+		pathSegments.radiances[idx] += pathSegments.colors[idx] * sampleDirectLight<false>(
+			point, surfNormal, material, ray.time, rng, lights, numLights,
+			geoms, numStatic, numMoving, triangles, vertices, bvhNodes,
+			tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot);
+	}
+#endif // DIRECT_LIGHTING_ENABLE
+
+	PathSegment segment = loadPathSegment(pathSegments, idx);
+	SobolState sobol = bounceSobolState(iter, idx, pixel, depth);
+	blueNoiseShiftBounce(sobol, depth, pixel);
+	float bsdfPdf = scatterRay(segment, point, surfNormal, material, sobol, rng);
+	finishScatteredPath(pathSegments, segment, idx, remainingBounces, depth, bsdfPdf, rng);
+	rngStates[lane] = rng;
+}
+
+#if MEGAKERNEL_ENABLE
+// one launch per bounce: thread-per-path over the live slots
+__global__ void fusedIntersectShade(
+	int iter
+	, int depth
+	, int num_paths
+	, PathSegmentSoA pathSegments
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, int numStatic
+	, int numMoving
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const Light* __restrict__ lights
+	, int numLights
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	, const int* activePaths
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths)
+	{
+		return;
+	}
+	if (activePaths != NULL)
+	{
+		idx = activePaths[idx];
+	}
+	fusedBounceOnePath(iter, depth, idx, pathSegments, geoms, geomsCold,
+		numStatic, numMoving, materials, rngStates, lights, numLights,
+		triangles, vertices, normals, bvhNodes, tlasNodes, tlasRoot,
+		movingTlasNodes, movingTlasRoot);
+}
+#endif // MEGAKERNEL_ENABLE
 
-			// If the material indicates that the object was a light, "light" the ray
-			if (material.emittance > 0.0f) {
-				if (pathSegments[idx].remainingBounces >= 0) {
-					pathSegments[idx].color *= (materialColor * material.emittance);
-					pathSegments[idx].remainingBounces = -1;
+#if COOP_LAUNCH_ENABLE
+// One launch per iteration: every thread walks a grid-stride slice of the
+// path pool through the fused bounce, grid.sync() fences the bounces, and
+// a ping-ponged live counter lets the whole grid quit as soon as the pool
+// dies out. Depth runs 1..traceDepth, matching the value the megakernel's
+// splice pre-increments to. liveCounters holds two ints, both zeroed by
+// the host before launch: each bounce publishes its count into slot
+// (depth & 1) while every thread pre-clears the other slot for the bounce
+// after - the plain stores race only with each other, writing the same
+// zero, and grid.sync() orders them against the next bounce's atomics.
+__global__ void kernBounceLoopCoop(
+	int iter
+	, int traceDepth
+	, int num_paths
+	, PathSegmentSoA pathSegments
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, int numStatic
+	, int numMoving
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const Light* __restrict__ lights
+	, int numLights
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	, int* liveCounters
+	)
+{
+	cooperative_groups::grid_group grid = cooperative_groups::this_grid();
+	const int stride = gridDim.x * blockDim.x;
+#if MATERIAL_DEPTH_BUDGET_ENABLE
+	const int depthCap = traceDepth + SPECULAR_EXTRA_DEPTH;
+#else
+	const int depthCap = traceDepth;
+#endif // MATERIAL_DEPTH_BUDGET_ENABLE
+	for (int depth = 1; depth <= depthCap; depth++)
+	{
+		int live = 0;
+		for (int idx = blockIdx.x * blockDim.x + threadIdx.x; idx < num_paths; idx += stride)
+		{
+			fusedBounceOnePath(iter, depth, idx, pathSegments, geoms, geomsCold,
+				numStatic, numMoving, materials, rngStates, lights, numLights,
+				triangles, vertices, normals, bvhNodes, tlasNodes, tlasRoot,
+				movingTlasNodes, movingTlasRoot);
+			live += pathSegments.remainingBounces[idx] > 0 ? 1 : 0;
+		}
+		liveCounters[(depth & 1) ^ 1] = 0;
+		if (live > 0)
+		{
+			atomicAdd(&liveCounters[depth & 1], live);
+		}
+		grid.sync();
+		if (liveCounters[depth & 1] == 0)
+		{
+			break;
+		}
+	}
+}
+#endif // COOP_LAUNCH_ENABLE
+#endif // MEGAKERNEL_ENABLE || COOP_LAUNCH_ENABLE
+
+#if BDPT_ENABLE || PHOTON_MAP_ENABLE
+// Closest hit over both geom partitions, the megakernel's pattern lifted
+// into a helper; returns the geom index (-1 for a miss) with t and the
+// object-space normal. Light subpaths and photons trace as the indirect
+// visibility class.
+__device__ int traceClosestHit(Ray ray, float& t_min, glm::vec3& objNormal, glm::vec2& objUV,
+	const GeomHot* __restrict__ geoms, int numStatic, int numMoving,
+	const TriangleIdx* __restrict__ triangles, const glm::vec4* __restrict__ vertices, const PackedNormal* __restrict__ normals,
+	const LBVHNode* __restrict__ bvhNodes, const LBVHNode* __restrict__ tlasNodes, int tlasRoot,
+	const LBVHNode* __restrict__ movingTlasNodes, int movingTlasRoot)
+{
+	glm::vec3 invDir = 1.0f / ray.direction;
+	objUV = glm::vec2(0.0f);
+	t_min = FLT_MAX;
+	int hit_geom_index = -1;
+	if (numStatic > 0) {
+		t_min = intersectList<false>(ray, invDir, t_min, geoms, numStatic, VIS_INDIRECT,
+			objNormal, objUV, hit_geom_index, triangles, vertices, normals, bvhNodes,
+			tlasNodes, tlasRoot);
+	}
+	if (numMoving > 0) {
+		int hit_moving_index = -1;
+		t_min = intersectList<true>(ray, invDir, t_min, geoms + numStatic, numMoving, VIS_INDIRECT,
+			objNormal, objUV, hit_moving_index, triangles, vertices, normals, bvhNodes,
+			movingTlasNodes, movingTlasRoot);
+		if (hit_moving_index >= 0) {
+			hit_geom_index = numStatic + hit_moving_index;
+		}
+	}
+	return hit_geom_index;
+}
+#endif // BDPT_ENABLE || PHOTON_MAP_ENABLE
+
+#if BDPT_ENABLE
+// One subpath vertex: enough of the hit to evaluate connections (the
+// diffuse lobe only, like NEE elsewhere) and the throughput accumulated up
+// to but not including this vertex's own BSDF.
+struct BDPTVertex {
+	glm::vec3 point;
+	glm::vec3 normal;
+	glm::vec3 albedo;
+	glm::vec3 beta;
+	bool connectable;  // false for delta vertices (specular / refractive)
+};
+
+// How many of the integrator's strategies could have built the combined
+// path camVerts[0..t-1] + lightVerts[s..0] + emitter: the pure camera walk
+// (if it fits the camera cap) plus one connection per chain edge whose
+// endpoints are both connectable and whose split fits both subpath caps.
+// Every strategy divides its contribution by this same count, so the
+// uniform weights sum to one and the combination stays unbiased - it is
+// just noisier than a pdf-ratio (power) heuristic would be.
+__device__ int bdptStrategyCount(
+	const BDPTVertex* camVerts, int t, const BDPTVertex* lightVerts, int s,
+	int camCap, int lightCap)
+{
+	int k = t + s + 1;  // path vertices past the pinhole, light sample last
+	int n = k <= camCap ? 1 : 0;
+	for (int j = 1; j <= k - 1; j++) {
+		// splitting at edge j means a camera subpath of j vertices and a
+		// light subpath of k - j
+		if (j > camCap || k - j > lightCap) {
+			continue;
+		}
+		// chain position p <= t is camera vertex p; past that, light
+		// vertex k - p counting down to the light sample itself
+		bool a = j <= t ? camVerts[j - 1].connectable : lightVerts[k - j].connectable;
+		bool b = j + 1 <= t ? camVerts[j].connectable : lightVerts[k - j - 1].connectable;
+		if (a && b) {
+			n++;
+		}
+	}
+	return n;
+}
+
+// One full bidirectional sample per pixel: walk the camera subpath from
+// the generated primary, walk a light subpath from a power-sampled light,
+// then connect every connectable vertex pair. The result lands in the
+// path's color stream, so finalGather and everything downstream stay
+// shared with the unidirectional pipeline.
+__global__ void kernBDPT(
+	int num_paths
+	, int iter
+	, int traceDepth
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	, const Light* __restrict__ lights
+	, int numLights
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, int numStatic
+	, int numMoving
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths)
+	{
+		return;
+	}
+	if (pathSegments.remainingBounces[idx] <= 0)
+	{
+		// frozen pixel (adaptive sampling): keep whatever raygen staged
+		return;
+	}
+	int pixel = pathSegments.pixelIndices[idx];
+	float time = pathSegments.times[idx];
+	int camCap = glm::min(traceDepth, BDPT_MAX_VERTS);
+	int lightCap = numLights > 0 ? glm::min(traceDepth, BDPT_MAX_VERTS) : 0;
+	thrust::default_random_engine rng = rngStates[pixel];
+	thrust::uniform_real_distribution<float> u01(0, 1);
+
+	glm::vec3 L = glm::vec3(0.0f);
+	BDPTVertex camVerts[BDPT_MAX_VERTS];
+	int nCam = 0;
+
+	// camera subpath; stops at emissive hits (the s = 0 strategy) and
+	// collects the environment on escape, both exactly once per path
+	{
+		PathSegment segment;
+		segment.ray.origin = pathSegments.origins[idx];
+		segment.ray.direction = pathSegments.directions[idx];
+		segment.ray.time = time;
+		segment.color = pathSegments.colors[idx];
+		while (nCam < camCap)
+		{
+			float t_min;
+			glm::vec3 objNormal;
+			glm::vec2 objUV;
+			int hit = traceClosestHit(segment.ray, t_min, objNormal, objUV, geoms,
+				numStatic, numMoving, triangles, vertices, normals, bvhNodes,
+				tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot);
+			if (hit < 0)
+			{
+				// only the camera walk reaches the environment, so no
+				// competing strategy shares this contribution
+				L += segment.color * environmentRadiance(segment.ray.direction);
+				break;
+			}
+			GeomCold cold = geomsCold[hit];
+			glm::vec3 surfNormal = glm::normalize(cold.invTranspose * objNormal);
+			glm::vec3 point = getPointOnRay(segment.ray, t_min);
+			Material material = fetchMaterial(materials, cold.materialid);
+			applyAlbedo(material, objUV, t_min);
+			if (material.emittance > 0.0f)
+			{
+				float w = 1.0f;
+				if (cold.lightArea > 0.0f)
+				{
+					// listed light: the connection strategies compete
+					BDPTVertex lightEnd;
+					lightEnd.connectable = true;
+					w = 1.0f / bdptStrategyCount(camVerts, nCam, &lightEnd, 0,
+						camCap, lightCap);
 				}
+				L += segment.color * (material.color * material.emittance) * w;
+				break;
 			}
-			else {
-				scatterRay(pathSegments[idx], intersection.point, intersection.surfaceNormal, material, rng);
-				pathSegments[idx].remainingBounces--;
-				// if the last bounce is not the light source, it should not be shaded
-				if (pathSegments[idx].remainingBounces <= 0) {
-#if AMBIENT_LIGHT_ENABLE
-					float t = 0.5 * (glm::normalize(pathSegments[idx].ray.direction).y + 1.0);
-					pathSegments[idx].color *= (1.0f - t) * glm::vec3(1.0, 1.0, 1.0) + t * glm::vec3(0.5, 0.7, 1.0);
-#else
-					pathSegments[idx].color = glm::vec3(0.0f);
-#endif // AMBIENT_LIGHT_ENABLE	
+			BDPTVertex v;
+			v.point = point;
+			v.normal = surfNormal;
+			v.albedo = material.color;
+			v.beta = segment.color;
+			v.connectable = material.hasRefractive <= 0.0f && material.hasReflective < 1.0f;
+			camVerts[nCam++] = v;
+			SobolState sobol = { (unsigned int)iter, sobolSeed(pixel, 3 + nCam - 1) };
+			scatterRay(segment, point, surfNormal, material, sobol, rng);
+		}
+	}
+
+	// light subpath from a power-sampled light; delta bounces ride along
+	// (that is where the caustics come from), emissive hits end the walk
+	// like they do on the camera side
+	BDPTVertex lightVerts[BDPT_MAX_VERTS];
+	int nLight = 0;
+	if (lightCap > 0)
+	{
+		int slot = glm::min((int)(u01(rng) * numLights), numLights - 1);
+		int pick = u01(rng) < c_lightAliasProb[slot] ? slot : c_lightAliasIdx[slot];
+		Light light = lights[pick];
+		float selectPdf = glm::dot(light.emittance, glm::vec3(0.2126f, 0.7152f, 0.0722f))
+			* light.area / c_lightPowerTotal;
+		if (selectPdf > 0.0f)
+		{
+			glm::vec3 lightNormal;
+			glm::vec3 lightPoint = sampleLightSurface(light, rng, lightNormal);
+			BDPTVertex v0;
+			v0.point = lightPoint;
+			v0.normal = lightNormal;
+			v0.albedo = glm::vec3(1.0f);
+			v0.beta = light.emittance * (light.area / selectPdf);
+			v0.connectable = true;
+			lightVerts[nLight++] = v0;
+
+			PathSegment segment;
+			segment.ray.origin = lightPoint + 0.001f * lightNormal;
+			segment.ray.direction = glm::normalize(calculateRandomDirectionInHemisphere(
+				lightNormal, glm::vec2(u01(rng), u01(rng))));
+			segment.ray.time = time;
+			// cosine-weighted emission: cos / pdf leaves a factor of pi.
+			// (the refraction transport asymmetry is ignored, as usual)
+			segment.color = v0.beta * PI;
+			while (nLight < lightCap)
+			{
+				float t_min;
+				glm::vec3 objNormal;
+				glm::vec2 objUV;
+				int hit = traceClosestHit(segment.ray, t_min, objNormal, objUV, geoms,
+					numStatic, numMoving, triangles, vertices, normals, bvhNodes,
+					tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot);
+				if (hit < 0)
+				{
+					break;
+				}
+				GeomCold cold = geomsCold[hit];
+				glm::vec3 surfNormal = glm::normalize(cold.invTranspose * objNormal);
+				glm::vec3 point = getPointOnRay(segment.ray, t_min);
+				Material material = fetchMaterial(materials, cold.materialid);
+				applyAlbedo(material, objUV, t_min);
+				if (material.emittance > 0.0f)
+				{
+					break;
 				}
+				BDPTVertex v;
+				v.point = point;
+				v.normal = surfNormal;
+				v.albedo = material.color;
+				v.beta = segment.color;
+				v.connectable = material.hasRefractive <= 0.0f && material.hasReflective < 1.0f;
+				lightVerts[nLight++] = v;
+				SobolState sobol = { (unsigned int)iter, sobolSeed(pixel, 3 + traceDepth + nLight) };
+				scatterRay(segment, point, surfNormal, material, sobol, rng);
 			}
 		}
-		else {
-#if AMBIENT_LIGHT_ENABLE
-			float t = 0.5 * (glm::normalize(pathSegments[idx].ray.direction).y + 1.0);
-			pathSegments[idx].color *= (1.0f - t) * glm::vec3(1.0, 1.0, 1.0) + t * glm::vec3(0.5, 0.7, 1.0);
+	}
+
+	// connect every connectable pair; one shadow ray per surviving pair
+	for (int t = 1; t <= nCam; t++)
+	{
+		if (!camVerts[t - 1].connectable)
+		{
+			continue;
+		}
+		for (int s = 0; s < nLight; s++)
+		{
+			if (!lightVerts[s].connectable)
+			{
+				continue;
+			}
+			glm::vec3 toLight = lightVerts[s].point - camVerts[t - 1].point;
+			float dist2 = glm::dot(toLight, toLight);
+			if (dist2 <= 1e-8f)
+			{
+				continue;
+			}
+			float dist = sqrt(dist2);
+			glm::vec3 wi = toLight / dist;
+			float cosCam = glm::dot(camVerts[t - 1].normal, wi);
+			float cosLight = glm::dot(lightVerts[s].normal, -wi);
+			if (cosCam <= 0.0f || cosLight <= 0.0f)
+			{
+				continue;
+			}
+			// the light sample itself emits; interior vertices reflect
+			glm::vec3 fLight = s == 0 ? glm::vec3(1.0f) : lightVerts[s].albedo / PI;
+			glm::vec3 contrib = camVerts[t - 1].beta * (camVerts[t - 1].albedo / PI)
+				* (cosCam * cosLight / dist2) * fLight * lightVerts[s].beta;
+			if (glm::dot(contrib, contrib) <= 0.0f)
+			{
+				continue;
+			}
+			Ray shadowRay;
+			shadowRay.origin = camVerts[t - 1].point + 0.001f * camVerts[t - 1].normal;
+			shadowRay.direction = wi;
+			shadowRay.time = time;
+			glm::vec3 invDir = 1.0f / wi;
+			float maxT = dist - 0.01f;
+			bool occluded = numStatic > 0 && occludedByList<false>(shadowRay, invDir, maxT,
+				geoms, numStatic, triangles, vertices, bvhNodes, tlasNodes, tlasRoot);
+			if (!occluded && numMoving > 0)
+			{
+				occluded = occludedByList<true>(shadowRay, invDir, maxT,
+					geoms + numStatic, numMoving, triangles, vertices, bvhNodes,
+					movingTlasNodes, movingTlasRoot);
+			}
+			if (occluded)
+			{
+				continue;
+			}
+			int n = bdptStrategyCount(camVerts, t, lightVerts, s, camCap, lightCap);
+			L += contrib / (float)n;
+		}
+	}
+
+	rngStates[pixel] = rng;
+	pathSegments.colors[idx] = L;
+	pathSegments.remainingBounces[idx] = 0;
+}
+#endif // BDPT_ENABLE
+
+#if PHOTON_MAP_ENABLE
+// Trace one photon: emit from a power-sampled light, bounce through the
+// scene via scatterRay with Russian roulette on the albedo, and record the
+// carried flux at every diffuse hit after the first - NEE already covers
+// direct light at the gather point, so storing first hits would count it
+// twice. Stores land unsorted with a per-cell histogram; buildPhotonMap
+// scans and scatters them into cell order afterwards.
+__global__ void kernEmitPhotons(
+	int numPhotons
+	, const Light* __restrict__ lights
+	, int numLights
+	, const GeomHot* __restrict__ geoms
+	, const GeomCold* __restrict__ geomsCold
+	, const Material* __restrict__ materials
+	, int numStatic
+	, int numMoving
+	, const TriangleIdx* __restrict__ triangles
+	, const glm::vec4* __restrict__ vertices
+	, const PackedNormal* __restrict__ normals
+	, const LBVHNode* __restrict__ bvhNodes
+	, const LBVHNode* __restrict__ tlasNodes
+	, int tlasRoot
+	, const LBVHNode* __restrict__ movingTlasNodes
+	, int movingTlasRoot
+	, Photon* out
+	, int* outCount
+	, int* cellCounts
+	, int capacity
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= numPhotons)
+	{
+		return;
+	}
+	thrust::default_random_engine rng = makeSeededRandomEngine(0, idx, 0);
+	thrust::uniform_real_distribution<float> u01(0, 1);
+
+	int slot = glm::min((int)(u01(rng) * numLights), numLights - 1);
+	int pick = u01(rng) < c_lightAliasProb[slot] ? slot : c_lightAliasIdx[slot];
+	Light light = lights[pick];
+	float selectPdf = glm::dot(light.emittance, glm::vec3(0.2126f, 0.7152f, 0.0722f))
+		* light.area / c_lightPowerTotal;
+	if (selectPdf <= 0.0f)
+	{
+		return;
+	}
+	glm::vec3 lightNormal;
+	glm::vec3 lightPoint = sampleLightSurface(light, rng, lightNormal);
+
+	PathSegment segment;
+	segment.ray.origin = lightPoint + 0.001f * lightNormal;
+	segment.ray.direction = glm::normalize(calculateRandomDirectionInHemisphere(
+		lightNormal, glm::vec2(u01(rng), u01(rng))));
+	// random time so moving geoms deposit their whole sweep into the map
+	segment.ray.time = u01(rng);
+	// flux of a diffuse emitter is pi * area * radiance; the cosine factor
+	// of the direction sample cancels against its pdf
+	segment.color = light.emittance * (PI * light.area / selectPdf);
+
+	for (int bounce = 0; bounce < PHOTON_MAX_BOUNCES; bounce++)
+	{
+		float t_min;
+		glm::vec3 objNormal;
+		glm::vec2 objUV;
+		int hit = traceClosestHit(segment.ray, t_min, objNormal, objUV, geoms,
+			numStatic, numMoving, triangles, vertices, normals, bvhNodes,
+			tlasNodes, tlasRoot, movingTlasNodes, movingTlasRoot);
+		if (hit < 0)
+		{
+			break;
+		}
+		GeomCold cold = geomsCold[hit];
+		glm::vec3 surfNormal = glm::normalize(cold.invTranspose * objNormal);
+		glm::vec3 point = getPointOnRay(segment.ray, t_min);
+		Material material = fetchMaterial(materials, cold.materialid);
+		applyAlbedo(material, objUV, t_min);
+		if (material.emittance > 0.0f)
+		{
+			break;
+		}
+		if (bounce > 0 && material.hasReflective + material.hasRefractive < 1.0f)
+		{
+			// storing lanes batch into one atomic per warp (emit.h)
+			int store = StreamCompaction::warpEmit(outCount);
+			if (store < capacity)
+			{
+				Photon photon;
+				photon.position = point;
+				photon.power = segment.color;
+				photon.normal = surfNormal;
+				out[store] = photon;
+				atomicAdd(&cellCounts[photonHash(photonCell(point))], 1);
+			}
+		}
+		SobolState sobol = { 0u, sobolSeed(idx, bounce) };
+		scatterRay(segment, point, surfNormal, material, sobol, rng);
+		// roulette on the albedo keeps the expected carried flux bounded
+		float q = glm::min(glm::max(material.color.r,
+			glm::max(material.color.g, material.color.b)), 0.95f);
+		if (u01(rng) >= q)
+		{
+			break;
+		}
+		segment.color /= q;
+	}
+}
+
+// Move each stored photon to its cell's range: cellStart holds the scanned
+// offsets, the cursor array claims slots within a cell.
+__global__ void kernBuildPhotonGrid(
+	int numStores
+	, const Photon* __restrict__ in
+	, Photon* out
+	, const int* __restrict__ cellStart
+	, int* cellCursor
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= numStores)
+	{
+		return;
+	}
+	Photon photon = in[idx];
+	unsigned int h = photonHash(photonCell(photon.position));
+	out[cellStart[h] + atomicAdd(&cellCursor[h], 1)] = photon;
+}
+
+// Emit, histogram, scan and scatter: the whole map in two kernels and one
+// thrust scan, then the lookup constants go up and the scratch goes away.
+// Runs once per device on its first iteration and is skipped for scenes
+// without listed lights.
+static void buildPhotonMap()
+{
+	NVTX_PUSH("photon map");
+	numPhotonStores = 0;
+	if (numLights > 0) {
+		const int capacity = PHOTON_COUNT * 2;
+		Photon* dev_photonScratch;
+		int* dev_photonCellCursor;
+		int* dev_photonCounter;
+		cudaMalloc(&dev_photons, capacity * sizeof(Photon));
+		cudaMalloc(&dev_photonScratch, capacity * sizeof(Photon));
+		cudaMalloc(&dev_photonCellStart, (PHOTON_HASH_SIZE + 1) * sizeof(int));
+		cudaMalloc(&dev_photonCellCursor, PHOTON_HASH_SIZE * sizeof(int));
+		cudaMalloc(&dev_photonCounter, sizeof(int));
+		cudaMemset(dev_photonCellStart, 0, (PHOTON_HASH_SIZE + 1) * sizeof(int));
+		cudaMemset(dev_photonCellCursor, 0, PHOTON_HASH_SIZE * sizeof(int));
+		cudaMemset(dev_photonCounter, 0, sizeof(int));
+
+		const int blockSize1d = 128;
+		dim3 numBlocks = (PHOTON_COUNT + blockSize1d - 1) / blockSize1d;
+		kernEmitPhotons << <numBlocks, blockSize1d >> > (
+			PHOTON_COUNT, dev_lights, numLights, dev_geomsHot, dev_geomsCold,
+			dev_materials, numStaticGeoms, numMovingGeoms,
+			dev_triangles, dev_vertices, dev_normals, dev_bvhNodes,
+			dev_tlasNodes, tlasRoot, dev_movingTlasNodes, movingTlasRoot,
+			dev_photonScratch, dev_photonCounter, dev_photonCellStart, capacity);
+		checkCUDAError("emit photons");
+
+		cudaMemcpy(&numPhotonStores, dev_photonCounter, sizeof(int), cudaMemcpyDeviceToHost);
+		numPhotonStores = std::min(numPhotonStores, capacity);
+		thrust::exclusive_scan(thrust::device, dev_photonCellStart,
+			dev_photonCellStart + PHOTON_HASH_SIZE + 1, dev_photonCellStart);
+		if (numPhotonStores > 0) {
+			numBlocks = (numPhotonStores + blockSize1d - 1) / blockSize1d;
+			kernBuildPhotonGrid << <numBlocks, blockSize1d >> > (
+				numPhotonStores, dev_photonScratch, dev_photons,
+				dev_photonCellStart, dev_photonCellCursor);
+			checkCUDAError("build photon grid");
+		}
+
+		cudaMemcpyToSymbol(c_photons, &dev_photons, sizeof(dev_photons));
+		cudaMemcpyToSymbol(c_photonCellStart, &dev_photonCellStart, sizeof(dev_photonCellStart));
+		cudaFree(dev_photonScratch);
+		cudaFree(dev_photonCellCursor);
+		cudaFree(dev_photonCounter);
+	}
+	cudaMemcpyToSymbol(c_numPhotonStores, &numPhotonStores, sizeof(numPhotonStores));
+	checkCUDAError("build photon map");
+	NVTX_POP();
+}
+#endif // PHOTON_MAP_ENABLE
+
+// Bin every live path into one per-material-class queue. Queue q occupies
+// dev_queues[q * queueCapacity .. q * queueCapacity + counters[q]).
+__global__ void kernBinPathsByMaterial(
+	int num_paths
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, int* queues
+	, int* counters
+	, int queueCapacity
+	, const int* activePaths
+	)
+{
+	// block-local counting sort: histogram the block's paths by class in
+	// shared memory, reserve each class's queue range with one global
+	// atomic per class, then scatter at block-local rank. Global atomic
+	// traffic drops from one add per path to QUEUE_COUNT per block, and a
+	// block's paths land contiguous and in slot order, so the queue
+	// kernels read mostly-ascending indices instead of an interleave of
+	// every block that raced on the counter.
+	__shared__ int localCount[QUEUE_COUNT];
+	__shared__ int globalBase[QUEUE_COUNT];
+	if (threadIdx.x < QUEUE_COUNT) {
+		localCount[threadIdx.x] = 0;
+	}
+	__syncthreads();
+
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	int q = -1;
+	int rank = 0;
+	if (idx < num_paths) {
+		if (activePaths != NULL) {
+			// queues receive real slot ids, so the queue kernels stay untouched
+			idx = activePaths[idx];
+		}
+		if (pathSegments.remainingBounces[idx] > 0
+#if VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+			// slots the medium stage consumed this bounce join no queue
+			&& shadeableIntersections.t[idx] != VOLUME_SCATTERED_T
+#endif // VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+			) {
+			if (shadeableIntersections.t[idx] <= 0.0f) {
+				q = QUEUE_MISS;
+			}
+			else {
+				Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+				applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+				q = material.emittance > 0.0f ? QUEUE_EMISSIVE
+					: material.hasRefractive > 0.0f ? QUEUE_REFRACTIVE
+					: material.hasReflective > 0.0f ? QUEUE_SPECULAR
+					: QUEUE_DIFFUSE;
+			}
+			rank = atomicAdd(&localCount[q], 1);
+		}
+	}
+	__syncthreads();
+	if (threadIdx.x < QUEUE_COUNT && localCount[threadIdx.x] > 0) {
+		globalBase[threadIdx.x] = atomicAdd(&counters[threadIdx.x], localCount[threadIdx.x]);
+	}
+	__syncthreads();
+	if (q >= 0) {
+		queues[q * queueCapacity + globalBase[q] + rank] = idx;
+	}
+}
+
+// One kernel per material class: every thread in a queue runs the same lobe,
+// so scatterRay's divergent branch chain becomes straight-line code.
+
+__global__ void shadeDiffuseQueue(
+	int iter, int depth, int n, const int* queue
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	int idx = queue[i];
+	int remainingBounces = pathSegments.remainingBounces[idx];
+	int lane = rngLane(idx, pathSegments.pixelIndices[idx]);
+	thrust::default_random_engine rng = rngStates[lane];
+
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+	PathSegment segment = loadPathSegment(pathSegments, idx);
+	SobolState sobol = bounceSobolState(iter, idx, pathSegments.pixelIndices[idx], depth);
+	blueNoiseShiftBounce(sobol, depth, pathSegments.pixelIndices[idx]);
+	float bsdfPdf = scatterDiffuse(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, 1.0f, sobol, rng);
+	finishScatteredPath(pathSegments, segment, idx, remainingBounces, depth, bsdfPdf, rng);
+	rngStates[lane] = rng;
+}
+
+__global__ void shadeSpecularQueue(
+	int iter, int depth, int n, const int* queue
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	int idx = queue[i];
+	int remainingBounces = pathSegments.remainingBounces[idx];
+	int lane = rngLane(idx, pathSegments.pixelIndices[idx]);
+	thrust::default_random_engine rng = rngStates[lane];
+	thrust::uniform_real_distribution<float> u01(0, 1);
+
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+	PathSegment segment = loadPathSegment(pathSegments, idx);
+	// mixed reflective/diffuse materials still pick a lobe, but the whole
+	// queue shares the same two-way split
+	float p0 = u01(rng);
+	float bsdfPdf;
+	if (p0 <= material.hasReflective) {
+		scatterSpecular(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, 1.0 / material.hasReflective, rng);
+		bsdfPdf = -1.0f;
+	}
+	else {
+		SobolState sobol = bounceSobolState(iter, idx, pathSegments.pixelIndices[idx], depth);
+		blueNoiseShiftBounce(sobol, depth, pathSegments.pixelIndices[idx]);
+		bsdfPdf = scatterDiffuse(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, 1.0 / (1.0 - material.hasReflective), sobol, rng);
+	}
+	finishScatteredPath(pathSegments, segment, idx, remainingBounces, depth, bsdfPdf, rng);
+	rngStates[lane] = rng;
+}
+
+__global__ void shadeRefractiveQueue(
+	int iter, int depth, int n, const int* queue
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, thrust::default_random_engine* rngStates
+	)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	int idx = queue[i];
+	int remainingBounces = pathSegments.remainingBounces[idx];
+	int lane = rngLane(idx, pathSegments.pixelIndices[idx]);
+	thrust::default_random_engine rng = rngStates[lane];
+
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+	PathSegment segment = loadPathSegment(pathSegments, idx);
+	// refractive materials may still carry a reflective component, so keep
+	// the full probabilistic combination here
+	SobolState sobol = bounceSobolState(iter, idx, pathSegments.pixelIndices[idx], depth);
+	blueNoiseShiftBounce(sobol, depth, pathSegments.pixelIndices[idx]);
+	float bsdfPdf = scatterRay(segment, shadeableIntersections.points[idx], shadeableIntersections.surfaceNormals[idx], material, sobol, rng);
+	finishScatteredPath(pathSegments, segment, idx, remainingBounces, depth, bsdfPdf, rng);
+	rngStates[lane] = rng;
+}
+
+__global__ void shadeEmissiveQueue(
+	int depth, int n, const int* queue
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	int idx = queue[i];
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+#if DIRECT_LIGHTING_ENABLE
+	float cosLight = glm::dot(shadeableIntersections.surfaceNormals[idx], -pathSegments.directions[idx]);
+	float weight = emissiveMisWeight(pathSegments.prevPdfs[idx],
+		shadeableIntersections.t[idx], cosLight,
+		shadeableIntersections.lightAreas[idx],
+		material.color * material.emittance);
+	pathSegments.colors[idx] *= weight * (material.color * material.emittance);
 #else
-			pathSegments[idx].color = glm::vec3(0.0f);
-#endif // AMBIENT_LIGHT_ENABLE
-			pathSegments[idx].remainingBounces = 0;
+	pathSegments.colors[idx] *= (material.color * material.emittance);
+#endif // DIRECT_LIGHTING_ENABLE
+	pathSegments.remainingBounces[idx] = -1;
+#if ADAPTIVE_DEPTH_ENABLE
+	adaptiveDepthDeposit(pathSegments, idx, depth);
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TERMINATE_GATHER_ENABLE
+	accumulateTerminatedPath(pathSegments, idx);
+#endif // TERMINATE_GATHER_ENABLE
+}
+
+__global__ void shadeMissQueue(
+	int depth, int n, const int* queue
+	, PathSegmentSoA pathSegments
+	)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n) {
+		return;
+	}
+	int idx = queue[i];
+	glm::vec3 dir = pathSegments.directions[idx];
+	pathSegments.colors[idx] *= environmentMisWeight(pathSegments.prevPdfs[idx], pathSegments.origins[idx], dir)
+		* environmentRadiance(dir);
+	pathSegments.remainingBounces[idx] = 0;
+#if ADAPTIVE_DEPTH_ENABLE
+	adaptiveDepthDeposit(pathSegments, idx, depth);
+#endif // ADAPTIVE_DEPTH_ENABLE
+#if TERMINATE_GATHER_ENABLE
+	accumulateTerminatedPath(pathSegments, idx);
+#endif // TERMINATE_GATHER_ENABLE
+}
+
+#if DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+// Snapshot the depth-0 intersection's normal and hit point as the filter's
+// edge-stopping guides. Misses write a zero normal; frozen pixels (dead at
+// depth 0 under adaptive sampling) keep their guides from earlier frames.
+__global__ void kernSaveDenoiseGBuffer(
+	int num_paths, ShadeableIntersectionSoA intersections, PathSegmentSoA pathSegments,
+	glm::vec3* normals, glm::vec3* positions)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths || pathSegments.remainingBounces[idx] <= 0) {
+		return;
+	}
+	int pixel = pathSegments.pixelIndices[idx];
+	if (intersections.t[idx] > 0.0f) {
+		normals[pixel] = intersections.surfaceNormals[idx];
+		positions[pixel] = intersections.points[idx];
+	}
+	else {
+		normals[pixel] = glm::vec3(0.0f);
+		positions[pixel] = glm::vec3(0.0f);
+	}
+}
+#endif // DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+
+#if AOV_ENABLE
+// Accumulate the depth-0 AOVs: first-hit shading normal, hit distance and
+// textured albedo. Misses leave a pixel's entries untouched, so its mean
+// decays toward zero like the denoiser guides do; every layer normalizes
+// by the iteration count at save time.
+__global__ void kernAccumulateFirstHitAOVs(
+	int num_paths
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, const Material* __restrict__ materials
+	, glm::vec3* aovNormal
+	, float* aovDepth
+	, glm::vec3* aovAlbedo
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths || pathSegments.remainingBounces[idx] <= 0) {
+		return;
+	}
+	if (shadeableIntersections.t[idx] <= 0.0f) {
+		return;
+	}
+	Material material = fetchMaterial(materials, shadeableIntersections.materialIds[idx]);
+	applyAlbedo(material, shadeableIntersections.uvs[idx], shadeableIntersections.t[idx]);
+	int pixel = pathSegments.pixelIndices[idx];
+	aovNormal[pixel] += shadeableIntersections.surfaceNormals[idx];
+	aovDepth[pixel] += shadeableIntersections.t[idx];
+	aovAlbedo[pixel] += material.color;
+}
+#endif // AOV_ENABLE
+
+#if DENOISE_ENABLE
+__global__ void kernScaleImage(int n, glm::vec3* out, const glm::vec3* in, float scale)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < n) {
+		out[i] = in[i] * scale;
+	}
+}
+
+// One A-Trous pass: a 5x5 B3-spline kernel with taps spread `stepwidth`
+// pixels apart, each tap additionally weighted by how similar its color,
+// normal and position are to the center's so the blur stops at edges.
+__global__ void kernATrousPass(
+	glm::ivec2 resolution, int stepwidth, float cPhi, float nPhi, float pPhi,
+	const glm::vec3* colorIn, glm::vec3* colorOut,
+	const glm::vec3* normals, const glm::vec3* positions)
+{
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+	if (x >= resolution.x || y >= resolution.y) {
+		return;
+	}
+	int index = x + (y * resolution.x);
+
+	glm::vec3 cVal = colorIn[index];
+	glm::vec3 nVal = normals[index];
+	if (glm::dot(nVal, nVal) == 0.0f) {
+		// background pixel: nothing to smooth against
+		colorOut[index] = cVal;
+		return;
+	}
+	glm::vec3 pVal = positions[index];
+
+	// 1D B3 spline, mirrored over the 5x5 footprint
+	const float h[3] = { 0.375f, 0.25f, 0.0625f };
+
+	glm::vec3 sum = glm::vec3(0.0f);
+	float cum = 0.0f;
+	for (int dy = -2; dy <= 2; dy++) {
+		for (int dx = -2; dx <= 2; dx++) {
+			int ux = glm::clamp(x + dx * stepwidth, 0, resolution.x - 1);
+			int uy = glm::clamp(y + dy * stepwidth, 0, resolution.y - 1);
+			int u = ux + (uy * resolution.x);
+
+			glm::vec3 diff = cVal - colorIn[u];
+			float cw = glm::min(expf(-glm::dot(diff, diff) / cPhi), 1.0f);
+			diff = nVal - normals[u];
+			float nw = glm::min(expf(-glm::dot(diff, diff) / nPhi), 1.0f);
+			diff = pVal - positions[u];
+			float pw = glm::min(expf(-glm::dot(diff, diff) / pPhi), 1.0f);
+
+			float weight = h[abs(dx)] * h[abs(dy)] * cw * nw * pw;
+			sum += colorIn[u] * weight;
+			cum += weight;
+		}
+	}
+	colorOut[index] = sum / cum;
+}
+#endif // DENOISE_ENABLE
+
+#if HALF_RES_INDIRECT_ENABLE
+// One thread per 2x2 quad, run right after the first bounce's shading:
+// flush every live path's banked first-vertex light sample into the
+// accumulation (that part is direct and stays full rate), pick the quad's
+// continuing representative and retire the rest with zero color, so
+// finalGather adds nothing for them. Slot == pixel here, so the quad's
+// four slots are addressable without a gather, and one thread owning the
+// quad's pixels means the image adds need no atomics.
+__global__ void kernHalfResSelect(
+	int iter, glm::ivec2 resolution, PathSegmentSoA pathSegments,
+	glm::vec3* image, int* quadRep)
+{
+	int qx = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int qy = (blockIdx.y * blockDim.y) + threadIdx.y;
+	int qw = (resolution.x + 1) / 2;
+	int qh = (resolution.y + 1) / 2;
+	if (qx >= qw || qy >= qh) {
+		return;
+	}
+	// rotate the representative through the quad so every pixel probes the
+	// indirect light once per four iterations
+	int prefer = (iter - 1) & 3;
+	int rep = -1;
+	for (int k = 0; k < 4; k++) {
+		int s = (k + prefer) & 3;
+		int px = qx * 2 + (s & 1);
+		int py = qy * 2 + (s >> 1);
+		if (px >= resolution.x || py >= resolution.y) {
+			continue;
+		}
+		int slot = px + py * resolution.x;
+		if (pathSegments.remainingBounces[slot] <= 0) {
+			// already terminated: its color is all direct, finalGather
+			// banks it at full rate as usual
+			continue;
+		}
+#if DIRECT_LIGHTING_ENABLE
+		image[slot] += glm::vec3(pathSegments.radiances[slot]);
+		pathSegments.radiances[slot] = glm::vec3(0.0f);
+#endif // DIRECT_LIGHTING_ENABLE
+		if (rep < 0) {
+			rep = slot;
+		}
+		else {
+			pathSegments.colors[slot] = glm::vec3(0.0f);
+			pathSegments.remainingBounces[slot] = 0;
+		}
+	}
+	quadRep[qx + qy * qw] = rep;
+}
+
+// One thread per quad at the end of the iteration: the representative's
+// remaining color and any deeper banked light samples are the quad's
+// indirect contribution; zero them afterwards so finalGather does not
+// count them again.
+__global__ void kernHalfResResolve(
+	glm::ivec2 resolution, PathSegmentSoA pathSegments,
+	const int* quadRep, glm::vec3* indirectQuads)
+{
+	int qx = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int qy = (blockIdx.y * blockDim.y) + threadIdx.y;
+	int qw = (resolution.x + 1) / 2;
+	int qh = (resolution.y + 1) / 2;
+	if (qx >= qw || qy >= qh) {
+		return;
+	}
+	int q = qx + qy * qw;
+	int rep = quadRep[q];
+	glm::vec3 indirect = glm::vec3(0.0f);
+	if (rep >= 0) {
+		indirect = glm::vec3(pathSegments.colors[rep]);
+#if DIRECT_LIGHTING_ENABLE
+		indirect += glm::vec3(pathSegments.radiances[rep]);
+#endif // DIRECT_LIGHTING_ENABLE
+		pathSegments.colors[rep] = glm::vec3(0.0f);
+		pathSegments.radiances[rep] = glm::vec3(0.0f);
+	}
+	indirectQuads[q] = indirect;
+}
+
+// Bilateral upsample of the quad-resolution indirect back over the full
+// frame: a bilinear blend of the four quad centers nearest the pixel,
+// each tap additionally weighted by how similar its representative's
+// first-bounce normal and hit point are to this pixel's, so indirect
+// light does not bleed across geometric edges. A pixel whose taps all
+// fail the similarity test falls back to its own quad's raw value.
+__global__ void kernHalfResUpsample(
+	glm::ivec2 resolution, glm::vec3* image, const glm::vec3* indirectQuads,
+	const int* quadRep, const glm::vec3* normals, const glm::vec3* positions)
+{
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+	if (x >= resolution.x || y >= resolution.y) {
+		return;
+	}
+	int index = x + (y * resolution.x);
+	glm::vec3 nVal = normals[index];
+	if (glm::dot(nVal, nVal) == 0.0f) {
+		// primary miss: the path ended on the environment at depth 0 and
+		// has no indirect part
+		return;
+	}
+	glm::vec3 pVal = positions[index];
+	int qw = (resolution.x + 1) / 2;
+	int qh = (resolution.y + 1) / 2;
+	// quad-space position of the pixel center, for the bilinear footprint
+	float fx = ((float)x - 0.5f) * 0.5f;
+	float fy = ((float)y - 0.5f) * 0.5f;
+	int qx0 = (int)floorf(fx);
+	int qy0 = (int)floorf(fy);
+	float tx = fx - qx0;
+	float ty = fy - qy0;
+
+	glm::vec3 sum = glm::vec3(0.0f);
+	float cum = 0.0f;
+	for (int dy = 0; dy <= 1; dy++) {
+		for (int dx = 0; dx <= 1; dx++) {
+			int qx = glm::clamp(qx0 + dx, 0, qw - 1);
+			int qy = glm::clamp(qy0 + dy, 0, qh - 1);
+			int rep = quadRep[qx + qy * qw];
+			if (rep < 0) {
+				continue;
+			}
+			glm::vec3 diff = nVal - normals[rep];
+			float nw = glm::min(expf(-glm::dot(diff, diff) / HALF_RES_N_PHI), 1.0f);
+			diff = pVal - positions[rep];
+			float pw = glm::min(expf(-glm::dot(diff, diff) / HALF_RES_P_PHI), 1.0f);
+			float weight = (dx ? tx : 1.0f - tx) * (dy ? ty : 1.0f - ty) * nw * pw;
+			sum += indirectQuads[qx + qy * qw] * weight;
+			cum += weight;
+		}
+	}
+	if (cum > 0.0f) {
+		image[index] += sum / cum;
+	}
+	else {
+		int own = glm::min(x / 2, qw - 1) + glm::min(y / 2, qh - 1) * qw;
+		if (quadRep[own] >= 0) {
+			image[index] += indirectQuads[own];
+		}
+	}
+}
+#endif // HALF_RES_INDIRECT_ENABLE
+
+#if ADAPTIVE_SAMPLING
+// Welford update of each live pixel's luminance statistics with this
+// iteration's contribution, then the convergence test: once the 95%
+// confidence halfwidth of the mean is within the tolerance (relative, with
+// a small floor so dark pixels can converge), the pixel is frozen.
+__global__ void kernUpdatePixelStats(
+	int nPaths, glm::ivec2 res, PathSegmentSoA iterationPaths,
+	float* means, float* m2s, int* samples, int* converged)
+{
+	int index = (blockIdx.x * blockDim.x) + threadIdx.x;
+	if (index >= nPaths) {
+		return;
+	}
+	int pixel = iterationPaths.pixelIndices[index];
+	if (converged[pixel]) {
+		return;
+	}
+	glm::vec3 c = iterationPaths.colors[index];
+#if DIRECT_LIGHTING_ENABLE
+	c += glm::vec3(iterationPaths.radiances[index]);
+#endif // DIRECT_LIGHTING_ENABLE
+	float l = glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+
+	int n = samples[pixel] + 1;
+	samples[pixel] = n;
+	float mean = means[pixel];
+	float delta = l - mean;
+	mean += delta / n;
+	float m2 = m2s[pixel] + delta * (l - mean);
+	means[pixel] = mean;
+	m2s[pixel] = m2;
+
+	if (n >= ADAPTIVE_MIN_SAMPLES) {
+		float tolerance = ADAPTIVE_TOLERANCE;
+#if IMPORTANCE_MAP_ENABLE
+		if (c_importance != NULL) {
+			// nearest-sample the map at the pixel's normalized position;
+			// the map is painted over the saved frame, which is mirrored
+			// in x (see saveImage), so mirror here to match
+			int px = res.x - 1 - pixel % res.x;
+			int py = pixel / res.x;
+			int ix = glm::min(px * c_importanceDims.x / res.x, c_importanceDims.x - 1);
+			int iy = glm::min(py * c_importanceDims.y / res.y, c_importanceDims.y - 1);
+			float imp = c_importance[iy * c_importanceDims.x + ix];
+			tolerance *= 1.0f + (IMPORTANCE_MAP_SLACK - 1.0f) * (1.0f - imp);
+		}
+#endif // IMPORTANCE_MAP_ENABLE
+		float ci = 1.96f * sqrt(m2 / ((float)n * (n - 1)));
+		if (ci < tolerance * (mean + 0.05f)) {
+			converged[pixel] = 1;
 		}
 	}
 }
+#endif // ADAPTIVE_SAMPLING
 
 // Add the current iteration's output to the overall image
-__global__ void finalGather(int nPaths, glm::vec3* image, PathSegment* iterationPaths)
+__global__ void finalGather(int nPaths, glm::vec3* image, PathSegmentSoA iterationPaths,
+	glm::vec3* clampedEnergy)
 {
 	int index = (blockIdx.x * blockDim.x) + threadIdx.x;
 
 	if (index < nPaths)
 	{
-		PathSegment iterationPath = iterationPaths[index];
-		image[iterationPath.pixelIndex] += iterationPath.color;
+		glm::vec3 contribution = iterationPaths.colors[index];
+#if DIRECT_LIGHTING_ENABLE
+		// radiance banked by the per-bounce light samples rides on top of the
+		// path's own terminal color
+		contribution += glm::vec3(iterationPaths.radiances[index]);
+#endif // DIRECT_LIGHTING_ENABLE
+#if SPP_BATCH > 1
+		// average the batch: one iteration still deposits one sample's
+		// worth, so the divide-by-iter display math holds unchanged. The
+		// clamp below then sees the scaled sample, which keeps the
+		// threshold's meaning per deposited iteration rather than per ray
+		contribution *= 1.0f / (float)SPP_BATCH;
+#endif // SPP_BATCH
+#if FIREFLY_CLAMP_ENABLE
+		float l = glm::dot(contribution, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+		if (l > FIREFLY_CLAMP) {
+			// scale the sample down to the clamp and bank the excess
+			glm::vec3 kept = contribution * (FIREFLY_CLAMP / l);
+#if SPP_BATCH > 1
+			glm::vec3 excess = contribution - kept;
+			glm::vec3* bank = &clampedEnergy[iterationPaths.pixelIndices[index]];
+			atomicAdd(&bank->x, excess.x);
+			atomicAdd(&bank->y, excess.y);
+			atomicAdd(&bank->z, excess.z);
+#else
+			clampedEnergy[iterationPaths.pixelIndices[index]] += contribution - kept;
+#endif // SPP_BATCH
+			contribution = kept;
+		}
+#endif // FIREFLY_CLAMP_ENABLE
+#if SPP_BATCH > 1
+		// the batch's slots share pixels within this one launch
+		glm::vec3* accum = &image[iterationPaths.pixelIndices[index]];
+		atomicAdd(&accum->x, contribution.x);
+		atomicAdd(&accum->y, contribution.y);
+		atomicAdd(&accum->z, contribution.z);
+#else
+		image[iterationPaths.pixelIndices[index]] += contribution;
+#endif // SPP_BATCH
 	}
 }
 
 
-struct is_zero
-{
-	__host__ __device__
-		bool operator()(const PathSegment p)
-	{
-		return p.remainingBounces > 0;
+/**
+ * Wrapper for the __global__ call that sets up the kernel calls and does a ton
+ * of memory management
+ */
+// occupancy-recommended block size for one kernel, with the hard-coded
+// default as the fallback if the query fails
+template <typename F>
+static int occupancyBlockSize(F kernel) {
+	int minGridSize = 0;
+	int blockSize = 0;
+	if (cudaOccupancyMaxPotentialBlockSize(&minGridSize, &blockSize, kernel)
+		!= cudaSuccess || blockSize <= 0) {
+		cudaGetLastError();
+		return 128;
 	}
-};
+	return blockSize;
+}
 
+// Pick the launch shapes for this device: occupancy first, then any
+// swept winners recorded for this GPU model by --tune. One magic number
+// was never right across three GPU generations; the traversal kernels in
+// particular spill at block sizes the cheap gather kernels are happy with.
+static void tuneLaunchSizes() {
+#if PERSISTENT_THREADS
+	blockSizeIntersect = occupancyBlockSize(computeIntersectionsPersistent<false, false>);
+#else
+	blockSizeIntersect = occupancyBlockSize(computeIntersections<false, false>);
+#endif // PERSISTENT_THREADS
+#if MEGAKERNEL_ENABLE
+	blockSizeShade = occupancyBlockSize(fusedIntersectShade);
+#elif WAVEFRONT_ENABLE
+	blockSizeShade = occupancyBlockSize(shadeDiffuseQueue);
+#else
+	blockSizeShade = occupancyBlockSize(shadeBSDFMaterial);
+#endif // MEGAKERNEL_ENABLE
+	blockSizeGather = occupancyBlockSize(finalGather);
 
+	// launchconfig.txt: "gpu <model>" then "<kernel> <blocksize>" lines.
+	// Ignored wholesale when the model does not match this device, so a
+	// config swept on one machine cannot mistune another.
+	FILE* f = fopen("launchconfig.txt", "r");
+	if (f != NULL) {
+		cudaDeviceProp prop;
+		int device = 0;
+		cudaGetDevice(&device);
+		cudaGetDeviceProperties(&prop, device);
 
-struct material_cmp {
-	__host__ __device__ bool operator()(const ShadeableIntersection& s1, const ShadeableIntersection& s2) {
-		return s1.materialId < s2.materialId;
+		char line[512];
+		bool gpuMatches = false;
+		while (fgets(line, sizeof(line), f) != NULL) {
+			char name[256];
+			int value;
+			if (sscanf(line, "gpu %255[^\n]", name) == 1) {
+				gpuMatches = strcmp(name, prop.name) == 0;
+			}
+			else if (gpuMatches && sscanf(line, "intersect %d", &value) == 1) {
+				blockSizeIntersect = value;
+			}
+			else if (gpuMatches && sscanf(line, "shade %d", &value) == 1) {
+				blockSizeShade = value;
+			}
+			else if (gpuMatches && sscanf(line, "gather %d", &value) == 1) {
+				blockSizeGather = value;
+			}
+		}
+		fclose(f);
 	}
-};
+	printf("launch config: intersect %d, shade %d, gather %d\n",
+		blockSizeIntersect, blockSizeShade, blockSizeGather);
+}
 
-/**
- * Wrapper for the __global__ call that sets up the kernel calls and does a ton
- * of memory management
- */
-void pathtrace(uchar4* pbo, int frame, int iter) {
-	const int traceDepth = hst_scene->state.traceDepth;
-	const Camera& cam = hst_scene->state.camera;
+void pathtraceSetLaunchSizes(int intersect, int shade, int gather) {
+	blockSizeIntersect = intersect;
+	blockSizeShade = shade;
+	blockSizeGather = gather;
+}
+
+void pathtraceGetLaunchSizes(int* intersect, int* shade, int* gather) {
+	*intersect = blockSizeIntersect;
+	*shade = blockSizeShade;
+	*gather = blockSizeGather;
+}
+
+static void pathtraceIteration(uchar4* pbo, int frame, int iter) {
+	// one bounce in layout preview; every launch below reads this local
+	const int traceDepth = layoutPreview ? 1 : hst_scene->state.traceDepth;
+	Camera cam = hst_scene->state.camera;
+	int scale = previewScale;
+#if GBUFFER_ENABLE
+	// the rasterized G-buffer stays full resolution, so a scaled traced
+	// frame would read the wrong texels; movement frames keep full size
+	scale = 1;
+#endif // GBUFFER_ENABLE
+	const glm::ivec2 displayResolution = cam.resolution;
+	if (scale > 1) {
+		// movement preview: trace 1/scale the pixels in each dimension over
+		// the same field of view. The buffers carved for the full frame
+		// simply run mostly empty, and the caller restarts accumulation on
+		// every scale change, so dev_image never mixes the two layouts.
+		cam.resolution = (cam.resolution + scale - 1) / scale;
+		cam.cropOffset /= scale;
+		cam.fullResolution = (cam.fullResolution + scale - 1) / scale;
+		cam.pixelLength *= (float)scale;
+	}
+	// the frame layout pixelIndices address: the (possibly preview-scaled)
+	// full view, regardless of any ROI crop below
+	const glm::ivec2 frameResolution = cam.resolution;
+#if ROI_ENABLE
+	// look-dev crop: shrink the traced frame to the region of interest,
+	// leaving every other pixel's accumulation untouched. The tile-camera
+	// crop fields give the rectangle its correct primary directions, and
+	// c_roiOffset maps the compact launch back onto the frame layout.
+	// Movement frames (scale > 1) trace the whole view - the camera is in
+	// motion and the freeze would show the wrong one anyway.
+	const bool roiActive = roiSize.x > 0 && scale == 1;
+	if (roiActive) {
+		cam.cropOffset += roiOffset;
+		cam.resolution = roiSize;
+	}
+	{
+		glm::ivec2 off = roiActive ? roiOffset : glm::ivec2(0, 0);
+		int frameWidth = roiActive ? displayResolution.x : cam.resolution.x;
+		cudaMemcpyToSymbolAsync(c_roiOffset, &off, sizeof(off), 0,
+			cudaMemcpyHostToDevice, computeStream);
+		cudaMemcpyToSymbolAsync(c_roiFrameWidth, &frameWidth, sizeof(frameWidth), 0,
+			cudaMemcpyHostToDevice, computeStream);
+	}
+#endif // ROI_ENABLE
 	const int pixelcount = cam.resolution.x * cam.resolution.y;
 
 	// 2D block for generating ray from camera
@@ -472,19 +8432,135 @@ void pathtrace(uchar4* pbo, int frame, int iter) {
 	// * Finally, add this iteration's results to the image. This has been done
 	//   for you.
 
+#if PHOTON_MAP_ENABLE
+	// deferred to the first iteration: the tracing kernels and every scene
+	// buffer the emission pass reads are in place by then on this device
+	if (numPhotonStores < 0) {
+		buildPhotonMap();
+	}
+#endif // PHOTON_MAP_ENABLE
+
+#if PATH_GUIDING_ENABLE
+	{
+		// refresh the guiding distribution from last iteration's deposits
+		// before any of this iteration's sampling reads it
+		int guideBlocks = (GUIDE_NUM_CELLS + blockSize1d - 1) / blockSize1d;
+		kernGuideDecay << <guideBlocks, blockSize1d, 0, computeStream >> > (
+			dev_guideFlux, dev_guideAccum, dev_guideCellFlux);
+	}
+#endif // PATH_GUIDING_ENABLE
+
+#if ADAPTIVE_DEPTH_ENABLE
+	{
+		// distill the tiles' depth budgets from everything deposited so
+		// far; zero samples during warmup parks every tile at full depth
+		float invSamples = iter > ADAPTIVE_DEPTH_WARMUP
+			? 1.0f / ((float)(iter - 1) * ADAPTIVE_DEPTH_TILE * ADAPTIVE_DEPTH_TILE * SPP_BATCH)
+			: 0.0f;
+		int tileBlocks = (numDepthTiles + blockSize1d - 1) / blockSize1d;
+		kernAdaptiveDepthBudget << <tileBlocks, blockSize1d, 0, computeStream >> > (
+			numDepthTiles, dev_tileDepthLum, dev_tileDepthBudget, traceDepth, invSamples);
+		checkCUDAError("adaptive depth budgets");
+	}
+#endif // ADAPTIVE_DEPTH_ENABLE
+
 	// perform one iteration of path tracing
+	NVTX_PUSH("iteration %d", iter);
 
-	generateRayFromCamera << <blocksPerGrid2d, blockSize2d >> > (cam, iter, traceDepth, dev_paths);
-	checkCUDAError("generate camera ray");
+#if CUDA_GRAPH_ENABLE && !STREAM_COMPACTION && !WAVEFRONT_ENABLE && !CACHE_ENABLE
+	// record the launches below into a graph instead of executing them
+	cudaStreamBeginCapture(computeStream, cudaStreamCaptureModeThreadLocal);
+#endif // CUDA_GRAPH_ENABLE
+
+#if PATH_REGEN_ENABLE
+	// only the very first call seeds the slots from the camera; afterwards
+	// kernRegeneratePaths keeps every slot in flight across calls
+	if (iter == 1)
+#endif // PATH_REGEN_ENABLE
+	{
+		PROFILE_BEGIN(PROF_RAYGEN, 0, computeStream);
+		NVTX_PUSH("raygen");
+#if FUSED_PRIMARY_ENABLE && !GBUFFER_ENABLE && !CACHE_ENABLE && !MEGAKERNEL_ENABLE && !COOP_LAUNCH_ENABLE && !PATH_REGEN_ENABLE && SPP_BATCH == 1
+		launchGeneratePrimaryAndIntersect(blocksPerGrid2d, blockSize2d, computeStream, camFeatures,
+			cam, iter, traceDepth);
+		checkCUDAError("generate primary rays and hits");
+#else
+#if SPP_BATCH > 1
+		// one raygen launch per sample plane: the shifted stream bases land
+		// the per-pixel slot math in plane s, the RNG lanes shift along, and
+		// the virtual iteration number puts each sample on its own point of
+		// the pixel's Sobol sequence
+		for (int s = 0; s < SPP_BATCH; s++) {
+			launchGenerateRayFromCamera(blocksPerGrid2d, blockSize2d, computeStream, camFeatures,
+				cam, (iter - 1) * SPP_BATCH + s + 1, traceDepth,
+				pathStreamForSample(dev_paths, s * pixelcount),
+				dev_rngStates + s * pixelcount, dev_image, dev_pixelConverged, dev_pixelToSlot);
+		}
+		checkCUDAError("generate camera ray batch");
+#else
+		launchGenerateRayFromCamera(blocksPerGrid2d, blockSize2d, computeStream, camFeatures,
+			cam, iter, traceDepth, dev_paths, dev_rngStates, dev_image, dev_pixelConverged, dev_pixelToSlot);
+		checkCUDAError("generate camera ray");
+#endif // SPP_BATCH
+#endif // FUSED_PRIMARY_ENABLE
+		NVTX_POP();
+		PROFILE_END(PROF_RAYGEN, computeStream);
+	}
 
+#if BDPT_ENABLE
+	// bidirectional engine: one kernel replaces the whole bounce loop. The
+	// raygen above staged the primary rays; everything after the #endif
+	// (gather, denoise, present) is shared with the unidirectional pipeline.
+	int num_paths = pixelcount;
+	dim3 numblocksBDPT = (num_paths + blockSize1d - 1) / blockSize1d;
+	NVTX_PUSH("bdpt");
+	kernBDPT << <numblocksBDPT, blockSize1d, 0, computeStream >> > (
+		num_paths, iter, traceDepth, dev_paths, dev_materials, dev_rngStates,
+		dev_lights, numLights, dev_geomsHot, dev_geomsCold, numStaticGeoms, numMovingGeoms,
+		dev_triangles, dev_vertices, dev_normals, dev_bvhNodes,
+		dev_tlasNodes, tlasRoot, dev_movingTlasNodes, movingTlasRoot);
+	checkCUDAError("bdpt iteration");
+	NVTX_POP();
+#elif COOP_LAUNCH_ENABLE
+	// single cooperative launch runs the whole bounce loop on-device; the
+	// grid is occupancy-sized so every block is resident and grid.sync()
+	// is legal, and each thread grid-strides over the path pool per bounce
+	int num_paths = SPP_BATCH * pixelcount;
+	static int coopBlocks = 0;
+	if (coopBlocks == 0) {
+		int device, numSMs, blocksPerSM;
+		cudaGetDevice(&device);
+		cudaDeviceGetAttribute(&numSMs, cudaDevAttrMultiProcessorCount, device);
+		cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocksPerSM,
+			kernBounceLoopCoop, blockSize1d, 0);
+		coopBlocks = numSMs * (blocksPerSM > 0 ? blocksPerSM : 1);
+	}
+	cudaMemsetAsync(dev_coopLiveCounters, 0, 2 * sizeof(int), computeStream);
+	NVTX_PUSH("coop bounce loop");
+	void* coopArgs[] = { &iter, &traceDepth, &num_paths, &dev_paths,
+		&dev_geomsHot, &dev_geomsCold, &numStaticGeoms, &numMovingGeoms,
+		&dev_materials, &dev_rngStates, &dev_lights, &numLights,
+		&dev_triangles, &dev_vertices, &dev_normals, &dev_bvhNodes,
+		&dev_tlasNodes, &tlasRoot, &dev_movingTlasNodes, &movingTlasRoot,
+		&dev_coopLiveCounters };
+	cudaLaunchCooperativeKernel((void*)kernBounceLoopCoop,
+		dim3(coopBlocks), dim3(blockSize1d), coopArgs, 0, computeStream);
+	checkCUDAError("cooperative bounce loop");
+	NVTX_POP();
+#else
 	int depth = 0;
-	PathSegment* dev_path_end = dev_paths + pixelcount;
-	int num_paths = dev_path_end - dev_paths;
+	int num_paths = SPP_BATCH * pixelcount;
 	int remaining_paths = num_paths;
-
-#if PROFILE_ENABLE
-	cudaEventRecord(start);
-#endif // PROFILE_ENABLE
+#if VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+	const bool sceneHasMedium = hst_scene->medium.sigmaS + hst_scene->medium.sigmaA != glm::vec3(0.0f);
+#endif // VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+#if STREAM_COMPACTION
+	// depth 0 runs on the identity order; the first compaction fills the
+	// first index buffer from it
+	dev_activePaths = NULL;
+	activePathBuf = 0;
+	bool countPending = false;
+#endif // STREAM_COMPACTION
 
 	// --- PathSegment Tracing Stage ---
 	// Shoot ray into scene, bounce between objects, push shading chunks
@@ -492,124 +8568,1011 @@ void pathtrace(uchar4* pbo, int frame, int iter) {
 	bool iterationComplete = false;
 	while (!iterationComplete) {
 
-		// clean shading chunks
-		cudaMemset(dev_intersections, 0, pixelcount * sizeof(ShadeableIntersection));
+#if STREAM_COMPACTION
+		// pick up the freshest compaction count that has actually arrived,
+		// without ever blocking; counts only shrink, so launching with an
+		// older value merely over-sizes the grid
+		if (countPending && cudaEventQuery(pathCountEvent) == cudaSuccess) {
+			remaining_paths = *host_pathCount;
+			countPending = false;
+			if (remaining_paths <= 0) {
+				break;
+			}
+		}
+#endif // STREAM_COMPACTION
+
+		// no clear needed: computeIntersections writes t for every active path,
+		// and the other components are only read when t > 0
 
 		dim3 numblocksPathSegmentTracing = (remaining_paths + blockSize1d - 1) / blockSize1d;
-#if CACHE_ENABLE && !ANTIALIASING
+		dim3 numblocksIntersect = (remaining_paths + blockSizeIntersect - 1) / blockSizeIntersect;
+		dim3 numblocksShade = (remaining_paths + blockSizeShade - 1) / blockSizeShade;
+		if (profileActive && depth < PROFILE_MAX_BOUNCES) {
+			profilePathsAliveSum[depth] += remaining_paths;
+			profilePathsAliveIters[depth]++;
+		}
+		NVTX_PUSH("bounce %d: %d paths", depth, remaining_paths);
+#if HEATMAP_ENABLE
+		kernAccumulateBounceDepth << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+			remaining_paths, dev_activePaths, dev_paths.pixelIndices, dev_pixelBounceDepth);
+#endif // HEATMAP_ENABLE
+#if MEGAKERNEL_ENABLE
+		// fused pipeline: one launch intersects, runs next event estimation
+		// and scatters; depth advances first so the scatter stage sees the
+		// same value it would in the split pipeline
+		depth++;
+		PROFILE_BEGIN(PROF_SHADE, depth - 1, computeStream);
+		NVTX_PUSH("fused intersect+shade");
+		fusedIntersectShade << <numblocksShade, blockSizeShade, 0, computeStream >> > (
+			iter, depth, remaining_paths, dev_paths,
+			dev_geomsHot, dev_geomsCold, numStaticGeoms, numMovingGeoms,
+			dev_materials, dev_rngStates, dev_lights, numLights,
+			dev_triangles, dev_vertices, dev_normals, dev_bvhNodes,
+			dev_tlasNodes, tlasRoot, dev_movingTlasNodes, movingTlasRoot, dev_activePaths);
+		checkCUDAError("fused intersect shade");
+		NVTX_POP();
+		PROFILE_END(PROF_SHADE, computeStream);
+#else
+#if RAY_SORT_ENABLE
+		if (depth > 0) {
+			PROFILE_BEGIN(PROF_SORT, depth, computeStream);
+			NVTX_PUSH("sort");
+			kernComputeRayKeys << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, dev_paths, dev_activePaths, sceneBoundsMin, sceneBoundsInvExtent,
+				dev_raySortKeys, dev_raySortIndices);
+			StreamCompaction::sortPairs(dev_raySortKeys, dev_raySortIndices,
+				remaining_paths, 32, dev_raySortScratch, computeStream);
+			checkCUDAError("ray coherence sort");
+			NVTX_POP();
+			PROFILE_END(PROF_SORT, computeStream);
+		}
+#endif // RAY_SORT_ENABLE
+		PROFILE_BEGIN(PROF_INTERSECT, depth, computeStream);
+		NVTX_PUSH("intersect");
+#if GBUFFER_ENABLE
+		if (depth <= 0) {
+			// primary visibility comes from the rasterized G-buffer
+			kernGBufferToIntersections << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths
+				, cam.resolution
+				, dev_gbufferPositions
+				, dev_gbufferNormals
+				, dev_paths
+				, dev_intersections
+				);
+			checkCUDAError("gbuffer primary hits");
+		}
+		else {
+			traceOneBounce(depth, remaining_paths, numblocksIntersect, blockSizeIntersect);
+		}
+#elif CACHE_ENABLE
 		if (depth <= 0) {
-			if (iter > 1) {
+			// the stratum cycle matches generateRayFromCamera, so the cached
+			// hit always belongs to this iteration's subpixel position
+			int stratum = (iter - 1) % CACHE_STRATA;
+			if (iter > CACHE_STRATA) {
 				// tracing
-				cudaMemcpy(dev_intersections, dev_intersections_cache, pixelcount * sizeof(ShadeableIntersection), cudaMemcpyDeviceToDevice);
+				copyIntersections(dev_intersections, cacheSlice(stratum, pixelcount), pixelcount);
+#if AA_EDGE_ADAPTIVE_ENABLE
+				if (numAaEdgePaths > 0) {
+					// re-trace just the edge pixels over the copied hits:
+					// pointing the live-slot indirection at the edge list
+					// shrinks the launch to the masked fraction, and the
+					// kernels write through the remapped slot so interior
+					// pixels keep their cached intersection
+					const int* savedActivePaths = dev_activePaths;
+					dev_activePaths = dev_aaEdgeList;
+					dim3 numblocksAaEdge = (numAaEdgePaths + blockSizeIntersect - 1) / blockSizeIntersect;
+					traceOneBounce(depth, numAaEdgePaths, numblocksAaEdge, blockSizeIntersect);
+					dev_activePaths = savedActivePaths;
+				}
+#endif // AA_EDGE_ADAPTIVE_ENABLE
 			}
 			else {
-				computeIntersections << <numblocksPathSegmentTracing, blockSize1d >> > (
-					depth
-					, remaining_paths
-					, dev_paths
-					, dev_geoms
-					, hst_scene->geoms.size()
-					, dev_intersections
-					, dev_triangles
-					);
-				checkCUDAError("trace one bounce");
-				cudaMemcpy(dev_intersections_cache, dev_intersections, pixelcount * sizeof(ShadeableIntersection), cudaMemcpyDeviceToDevice);
+				traceOneBounce(depth, remaining_paths, numblocksIntersect, blockSizeIntersect);
+				copyIntersections(cacheSlice(stratum, pixelcount), dev_intersections, pixelcount);
+#if AA_EDGE_ADAPTIVE_ENABLE
+				if (iter == CACHE_STRATA) {
+					// the cache just completed its last stratum: classify
+					// the frame before the next iteration consults the mask
+					cudaMemsetAsync(dev_aaEdgeCount, 0, sizeof(int), computeStream);
+					dim3 numblocksAaMask = (pixelcount + blockSizeIntersect - 1) / blockSizeIntersect;
+					kernBuildAaEdgeMask << <numblocksAaMask, blockSizeIntersect, 0, computeStream >> > (
+						cam.resolution, dev_intersections_cache,
+						dev_aaEdgeMask, dev_aaEdgeList, dev_aaEdgeCount);
+					cudaMemcpy(&numAaEdgePaths, dev_aaEdgeCount, sizeof(int), cudaMemcpyDeviceToHost);
+					checkCUDAError("build aa edge mask");
+				}
+#endif // AA_EDGE_ADAPTIVE_ENABLE
 			}
 		}
 		else {
 			// tracing
-			computeIntersections << <numblocksPathSegmentTracing, blockSize1d >> > (
-				depth
-				, remaining_paths
-				, dev_paths
-				, dev_geoms
-				, hst_scene->geoms.size()
-				, dev_intersections
-				, dev_triangles
-				);
-			checkCUDAError("trace one bounce");
+			traceOneBounce(depth, remaining_paths, numblocksIntersect, blockSizeIntersect);
 		}
 #else
-		// tracing
-		computeIntersections << <numblocksPathSegmentTracing, blockSize1d >> > (
-			depth
-			, remaining_paths
-			, dev_paths
-			, dev_geoms
-			, hst_scene->geoms.size()
-			, dev_intersections
-			, dev_triangles
-			);
-		checkCUDAError("trace one bounce");
+		// tracing (depth 0 already came fused with ray generation)
+#if FUSED_PRIMARY_ENABLE && !PATH_REGEN_ENABLE
+		if (depth > 0)
+#endif // FUSED_PRIMARY_ENABLE
+		{
+			traceOneBounce(depth, remaining_paths, numblocksIntersect, blockSizeIntersect);
+		}
 #endif // CACHE_ENABLE
-		cudaDeviceSynchronize();
-		depth++;
+		NVTX_POP();
+		PROFILE_END(PROF_INTERSECT, computeStream);
+
+#if DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+		if (depth == 0) {
+			kernSaveDenoiseGBuffer << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, dev_intersections, dev_paths, dev_denoiseNormals, dev_denoisePositions);
+			checkCUDAError("save denoise gbuffer");
+		}
+#endif // DENOISE_ENABLE || HALF_RES_INDIRECT_ENABLE
+#if AOV_ENABLE
+		if (depth == 0 && scale == 1) {
+			kernAccumulateFirstHitAOVs << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, dev_intersections, dev_paths, dev_materials,
+				dev_aovNormal, dev_aovDepth, dev_aovAlbedo);
+			checkCUDAError("accumulate first hit aovs");
+		}
+#endif // AOV_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+		if (depth == 0 && scale == 1) {
+			kernSaveReprojPositions << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, dev_intersections, dev_paths, dev_reprojPositions);
+			checkCUDAError("save reprojection positions");
+		}
+#endif // TEMPORAL_REPROJECTION_ENABLE
 
-#if SORT_BY_MATERIAL
-		// sort by material id
-		thrust::device_ptr<ShadeableIntersection> pIntersection = thrust::device_pointer_cast<ShadeableIntersection>(dev_intersections);
-		thrust::device_ptr<PathSegment> pPathSegment = thrust::device_pointer_cast<PathSegment>(dev_paths);
-		thrust::sort_by_key(pIntersection, pIntersection + remaining_paths, pPathSegment, material_cmp());
-#endif // SORT_BY_MATERIAL
+#if VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
+		if (sceneHasMedium) {
+			NVTX_PUSH("volume");
+			kernVolumeScatter << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, dev_intersections, dev_paths, dev_rngStates,
+				dev_lights, numLights, dev_geomsHot, numStaticGeoms, numMovingGeoms,
+				dev_triangles, dev_vertices, dev_bvhNodes,
+				dev_tlasNodes, tlasRoot, dev_movingTlasNodes, movingTlasRoot, dev_activePaths);
+			checkCUDAError("volume scatter");
+			NVTX_POP();
+		}
+#endif // VOLUME_ENABLE && DIRECT_LIGHTING_ENABLE
 
-		
+		PROFILE_BEGIN(PROF_SHADE, depth, computeStream);
+		NVTX_PUSH("shade");
+#if DIRECT_LIGHTING_ENABLE
+#if RESTIR_ENABLE
+		// first bounce with listed lights (and no environment map, whose
+		// 50/50 technique split the reservoirs do not model): resampled
+		// light selection with temporal + spatial reuse, one shadow ray
+		if (depth == 0 && numLights > 0 && envMapTexels == 0) {
+			kernReSTIRTemporal << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, iter, dev_intersections, dev_paths, dev_materials, dev_rngStates,
+				dev_lights, numLights, dev_reservoirs[0], dev_reservoirs[1], dev_activePaths);
+			kernReSTIRSpatial << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, cam.resolution, dev_intersections, dev_paths, dev_materials,
+				dev_rngStates, dev_reservoirs[1], dev_reservoirs[0],
+				dev_geomsHot, numStaticGeoms, numMovingGeoms,
+				dev_triangles, dev_vertices, dev_bvhNodes,
+				dev_tlasNodes, tlasRoot, dev_movingTlasNodes, movingTlasRoot, dev_activePaths);
+			checkCUDAError("restir direct light");
+		} else if (numLights > 0 || envMapTexels > 0) {
+#else
+		if (numLights > 0 || envMapTexels > 0) {
+#endif // RESTIR_ENABLE
+			kernSampleDirectLight << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+				remaining_paths, depth, dev_intersections, dev_paths, dev_materials, dev_rngStates,
+				dev_lights, numLights, dev_geomsHot, numStaticGeoms, numMovingGeoms,
+				dev_triangles, dev_vertices, dev_bvhNodes,
+				dev_tlasNodes, tlasRoot, dev_movingTlasNodes, movingTlasRoot, dev_activePaths
+#if DEFERRED_SHADOW_ENABLE
+				, dev_shadowQueue, dev_shadowQueueCount
+#endif // DEFERRED_SHADOW_ENABLE
+				);
+			checkCUDAError("sample direct light");
+		}
+#endif // DIRECT_LIGHTING_ENABLE
+		depth++;
 
 		// TODO:
 		// --- Shading Stage ---
 		// Shade path segments based on intersections and generate new rays by
-	  // evaluating the BSDF.
+		// evaluating the BSDF.
 	  // Start off with just a big kernel that handles all the different
 	  // materials you have in the scenefile.
 	  // TODO: compare between directly shading the path segments and shading
 	  // path segments that have been reshuffled to be contiguous in memory.
 
-		shadeBSDFMaterial << <numblocksPathSegmentTracing, blockSize1d >> > (
+#if WAVEFRONT_ENABLE
+		cudaMemset(dev_queueCounters, 0, QUEUE_COUNT * sizeof(int));
+		kernBinPathsByMaterial << <numblocksPathSegmentTracing, blockSize1d, 0, computeStream >> > (
+			remaining_paths,
+			dev_intersections,
+			dev_paths,
+			dev_materials,
+			dev_queues,
+			dev_queueCounters,
+			SPP_BATCH * pixelcount,
+			dev_activePaths
+			);
+		checkCUDAError("bin paths by material");
+
+		int queueCounts[QUEUE_COUNT];
+		cudaMemcpyAsync(queueCounts, dev_queueCounters, QUEUE_COUNT * sizeof(int), cudaMemcpyDeviceToHost, computeStream);
+		cudaStreamSynchronize(computeStream);
+
+		for (int q = 0; q < QUEUE_COUNT; q++) {
+			int n = queueCounts[q];
+			if (n <= 0) {
+				continue;
+			}
+			const int* queue = dev_queues + q * pixelcount;
+			dim3 numBlocksQueue = (n + blockSizeShade - 1) / blockSizeShade;
+			switch (q) {
+			case QUEUE_DIFFUSE:
+				shadeDiffuseQueue << <numBlocksQueue, blockSizeShade, 0, computeStream >> > (iter, depth, n, queue, dev_intersections, dev_paths, dev_materials, dev_rngStates);
+				break;
+			case QUEUE_SPECULAR:
+				shadeSpecularQueue << <numBlocksQueue, blockSizeShade, 0, computeStream >> > (iter, depth, n, queue, dev_intersections, dev_paths, dev_materials, dev_rngStates);
+				break;
+			case QUEUE_REFRACTIVE:
+				shadeRefractiveQueue << <numBlocksQueue, blockSizeShade, 0, computeStream >> > (iter, depth, n, queue, dev_intersections, dev_paths, dev_materials, dev_rngStates);
+				break;
+			case QUEUE_EMISSIVE:
+				shadeEmissiveQueue << <numBlocksQueue, blockSizeShade, 0, computeStream >> > (depth, n, queue, dev_intersections, dev_paths, dev_materials);
+				break;
+			case QUEUE_MISS:
+				shadeMissQueue << <numBlocksQueue, blockSizeShade, 0, computeStream >> > (depth, n, queue, dev_paths);
+				break;
+			}
+		}
+		checkCUDAError("shade material queues");
+#else
+#if FUSED_COMPACT_ENABLE
+		// reset the append counter the survivor emission bumps; same
+		// stream, so the launch below always sees it zeroed
+		cudaMemsetAsync(dev_survivorCount, 0, sizeof(int), computeStream);
+#endif // FUSED_COMPACT_ENABLE
+		shadeBSDFMaterial << <numblocksShade, blockSizeShade, 0, computeStream >> > (
 			iter,
+			depth,
 			remaining_paths,
 			dev_intersections,
 			dev_paths,
-			dev_materials
+			dev_materials,
+			dev_rngStates,
+			dev_activePaths
+#if FUSED_COMPACT_ENABLE
+			, dev_pathIndices[activePathBuf]
+			, dev_survivorCount
+#endif // FUSED_COMPACT_ENABLE
 			);
+#endif // WAVEFRONT_ENABLE
+		NVTX_POP();
+		PROFILE_END(PROF_SHADE, computeStream);
+
+#if HALF_RES_INDIRECT_ENABLE
+		if (depth == 1) {
+			// first bounce just shaded: drop to one continuing path per quad
+			const dim3 quadBlocks(
+				((cam.resolution.x + 1) / 2 + blockSize2d.x - 1) / blockSize2d.x,
+				((cam.resolution.y + 1) / 2 + blockSize2d.y - 1) / blockSize2d.y);
+			kernHalfResSelect << <quadBlocks, blockSize2d, 0, computeStream >> > (
+				iter, cam.resolution, dev_paths, dev_image, dev_quadRep);
+			checkCUDAError("half-res select");
+		}
+#endif // HALF_RES_INDIRECT_ENABLE
+#endif // MEGAKERNEL_ENABLE
 		//iterationComplete = true;
 
-		if (depth >= traceDepth) {
+#if MATERIAL_DEPTH_BUDGET_ENABLE
+		// refunded delta chains may still be alive past traceDepth
+		if (depth >= traceDepth + SPECULAR_EXTRA_DEPTH) {
 			iterationComplete = true;
 		}
-
-#if STREAM_COMPACTION
-		PathSegment* new_dev_path_end = thrust::stable_partition(thrust::device, dev_paths, dev_paths + remaining_paths, is_zero());
-		remaining_paths = new_dev_path_end - dev_paths;
-		if (remaining_paths <= 0) {
+#else
+		if (depth >= traceDepth) {
 			iterationComplete = true;
 		}
+#endif // MATERIAL_DEPTH_BUDGET_ENABLE
+
+#if PATH_REGEN_ENABLE
+		// flush finished samples and refill their slots with the next
+		// sample's primaries, so the next wavefront re-enters full
+		PROFILE_BEGIN(PROF_COMPACT, depth - 1, computeStream);
+		NVTX_PUSH("regenerate");
+		launchRegeneratePaths(numblocksPathSegmentTracing, blockSize1d,
+			computeStream, camFeatures, cam, remaining_paths, traceDepth);
+		checkCUDAError("regenerate paths");
+		NVTX_POP();
+		PROFILE_END(PROF_COMPACT, computeStream);
+#endif // PATH_REGEN_ENABLE
+
+#if FUSED_COMPACT_ENABLE
+		// the shade launch above already appended every survivor into
+		// dev_pathIndices[activePathBuf]; all that remains of the
+		// compaction stage is publishing the list and dripping the count
+		// back the way compactIndicesAsync used to
+		PROFILE_BEGIN(PROF_COMPACT, depth - 1, computeStream);
+		NVTX_PUSH("compact");
+		cudaMemcpyAsync(host_pathCount, dev_survivorCount, sizeof(int),
+			cudaMemcpyDeviceToHost, computeStream);
+		dev_activePaths = dev_pathIndices[activePathBuf];
+		activePathBuf ^= 1;
+		cudaEventRecord(pathCountEvent, computeStream);
+		countPending = true;
+		NVTX_POP();
+		PROFILE_END(PROF_COMPACT, computeStream);
+#elif STREAM_COMPACTION
+		// index-based compaction: 4 bytes move per path and the path /
+		// intersection streams stay put, so both always agree; the bounce
+		// kernels read through the compacted indirection instead. Nothing
+		// here syncs: the live count drips back into pinned memory a bounce
+		// or two behind and the loop-top query folds it in when it lands
+		PROFILE_BEGIN(PROF_COMPACT, depth - 1, computeStream);
+		NVTX_PUSH("compact");
+		StreamCompaction::compactIndicesAsync(dev_activePaths,
+			dev_pathIndices[activePathBuf], dev_paths, remaining_paths,
+			host_pathCount, computeStream);
+		dev_activePaths = dev_pathIndices[activePathBuf];
+		activePathBuf ^= 1;
+		cudaEventRecord(pathCountEvent, computeStream);
+		countPending = true;
+		NVTX_POP();
+		PROFILE_END(PROF_COMPACT, computeStream);
 #endif // STREAM_COMPACTION
+		NVTX_POP();
 	}
+#endif // BDPT_ENABLE
 
-#if PROFILE_ENABLE
-	cudaEventRecord(stop);
-	cudaEventSynchronize(stop);
-	float t;
-	cudaEventElapsedTime(&t, start, stop);
+#if CUDA_GRAPH_ENABLE && !STREAM_COMPACTION && !WAVEFRONT_ENABLE && !CACHE_ENABLE
+	cudaGraph_t iterationGraph;
+	cudaStreamEndCapture(computeStream, &iterationGraph);
+	if (iterationGraphExec == NULL) {
+		cudaGraphInstantiate(&iterationGraphExec, iterationGraph, NULL, NULL, 0);
+	}
+	else {
+		// cheap in-place parameter update; falls back to re-instantiating if
+		// the topology changed
+		cudaGraphNode_t errorNode;
+		cudaGraphExecUpdateResult updateResult;
+		if (cudaGraphExecUpdate(iterationGraphExec, iterationGraph, &errorNode, &updateResult) != cudaSuccess) {
+			cudaGetLastError();
+			cudaGraphExecDestroy(iterationGraphExec);
+			cudaGraphInstantiate(&iterationGraphExec, iterationGraph, NULL, NULL, 0);
+		}
+	}
+	cudaGraphDestroy(iterationGraph);
+	cudaGraphLaunch(iterationGraphExec, computeStream);
+	checkCUDAError("launch iteration graph");
+#endif // CUDA_GRAPH_ENABLE
 
-	totalTime += t;
-	if (countStart && iter > 20) {
-		std::cout << totalTime / iter << std::endl;
-		countStart = false;
+#if DEFERRED_SHADOW_ENABLE
+	{
+		// the whole iteration's NEE visibility tests, queued across every
+		// bounce above, traced as one coherence-sorted any-hit batch
+		NVTX_PUSH("shadow batch");
+		int numShadowJobs = 0;
+		cudaMemcpyAsync(&numShadowJobs, dev_shadowQueueCount, sizeof(int),
+			cudaMemcpyDeviceToHost, computeStream);
+		cudaStreamSynchronize(computeStream);
+		if (numShadowJobs > 0) {
+			dim3 numBlocksShadow = (numShadowJobs + blockSize1d - 1) / blockSize1d;
+			kernComputeShadowKeys << <numBlocksShadow, blockSize1d, 0, computeStream >> > (
+				numShadowJobs, dev_shadowQueue, sceneBoundsMin, sceneBoundsInvExtent,
+				dev_shadowSortKeys, dev_shadowSortIndices);
+			StreamCompaction::sortPairs(dev_shadowSortKeys, dev_shadowSortIndices,
+				numShadowJobs, 32, dev_shadowSortScratch, computeStream);
+			kernResolveShadowQueue << <numBlocksShadow, blockSize1d, 0, computeStream >> > (
+				numShadowJobs, dev_shadowQueue, dev_shadowSortIndices,
+				dev_image, dev_clampedEnergy, dev_geomsHot, numStaticGeoms, numMovingGeoms,
+				dev_triangles, dev_vertices, dev_bvhNodes,
+				dev_tlasNodes, tlasRoot, dev_movingTlasNodes, movingTlasRoot);
+			checkCUDAError("deferred shadow batch");
+		}
+		cudaMemsetAsync(dev_shadowQueueCount, 0, sizeof(int), computeStream);
+		NVTX_POP();
 	}
-#endif // PROFILE_ENABLE
+#endif // DEFERRED_SHADOW_ENABLE
 
 	// Assemble this iteration and apply it to the image
-	dim3 numBlocksPixels = (pixelcount + blockSize1d - 1) / blockSize1d;
-	finalGather << <numBlocksPixels, blockSize1d >> > (num_paths, dev_image, dev_paths);
+	dim3 numBlocksPixels = (pixelcount + blockSizeGather - 1) / blockSizeGather;
+	PROFILE_BEGIN(PROF_GATHER, 0, computeStream);
+	NVTX_PUSH("gather");
+#if HALF_RES_INDIRECT_ENABLE && !MEGAKERNEL_ENABLE && !COOP_LAUNCH_ENABLE && !BDPT_ENABLE
+	{
+		// fold the quarter-rate indirect back over the full frame before
+		// finalGather banks what is left on the path streams; the fused
+		// loops and BDPT never ran the select, so they skip the resolve too
+		const dim3 quadBlocks(
+			((cam.resolution.x + 1) / 2 + blockSize2d.x - 1) / blockSize2d.x,
+			((cam.resolution.y + 1) / 2 + blockSize2d.y - 1) / blockSize2d.y);
+		kernHalfResResolve << <quadBlocks, blockSize2d, 0, computeStream >> > (
+			cam.resolution, dev_paths, dev_quadRep, dev_indirectQuads);
+		kernHalfResUpsample << <blocksPerGrid2d, blockSize2d, 0, computeStream >> > (
+			cam.resolution, dev_image, dev_indirectQuads, dev_quadRep,
+			dev_denoiseNormals, dev_denoisePositions);
+		checkCUDAError("half-res indirect upsample");
+	}
+#endif // HALF_RES_INDIRECT_ENABLE && !MEGAKERNEL_ENABLE && !COOP_LAUNCH_ENABLE && !BDPT_ENABLE
+#if PATH_REGEN_ENABLE
+	// nothing to gather: kernRegeneratePaths already flushed every finished
+	// sample, and the still-alive paths carry straight over to the next call
+#elif TERMINATE_GATHER_ENABLE && !BDPT_ENABLE
+	// nothing to gather: every kill site banked its path the moment it died
+#else
+	dim3 numBlocksGather = (num_paths + blockSizeGather - 1) / blockSizeGather;
+	finalGather << <numBlocksGather, blockSizeGather, 0, computeStream >> > (num_paths, dev_image, dev_paths, dev_clampedEnergy);
+#endif // PATH_REGEN_ENABLE
+
+#if DENOISE_ENABLE
+	// filter the averaged image: normalize once, then DENOISE_LEVELS A-Trous
+	// passes with doubling step width, ping-ponging between the two buffers
+	kernScaleImage << <numBlocksPixels, blockSizeGather, 0, computeStream >> > (
+		pixelcount, dev_denoised[0], dev_image, 1.0f / iter);
+	int src = 0;
+	for (int level = 0; level < DENOISE_LEVELS; level++) {
+		kernATrousPass << <blocksPerGrid2d, blockSize2d, 0, computeStream >> > (
+			cam.resolution, 1 << level, DENOISE_C_PHI / (1 << level), DENOISE_N_PHI, DENOISE_P_PHI,
+			dev_denoised[src], dev_denoised[1 - src], dev_denoiseNormals, dev_denoisePositions);
+		src = 1 - src;
+	}
+	dev_denoisedResult = dev_denoised[src];
+	lastDenoisedIter = iter;
+	checkCUDAError("denoise");
+#endif // DENOISE_ENABLE
+	cudaEventRecord(gatherDone, computeStream);
+
+#if ADAPTIVE_SAMPLING
+	// statistics are not needed by the display, so this runs after the event
+	kernUpdatePixelStats << <numBlocksPixels, blockSizeGather, 0, computeStream >> > (
+		num_paths, frameResolution, dev_paths, dev_pixelMeans, dev_pixelM2s, dev_pixelSamples, dev_pixelConverged);
+#endif // ADAPTIVE_SAMPLING
+	NVTX_POP();
+	PROFILE_END(PROF_GATHER, computeStream);
 
 	///////////////////////////////////////////////////////////////////////////
 
-	// Send results to OpenGL buffer for rendering
-	sendImageToPBO << <blocksPerGrid2d, blockSize2d >> > (pbo, cam.resolution, iter, dev_image);
+	// Send results to OpenGL buffer for rendering once the gather has landed;
+	// computeStream is free to start the next iteration in the meantime.
+	// Headless runs pass no PBO and skip the display copy altogether.
+	if (pbo != NULL) {
+		cudaStreamWaitEvent(displayStream, gatherDone, 0);
+		PROFILE_BEGIN(PROF_PBO, 0, displayStream);
+		NVTX_PUSH("pbo upload");
+#if HEATMAP_ENABLE
+		if (heatmapView) {
+			sendHeatmapToPBO << <blocksPerGrid2d, blockSize2d, 0, displayStream >> > (
+				pbo, cam.resolution, iter, traceDepth, dev_pixelBounceDepth);
+		}
+		else
+#endif // HEATMAP_ENABLE
+#if ROI_ENABLE
+		if (roiActive) {
+			// full-frame grid: the frozen remainder still needs encoding
+			const dim3 blocksPerGridFull(
+				(displayResolution.x + blockSize2d.x - 1) / blockSize2d.x,
+				(displayResolution.y + blockSize2d.y - 1) / blockSize2d.y);
+			sendRoiImageToPBO << <blocksPerGridFull, blockSize2d, 0, displayStream >> > (
+				pbo, displayResolution, iter, roiBaseIter, roiOffset, roiSize, dev_image);
+		}
+		else
+#endif // ROI_ENABLE
+		if (scale > 1) {
+			// transient movement frame: nearest-neighbor upscale of the raw
+			// accumulation, skipping the denoised / per-pixel-sample paths
+			const dim3 blocksPerGridFull(
+				(displayResolution.x + blockSize2d.x - 1) / blockSize2d.x,
+				(displayResolution.y + blockSize2d.y - 1) / blockSize2d.y);
+			sendScaledImageToPBO << <blocksPerGridFull, blockSize2d, 0, displayStream >> > (
+				pbo, displayResolution, cam.resolution, scale, iter, dev_image);
+		}
+		else {
+#if DENOISE_ENABLE
+		sendDenoisedImageToPBO << <blocksPerGrid2d, blockSize2d, 0, displayStream >> > (pbo, cam.resolution, dev_denoisedResult);
+#else
+#if PATH_REGEN_ENABLE
+		sendImageToPBO << <blocksPerGrid2d, blockSize2d, 0, displayStream >> > (pbo, cam.resolution, dev_pixelDoneSamples, dev_image);
+#else
+#if TEMPORAL_REPROJECTION_ENABLE
+		// early iterations of a fresh view lean on the reprojected prior,
+		// fading it out as real samples arrive
+		if (reprojBlendValid && iter < TEMPORAL_BLEND_ITERS) {
+			sendReprojectedImageToPBO << <blocksPerGrid2d, blockSize2d, 0, displayStream >> > (
+				pbo, cam.resolution, iter, dev_image, dev_reprojImage);
+		}
+		else {
+			sendImageToPBO << <blocksPerGrid2d, blockSize2d, 0, displayStream >> > (pbo, cam.resolution, iter, dev_image);
+		}
+#else
+		sendImageToPBO << <blocksPerGrid2d, blockSize2d, 0, displayStream >> > (pbo, cam.resolution, iter, dev_image);
+#endif // TEMPORAL_REPROJECTION_ENABLE
+#endif // PATH_REGEN_ENABLE
+#endif // DENOISE_ENABLE
+		}
+		NVTX_POP();
+		PROFILE_END(PROF_PBO, displayStream);
+	}
+	NVTX_POP();
+}
+
+#if MULTI_GPU_ENABLE
+// out += in * scale, for blending the worker accumulations into the merged
+// image on device 0
+__global__ void kernAccumulateScaledImage(int n, glm::vec3* out, const glm::vec3* in, float scale)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < n) {
+		out[i] += in[i] * scale;
+	}
+}
+
+// Average the per-device accumulations into dev_mergedImage on device 0.
+// The 1/N scaled sum divided by `iter` at display time is the mean over
+// the N * iter samples the devices collectively hold; only that total
+// matters, so the arithmetic stays exact whether the per-call hand-out was
+// one sample per device or stolen unevenly (MULTI_GPU_STEAL_ENABLE).
+static void mergeDeviceImages(uchar4* pbo, int iter)
+{
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+	const int numBlocks = (pixelcount + 127) / 128;
+	const float weight = 1.0f / (float)numDevices;
+
+	kernScaleImage << <numBlocks, 128, 0, computeStream >> > (
+		pixelcount, dev_mergedImage, dev_image, weight);
+	for (int d = 1; d < numDevices; d++) {
+		// one staging buffer is enough: each worker's copy and blend are
+		// stream-ordered on computeStream
+		cudaMemcpyPeerAsync(dev_peerStage, 0, deviceStates[d].image, d,
+			pixelcount * sizeof(glm::vec3), computeStream);
+		kernAccumulateScaledImage << <numBlocks, 128, 0, computeStream >> > (
+			pixelcount, dev_mergedImage, dev_peerStage, weight);
+	}
+
+	if (pbo != NULL) {
+		const dim3 blockSize2d(8, 8);
+		const dim3 blocksPerGrid2d(
+			(cam.resolution.x + blockSize2d.x - 1) / blockSize2d.x,
+			(cam.resolution.y + blockSize2d.y - 1) / blockSize2d.y);
+		sendImageToPBO << <blocksPerGrid2d, blockSize2d, 0, computeStream >> > (
+			pbo, cam.resolution, iter, dev_mergedImage);
+	}
+}
+#endif // MULTI_GPU_ENABLE
+
+#if PIXEL_PROBE_ENABLE
+// Read back and print the probed pixel's bounce records, then disarm.
+// Runs right after the iteration's sync check, so they are complete.
+static void probeResolve(int iter) {
+	int depthCap = hst_scene->state.traceDepth;
+	std::vector<ProbeRecord> recs(depthCap);
+	cudaMemcpy(recs.data(), dev_probeRecords, depthCap * sizeof(ProbeRecord),
+		cudaMemcpyDeviceToHost);
+	printf("probe pixel (%d, %d), iteration %d:\n", probeX, probeY, iter);
+	bool any = false;
+	for (int d = 0; d < depthCap; d++) {
+		const ProbeRecord& r = recs[d];
+		if (r.event == PROBE_NONE) {
+			break;
+		}
+		any = true;
+		switch (r.event) {
+		case PROBE_SCATTERED:
+			printf("  bounce %d: hit mat %d at t=%.4f, scattered pdf=%.4f dir=(%.3f, %.3f, %.3f) throughput=(%.4g, %.4g, %.4g)\n",
+				d + 1, r.materialId, r.t, r.pdf, r.direction.x, r.direction.y, r.direction.z,
+				r.throughput.x, r.throughput.y, r.throughput.z);
+			break;
+		case PROBE_EMISSIVE_HIT:
+			printf("  bounce %d: hit emissive mat %d at t=%.4f, banked radiance=(%.4g, %.4g, %.4g)\n",
+				d + 1, r.materialId, r.t, r.throughput.x, r.throughput.y, r.throughput.z);
+			break;
+		case PROBE_ENV_MISS:
+			printf("  bounce %d: escaped to the environment, banked radiance=(%.4g, %.4g, %.4g)\n",
+				d + 1, r.throughput.x, r.throughput.y, r.throughput.z);
+			break;
+		case PROBE_TERMINATED:
+			printf("  bounce %d: hit mat %d at t=%.4f, pdf=%.4f, terminated (roulette or depth budget)\n",
+				d + 1, r.materialId, r.t, r.pdf);
+			break;
+		}
+	}
+	if (!any) {
+		// nothing shaded this pixel's path: frozen by adaptive sampling,
+		// outside the region of interest, or replaying its mean
+		printf("  no bounces recorded for this pixel this iteration\n");
+	}
+	int disarmed = -1;
+	cudaMemcpyToSymbol(c_probePixel, &disarmed, sizeof(int));
+	probePixel = -1;
+	checkCUDAError("probeResolve");
+}
+#endif // PIXEL_PROBE_ENABLE
+
+void pathtrace(uchar4* pbo, int frame, int iter) {
+	if (traceActive) {
+		if (!traceEpochRecorded) {
+			traceRecordEpoch();
+		}
+		pathtraceTraceHostBegin("pathtrace");
+	}
+#if PIXEL_PROBE_ENABLE
+	// an armed probe captures on full-resolution frames only; a preview
+	// drag keeps it armed until the next full-size iteration
+	bool probeCapturing = probePixel >= 0 && previewScale == 1;
+	if (probeCapturing) {
+		cudaMemset(dev_probeRecords, 0, hst_scene->state.traceDepth * sizeof(ProbeRecord));
+		cudaMemcpyToSymbol(c_probePixel, &probePixel, sizeof(int));
+	}
+#endif // PIXEL_PROBE_ENABLE
+#if MULTI_GPU_ENABLE
+#if MULTI_GPU_STEAL_ENABLE
+	// greedy hand-out of the call's N sample indices: each goes to the
+	// first device whose previous enqueue has drained, so a faster card
+	// takes more of the batch. The poll is a cheap driver query, and at
+	// most one in-flight sample's tail is ever waited out here.
+	for (int s = 0; s < numDevices; s++) {
+		int target = -1;
+		while (target < 0) {
+			for (int d = 0; d < numDevices; d++) {
+				if (cudaEventQuery(stealDone[d]) == cudaSuccess) {
+					target = d;
+					break;
+				}
+			}
+		}
+		// clear the sticky not-ready results the polling left behind
+		cudaGetLastError();
+		cudaSetDevice(target);
+		loadDeviceState(deviceStates[target]);
+		// interleaved global sample index: decorrelates every seed keyed
+		// on the iteration without touching the seeding itself
+		pathtraceIteration(NULL, frame, (iter - 1) * numDevices + s + 1);
+		cudaEventRecord(stealDone[target], computeStream);
+		saveDeviceState(deviceStates[target]);
+	}
+#else
+	for (int d = 0; d < numDevices; d++) {
+		cudaSetDevice(d);
+		loadDeviceState(deviceStates[d]);
+		// interleaved global sample index: decorrelates every seed keyed
+		// on the iteration without touching the seeding itself
+		pathtraceIteration(NULL, frame, (iter - 1) * numDevices + d + 1);
+		saveDeviceState(deviceStates[d]);
+	}
+#endif // MULTI_GPU_STEAL_ENABLE
+	// the loop above only enqueued work, so the devices run concurrently
+	// until this drain, which the peer copies in the merge need
+	for (int d = numDevices - 1; d >= 0; d--) {
+		cudaSetDevice(d);
+		cudaDeviceSynchronize();
+	}
+	loadDeviceState(deviceStates[0]);
+	mergeDeviceImages(pbo, iter);
+#else
+	pathtraceIteration(pbo, frame, iter);
+#endif // MULTI_GPU_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+	// what dev_image and the positions buffer now hold, for the next
+	// camera reset's reprojection (per-device accumulations all carry
+	// `iter` samples, so one host-side record covers every device)
+	reprojPrevIter = iter;
+	reprojPrevScale = previewScale;
+#endif // TEMPORAL_REPROJECTION_ENABLE
+	checkCUDAErrorSync("pathtrace");
+	// the sync check passed, so iteration `iter` is fully gathered; a live
+	// salvage in emergencySave divides by this
+	lastCompletedIter = iter;
+#if PIXEL_PROBE_ENABLE
+	if (probeCapturing) {
+		probeResolve(iter);
+	}
+#endif // PIXEL_PROBE_ENABLE
+	profileCollect();
+	pathtraceTraceHostEnd();
+}
+
+/**
+ * Flip the display between the image and the bounce-cost heatmap. No-op
+ * unless built with HEATMAP_ENABLE.
+ */
+void pathtraceToggleHeatmap() {
+#if HEATMAP_ENABLE
+	heatmapView = !heatmapView;
+#endif // HEATMAP_ENABLE
+}
+
+/**
+ * Flip the layout-preview integrator: one bounce plus the NEE direct
+ * sample, with a flat ambient in place of the skipped indirect - a
+ * handful of samples reads as converged, so blocking out placement and
+ * framing gets near-instant feedback. The caller restarts accumulation
+ * (the two integrators' images must not mix).
+ */
+void pathtraceToggleLayoutPreview() {
+	layoutPreview = !layoutPreview;
+	int flag = layoutPreview ? 1 : 0;
+	cudaMemcpyToSymbol(c_layoutPreview, &flag, sizeof(int));
+	printf("Layout preview %s\n", layoutPreview ? "on" : "off");
+}
+
+/**
+ * Download the per-pixel mean bounces per sample. Returns false (leaving
+ * out untouched) unless built with HEATMAP_ENABLE; benchmark mode uses
+ * this to dump the heatmap alongside its timing record.
+ */
+bool pathtraceDownloadHeatmap(std::vector<float>& out, int iter) {
+#if HEATMAP_ENABLE
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+	std::vector<int> counts(pixelcount);
+	cudaMemcpy(counts.data(), dev_pixelBounceDepth, pixelcount * sizeof(int),
+		cudaMemcpyDeviceToHost);
+	out.resize(pixelcount);
+	for (int i = 0; i < pixelcount; i++) {
+		out[i] = (float)counts[i] / (float)(iter > 0 ? iter : 1);
+	}
+	return true;
+#else
+	return false;
+#endif // HEATMAP_ENABLE
+}
+
+/**
+ * Fraction of pixels frozen by adaptive sampling, for the main loop's
+ * early-exit check. One device reduction; call sparingly.
+ */
+float pathtraceConvergedFraction() {
+#if ADAPTIVE_SAMPLING
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+	int converged = thrust::reduce(
+		thrust::device_pointer_cast(dev_pixelConverged),
+		thrust::device_pointer_cast(dev_pixelConverged) + pixelcount, 0);
+	return (float)converged / (float)pixelcount;
+#else
+	return 0.0f;
+#endif // ADAPTIVE_SAMPLING
+}
+
+/**
+ * Copy the accumulated image back to the host. Only needed when saving; the
+ * per-iteration display path reads dev_image directly through the PBO.
+ */
+void downloadImageAsync() {
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+
+	// whatever this call stages carries today's completed sample count
+	imageStageIter = lastCompletedIter;
+
+#if MULTI_GPU_ENABLE
+	// pathtrace() just refreshed dev_mergedImage with the mean of the
+	// per-device accumulations, so the uniform divide-by-iteration in
+	// saveImage stays exact
+	cudaMemcpyAsync(host_imageStage, dev_mergedImage,
+		pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost, computeStream);
+	cudaEventRecord(imageStageDone, computeStream);
+	checkCUDAError("downloadImageAsync");
+	return;
+#endif // MULTI_GPU_ENABLE
+#if DENOISE_ENABLE
+	if (dev_denoisedResult != NULL) {
+		// saveImage divides by the iteration count, so scale the filtered
+		// per-pixel mean back up into the free ping-pong buffer first
+		glm::vec3* scratch = dev_denoisedResult == dev_denoised[0] ? dev_denoised[1] : dev_denoised[0];
+		kernScaleImage << <(pixelcount + 127) / 128, 128, 0, computeStream >> > (
+			pixelcount, scratch, dev_denoisedResult, (float)lastDenoisedIter);
+		cudaMemcpyAsync(host_imageStage, scratch,
+			pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost, computeStream);
+		cudaEventRecord(imageStageDone, computeStream);
+		checkCUDAError("downloadImageAsync");
+		return;
+	}
+#endif // DENOISE_ENABLE
+	cudaMemcpyAsync(host_imageStage, dev_image,
+		pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost, computeStream);
+	cudaEventRecord(imageStageDone, computeStream);
+
+	checkCUDAError("downloadImageAsync");
+}
+
+void downloadImageWait() {
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+
+	cudaEventSynchronize(imageStageDone);
+	memcpy(hst_scene->state.image.data(), host_imageStage,
+		pixelcount * sizeof(glm::vec3));
+	hostSnapshotIter = imageStageIter;
+}
+
+void downloadImage() {
+	downloadImageAsync();
+	downloadImageWait();
+}
+
+bool pathtraceGetAOVs(std::vector<glm::vec3>& normal, std::vector<float>& depth,
+	std::vector<glm::vec3>& albedo, std::vector<glm::vec3>& direct)
+{
+#if AOV_ENABLE
+	if (hst_scene == NULL) {
+		return false;
+	}
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+	normal.resize(pixelcount);
+	depth.resize(pixelcount);
+	albedo.resize(pixelcount);
+	direct.resize(pixelcount);
+	cudaMemcpy(normal.data(), dev_aovNormal, pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost);
+	cudaMemcpy(depth.data(), dev_aovDepth, pixelcount * sizeof(float), cudaMemcpyDeviceToHost);
+	cudaMemcpy(albedo.data(), dev_aovAlbedo, pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost);
+	cudaMemcpy(direct.data(), dev_aovDirect, pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost);
+	checkCUDAError("download aovs");
+	return true;
+#else
+	return false;
+#endif // AOV_ENABLE
+}
+
+// On-disk layout of a checkpoint: this header followed by the raw arena
+// bytes. The arena holds every per-pixel buffer (accumulation, RNG lanes,
+// adaptive-sampling statistics, ...), so together with the iteration
+// counter it is the complete resumable state; mid-bounce path state is in
+// there too but meaningless, since resume restarts at an iteration
+// boundary. arenaBytes doubles as a compile-flag fingerprint: a binary
+// built with different feature toggles carves a different total and
+// refuses the file instead of misinterpreting it.
+struct CheckpointHeader {
+	char magic[4];
+	int version;
+	int width;
+	int height;
+	int iteration;
+	unsigned long long arenaBytes;
+};
+static const char checkpointMagic[4] = { 'P', 'T', 'C', 'K' };
+static const int checkpointVersion = 1;
+
+bool pathtraceSaveCheckpoint(const std::string& path, int iteration) {
+	const Camera& cam = hst_scene->state.camera;
+
+	std::vector<char> staging(arenaOffset);
+	// synchronous on purpose: a checkpoint must be a consistent cut, so it
+	// waits for the queued iteration before copying
+	cudaMemcpy(staging.data(), dev_arena, arenaOffset, cudaMemcpyDeviceToHost);
+	checkCUDAError("pathtraceSaveCheckpoint");
+
+	CheckpointHeader header;
+	memcpy(header.magic, checkpointMagic, 4);
+	header.version = checkpointVersion;
+	header.width = cam.resolution.x;
+	header.height = cam.resolution.y;
+	header.iteration = iteration;
+	header.arenaBytes = arenaOffset;
+
+	// write to a temp name and rename, so a crash mid-write never leaves a
+	// truncated checkpoint behind
+	std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (f == NULL) {
+		fprintf(stderr, "checkpoint: cannot open %s\n", tmp.c_str());
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(staging.data(), 1, staging.size(), f) == staging.size();
+	ok = (fclose(f) == 0) && ok;
+	if (!ok) {
+		fprintf(stderr, "checkpoint: short write to %s\n", tmp.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+	remove(path.c_str());
+	if (rename(tmp.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "checkpoint: cannot rename %s\n", tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+int pathtraceLoadCheckpoint(const std::string& path) {
+	const Camera& cam = hst_scene->state.camera;
+
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == NULL) {
+		fprintf(stderr, "checkpoint: cannot open %s\n", path.c_str());
+		return -1;
+	}
+	CheckpointHeader header;
+	if (fread(&header, sizeof(header), 1, f) != 1
+		|| memcmp(header.magic, checkpointMagic, 4) != 0
+		|| header.version != checkpointVersion) {
+		fprintf(stderr, "checkpoint: %s is not a checkpoint\n", path.c_str());
+		fclose(f);
+		return -1;
+	}
+	if (header.width != cam.resolution.x || header.height != cam.resolution.y
+		|| header.arenaBytes != (unsigned long long)arenaOffset) {
+		fprintf(stderr, "checkpoint: %s does not match this scene/build\n", path.c_str());
+		fclose(f);
+		return -1;
+	}
+	std::vector<char> staging(arenaOffset);
+	if (fread(staging.data(), 1, staging.size(), f) != staging.size()) {
+		fprintf(stderr, "checkpoint: short read from %s\n", path.c_str());
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	cudaMemcpy(dev_arena, staging.data(), arenaOffset, cudaMemcpyHostToDevice);
+	checkCUDAError("pathtraceLoadCheckpoint");
+	printf("Resumed %s at iteration %d\n", path.c_str(), header.iteration);
+	lastCompletedIter = header.iteration;
+	return header.iteration;
+}
+
+// Best-effort salvage on a fatal CUDA error, called by reportCUDAError on
+// its way to exit: a three-hour render should not lose its accumulation
+// to an OOM in hour three. A device-to-host copy of the live
+// accumulation is tried first - many errors poison one launch but leave
+// the context and its memory readable - with the host-side snapshot
+// staged by the periodic download as the fallback once the context is
+// really gone. Whatever survives is written as <imageName>.crash.png,
+// plus a full resume checkpoint (<imageName>.crash.ckpt) when the arena
+// still answers. Paired with the periodic checkpoint schedule in the
+// main loop, a crash costs at most one snapshot interval of GPU time.
+// Multi-GPU builds salvage the device the error surfaced on; every
+// replica carries the same per-device sample count.
+static void emergencySave() {
+	// a salvage that itself trips the error path must not recurse
+	static bool salvaging = false;
+	if (salvaging || hst_scene == NULL || dev_image == NULL || lastCompletedIter <= 0) {
+		return;
+	}
+	salvaging = true;
+
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+	std::vector<glm::vec3> pixels(pixelcount);
+	int samples = 0;
+
+	// the error is sticky in cudaGetLastError but does not necessarily
+	// kill the context; clear it and let the copy speak for itself
+	cudaGetLastError();
+	if (cudaMemcpy(pixels.data(), dev_image, pixelcount * sizeof(glm::vec3),
+		cudaMemcpyDeviceToHost) == cudaSuccess) {
+		samples = lastCompletedIter;
+	}
+	else if (hostSnapshotIter > 0) {
+		memcpy(pixels.data(), hst_scene->state.image.data(),
+			pixelcount * sizeof(glm::vec3));
+		samples = hostSnapshotIter;
+	}
+	if (samples <= 0) {
+		fprintf(stderr, "emergency save: no readable accumulation to salvage\n");
+		return;
+	}
 
-	// Retrieve image from GPU
-	cudaMemcpy(hst_scene->state.image.data(), dev_image,
-		pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost);
+	// same orientation convention as the snapshot writer in main.cpp
+	image img(cam.resolution.x, cam.resolution.y);
+	for (int y = 0; y < cam.resolution.y; y++) {
+		for (int x = 0; x < cam.resolution.x; x++) {
+			img.setPixel(cam.resolution.x - 1 - x, y,
+				pixels[x + y * cam.resolution.x] / (float)samples);
+		}
+	}
+	std::string base = hst_scene->state.imageName + ".crash";
+	img.savePNG(base);
+	fprintf(stderr, "emergency save: wrote %s.png (%d samples)\n", base.c_str(), samples);
 
-	checkCUDAError("pathtrace");
+	if (samples == lastCompletedIter) {
+		// the context answered the image copy, so try the full resumable
+		// cut too; its own error checks exit directly if the arena is in
+		// worse shape than dev_image was
+		cudaGetLastError();
+		if (pathtraceSaveCheckpoint(base + ".ckpt", samples)) {
+			fprintf(stderr, "emergency save: wrote %s.ckpt\n", base.c_str());
+		}
+	}
 }
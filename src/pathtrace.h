@@ -3,6 +3,235 @@
 #include <vector>
 #include "scene.h"
 
+// checking convergence costs a small reduction, so the main loop only polls
+// it every this many iterations
+#define CONVERGENCE_CHECK_INTERVAL 100
+// stop once this fraction of pixels has been frozen by adaptive sampling
+#define CONVERGENCE_PIXEL_FRACTION 0.99f
+
 void pathtraceInit(Scene *scene);
 void pathtraceFree();
+
+/**
+ * Split each geom into the hot (traversal) and cold (post-hit) halves the
+ * intersection routines consume, including the sphere center/radius fast
+ * path detection. Host-only code; exposed so the CPU backend builds the
+ * same arrays pathtraceInit uploads.
+ */
+void buildGeomSplit(Scene* scene, std::vector<GeomHot>& geomsHot,
+    std::vector<GeomCold>& geomsCold);
+
+/**
+ * Restart the accumulation for a new camera without releasing anything:
+ * per-pixel state is cleared with a few async memsets while geometry, BVHs
+ * and materials stay resident. Call instead of pathtraceFree +
+ * pathtraceInit when only the viewpoint changed.
+ */
+void pathtraceCameraReset();
 void pathtrace(uchar4 *pbo, int frame, int iteration);
+
+/**
+ * Trace interactive frames at 1/scale the display resolution in each
+ * dimension, upscaled nearest-neighbor into the PBO (1 restores full
+ * size). Meant for camera drags, where latency beats pixel count; the
+ * caller must restart accumulation whenever the scale changes, since the
+ * image buffer's layout follows the traced size.
+ */
+void pathtraceSetPreviewScale(int scale);
+
+/**
+ * Set the look-dev region of interest: following iterations trace only the
+ * (x, y, w, h) pixel rectangle, and the display freezes the rest of the
+ * frame at the baseIter-sample accumulation it holds now (pass the current
+ * iteration). w or h <= 0 clears the region, as does any camera reset.
+ * No-op unless built with ROI_ENABLE.
+ */
+void pathtraceSetROI(int x, int y, int w, int h, int baseIter);
+
+/**
+ * Debug probe (Shift+click in the viewer): the next full-resolution
+ * iteration records image pixel (x, y)'s path bounce by bounce - hit
+ * material, throughput, scatter pdf, termination reason - and prints it
+ * to stdout, then disarms. No-op unless built with PIXEL_PROBE_ENABLE.
+ */
+void pathtraceProbePixel(int x, int y);
+
+/**
+ * Push transforms rewritten on the host (Scene::setAnimationFrame) back to
+ * the device: re-uploads the per-geom tables and the light transforms and
+ * rebuilds the moving-partition TLAS, leaving triangles, BLASes and the
+ * static TLAS untouched. Follow with pathtraceCameraReset to restart the
+ * accumulation for the new pose.
+ */
+void pathtraceUpdateGeoms();
+
+/**
+ * Incremental look-dev edits: after mutating hst_scene's material id (or a
+ * geom's translation/rotation/scale), patch the corresponding device
+ * entries in place, refresh whatever derives from them (light list and
+ * alias table, the edited geom's TLAS partition) and restart the
+ * accumulation. Milliseconds of upload instead of a scene reload;
+ * triangle data and BLASes are never touched.
+ */
+void pathtraceUpdateMaterial(int id);
+void pathtraceUpdateTransform(int geomId);
+
+/**
+ * Request the OptiX hardware intersection backend (--hwtrace) before
+ * pathtraceInit; a build without OPTIX_BACKEND_ENABLE, or any backend init
+ * failure, silently keeps the software traversal.
+ */
+void pathtraceSetHardwareTrace(bool enable);
+
+/**
+ * Print the rolling per-stage GPU timing table (mean/p95/last ms over the
+ * most recent iterations, broken down by bounce where that applies).
+ * Empty until profiling has been active for at least one iteration.
+ */
+void pathtraceProfileReport();
+
+/**
+ * Switch the per-stage timing layer on or off at runtime. The default is
+ * the PROFILE_ENABLE build flag; --benchmark enables it unconditionally.
+ */
+void pathtraceProfileSetActive(bool active);
+
+// one populated (stage, bounce) timing slot, as returned by
+// pathtraceProfileSnapshot
+struct ProfileStageStats {
+    const char* stage;
+    int bounce;
+    int samples;
+    float meanMs;
+    float p95Ms;
+};
+
+/**
+ * Copy the populated per-stage timing slots into out (at most maxEntries)
+ * and return how many were written. Machine-readable counterpart of
+ * pathtraceProfileReport, for the benchmark emitters.
+ */
+int pathtraceProfileSnapshot(ProfileStageStats* out, int maxEntries);
+
+/**
+ * Start recording a chrome://tracing timeline (--trace in main.cpp):
+ * per-stage GPU spans from the timing layer's event pairs plus host
+ * brackets, kept in memory until pathtraceTraceEnd writes them to path
+ * as Trace Event Format JSON. Forces the timing layer on while active.
+ */
+void pathtraceTraceBegin(const char* path);
+
+/**
+ * Stop recording and write the timeline JSON. No-op when no trace is
+ * being recorded, so shutdown paths can call it unconditionally.
+ */
+void pathtraceTraceEnd();
+
+/**
+ * Bracket a host-side span on the trace's host track (runCuda wraps
+ * itself with these). Begin/end pairs nest; no-ops while not tracing.
+ */
+void pathtraceTraceHostBegin(const char* name);
+void pathtraceTraceHostEnd();
+
+// one labeled in-kernel region of the clock64 sampling profiler, as
+// returned by pathtraceKernelProfileSnapshot
+struct KernelRegionStats {
+    const char* region;
+    double visits;  // sampled entries (one per warp leader per visit)
+    double cycles;  // leader-lane clock64 cycles summed over those visits
+    double share;   // this region's fraction of all sampled cycles
+};
+
+/**
+ * Copy the in-kernel profiler's per-region totals into out (at most
+ * maxEntries, empty regions skipped) and return how many were written.
+ * The counters accumulate from pathtraceInit on; cycle shares attribute
+ * time inside the hot kernels (box vs sphere vs mesh tests, shade fetch
+ * vs scatter) where the per-stage event timing cannot see. Returns 0
+ * when the build lacks KERNEL_PROFILE_ENABLE.
+ */
+int pathtraceKernelProfileSnapshot(KernelRegionStats* out, int maxEntries);
+
+/**
+ * Mean number of paths the launch grid saw at the given bounce, averaged
+ * over the iterations profiling was active. 0 for untracked bounces.
+ */
+double pathtracePathsAlivePerBounce(int bounce);
+
+/**
+ * Override / read back the tuned 1D block sizes for the intersect, shade
+ * and gather kernel classes. pathtraceInit seeds them from the occupancy
+ * calculator plus launchconfig.txt; the --tune sweep uses the setter to
+ * try candidates and records the winners.
+ */
+void pathtraceSetLaunchSizes(int intersect, int shade, int gather);
+void pathtraceGetLaunchSizes(int* intersect, int* shade, int* gather);
+
+/**
+ * Flip the display between the rendered image and the false-color
+ * bounce-cost heatmap (H key). No-op unless built with HEATMAP_ENABLE.
+ */
+void pathtraceToggleHeatmap();
+
+/**
+ * Flip the layout-preview integrator (L key): primary hit plus the NEE
+ * direct sample only, with a flat ambient in place of indirect transport,
+ * so placement and framing read as converged within a handful of samples.
+ * The caller must restart accumulation on every flip.
+ */
+void pathtraceToggleLayoutPreview();
+
+/**
+ * Download per-pixel mean bounces per sample into out. Returns false when
+ * the build lacks HEATMAP_ENABLE; --benchmark dumps this as a PNG.
+ */
+bool pathtraceDownloadHeatmap(std::vector<float>& out, int iter);
+
+/** One line of feature-toggle values identifying this build's pipeline. */
+const char* pathtraceBuildConfig();
+
+/**
+ * GPU model name plus current/total device memory in bytes. Usage is
+ * effectively the peak: the arena is carved once at pathtraceInit.
+ */
+void pathtraceDeviceInfo(char* name, int nameLen, size_t* memUsed,
+    size_t* memTotal);
+void downloadImage();
+
+/**
+ * Split form of downloadImage for callers that can overlap the readback
+ * with more kernel work: Async enqueues the device-to-pinned copy on the
+ * compute stream and returns immediately; Wait blocks until the staged
+ * pixels are valid and publishes them to hst_scene->state.image.
+ */
+void downloadImageAsync();
+void downloadImageWait();
+
+/**
+ * Download the AOV accumulations (AOV_ENABLE in pathtraceConfig.h):
+ * first-hit normal, depth and albedo plus the direct-only radiance
+ * split, each resolution-sized and normalized by the caller against the
+ * same iteration count as the beauty accumulation. Returns false when
+ * AOVs are compiled out.
+ */
+bool pathtraceGetAOVs(std::vector<glm::vec3>& normal, std::vector<float>& depth,
+    std::vector<glm::vec3>& albedo, std::vector<glm::vec3>& direct);
+
+/**
+ * Checkpointing: save writes the full per-pixel device state (the arena)
+ * plus the iteration counter atomically (temp file + rename); load
+ * restores it into an already-initialized tracer and returns the
+ * iteration to resume from, or -1 if the file does not match this
+ * scene and build. RNG lanes live in the arena, so sampling sequences
+ * continue exactly where they left off.
+ */
+bool pathtraceSaveCheckpoint(const std::string& path, int iteration);
+int pathtraceLoadCheckpoint(const std::string& path);
+
+/**
+ * Fraction of pixels the adaptive sampler has frozen so far; 0 when
+ * adaptive sampling is disabled. The main loop uses it to stop a render
+ * early instead of always running the scene file's iteration count.
+ */
+float pathtraceConvergedFraction();
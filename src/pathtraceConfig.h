@@ -0,0 +1,644 @@
+#pragma once
+
+// Build-time configuration shared by the pathtrace translation units. Every
+// feature toggle below changes which kernels compile and which paths the
+// host pipeline takes, so each stage .cu must see the same values; each
+// toggle's comment documents what it buys and what it is incompatible with.
+// The pipeline that consumes them lives in pathtrace.cu.
+
+// 0: off; 1: deferred - peek cudaGetLastError at launch sites without
+// synchronizing, plus one synchronizing check per iteration; 2: synchronize
+// after every launch (debug; serializes the whole pipeline)
+#define ERRORCHECK 1
+#define TLAS_ENABLE 1
+// uniform-grid alternative to the TLAS for the static partition: when the
+// scene looks like a particle field - enough static geoms whose world
+// AABB diagonals cluster around one size (relative spread under
+// GEOM_GRID_MAX_SPREAD) - init builds a CSR cell grid over them instead
+// and closest-hit traversal runs a 3-axis DDA walk: O(1) build,
+// per-step exits instead of hierarchy divergence, and the step order
+// visits cells front to back so the walk stops at the first cell past
+// the best hit. Scenes that fail the heuristic (few geoms, mixed sizes,
+// meshes dwarfing spheres) keep the TLAS untouched; the moving partition
+// and shadow-ray occlusion always do. Chains below the TLAS still apply:
+// each cell entry is a whole geom, so meshes found in a cell traverse
+// their BLAS as usual.
+#define GEOM_GRID_ENABLE 0
+// geoms needed before a grid can beat the (already cheap) small TLAS
+#define GEOM_GRID_MIN_GEOMS 64
+// max stddev/mean of the static geoms' AABB diagonals
+#define GEOM_GRID_MAX_SPREAD 0.5f
+// with the TLAS off, stage the geom list in shared memory so the linear
+// loop in computeIntersections reads it once per block instead of once per
+// thread; only pays off for small lists, hence the cap, and the TLAS build
+// skips it entirely (the traversal touches few geoms per ray anyway)
+#define SHARED_GEOMS_ENABLE 1
+#define SHARED_GEOMS_MAX 64
+#define STREAM_COMPACTION 0
+// bins paths into per-material-class queues after intersection and launches one
+// specialized shading kernel per non-empty queue (replaces the old full-struct
+// material sort, which cost more than the divergence it removed)
+#define WAVEFRONT_ENABLE 0
+// fuse intersection and shading into one kernel per bounce, keeping the hit
+// record in registers instead of round-tripping a ShadeableIntersection per
+// path through global memory between the two stages. Wins on simple material
+// sets (cornell); the split pipeline wins once divergent materials dominate,
+// so this is a per-scene choice. Incompatible with the first-bounce cache,
+// wavefront queues, the G-buffer primary hit and the denoiser guide save,
+// which all consume the intersection stream from memory.
+#define MEGAKERNEL_ENABLE 0
+// cooperative single-launch bounce loop: one grid runs every bounce of an
+// iteration with grid.sync() between them and a device-side live count for
+// early exit, so an iteration costs one kernel launch instead of one per
+// stage per bounce. Wins at preview resolutions where each stage lasts
+// tens of microseconds and launch latency dominates; the whole grid must
+// be co-resident, so the launch is occupancy-sized and big frames iterate
+// more per thread. Shares the fused per-path bounce with
+// MEGAKERNEL_ENABLE and inherits its incompatibilities (first-bounce
+// cache, wavefront queues, G-buffer primaries, denoiser guide save), plus
+// stream compaction, path regeneration and ray sorting - those reorder
+// work between launches, and there are no launches left to reorder
+// between.
+#define COOP_LAUNCH_ENABLE 0
+// samples per pixel per iteration: above 1, raygen emits SPP_BATCH
+// samples per pixel into an SPP_BATCH*pixelcount path pool (sample-major:
+// sample s of pixel p lands in slot s*pixelcount + p), every slot gets
+// its own persistent RNG lane while the Sobol dimensions walk one shared
+// per-pixel sequence at consecutive virtual iteration numbers - so the
+// batch's samples stay jointly stratified with every earlier one - and
+// finalGather averages the batch so one iteration still deposits one
+// sample's worth into the accumulation.
+// Fills the machine when pixelcount alone cannot (small frames, late
+// bounces) and amortizes per-launch overhead, at SPP_BATCH times the
+// path-pool memory. Incompatible with the features that assume one slot
+// per pixel: adaptive sampling, the first-bounce cache, path
+// regeneration, the G-buffer primary, ReSTIR and BDPT.
+#define SPP_BATCH 1
+// retire paths straight into the accumulation: every site that ends a
+// path (environment miss, emissive hit, bounce budget, Russian roulette)
+// banks its contribution the moment the path dies, and the
+// end-of-iteration finalGather launch - a full extra read of the path
+// pool, most of it long-dead slots once compaction has been shrinking the
+// wavefronts - disappears. BDPT keeps the gather pass (its kernel ends
+// every path in one launch, making the pass its natural flush point), and
+// path regeneration already flushes inline, so the toggle stands down
+// there rather than double-counting.
+#define TERMINATE_GATHER_ENABLE 1
+// fuse camera-ray generation with primary visibility: the ray is built and
+// intersected in one 2D-tiled launch, so the freshly written PathSegment is
+// not read straight back by the next kernel, and primary traversal runs on
+// square screen-tile warps instead of the 1D launch's scanline slivers.
+// Ignored while the G-buffer, first-bounce cache or megakernel own the
+// primary hits.
+#define FUSED_PRIMARY_ENABLE 1
+// per-tile geometry culling for the fused primary launch: every 8x8
+// block of primary rays shares a narrow frustum, so on each camera
+// change the host tests the static geoms' world AABBs against every
+// tile's four frustum planes (half-pixel margin for the AA jitter, plus
+// the lens radius with depth of field) and uploads per-tile candidate
+// index lists; the fused kernel then runs a short linear loop over its
+// tile's candidates instead of full TLAS traversal. Pays off on scenes
+// of many analytic geoms - most random-spheres tiles see a handful of
+// the hundreds - and costs tiles * geoms plane tests per camera move
+// plus a tiles * geoms index buffer, so it is a per-build choice for
+// geom-heavy batches rather than a default. Moving geoms keep their own
+// traversal pass, preview-scaled frames fall back to the TLAS (the
+// lists are built for the full-resolution tile grid), and the tile size
+// must stay in step with the fused launch's blockSize2d.
+#define TILE_CULL_ENABLE 0
+#define TILE_CULL_SIZE 8
+// lay primary paths out in Morton (Z) order of their pixel instead of
+// scanline order, so a 128-wide block covers a compact 2D screen tile
+// rather than a 128x1 sliver; warps then carry rays that stay spatially
+// close through the first bounces, which traversal rewards. Only the
+// pixel-to-slot write side changes: everything downstream already goes
+// through the pixelIndices stream.
+#define MORTON_ORDER_ENABLE 1
+// serve material records from a texture object instead of plain global
+// loads: thousands of threads hammer a handful of Material entries per
+// bounce, and texture-resident fetches keep that broadcast traffic out of
+// the cache lines the path-state streams live in. Three float4 texels per
+// material; layout asserted next to fetchMaterial
+#define MATERIAL_TEX_ENABLE 1
+// stage the whole material table into shared memory at the top of the
+// wavefront shade kernel: after dedupMaterials the palette is typically a
+// handful of entries, so each block copies it once cooperatively and every
+// thread's divergent material fetch becomes a shared-memory read instead
+// of a global (or texture) load. Scenes whose palette exceeds
+// SHARED_MATERIALS_MAX fall back to fetchMaterial per thread at runtime;
+// the cap bounds the static shared allocation (64 entries * 64 bytes = 4 KB
+// per block). Wavefront shadeBSDFMaterial only; the megakernel and the
+// material queues keep their per-thread fetches.
+#define SHARED_MATERIALS_ENABLE 0
+#define SHARED_MATERIALS_MAX 64
+// optional per-bounce coherence sort for secondary rays: paths are keyed by
+// direction octant + Morton cell of the origin and an index array is radix
+// sorted by that 32-bit key, so intersection pulls warps of rays that agree
+// on where they start and roughly where they are headed. Key-only: the path
+// streams themselves never move. Traversal divergence grows 2-3x by bounce
+// three without it, but the sort is not free, so it is a per-scene choice.
+#define RAY_SORT_ENABLE 0
+// refill every dead path slot with the next sample's primary ray for its
+// pixel at the end of each bounce, instead of compacting the survivors:
+// wavefronts stay full no matter how fast paths die, which is where deep
+// traceDepth configs lose most of their occupancy. Samples are accounted
+// per pixel (started / flushed counters, no atomics since a pixel owns one
+// slot) and the display normalizes by each pixel's own flushed count, so
+// pixels are free to run ahead of one another; in-flight paths persist
+// across pathtrace() calls. Mutually exclusive with STREAM_COMPACTION
+// (slots must stay put), and not meaningful with the first-bounce cache,
+// G-buffer, megakernel, adaptive sampling, the denoiser or the CUDA graph
+// capture, which all assume one uniform sample per pixel per call.
+#define PATH_REGEN_ENABLE 0
+#if PATH_REGEN_ENABLE && TERMINATE_GATHER_ENABLE
+// path regeneration flushes finished samples itself; banking them a
+// second time at the kill sites would double-count
+#undef TERMINATE_GATHER_ENABLE
+#define TERMINATE_GATHER_ENABLE 0
+#endif // PATH_REGEN_ENABLE
+// probabilistically terminate dark paths once they are a few bounces deep;
+// survivors carry the compensation in color so the estimator stays unbiased
+#define RUSSIAN_ROULETTE_ENABLE 1
+#define RUSSIAN_ROULETTE_MIN_DEPTH 3
+// material-aware bounce budgets on top of the single traceDepth cap: a
+// delta (specular/refractive) bounce refunds itself, so a transmission
+// chain through glass keeps its remaining budget and the scene can run
+// the depth the diffuse transport needs instead of the depth the glass
+// needs. The wavefront loop runs up to SPECULAR_EXTRA_DEPTH bounces past
+// traceDepth to absorb the refunds (with stream compaction it still ends
+// the moment the last chain dies), and a path stops refunding once it
+// could no longer finish inside that window, so nothing outlives the
+// loop with throughput still on it. Diffuse-to-diffuse chains go the
+// other way: they face the roulette above from DIFFUSE_RR_MIN_DEPTH
+// instead of RUSSIAN_ROULETTE_MIN_DEPTH, with the usual survival
+// compensation keeping the earlier cut unbiased.
+#define MATERIAL_DEPTH_BUDGET_ENABLE 1
+#define SPECULAR_EXTRA_DEPTH 8
+#define DIFFUSE_RR_MIN_DEPTH 2
+// sample one shadow ray toward a randomly chosen scene light per diffuse
+// bounce (next event estimation); the light sample and the BSDF sample are
+// combined with the power heuristic, so whichever technique has the higher
+// pdf for a given light dominates instead of both counting in full
+#define DIRECT_LIGHTING_ENABLE 1
+// reservoir resampling (ReSTIR-style) for the first bounce's light sample:
+// each pixel streams a few alias-table candidates through a persistent
+// per-pixel reservoir, folds in last iteration's winner (history capped so
+// stale samples age out) and a few neighbors' winners, then traces one
+// shadow ray for the survivor. Many-light scenes get far better sample
+// placement per shadow ray at 1 spp; the neighbor reuse skips the usual
+// visibility re-test, so the preview trades a little bias for the variance
+// drop. First bounce of the default pipeline only - deeper bounces and
+// scenes with an environment map keep the plain light sample - and needs
+// DIRECT_LIGHTING_ENABLE.
+#define RESTIR_ENABLE 0
+#define RESTIR_CANDIDATES 4
+// temporal history cap, in multiples of the per-iteration candidate count
+#define RESTIR_M_CAP 20
+#define RESTIR_SPATIAL_NEIGHBORS 3
+#define RESTIR_SPATIAL_RADIUS 8
+// defer the NEE shadow rays instead of tracing them inline per bounce:
+// sampleDirectLight queues each visibility test (origin, direction, maxT,
+// throughput-weighted contribution, pixel) into a device buffer across
+// every bounce of the iteration, and one launch then traces the whole
+// queue after the bounce loop, Morton-sorted by direction octant and
+// origin like the RAY_SORT path. Eight small launches over increasingly
+// divergent survivor sets become one large coherent any-hit batch.
+// Because TERMINATE_GATHER banks a path's colors and radiances the moment
+// it dies, resolved contributions deposit straight into the accumulation
+// image per pixel (atomicAdd - several bounces of one pixel land in the
+// same launch), which also means the firefly clamp sees each light sample
+// on its own rather than folded into the path's banked sum. Costs the
+// queue (slots * traceDepth * 48 B) plus the sort's key/index/scratch
+// arrays out of the arena. Two-pass pipeline only: the megakernel and
+// ReSTIR keep their inline shadow rays, and AOV builds force this off
+// below. Needs DIRECT_LIGHTING_ENABLE.
+#define DEFERRED_SHADOW_ENABLE 0
+// scene-wide homogeneous participating medium (MEDIUM scene block) in
+// place of the old fields of semi-transparent geometry, which multiplied
+// path length and defeated compaction. Transmittance-based distance
+// sampling in the bounce loop decides whether each segment scatters
+// before its surface hit; scattered paths continue with a
+// Henyey-Greenstein draw, and single scattering of the listed lights is
+// banked once per segment through an equiangular distance sample, which
+// resolves a visible shaft in tens of iterations instead of thousands.
+// The medium fills all space, so environment light fades with its optical
+// depth. Covers the split pipeline, the wavefront queues and the fused /
+// cooperative bounce loops; BDPT and the photon pass ignore the medium.
+// Needs DIRECT_LIGHTING_ENABLE for the light list and its alias table.
+#define VOLUME_ENABLE 1
+// portal-guided environment sampling for interiors (scene file PORTAL
+// blocks): next event estimation draws its environment sample from a
+// point on one of the marked openings - portal picked in proportion to
+// area, point uniform over the rectangle - instead of from the map's
+// alias table, and the escaped-ray MIS weight pairs against the same
+// portal pdf so the combination stays unbiased. Indoor scenes otherwise
+// spend almost every map sample on a direction the walls occlude; with
+// the openings sampled directly, thousand-iteration interiors converge
+// in hundreds. Portals are virtual (never intersected as geometry) and
+// two-sided; a scene without PORTAL blocks runs the plain map sample,
+// so the toggle costs such scenes one compare. Up to PORTAL_MAX_COUNT
+// portals live in the constant bank.
+#define PORTAL_SAMPLING_ENABLE 1
+#define PORTAL_MAX_COUNT 8
+// online path guiding for interiors lit through small openings, where
+// nearly every cosine-sampled diffuse bounce misses the doorway: finished
+// paths deposit their contribution into a fixed grid over the scene
+// bounds (GUIDE_GRID_RES^3 cells, an octahedral GUIDE_DIR_RES^2 direction
+// histogram each), and shadeBSDFMaterial then draws diffuse bounces from
+// a one-sample MIS mixture of that learned distribution and the usual
+// cosine hemisphere. The mixture pdf keeps the estimator unbiased however
+// wrong the histogram still is, and an unvisited cell falls back to pure
+// cosine, so the early iterations just explore. The distribution is
+// frozen within an iteration and refreshed with exponential decay between
+// them (kernGuideDecay). Fixed-resolution stand-in for the adaptive
+// SD-tree of the practical guiding literature; ~8 MB per device at the
+// defaults. Default pipeline only - the wavefront queues, fused /
+// cooperative loops, BDPT and the photon pass keep plain BSDF sampling.
+#define PATH_GUIDING_ENABLE 0
+// spatial cells per axis over the scene bounds
+#define GUIDE_GRID_RES 32
+// direction bins per octahedral-map axis (squared per cell)
+#define GUIDE_DIR_RES 8
+#define GUIDE_DIR_BINS (GUIDE_DIR_RES * GUIDE_DIR_RES)
+#define GUIDE_NUM_CELLS (GUIDE_GRID_RES * GUIDE_GRID_RES * GUIDE_GRID_RES)
+// share of guided diffuse bounces drawn from the learned distribution
+#define GUIDE_MIX 0.5f
+// per-iteration decay of the learned flux before fresh deposits fold in
+#define GUIDE_DECAY 0.5f
+// bidirectional integrator: every pixel traces a camera subpath and a
+// light subpath and connects each non-delta vertex pair with a shadow ray,
+// weighting every complete path uniformly over the strategies that could
+// have built it. Caustics (light through the refractive spheres onto
+// diffuse) arrive via the light subpath's delta bounces instead of waiting
+// for a camera path to find the chain backwards, which on caustic-heavy
+// scenes is the difference between hundreds and tens of thousands of
+// iterations; directly-lit content resolves faster with the default
+// integrator and its NEE, so this is a per-build choice per scene batch.
+// Replaces the whole bounce loop: no compaction, wavefront, megakernel or
+// ReSTIR, and needs DIRECT_LIGHTING_ENABLE for the extracted light list.
+#define BDPT_ENABLE 0
+// per-subpath vertex cap; the effective caps are min of this and the
+// scene's trace depth
+#define BDPT_MAX_VERTS 8
+// photon-mapped diffuse interreflection: a one-time light pass traces
+// PHOTON_COUNT particles from the extracted light list and stores their
+// diffuse hits in a uniform spatial hash; shadeBSDFMaterial then answers
+// diffuse bounces past PHOTON_GATHER_DEPTH with a density estimate over
+// the map instead of extending the path. The deep cosine-hemisphere chains
+// are what traceDepth 8 mostly pays for, so interior scenes can run
+// traceDepth 3 against the cache at similar quality. Biased (the estimate
+// blurs over PHOTON_RADIUS) and the map is built once per scene, so moving
+// geoms see time-averaged indirect light. Default pipeline only; needs
+// DIRECT_LIGHTING_ENABLE for the light list and its alias table.
+#define PHOTON_MAP_ENABLE 0
+// particles emitted; stores can exceed this (one per diffuse bounce), the
+// arrays are sized at twice the emission count
+#define PHOTON_COUNT (1 << 20)
+#define PHOTON_MAX_BOUNCES 8
+// camera depth at which diffuse shading switches to the cache lookup
+#define PHOTON_GATHER_DEPTH 2
+// world-space gather radius; doubles as the hash grid's cell size
+#define PHOTON_RADIUS 0.3f
+// hash bucket count (power of two); collisions only cost the distance
+// rejections, not correctness
+#define PHOTON_HASH_SIZE (1 << 20)
+// temporal reprojection across camera moves: every iteration keeps its
+// first-bounce hit points, and a camera reset scatters the old
+// accumulation's per-pixel means through them into the new view (nearest
+// depth wins, so newly revealed surfaces stay empty instead of inheriting
+// a stale occluder). The reprojected frame is a display-side prior only -
+// the early iterations of the new view blend it out as real samples
+// arrive - so the accumulation itself stays untouched and unbiased.
+#define TEMPORAL_REPROJECTION_ENABLE 0
+// iterations over which the prior fades to the live accumulation
+#define TEMPORAL_BLEND_ITERS 16
+// proper display transform in the PBO kernels - exposure scale, the ACES
+// filmic curve and sRGB encoding - in place of the raw linear
+// clamp-to-255 that crushed everything past 1.0 to flat white and showed
+// midtones too dark on sRGB displays. Fused into the existing send*ToPBO
+// launches, so it costs a handful of FMAs per pixel; display-side only,
+// the accumulation and the saved PNG stay linear. The heatmap's
+// false-color view is exempt.
+#define TONEMAP_ENABLE 1
+// linear exposure multiplier applied before the tonemap curve
+#define DISPLAY_EXPOSURE 1.0f
+// intersection runs as a fixed grid of persistent worker warps pulling path
+// indices from a global queue, so a warp that finishes cheap paths grabs more
+// work instead of idling behind the launch's slowest mesh traversal
+#define PERSISTENT_THREADS 0
+// capture the camera-ray + bounce-loop kernel pipeline as a CUDA graph and
+// replay it with a single launch per iteration. Re-captured every frame (host
+// side only) so per-iteration kernel arguments stay fresh, then applied to
+// the instantiated graph via cudaGraphExecUpdate. Only valid while the
+// pipeline shape is fixed: no compaction, wavefront queues or first-bounce
+// cache, which all make host-side decisions mid-iteration.
+#define CUDA_GRAPH_ENABLE 0
+#define CACHE_ENABLE 0
+// per-pixel bounce-cost heatmap: a device counter accumulates one count
+// per live path per bounce, the H key swaps the display over to a
+// false-color mean-bounces-per-sample view, and --benchmark dumps it as a
+// grayscale PNG. The data for choosing compaction / regeneration /
+// roulette settings per scene; costs one extra pixel-sized int buffer and
+// one cheap kernel per bounce when on
+#define HEATMAP_ENABLE 0
+// interactive pixel probe: Shift+click a pixel in the viewer
+// (pathtraceProbePixel) and the next full-resolution iteration records
+// that pixel's path bounce by bounce - hit distance, material,
+// throughput, scatter pdf and how it ended (emissive hit, environment
+// miss, roulette/depth) - into a trace-depth-sized buffer and prints it
+// to stdout. Answers "why is this region converging slowly" without
+// printf archaeology in the shade kernel. The armed check is one
+// constant compare per shaded path (the pixel id is -1 between
+// captures), so the cost is noise; instrumented in the wavefront
+// shadeBSDFMaterial pipeline only - the megakernel, cooperative and
+// material-queue variants record nothing.
+#define PIXEL_PROBE_ENABLE 0
+// region-adaptive trace depth learned across iterations: terminated paths
+// deposit their contribution's luminance per pixel tile and per
+// termination depth, and kernAdaptiveDepthBudget distills each tile's
+// depth budget at the top of every iteration - the deepest bounce whose
+// contribution tail still clears a per-sample luminance threshold. Paths
+// that finish their tile's budgeted bounces face a fixed-survival
+// Russian roulette in the shared scatter epilogue, so the truncation is
+// compensated and stays unbiased; open sky settles to
+// ADAPTIVE_DEPTH_MIN while the glass cluster keeps the scene's full
+// depth, retiring most of what the global worst-case traceDepth pays
+// for. Contribution-weighted statistics rather than the heatmap's raw
+// bounce counts, which cost the same to record but cannot tell a cheap
+// deep bounce from a bright one.
+#define ADAPTIVE_DEPTH_ENABLE 0
+// pixel tile edge for the learned budgets
+#define ADAPTIVE_DEPTH_TILE 16
+// per-depth statistics bins; deeper terminations clamp into the last
+#define ADAPTIVE_DEPTH_BINS 16
+// depth every tile keeps regardless of its statistics
+#define ADAPTIVE_DEPTH_MIN 2
+// mean per-sample luminance a depth's contribution tail must clear
+#define ADAPTIVE_DEPTH_THRESHOLD 0.005f
+// Russian-roulette survival past the budget; any value is unbiased,
+// lower is faster and noisier inside truncated tiles
+#define ADAPTIVE_DEPTH_SURVIVAL 0.125f
+// iterations of full-depth exploration before the budgets apply
+#define ADAPTIVE_DEPTH_WARMUP 8
+// interactive region-of-interest rendering for look-dev: a Ctrl+drag in
+// the viewer (main.cpp callbacks) picks a screen rectangle, and every
+// following iteration traces only those pixels - the tile-camera crop
+// fields restrict the raygen launch, and with it every downstream path
+// count, to the rectangle, so a 300x300 region of a 1440p frame costs
+// the region's share of a full iteration rather than all of it. The rest
+// of the display stays frozen at the accumulation it had when the region
+// was set (the PBO kernel divides the two sides by their own sample
+// counts), while the region keeps accumulating into dev_image in place:
+// the RNG lanes and Sobol seeds stay addressed in the frame layout
+// through c_roiOffset, so the crop continues each pixel's sample
+// sequence exactly as the full-frame render would have. Ctrl+click
+// clears the rectangle; a camera move clears it too, since the frozen
+// remainder would show the outgoing view. Clear it before saving as
+// well - saveImage divides the whole frame uniformly. Builds with this
+// on fall back to identity path slotting (the full-frame Morton table
+// cannot yield compact crop slots) and assume the plain accumulation
+// display: PATH_REGEN, DENOISE and the MULTI_GPU merge normalize the
+// frame their own way and ignore the freeze divisor.
+#define ROI_ENABLE 0
+#if ROI_ENABLE && TILE_CULL_ENABLE
+// the region of interest launches a compact grid whose blocks no longer
+// line up with the full-frame tiles the culling lists were built for
+#undef TILE_CULL_ENABLE
+#define TILE_CULL_ENABLE 0
+#endif // ROI_ENABLE
+// default for the per-stage GPU timing layer (raygen / per-bounce
+// intersect, sort, shade, compact / gather / PBO upload) with rolling
+// mean/p95 windows, printed by pathtraceProfileReport (P key in the
+// preview). Runtime-switchable either way via pathtraceProfileSetActive;
+// --benchmark turns it on regardless of this default
+#define PROFILE_ENABLE 0
+// clock64 sampling inside the hot kernels: labeled regions (the per-type
+// intersection tests, shade's material fetch and scatter) accumulate
+// leader-lane cycles and visit counts into device totals, snapshotted by
+// pathtraceKernelProfileSnapshot and folded into the --benchmark report.
+// Attributes time within computeIntersections and shadeBSDFMaterial
+// where the event timing above stops. Compile-time only - the clocks
+// and per-warp atomics cost real time - so keep it off outside profiling
+// sessions, and never compare its timings against an uninstrumented
+// build's.
+#define KERNEL_PROFILE_ENABLE 0
+// shard Monte Carlo iterations across every visible GPU: each device holds a
+// full replica of the pipeline (scene, BVHs, arena, accumulation, RNG lanes)
+// and device d renders the interleaved global sample indices d+1, d+1+N,
+// d+1+2N, ... so the devices' sequences stay decorrelated while every seed
+// path stays the single-device one. One pathtrace() call then advances every
+// device by one iteration and averages the per-device accumulations on
+// device 0 for display and readback, so N devices mean N samples per shown
+// "iteration". The per-device state is swapped through snapshots of the
+// module statics around cudaSetDevice, which keeps every kernel and helper
+// in this file single-device. Expects the default pipeline: stream
+// compaction (library-side scratch), path regeneration (per-pixel
+// normalization), the first-hit cache (stratum schedule keyed on iter), the
+// G-buffer, CUDA graph capture and checkpoint resume all assume one device.
+// pick each mesh instance's LOD level (compiler-built simplified ranges,
+// Geom::lodStart/..Root) from its projected size at the job's starting
+// camera. Per-init, not per-ray: the render camera is fixed for a batch
+// job, and the preview's accumulation resets on movement anyway
+#define MESH_LOD_ENABLE 1
+// proxy traversal for deep bounces: bounces at or past PROXY_BOUNCE_DEPTH
+// intersect a second hot-geom table whose compiled-LOD meshes are pinned
+// to their coarsest level, regardless of what the projected-size
+// heuristic above picked for the visible hits. Light past the second
+// bounce is blurred and low-frequency, so simplification that would
+// shimmer on primary visibility is harmless there, and mesh-heavy frames
+// spend most of their intersection time exactly on those bounces. Costs
+// one extra geom-table copy; inert (the proxy table is never allocated)
+// for scenes without compiled LOD chains. Wavefront bounce loop only -
+// the megakernel keeps one table - and the deep bounces' shadow rays
+// keep full-detail occlusion either way.
+#define PROXY_BOUNCE_ENABLE 0
+#define PROXY_BOUNCE_DEPTH 2
+#define MULTI_GPU_ENABLE 0
+#define MULTI_GPU_MAX_DEVICES 8
+// with the sharding above, place the big read-only geometry pools
+// (triangles, vertices, normals, texcoords, and the BVH node pools) once
+// across the peer group instead of replicating them per device: the flat
+// pools land round-robin so each card holds roughly 1/N of the scene, and
+// every other device reads them through NVLink peer mappings. That is
+// what lets a scene bigger than any single card's VRAM render at all; the
+// price is remote fetches on the minority of traversal traffic that
+// leaves the local card, which L2 absorbs reasonably on NVLink pairs.
+// Requires peer access between every device pair - checked at init, and
+// the build replicates exactly as before when any pair lacks it. Texture
+// objects cannot wrap another device's memory, so this forces
+// POOL_TEX_ENABLE off (see intersections.h).
+#define MULTI_GPU_PEER_GEOM_ENABLE 0
+// hand each pathtrace() call's N-sample batch to devices greedily instead
+// of one fixed sample per device: every sample index goes to the first
+// device whose previous enqueue has drained (event poll), so a card that
+// is twice as fast renders twice the samples and mixed-generation or
+// display-burdened nodes stop idling the fast card at the frame tail.
+// The global accounting is untouched - a call still advances the total by
+// N samples, and the merge is a scaled sum, so uneven per-device counts
+// need no reweighting. Per-device iteration subsequences become irregular
+// instead of strided, which the seeding (keyed on the global sample
+// index) does not care about.
+#define MULTI_GPU_STEAL_ENABLE 0
+// job defaults for the camera-ray features; the actual combination is a
+// runtime bitmask (see CamFeature) dispatched to per-mask template
+// instantiations, so one binary serves DOF and motion-blur jobs alike
+#define DEPTH_OF_FIELD_ENABLE 0
+#define ANTIALIASING 0
+// with antialiasing, primary rays draw their jitter from a fixed set of
+// subpixel strata (one per iteration, round-robin) and the first-hit cache
+// keeps one entry per stratum, so cached primary visibility survives AA
+#if ANTIALIASING
+#define CACHE_STRATA 4
+#else
+#define CACHE_STRATA 1
+#endif // ANTIALIASING
+// Edge-masked adaptive antialiasing on top of the stratified cache: once
+// all CACHE_STRATA first hits are cached, pixels whose strata all landed
+// on the same surface (and whose 4-neighbors agree) are interior - AA
+// cannot change them, so they keep replaying their cached hit. The rest
+// are edge pixels: they re-trace their primary ray every iteration with
+// free per-iteration jitter, which is both cheaper frame-wide (typical
+// frames mask well under 10% of pixels) and higher quality at the edges
+// than cycling the four fixed strata. The mask is rebuilt whenever the
+// accumulation restarts, so camera moves stay correct. Requires the
+// cache and antialiasing; off otherwise.
+#define AA_EDGE_ADAPTIVE_ENABLE 0
+// relative first-hit depth difference (against the larger of |t| and 1)
+// past which two samples count as different surfaces for the mask
+#define AA_EDGE_DEPTH_TOLERANCE 0.02f
+#if AA_EDGE_ADAPTIVE_ENABLE && !(ANTIALIASING && CACHE_ENABLE)
+// without the stratified cache there is no cached hit to mask against
+#undef AA_EDGE_ADAPTIVE_ENABLE
+#define AA_EDGE_ADAPTIVE_ENABLE 0
+#endif // AA_EDGE_ADAPTIVE_ENABLE
+#define MOTION_BLUR_ENABLE 0
+// procedural sky gradient for rays that escape a scene without an
+// environment map; scenes that load one (ENVMAP directive) get the HDR map
+// instead regardless of this toggle (see environmentRadiance)
+#define AMBIENT_LIGHT_ENABLE 1
+// track a per-pixel running mean and M2 (Welford) of the iteration
+// luminance and stop tracing pixels whose 95% confidence interval has
+// shrunk below a relative tolerance; a frozen pixel replays its mean into
+// the accumulation, so the uniform divide-by-iteration used by the display
+// and by saveImage stays valid without per-pixel sample counts downstream
+#define ADAPTIVE_SAMPLING 1
+#define ADAPTIVE_MIN_SAMPLES 64
+#define ADAPTIVE_TOLERANCE 0.02f
+// grayscale importance map over the frame (IMPORTANCE directive in the
+// scene file): white pixels keep the tolerance above, black pixels get
+// IMPORTANCE_MAP_SLACK times it, linear in between, so backdrop and
+// blurred-behind-DOF regions freeze after far fewer samples while the
+// subject converges to full quality. Artist intent over a mathematical
+// target: the map is painted over the saved frame (or rendered - any
+// grayscale source works, an object-ID matte included) and sampled
+// nearest at whatever resolution it comes in. Only the freeze test
+// changes; warmup (ADAPTIVE_MIN_SAMPLES) still applies everywhere so the
+// confidence interval is meaningful before a pixel can freeze early.
+#define IMPORTANCE_MAP_ENABLE 0
+#define IMPORTANCE_MAP_SLACK 8.0f
+#if IMPORTANCE_MAP_ENABLE && !ADAPTIVE_SAMPLING
+// the map only meters the adaptive freeze test; without the scheduler it
+// has nothing to scale
+#undef IMPORTANCE_MAP_ENABLE
+#define IMPORTANCE_MAP_ENABLE 0
+#endif // IMPORTANCE_MAP_ENABLE
+// edge-avoiding A-Trous wavelet filter (Dammertz et al.) over the averaged
+// image, guided by first-bounce normals and positions; a few milliseconds
+// per iteration buys a usable preview (and saved image) at a fraction of
+// the iterations, for look-dev renders that stop early
+// clamp each iteration's per-pixel luminance before it enters the
+// accumulation; the clipped excess is banked per pixel instead of being
+// thrown away, so the introduced bias can be measured (or redistributed)
+// rather than silently shipped. Fireflies from specular-to-diffuse chains
+// otherwise persist as hot pixels for thousands of iterations.
+#define FIREFLY_CLAMP_ENABLE 1
+#define FIREFLY_CLAMP 10.0f
+#define DENOISE_ENABLE 0
+#define DENOISE_LEVELS 5
+#define DENOISE_C_PHI 0.6f
+#define DENOISE_N_PHI 0.3f
+#define DENOISE_P_PHI 0.6f
+// render auxiliary output channels alongside the beauty pass: first-hit
+// normal, depth and albedo accumulate from the depth-0 intersection
+// stream, and a direct-only radiance layer banks the first-vertex light
+// sample plus first-hit emissive and environment light (the indirect
+// layer is derived as beauty minus direct at save time). saveImage then
+// writes every channel into the one EXR next to R/G/B, so compositing
+// gets its passes from a single render instead of re-rendering with
+// hacked shaders. Capture rides the split pipeline's intersection stream
+// and assumes one slot per pixel: the megakernel, the cooperative loop,
+// path regeneration and SPP_BATCH > 1 skip it, and the multi-GPU merge
+// moves only the beauty accumulation.
+#define AOV_ENABLE 0
+#if AOV_ENABLE && DEFERRED_SHADOW_ENABLE
+// the direct AOV banks the first-vertex light sample at the bounce it
+// belongs to; a queue resolved after the loop cannot split it back out
+#undef DEFERRED_SHADOW_ENABLE
+#define DEFERRED_SHADOW_ENABLE 0
+#endif // AOV_ENABLE
+// look-dev preview mode tracing bounces past the first at half resolution
+// (a quarter of the paths). After the first bounce's shading, each 2x2
+// pixel quad keeps one continuing path - the representative rotates
+// through the quad with the iteration - and retires the other three; the
+// survivor's contribution past that point (terminal color plus any deeper
+// banked light samples) lands in a quad-resolution buffer instead of the
+// accumulation, and a bilateral upsample guided by the first-bounce
+// normals and positions (the denoiser's G-buffer) spreads it back over
+// the quad. Direct light - first-vertex NEE, emissive hits and misses up
+// to depth 1 - stays per pixel at full rate, so edges and textures keep
+// full resolution while the dominant deep-bounce cost drops to a quarter.
+// Biased wherever the filter bridges a geometric edge; previews only.
+// Default pipeline (compaction is fine); needs slot == pixel, so no
+// Morton order and SPP_BATCH 1, and no PATH_REGEN, TERMINATE_GATHER or
+// ADAPTIVE_SAMPLING, which retire or meter paths before the resolve
+// sees their streams.
+#define HALF_RES_INDIRECT_ENABLE 0
+// edge-stopping weights of the upsample, on the A-Trous scales
+#define HALF_RES_N_PHI 0.3f
+#define HALF_RES_P_PHI 0.6f
+// flat radiance the layout-preview integrator (L key,
+// pathtraceToggleLayoutPreview) adds where its single bounce terminates,
+// so untextured interiors stay readable without indirect transport;
+// scenes with an environment map get its light on top of this
+#define LAYOUT_PREVIEW_AMBIENT 0.15f
+// let the shading kernel build the next bounce's live-path list itself:
+// every thread whose path survives its scatter claims a slot in the
+// index buffer with the warp-aggregated append, so the separate
+// compaction pass - a full re-read of every slot's remainingBounces just
+// to rediscover decisions shading made moments earlier - disappears, and
+// the kill sites keep banking dead paths' colors inline as under
+// TERMINATE_GATHER_ENABLE. The emitted list is unordered (warp-append
+// order, not slot order); the ray coherence sort rebuilds locality when
+// it is on, and nothing else reads the list's order. Needs the
+// compaction indirection and inline termination to exist, and stands
+// down for the pipelines where liveness changes after the shading
+// launch (path regeneration refills slots, the half-res select retires
+// them) or where no shading launch exists (megakernel, cooperative
+// loop, wavefront queues, BDPT's own walk).
+#define FUSED_COMPACT_ENABLE 0
+#if FUSED_COMPACT_ENABLE && !(STREAM_COMPACTION && TERMINATE_GATHER_ENABLE)
+// without the indirection there is no list to emit into; without inline
+// termination the gather pass still needs every slot intact
+#undef FUSED_COMPACT_ENABLE
+#define FUSED_COMPACT_ENABLE 0
+#endif // FUSED_COMPACT_ENABLE
+#if FUSED_COMPACT_ENABLE && (WAVEFRONT_ENABLE || MEGAKERNEL_ENABLE \
+	|| COOP_LAUNCH_ENABLE || PATH_REGEN_ENABLE || HALF_RES_INDIRECT_ENABLE \
+	|| BDPT_ENABLE)
+// these pipelines either have no shadeBSDFMaterial launch or change
+// path liveness after it, so the emitted list would go stale
+#undef FUSED_COMPACT_ENABLE
+#define FUSED_COMPACT_ENABLE 0
+#endif // FUSED_COMPACT_ENABLE
+
+#define FILENAME (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+#define checkCUDAError(msg) checkCUDAErrorFn(msg, FILENAME, __LINE__)
+#define checkCUDAErrorSync(msg) checkCUDAErrorSyncFn(msg, FILENAME, __LINE__)
+// two-step expansion so TOSTR(FLAG) yields the flag's value, not its name
+#define TOSTR_(x) #x
+#define TOSTR(x) TOSTR_(x)
+
+// launch-site error checks, defined in pathtrace.cu; ERRORCHECK above
+// selects how much they synchronize
+void checkCUDAErrorFn(const char* msg, const char* file, int line);
+void checkCUDAErrorSyncFn(const char* msg, const char* file, int line);
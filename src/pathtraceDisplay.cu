@@ -0,0 +1,283 @@
+#include "pathtraceDisplay.h"
+
+#if TONEMAP_ENABLE
+// Display transform shared by every linear-input PBO kernel: exposure,
+// the ACES filmic fit (Narkowicz' rational approximation - five FMAs and
+// a divide per channel, cheaper than a texture or constant LUT fetch and
+// with no interpolation seams), then sRGB encoding per IEC 61966-2-1.
+__device__ unsigned char displayEncode(float c) {
+	c *= DISPLAY_EXPOSURE;
+	c = glm::clamp(c * (2.51f * c + 0.03f) / (c * (2.43f * c + 0.59f) + 0.14f), 0.0f, 1.0f);
+	c = c <= 0.0031308f ? 12.92f * c : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+	return (unsigned char)(glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+#else
+// legacy raw linear clamp
+__device__ unsigned char displayEncode(float c) {
+	return (unsigned char)glm::clamp((int)(c * 255.0f), 0, 255);
+}
+#endif // TONEMAP_ENABLE
+
+//Kernel that writes the image to the OpenGL PBO directly.
+__global__ void sendImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, glm::vec3* image) {
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < resolution.x && y < resolution.y) {
+		int index = x + (y * resolution.x);
+		glm::vec3 pix = image[index];
+
+		// Each thread writes one pixel location in the texture (textel)
+		pbo[index].w = 0;
+		pbo[index].x = displayEncode(pix.x / iter);
+		pbo[index].y = displayEncode(pix.y / iter);
+		pbo[index].z = displayEncode(pix.z / iter);
+	}
+}
+
+// Upscale variant for the movement preview: the traced frame is 1/scale
+// the display size in each dimension, so every display pixel samples its
+// nearest traced pixel.
+__global__ void sendScaledImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	glm::ivec2 scaledResolution, int scale, int iter, glm::vec3* image) {
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < resolution.x && y < resolution.y) {
+		int sx = glm::min(x / scale, scaledResolution.x - 1);
+		int sy = glm::min(y / scale, scaledResolution.y - 1);
+		glm::vec3 pix = image[sx + sy * scaledResolution.x];
+
+		int index = x + (y * resolution.x);
+		pbo[index].w = 0;
+		pbo[index].x = displayEncode(pix.x / iter);
+		pbo[index].y = displayEncode(pix.y / iter);
+		pbo[index].z = displayEncode(pix.z / iter);
+	}
+}
+
+#if ROI_ENABLE
+// Region-of-interest variant: pixels inside the rectangle keep
+// accumulating and divide by the live iteration count; everything else
+// stopped at baseIter samples when the rectangle was set and divides by
+// that, so the frozen remainder holds its appearance instead of
+// darkening as iter grows past it.
+__global__ void sendRoiImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, int baseIter, glm::ivec2 roiMin, glm::ivec2 roiExtent,
+	glm::vec3* image) {
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < resolution.x && y < resolution.y) {
+		int index = x + (y * resolution.x);
+		bool inside = x >= roiMin.x && x < roiMin.x + roiExtent.x
+			&& y >= roiMin.y && y < roiMin.y + roiExtent.y;
+		int samples = inside ? iter : baseIter;
+		samples = samples > 0 ? samples : 1;
+		glm::vec3 pix = image[index];
+
+		pbo[index].w = 0;
+		pbo[index].x = displayEncode(pix.x / samples);
+		pbo[index].y = displayEncode(pix.y / samples);
+		pbo[index].z = displayEncode(pix.z / samples);
+	}
+}
+#endif // ROI_ENABLE
+
+#if TEMPORAL_REPROJECTION_ENABLE
+// Invert the ray-generation mapping: the pixel whose (unjittered) primary
+// ray passes through `point`, plus its view depth. False when the point is
+// behind the camera or lands outside the frame.
+__device__ bool reprojectToPixel(const Camera cam, glm::vec3 point,
+	int& px, int& py, float& z)
+{
+	glm::vec3 w = point - cam.position;
+	z = glm::dot(w, cam.view);
+	if (z <= 0.0f) {
+		return false;
+	}
+	glm::vec3 wn = w / z;
+	float fx = -glm::dot(wn, cam.right) / cam.pixelLength.x
+		- (float)cam.cropOffset.x + (float)cam.fullResolution.x * 0.5f;
+	float fy = -glm::dot(wn, cam.up) / cam.pixelLength.y
+		- (float)cam.cropOffset.y + (float)cam.fullResolution.y * 0.5f;
+	px = (int)fx;
+	py = (int)fy;
+	return fx >= 0.0f && px < cam.resolution.x
+		&& fy >= 0.0f && py < cam.resolution.y;
+}
+
+// Keep each iteration's first-bounce hit points for the next reprojection.
+// Frozen pixels (adaptive sampling) keep their previous entry, which still
+// describes the same surface.
+__global__ void kernSaveReprojPositions(
+	int num_paths
+	, ShadeableIntersectionSoA shadeableIntersections
+	, PathSegmentSoA pathSegments
+	, glm::vec4* positions
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= num_paths || pathSegments.remainingBounces[idx] <= 0) {
+		return;
+	}
+	int pixel = pathSegments.pixelIndices[idx];
+	positions[pixel] = shadeableIntersections.t[idx] > 0.0f
+		? glm::vec4(shadeableIntersections.points[idx], 1.0f)
+		: glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+}
+
+// Scatter pass 1: nearest-depth resolve. Several old pixels can land on
+// the same new pixel (perspective shrink); atomicMin keeps the closest, so
+// a surface never shows through what now occludes it.
+__global__ void kernReprojectDepth(
+	int pixelcount
+	, const glm::vec4* __restrict__ positions
+	, Camera cam
+	, unsigned int* depth
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= pixelcount) {
+		return;
+	}
+	glm::vec4 p = positions[idx];
+	int px, py;
+	float z;
+	if (p.w <= 0.0f || !reprojectToPixel(cam, glm::vec3(p), px, py, z)) {
+		return;
+	}
+	// positive float bits order like the floats themselves
+	atomicMin(&depth[px + py * cam.resolution.x], __float_as_uint(z));
+}
+
+// Scatter pass 2: the depth winner writes its mean radiance. Pixels no old
+// surface reaches keep w = 0 and show the live accumulation unblended.
+__global__ void kernReprojectResolve(
+	int pixelcount
+	, const glm::vec4* __restrict__ positions
+	, const glm::vec3* __restrict__ prevImage
+	, float prevIter
+	, Camera cam
+	, const unsigned int* __restrict__ depth
+	, glm::vec4* reprojected
+	)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx >= pixelcount) {
+		return;
+	}
+	glm::vec4 p = positions[idx];
+	int px, py;
+	float z;
+	if (p.w <= 0.0f || !reprojectToPixel(cam, glm::vec3(p), px, py, z)) {
+		return;
+	}
+	int nidx = px + py * cam.resolution.x;
+	if (depth[nidx] == __float_as_uint(z)) {
+		reprojected[nidx] = glm::vec4(prevImage[idx] / prevIter, 1.0f);
+	}
+}
+
+// Display blend for the first iterations after a camera move: the
+// reprojected prior fades linearly into the live accumulation.
+__global__ void sendReprojectedImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, glm::vec3* image, const glm::vec4* __restrict__ reprojected) {
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < resolution.x && y < resolution.y) {
+		int index = x + (y * resolution.x);
+		glm::vec3 pix = image[index] / (float)iter;
+		glm::vec4 prior = reprojected[index];
+		if (prior.w > 0.5f) {
+			float a = (float)iter / (float)TEMPORAL_BLEND_ITERS;
+			pix = glm::mix(glm::vec3(prior), pix, a);
+		}
+
+		pbo[index].w = 0;
+		pbo[index].x = displayEncode(pix.x);
+		pbo[index].y = displayEncode(pix.y);
+		pbo[index].z = displayEncode(pix.z);
+	}
+}
+#endif // TEMPORAL_REPROJECTION_ENABLE
+
+#if HEATMAP_ENABLE
+// one count per live path per bounce; a pixel owns at most one live path,
+// so plain increments suffice
+__global__ void kernAccumulateBounceDepth(int nPaths, const int* activePaths,
+	const int* pixelIndices, int* bounceDepth) {
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < nPaths) {
+		int idx = activePaths != NULL ? activePaths[i] : i;
+		bounceDepth[pixelIndices[idx]]++;
+	}
+}
+
+// False-color view of mean bounces per sample: blue (paths die on the
+// first hit) through green to red (paths survive to the depth cap).
+__global__ void sendHeatmapToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, int traceDepth, const int* bounceDepth) {
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < resolution.x && y < resolution.y) {
+		int index = x + (y * resolution.x);
+		float mean = (float)bounceDepth[index] / (float)iter;
+		float t = glm::clamp(mean / (float)traceDepth, 0.0f, 1.0f);
+
+		// two linear ramps meeting at green
+		float r = glm::clamp(2.0f * t - 1.0f, 0.0f, 1.0f);
+		float g = 1.0f - fabsf(2.0f * t - 1.0f);
+		float b = glm::clamp(1.0f - 2.0f * t, 0.0f, 1.0f);
+
+		pbo[index].w = 0;
+		pbo[index].x = (unsigned char)(r * 255.0f);
+		pbo[index].y = (unsigned char)(g * 255.0f);
+		pbo[index].z = (unsigned char)(b * 255.0f);
+	}
+}
+#endif // HEATMAP_ENABLE
+
+#if PATH_REGEN_ENABLE
+// Regeneration variant: pixels complete samples at different rates, so the
+// accumulation is normalized by each pixel's own flushed-sample count
+// instead of the uniform iteration counter.
+__global__ void sendImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	const int* doneSamples, glm::vec3* image) {
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < resolution.x && y < resolution.y) {
+		int index = x + (y * resolution.x);
+		glm::vec3 pix = image[index];
+		int samples = doneSamples[index] > 0 ? doneSamples[index] : 1;
+
+		pbo[index].w = 0;
+		pbo[index].x = displayEncode(pix.x / samples);
+		pbo[index].y = displayEncode(pix.y / samples);
+		pbo[index].z = displayEncode(pix.z / samples);
+	}
+}
+#endif // PATH_REGEN_ENABLE
+
+#if DENOISE_ENABLE
+// Display kernel for the filtered buffer; it already holds the per-pixel
+// mean, so there is no divide by the iteration count here.
+__global__ void sendDenoisedImageToPBO(uchar4* pbo, glm::ivec2 resolution, const glm::vec3* image) {
+	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
+	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
+
+	if (x < resolution.x && y < resolution.y) {
+		int index = x + (y * resolution.x);
+		glm::vec3 pix = image[index];
+
+		pbo[index].w = 0;
+		pbo[index].x = displayEncode(pix.x);
+		pbo[index].y = displayEncode(pix.y);
+		pbo[index].z = displayEncode(pix.z);
+	}
+}
+#endif // DENOISE_ENABLE
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cuda_runtime.h>
+#include "glm/glm.hpp"
+#include "sceneStructs.h"
+#include "pathtraceConfig.h"
+
+// Display-side kernels (pathtraceDisplay.cu): everything that turns the
+// linear accumulation into PBO texels, plus the temporal-reprojection and
+// heatmap passes feeding it. All of them are parameter-driven - no constant
+// banks, no file statics - which is what lets them live in their own
+// translation unit: an edit to the tracing kernels no longer recompiles the
+// display path, and the two units build in parallel.
+
+__global__ void sendImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, glm::vec3* image);
+__global__ void sendScaledImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	glm::ivec2 scaledResolution, int scale, int iter, glm::vec3* image);
+#if ROI_ENABLE
+__global__ void sendRoiImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, int baseIter, glm::ivec2 roiMin, glm::ivec2 roiExtent,
+	glm::vec3* image);
+#endif // ROI_ENABLE
+#if TEMPORAL_REPROJECTION_ENABLE
+__global__ void kernSaveReprojPositions(int num_paths,
+	ShadeableIntersectionSoA shadeableIntersections,
+	PathSegmentSoA pathSegments, glm::vec4* positions);
+__global__ void kernReprojectDepth(int pixelcount,
+	const glm::vec4* __restrict__ positions, Camera cam, unsigned int* depth);
+__global__ void kernReprojectResolve(int pixelcount,
+	const glm::vec4* __restrict__ positions,
+	const glm::vec3* __restrict__ prevImage, float prevIter, Camera cam,
+	const unsigned int* __restrict__ depth, glm::vec4* reprojected);
+__global__ void sendReprojectedImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, glm::vec3* image, const glm::vec4* __restrict__ reprojected);
+#endif // TEMPORAL_REPROJECTION_ENABLE
+#if HEATMAP_ENABLE
+__global__ void kernAccumulateBounceDepth(int nPaths, const int* activePaths,
+	const int* pixelIndices, int* bounceDepth);
+__global__ void sendHeatmapToPBO(uchar4* pbo, glm::ivec2 resolution,
+	int iter, int traceDepth, const int* bounceDepth);
+#endif // HEATMAP_ENABLE
+#if PATH_REGEN_ENABLE
+__global__ void sendImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	const int* doneSamples, glm::vec3* image);
+#endif // PATH_REGEN_ENABLE
+#if DENOISE_ENABLE
+__global__ void sendDenoisedImageToPBO(uchar4* pbo, glm::ivec2 resolution,
+	const glm::vec3* image);
+#endif // DENOISE_ENABLE
@@ -5,9 +5,14 @@
 
 GLuint positionLocation = 0;
 GLuint texcoordsLocation = 1;
-GLuint pbo;
+GLuint pbo[2];
 GLuint displayImage;
 
+// persistent CUDA registrations of the two PBOs, and which one CUDA
+// writes this frame; mainLoop flips the index after each displayed frame
+static cudaGraphicsResource_t pboResource[2] = { NULL, NULL };
+static int pboWriteIndex = 0;
+
 GLFWwindow *window;
 
 std::string currentTimeString() {
@@ -77,15 +82,16 @@ GLuint initShader() {
     return program;
 }
 
-void deletePBO(GLuint* pbo) {
-    if (pbo) {
-        // unregister this buffer object with CUDA
-        cudaGLUnregisterBufferObject(*pbo);
-
-        glBindBuffer(GL_ARRAY_BUFFER, *pbo);
-        glDeleteBuffers(1, pbo);
+void deletePBO() {
+    for (int i = 0; i < 2; i++) {
+        if (pbo[i]) {
+            // drop the persistent registration before the GL delete
+            cudaGraphicsUnregisterResource(pboResource[i]);
+            pboResource[i] = NULL;
 
-        *pbo = (GLuint)NULL;
+            glDeleteBuffers(1, &pbo[i]);
+            pbo[i] = (GLuint)NULL;
+        }
     }
 }
 
@@ -95,16 +101,17 @@ void deleteTexture(GLuint* tex) {
 }
 
 void cleanupCuda() {
-    if (pbo) {
-        deletePBO(&pbo);
-    }
+    deletePBO();
     if (displayImage) {
         deleteTexture(&displayImage);
     }
 }
 
 void initCuda() {
-    cudaGLSetGLDevice(0);
+    // the graphics-interop registration binds to whichever device owns the
+    // current GL context; no cudaGLSetGLDevice needed (it is deprecated
+    // along with the map/unmap-per-frame API this used to pair with)
+    cudaSetDevice(0);
 
     // Clean up on program exit
     atexit(cleanupCuda);
@@ -116,16 +123,33 @@ void initPBO() {
     int num_values = num_texels * 4;
     int size_tex_data = sizeof(GLubyte) * num_values;
 
-    // Generate a buffer ID called a PBO (Pixel Buffer Object)
-    glGenBuffers(1, &pbo);
-
-    // Make this the current UNPACK buffer (OpenGL is state-based)
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    // Two PBOs, registered with CUDA once for the life of the window:
+    // per-frame traffic is then a cheap map/unmap of one resource instead
+    // of the old register-map-sync of a single shared buffer
+    glGenBuffers(2, pbo);
+    for (int i = 0; i < 2; i++) {
+        // Make this the current UNPACK buffer (OpenGL is state-based)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+
+        // Allocate data for the buffer. 4-channel 8-bit image
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size_tex_data, NULL, GL_DYNAMIC_COPY);
+        // CUDA only ever writes the display image, never reads it back
+        cudaGraphicsGLRegisterBuffer(&pboResource[i], pbo[i],
+            cudaGraphicsRegisterFlagsWriteDiscard);
+    }
+}
 
-    // Allocate data for the buffer. 4-channel 8-bit image
-    glBufferData(GL_PIXEL_UNPACK_BUFFER, size_tex_data, NULL, GL_DYNAMIC_COPY);
-    cudaGLRegisterBufferObject(pbo);
+uchar4* pboMapForWrite() {
+    uchar4* dptr = NULL;
+    size_t size = 0;
+    cudaGraphicsMapResources(1, &pboResource[pboWriteIndex]);
+    cudaGraphicsResourceGetMappedPointer((void**)&dptr, &size,
+        pboResource[pboWriteIndex]);
+    return dptr;
+}
 
+void pboUnmapForWrite() {
+    cudaGraphicsUnmapResources(1, &pboResource[pboWriteIndex]);
 }
 
 void errorCallback(int error, const char* description) {
@@ -171,12 +195,17 @@ bool init() {
 void mainLoop() {
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
+        pathtraceTraceHostBegin("runCuda");
         runCuda();
+        pathtraceTraceHostEnd();
 
         string title = "CIS565 Path Tracer | " + utilityCore::convertIntToString(iteration) + " Iterations";
         glfwSetWindowTitle(window, title.c_str());
 
-        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        // texture from the buffer CUDA filled last frame, so the upload
+        // never stalls on kernels still writing the other one (the very
+        // first frame shows its cleared partner once)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[pboWriteIndex ^ 1]);
         glBindTexture(GL_TEXTURE_2D, displayImage);
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
         glClear(GL_COLOR_BUFFER_BIT);
@@ -184,6 +213,7 @@ void mainLoop() {
         // VAO, shader program, and texture already bound
         glDrawElements(GL_TRIANGLES, 6,  GL_UNSIGNED_SHORT, 0);
         glfwSwapBuffers(window);
+        pboWriteIndex ^= 1;
     }
     glfwDestroyWindow(window);
     glfwTerminate();
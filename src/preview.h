@@ -1,7 +1,21 @@
 #pragma once
 
-extern GLuint pbo;
+// double-buffered display PBOs: CUDA fills one while GL textures from the
+// other, swapped once per displayed frame (see pboMapForWrite)
+extern GLuint pbo[2];
 
 std::string currentTimeString();
 bool init();
 void mainLoop();
+
+/**
+ * Map this frame's write buffer for CUDA and return its device pointer.
+ * Registration is persistent (cudaGraphicsGLRegisterBuffer at init); this
+ * only maps. The two buffers ping-pong per displayed frame, so the GL
+ * texture upload reads last frame's buffer and never waits on the CUDA
+ * work still filling this one.
+ */
+uchar4* pboMapForWrite();
+
+/** Release the write buffer back to GL; it is displayed next frame. */
+void pboUnmapForWrite();
@@ -0,0 +1,172 @@
+#include "sahbvh.h"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+
+const int kNumBins = 16;
+
+struct TriRef {
+    TriangleIdx tri;
+    glm::vec3 lo;
+    glm::vec3 hi;
+    glm::vec3 centroid;
+};
+
+float surfaceArea(const glm::vec3& lo, const glm::vec3& hi) {
+    glm::vec3 d = glm::max(hi - lo, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+struct Builder {
+    std::vector<TriRef>& refs;
+    std::vector<LBVHNode>& nodes;
+    int base;  // absolute pool index of refs[0], for leaf triangleIndex
+
+    // Build the subtree over refs[first, last) and return its node index.
+    int build(int first, int last, int parent) {
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        glm::vec3 clo(FLT_MAX), chi(-FLT_MAX);
+        for (int i = first; i < last; i++) {
+            lo = glm::min(lo, refs[i].lo);
+            hi = glm::max(hi, refs[i].hi);
+            clo = glm::min(clo, refs[i].centroid);
+            chi = glm::max(chi, refs[i].centroid);
+        }
+
+        int nodeIndex = (int)nodes.size();
+        nodes.emplace_back();
+        nodes[nodeIndex].leftBottom = lo;
+        nodes[nodeIndex].rightTop = hi;
+        nodes[nodeIndex].parent = parent;
+        if (last - first == 1) {
+            // single-triangle leaf, matching the GPU LBVH's leaf arity
+            nodes[nodeIndex].left = -1;
+            nodes[nodeIndex].right = -1;
+            nodes[nodeIndex].triangleIndex = base + first;
+            return nodeIndex;
+        }
+
+        // binned SAH along the widest centroid axis; every candidate split
+        // puts whole bins left/right, cost = area * count on each side
+        glm::vec3 cext = chi - clo;
+        int axis = 0;
+        if (cext.y > cext.x) axis = 1;
+        if (cext.z > cext[axis]) axis = 2;
+
+        int mid = -1;
+        if (cext[axis] > 1e-7f) {
+            glm::vec3 binLo[kNumBins], binHi[kNumBins];
+            int binCount[kNumBins];
+            for (int b = 0; b < kNumBins; b++) {
+                binLo[b] = glm::vec3(FLT_MAX);
+                binHi[b] = glm::vec3(-FLT_MAX);
+                binCount[b] = 0;
+            }
+            float toBin = (float)kNumBins / cext[axis];
+            for (int i = first; i < last; i++) {
+                int b = std::min(kNumBins - 1,
+                    (int)((refs[i].centroid[axis] - clo[axis]) * toBin));
+                binLo[b] = glm::min(binLo[b], refs[i].lo);
+                binHi[b] = glm::max(binHi[b], refs[i].hi);
+                binCount[b]++;
+            }
+
+            // suffix sweep caches the right side of every candidate, the
+            // prefix sweep then scores them in one pass
+            float rightArea[kNumBins];
+            int rightCount[kNumBins];
+            glm::vec3 slo(FLT_MAX), shi(-FLT_MAX);
+            int scount = 0;
+            for (int b = kNumBins - 1; b > 0; b--) {
+                slo = glm::min(slo, binLo[b]);
+                shi = glm::max(shi, binHi[b]);
+                scount += binCount[b];
+                rightArea[b] = surfaceArea(slo, shi);
+                rightCount[b] = scount;
+            }
+            float bestCost = FLT_MAX;
+            int bestBin = -1;
+            glm::vec3 plo(FLT_MAX), phi(-FLT_MAX);
+            int pcount = 0;
+            for (int b = 1; b < kNumBins; b++) {
+                plo = glm::min(plo, binLo[b - 1]);
+                phi = glm::max(phi, binHi[b - 1]);
+                pcount += binCount[b - 1];
+                if (pcount == 0 || rightCount[b] == 0) {
+                    continue;
+                }
+                float cost = surfaceArea(plo, phi) * pcount
+                    + rightArea[b] * rightCount[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestBin = b;
+                }
+            }
+
+            if (bestBin >= 0) {
+                float splitPos = clo[axis] + bestBin / toBin;
+                TriRef* p = std::partition(refs.data() + first, refs.data() + last,
+                    [axis, splitPos](const TriRef& r) {
+                        return r.centroid[axis] < splitPos;
+                    });
+                mid = (int)(p - refs.data());
+            }
+        }
+        if (mid <= first || mid >= last) {
+            // degenerate centroids (or all in one bin): median split keeps
+            // the tree balanced instead of recursing on n-1 triangles
+            mid = first + (last - first) / 2;
+            std::nth_element(refs.data() + first, refs.data() + mid,
+                refs.data() + last,
+                [axis](const TriRef& a, const TriRef& b) {
+                    return a.centroid[axis] < b.centroid[axis];
+                });
+        }
+
+        // fill children after the recursive calls: they grow the node
+        // vector, so references into it would dangle
+        int left = build(first, mid, nodeIndex);
+        int right = build(mid, last, nodeIndex);
+        nodes[nodeIndex].left = left;
+        nodes[nodeIndex].right = right;
+        nodes[nodeIndex].triangleIndex = -1;
+        return nodeIndex;
+    }
+};
+
+}  // namespace
+
+int buildMeshSAHBVH(std::vector<TriangleIdx>& triangles,
+    const std::vector<glm::vec4>& vertices, Geom& geom,
+    std::vector<LBVHNode>& nodes) {
+    int first = geom.startIndex;
+    int count = geom.endIndex - geom.startIndex + 1;
+    if (count <= 0) {
+        geom.bvhRoot = -1;
+        return 0;
+    }
+
+    std::vector<TriRef> refs(count);
+    for (int i = 0; i < count; i++) {
+        const TriangleIdx& tri = triangles[first + i];
+        glm::vec3 a(vertices[tri.x]);
+        glm::vec3 b(vertices[tri.y]);
+        glm::vec3 c(vertices[tri.z]);
+        refs[i].tri = tri;
+        refs[i].lo = glm::min(a, glm::min(b, c));
+        refs[i].hi = glm::max(a, glm::max(b, c));
+        refs[i].centroid = (refs[i].lo + refs[i].hi) * 0.5f;
+    }
+
+    int before = (int)nodes.size();
+    Builder builder = { refs, nodes, first };
+    geom.bvhRoot = builder.build(0, count, -1);
+
+    // leaf triangleIndex points at the partitioned order; make it real
+    for (int i = 0; i < count; i++) {
+        triangles[first + i] = refs[i].tri;
+    }
+    return (int)nodes.size() - before;
+}
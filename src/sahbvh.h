@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+
+#include "sceneStructs.h"
+
+/**
+ * CPU binned-SAH BVH builder over the triangles of one mesh Geom, for the
+ * offline scene compiler. Drop-in replacement for the GPU LBVH: nodes use
+ * the same LBVHNode layout with absolute indices and single-triangle
+ * leaves, so meshIntersectionTest traverses both without knowing which
+ * builder produced the tree. The geom's triangle range is permuted in
+ * place so leaf triangleIndex stays valid. Much slower to build than
+ * Morton splits, but the better tree is the right trade once the build
+ * happens once per asset instead of once per run.
+ *
+ * @param triangles  Host triangle pool; [geom.startIndex, geom.endIndex]
+ *                   is reordered during the build.
+ * @param vertices   Vertex position pool the indices refer to.
+ * @param geom       bvhRoot is filled in (absolute index into `nodes`).
+ * @param nodes      Shared node buffer, appended to.
+ * @return           Number of nodes appended (2n-1 for n triangles).
+ */
+int buildMeshSAHBVH(std::vector<TriangleIdx>& triangles,
+    const std::vector<glm::vec4>& vertices, Geom& geom,
+    std::vector<LBVHNode>& nodes);
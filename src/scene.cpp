@@ -1,44 +1,415 @@
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <map>
+#include <random>
+#include <thread>
 #include "scene.h"
+#include "meshassembly.h"
+#include "nvtx.h"
 #include <cstring>
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtx/string_cast.hpp>
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include "tinyobj/tiny_obj_loader.h"
+// geometry-only glTF: image decoding stays out so the stb implementations
+// in stb.cpp remain the only ones in the binary
+#define TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_NO_STB_IMAGE
+#define TINYGLTF_NO_STB_IMAGE_WRITE
+#define TINYGLTF_NO_EXTERNAL_IMAGE
+#include "tinygltf/tiny_gltf.h"
+// declarations only; the implementation is compiled once in stb.cpp
+#include <stb_image.h>
 
-#define BUILD_RANDOM_SCENE 1
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// legacy escape hatch: force the procedural scene regardless of the file.
+// GENERATOR scene files are the supported way to reach the generator now.
+#define BUILD_RANDOM_SCENE 0
+
+// Process-shared scene cache: the first process to load a scene publishes
+// the fully preprocessed result (packed-scene format) into a POSIX
+// shared-memory segment keyed by the scene file's content hash; later
+// processes map it read-only and skip parsing, mesh loading and BVH
+// preprocessing entirely. Farm wrappers and artist scripts that launch a
+// fresh process per variant hit the same segment ten times instead of
+// parsing ten times, and the kernel keeps it resident between runs - no
+// daemon to run. Segments carry the publisher's watched-file list and are
+// revalidated against source modification times on attach, so editing any
+// input invalidates them; they cost /dev/shm (RAM) until reboot or
+// `rm /dev/shm/ptscene-*`. POSIX builds only.
+#define SCENE_SHM_CACHE_ENABLE 1
+
+#if SCENE_SHM_CACHE_ENABLE && !defined(_WIN32)
+static unsigned long long hashFileContents(const string& filename);
+#endif
+
+// ---------------------------------------------------------------------------
+// Minimal LZ4 block codec for the packed scene's geometry sections.
+// Spec-compatible block format (token / literals / little-endian offset /
+// match-length extension) with a greedy 4-byte-prefix hash matcher - a hair
+// short of the reference matcher's ratio, but self-contained, so farm nodes
+// build from this tree alone. Structured geometry lands around 2-3x
+// smaller, which is the difference that matters on network-mounted asset
+// storage where cold loads are I/O-bound.
+
+static inline unsigned int lz4Read32(const unsigned char* p) {
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static size_t lz4CompressBound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+static size_t lz4Compress(const unsigned char* src, size_t n, unsigned char* dst) {
+    std::vector<unsigned int> table(1 << 16, 0);  // position + 1; 0 = empty
+    size_t ip = 0, anchor = 0, op = 0;
+    // spec margins: no match may start within the final 12 bytes, and the
+    // final 5 bytes are always literals
+    size_t mflimit = n > 12 ? n - 12 : 0;
+    while (ip < mflimit) {
+        unsigned int hash = (lz4Read32(src + ip) * 2654435761u) >> 16;
+        size_t cand = table[hash];
+        table[hash] = (unsigned int)(ip + 1);
+        if (cand == 0 || ip + 1 - cand > 65535
+                || lz4Read32(src + cand - 1) != lz4Read32(src + ip)) {
+            ip++;
+            continue;
+        }
+        size_t match = cand - 1;
+        size_t matchLen = 4;
+        size_t matchLimit = n - 5;
+        while (ip + matchLen < matchLimit && src[match + matchLen] == src[ip + matchLen]) {
+            matchLen++;
+        }
+        size_t litLen = ip - anchor;
+        unsigned char* token = dst + op++;
+        if (litLen >= 15) {
+            *token = 15 << 4;
+            size_t rest = litLen - 15;
+            for (; rest >= 255; rest -= 255) {
+                dst[op++] = 255;
+            }
+            dst[op++] = (unsigned char)rest;
+        }
+        else {
+            *token = (unsigned char)(litLen << 4);
+        }
+        memcpy(dst + op, src + anchor, litLen);
+        op += litLen;
+        size_t offset = ip - match;
+        dst[op++] = (unsigned char)(offset & 0xff);
+        dst[op++] = (unsigned char)(offset >> 8);
+        size_t mlCode = matchLen - 4;
+        if (mlCode >= 15) {
+            *token |= 15;
+            mlCode -= 15;
+            for (; mlCode >= 255; mlCode -= 255) {
+                dst[op++] = 255;
+            }
+            dst[op++] = (unsigned char)mlCode;
+        }
+        else {
+            *token |= (unsigned char)mlCode;
+        }
+        ip += matchLen;
+        anchor = ip;
+    }
+    size_t litLen = n - anchor;
+    unsigned char* token = dst + op++;
+    if (litLen >= 15) {
+        *token = 15 << 4;
+        size_t rest = litLen - 15;
+        for (; rest >= 255; rest -= 255) {
+            dst[op++] = 255;
+        }
+        dst[op++] = (unsigned char)rest;
+    }
+    else {
+        *token = (unsigned char)(litLen << 4);
+    }
+    memcpy(dst + op, src + anchor, litLen);
+    op += litLen;
+    return op;
+}
+
+// Bounds-checked inflate; returns false on any malformed sequence or a
+// size mismatch, so a corrupt section reads as a load failure instead of
+// scribbling past the destination.
+static bool lz4Decompress(const unsigned char* src, size_t srcLen,
+        unsigned char* dst, size_t dstLen) {
+    size_t ip = 0, op = 0;
+    while (ip < srcLen) {
+        unsigned int token = src[ip++];
+        size_t litLen = token >> 4;
+        if (litLen == 15) {
+            unsigned int b;
+            do {
+                if (ip >= srcLen) {
+                    return false;
+                }
+                b = src[ip++];
+                litLen += b;
+            } while (b == 255);
+        }
+        if (ip + litLen > srcLen || op + litLen > dstLen) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip >= srcLen) {
+            break;  // final sequence carries no match
+        }
+        if (ip + 2 > srcLen) {
+            return false;
+        }
+        size_t offset = src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return false;
+        }
+        size_t matchLen = token & 15;
+        if (matchLen == 15) {
+            unsigned int b;
+            do {
+                if (ip >= srcLen) {
+                    return false;
+                }
+                b = src[ip++];
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += 4;
+        if (op + matchLen > dstLen) {
+            return false;
+        }
+        // byte-wise: offsets shorter than the match length overlap the
+        // bytes this very copy produces
+        const unsigned char* m = dst + op - offset;
+        for (size_t i = 0; i < matchLen; i++) {
+            dst[op + i] = m[i];
+        }
+        op += matchLen;
+    }
+    return op == dstLen;
+}
+
+// One geometry section on disk: an unsigned 64-bit stored-size prefix,
+// then either the LZ4 block (stored < raw) or the bytes verbatim
+// (stored == raw, for sections that did not compress).
+static void writePackedSection(FILE* f, const void* data, size_t bytes) {
+    std::vector<unsigned char> comp(lz4CompressBound(bytes));
+    size_t c = bytes > 0 ? lz4Compress((const unsigned char*)data, bytes, comp.data()) : 0;
+    unsigned long long stored = (c > 0 && c < bytes) ? c : (unsigned long long)bytes;
+    fwrite(&stored, sizeof(stored), 1, f);
+    fwrite((size_t)stored == bytes ? data : (const void*)comp.data(), 1, (size_t)stored, f);
+}
+
+#ifdef _WIN32
+// fread-path twin of the section reader: no mapping to share, so a
+// compressed blob takes one bounce through a scratch vector and inflates
+// into the destination array
+static bool readPackedSection(FILE* f, void* dst, size_t rawBytes) {
+    unsigned long long stored;
+    if (fread(&stored, sizeof(stored), 1, f) != 1 || stored > rawBytes) {
+        return false;
+    }
+    if ((size_t)stored == rawBytes) {
+        return rawBytes == 0 || fread(dst, 1, rawBytes, f) == rawBytes;
+    }
+    std::vector<unsigned char> comp((size_t)stored);
+    if (fread(comp.data(), 1, comp.size(), f) != comp.size()) {
+        return false;
+    }
+    return lz4Decompress(comp.data(), comp.size(), (unsigned char*)dst, rawBytes);
+}
+#endif
+
+// One section of the mapped load: raw sections copy inline, compressed
+// ones are handed to worker threads (see loadPacked)
+struct PackedSectionJob {
+    const unsigned char* src;
+    size_t storedBytes;
+    unsigned char* dst;
+    size_t rawBytes;
+    bool ok;
+};
+
+// Packed binary scene format: a fixed header followed by the Geom,
+// Material, vertex, normal and triangle arrays dumped exactly as
+// pathtraceInit uploads them, so loading is a map plus five bulk copies
+// and zero parsing. All startup preprocessing (transform matrices, mesh
+// AABBs) is baked in by the scene compiler. Raw host-layout structs: bump
+// the version whenever any of those structs (or Camera) changes.
+// v7: the vertex, normal, triangle and BVH-node sections - the bulk of
+// any geometry-heavy scene - are LZ4 block-compressed, each behind a
+// stored-size frame (see writePackedSection).
+// v8: Geom grew the ray-class visibility mask.
+static const unsigned int kPackedSceneVersion = 8;
+
+struct PackedSceneHeader {
+    char magic[4];  // "PTSC"
+    unsigned int version;
+    Camera camera;
+    int iterations;
+    int traceDepth;
+    char imageName[256];
+    int numGeoms;
+    int numMaterials;
+    int numVertices;
+    int numNormals;
+    int numTriangles;
+    // v2: offline SAH BVH nodes appended after the triangles; 0 for scenes
+    // compiled without trees (the GPU LBVH covers those at init)
+    int numBvhNodes;
+    // v4: equirect HDR environment map texels appended after the BVH
+    // nodes; both dimensions 0 for scenes without one
+    int envMapWidth;
+    int envMapHeight;
+    // v5: per-vertex texcoords appended after the environment map (always
+    // numVertices entries when nonzero), then numTextures albedo maps,
+    // each an int width / int height pair followed by its RGBA8 pixels
+    int numUvs;
+    int numTextures;
+    // v6: scene-wide homogeneous medium, zero coefficients when absent
+    Medium medium;
+};
+
+#if SCENE_SHM_CACHE_ENABLE && !defined(_WIN32)
+// Shared-memory cache segment layout: this header, numWatched
+// SharedSceneWatchedEntry records, then one packed-scene image
+// (PackedSceneHeader onward, exactly the file format). version is
+// written last - a reader seeing 0 caught a publisher mid-write and
+// treats the segment as a miss. Reuses kPackedSceneVersion, so a struct
+// bump invalidates stale segments the same way it invalidates files.
+struct SharedSceneHeader {
+    char magic[4];  // "PTSH"
+    unsigned int version;
+    unsigned long long packedBytes;
+    int numWatched;
+};
+
+struct SharedSceneWatchedEntry {
+    char path[256];
+    long long mtime;
+};
+#endif
+
+void Scene::watchFile(const string& filename) {
+    for (size_t i = 0; i < watchedFiles.size(); i++) {
+        if (watchedFiles[i].path == filename) {
+            return;
+        }
+    }
+    WatchedFile w;
+    w.path = filename;
+    w.mtime = utilityCore::fileModTime(filename);
+    watchedFiles.push_back(w);
+}
 
 Scene::Scene(string filename) {
+#if SCENE_SHM_CACHE_ENABLE && !defined(_WIN32)
+    // a prior process may have left this exact file's fully preprocessed
+    // scene in shared memory; attaching skips everything below
+    shmSceneKey = hashFileContents(filename);
+    if (shmSceneKey != 0 && attachSharedScene()) {
+        watchFile(filename);
+        return;
+    }
+#endif
+
+    // a packed scene short-circuits everything below: no text parsing, no
+    // OBJ re-parse, no preprocessing. Sniffed by magic, so the flag build
+    // and the farm can share command lines.
+    if (loadPacked(filename)) {
+        watchFile(filename);
+#if SCENE_SHM_CACHE_ENABLE && !defined(_WIN32)
+        publishSharedScene();
+#endif
+        return;
+    }
+
 #if BUILD_RANDOM_SCENE
-    buildRandomScene();
+    buildRandomScene(GeneratorParams());
     return;
 #endif
 
     cout << "Reading scene from " << filename << " ..." << endl;
     cout << " " << endl;
-    char* fname = (char*)filename.c_str();
-    fp_in.open(fname);
-    if (!fp_in.is_open()) {
-        cout << "Error reading from file - aborting!" << endl;
-        throw;
+    {
+        ifstream file(filename.c_str(), ios::binary);
+        if (!file.is_open()) {
+            cout << "Error reading from file - aborting!" << endl;
+            throw;
+        }
+        stringstream buffer;
+        buffer << file.rdbuf();
+        fp_in.str(buffer.str());
     }
+    watchFile(filename);
+    string line;
+    vector<utilityCore::Token> tokens;
+    NVTX_PUSH("parse scene %s", filename.c_str());
     while (fp_in.good()) {
-        string line;
         utilityCore::safeGetline(fp_in, line);
         if (!line.empty()) {
-            vector<string> tokens = utilityCore::tokenizeString(line);
-            if (strcmp(tokens[0].c_str(), "MATERIAL") == 0) {
-                loadMaterial(tokens[1]);
+            utilityCore::tokenizeLine(line, tokens);
+            if (tokens[0].equals("GENERATOR")) {
+                // procedural benchmark scene; directives follow, defaults
+                // reproduce the original hard-coded layout
+                NVTX_POP();
+                buildRandomScene(parseGenerator());
+#if SCENE_SHM_CACHE_ENABLE && !defined(_WIN32)
+                publishSharedScene();
+#endif
+                return;
+            }
+            if (tokens[0].equals("MATERIAL")) {
+                loadMaterial(tokens[1].toString());
                 cout << " " << endl;
-            } else if (strcmp(tokens[0].c_str(), "OBJECT") == 0) {
-                loadGeom(tokens[1]);
+            } else if (tokens[0].equals("OBJECT")) {
+                loadGeom(tokens[1].toString());
                 cout << " " << endl;
-            } else if (strcmp(tokens[0].c_str(), "CAMERA") == 0) {
+            } else if (tokens[0].equals("CAMERA")) {
                 loadCamera();
                 cout << " " << endl;
+            } else if (tokens[0].equals("ENVMAP")) {
+                loadEnvMap(tokens[1].toString());
+                cout << " " << endl;
+            } else if (tokens[0].equals("IMPORTANCE")) {
+                loadImportanceMap(tokens[1].toString());
+                cout << " " << endl;
+            } else if (tokens[0].equals("ANIMATION")) {
+                loadAnimation();
+                cout << " " << endl;
+            } else if (tokens[0].equals("VIEW")) {
+                loadView();
+                cout << " " << endl;
+            } else if (tokens[0].equals("MEDIUM")) {
+                loadMedium();
+                cout << " " << endl;
+            } else if (tokens[0].equals("PORTAL")) {
+                loadPortal();
+                cout << " " << endl;
             }
         }
     }
+    NVTX_POP();
+    dedupMaterials();
+    bakeStaticMeshTransforms();
+#if SCENE_SHM_CACHE_ENABLE && !defined(_WIN32)
+    publishSharedScene();
+#endif
 }
 
 int Scene::loadGeom(string objectid) {
@@ -57,6 +428,11 @@ int Scene::loadGeom(string objectid) {
             if (strcmp(line.c_str(), "sphere") == 0) {
                 cout << "Creating new sphere..." << endl;
                 newGeom.type = SPHERE;
+            } else if (strcmp(line.c_str(), "plane") == 0) {
+                // analytic infinite plane, y = 0 in object space; TRANS
+                // places it and ROTAT tilts it, SCALE is ignored
+                cout << "Creating new plane..." << endl;
+                newGeom.type = PLANE;
             } else if (strcmp(line.c_str(), "cube") == 0) {
                 cout << "Creating new cube..." << endl;
                 newGeom.type = CUBE;
@@ -65,16 +441,41 @@ int Scene::loadGeom(string objectid) {
                 newGeom.type = MESH;
                 utilityCore::safeGetline(fp_in, line);
                 if (!line.empty() && fp_in.good()) {
-                    loadObj(line, newGeom);
+                    // pick the loader by extension; glTF skips text
+                    // parsing and per-face assembly entirely
+                    size_t dot = line.find_last_of('.');
+                    string ext = dot == string::npos ? "" : line.substr(dot);
+                    map<string, MeshRange>::iterator cached = meshCache.find(line);
+                    if (cached != meshCache.end()) {
+                        // instance of an already-loaded mesh: share its
+                        // triangle range, keep this geom's own transform
+                        newGeom.startIndex = cached->second.startIndex;
+                        newGeom.endIndex = cached->second.endIndex;
+                        newGeom.leftBottom = cached->second.leftBottom;
+                        newGeom.rightTop = cached->second.rightTop;
+                    } else {
+                        if (ext == ".glb" || ext == ".gltf") {
+                            loadGltf(line, newGeom);
+                        } else {
+                            loadObj(line, newGeom);
+                        }
+                        MeshRange range;
+                        range.startIndex = newGeom.startIndex;
+                        range.endIndex = newGeom.endIndex;
+                        range.leftBottom = newGeom.leftBottom;
+                        range.rightTop = newGeom.rightTop;
+                        meshCache[line] = range;
+                    }
                 }
             }
         }
 
         //link material
+        vector<utilityCore::Token> tokens;
         utilityCore::safeGetline(fp_in, line);
         if (!line.empty() && fp_in.good()) {
-            vector<string> tokens = utilityCore::tokenizeString(line);
-            newGeom.materialid = atoi(tokens[1].c_str());
+            utilityCore::tokenizeLine(line, tokens);
+            newGeom.materialid = tokens[1].toInt();
             cout << "Connecting Geom " << objectid << " to Material " << newGeom.materialid << "..." << endl;
         }
 
@@ -82,18 +483,33 @@ int Scene::loadGeom(string objectid) {
         utilityCore::safeGetline(fp_in, line);
         newGeom.moving = false;
         while (!line.empty() && fp_in.good()) {
-            vector<string> tokens = utilityCore::tokenizeString(line);
+            utilityCore::tokenizeLine(line, tokens);
 
             //load tranformations
-            if (strcmp(tokens[0].c_str(), "TRANS") == 0) {
-                newGeom.translation = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
-            } else if (strcmp(tokens[0].c_str(), "ROTAT") == 0) {
-                newGeom.rotation = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
-            } else if (strcmp(tokens[0].c_str(), "SCALE") == 0) {
-                newGeom.scale = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
-            } else if (strcmp(tokens[0].c_str(), "MOTION") == 0) {
+            if (tokens[0].equals("TRANS")) {
+                newGeom.translation = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+            } else if (tokens[0].equals("ROTAT")) {
+                newGeom.rotation = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+            } else if (tokens[0].equals("SCALE")) {
+                newGeom.scale = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+            } else if (tokens[0].equals("MOTION")) {
                 newGeom.moving = true;
-                newGeom.target = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
+                newGeom.target = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+            } else if (tokens[0].equals("VISIBLE")) {
+                // ray classes that see this geom; listing any restricts it
+                // to exactly the listed ones (sceneStructs.h VisFlags)
+                newGeom.visibility = 0;
+                for (size_t t = 1; t < tokens.size(); t++) {
+                    if (tokens[t].equals("camera")) {
+                        newGeom.visibility |= VIS_CAMERA;
+                    } else if (tokens[t].equals("indirect")) {
+                        newGeom.visibility |= VIS_INDIRECT;
+                    } else if (tokens[t].equals("shadow")) {
+                        newGeom.visibility |= VIS_SHADOW;
+                    } else {
+                        cout << "ERROR: unknown VISIBLE class " << tokens[t].toString() << endl;
+                    }
+                }
             }
             utilityCore::safeGetline(fp_in, line);
         }
@@ -109,7 +525,122 @@ int Scene::loadGeom(string objectid) {
 }
 
 
+// Expand a 10-bit integer into 30 bits by inserting 2 zeros after each
+// bit; host twin of the LBVH builder's device version (lbvh.cu)
+static unsigned int expandBits(unsigned int v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code for a point in [0,1]^3.
+static unsigned int morton3D(glm::vec3 p) {
+    float x = glm::min(glm::max(p.x * 1024.0f, 0.0f), 1023.0f);
+    float y = glm::min(glm::max(p.y * 1024.0f, 0.0f), 1023.0f);
+    float z = glm::min(glm::max(p.z * 1024.0f, 0.0f), 1023.0f);
+    return expandBits((unsigned int)x) * 4 + expandBits((unsigned int)y) * 2
+        + expandBits((unsigned int)z);
+}
+
+static bool mortonKeyLess(const std::pair<unsigned int, TriangleIdx>& a,
+        const std::pair<unsigned int, TriangleIdx>& b) {
+    return a.first < b.first;
+}
+
+// Post-load cleanup shared by the OBJ and glTF importers, confined to the
+// ranges the mesh just appended: weld bit-identical (position, normal)
+// vertices that arrived under different file indices, drop zero-area
+// triangles before they can reach the intersection loop, and reorder the
+// survivors along a Morton curve of their centroids so triangles that
+// are neighbors in space sit in neighboring dev_triangles entries - the
+// linear mesh scan reads them in bursts, and BVH leaves inherit the
+// locality too. Runs before the next mesh loads, so shrinking the pools
+// never moves anyone else's range.
+void Scene::finalizeMesh(Geom& geom, size_t vertexBase) {
+    if ((size_t)geom.startIndex >= triangles.size()) {
+        return;
+    }
+    size_t vertexCount = vertices.size() - vertexBase;
+
+    // exact bit-match keys (position, normal, texcoord), so welding never
+    // moves any attribute
+    std::vector<int> remap(vertexCount);
+    std::vector<glm::vec4> weldedVerts;
+    std::vector<glm::vec4> weldedNorms;
+    std::vector<glm::vec2> weldedUvs;
+    weldedVerts.reserve(vertexCount);
+    weldedNorms.reserve(vertexCount);
+    weldedUvs.reserve(vertexCount);
+    std::map<std::array<unsigned int, 8>, int> welded;
+    for (size_t i = 0; i < vertexCount; i++) {
+        std::array<unsigned int, 8> key;
+        std::memcpy(&key[0], &vertices[vertexBase + i], 3 * sizeof(float));
+        std::memcpy(&key[3], &normals[vertexBase + i], 3 * sizeof(float));
+        std::memcpy(&key[6], &uvs[vertexBase + i], 2 * sizeof(float));
+        std::map<std::array<unsigned int, 8>, int>::iterator it = welded.find(key);
+        if (it != welded.end()) {
+            remap[i] = it->second;
+            continue;
+        }
+        remap[i] = (int)weldedVerts.size();
+        welded[key] = remap[i];
+        weldedVerts.push_back(vertices[vertexBase + i]);
+        weldedNorms.push_back(normals[vertexBase + i]);
+        weldedUvs.push_back(uvs[vertexBase + i]);
+    }
+    size_t weldedAway = vertexCount - weldedVerts.size();
+    if (weldedAway > 0) {
+        std::copy(weldedVerts.begin(), weldedVerts.end(), vertices.begin() + vertexBase);
+        std::copy(weldedNorms.begin(), weldedNorms.end(), normals.begin() + vertexBase);
+        std::copy(weldedUvs.begin(), weldedUvs.end(), uvs.begin() + vertexBase);
+        vertices.resize(vertexBase + weldedVerts.size());
+        normals.resize(vertexBase + weldedNorms.size());
+        uvs.resize(vertexBase + weldedUvs.size());
+    }
+
+    // rebase indices through the weld, prune degenerates, and key the
+    // survivors by the Morton code of their centroid in the mesh bounds
+    glm::vec3 extent = glm::max(geom.rightTop - geom.leftBottom, glm::vec3(1e-6f));
+    std::vector<std::pair<unsigned int, TriangleIdx> > keyed;
+    keyed.reserve(triangles.size() - geom.startIndex);
+    size_t dropped = 0;
+    for (size_t f = geom.startIndex; f < triangles.size(); f++) {
+        TriangleIdx t = triangles[f];
+        t.x = (int)vertexBase + remap[t.x - vertexBase];
+        t.y = (int)vertexBase + remap[t.y - vertexBase];
+        t.z = (int)vertexBase + remap[t.z - vertexBase];
+        glm::vec3 a(vertices[t.x]);
+        glm::vec3 b(vertices[t.y]);
+        glm::vec3 c(vertices[t.z]);
+        glm::vec3 cross = glm::cross(b - a, c - a);
+        // != rather than > drops exact zeros and NaNs but keeps slivers,
+        // which are thin yet still legitimate geometry
+        if (!(glm::dot(cross, cross) > 0.0f)) {
+            dropped++;
+            continue;
+        }
+        glm::vec3 centroid = (a + b + c) / 3.0f;
+        keyed.push_back(std::make_pair(
+            morton3D((centroid - geom.leftBottom) / extent), t));
+    }
+    std::stable_sort(keyed.begin(), keyed.end(), mortonKeyLess);
+    for (size_t i = 0; i < keyed.size(); i++) {
+        triangles[geom.startIndex + i] = keyed[i].second;
+    }
+    triangles.resize(geom.startIndex + keyed.size());
+    geom.endIndex = (int)triangles.size() - 1;
+
+    if (weldedAway > 0 || dropped > 0) {
+        cout << "Mesh cleanup: welded " << weldedAway << " vertices, dropped "
+             << dropped << " degenerate triangles" << endl;
+    }
+}
+
 bool Scene::loadObj(string filename, Geom& geom) {
+    NVTX_PUSH("loadObj %s", filename.c_str());
+    watchFile(filename);
     tinyobj::attrib_t attrib;
     vector<tinyobj::shape_t> shapes;
     vector<tinyobj::material_t> materials;
@@ -135,54 +666,349 @@ bool Scene::loadObj(string filename, Geom& geom) {
     geom.leftBottom = glm::vec3(1000000);
     geom.rightTop = glm::vec3(-1000000);
 
-    // Loop over shapes
+    // flatten (shape, face) so threads can carve contiguous face ranges;
+    // this pass only accumulates offsets, no per-vertex work
+    struct FaceRef {
+        int shape;
+        int indexOffset;
+    };
+    std::vector<FaceRef> faces;
+    size_t totalFaces = 0;
     for (size_t s = 0; s < shapes.size(); s++) {
-        // Loop over faces(polygon)
-        size_t index_offset = 0;
+        totalFaces += shapes[s].mesh.num_face_vertices.size();
+    }
+    faces.reserve(totalFaces);
+    for (size_t s = 0; s < shapes.size(); s++) {
+        int indexOffset = 0;
         for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            Triangle t;
-
-            int fv = shapes[s].mesh.num_face_vertices[f];
-            tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + 0];
-            glm::vec3 p1(attrib.vertices[3 * idx.vertex_index + 0], attrib.vertices[3 * idx.vertex_index + 1], attrib.vertices[3 * idx.vertex_index + 2]);
-            t.p1 = p1;
-            if (attrib.normals.size() > 0) {
-                t.n1 = glm::vec3(attrib.normals[3 * idx.normal_index + 0], attrib.normals[3 * idx.normal_index + 1], attrib.normals[3 * idx.normal_index + 2]);
+            FaceRef ref;
+            ref.shape = (int)s;
+            ref.indexOffset = indexOffset;
+            faces.push_back(ref);
+            indexOffset += shapes[s].mesh.num_face_vertices[f];
+        }
+    }
+    if (totalFaces == 0) {
+        geom.endIndex = triangles.size() - 1;
+        NVTX_POP();
+        return ret;
+    }
+
+    const size_t vertexBase = vertices.size();
+
+    // Big meshes assemble on the device instead: corner index pairs are
+    // the only host-side pass, then dedup, gather, bounds and normal
+    // generation run as kernels (meshassembly.cu). Any failure - no GPU,
+    // no memory - falls through to the shard threads below. Meshes with
+    // texcoords take the host path too: the assembly kernels pool on
+    // (position, normal) pairs only, and teaching them a third stream is
+    // not worth it for the few big textured OBJs we see.
+    if (totalFaces >= GPU_MESH_ASSEMBLY_MIN_FACES && attrib.texcoords.empty()) {
+        std::vector<glm::ivec2> corners;
+        corners.reserve(3 * totalFaces);
+        for (size_t fi = 0; fi < totalFaces; fi++) {
+            const tinyobj::mesh_t& mesh = shapes[faces[fi].shape].mesh;
+            for (int v = 0; v < 3; v++) {
+                tinyobj::index_t idx = mesh.indices[faces[fi].indexOffset + v];
+                corners.push_back(glm::ivec2(idx.vertex_index,
+                    attrib.normals.size() > 0 ? idx.normal_index : -1));
             }
-            geom.leftBottom = glm::min(geom.leftBottom, p1);
-            geom.rightTop = glm::max(geom.rightTop, p1);
-
-            idx = shapes[s].mesh.indices[index_offset + 1];
-            glm::vec3 p2(attrib.vertices[3 * idx.vertex_index + 0], attrib.vertices[3 * idx.vertex_index + 1], attrib.vertices[3 * idx.vertex_index + 2]);
-            t.p2 = p2;
-            if (attrib.normals.size() > 0) {
-                t.n2 = glm::vec3(attrib.normals[3 * idx.normal_index + 0], attrib.normals[3 * idx.normal_index + 1], attrib.normals[3 * idx.normal_index + 2]);
+        }
+        if (meshAssembleOnDevice(attrib.vertices.data(),
+                attrib.vertices.size() / 3, attrib.normals.data(),
+                attrib.normals.size() / 3, corners.data(), totalFaces,
+                vertices, normals, triangles,
+                geom.leftBottom, geom.rightTop)) {
+            uvs.resize(vertices.size(), glm::vec2(0.0f));
+            geom.endIndex = triangles.size() - 1;
+            finalizeMesh(geom, vertexBase);
+            NVTX_POP();
+            return ret;
+        }
+    }
+
+    // Each thread assembles a face range into its own buffers with its own
+    // dedup map and bounds; triangle indices are local to the thread's
+    // vertex pool and rebased in the ordered append below. A corner shared
+    // between two threads' ranges is pooled once per thread instead of
+    // once overall - a small size cost for zero cross-thread
+    // synchronization in the hot loop.
+    struct Shard {
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::vec4> normals;
+        std::vector<glm::vec2> uvs;
+        std::vector<TriangleIdx> triangles;
+        glm::vec3 leftBottom;
+        glm::vec3 rightTop;
+    };
+    size_t nThreads = std::max((size_t)1,
+        std::min((size_t)std::thread::hardware_concurrency(), totalFaces));
+    std::vector<Shard> shards(nThreads);
+    size_t facesPerThread = (totalFaces + nThreads - 1) / nThreads;
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < nThreads; w++) {
+        size_t f0 = w * facesPerThread;
+        size_t f1 = std::min(totalFaces, f0 + facesPerThread);
+        workers.emplace_back([&attrib, &shapes, &faces, f0, f1](Shard& shard) {
+            shard.leftBottom = glm::vec3(1000000);
+            shard.rightTop = glm::vec3(-1000000);
+            shard.vertices.reserve((f1 - f0) * 3);
+            shard.normals.reserve((f1 - f0) * 3);
+            shard.uvs.reserve((f1 - f0) * 3);
+            shard.triangles.reserve(f1 - f0);
+
+            // map each distinct (position, normal, texcoord) triple to one
+            // pooled vertex so corners shared between faces are stored
+            // once instead of once per face
+            std::map<std::array<int, 3>, int> pooled;
+
+            for (size_t fi = f0; fi < f1; fi++) {
+                const tinyobj::mesh_t& mesh = shapes[faces[fi].shape].mesh;
+                int index_offset = faces[fi].indexOffset;
+                TriangleIdx t(0);
+                glm::vec3 p[3];
+
+                for (int v = 0; v < 3; v++) {
+                    tinyobj::index_t idx = mesh.indices[index_offset + v];
+                    p[v] = glm::vec3(attrib.vertices[3 * idx.vertex_index + 0], attrib.vertices[3 * idx.vertex_index + 1], attrib.vertices[3 * idx.vertex_index + 2]);
+                    shard.leftBottom = glm::min(shard.leftBottom, p[v]);
+                    shard.rightTop = glm::max(shard.rightTop, p[v]);
+
+                    // OBJ vt puts v = 0 at the bottom of the image; flip it
+                    // so texture fetches address rows top-down
+                    int uvIndex = attrib.texcoords.size() > 0 ? idx.texcoord_index : -1;
+                    glm::vec2 uv = uvIndex >= 0
+                        ? glm::vec2(attrib.texcoords[2 * uvIndex + 0], 1.0f - attrib.texcoords[2 * uvIndex + 1])
+                        : glm::vec2(0.0f);
+
+                    if (attrib.normals.size() > 0) {
+                        std::array<int, 3> key = { idx.vertex_index, idx.normal_index, uvIndex };
+                        std::map<std::array<int, 3>, int>::iterator it = pooled.find(key);
+                        if (it != pooled.end()) {
+                            t[v] = it->second;
+                            continue;
+                        }
+                        t[v] = shard.vertices.size();
+                        pooled[key] = t[v];
+                        shard.vertices.push_back(glm::vec4(p[v], 0.0f));
+                        shard.normals.push_back(glm::vec4(attrib.normals[3 * idx.normal_index + 0], attrib.normals[3 * idx.normal_index + 1], attrib.normals[3 * idx.normal_index + 2], 0.0f));
+                        shard.uvs.push_back(uv);
+                    }
+                    else {
+                        // the generated face normal differs per face, so
+                        // these entries cannot be shared; filled in below
+                        t[v] = shard.vertices.size();
+                        shard.vertices.push_back(glm::vec4(p[v], 0.0f));
+                        shard.normals.push_back(glm::vec4(0.0f));
+                        shard.uvs.push_back(uv);
+                    }
+                }
+
+                if (attrib.normals.size() <= 0) {
+                    glm::vec4 n(glm::normalize(glm::cross(p[1] - p[0], p[2] - p[1])), 0.0f);
+                    shard.normals[t.x] = n;
+                    shard.normals[t.y] = n;
+                    shard.normals[t.z] = n;
+                }
+
+                shard.triangles.push_back(t);
             }
-            geom.leftBottom = glm::min(geom.leftBottom, p2);
-            geom.rightTop = glm::max(geom.rightTop, p2);
-
-            idx = shapes[s].mesh.indices[index_offset + 2];
-            glm::vec3 p3(attrib.vertices[3 * idx.vertex_index + 0], attrib.vertices[3 * idx.vertex_index + 1], attrib.vertices[3 * idx.vertex_index + 2]);
-            t.p3 = p3;
-            if (attrib.normals.size() > 0) {
-                t.n3 = glm::vec3(attrib.normals[3 * idx.normal_index + 0], attrib.normals[3 * idx.normal_index + 1], attrib.normals[3 * idx.normal_index + 2]);
+        }, std::ref(shards[w]));
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+
+    // ordered append keeps the global face order of the sequential loader;
+    // reserve from the exact totals so the big vectors reallocate once
+    size_t vertexTotal = 0;
+    for (const Shard& shard : shards) {
+        vertexTotal += shard.vertices.size();
+    }
+    vertices.reserve(vertices.size() + vertexTotal);
+    normals.reserve(normals.size() + vertexTotal);
+    uvs.reserve(uvs.size() + vertexTotal);
+    triangles.reserve(triangles.size() + totalFaces);
+    for (const Shard& shard : shards) {
+        int base = (int)vertices.size();
+        vertices.insert(vertices.end(), shard.vertices.begin(), shard.vertices.end());
+        normals.insert(normals.end(), shard.normals.begin(), shard.normals.end());
+        uvs.insert(uvs.end(), shard.uvs.begin(), shard.uvs.end());
+        for (TriangleIdx t : shard.triangles) {
+            t.x += base;
+            t.y += base;
+            t.z += base;
+            triangles.push_back(t);
+        }
+        geom.leftBottom = glm::min(geom.leftBottom, shard.leftBottom);
+        geom.rightTop = glm::max(geom.rightTop, shard.rightTop);
+    }
+    geom.endIndex = triangles.size() - 1;
+    finalizeMesh(geom, vertexBase);
+    NVTX_POP();
+    return ret;
+}
+
+// glTF mesh import. The file is already indexed the way the device wants
+// it, so there is no tokenization and no dedup map: positions, normals and
+// indices come straight out of the binary buffers in bulk, with only the
+// vec3 -> vec4 widening our pooled layout requires. Bounds come from the
+// accessor min/max when the exporter wrote them, which skips the per-vertex
+// scan as well.
+bool Scene::loadGltf(string filename, Geom& geom) {
+    NVTX_PUSH("loadGltf %s", filename.c_str());
+    watchFile(filename);
+    tinygltf::Model model;
+    tinygltf::TinyGLTF loader;
+    string warn;
+    string err;
+
+    bool ret = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".glb") == 0
+        ? loader.LoadBinaryFromFile(&model, &err, &warn, filename)
+        : loader.LoadASCIIFromFile(&model, &err, &warn, filename);
+
+    if (!warn.empty()) {
+        std::cout << warn << std::endl;
+    }
+    if (!err.empty()) {
+        std::cerr << err << std::endl;
+    }
+    if (!ret) {
+        exit(1);
+    }
+
+    geom.startIndex = triangles.size();
+    geom.leftBottom = glm::vec3(1000000);
+    geom.rightTop = glm::vec3(-1000000);
+    const size_t vertexBase = vertices.size();
+
+    for (const tinygltf::Mesh& mesh : model.meshes) {
+        for (const tinygltf::Primitive& prim : mesh.primitives) {
+            if (prim.mode != TINYGLTF_MODE_TRIANGLES
+                || prim.attributes.count("POSITION") == 0) {
+                std::cout << "Skipping non-triangle or position-less primitive in "
+                          << filename << std::endl;
+                continue;
+            }
+
+            const tinygltf::Accessor& pos = model.accessors[prim.attributes.at("POSITION")];
+            const tinygltf::BufferView& posView = model.bufferViews[pos.bufferView];
+            const unsigned char* posData = model.buffers[posView.buffer].data.data()
+                + posView.byteOffset + pos.byteOffset;
+            int posStride = pos.ByteStride(posView);
+
+            int base = (int)vertices.size();
+            vertices.reserve(base + pos.count);
+            normals.reserve(base + pos.count);
+            for (size_t i = 0; i < pos.count; i++) {
+                const float* p = (const float*)(posData + i * posStride);
+                vertices.push_back(glm::vec4(p[0], p[1], p[2], 0.0f));
             }
-            geom.leftBottom = glm::min(geom.leftBottom, p3);
-            geom.rightTop = glm::max(geom.rightTop, p3);
-
-            if (attrib.normals.size() <= 0) {
-                glm::vec3 n1 = glm::normalize(glm::cross(t.p2 - t.p1, t.p3 - t.p2));
-                t.n1 = n1;
-                t.n2 = n1;
-                t.n3 = n1;
+            if (pos.minValues.size() == 3 && pos.maxValues.size() == 3) {
+                geom.leftBottom = glm::min(geom.leftBottom,
+                    glm::vec3(pos.minValues[0], pos.minValues[1], pos.minValues[2]));
+                geom.rightTop = glm::max(geom.rightTop,
+                    glm::vec3(pos.maxValues[0], pos.maxValues[1], pos.maxValues[2]));
+            } else {
+                for (size_t i = 0; i < pos.count; i++) {
+                    glm::vec3 p(vertices[base + i]);
+                    geom.leftBottom = glm::min(geom.leftBottom, p);
+                    geom.rightTop = glm::max(geom.rightTop, p);
+                }
             }
 
-            index_offset += fv;
+            bool hasNormals = prim.attributes.count("NORMAL") > 0;
+            if (hasNormals) {
+                const tinygltf::Accessor& nrm = model.accessors[prim.attributes.at("NORMAL")];
+                const tinygltf::BufferView& nrmView = model.bufferViews[nrm.bufferView];
+                const unsigned char* nrmData = model.buffers[nrmView.buffer].data.data()
+                    + nrmView.byteOffset + nrm.byteOffset;
+                int nrmStride = nrm.ByteStride(nrmView);
+                for (size_t i = 0; i < nrm.count; i++) {
+                    const float* n = (const float*)(nrmData + i * nrmStride);
+                    normals.push_back(glm::vec4(n[0], n[1], n[2], 0.0f));
+                }
+            } else {
+                normals.resize(vertices.size(), glm::vec4(0.0f));
+            }
 
-            triangles.push_back(t);
+            // glTF texcoords are already top-down; anything but the float
+            // encoding (normalized shorts etc.) just shades untextured
+            if (prim.attributes.count("TEXCOORD_0") > 0
+                && model.accessors[prim.attributes.at("TEXCOORD_0")].componentType
+                    == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+                const tinygltf::Accessor& tc = model.accessors[prim.attributes.at("TEXCOORD_0")];
+                const tinygltf::BufferView& tcView = model.bufferViews[tc.bufferView];
+                const unsigned char* tcData = model.buffers[tcView.buffer].data.data()
+                    + tcView.byteOffset + tc.byteOffset;
+                int tcStride = tc.ByteStride(tcView);
+                for (size_t i = 0; i < tc.count; i++) {
+                    const float* u = (const float*)(tcData + i * tcStride);
+                    uvs.push_back(glm::vec2(u[0], u[1]));
+                }
+            }
+            uvs.resize(vertices.size(), glm::vec2(0.0f));
+
+            size_t firstTriangle = triangles.size();
+            if (prim.indices >= 0) {
+                const tinygltf::Accessor& idx = model.accessors[prim.indices];
+                const tinygltf::BufferView& idxView = model.bufferViews[idx.bufferView];
+                const unsigned char* idxData = model.buffers[idxView.buffer].data.data()
+                    + idxView.byteOffset + idx.byteOffset;
+                triangles.reserve(triangles.size() + idx.count / 3);
+                for (size_t i = 0; i + 2 < idx.count; i += 3) {
+                    TriangleIdx t(0);
+                    for (int v = 0; v < 3; v++) {
+                        size_t j = i + v;
+                        int index;
+                        if (idx.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
+                            index = (int)((const unsigned int*)idxData)[j];
+                        } else if (idx.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+                            index = ((const unsigned short*)idxData)[j];
+                        } else {
+                            index = ((const unsigned char*)idxData)[j];
+                        }
+                        t[v] = base + index;
+                    }
+                    triangles.push_back(t);
+                }
+            } else {
+                // unindexed primitive: consecutive position triplets
+                triangles.reserve(triangles.size() + pos.count / 3);
+                for (size_t i = 0; i + 2 < pos.count; i += 3) {
+                    triangles.push_back(TriangleIdx(base + (int)i,
+                        base + (int)i + 1, base + (int)i + 2, 0));
+                }
+            }
+
+            if (!hasNormals) {
+                // accumulate face normals onto the shared vertices, then
+                // normalize: smooth shading without breaking the indexing
+                for (size_t f = firstTriangle; f < triangles.size(); f++) {
+                    TriangleIdx t = triangles[f];
+                    glm::vec3 a(vertices[t.x]);
+                    glm::vec3 b(vertices[t.y]);
+                    glm::vec3 c(vertices[t.z]);
+                    glm::vec4 n(glm::cross(b - a, c - b), 0.0f);
+                    normals[t.x] += n;
+                    normals[t.y] += n;
+                    normals[t.z] += n;
+                }
+                for (size_t i = base; i < normals.size(); i++) {
+                    glm::vec3 n(normals[i]);
+                    float len = glm::length(n);
+                    normals[i] = len > 0.0f ? glm::vec4(n / len, 0.0f) : glm::vec4(0, 1, 0, 0);
+                }
+            }
         }
     }
+
     geom.endIndex = triangles.size() - 1;
+    finalizeMesh(geom, vertexBase);
+    cout << "Loaded glTF mesh " << filename << ": "
+         << geom.endIndex - geom.startIndex + 1 << " triangles" << endl;
+    NVTX_POP();
+    return true;
 }
 
 int Scene::loadCamera() {
@@ -192,34 +1018,34 @@ int Scene::loadCamera() {
     float fovy;
 
     //load static properties
+    string line;
+    vector<utilityCore::Token> tokens;
     for (int i = 0; i < 5; i++) {
-        string line;
         utilityCore::safeGetline(fp_in, line);
-        vector<string> tokens = utilityCore::tokenizeString(line);
-        if (strcmp(tokens[0].c_str(), "RES") == 0) {
-            camera.resolution.x = atoi(tokens[1].c_str());
-            camera.resolution.y = atoi(tokens[2].c_str());
-        } else if (strcmp(tokens[0].c_str(), "FOVY") == 0) {
-            fovy = atof(tokens[1].c_str());
-        } else if (strcmp(tokens[0].c_str(), "ITERATIONS") == 0) {
-            state.iterations = atoi(tokens[1].c_str());
-        } else if (strcmp(tokens[0].c_str(), "DEPTH") == 0) {
-            state.traceDepth = atoi(tokens[1].c_str());
-        } else if (strcmp(tokens[0].c_str(), "FILE") == 0) {
-            state.imageName = tokens[1];
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("RES")) {
+            camera.resolution.x = tokens[1].toInt();
+            camera.resolution.y = tokens[2].toInt();
+        } else if (tokens[0].equals("FOVY")) {
+            fovy = tokens[1].toFloat();
+        } else if (tokens[0].equals("ITERATIONS")) {
+            state.iterations = tokens[1].toInt();
+        } else if (tokens[0].equals("DEPTH")) {
+            state.traceDepth = tokens[1].toInt();
+        } else if (tokens[0].equals("FILE")) {
+            state.imageName = tokens[1].toString();
         }
     }
 
-    string line;
     utilityCore::safeGetline(fp_in, line);
     while (!line.empty() && fp_in.good()) {
-        vector<string> tokens = utilityCore::tokenizeString(line);
-        if (strcmp(tokens[0].c_str(), "EYE") == 0) {
-            camera.position = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
-        } else if (strcmp(tokens[0].c_str(), "LOOKAT") == 0) {
-            camera.lookAt = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
-        } else if (strcmp(tokens[0].c_str(), "UP") == 0) {
-            camera.up = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("EYE")) {
+            camera.position = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("LOOKAT")) {
+            camera.lookAt = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("UP")) {
+            camera.up = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
         }
 
         utilityCore::safeGetline(fp_in, line);
@@ -235,6 +1061,11 @@ int Scene::loadCamera() {
 	camera.pixelLength = glm::vec2(2 * xscaled / (float)camera.resolution.x
 							, 2 * yscaled / (float)camera.resolution.y);
 
+    // full frame by default; the distributed tile mode narrows the
+    // resolution to a crop window and sets the offset (see distributed.cpp)
+    camera.cropOffset = glm::ivec2(0, 0);
+    camera.fullResolution = camera.resolution;
+
     camera.view = glm::normalize(camera.lookAt - camera.position);
 
     //set up render camera stuff
@@ -246,6 +1077,159 @@ int Scene::loadCamera() {
     return 1;
 }
 
+int Scene::loadAnimation() {
+    cout << "Loading Animation ..." << endl;
+    string line;
+    vector<utilityCore::Token> tokens;
+    utilityCore::safeGetline(fp_in, line);
+    while (!line.empty() && fp_in.good()) {
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("FRAMES")) {
+            state.frames = std::max(tokens[1].toInt(), 1);
+        } else if (tokens[0].equals("EYE_END")) {
+            state.eyeEnd = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+            state.animateCamera = true;
+        } else if (tokens[0].equals("LOOKAT_END")) {
+            state.lookAtEnd = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+            state.animateCamera = true;
+        }
+        utilityCore::safeGetline(fp_in, line);
+    }
+    cout << "Loaded animation: " << state.frames << " frames" << endl;
+    return 1;
+}
+
+// One extra camera pose for a multi-view batch render. The block must
+// follow the CAMERA block: the view starts as a copy of it (resolution,
+// fov, pixel pitch, crop) and only EYE/LOOKAT/UP override, which is all a
+// product-shot template varies between angles.
+int Scene::loadView() {
+    cout << "Loading View " << state.views.size() << "..." << endl;
+    Camera camera = state.camera;
+    string line;
+    vector<utilityCore::Token> tokens;
+    utilityCore::safeGetline(fp_in, line);
+    while (!line.empty() && fp_in.good()) {
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("EYE")) {
+            camera.position = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("LOOKAT")) {
+            camera.lookAt = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("UP")) {
+            camera.up = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        }
+        utilityCore::safeGetline(fp_in, line);
+    }
+    camera.view = glm::normalize(camera.lookAt - camera.position);
+    camera.right = glm::normalize(glm::cross(camera.view, camera.up));
+    state.views.push_back(camera);
+    cout << "Loaded view!" << endl;
+    return 1;
+}
+
+int Scene::loadMedium() {
+    cout << "Loading Medium ..." << endl;
+    string line;
+    vector<utilityCore::Token> tokens;
+    utilityCore::safeGetline(fp_in, line);
+    while (!line.empty() && fp_in.good()) {
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("SCATTER")) {
+            medium.sigmaS = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("ABSORB")) {
+            medium.sigmaA = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("ANISO")) {
+            // g walks into a singular phase function at +-1
+            medium.g = glm::clamp(tokens[1].toFloat(), -0.99f, 0.99f);
+        }
+        utilityCore::safeGetline(fp_in, line);
+    }
+    cout << "Loaded medium: scatter " << glm::to_string(medium.sigmaS)
+         << ", absorb " << glm::to_string(medium.sigmaA)
+         << ", g " << medium.g << endl;
+    return 1;
+}
+
+int Scene::loadPortal() {
+    cout << "Loading Portal ..." << endl;
+    string line;
+    vector<utilityCore::Token> tokens;
+    glm::vec3 translation(0.0f);
+    glm::vec3 rotation(0.0f);
+    glm::vec3 scale(1.0f);
+    utilityCore::safeGetline(fp_in, line);
+    while (!line.empty() && fp_in.good()) {
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("TRANS")) {
+            translation = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("ROTAT")) {
+            rotation = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        } else if (tokens[0].equals("SCALE")) {
+            scale = glm::vec3(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
+        }
+        utilityCore::safeGetline(fp_in, line);
+    }
+    // the portal is the unit square [-0.5, 0.5]^2 in the local xy plane,
+    // transformed like a geom; only the rectangle matters, so the z scale
+    // is ignored
+    glm::mat4 transform = utilityCore::buildTransformationMatrix(translation, rotation, scale);
+    Portal portal;
+    portal.corner = glm::vec3(transform * glm::vec4(-0.5f, -0.5f, 0.0f, 1.0f));
+    portal.edgeU = glm::vec3(transform * glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
+    portal.edgeV = glm::vec3(transform * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
+    glm::vec3 crossUV = glm::cross(portal.edgeU, portal.edgeV);
+    portal.area = glm::length(crossUV);
+    if (portal.area <= 0.0f) {
+        cout << "ERROR: PORTAL has zero area - skipping it" << endl;
+        return -1;
+    }
+    portal.normal = crossUV / portal.area;
+    portals.push_back(portal);
+    cout << "Loaded portal: area " << portal.area << endl;
+    return 1;
+}
+
+void Scene::setAnimationFrame(int frame) {
+    // captured lazily rather than at load so the capture happens after
+    // pathtraceInit's static/moving partition has settled the geom order
+    if (!animBasesCaptured) {
+        for (Geom& geom : geoms) {
+            geom.baseTranslation = geom.translation;
+            geom.endTranslation = geom.target;
+        }
+        eyeStart = state.camera.position;
+        lookAtStart = state.camera.lookAt;
+        animBasesCaptured = true;
+    }
+
+    const float denom = (float)std::max(state.frames - 1, 1);
+    const float t = frame / denom;
+
+    if (state.animateCamera) {
+        Camera& camera = state.camera;
+        camera.position = glm::mix(eyeStart, state.eyeEnd, t);
+        camera.lookAt = glm::mix(lookAtStart, state.lookAtEnd, t);
+        camera.view = glm::normalize(camera.lookAt - camera.position);
+        camera.right = glm::normalize(glm::cross(camera.view, camera.up));
+        camera.up = glm::cross(camera.right, camera.view);
+    }
+
+    for (Geom& geom : geoms) {
+        if (!geom.moving) {
+            continue;
+        }
+        glm::vec3 sweep = (geom.endTranslation - geom.baseTranslation) / denom;
+        geom.translation = glm::mix(geom.baseTranslation, geom.endTranslation, t);
+        // target stays one frame ahead so the motion-blur sweep covers
+        // exactly this frame's motion (held at the last frame)
+        geom.target = geom.translation + (frame + 1 <= state.frames - 1 ? sweep : glm::vec3(0.0f));
+        geom.transform = utilityCore::buildTransformationMatrix(
+            geom.translation, geom.rotation, geom.scale);
+        geom.inverseTransform = glm::inverse(geom.transform);
+        geom.invTranspose = glm::inverseTranspose(geom.transform);
+    }
+}
+
 int Scene::loadMaterial(string materialid) {
     int id = atoi(materialid.c_str());
     if (id != materials.size()) {
@@ -254,35 +1238,151 @@ int Scene::loadMaterial(string materialid) {
     } else {
         cout << "Loading Material " << id << "..." << endl;
         Material newMaterial;
+        newMaterial.roughness = 0.0f;
+        newMaterial.albedoTex = 0;
+        newMaterial.albedoMaxLod = 0.0f;
+        newMaterial.albedoTexId = 0;
 
         //load static properties
+        string line;
+        vector<utilityCore::Token> tokens;
         for (int i = 0; i < 7; i++) {
-            string line;
             utilityCore::safeGetline(fp_in, line);
-            vector<string> tokens = utilityCore::tokenizeString(line);
-            if (strcmp(tokens[0].c_str(), "RGB") == 0) {
-                glm::vec3 color( atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()) );
+            utilityCore::tokenizeLine(line, tokens);
+            if (tokens[0].equals("RGB")) {
+                glm::vec3 color( tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat() );
                 newMaterial.color = color;
-            } else if (strcmp(tokens[0].c_str(), "SPECEX") == 0) {
-                newMaterial.specular.exponent = atof(tokens[1].c_str());
-            } else if (strcmp(tokens[0].c_str(), "SPECRGB") == 0) {
-                glm::vec3 specColor(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
+            } else if (tokens[0].equals("SPECEX")) {
+                newMaterial.specular.exponent = tokens[1].toFloat();
+            } else if (tokens[0].equals("ROUGHNESS")) {
+                newMaterial.roughness = tokens[1].toFloat();
+            } else if (tokens[0].equals("SPECRGB")) {
+                glm::vec3 specColor(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat());
                 newMaterial.specular.color = specColor;
-            } else if (strcmp(tokens[0].c_str(), "REFL") == 0) {
-                newMaterial.hasReflective = atof(tokens[1].c_str());
-            } else if (strcmp(tokens[0].c_str(), "REFR") == 0) {
-                newMaterial.hasRefractive = atof(tokens[1].c_str());
-            } else if (strcmp(tokens[0].c_str(), "REFRIOR") == 0) {
-                newMaterial.indexOfRefraction = atof(tokens[1].c_str());
-            } else if (strcmp(tokens[0].c_str(), "EMITTANCE") == 0) {
-                newMaterial.emittance = atof(tokens[1].c_str());
+            } else if (tokens[0].equals("REFL")) {
+                newMaterial.hasReflective = tokens[1].toFloat();
+            } else if (tokens[0].equals("REFR")) {
+                newMaterial.hasRefractive = tokens[1].toFloat();
+            } else if (tokens[0].equals("REFRIOR")) {
+                newMaterial.indexOfRefraction = tokens[1].toFloat();
+            } else if (tokens[0].equals("EMITTANCE")) {
+                newMaterial.emittance = tokens[1].toFloat();
             }
         }
+        // legacy scenes express glossiness through SPECEX as a jitter radius;
+        // map it to a GGX alpha so they keep a comparable highlight width
+        if (newMaterial.roughness <= 0.0f && newMaterial.specular.exponent > 0.0f) {
+            newMaterial.roughness = glm::clamp(newMaterial.specular.exponent, 0.0f, 1.0f);
+        }
+        // optional TEXTURE line after the seven fixed ones: peek and
+        // rewind when the line belongs to the next block, so untextured
+        // materials keep the legacy layout
+        std::streampos beforeTexture = fp_in.tellg();
+        utilityCore::safeGetline(fp_in, line);
+        utilityCore::tokenizeLine(line, tokens);
+        if (!tokens.empty() && tokens[0].equals("TEXTURE")) {
+            newMaterial.albedoTexId = loadTexture(tokens[1].toString());
+        } else {
+            fp_in.clear();
+            fp_in.seekg(beforeTexture);
+        }
         materials.push_back(newMaterial);
         return 1;
     }
 }
 
+// Collapse byte-identical materials into a single palette entry and remap
+// every geom's materialid. The generator pushes one material per sphere and
+// hand-written files repeat entries freely, but shading only cares about
+// content: a compact palette keeps the material-sort histogram in a handful
+// of bins and the table itself cache-resident. The comparison is exact
+// bytes on purpose - duplicates parsed from the same text are bit-identical,
+// and near-duplicates differing in a real parameter must stay distinct.
+void Scene::dedupMaterials() {
+    typedef std::array<unsigned int, sizeof(Material) / sizeof(unsigned int)> MaterialKey;
+    std::map<MaterialKey, int> seen;
+    std::vector<int> remap(materials.size());
+    std::vector<Material> palette;
+    for (size_t i = 0; i < materials.size(); i++) {
+        MaterialKey key;
+        memcpy(key.data(), &materials[i], sizeof(Material));
+        std::map<MaterialKey, int>::iterator it = seen.find(key);
+        if (it == seen.end()) {
+            it = seen.insert(std::make_pair(key, (int)palette.size())).first;
+            palette.push_back(materials[i]);
+        }
+        remap[i] = it->second;
+    }
+    if (palette.size() == materials.size()) {
+        return;
+    }
+    for (size_t g = 0; g < geoms.size(); g++) {
+        geoms[g].materialid = remap[geoms[g].materialid];
+    }
+    cout << "Material palette: " << materials.size() << " entries, "
+         << palette.size() << " after dedup" << endl;
+    materials.swap(palette);
+}
+
+void Scene::bakeStaticMeshTransforms() {
+    // meshes placed more than once share a triangle range (meshCache), so
+    // their vertices must stay in object space under per-instance transforms
+    std::map<int, int> rangeUsers;
+    for (size_t g = 0; g < geoms.size(); g++) {
+        if (geoms[g].type == MESH) {
+            rangeUsers[geoms[g].startIndex]++;
+        }
+    }
+    // a vertex belongs to exactly one mesh range, but triangles share
+    // vertices within a range; the mark keeps each one transformed once
+    std::vector<char> baked(vertices.size(), 0);
+    int bakedMeshes = 0;
+    for (size_t g = 0; g < geoms.size(); g++) {
+        Geom& geom = geoms[g];
+        if (geom.type != MESH || geom.moving || rangeUsers[geom.startIndex] > 1
+            || geom.transform == glm::mat4(1.0f)) {
+            continue;
+        }
+        glm::mat3 normalMat = glm::mat3(geom.invTranspose);
+        glm::vec3 lo(FLT_MAX);
+        glm::vec3 hi(-FLT_MAX);
+        for (int i = geom.startIndex; i <= geom.endIndex; i++) {
+            const TriangleIdx& tri = triangles[i];
+            int idx[3] = { tri.x, tri.y, tri.z };
+            for (int k = 0; k < 3; k++) {
+                int v = idx[k];
+                if (!baked[v]) {
+                    glm::vec3 p = glm::vec3(geom.transform * glm::vec4(glm::vec3(vertices[v]), 1.0f));
+                    vertices[v] = glm::vec4(p, vertices[v].w);
+                    glm::vec3 n = normalMat * glm::vec3(normals[v]);
+                    float len = glm::length(n);
+                    if (len > 0.0f) {
+                        n /= len;
+                    }
+                    normals[v] = glm::vec4(n, normals[v].w);
+                    baked[v] = 1;
+                }
+                lo = glm::min(lo, glm::vec3(vertices[v]));
+                hi = glm::max(hi, glm::vec3(vertices[v]));
+            }
+        }
+        // the range is world space now; the bounds move with it and the
+        // transforms collapse to identity (buildGeomSplit flags this)
+        geom.leftBottom = lo;
+        geom.rightTop = hi;
+        geom.translation = glm::vec3(0.0f);
+        geom.rotation = glm::vec3(0.0f);
+        geom.scale = glm::vec3(1.0f);
+        geom.transform = glm::mat4(1.0f);
+        geom.inverseTransform = glm::mat4(1.0f);
+        geom.invTranspose = glm::mat4(1.0f);
+        bakedMeshes++;
+    }
+    if (bakedMeshes > 0) {
+        cout << "Baked " << bakedMeshes << " static mesh(es) into world space" << endl;
+    }
+}
+
 void Scene::addSphereByMaterial(Geom& geom, int id, glm::vec3 trans, float radius) {
     geom.type = SPHERE;
     geom.materialid = id;
@@ -298,18 +1398,103 @@ void Scene::addSphereByMaterial(Geom& geom, int id, glm::vec3 trans, float radiu
 }
 
 
-void Scene::buildRandomScene() {
+// Parse the directive lines following a GENERATOR header; unknown keys
+// are ignored so older files keep loading.
+GeneratorParams Scene::parseGenerator() {
+    GeneratorParams params;
+    string line;
+    vector<utilityCore::Token> tokens;
+    utilityCore::safeGetline(fp_in, line);
+    while (!line.empty() && fp_in.good()) {
+        utilityCore::tokenizeLine(line, tokens);
+        if (tokens[0].equals("SEED")) {
+            params.seed = tokens[1].toInt();
+        } else if (tokens[0].equals("GRID")) {
+            params.gridSize = tokens[1].toInt();
+        } else if (tokens[0].equals("SPACING")) {
+            params.spacing = tokens[1].toFloat();
+        } else if (tokens[0].equals("RADIUS")) {
+            params.sphereRadius = tokens[1].toFloat();
+        } else if (tokens[0].equals("RES")) {
+            params.resolution = glm::ivec2(tokens[1].toInt(), tokens[2].toInt());
+        } else if (tokens[0].equals("ITERATIONS")) {
+            params.iterations = tokens[1].toInt();
+        } else if (tokens[0].equals("DEPTH")) {
+            params.traceDepth = tokens[1].toInt();
+        } else if (tokens[0].equals("MIX")) {
+            params.mixDiffuse = tokens[1].toFloat();
+            params.mixEmissive = tokens[2].toFloat();
+            params.mixMetal = tokens[3].toFloat();
+            params.mixGlass = tokens[4].toFloat();
+        } else if (tokens[0].equals("MOVING")) {
+            params.movingFraction = tokens[1].toFloat();
+        } else if (tokens[0].equals("MESH")) {
+            params.meshFile = tokens[1].toString();
+        } else if (tokens[0].equals("MESHCOUNT")) {
+            params.meshInstances = tokens[1].toInt();
+        } else if (tokens[0].equals("FILE")) {
+            params.imageName = tokens[1].toString();
+        }
+        utilityCore::safeGetline(fp_in, line);
+    }
+    return params;
+}
+
+// Procedural unit-diameter UV sphere: `stacks` latitude bands, 2*stacks
+// longitude slices, 4*stacks*(stacks-1) triangles. Gives the benchmark
+// corpus a mesh-density dial that needs no asset files and produces the
+// identical mesh on every platform - uvsphere:45 is ~8k triangles,
+// uvsphere:128 ~65k, uvsphere:362 ~523k. Goes through the same weld and
+// finalize path as the file loaders, so BVH build and traversal see
+// nothing unusual.
+void Scene::buildUvSphere(int stacks, Geom& geom) {
+    stacks = std::max(stacks, 2);
+    int slices = 2 * stacks;
+    size_t vertexBase = vertices.size();
+    geom.startIndex = (int)triangles.size();
+    // ring-major shared vertices; the seam column (j == slices) repeats
+    // j == 0 with uv.x 1 so texcoords stay monotonic, and the poles keep
+    // their degenerate rings - the welder folds what it can
+    for (int i = 0; i <= stacks; i++) {
+        float phi = PI * i / stacks;
+        for (int j = 0; j <= slices; j++) {
+            float theta = 2.0f * PI * j / slices;
+            glm::vec3 n(sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta));
+            vertices.push_back(glm::vec4(0.5f * n, 0.0f));
+            normals.push_back(glm::vec4(n, 0.0f));
+            uvs.push_back(glm::vec2((float)j / slices, (float)i / stacks));
+        }
+    }
+    int base = (int)vertexBase;
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            int a = base + i * (slices + 1) + j;
+            int b = a + slices + 1;
+            if (i > 0) {
+                triangles.push_back(TriangleIdx(a, b, a + 1, 0));
+            }
+            if (i < stacks - 1) {
+                triangles.push_back(TriangleIdx(a + 1, b, b + 1, 0));
+            }
+        }
+    }
+    geom.endIndex = (int)triangles.size() - 1;
+    geom.leftBottom = glm::vec3(-0.5f);
+    geom.rightTop = glm::vec3(0.5f);
+    finalizeMesh(geom, vertexBase);
+}
+
+void Scene::buildRandomScene(const GeneratorParams& params) {
     // camera
     cout << "Loading Camera ..." << endl;
     RenderState& state = this->state;
     Camera& camera = state.camera;
     float fovy;
 
-    camera.resolution.x = 800;
-    camera.resolution.y = 600;
+    camera.resolution = params.resolution;
     fovy = 20;
-    state.iterations = 5000;
-    state.traceDepth = 8;
+    state.iterations = params.iterations;
+    state.traceDepth = params.traceDepth;
     camera.position = glm::vec3(12, 1.6, 5);
     camera.lookAt = glm::vec3(0, 1.6, 0);
     camera.up = glm::vec3(0, 1, 0);
@@ -325,19 +1510,36 @@ void Scene::buildRandomScene() {
     camera.pixelLength = glm::vec2(2 * xscaled / (float)camera.resolution.x
         , 2 * yscaled / (float)camera.resolution.y);
 
+    camera.cropOffset = glm::ivec2(0, 0);
+    camera.fullResolution = camera.resolution;
+
     camera.view = glm::normalize(camera.lookAt - camera.position);
 
     //set up render camera stuff
     int arraylen = camera.resolution.x * camera.resolution.y;
     state.image.resize(arraylen);
     std::fill(state.image.begin(), state.image.end(), glm::vec3());
+    state.imageName = params.imageName;
 
     Material groundMaterial = { glm::vec3(0.5, 0.5, 0.5), {0, glm::vec3(0.5, 0.5, 0.5) }, 0, 0, 0, 0 };
     materials.push_back(groundMaterial);
 
-    Geom groundSphere;
-    addSphereByMaterial(groundSphere, 0, glm::vec3(0, -1000, 0), 2000);
-    geoms.push_back(groundSphere);
+    // analytic ground plane at y = 0. The old radius-2000 sphere paid the
+    // full transformed quadratic per ray and its extreme radius caused
+    // float-precision acne at contact points; the point-normal plane test
+    // is a few FLOPs and exact.
+    Geom groundPlane;
+    groundPlane.type = PLANE;
+    groundPlane.materialid = 0;
+    groundPlane.translation = glm::vec3(0);
+    groundPlane.rotation = glm::vec3(0);
+    groundPlane.scale = glm::vec3(1);
+    groundPlane.moving = false;
+    groundPlane.transform = utilityCore::buildTransformationMatrix(
+        groundPlane.translation, groundPlane.rotation, groundPlane.scale);
+    groundPlane.inverseTransform = glm::inverse(groundPlane.transform);
+    groundPlane.invTranspose = glm::inverseTranspose(groundPlane.transform);
+    geoms.push_back(groundPlane);
 
     Material material1 = { glm::vec3(1), {0, glm::vec3(1) }, 0, 1, 1.5, 0 };
     materials.push_back(material1);
@@ -357,63 +1559,97 @@ void Scene::buildRandomScene() {
     addSphereByMaterial(sphere3, 3, glm::vec3(4, 1, 0), 2);
     geoms.push_back(sphere3);
 
-    Material material4 = { glm::vec3(0.85, 0.5, 0.67), {0, glm::vec3(0) }, 0, 0, 0, 0 };
-    materials.push_back(material4);
-
-    Geom bunny;
-    bunny.type = MESH;
-    bunny.materialid = 4;
-    bunny.translation = glm::vec3(5, 0, 3);
-    bunny.rotation = glm::vec3(0, 90, 0);
-    bunny.scale = glm::vec3(5);
-    bunny.moving = false;
-    loadObj("../scenes/models/bunny.obj", bunny);
-
-    bunny.transform = utilityCore::buildTransformationMatrix(
-        bunny.translation, bunny.rotation, bunny.scale);
-    bunny.inverseTransform = glm::inverse(bunny.transform);
-    bunny.invTranspose = glm::inverseTranspose(bunny.transform);
-    geoms.push_back(bunny);
-
-    int matId = 5;
-    for (int a = -9; a < 9; a++) {
-        for (int b = -9; b < 9; b++) {
-            float choose_mat = rand() / (RAND_MAX + 1.0);
-            float choose_motion = rand() / (RAND_MAX + 1.0);
-            glm::vec3 center(a * 1.5 + 0.9 * rand() / (RAND_MAX + 1.0), 0.2, b * 1.5 + 0.9 * rand() / (RAND_MAX + 1.0));
-
-            Material material;
-            if (glm::length(center - glm::vec3(0, 0.2, 0)) > 1 &&
-                glm::length(center - glm::vec3(-4, 0.2, 0)) > 1 &&
-                glm::length(center - glm::vec3(4, 0.2, 0)) > 1) {
-                if (choose_mat < 0.75) {
-                    // diffuse
-                    glm::vec3 color(rand() / (RAND_MAX + 1.0), rand() / (RAND_MAX + 1.0), rand() / (RAND_MAX + 1.0));
-                    Material material = { color, {0, color}, 0, 0, 0, 0 };
-                    materials.push_back(material);
+    if (params.meshFile != "none" && params.meshInstances > 0) {
+        Material material4 = { glm::vec3(0.85, 0.5, 0.67), {0, glm::vec3(0) }, 0, 0, 0, 0 };
+        materials.push_back(material4);
+
+        // the first instance loads the file; the rest reuse its triangle
+        // range with their own transform (and later their own BVH root)
+        Geom first;
+        for (int i = 0; i < params.meshInstances; i++) {
+            Geom mesh;
+            mesh.type = MESH;
+            mesh.materialid = 4;
+            mesh.translation = glm::vec3(5 + 4 * i, 0, 3);
+            mesh.rotation = glm::vec3(0, 90, 0);
+            mesh.scale = glm::vec3(5);
+            mesh.moving = false;
+            if (i == 0) {
+                if (params.meshFile.compare(0, 9, "uvsphere:") == 0) {
+                    buildUvSphere(atoi(params.meshFile.c_str() + 9), mesh);
+                } else {
+                    loadObj(params.meshFile, mesh);
+                }
+                first = mesh;
+            } else {
+                mesh.startIndex = first.startIndex;
+                mesh.endIndex = first.endIndex;
+                mesh.leftBottom = first.leftBottom;
+                mesh.rightTop = first.rightTop;
+            }
+
+            mesh.transform = utilityCore::buildTransformationMatrix(
+                mesh.translation, mesh.rotation, mesh.scale);
+            mesh.inverseTransform = glm::inverse(mesh.transform);
+            mesh.invTranspose = glm::inverseTranspose(mesh.transform);
+            geoms.push_back(mesh);
+        }
+    }
+
+    // fixed-seed generator with explicit scaling, so a given SEED produces
+    // the same scene on every platform and standard library
+    std::mt19937 rng(params.seed);
+    auto urand = [&rng]() {
+        return (float)(rng() & 0xFFFFFFu) / 16777216.0f;
+    };
+    float mixTotal = params.mixDiffuse + params.mixEmissive
+        + params.mixMetal + params.mixGlass;
+    if (mixTotal <= 0.0f) {
+        mixTotal = 1.0f;
+    }
+    float tDiffuse = params.mixDiffuse / mixTotal;
+    float tEmissive = tDiffuse + params.mixEmissive / mixTotal;
+    float tMetal = tEmissive + params.mixMetal / mixTotal;
+
+    int matId = (int)materials.size();
+    for (int a = -params.gridSize; a < params.gridSize; a++) {
+        for (int b = -params.gridSize; b < params.gridSize; b++) {
+            float choose_mat = urand();
+            float choose_motion = urand();
+            glm::vec3 center(a * params.spacing + 0.9f * urand(),
+                params.sphereRadius * 0.5f,
+                b * params.spacing + 0.9f * urand());
 
+            if (glm::length(center - glm::vec3(0, center.y, 0)) > 1 &&
+                glm::length(center - glm::vec3(-4, center.y, 0)) > 1 &&
+                glm::length(center - glm::vec3(4, center.y, 0)) > 1) {
+                Material material;
+                bool glass = false;
+                if (choose_mat < tDiffuse) {
+                    // diffuse
+                    glm::vec3 color(urand(), urand(), urand());
+                    material = { color, {0, color}, 0, 0, 0, 0 };
                 }
-                else if (choose_mat < 0.82) {
-                    // emmision
-                    glm::vec3 color(rand() / (RAND_MAX + 1.0) * 0.1 + 0.9, rand() / (RAND_MAX + 1.0) * 0.1 + 0.9, rand() / (RAND_MAX + 1.0) * 0.1 + 0.9);
+                else if (choose_mat < tEmissive) {
+                    // emission
+                    glm::vec3 color(urand() * 0.1 + 0.9, urand() * 0.1 + 0.9, urand() * 0.1 + 0.9);
                     material = { color, {0, color}, 0, 0, 0, 1 };
-                    materials.push_back(material);
                 }
-                else if (choose_mat < 0.95) {
+                else if (choose_mat < tMetal) {
                     // metal
-                    glm::vec3 color(rand() / (RAND_MAX + 1.0) * 0.5 + 0.5, rand() / (RAND_MAX + 1.0) * 0.5 + 0.5, rand() / (RAND_MAX + 1.0) * 0.5 + 0.5);
+                    glm::vec3 color(urand() * 0.5 + 0.5, urand() * 0.5 + 0.5, urand() * 0.5 + 0.5);
                     material = { color, {0, color}, 1, 0, 0, 0 };
-                    materials.push_back(material);
                 }
                 else {
                     // glass
-                    glm::vec3 color(rand() / (RAND_MAX + 1.0) * 0.1 + 0.9, rand() / (RAND_MAX + 1.0) * 0.1 + 0.9, rand() / (RAND_MAX + 1.0) * 0.1 + 0.9);
+                    glm::vec3 color(urand() * 0.1 + 0.9, urand() * 0.1 + 0.9, urand() * 0.1 + 0.9);
                     material = { color, {0, color}, 0, 1, 1.5, 0 };
-                    materials.push_back(material);
+                    glass = true;
                 }
+                materials.push_back(material);
                 Geom sphere;
-                addSphereByMaterial(sphere, matId++, center, 0.4);
-                if (choose_motion < 0.2 && choose_mat < 0.95) {
+                addSphereByMaterial(sphere, matId++, center, params.sphereRadius);
+                if (choose_motion < params.movingFraction && !glass) {
                     sphere.moving = true;
                     sphere.target = sphere.translation + glm::vec3(0, 0.2, 0);
                 }
@@ -421,4 +1657,494 @@ void Scene::buildRandomScene() {
             }
         }
     }
+    dedupMaterials();
+    bakeStaticMeshTransforms();
+    cout << "Generated benchmark scene: " << geoms.size() << " geoms, "
+         << materials.size() << " materials (seed " << params.seed << ")" << endl;
+}
+bool Scene::loadEnvMap(string filename) {
+    NVTX_PUSH("loadEnvMap %s", filename.c_str());
+    watchFile(filename);
+    cout << "Loading environment map " << filename << "..." << endl;
+    int width;
+    int height;
+    int components;
+    float* pixels = stbi_loadf(filename.c_str(), &width, &height, &components, 3);
+    if (pixels == NULL) {
+        std::cerr << "Cannot load environment map " << filename << ": "
+                  << stbi_failure_reason() << std::endl;
+        exit(1);
+    }
+    envMapWidth = width;
+    envMapHeight = height;
+    envMap.resize((size_t)width * height);
+    for (size_t i = 0; i < envMap.size(); i++) {
+        envMap[i] = glm::vec4(pixels[3 * i], pixels[3 * i + 1],
+            pixels[3 * i + 2], 0.0f);
+    }
+    stbi_image_free(pixels);
+    cout << "Environment map is " << width << " x " << height << endl;
+    NVTX_POP();
+    return true;
+}
+
+// Grayscale importance map for the adaptive sampler (IMPORTANCE
+// directive): decoded single-channel to [0, 1] floats at whatever
+// resolution the painting came in; the freeze test samples it nearest.
+// A failed decode warns and leaves the scene without a map, which keeps
+// the sample budget uniform rather than killing the job.
+bool Scene::loadImportanceMap(string filename) {
+    watchFile(filename);
+    cout << "Loading importance map " << filename << "..." << endl;
+    int width;
+    int height;
+    int components;
+    unsigned char* pixels = stbi_load(filename.c_str(), &width, &height, &components, 1);
+    if (pixels == NULL) {
+        std::cerr << "Cannot load importance map " << filename << ": "
+                  << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    importanceWidth = width;
+    importanceHeight = height;
+    importanceMap.resize((size_t)width * height);
+    for (size_t i = 0; i < importanceMap.size(); i++) {
+        importanceMap[i] = pixels[i] * (1.0f / 255.0f);
+    }
+    stbi_image_free(pixels);
+    cout << "Importance map is " << width << " x " << height << endl;
+    return true;
 }
+
+// Decode an albedo map to RGBA8 (the device textures are sRGB uchar4 mip
+// chains) and return its 1-based Material::albedoTexId. A failed decode
+// warns and returns 0, which just renders that material untextured.
+int Scene::loadTexture(string filename) {
+    std::map<string, int>::iterator it = textureCache.find(filename);
+    if (it != textureCache.end()) {
+        return it->second;
+    }
+    watchFile(filename);
+    cout << "Loading texture " << filename << "..." << endl;
+    int width;
+    int height;
+    int components;
+    unsigned char* pixels = stbi_load(filename.c_str(), &width, &height, &components, 4);
+    if (pixels == NULL) {
+        std::cerr << "Cannot load texture " << filename << ": "
+                  << stbi_failure_reason() << std::endl;
+        return 0;
+    }
+    SceneTexture tex;
+    tex.width = width;
+    tex.height = height;
+    tex.pixels.assign(pixels, pixels + (size_t)4 * width * height);
+    stbi_image_free(pixels);
+    textures.push_back(std::move(tex));
+    int id = (int)textures.size();
+    textureCache[filename] = id;
+    cout << "Texture is " << width << " x " << height << endl;
+    return id;
+}
+
+bool Scene::loadPacked(string filename) {
+#ifdef _WIN32
+    // no mmap here; a single buffered read of each array does the job
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == NULL) {
+        return false;
+    }
+    PackedSceneHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1
+        || strncmp(h.magic, "PTSC", 4) != 0) {
+        fclose(f);
+        return false;
+    }
+    if (h.version != kPackedSceneVersion) {
+        cout << "Packed scene " << filename << " has version " << h.version
+             << ", expected " << kPackedSceneVersion << " - recompile it" << endl;
+        fclose(f);
+        return false;
+    }
+    geoms.resize(h.numGeoms);
+    materials.resize(h.numMaterials);
+    vertices.resize(h.numVertices);
+    normals.resize(h.numNormals);
+    triangles.resize(h.numTriangles);
+    bool ok = fread(geoms.data(), sizeof(Geom), h.numGeoms, f) == (size_t)h.numGeoms
+        && fread(materials.data(), sizeof(Material), h.numMaterials, f) == (size_t)h.numMaterials
+        && readPackedSection(f, vertices.data(), h.numVertices * sizeof(glm::vec4))
+        && readPackedSection(f, normals.data(), h.numNormals * sizeof(glm::vec4))
+        && readPackedSection(f, triangles.data(), h.numTriangles * sizeof(TriangleIdx));
+    bvhNodes.resize(h.numBvhNodes);
+    ok = ok && readPackedSection(f, bvhNodes.data(), h.numBvhNodes * sizeof(LBVHNode));
+    envMapWidth = h.envMapWidth;
+    envMapHeight = h.envMapHeight;
+    size_t envTexels = (size_t)h.envMapWidth * h.envMapHeight;
+    envMap.resize(envTexels);
+    ok = ok && fread(envMap.data(), sizeof(glm::vec4), envTexels, f) == envTexels;
+    uvs.resize(h.numUvs);
+    ok = ok && fread(uvs.data(), sizeof(glm::vec2), h.numUvs, f) == (size_t)h.numUvs;
+    textures.resize(h.numTextures);
+    for (int i = 0; ok && i < h.numTextures; i++) {
+        int dims[2];
+        ok = fread(dims, sizeof(int), 2, f) == 2;
+        if (!ok) {
+            break;
+        }
+        textures[i].width = dims[0];
+        textures[i].height = dims[1];
+        size_t bytes = (size_t)4 * dims[0] * dims[1];
+        textures[i].pixels.resize(bytes);
+        ok = fread(textures[i].pixels.data(), 1, bytes, f) == bytes;
+    }
+    fclose(f);
+    if (!ok) {
+        cout << "Packed scene " << filename << " is truncated" << endl;
+        return false;
+    }
+    state.camera = h.camera;
+    state.iterations = h.iterations;
+    state.traceDepth = h.traceDepth;
+    state.imageName = h.imageName;
+    medium = h.medium;
+    int arraylen = state.camera.resolution.x * state.camera.resolution.y;
+    state.image.assign(arraylen, glm::vec3());
+    cout << "Loaded packed scene " << filename << ": " << geoms.size()
+         << " geoms, " << triangles.size() << " triangles, "
+         << bvhNodes.size() << " BVH nodes" << endl;
+    return true;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PackedSceneHeader)) {
+        close(fd);
+        return false;
+    }
+    const char* base = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    bool ok = loadPackedFromMemory(base, (size_t)st.st_size, filename);
+    munmap((void*)base, st.st_size);
+    return ok;
+#endif
+}
+
+#ifndef _WIN32
+bool Scene::loadPackedFromMemory(const char* base, size_t bytes, const string& label) {
+    if (bytes < sizeof(PackedSceneHeader)) {
+        return false;
+    }
+    // copied out by value so the caller may drop the mapping afterwards
+    PackedSceneHeader h = *(const PackedSceneHeader*)base;
+    if (strncmp(h.magic, "PTSC", 4) != 0) {
+        return false;
+    }
+    // floor only: the four geometry sections carry their stored sizes in
+    // the stream, so they (and the texture pixels) are bounds-checked as
+    // the walk reaches them
+    size_t expected = sizeof(PackedSceneHeader)
+        + h.numGeoms * sizeof(Geom)
+        + h.numMaterials * sizeof(Material)
+        + 4 * sizeof(unsigned long long)  // geometry section frames
+        + (size_t)h.envMapWidth * h.envMapHeight * sizeof(glm::vec4)
+        + h.numUvs * sizeof(glm::vec2)
+        + h.numTextures * 2 * sizeof(int);  // texture pixels checked per map
+    if (h.version != kPackedSceneVersion || bytes < expected) {
+        cout << "Packed scene " << label << " has version " << h.version
+             << " / " << bytes << " bytes, expected version "
+             << kPackedSceneVersion << " / " << expected
+             << " bytes - recompile it" << endl;
+        return false;
+    }
+    const char* p = base + sizeof(PackedSceneHeader);
+    const char* end = base + bytes;
+    geoms.assign((const Geom*)p, (const Geom*)p + h.numGeoms);
+    p += h.numGeoms * sizeof(Geom);
+    materials.assign((const Material*)p, (const Material*)p + h.numMaterials);
+    p += h.numMaterials * sizeof(Material);
+    vertices.resize(h.numVertices);
+    normals.resize(h.numNormals);
+    triangles.resize(h.numTriangles);
+    bvhNodes.resize(h.numBvhNodes);
+    PackedSectionJob jobs[4] = {
+        { NULL, 0, (unsigned char*)vertices.data(), h.numVertices * sizeof(glm::vec4), true },
+        { NULL, 0, (unsigned char*)normals.data(), h.numNormals * sizeof(glm::vec4), true },
+        { NULL, 0, (unsigned char*)triangles.data(), h.numTriangles * sizeof(TriangleIdx), true },
+        { NULL, 0, (unsigned char*)bvhNodes.data(), h.numBvhNodes * sizeof(LBVHNode), true },
+    };
+    for (int i = 0; i < 4; i++) {
+        unsigned long long stored = 0;
+        bool framed = p + sizeof(stored) <= end;
+        if (framed) {
+            memcpy(&stored, p, sizeof(stored));
+            p += sizeof(stored);
+        }
+        if (!framed || stored > (unsigned long long)(end - p)
+                || stored > jobs[i].rawBytes) {
+            cout << "Packed scene " << label << " has a truncated section" << endl;
+            return false;
+        }
+        jobs[i].src = (const unsigned char*)p;
+        jobs[i].storedBytes = (size_t)stored;
+        p += stored;
+    }
+    // raw sections copy inline; compressed ones - the bulk of a
+    // geometry-heavy scene - inflate in parallel, one worker per section,
+    // reading straight off the shared read-only mapping
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 4; i++) {
+        PackedSectionJob& job = jobs[i];
+        if (job.storedBytes == job.rawBytes) {
+            memcpy(job.dst, job.src, job.rawBytes);
+        }
+        else {
+            workers.push_back(std::thread([&job] {
+                job.ok = lz4Decompress(job.src, job.storedBytes, job.dst, job.rawBytes);
+            }));
+        }
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!jobs[i].ok) {
+            cout << "Packed scene " << label << " has a corrupt section" << endl;
+            return false;
+        }
+    }
+    size_t tailBytes = (size_t)h.envMapWidth * h.envMapHeight * sizeof(glm::vec4)
+        + h.numUvs * sizeof(glm::vec2);
+    if (tailBytes > (size_t)(end - p)) {
+        cout << "Packed scene " << label << " is truncated" << endl;
+        return false;
+    }
+    envMapWidth = h.envMapWidth;
+    envMapHeight = h.envMapHeight;
+    size_t envTexels = (size_t)h.envMapWidth * h.envMapHeight;
+    envMap.assign((const glm::vec4*)p, (const glm::vec4*)p + envTexels);
+    p += envTexels * sizeof(glm::vec4);
+    uvs.assign((const glm::vec2*)p, (const glm::vec2*)p + h.numUvs);
+    p += h.numUvs * sizeof(glm::vec2);
+    // variable-size texture blobs follow; each map re-checks the mapping
+    // bounds since the header cannot carry their total
+    for (int i = 0; i < h.numTextures; i++) {
+        SceneTexture tex;
+        if (p + 2 * sizeof(int) > end) {
+            cout << "Packed scene " << label << " has a truncated texture" << endl;
+            return false;
+        }
+        tex.width = ((const int*)p)[0];
+        tex.height = ((const int*)p)[1];
+        p += 2 * sizeof(int);
+        size_t texBytes = (size_t)4 * tex.width * tex.height;
+        if (p + texBytes > end) {
+            cout << "Packed scene " << label << " has a truncated texture" << endl;
+            return false;
+        }
+        tex.pixels.assign((const unsigned char*)p, (const unsigned char*)p + texBytes);
+        p += texBytes;
+        textures.push_back(std::move(tex));
+    }
+
+    state.camera = h.camera;
+    state.iterations = h.iterations;
+    state.traceDepth = h.traceDepth;
+    state.imageName = h.imageName;
+    medium = h.medium;
+    int arraylen = state.camera.resolution.x * state.camera.resolution.y;
+    state.image.assign(arraylen, glm::vec3());
+    cout << "Loaded packed scene " << label << ": " << geoms.size()
+         << " geoms, " << triangles.size() << " triangles, "
+         << bvhNodes.size() << " BVH nodes" << endl;
+    return true;
+}
+#endif
+
+// serialize one packed-scene image (header through texture blobs) to an
+// already-open stream; shared by savePacked and the shared-memory cache
+static void writePackedImage(const Scene& scene, FILE* f) {
+    PackedSceneHeader h = {};
+    memcpy(h.magic, "PTSC", 4);
+    h.version = kPackedSceneVersion;
+    h.camera = scene.state.camera;
+    h.iterations = scene.state.iterations;
+    h.traceDepth = scene.state.traceDepth;
+    snprintf(h.imageName, sizeof(h.imageName), "%s", scene.state.imageName.c_str());
+    h.numGeoms = (int)scene.geoms.size();
+    h.numMaterials = (int)scene.materials.size();
+    h.numVertices = (int)scene.vertices.size();
+    h.numNormals = (int)scene.normals.size();
+    h.numTriangles = (int)scene.triangles.size();
+    h.numBvhNodes = (int)scene.bvhNodes.size();
+    h.envMapWidth = scene.envMapWidth;
+    h.envMapHeight = scene.envMapHeight;
+    h.numUvs = (int)scene.uvs.size();
+    h.numTextures = (int)scene.textures.size();
+    h.medium = scene.medium;
+
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(scene.geoms.data(), sizeof(Geom), scene.geoms.size(), f);
+    fwrite(scene.materials.data(), sizeof(Material), scene.materials.size(), f);
+    writePackedSection(f, scene.vertices.data(), scene.vertices.size() * sizeof(glm::vec4));
+    writePackedSection(f, scene.normals.data(), scene.normals.size() * sizeof(glm::vec4));
+    writePackedSection(f, scene.triangles.data(), scene.triangles.size() * sizeof(TriangleIdx));
+    writePackedSection(f, scene.bvhNodes.data(), scene.bvhNodes.size() * sizeof(LBVHNode));
+    fwrite(scene.envMap.data(), sizeof(glm::vec4), scene.envMap.size(), f);
+    fwrite(scene.uvs.data(), sizeof(glm::vec2), scene.uvs.size(), f);
+    for (const Scene::SceneTexture& tex : scene.textures) {
+        int dims[2] = { tex.width, tex.height };
+        fwrite(dims, sizeof(int), 2, f);
+        fwrite(tex.pixels.data(), 1, tex.pixels.size(), f);
+    }
+}
+
+void Scene::savePacked(string filename) const {
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (f == NULL) {
+        cout << "Cannot write packed scene " << filename << endl;
+        return;
+    }
+    writePackedImage(*this, f);
+    fclose(f);
+    cout << "Wrote packed scene " << filename << " (" << geoms.size()
+         << " geoms, " << triangles.size() << " triangles)" << endl;
+}
+
+#if SCENE_SHM_CACHE_ENABLE && !defined(_WIN32)
+// FNV-1a over the scene file's bytes; 0 is reserved for "could not read"
+static unsigned long long hashFileContents(const string& filename) {
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    unsigned long long h = 1469598103934665603ULL;
+    unsigned char chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            h = (h ^ chunk[i]) * 1099511628211ULL;
+        }
+    }
+    fclose(f);
+    return h != 0 ? h : 1;
+}
+
+static string shmSegmentName(unsigned long long key) {
+    char name[32];
+    snprintf(name, sizeof(name), "/ptscene-%016llx", key);
+    return name;
+}
+
+// Attach to the cache segment for shmSceneKey, if a prior process
+// published one and every source file it was built from is unchanged.
+// Mid-write segments (version 0) are plain misses; stale completed ones
+// are also unlinked so the parse below republishes fresh.
+bool Scene::attachSharedScene() {
+    string name = shmSegmentName(shmSceneKey);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedSceneHeader)) {
+        close(fd);
+        return false;
+    }
+    const char* base = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    SharedSceneHeader sh = *(const SharedSceneHeader*)base;
+    size_t entryBytes = (size_t)sh.numWatched * sizeof(SharedSceneWatchedEntry);
+    bool ok = strncmp(sh.magic, "PTSH", 4) == 0
+        && sh.version == kPackedSceneVersion
+        && sizeof(SharedSceneHeader) + entryBytes + sh.packedBytes <= (size_t)st.st_size;
+    const SharedSceneWatchedEntry* entries =
+        (const SharedSceneWatchedEntry*)(base + sizeof(SharedSceneHeader));
+    for (int i = 0; ok && i < sh.numWatched; i++) {
+        // any edited source file invalidates the whole segment
+        ok = utilityCore::fileModTime(entries[i].path) == entries[i].mtime;
+    }
+    if (ok) {
+        ok = loadPackedFromMemory(base + sizeof(SharedSceneHeader) + entryBytes,
+            (size_t)sh.packedBytes, name);
+    }
+    if (ok) {
+        // inherit the publisher's watch list so hot reload still fires here
+        for (int i = 0; i < sh.numWatched; i++) {
+            watchFile(entries[i].path);
+        }
+        cout << "Attached shared scene cache " << name << endl;
+    }
+    munmap((void*)base, st.st_size);
+    if (!ok && strncmp(sh.magic, "PTSH", 4) == 0 && sh.version != 0) {
+        shm_unlink(name.c_str());
+    }
+    return ok;
+}
+
+// Publish this fully preprocessed scene for other processes. First writer
+// wins: losing the creation race, or finding a prior segment already
+// published for this content hash, is a silent no-op.
+void Scene::publishSharedScene() const {
+    if (shmSceneKey == 0) {
+        return;
+    }
+    // the packed image cannot carry these; serving such a scene from the
+    // cache would silently drop them, so it just parses every time
+    if (state.frames > 1 || !state.views.empty() || !portals.empty()
+            || !importanceMap.empty()) {
+        return;
+    }
+    for (const WatchedFile& w : watchedFiles) {
+        if (w.path.size() >= sizeof(SharedSceneWatchedEntry().path)) {
+            return;  // an untruncatable path could never revalidate
+        }
+    }
+    string name = shmSegmentName(shmSceneKey);
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return;
+    }
+    FILE* f = fdopen(fd, "wb");
+    if (f == NULL) {
+        close(fd);
+        shm_unlink(name.c_str());
+        return;
+    }
+    // the header goes in with version 0 and is patched complete at the
+    // end, so a reader mapping the segment mid-write sees a miss
+    SharedSceneHeader sh = {};
+    memcpy(sh.magic, "PTSH", 4);
+    sh.numWatched = (int)watchedFiles.size();
+    fwrite(&sh, sizeof(sh), 1, f);
+    for (const WatchedFile& w : watchedFiles) {
+        SharedSceneWatchedEntry e = {};
+        snprintf(e.path, sizeof(e.path), "%s", w.path.c_str());
+        e.mtime = w.mtime;
+        fwrite(&e, sizeof(e), 1, f);
+    }
+    long packedStart = ftell(f);
+    writePackedImage(*this, f);
+    long packedEnd = ftell(f);
+    fflush(f);
+    sh.version = kPackedSceneVersion;
+    sh.packedBytes = (unsigned long long)(packedEnd - packedStart);
+    bool ok = packedStart >= 0 && packedEnd >= packedStart
+        && pwrite(fd, &sh, sizeof(sh), 0) == (ssize_t)sizeof(sh);
+    fclose(f);
+    if (!ok) {  // /dev/shm full, most likely
+        shm_unlink(name.c_str());
+        return;
+    }
+    cout << "Published scene to shared cache " << name << " ("
+         << packedEnd << " bytes)" << endl;
+}
+#endif
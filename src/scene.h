@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -10,21 +11,167 @@
 
 using namespace std;
 
+// Knobs for the procedural benchmark scene (buildRandomScene): primitive
+// counts, material mix, mesh instancing, resolution and a fixed seed, so
+// acceleration-structure changes can be validated on reproducible scaling
+// sweeps instead of hand-edited source. Driven by GENERATOR scene files;
+// the defaults reproduce the original hard-coded scene.
+struct GeneratorParams {
+    int seed = 42;
+    int gridSize = 9;          // spheres on [-gridSize, gridSize)^2
+    float spacing = 1.5f;
+    float sphereRadius = 0.4f;
+    glm::ivec2 resolution = glm::ivec2(800, 600);
+    int iterations = 5000;
+    int traceDepth = 8;
+    // material mix ratios, normalized at use
+    float mixDiffuse = 0.75f;
+    float mixEmissive = 0.07f;
+    float mixMetal = 0.13f;
+    float mixGlass = 0.05f;
+    float movingFraction = 0.2f;
+    // "none" disables; "uvsphere:N" builds a procedural N-stack sphere
+    // mesh instead of loading a file (see buildUvSphere)
+    std::string meshFile = "../scenes/models/bunny.obj";
+    int meshInstances = 1;
+    // output/record name; benchmark and regression corpus entries set
+    // this so their references and timing records do not collide
+    std::string imageName = "benchmark";
+};
+
 class Scene {
 private:
-    ifstream fp_in;
+    // whole scene file slurped by one buffered read; line iteration then
+    // walks memory instead of the filesystem
+    istringstream fp_in;
     int loadMaterial(string materialid);
     int loadGeom(string objectid);
     int loadCamera();
+    int loadAnimation();
+    int loadView();
+    int loadMedium();
+    int loadPortal();
     bool loadObj(string filename, Geom &geom);
-    void buildRandomScene();
+    bool loadGltf(string filename, Geom &geom);
+    // shared post-load mesh cleanup: vertex weld, degenerate pruning and
+    // Morton triangle reordering over the freshly appended ranges
+    void finalizeMesh(Geom &geom, size_t vertexBase);
+    void buildUvSphere(int stacks, Geom &geom);
+    // collapse byte-identical materials into one palette entry and remap
+    // every geom's materialid; runs once after parsing or generation
+    void dedupMaterials();
+    // bake each sole-instance static mesh's transform into its triangles
+    // so traversal runs transform-free on them; instanced and moving
+    // meshes stay in object space. Runs once after parsing or generation
+    void bakeStaticMeshTransforms();
+    bool loadEnvMap(string filename);
+    bool loadImportanceMap(string filename);
+    bool loadPacked(string filename);
+    // POSIX-only twin of loadPacked's mapped path: parse one packed-scene
+    // image out of any read-only mapping (the packed file itself, or a
+    // shared-memory cache segment). label names the source in diagnostics;
+    // the mapping only has to outlive the call.
+    bool loadPackedFromMemory(const char* base, size_t bytes, const string& label);
+    // process-shared scene cache (SCENE_SHM_CACHE_ENABLE in scene.cpp):
+    // attach to / publish the POSIX shared-memory segment keyed by
+    // shmSceneKey, the content hash of the scene file
+    bool attachSharedScene();
+    void publishSharedScene() const;
+    unsigned long long shmSceneKey = 0;
+    void buildRandomScene(const GeneratorParams& params);
+    GeneratorParams parseGenerator();
     void addSphereByMaterial(Geom &geom, int id, glm::vec3 trans, float radius);
+    // meshes already loaded for this scene, keyed by filename; placing the
+    // same file again shares the triangle range (and so the BLAS built over
+    // it) instead of appending a duplicate copy, so memory scales with
+    // unique meshes rather than instance count
+    struct MeshRange {
+        int startIndex;
+        int endIndex;
+        glm::vec3 leftBottom;
+        glm::vec3 rightTop;
+    };
+    std::map<string, MeshRange> meshCache;
+    // albedo maps already decoded for this scene, keyed by filename, so
+    // materials sharing a map share one image (and one device mip chain)
+    std::map<string, int> textureCache;
+    // load an image file into Scene::textures; returns its 1-based id
+    // (Material::albedoTexId convention), or 0 on failure
+    int loadTexture(string filename);
+    // record a source file (and its current modification time) in
+    // watchedFiles; duplicates collapse to one entry
+    void watchFile(const string& filename);
+    // set once setAnimationFrame has recorded the start-of-animation poses
+    // (each geom's baseTranslation plus the camera keyframe below)
+    bool animBasesCaptured = false;
+    glm::vec3 eyeStart;
+    glm::vec3 lookAtStart;
 public:
     Scene(string filename);
     ~Scene();
 
+    // write this scene in the packed binary format loadPacked consumes
+    // (see scene.cpp); used by the offline scene compiler
+    void savePacked(string filename) const;
+
+    /**
+     * Pose the scene for one animation frame: lerp the camera (when the
+     * ANIMATION block keyframes it) and every MOTION geom's transform to
+     * frame / (state.frames - 1), leaving each geom's target one frame
+     * ahead so motion blur covers exactly that frame's sweep. Call after
+     * pathtraceInit (it reorders geoms), then pathtraceUpdateGeoms to push
+     * the new transforms to the device.
+     */
+    void setAnimationFrame(int frame);
+
     std::vector<Geom> geoms;
     std::vector<Material> materials;
-    std::vector<Triangle> triangles;
+    std::vector<glm::vec4> vertices;
+    std::vector<glm::vec4> normals;
+    // per-vertex texcoords, always sized to match vertices ((0, 0) where
+    // the source mesh had none) so TriangleIdx indexes all three pools
+    std::vector<glm::vec2> uvs;
+    std::vector<TriangleIdx> triangles;
+    // RGBA8 albedo maps referenced by Material::albedoTexId (1-based);
+    // uploaded as mipmapped bindless textures by pathtraceInit
+    struct SceneTexture {
+        int width;
+        int height;
+        std::vector<unsigned char> pixels;  // 4 * width * height bytes
+    };
+    std::vector<SceneTexture> textures;
+    // offline-built SAH BVH nodes from a packed scene (device-ready
+    // LBVHNode layout, geom.bvhRoot indices into it); empty means
+    // pathtraceInit builds the GPU LBVH as usual
+    std::vector<LBVHNode> bvhNodes;
+    // equirectangular HDR environment map from an ENVMAP directive, row 0 at
+    // the zenith; empty (width and height 0) when the scene has none. The
+    // texels are vec4 so the device texture over them is float4-aligned like
+    // the geometry pools.
+    int envMapWidth = 0;
+    int envMapHeight = 0;
+    std::vector<glm::vec4> envMap;
+    // grayscale importance map from an IMPORTANCE directive, row-major at
+    // its source resolution, values in [0, 1]; empty for scenes without
+    // one. Scales the adaptive-sampling freeze tolerance per pixel (see
+    // IMPORTANCE_MAP_ENABLE in pathtraceConfig.h).
+    int importanceWidth = 0;
+    int importanceHeight = 0;
+    std::vector<float> importanceMap;
+    // homogeneous participating medium; zero coefficients when the scene
+    // file has no MEDIUM block
+    Medium medium;
+    // environment portals (PORTAL blocks): rectangles next event
+    // estimation samples in place of the whole environment map, for
+    // interiors lit through openings; empty for scenes without any
+    std::vector<Portal> portals;
+    // every file this scene was parsed from (the scene text or packed
+    // blob, meshes, textures, environment map) with its modification time
+    // at load, so the viewer can poll for edits and hot-reload (main.cpp)
+    struct WatchedFile {
+        string path;
+        long long mtime;
+    };
+    std::vector<WatchedFile> watchedFiles;
     RenderState state;
 };
@@ -11,27 +11,115 @@ enum GeomType {
     SPHERE,
     CUBE,
     MESH,
+    // analytic infinite plane, y = 0 with a +y normal in object space;
+    // appended so packed scenes keep their type numbering
+    PLANE,
+};
+
+// Per-geom ray-class visibility (the scene file's VISIBLE line, default
+// all three): camera gates primary rays, indirect gates every later
+// closest-hit bounce, shadow gates the next-event-estimation occlusion
+// tests. Dropping a backdrop card or ground plane from the shadow class
+// removes it from every shadow ray's candidate set outright.
+enum VisFlags {
+    VIS_CAMERA = 1 << 0,
+    VIS_INDIRECT = 1 << 1,
+    VIS_SHADOW = 1 << 2,
+    VIS_ALL = VIS_CAMERA | VIS_INDIRECT | VIS_SHADOW,
 };
 
 struct Ray {
     glm::vec3 origin;
-    glm::vec3 direction;
+    glm::vec3 direction;  // kept normalized; the intersection tests rely on it
     float time = 0.0f;
 };
 
-struct Triangle {
-    glm::vec3 p1;
-    glm::vec3 p2;
-    glm::vec3 p3;
+// Indexed mesh storage: a triangle is three indices (w is padding) into
+// shared position/normal pools. The pools are glm::vec4 so every fetch is one
+// float4-aligned load, and vertices shared between faces are stored once
+// instead of being expanded per face.
+typedef glm::ivec4 TriangleIdx;
+
+// Storage format of the device-side normal pool. Shading normals are unit
+// length, so two octahedron coordinates determine the third: packing them
+// as 2x16-bit snorm cuts a pool entry from 16 bytes to 4, and the decode
+// is a handful of ALU ops paid once per winning hit, overlapping loads the
+// barycentric interpolation already waits on. The 16-bit grid's worst-case
+// angular error is a few hundredths of a degree, far below anything a
+// bounce direction resolves. Scene::normals stays glm::vec4 either way (the
+// G-buffer rasterizer hands it to OpenGL directly); only the device upload
+// converts, so flipping this needs no scene reload.
+#define OCT_NORMALS_ENABLE 1
+
+#if OCT_NORMALS_ENABLE
+typedef unsigned int PackedNormal;
+
+__host__ __device__ inline PackedNormal packNormal(glm::vec3 n) {
+    n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    float u = n.x;
+    float v = n.y;
+    if (n.z < 0.0f) {
+        // fold the lower hemisphere over the diagonals
+        u = (1.0f - glm::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        v = (1.0f - glm::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    int iu = (int)(glm::clamp(u, -1.0f, 1.0f) * 32767.0f + (u >= 0.0f ? 0.5f : -0.5f));
+    int iv = (int)(glm::clamp(v, -1.0f, 1.0f) * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f));
+    return ((unsigned int)(unsigned short)iv << 16) | (unsigned short)iu;
+}
+
+__host__ __device__ inline glm::vec3 unpackNormal(PackedNormal p) {
+    float u = (float)(short)(p & 0xffffu) * (1.0f / 32767.0f);
+    float v = (float)(short)(p >> 16) * (1.0f / 32767.0f);
+    glm::vec3 n(u, v, 1.0f - glm::abs(u) - glm::abs(v));
+    if (n.z < 0.0f) {
+        n.x = (1.0f - glm::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - glm::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(n);
+}
+#else
+typedef glm::vec4 PackedNormal;
+
+__host__ __device__ inline PackedNormal packNormal(glm::vec3 n) {
+    return glm::vec4(n, 0.0f);
+}
+
+__host__ __device__ inline glm::vec3 unpackNormal(const PackedNormal& p) {
+    return glm::vec3(p);
+}
+#endif
+
+// Node of a per-mesh LBVH over dev_triangles. Internal nodes store child node
+// indices; leaves store the index of one triangle. All indices are absolute
+// into the shared node / triangle buffers.
+struct LBVHNode {
+    glm::vec3 leftBottom;
+    glm::vec3 rightTop;
+    int left;           // -1 for leaves
+    int right;          // -1 for leaves
+    int triangleIndex;  // only valid for leaves
+    int parent;
+};
 
-    glm::vec3 n1;
-    glm::vec3 n2;
-    glm::vec3 n3;
+// 8-wide BVH node with child bounds quantized to 8 bits per axis against
+// the node's own box (origin + 255 * scale spans it); 104 bytes, about 5x
+// less than the eight binary nodes it replaces. Built host-side from the
+// binary tree by buildBVH8 (bvh8.h).
+struct BVH8Node {
+    glm::vec3 origin;  // this node's box min
+    glm::vec3 scale;   // box extent / 255, per axis
+    int child[8];      // >= 0: wide node index; < -1: leaf, triangle
+                       // index -(child + 2); == -1: empty slot
+    unsigned char qlo[8][3];
+    unsigned char qhi[8][3];
 };
 
 struct Geom {
     enum GeomType type;
     int materialid;
+    // VisFlags mask; rays of a class not set here never see this geom
+    int visibility = VIS_ALL;
     glm::vec3 translation;
     glm::vec3 rotation;
     glm::vec3 scale;
@@ -41,11 +129,94 @@ struct Geom {
 
     bool moving = false;
     glm::vec3 target;
+    // animation keyframes, captured the first time
+    // Scene::setAnimationFrame runs (it then rewrites translation and
+    // target per frame, so the endpoints must survive separately); unused
+    // for still renders, where target is just the shutter sweep
+    glm::vec3 baseTranslation;
+    glm::vec3 endTranslation;
+
+    int startIndex;
+    int endIndex;
+    glm::vec3 leftBottom;
+    glm::vec3 rightTop;
+    int bvhRoot = -1;
 
+    // simplified levels from the scene compiler, finest first; level 0 is
+    // the full-resolution range above. The runtime picks one level per
+    // instance from its projected size and writes it back into the range
+    // fields. numLods stays 1 for meshes loaded without compiled levels.
+    int numLods = 1;
+    int lodStart[3] = { -1, -1, -1 };
+    int lodEnd[3] = { -1, -1, -1 };
+    int lodRoot[3] = { -1, -1, -1 };
+};
+
+// Device-side split of Geom. The hot half is everything the intersection
+// tests stream per candidate geom, with the affine transforms stored as 3x4
+// (glm::mat4x3) since the projective row is always (0, 0, 0, 1). The cold
+// half is fetched once, for the geom the ray actually hit.
+struct GeomHot {
+    enum GeomType type;
     int startIndex;
     int endIndex;
+    int bvhRoot;
+    int visibility;  // VisFlags mask; traversal skips non-matching geoms
+    glm::mat4x3 inverseTransform;
+    glm::vec3 motionOffset;  // target - translation; zero for static geoms
+    // For meshes: the object-space AABB. Spheres reuse the fields instead:
+    // buildGeomSplit packs the world-space center into leftBottom and the
+    // world-space radius into rightTop.x when the transform is a rigid
+    // motion plus uniform scale, letting sphereIntersectionTest skip the
+    // matrix transforms entirely; rightTop.x < 0 marks a deformed sphere
+    // that still needs the matrix path. Planes likewise pack their
+    // world-space unit normal into leftBottom and the plane offset
+    // (dot(normal, point)) into rightTop.x, so planeIntersectionTest is a
+    // transform-free point-normal test.
     glm::vec3 leftBottom;
     glm::vec3 rightTop;
+    // nonzero for meshes whose triangles were baked into world space at
+    // load (Scene::bakeStaticMeshTransforms left the transform at
+    // identity): the mesh tests skip the ray transform entirely
+    int worldSpace;
+};
+
+struct GeomCold {
+    glm::mat3 invTranspose;
+    int materialid;
+    float lightArea;  // surface area if this geom is a listed light, else 0
+};
+
+// One emissive geom flattened for device-side light sampling (next event
+// estimation). Mesh emitters are not listed; BSDF samples still collect
+// them at full weight.
+struct Light {
+    enum GeomType type;
+    glm::mat4x3 transform;
+    glm::vec3 emittance;  // material color * emittance
+    float area;           // world-space surface area (average-scale approx)
+};
+
+// Scene-wide homogeneous participating medium (the scene file's MEDIUM
+// block): per-channel scattering and absorption coefficients per world
+// unit plus the Henyey-Greenstein anisotropy. The medium fills all space;
+// a zero extinction (the default) means the scene has none.
+struct Medium {
+    glm::vec3 sigmaS = glm::vec3(0.0f);
+    glm::vec3 sigmaA = glm::vec3(0.0f);
+    float g = 0.0f;
+};
+
+// One environment portal (the scene file's PORTAL block): a rectangle
+// marking an opening the environment light enters through, flattened to a
+// corner plus two edge vectors so sampling a point is two uniform draws.
+// Virtual - portals are never intersected as geometry - and two-sided.
+struct Portal {
+    glm::vec3 corner;
+    glm::vec3 edgeU;
+    glm::vec3 edgeV;
+    glm::vec3 normal;  // unit; orientation is ignored by the samplers
+    float area;        // world-space area, |edgeU x edgeV|
 };
 
 struct Material {
@@ -54,10 +225,21 @@ struct Material {
         float exponent;
         glm::vec3 color;
     } specular;
+    float roughness;  // GGX alpha for the reflective lobe; 0 = perfect mirror
     float hasReflective;
     float hasRefractive;
     float indexOfRefraction;
     float emittance;
+    // bindless albedo map, multiplied into color at shading time; 0 for
+    // untextured materials. The handle is per-device: pathtraceInitDevice
+    // patches it into the upload copy from albedoTexId, which is what the
+    // loader actually sets (1-based index into Scene::textures, 0 = none).
+    // albedoMaxLod is log2(width) of the map's mip chain, precomputed for
+    // the distance-based lod heuristic. No default initializers: the
+    // generator's aggregate initializers rely on value-init zeroing these.
+    cudaTextureObject_t albedoTex;
+    float albedoMaxLod;
+    int albedoTexId;
 };
 
 struct Camera {
@@ -69,6 +251,12 @@ struct Camera {
     glm::vec3 right;
     glm::vec2 fov;
     glm::vec2 pixelLength;
+    // crop window for tile rendering: the camera renders `resolution`
+    // pixels starting at cropOffset within a fullResolution frame, and the
+    // pixelLength centering uses the full frame. A normal camera has
+    // cropOffset (0, 0) and fullResolution == resolution.
+    glm::ivec2 cropOffset;
+    glm::ivec2 fullResolution;
 };
 
 struct RenderState {
@@ -77,6 +265,22 @@ struct RenderState {
     int traceDepth;
     std::vector<glm::vec3> image;
     std::string imageName;
+
+    // animation (ANIMATION scene block): number of frames to render, 1 for
+    // a still. When animateCamera is set the camera pose lerps from the
+    // CAMERA block's EYE/LOOKAT to the end keyframes below; geoms flagged
+    // MOTION lerp translation -> target over the same frame range.
+    int frames = 1;
+    bool animateCamera = false;
+    glm::vec3 eyeEnd;
+    glm::vec3 lookAtEnd;
+
+    // multi-view batch (VIEW scene blocks): extra camera poses rendered
+    // after the CAMERA block's pose in one process, so the scene parse,
+    // device upload and BVH builds are paid once for the whole set. Each
+    // view gets its own accumulation via pathtraceCameraReset and saves
+    // as imageName.v00.png etc. Empty for a single-view render.
+    std::vector<Camera> views;
 };
 
 struct PathSegment {
@@ -94,4 +298,76 @@ struct ShadeableIntersection {
   glm::vec3 surfaceNormal;
   int materialId;
   glm::vec3 point;
+};
+
+// Storage format of the throughput and banked-radiance streams. Both hold
+// values the shading kernels read-modify-write every bounce, and throughput
+// lives in [0, 1] after the first few bounces, so fp16 carries them fine:
+// enabling this stores each vec3 as three halves (8 bytes with padding
+// instead of 12), cutting a third off the streams' bandwidth on 4K renders
+// that are bound by it. All arithmetic still happens in fp32 through the
+// conversion operators below; only the memory format changes. Validate with
+// an image diff against an fp32 render of the same scene before shipping a
+// build with it on. dev_image stays fp32: the accumulator's magnitude grows
+// with the iteration count, and the denoiser, adaptive sampling, tile merge
+// and host readback all consume it directly.
+#define HALF_COLOR_ENABLE 0
+
+#if HALF_COLOR_ENABLE
+#include <cuda_fp16.h>
+struct __align__(8) PathColor {
+    __half x, y, z, pad;
+    __device__ PathColor& operator=(const glm::vec3& v) {
+        x = __float2half(v.x); y = __float2half(v.y); z = __float2half(v.z);
+        return *this;
+    }
+    __device__ operator glm::vec3() const {
+        return glm::vec3(__half2float(x), __half2float(y), __half2float(z));
+    }
+    __device__ PathColor& operator*=(const glm::vec3& v) {
+        return *this = glm::vec3(*this) * v;
+    }
+    __device__ PathColor& operator+=(const glm::vec3& v) {
+        return *this = glm::vec3(*this) + v;
+    }
+    // member operators so mixed products need no template deduction against
+    // glm's operators
+    __device__ glm::vec3 operator*(const glm::vec3& v) const {
+        return glm::vec3(*this) * v;
+    }
+    __device__ glm::vec3 operator*(float f) const {
+        return glm::vec3(*this) * f;
+    }
+};
+#else
+typedef glm::vec3 PathColor;
+#endif
+
+// Structure-of-arrays device storage for the path segment and intersection
+// pools. The pointer tables are passed to kernels by value; each hot load
+// then only touches the component stream it actually needs, so transactions
+// stay coalesced instead of striding over whole structs.
+struct PathSegmentSoA {
+    glm::vec3* origins;
+    glm::vec3* directions;
+    glm::vec3* invDirections;  // 1/direction, refreshed with every scatter
+    float* times;
+    PathColor* colors;         // multiplicative path throughput
+    PathColor* radiances;      // additive radiance banked by direct lighting
+    int* pixelIndices;
+    int* remainingBounces;
+    float* prevPdfs;           // solid-angle pdf of the last BSDF sample;
+                               // negative for delta lobes and primary rays
+    int* guideBins;            // guiding histogram slot (cell * bins + bin)
+                               // of the last guided bounce, -1 for none;
+                               // only carved with PATH_GUIDING_ENABLE
+};
+
+struct ShadeableIntersectionSoA {
+    float* t;
+    glm::vec3* surfaceNormals;
+    int* materialIds;
+    glm::vec3* points;
+    float* lightAreas;  // GeomCold::lightArea of the geom hit
+    glm::vec2* uvs;     // interpolated texcoords; (0, 0) off meshes
 };
\ No newline at end of file
@@ -0,0 +1,137 @@
+// Offline scene compiler: reads a text scene (and the OBJ files it
+// references), runs every preprocessing pass Scene already does at
+// startup - tokenized parsing, transform matrix builds from loadGeom,
+// mesh AABB computation from loadObj - and writes the packed binary
+// format loadPacked consumes. Geom already carries the BVH hookup fields
+// (bvhRoot, start/endIndex), so offline BVH construction slots in here
+// later without another format change. Run once per asset change; render
+// jobs then cold-start with zero parsing.
+
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include "sahbvh.h"
+#include "scene.h"
+
+// Vertex-clustering decimation of one triangle range: vertices snap to a
+// cellsPerAxis^3 grid over the mesh AABB (first vertex seen in a cell is
+// its representative, so positions stay on the surface), and triangles
+// whose corners collapse into fewer than three cells are dropped. The
+// simplified range is appended to the shared pools.
+//
+// Returns the surviving triangle count; 0 appends nothing.
+static int simplifyRange(Scene& scene, const Geom& geom, int cellsPerAxis,
+        int& outStart, int& outEnd) {
+    glm::vec3 lo = geom.leftBottom;
+    glm::vec3 invCell = (float)cellsPerAxis
+        / glm::max(geom.rightTop - lo, glm::vec3(1e-6f));
+    std::map<long long, int> cellVertex;
+    std::vector<TriangleIdx> simplified;
+    for (int t = geom.startIndex; t <= geom.endIndex; t++) {
+        TriangleIdx tri = scene.triangles[t];
+        long long keys[3];
+        int remapped[3];
+        for (int k = 0; k < 3; k++) {
+            int vi = tri[k];
+            glm::vec3 p = glm::vec3(scene.vertices[vi]);
+            glm::ivec3 c = glm::clamp(glm::ivec3((p - lo) * invCell),
+                glm::ivec3(0), glm::ivec3(cellsPerAxis - 1));
+            keys[k] = ((long long)c.x * cellsPerAxis + c.y) * cellsPerAxis + c.z;
+            std::map<long long, int>::iterator it = cellVertex.find(keys[k]);
+            if (it == cellVertex.end()) {
+                it = cellVertex.insert(std::make_pair(keys[k],
+                    (int)scene.vertices.size())).first;
+                scene.vertices.push_back(scene.vertices[vi]);
+                scene.normals.push_back(scene.normals[vi]);
+            }
+            remapped[k] = it->second;
+        }
+        if (keys[0] == keys[1] || keys[1] == keys[2] || keys[0] == keys[2]) {
+            continue;
+        }
+        simplified.push_back(TriangleIdx(remapped[0], remapped[1], remapped[2], tri.w));
+    }
+    if (simplified.empty()) {
+        return 0;
+    }
+    outStart = (int)scene.triangles.size();
+    scene.triangles.insert(scene.triangles.end(), simplified.begin(), simplified.end());
+    outEnd = (int)scene.triangles.size() - 1;
+    return (int)simplified.size();
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        printf("Usage: %s SCENEFILE.txt OUTPUT.ptsc\n", argv[0]);
+        return 1;
+    }
+    Scene scene(argv[1]);
+    if (scene.geoms.empty() && scene.materials.empty()) {
+        printf("Nothing loaded from %s, not writing %s\n", argv[1], argv[2]);
+        return 1;
+    }
+    // offline SAH trees for every mesh; scenes without meshes pack an
+    // empty node array and keep using the GPU LBVH path
+    scene.bvhNodes.clear();
+    // per unique triangle range: simplified LOD levels (each targeting a
+    // quarter of the previous level's grid resolution), then one SAH tree
+    // per level. Instances sharing a range copy the owner's chain - a
+    // second build would re-permute the range out from under the first
+    // tree's leaves
+    std::map<int, size_t> rangeOwner;
+    for (size_t g = 0; g < scene.geoms.size(); g++) {
+        Geom& geom = scene.geoms[g];
+        if (geom.type != MESH) {
+            continue;
+        }
+        std::map<int, size_t>::iterator owner = rangeOwner.find(geom.startIndex);
+        if (owner != rangeOwner.end()) {
+            const Geom& built = scene.geoms[owner->second];
+            geom.numLods = built.numLods;
+            for (int l = 0; l < built.numLods; l++) {
+                geom.lodStart[l] = built.lodStart[l];
+                geom.lodEnd[l] = built.lodEnd[l];
+                geom.lodRoot[l] = built.lodRoot[l];
+            }
+            geom.bvhRoot = built.bvhRoot;
+            continue;
+        }
+        rangeOwner[geom.startIndex] = g;
+
+        geom.numLods = 1;
+        geom.lodStart[0] = geom.startIndex;
+        geom.lodEnd[0] = geom.endIndex;
+        int prevCount = geom.endIndex - geom.startIndex + 1;
+        for (int cells = 64; cells >= 16 && geom.numLods < 3; cells /= 4) {
+            int ls, le;
+            int count = simplifyRange(scene, geom, cells, ls, le);
+            // a level only earns its keep if it sheds real work
+            if (count < 16 || count * 4 > prevCount * 3) {
+                break;
+            }
+            geom.lodStart[geom.numLods] = ls;
+            geom.lodEnd[geom.numLods] = le;
+            geom.numLods++;
+            prevCount = count;
+        }
+
+        int totalNodes = 0;
+        for (int l = 0; l < geom.numLods; l++) {
+            Geom level = geom;
+            level.startIndex = geom.lodStart[l];
+            level.endIndex = geom.lodEnd[l];
+            totalNodes += buildMeshSAHBVH(scene.triangles, scene.vertices,
+                level, scene.bvhNodes);
+            geom.lodRoot[l] = level.bvhRoot;
+        }
+        geom.bvhRoot = geom.lodRoot[0];
+        printf("SAH BVH for geom %d: %d nodes over %d LOD level%s\n",
+            (int)g, totalNodes, geom.numLods, geom.numLods == 1 ? "" : "s");
+    }
+
+    // re-packing a packed scene is fine: after a version bump it upgrades
+    // old files, as long as this build can still read them
+    scene.savePacked(argv[2]);
+    return 0;
+}
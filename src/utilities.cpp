@@ -8,9 +8,28 @@
 #include <glm/gtc/matrix_inverse.hpp>
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/stat.h>
 
 #include "utilities.h"
 
+long long utilityCore::fileModTime(const std::string& path) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path.c_str(), &st) != 0) {
+        return 0;
+    }
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+#endif
+    return (long long)st.st_mtime;
+}
+
 float utilityCore::clamp(float f, float min, float max) {
     if (f < min) {
         return min;
@@ -71,6 +90,44 @@ glm::mat4 utilityCore::buildTransformationMatrix(glm::vec3 translation, glm::vec
     return translationMat * rotationMat * scaleMat;
 }
 
+bool utilityCore::Token::equals(const char* s) const {
+    return strncmp(ptr, s, len) == 0 && s[len] == '\0';
+}
+
+// tokens always end at whitespace or the line terminator, so strtod /
+// strtol stop on their own and no null-terminated copy is needed
+float utilityCore::Token::toFloat() const {
+    return (float)strtod(ptr, NULL);
+}
+
+int utilityCore::Token::toInt() const {
+    return (int)strtol(ptr, NULL, 10);
+}
+
+std::string utilityCore::Token::toString() const {
+    return std::string(ptr, len);
+}
+
+void utilityCore::tokenizeLine(const std::string& line, std::vector<Token>& tokens) {
+    tokens.clear();
+    const char* p = line.c_str();
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        Token t;
+        t.ptr = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        t.len = p - t.ptr;
+        tokens.push_back(t);
+    }
+}
+
 std::vector<std::string> utilityCore::tokenizeString(std::string str) {
     std::stringstream strstr(str);
     std::istream_iterator<std::string> it(strstr);
@@ -20,7 +20,26 @@ namespace utilityCore {
     extern glm::vec3 clampRGB(glm::vec3 color);
     extern bool epsilonCheck(float a, float b);
     extern std::vector<std::string> tokenizeString(std::string str);
+
+    // Zero-allocation line tokenizer for the scene text parser: tokens are
+    // slices into the caller's line buffer (valid only until that buffer is
+    // reused) and numeric conversion runs in place, so steady-state parsing
+    // allocates nothing. tokenizeLine clears and refills the caller's
+    // vector, whose capacity survives across lines.
+    struct Token {
+        const char* ptr;
+        size_t len;
+
+        bool equals(const char* s) const;
+        float toFloat() const;
+        int toInt() const;
+        std::string toString() const;
+    };
+    extern void tokenizeLine(const std::string& line, std::vector<Token>& tokens);
     extern glm::mat4 buildTransformationMatrix(glm::vec3 translation, glm::vec3 rotation, glm::vec3 scale);
+    // last-modification time of a file in seconds since the epoch, 0 when
+    // it cannot be stat'ed; the scene hot-reload watcher polls this
+    extern long long fileModTime(const std::string& path);
     extern std::string convertIntToString(int number);
     extern std::istream& safeGetline(std::istream& is, std::string& t); //Thanks to http://stackoverflow.com/a/6089413
 }
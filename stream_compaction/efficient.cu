@@ -0,0 +1,526 @@
+#include <cstdio>
+#include <vector>
+#include "efficient.h"
+
+// Work-efficient (Blelloch) exclusive scan: 2 elements per thread, up-sweep
+// and down-sweep over a shared-memory tree. Shared indices are padded every
+// NUM_BANKS words so the power-of-two strides of the tree phases do not all
+// land in the same bank and serialize.
+#define SCAN_BLOCK 128
+#define SCAN_ELEMS (2 * SCAN_BLOCK)
+#define LOG_NUM_BANKS 5
+#define CONFLICT_FREE_OFFSET(i) ((i) >> LOG_NUM_BANKS)
+
+namespace StreamCompaction {
+
+// scratch, cached across bounces: liveness flags scanned in place, the
+// dead-slot index table, and one block-sum array per scan level
+static int* dev_scan = NULL;
+static int* dev_deadSlots = NULL;
+static int* dev_numAlive = NULL;
+static int scratchCapacity = 0;
+static std::vector<int*> dev_levelSums;
+static std::vector<int> levelCapacities;
+
+// Exclusive scan of one SCAN_ELEMS tile in shared memory; the tile total
+// goes to blockSums for the next level.
+__global__ void kernBlockScan(int n, int* data, int* blockSums)
+{
+	__shared__ int temp[SCAN_ELEMS + (SCAN_ELEMS >> LOG_NUM_BANKS)];
+	int tid = threadIdx.x;
+	int base = blockIdx.x * SCAN_ELEMS;
+	int ai = tid;
+	int bi = tid + SCAN_BLOCK;
+	temp[ai + CONFLICT_FREE_OFFSET(ai)] = base + ai < n ? data[base + ai] : 0;
+	temp[bi + CONFLICT_FREE_OFFSET(bi)] = base + bi < n ? data[base + bi] : 0;
+
+	// up-sweep: build partial sums up the tree
+	int offset = 1;
+	for (int d = SCAN_ELEMS >> 1; d > 0; d >>= 1) {
+		__syncthreads();
+		if (tid < d) {
+			int i = offset * (2 * tid + 1) - 1;
+			int j = offset * (2 * tid + 2) - 1;
+			i += CONFLICT_FREE_OFFSET(i);
+			j += CONFLICT_FREE_OFFSET(j);
+			temp[j] += temp[i];
+		}
+		offset <<= 1;
+	}
+
+	if (tid == 0) {
+		int last = SCAN_ELEMS - 1 + CONFLICT_FREE_OFFSET(SCAN_ELEMS - 1);
+		blockSums[blockIdx.x] = temp[last];
+		temp[last] = 0;
+	}
+
+	// down-sweep: rotate the partials into an exclusive scan
+	for (int d = 1; d < SCAN_ELEMS; d <<= 1) {
+		offset >>= 1;
+		__syncthreads();
+		if (tid < d) {
+			int i = offset * (2 * tid + 1) - 1;
+			int j = offset * (2 * tid + 2) - 1;
+			i += CONFLICT_FREE_OFFSET(i);
+			j += CONFLICT_FREE_OFFSET(j);
+			int t = temp[i];
+			temp[i] = temp[j];
+			temp[j] += t;
+		}
+	}
+	__syncthreads();
+
+	if (base + ai < n) {
+		data[base + ai] = temp[ai + CONFLICT_FREE_OFFSET(ai)];
+	}
+	if (base + bi < n) {
+		data[base + bi] = temp[bi + CONFLICT_FREE_OFFSET(bi)];
+	}
+}
+
+// Single-block exclusive scan for the top of the block-sum pyramid
+// (n <= 1024): a shuffle scan inside each warp, warp totals scanned by
+// warp 0 by shuffles again — no tree, no bank traffic at this size.
+__global__ void kernSmallScanShfl(int n, int* data)
+{
+	__shared__ int warpSums[32];
+	int tid = threadIdx.x;
+	int lane = tid & 31;
+	int warp = tid >> 5;
+	int orig = tid < n ? data[tid] : 0;
+
+	int v = orig;
+	for (int d = 1; d < 32; d <<= 1) {
+		int up = __shfl_up_sync(0xffffffff, v, d);
+		if (lane >= d) {
+			v += up;
+		}
+	}
+	if (lane == 31) {
+		warpSums[warp] = v;
+	}
+	__syncthreads();
+	if (warp == 0) {
+		int w = lane < (int)(blockDim.x >> 5) ? warpSums[lane] : 0;
+		for (int d = 1; d < 32; d <<= 1) {
+			int up = __shfl_up_sync(0xffffffff, w, d);
+			if (lane >= d) {
+				w += up;
+			}
+		}
+		warpSums[lane] = w;
+	}
+	__syncthreads();
+
+	int inclusive = v + (warp > 0 ? warpSums[warp - 1] : 0);
+	if (tid < n) {
+		data[tid] = inclusive - orig;
+	}
+}
+
+// Fold each tile's scanned block sum back into its elements.
+__global__ void kernUniformAdd(int n, int* data, const int* blockSums)
+{
+	int base = blockIdx.x * SCAN_ELEMS;
+	int add = blockSums[blockIdx.x];
+	int ai = base + threadIdx.x;
+	int bi = ai + SCAN_BLOCK;
+	if (ai < n) {
+		data[ai] += add;
+	}
+	if (bi < n) {
+		data[bi] += add;
+	}
+}
+
+__global__ void kernMarkAlive(int n, PathSegmentSoA paths, int* flags)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < n) {
+		flags[i] = paths.remainingBounces[i] > 0 ? 1 : 0;
+	}
+}
+
+// Record, for every dead slot in the front region [0, numAlive), its rank
+// among the dead slots there. scan[i] counts live paths before i, so the
+// dead rank is just i - scan[i].
+__global__ void kernIndexDeadFront(int numAlive, PathSegmentSoA paths,
+	const int* scan, int* deadSlots)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < numAlive && paths.remainingBounces[i] <= 0) {
+		deadSlots[i - scan[i]] = i;
+	}
+}
+
+// Move each live path in the back region [numAlive, n) into the dead front
+// slot of the same rank. Sources and destinations are disjoint regions, so
+// every stream copies race-free and in place.
+__global__ void kernRelocateBackAlive(int n, int numAlive, PathSegmentSoA paths,
+	const int* scan, const int* deadSlots)
+{
+	int i = numAlive + blockIdx.x * blockDim.x + threadIdx.x;
+	if (i >= n || paths.remainingBounces[i] <= 0) {
+		return;
+	}
+	int dst = deadSlots[scan[i] - scan[numAlive]];
+	paths.origins[dst] = paths.origins[i];
+	paths.directions[dst] = paths.directions[i];
+	paths.invDirections[dst] = paths.invDirections[i];
+	paths.times[dst] = paths.times[i];
+	paths.colors[dst] = paths.colors[i];
+	paths.radiances[dst] = paths.radiances[i];
+	paths.pixelIndices[dst] = paths.pixelIndices[i];
+	paths.remainingBounces[dst] = paths.remainingBounces[i];
+	paths.prevPdfs[dst] = paths.prevPdfs[i];
+}
+
+__global__ void kernMarkAliveIndexed(int n, const int* in, PathSegmentSoA paths, int* flags)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < n) {
+		flags[i] = paths.remainingBounces[in != NULL ? in[i] : i] > 0 ? 1 : 0;
+	}
+}
+
+// Fold the last element's own flag (which the exclusive scan misses) into
+// the total and publish the live count on the device.
+__global__ void kernWriteAliveCount(int n, const int* in, PathSegmentSoA paths,
+	const int* scan, int* numAlive)
+{
+	int lastSlot = in != NULL ? in[n - 1] : n - 1;
+	numAlive[0] = scan[n - 1] + (paths.remainingBounces[lastSlot] > 0 ? 1 : 0);
+}
+
+// Stable split scatter: surviving indices go to their scan rank, dead ones
+// behind them in order. The output is a full permutation of the input, so a
+// caller launching with a stale (over-)count still lands every extra thread
+// on a genuinely dead slot that its bounce check rejects.
+__global__ void kernScatterIndices(int n, const int* in, PathSegmentSoA paths,
+	const int* scan, const int* numAlive, int* out)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < n) {
+		int slot = in != NULL ? in[i] : i;
+		if (paths.remainingBounces[slot] > 0) {
+			out[scan[i]] = slot;
+		}
+		else {
+			out[numAlive[0] + i - scan[i]] = slot;
+		}
+	}
+}
+
+// LSD radix sort over 4-bit digits: each pass histograms SORT_TILE-element
+// tiles in shared memory, one exclusive scan of the digit-major counts
+// turns them into global base offsets, and a scatter kernel sorts each tile
+// locally (stable) before writing runs of equal digits out coalesced.
+#define SORT_BITS 4
+#define SORT_RADIX (1 << SORT_BITS)
+#define SORT_BLOCK 256
+#define SORT_ELEMS_PER_THREAD 4
+#define SORT_TILE (SORT_BLOCK * SORT_ELEMS_PER_THREAD)
+
+// Per-tile digit histogram, written digit-major (counts[digit * numTiles +
+// tile]) so a single exclusive scan of the whole array yields the global
+// output base of every (digit, tile) pair at once.
+__global__ void kernRadixCount(int n, const unsigned int* keys, int shift,
+	int* counts, int numTiles)
+{
+	__shared__ int hist[SORT_RADIX];
+	int tid = threadIdx.x;
+	if (tid < SORT_RADIX) {
+		hist[tid] = 0;
+	}
+	__syncthreads();
+	int base = blockIdx.x * SORT_TILE;
+	for (int e = 0; e < SORT_ELEMS_PER_THREAD; e++) {
+		int i = base + e * SORT_BLOCK + tid;
+		if (i < n) {
+			atomicAdd(&hist[(keys[i] >> shift) & (SORT_RADIX - 1)], 1);
+		}
+	}
+	__syncthreads();
+	if (tid < SORT_RADIX) {
+		counts[tid * numTiles + blockIdx.x] = hist[tid];
+	}
+}
+
+// Exclusive scan of the SORT_TILE flags in sScan (4 consecutive elements
+// per thread summed in registers, shuffle scan of the per-thread sums,
+// warp totals folded serially by thread 0 — there are only 8); returns the
+// tile total. Each thread only ever reads back the entries it wrote, so no
+// trailing barrier is needed here.
+__device__ int tileScanFlags(int* sScan, int* sWarp)
+{
+	int tid = threadIdx.x;
+	int b = tid * SORT_ELEMS_PER_THREAD;
+	int f0 = sScan[b];
+	int f1 = sScan[b + 1];
+	int f2 = sScan[b + 2];
+	int f3 = sScan[b + 3];
+	int sum = f0 + f1 + f2 + f3;
+	int lane = tid & 31;
+	int warp = tid >> 5;
+	int v = sum;
+	for (int d = 1; d < 32; d <<= 1) {
+		int up = __shfl_up_sync(0xffffffff, v, d);
+		if (lane >= d) {
+			v += up;
+		}
+	}
+	if (lane == 31) {
+		sWarp[warp] = v;
+	}
+	__syncthreads();
+	if (tid == 0) {
+		int total = 0;
+		for (int w = 0; w < SORT_BLOCK / 32; w++) {
+			int t = sWarp[w];
+			sWarp[w] = total;
+			total += t;
+		}
+		sWarp[SORT_BLOCK / 32] = total;
+	}
+	__syncthreads();
+	int excl = v - sum + sWarp[warp];
+	sScan[b] = excl;
+	sScan[b + 1] = excl + f0;
+	sScan[b + 2] = excl + f0 + f1;
+	sScan[b + 3] = excl + f0 + f1 + f2;
+	return sWarp[SORT_BLOCK / 32];
+}
+
+// One radix pass: sort the tile on the current digit in shared memory with
+// SORT_BITS stable binary splits (zeros first, ping-ponging between two
+// shared copies), then scatter it out. After the local sort every digit
+// occupies one contiguous run, so the global writes of a tile are coalesced
+// runs instead of SORT_TILE scattered words. Slots past n load the maximum
+// key, sort to the back of the last tile (stability keeps them behind the
+// genuine maximum-digit entries) and are simply never written out.
+__global__ void kernRadixScatter(int n, const unsigned int* keysIn,
+	const int* valsIn, int shift, const int* counts, int numTiles,
+	unsigned int* keysOut, int* valsOut)
+{
+	__shared__ unsigned int sKeys[2][SORT_TILE];
+	__shared__ int sVals[2][SORT_TILE];
+	__shared__ int sScan[SORT_TILE];
+	__shared__ int sWarp[SORT_BLOCK / 32 + 1];
+	__shared__ int sStart[SORT_RADIX];
+	int tid = threadIdx.x;
+	int base = blockIdx.x * SORT_TILE;
+	for (int e = 0; e < SORT_ELEMS_PER_THREAD; e++) {
+		int j = e * SORT_BLOCK + tid;
+		int i = base + j;
+		sKeys[0][j] = i < n ? keysIn[i] : 0xffffffffu;
+		sVals[0][j] = i < n ? valsIn[i] : 0;
+	}
+	__syncthreads();
+
+	int src = 0;
+	int b = tid * SORT_ELEMS_PER_THREAD;
+	for (int bit = 0; bit < SORT_BITS; bit++) {
+		for (int k = 0; k < SORT_ELEMS_PER_THREAD; k++) {
+			sScan[b + k] = ((sKeys[src][b + k] >> (shift + bit)) & 1u) == 0u ? 1 : 0;
+		}
+		int zeros = tileScanFlags(sScan, sWarp);
+		for (int k = 0; k < SORT_ELEMS_PER_THREAD; k++) {
+			int j = b + k;
+			unsigned int key = sKeys[src][j];
+			int rank = ((key >> (shift + bit)) & 1u) == 0u
+				? sScan[j]
+				: zeros + j - sScan[j];
+			sKeys[src ^ 1][rank] = key;
+			sVals[src ^ 1][rank] = sVals[src][j];
+		}
+		src ^= 1;
+		__syncthreads();
+	}
+
+	// first tile position of each digit present in the sorted tile
+	for (int e = 0; e < SORT_ELEMS_PER_THREAD; e++) {
+		int j = e * SORT_BLOCK + tid;
+		int d = (sKeys[src][j] >> shift) & (SORT_RADIX - 1);
+		if (j == 0 || d != (int)((sKeys[src][j - 1] >> shift) & (SORT_RADIX - 1))) {
+			sStart[d] = j;
+		}
+	}
+	__syncthreads();
+
+	int valid = n - base < SORT_TILE ? n - base : SORT_TILE;
+	for (int e = 0; e < SORT_ELEMS_PER_THREAD; e++) {
+		int j = e * SORT_BLOCK + tid;
+		if (j >= valid) {
+			continue;
+		}
+		unsigned int key = sKeys[src][j];
+		int d = (key >> shift) & (SORT_RADIX - 1);
+		int pos = counts[d * numTiles + blockIdx.x] + j - sStart[d];
+		keysOut[pos] = key;
+		valsOut[pos] = sVals[src][j];
+	}
+}
+
+static int* levelSums(int level, int capacity)
+{
+	if ((int)dev_levelSums.size() <= level) {
+		dev_levelSums.resize(level + 1, NULL);
+		levelCapacities.resize(level + 1, 0);
+	}
+	if (levelCapacities[level] < capacity) {
+		cudaFree(dev_levelSums[level]);
+		cudaMalloc(&dev_levelSums[level], capacity * sizeof(int));
+		levelCapacities[level] = capacity;
+	}
+	return dev_levelSums[level];
+}
+
+// In-place exclusive scan over device data: tile scans plus a recursive
+// scan of the tile totals, terminated by the shuffle kernel once a level
+// fits in one block.
+static void scanDevice(int* data, int n, cudaStream_t stream, int level)
+{
+	if (n <= 1024) {
+		kernSmallScanShfl << <1, 1024, 0, stream >> > (n, data);
+		return;
+	}
+	int numBlocks = (n + SCAN_ELEMS - 1) / SCAN_ELEMS;
+	int* sums = levelSums(level, numBlocks);
+	kernBlockScan << <numBlocks, SCAN_BLOCK, 0, stream >> > (n, data, sums);
+	scanDevice(sums, numBlocks, stream, level + 1);
+	kernUniformAdd << <numBlocks, SCAN_BLOCK, 0, stream >> > (n, data, sums);
+}
+
+size_t sortPairsScratchBytes(int n)
+{
+	int numTiles = (n + SORT_TILE - 1) / SORT_TILE;
+	return (size_t)n * (sizeof(unsigned int) + sizeof(int))
+		+ (size_t)SORT_RADIX * numTiles * sizeof(int);
+}
+
+void sortPairs(unsigned int* keys, int* values, int n, int endBit,
+	void* scratch, cudaStream_t stream)
+{
+	if (n <= 1) {
+		return;
+	}
+	int numTiles = (n + SORT_TILE - 1) / SORT_TILE;
+	unsigned int* altKeys = (unsigned int*)scratch;
+	int* altVals = (int*)(altKeys + n);
+	int* counts = altVals + n;
+
+	unsigned int* srcKeys = keys;
+	int* srcVals = values;
+	unsigned int* dstKeys = altKeys;
+	int* dstVals = altVals;
+	for (int shift = 0; shift < endBit; shift += SORT_BITS) {
+		kernRadixCount << <numTiles, SORT_BLOCK, 0, stream >> > (
+			n, srcKeys, shift, counts, numTiles);
+		scanDevice(counts, SORT_RADIX * numTiles, stream, 0);
+		kernRadixScatter << <numTiles, SORT_BLOCK, 0, stream >> > (
+			n, srcKeys, srcVals, shift, counts, numTiles, dstKeys, dstVals);
+		unsigned int* tk = srcKeys; srcKeys = dstKeys; dstKeys = tk;
+		int* tv = srcVals; srcVals = dstVals; dstVals = tv;
+	}
+	// an odd number of passes leaves the result in the alternate buffers
+	if (srcKeys != keys) {
+		cudaMemcpyAsync(keys, srcKeys, n * sizeof(unsigned int),
+			cudaMemcpyDeviceToDevice, stream);
+		cudaMemcpyAsync(values, srcVals, n * sizeof(int),
+			cudaMemcpyDeviceToDevice, stream);
+	}
+}
+
+int compactActivePaths(PathSegmentSoA paths, int n, cudaStream_t stream)
+{
+	if (n <= 0) {
+		return 0;
+	}
+	if (scratchCapacity < n) {
+		cudaFree(dev_scan);
+		cudaFree(dev_deadSlots);
+		cudaMalloc(&dev_scan, n * sizeof(int));
+		cudaMalloc(&dev_deadSlots, n * sizeof(int));
+		scratchCapacity = n;
+	}
+
+	const int blockSize = 128;
+	int numBlocks = (n + blockSize - 1) / blockSize;
+	kernMarkAlive << <numBlocks, blockSize, 0, stream >> > (n, paths, dev_scan);
+	scanDevice(dev_scan, n, stream, 0);
+
+	// the exclusive scan misses the last element's own flag
+	int scanLast = 0;
+	int lastBounces = 0;
+	cudaMemcpyAsync(&scanLast, dev_scan + n - 1, sizeof(int), cudaMemcpyDeviceToHost, stream);
+	cudaMemcpyAsync(&lastBounces, paths.remainingBounces + n - 1, sizeof(int), cudaMemcpyDeviceToHost, stream);
+	cudaStreamSynchronize(stream);
+	int numAlive = scanLast + (lastBounces > 0 ? 1 : 0);
+	if (numAlive <= 0 || numAlive >= n) {
+		return numAlive;
+	}
+
+	int frontBlocks = (numAlive + blockSize - 1) / blockSize;
+	kernIndexDeadFront << <frontBlocks, blockSize, 0, stream >> > (numAlive, paths, dev_scan, dev_deadSlots);
+	int backBlocks = (n - numAlive + blockSize - 1) / blockSize;
+	kernRelocateBackAlive << <backBlocks, blockSize, 0, stream >> > (n, numAlive, paths, dev_scan, dev_deadSlots);
+	return numAlive;
+}
+
+void compactIndicesAsync(const int* in, int* out, PathSegmentSoA paths, int n,
+	int* pinnedCount, cudaStream_t stream)
+{
+	if (n <= 0) {
+		return;
+	}
+	if (scratchCapacity < n) {
+		cudaFree(dev_scan);
+		cudaFree(dev_deadSlots);
+		cudaMalloc(&dev_scan, n * sizeof(int));
+		cudaMalloc(&dev_deadSlots, n * sizeof(int));
+		scratchCapacity = n;
+	}
+	if (dev_numAlive == NULL) {
+		cudaMalloc(&dev_numAlive, sizeof(int));
+	}
+
+	const int blockSize = 128;
+	int numBlocks = (n + blockSize - 1) / blockSize;
+	kernMarkAliveIndexed << <numBlocks, blockSize, 0, stream >> > (n, in, paths, dev_scan);
+	scanDevice(dev_scan, n, stream, 0);
+	kernWriteAliveCount << <1, 1, 0, stream >> > (n, in, paths, dev_scan, dev_numAlive);
+	kernScatterIndices << <numBlocks, blockSize, 0, stream >> > (n, in, paths, dev_scan, dev_numAlive, out);
+	if (pinnedCount != NULL) {
+		cudaMemcpyAsync(pinnedCount, dev_numAlive, sizeof(int), cudaMemcpyDeviceToHost, stream);
+	}
+}
+
+int compactIndices(const int* in, int* out, PathSegmentSoA paths, int n, cudaStream_t stream)
+{
+	if (n <= 0) {
+		return 0;
+	}
+	compactIndicesAsync(in, out, paths, n, NULL, stream);
+	int numAlive = 0;
+	cudaMemcpyAsync(&numAlive, dev_numAlive, sizeof(int), cudaMemcpyDeviceToHost, stream);
+	cudaStreamSynchronize(stream);
+	return numAlive;
+}
+
+void cleanup()
+{
+	cudaFree(dev_scan);
+	dev_scan = NULL;
+	cudaFree(dev_deadSlots);
+	dev_deadSlots = NULL;
+	cudaFree(dev_numAlive);
+	dev_numAlive = NULL;
+	scratchCapacity = 0;
+	for (int* sums : dev_levelSums) {
+		cudaFree(sums);
+	}
+	dev_levelSums.clear();
+	levelCapacities.clear();
+}
+
+}
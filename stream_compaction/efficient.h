@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cuda_runtime.h>
+#include "../src/sceneStructs.h"
+
+namespace StreamCompaction {
+
+/**
+ * Compact the live paths (remainingBounces > 0) of the first n slots into
+ * the front of the SoA streams and return how many there are. Order is NOT
+ * preserved: only the live paths currently stranded behind dead slots are
+ * moved, into the dead slots ahead of them, so the copy volume is the
+ * minimum possible and no ping-pong buffers are needed. The ranks driving
+ * those moves come from a work-efficient exclusive scan of the liveness
+ * flags (see efficient.cu).
+ *
+ * Scratch buffers are cached inside the library and grown on demand; call
+ * cleanup() at teardown.
+ */
+int compactActivePaths(PathSegmentSoA paths, int n, cudaStream_t stream);
+
+/**
+ * Index-based variant: compact the n path slot indices of `in` whose path
+ * is still live into `out` (stable, scan + scatter) and return how many
+ * survived; a NULL `in` means the identity order. Only 4 bytes move per
+ * path and every consumer that reads through the index buffer stays
+ * consistent with every other by construction; the path and intersection
+ * streams themselves never move.
+ */
+int compactIndices(const int* in, int* out, PathSegmentSoA paths, int n, cudaStream_t stream);
+
+/**
+ * Fully asynchronous variant of compactIndices: everything stays on the
+ * stream, nothing syncs. `out` receives a complete permutation of the input
+ * (live slot ids first, dead ones behind them), so launches sized with a
+ * stale over-count remain safe — the extra threads land on dead slots. The
+ * live count is written to `pinnedCount` (page-locked host memory) by an
+ * async copy enqueued last; pass NULL to skip the readback.
+ */
+void compactIndicesAsync(const int* in, int* out, PathSegmentSoA paths, int n,
+    int* pinnedCount, cudaStream_t stream);
+
+/**
+ * In-place LSD radix sort of n 32-bit keys with paired 32-bit values:
+ * 4-bit digits, per-tile shared-memory histograms, a stable binary-split
+ * local sort so the global scatter writes coalesced runs, and one pass of
+ * the exclusive scan above over the digit counts per digit (see
+ * efficient.cu). `endBit` bounds the key range so callers with narrow keys
+ * (material ids) only pay for the passes they need; pass 32 for arbitrary
+ * keys. `scratch` is caller-owned device memory of sortPairsScratchBytes(n)
+ * bytes — the path tracer carves it from its arena once — so steady-state
+ * sorts allocate nothing. Everything stays on the stream.
+ */
+size_t sortPairsScratchBytes(int n);
+void sortPairs(unsigned int* keys, int* values, int n, int endBit,
+    void* scratch, cudaStream_t stream);
+
+/**
+ * Release the cached scratch buffers.
+ */
+void cleanup();
+
+}
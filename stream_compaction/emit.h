@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cuda_runtime.h>
+
+namespace StreamCompaction {
+
+/**
+ * Warp-aggregated emission: claim one slot on a shared append counter.
+ * The active lanes of the warp are batched into a single atomic - the
+ * first active lane adds the whole group's count and shuffles the base
+ * offset back, and every lane takes base plus its rank among the active
+ * lanes - so a warp appending together costs one global atomic instead
+ * of up to 32 serialized ones. Safe under divergence: the mask comes
+ * from __activemask(), so only the lanes that actually arrived take
+ * part. Slots within a warp land in lane order, not arrival order,
+ * which no consumer of an unordered append list can observe. Assumes
+ * the 1-D blocks every kernel here launches with.
+ */
+__device__ __forceinline__ int warpEmit(int* counter) {
+    unsigned mask = __activemask();
+    int lane = threadIdx.x & 31;
+    int leader = __ffs(mask) - 1;
+    int base;
+    if (lane == leader) {
+        base = atomicAdd(counter, __popc(mask));
+    }
+    base = __shfl_sync(mask, base, leader);
+    return base + __popc(mask & ((1u << lane) - 1u));
+}
+
+}